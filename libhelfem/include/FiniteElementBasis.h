@@ -28,6 +28,10 @@ namespace helfem {
     protected:
       /// Polynomial basis
       std::shared_ptr<const polynomial_basis::PolynomialBasis> poly;
+      /// Polynomial basis of each element, empty if all use poly
+      std::vector< std::shared_ptr<const polynomial_basis::PolynomialBasis> > el_poly;
+      /// Polynomial basis used in the element
+      const polynomial_basis::PolynomialBasis & element_poly(size_t iel) const;
 
       /// Element boundary values
       arma::vec bval;
@@ -53,12 +57,29 @@ namespace helfem {
       /// Used basis function indices in element
       arma::uvec basis_indices(size_t iel) const;
 
+      /// Derivatives of the functions tabulated at a fixed set of points
+      struct Tabulation {
+        /// The points in primitive coordinates
+        arma::vec x;
+        /// Values of the nth derivative in each element, dnf[n][iel]
+        std::vector< std::vector<arma::mat> > dnf;
+      };
+      /// The tabulations
+      std::vector<Tabulation> tables;
+      /// Find the tabulation at the given points, NULL if there is none
+      const Tabulation * find_table(const arma::vec & x) const;
+
     public:
       /// Dummy constructor
       FiniteElementBasis();
       /// Constructor
       FiniteElementBasis(const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly,
                          const arma::vec &bval, bool zero_func_left, bool zero_deriv_left, bool zero_func_right, bool zero_deriv_right);
+      /// Constructor with a polynomial basis for every element, e.g. of
+      /// different order. Neighbouring elements must share the same
+      /// number of overlapping functions.
+      FiniteElementBasis(const std::vector< std::shared_ptr<const polynomial_basis::PolynomialBasis> > &polys,
+                         const arma::vec &bval, bool zero_func_left, bool zero_deriv_left, bool zero_func_right, bool zero_deriv_right);
       /// Destructor
       ~FiniteElementBasis();
 
@@ -75,6 +96,10 @@ namespace helfem {
       int get_poly_id() const;
       /// Get the number of nodes in the polynomial basis
       int get_poly_nnodes() const;
+      /// Get the number of nodes in the polynomial basis of each element
+      arma::ivec get_element_nnodes() const;
+      /// Do the elements use polynomial bases of different order?
+      bool mixed_order() const;
 
       /// Get the used subset of primitives in the element
       arma::mat get_basis(const arma::mat &bas, size_t iel) const;
@@ -142,6 +167,18 @@ namespace helfem {
       /// Evaluate nth derivative
       arma::mat eval_dnf(const arma::vec & x, int n, size_t iel) const;
 
+      /**
+       * Tabulate the functions and their derivatives up to order nder
+       * at the points x, typically a quadrature rule, in all
+       * elements. Evaluations at these points are then table lookups.
+       * The tables are built once and only read afterwards, so they
+       * can be used from any number of threads; adding a boundary
+       * discards them.
+       */
+      void tabulate(const arma::vec & x, int nder);
+      /// Get the tabulated nth derivative at x in element iel
+      const arma::mat & tabulated_dnf(const arma::vec & x, int n, size_t iel) const;
+
       /**
        * Compute matrix elements in the finite element basis <lh|f|rh>
        *
@@ -179,6 +216,8 @@ namespace helfem {
       arma::mat matrix_element(const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
       /// The driver function
       arma::mat matrix_element(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
+      /// Same as above, but the weight function f(r) is evaluated for all quadrature points at once
+      arma::mat matrix_element(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<arma::vec(const arma::vec &)> & f) const;
 
       /**
        * Compute vector elements in the finite element basis <bf|f>
@@ -192,6 +231,34 @@ namespace helfem {
       /// The driver function
       arma::vec vector_element(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_bf, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const;
 
+      /**
+       * Templated versions of the single element drivers, which avoid
+       * the std::function dispatch. The evaluators are called as
+       * eval(xq, iel) and may return the basis function values by
+       * reference; the weight is called once for all the quadrature
+       * points as f(r), returning an arma::vec.
+       */
+      template<typename LH, typename RH, typename W>
+      arma::mat matrix_element_inline(size_t iel, const LH & eval_lh, const RH & eval_rh, const arma::vec & xq, const arma::vec & wq, const W & f) const {
+        arma::vec wp(wq*scaling_factor(iel));
+        wp%=f(eval_coord(xq, iel));
+        return weighted_product(eval_lh(xq, iel), wp, eval_rh(xq, iel));
+      }
+      /// Same as above, with unit weight
+      template<typename LH, typename RH>
+      arma::mat matrix_element_inline(size_t iel, const LH & eval_lh, const RH & eval_rh, const arma::vec & xq, const arma::vec & wq) const {
+        return weighted_product(eval_lh(xq, iel), wq*scaling_factor(iel), eval_rh(xq, iel));
+      }
+      /// Templated version of the single element vector driver
+      template<typename BF, typename W>
+      arma::vec vector_element_inline(size_t iel, const BF & eval_bf, const arma::vec & xq, const arma::vec & wq, const W & f) const {
+        arma::vec wp(wq*scaling_factor(iel));
+        wp%=f(eval_coord(xq, iel));
+        return arma::trans(eval_bf(xq, iel))*wp;
+      }
+      /// Computes lh^T diag(w) rh
+      static arma::mat weighted_product(const arma::mat & lh, const arma::vec & w, const arma::mat & rh);
+
       /// Print out the basis functions
       void print(const std::string & str="") const;
     };
@@ -36,6 +36,10 @@ namespace helfem {
       ~GaussianNucleus();
       /// Potential
       double V(double r) const override;
+      /// Potential at a batch of points
+      arma::vec V(const arma::vec & r) const override;
+      /// Radii where the element integrals are split
+      std::vector<double> breakpoints() const override;
       /// Get mu
       double get_mu() const;
       /// Set mu
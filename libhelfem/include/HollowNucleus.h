@@ -33,6 +33,10 @@ namespace helfem {
       ~HollowNucleus();
       /// Potential
       double V(double r) const override;
+      /// Potential at a batch of points
+      arma::vec V(const arma::vec & r) const override;
+      /// Radii where the element integrals are split
+      std::vector<double> breakpoints() const override;
       /// Get R
       double get_R() const;
       /// Set R
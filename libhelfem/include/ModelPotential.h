@@ -17,6 +17,7 @@
 #define MODELPOTENTIAL_MODELPOTENTIAL_H
 
 #include <armadillo>
+#include <vector>
 
 namespace helfem {
   namespace modelpotential {
@@ -30,8 +31,16 @@ namespace helfem {
 
       /// Potential
       virtual double V(double r) const=0;
-      /// Potential
-      arma::vec V(const arma::vec & r) const;
+      /// Potential at a batch of points; defaults to a loop over the scalar version
+      virtual arma::vec V(const arma::vec & r) const;
+      /**
+       * Radii at which the potential is not smooth, or beyond which it
+       * is the Coulomb potential of the full charge to machine
+       * precision. Element integrals are split at these radii, so
+       * that each piece of the integrand is a polynomial times a
+       * smooth function. Defaults to none.
+       */
+      virtual std::vector<double> breakpoints() const;
     };
   }
 }
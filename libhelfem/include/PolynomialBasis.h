@@ -67,7 +67,7 @@ namespace helfem {
       virtual void drop_last(bool zero_func, bool zero_deriv)=0;
 
       /// Evaluate nth derivatives of polynomials at given points
-      void eval_dnf(const arma::vec & x, arma::mat & dnf, int n, double element_length) const;
+      virtual void eval_dnf(const arma::vec & x, arma::mat & dnf, int n, double element_length) const;
       /// Evaluate nth derivatives of polynomials at given points
       arma::mat eval_dnf(const arma::vec & x, int n, double element_length) const;
 
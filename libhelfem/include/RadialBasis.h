@@ -19,6 +19,7 @@
 #include "ModelPotential.h"
 #include "FiniteElementBasis.h"
 #include <armadillo>
+#include <map>
 
 namespace helfem {
   namespace atomic {
@@ -42,9 +43,38 @@ namespace helfem {
 
         /// Derivatives of basis functions at origin
         std::vector<arma::rowvec> taylor_df;
+        /// Taylor series of B(r)/r and its first two derivatives at
+        /// the origin in Horner order: row k multiplies r^k
+        std::vector<arma::mat> taylor_horner;
+        /// Form the Horner coefficients from taylor_df
+        void set_taylor_horner();
         /// Set the cutoff
         void set_small_r_taylor_cutoff();
 
+        /// Basis function values at the quadrature points in each element
+        std::vector<arma::mat> bf_xq;
+        /// Basis function derivatives at the quadrature points in each element
+        std::vector<arma::mat> df_xq;
+        /// Basis function Laplacians at the quadrature points in each element
+        std::vector<arma::mat> lf_xq;
+        /// Evaluator for the matrix element kernels that returns the tabulated values
+        struct TabulatedBF {
+          /// The tabulated values
+          const std::vector<arma::mat> & bf;
+          /// Values in element iel
+          const arma::mat & operator()(const arma::vec &, size_t iel) const { return bf[iel]; }
+        };
+        /// Get the evaluator of the tabulated values
+        TabulatedBF tabulated_bf() const { return TabulatedBF{bf_xq}; }
+        /// Cached radial moments <r^n> for each element, keyed by n
+        mutable std::map<int, std::vector<arma::mat>> moments;
+        /// Compute radial moments in all elements
+        std::vector<arma::mat> compute_radial_moments(int n) const;
+        /// Cached spherical potentials for each element
+        mutable std::vector<arma::mat> sph_potentials;
+        /// Compute the spherical potential in an element
+        arma::mat compute_spherical_potential(size_t iel) const;
+
       public:
         /// Dummy constructor
         RadialBasis();
@@ -69,6 +99,8 @@ namespace helfem {
         int get_poly_id() const;
         /// Get number of nodes in polynomial basis
         int get_poly_nnodes() const;
+        /// Get the number of nodes in the polynomial basis of each element
+        arma::ivec get_element_nnodes() const;
         /// Get small r Taylor cutoff
         double get_small_r_taylor_cutoff() const;
         /// Get the order of the Taylor series
@@ -99,13 +131,17 @@ namespace helfem {
         arma::mat radial_integral(const arma::mat &bf_c, int n,
                                   size_t iel) const;
         /// Compute radial matrix elements <r^n> in element (overlap is n=0,
-        /// nuclear is n=-1)
+        /// nuclear is n=-1). The moments are cached on first use.
         arma::mat radial_integral(int n, size_t iel) const;
+        /// Compute the missing radial moments for the listed n in parallel
+        void precompute_radial_moments(const std::vector<int> & nlist) const;
 
         /// Compute Bessel i_L integral
         arma::mat bessel_il_integral(int L, double lambda, size_t iel) const;
         /// Compute Bessel k_L integral
         arma::mat bessel_kl_integral(int L, double lambda, size_t iel) const;
+        /// Compute the Bessel i_L and k_L integrals for all L <= Lmax at once
+        void bessel_integrals(int Lmax, double lambda, size_t iel, std::vector<arma::mat> & il, std::vector<arma::mat> & kl) const;
 
         /// Compute overlap matrix in element
         arma::mat overlap(size_t iel) const;
@@ -118,6 +154,8 @@ namespace helfem {
         arma::mat nuclear(size_t iel) const;
 	/// Compute exponential confinement potential matrix in element
 	arma::mat exponential_confinement(size_t iel, int N, double r_0) const;
+	/// Compute derivative of exponential confinement potential matrix wrt r_0 in element
+	arma::mat exponential_confinement_derivative(size_t iel, int N, double r_0) const;
         /// Compute model potential matrix in element
         arma::mat model_potential(const modelpotential::ModelPotential *nuc,
                                   size_t iel) const;
@@ -131,7 +169,8 @@ namespace helfem {
         /// Compute primitive complementary error function two-electron integral
         arma::mat erfc_integral(int L, double lambda, size_t iel,
                                 size_t jel) const;
-        /// Compute a spherically symmetric potential
+        /// Compute a spherically symmetric potential. The potentials of
+        /// all elements are computed in parallel and cached on first use.
         arma::mat spherical_potential(size_t iel) const;
 
         /// Compute cross-basis integral
@@ -161,6 +200,16 @@ namespace helfem {
 
         /// Evaluate orbitals at a given point
         arma::vec eval_orbs(const arma::mat & C, double r) const;
+        /// Primitive coordinates of radii in element
+        arma::vec get_prim(const arma::vec & r, size_t iel) const;
+        /// Sort a set of radii by element: the indices of the points
+        /// in each element. Points beyond the last element are left out.
+        std::vector<arma::uvec> sort_points(const arma::vec & r) const;
+        /// Evaluate orbitals at a set of points: Npoints x Norbs. Each
+        /// element is evaluated once for all of its points.
+        arma::mat eval_orbs(const arma::mat & C, const arma::vec & r) const;
+        /// Evaluate P_uv B_u(r) B_v(r) at a set of points
+        arma::vec eval_density(const arma::mat & P, const arma::vec & r) const;
 
         /// Get quadrature weights
         arma::vec get_wrad(size_t iel) const;
@@ -177,6 +226,8 @@ namespace helfem {
         double nuclear_density_gradient(const arma::mat &P) const;
         /// Evaluate orbitals at nucleus
         arma::rowvec nuclear_orbital(const arma::mat &C) const;
+        /// Derivative of the energy wrt a hard wall at the end of the last element, as a matrix in the last element
+        arma::mat hard_wall_derivative() const;
       };
     } // namespace basis
   }   // namespace atomic
@@ -35,6 +35,10 @@ namespace helfem {
       ~RegularizedNucleus();
       /// Potential
       double V(double r) const override;
+      /// Potential at a batch of points
+      arma::vec V(const arma::vec & r) const override;
+      /// Radii where the element integrals are split
+      std::vector<double> breakpoints() const override;
       /// Get a
       double get_a() const;
       /// Get b
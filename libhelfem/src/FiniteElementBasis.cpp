@@ -31,9 +31,34 @@ namespace helfem {
       check_bf_continuity();
     }
 
+    FiniteElementBasis::FiniteElementBasis(const std::vector< std::shared_ptr<const polynomial_basis::PolynomialBasis> > & polys,
+                                           const arma::vec &bval_, bool zero_func_left_, bool zero_deriv_left_, bool zero_func_right_, bool zero_deriv_right_) : bval(bval_), zero_func_left(zero_func_left_), zero_deriv_left(zero_deriv_left_), zero_func_right(zero_func_right_), zero_deriv_right(zero_deriv_right_) {
+      if(polys.size()+1 != bval.n_elem)
+        throw std::logic_error("Need a polynomial basis for every element!\n");
+      el_poly.resize(polys.size());
+      size_t imax=0;
+      for(size_t iel=0;iel<polys.size();iel++) {
+        el_poly[iel] = std::shared_ptr<const polynomial_basis::PolynomialBasis>(polys[iel]->copy());
+        if(el_poly[iel]->get_noverlap() != el_poly[0]->get_noverlap())
+          throw std::logic_error("The polynomial bases of all elements must have the same number of overlapping functions!\n");
+        if(el_poly[iel]->get_nprim() > el_poly[imax]->get_nprim())
+          imax=iel;
+      }
+      // The highest order basis stands for the whole basis set
+      poly = el_poly[imax];
+      // Update list of basis functions
+      update_bf_list();
+      // Check that basis functions are continuous
+      check_bf_continuity();
+    }
+
     FiniteElementBasis::~FiniteElementBasis() {
     }
 
+    const polynomial_basis::PolynomialBasis & FiniteElementBasis::element_poly(size_t iel) const {
+      return el_poly.size() ? *el_poly[iel] : *poly;
+    }
+
     void FiniteElementBasis::update_bf_list() {
       if(bval.n_elem==0)
         throw std::logic_error("Can't update basis function list since there are no elements!\n");
@@ -43,7 +68,7 @@ namespace helfem {
       last_func_in_element.zeros(bval.n_elem-1);
       for(size_t iel=0; iel<first_func_in_element.n_elem; iel++) {
         // First func is
-        first_func_in_element[iel] = (iel == 0) ? 0 : last_func_in_element[iel-1] - poly->get_noverlap() + 1;
+        first_func_in_element[iel] = (iel == 0) ? 0 : last_func_in_element[iel-1] - element_poly(iel).get_noverlap() + 1;
         // Last func is
         last_func_in_element[iel] = first_func_in_element[iel] + basis_indices(iel).n_elem - 1;
       }
@@ -127,11 +152,24 @@ namespace helfem {
 
       // Add
       if (!in_bval) {
+        // The split element keeps its polynomial basis in both halves
+        if(el_poly.size()) {
+          if(r > bval(0) && r < bval(bval.n_elem-1)) {
+            size_t iel(find_element(r));
+            el_poly.insert(el_poly.begin()+iel, el_poly[iel]);
+          } else if(r < bval(0)) {
+            el_poly.insert(el_poly.begin(), el_poly.front());
+          } else {
+            el_poly.push_back(el_poly.back());
+          }
+        }
         arma::vec newbval(bval.n_elem + 1);
         newbval.subvec(0, bval.n_elem - 1) = bval;
         newbval(bval.n_elem) = r;
         bval = arma::sort(newbval, "ascend");
         update_bf_list();
+        // The elements have changed
+        tables.clear();
       }
     }
 
@@ -220,6 +258,20 @@ namespace helfem {
       return poly->get_nnodes();
     }
 
+    arma::ivec FiniteElementBasis::get_element_nnodes() const {
+      arma::ivec nnodes(get_nelem());
+      for(size_t iel=0;iel<get_nelem();iel++)
+        nnodes(iel)=element_poly(iel).get_nnodes();
+      return nnodes;
+    }
+
+    bool FiniteElementBasis::mixed_order() const {
+      for(size_t iel=0;iel<el_poly.size();iel++)
+        if(el_poly[iel]->get_nnodes() != poly->get_nnodes())
+          return true;
+      return false;
+    }
+
     arma::uvec FiniteElementBasis::basis_indices(size_t iel) const {
       std::shared_ptr<polynomial_basis::PolynomialBasis> p(get_basis(iel));
       return p->get_enabled();
@@ -232,7 +284,7 @@ namespace helfem {
 
     std::shared_ptr<polynomial_basis::PolynomialBasis>
     FiniteElementBasis::get_basis(size_t iel) const {
-      std::shared_ptr<polynomial_basis::PolynomialBasis> p(poly->copy());
+      std::shared_ptr<polynomial_basis::PolynomialBasis> p(element_poly(iel).copy());
       if (iel == 0)
         p->drop_first(zero_func_left, zero_deriv_left);
       if (iel == bval.n_elem - 2)
@@ -273,6 +325,11 @@ namespace helfem {
     }
 
     void FiniteElementBasis::eval_dnf(const arma::vec & x, arma::mat & dnf, int n, size_t iel) const {
+      const Tabulation * tab(find_table(x));
+      if(tab && n < (int) tab->dnf.size()) {
+        dnf=tab->dnf[n][iel];
+        return;
+      }
       std::shared_ptr<polynomial_basis::PolynomialBasis> p(get_basis(iel));
       p->eval_dnf(x,dnf,n,scaling_factor(iel));
     }
@@ -290,10 +347,61 @@ namespace helfem {
     }
 
     arma::mat FiniteElementBasis::eval_dnf(const arma::vec & x, int n, size_t iel) const {
+      const Tabulation * tab(find_table(x));
+      if(tab && n < (int) tab->dnf.size())
+        return tab->dnf[n][iel];
       std::shared_ptr<polynomial_basis::PolynomialBasis> p(get_basis(iel));
       return p->eval_dnf(x,n,scaling_factor(iel));
     }
 
+    const FiniteElementBasis::Tabulation * FiniteElementBasis::find_table(const arma::vec & x) const {
+      for(size_t it=0;it<tables.size();it++) {
+        const arma::vec & tx(tables[it].x);
+        if(tx.n_elem != x.n_elem)
+          continue;
+        bool match=true;
+        for(size_t i=0;i<x.n_elem && match;i++)
+          match=(tx(i)==x(i));
+        if(match)
+          return &tables[it];
+      }
+      return NULL;
+    }
+
+    void FiniteElementBasis::tabulate(const arma::vec & x, int nder) {
+      if(nder<0)
+        throw std::logic_error("Derivative order must be non-negative!\n");
+      const Tabulation * old(find_table(x));
+      if(old && (int) old->dnf.size() > nder)
+        return;
+
+      Tabulation tab;
+      tab.x=x;
+      tab.dnf.assign(nder+1,std::vector<arma::mat>(get_nelem()));
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
+      for(int n=0;n<=nder;n++)
+        for(size_t iel=0;iel<get_nelem();iel++) {
+          std::shared_ptr<polynomial_basis::PolynomialBasis> p(get_basis(iel));
+          tab.dnf[n][iel]=p->eval_dnf(x,n,scaling_factor(iel));
+        }
+
+      if(old)
+        tables[old-&tables[0]]=tab;
+      else
+        tables.push_back(tab);
+    }
+
+    const arma::mat & FiniteElementBasis::tabulated_dnf(const arma::vec & x, int n, size_t iel) const {
+      const Tabulation * tab(find_table(x));
+      if(!tab || n >= (int) tab->dnf.size())
+        throw std::logic_error("Requested derivative has not been tabulated at these points!\n");
+      if(iel >= tab->dnf[n].size())
+        throw std::logic_error("Element index out of bounds!\n");
+      return tab->dnf[n][iel];
+    }
+
     arma::mat FiniteElementBasis::matrix_element(const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
       // Compute matrix elements in parallel
       std::vector<arma::mat> matel(get_nelem());
@@ -380,6 +488,30 @@ namespace helfem {
       return arma::trans(lhbf)*rhbf;
     }
 
+    arma::mat FiniteElementBasis::matrix_element(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_lh, const std::function<arma::mat(arma::vec,size_t)> & eval_rh, const arma::vec & xq, const arma::vec & wq, const std::function<arma::vec(const arma::vec &)> & f) const {
+      // Get coordinate values
+      arma::vec r(eval_coord(xq, iel));
+      // Calculate total weight per point
+      arma::vec wp(wq*scaling_factor(iel));
+      // Include the function
+      if(f)
+        wp%=f(r);
+
+      // Evaluate basis functions
+      if(!eval_lh)
+        throw std::logic_error("Need function for evaluating left-hand basis functions!\n");
+      arma::mat lhbf = eval_lh(xq, iel);
+      if(!eval_rh)
+        throw std::logic_error("Need function for evaluating right-hand basis functions!\n");
+      arma::mat rhbf = eval_rh(xq, iel);
+
+      // Include weight in the lh operand
+      for(size_t i=0;i<lhbf.n_cols;i++)
+        lhbf.col(i)%=wp;
+
+      return arma::trans(lhbf)*rhbf;
+    }
+
     arma::vec FiniteElementBasis::vector_element(size_t iel, const std::function<arma::mat(arma::vec,size_t)> & eval_bf, const arma::vec & xq, const arma::vec & wq, const std::function<double(double)> & f) const {
       // Get coordinate values
       arma::vec r(eval_coord(xq, iel));
@@ -409,6 +541,14 @@ namespace helfem {
       return vector_element(iel, eval_f, xq, wq, f);
     }
 
+    arma::mat FiniteElementBasis::weighted_product(const arma::mat & lh, const arma::vec & w, const arma::mat & rh) {
+      if(lh.n_rows != w.n_elem || rh.n_rows != w.n_elem)
+        throw std::logic_error("Basis function values and quadrature weights don't match!\n");
+      arma::mat wlh(lh);
+      wlh.each_col()%=w;
+      return arma::trans(wlh)*rh;
+    }
+
     void FiniteElementBasis::print(const std::string & str) const {
       printf("%s",str.c_str());
       bval.print("bval");
@@ -0,0 +1,59 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "FixedLIPBasis.h"
+
+namespace helfem {
+  namespace polynomial_basis {
+    LIPBasis * get_fixed_lip_basis(const arma::vec & x, int id) {
+      switch(x.n_elem) {
+      case(5):
+        return new FixedLIPBasis<5>(x,id);
+      case(6):
+        return new FixedLIPBasis<6>(x,id);
+      case(7):
+        return new FixedLIPBasis<7>(x,id);
+      case(8):
+        return new FixedLIPBasis<8>(x,id);
+      case(9):
+        return new FixedLIPBasis<9>(x,id);
+      case(10):
+        return new FixedLIPBasis<10>(x,id);
+      case(11):
+        return new FixedLIPBasis<11>(x,id);
+      case(12):
+        return new FixedLIPBasis<12>(x,id);
+      case(13):
+        return new FixedLIPBasis<13>(x,id);
+      case(14):
+        return new FixedLIPBasis<14>(x,id);
+      case(15):
+        return new FixedLIPBasis<15>(x,id);
+      case(16):
+        return new FixedLIPBasis<16>(x,id);
+      case(17):
+        return new FixedLIPBasis<17>(x,id);
+      case(18):
+        return new FixedLIPBasis<18>(x,id);
+      case(19):
+        return new FixedLIPBasis<19>(x,id);
+      case(20):
+        return new FixedLIPBasis<20>(x,id);
+      default:
+        return nullptr;
+      }
+    }
+  }
+}
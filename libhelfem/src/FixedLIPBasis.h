@@ -0,0 +1,108 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef POLYNOMIAL_BASIS_FIXEDLIPBASIS_H
+#define POLYNOMIAL_BASIS_FIXEDLIPBASIS_H
+
+#include "LIPBasis.h"
+#include "lip_kernels.h"
+#include <array>
+#include <cmath>
+
+namespace helfem {
+  namespace polynomial_basis {
+    /**
+     * Lagrange interpolating polynomials with the number of nodes N
+     * fixed at compile time. The nodes and barycentric weights are
+     * kept in fixed-size arrays, and the values and derivatives up to
+     * second order are evaluated with fully specialized kernels,
+     * directly into the enabled columns with the element scaling
+     * applied.
+     */
+    template<int N>
+    class FixedLIPBasis: public LIPBasis {
+      /// Nodes
+      std::array<double, N> xn;
+      /// Barycentric weights
+      std::array<double, N> wn;
+
+      /// Evaluate the enabled functions
+      template<int ORDER>
+      void eval_enabled(const arma::vec & x, arma::mat & dnf, double scale) const {
+        dnf.set_size(x.n_elem, enabled.n_elem);
+        lip_kernels::lip_eval_range<ORDER,N>(x,xn.data(),wn.data(),N,enabled(0),enabled(enabled.n_elem-1)+1,scale,dnf.memptr());
+      }
+
+    public:
+      /// Constructor
+      FixedLIPBasis(const arma::vec & x, int id_=4) : LIPBasis(x, id_) {
+        if(x0.n_elem != (arma::uword) N)
+          throw std::logic_error("Number of nodes does not match FixedLIPBasis template.\n");
+        for(int i=0;i<N;i++) {
+          xn[i]=x0(i);
+          wn[i]=bw(i);
+        }
+      }
+      /// Destructor
+      ~FixedLIPBasis() {
+      }
+      /// Get a copy
+      FixedLIPBasis * copy() const override {
+        return new FixedLIPBasis(*this);
+      }
+
+      /// Evaluate polynomials at given points
+      void eval_prim_dnf(const arma::vec & x, arma::mat & dnf, int n, double element_length) const override {
+        dnf.set_size(x.n_elem, N);
+        switch(n) {
+        case(0):
+          lip_kernels::lip_eval_range<0,N>(x,xn.data(),wn.data(),N,0,N,1.0,dnf.memptr());
+          break;
+        case(1):
+          lip_kernels::lip_eval_range<1,N>(x,xn.data(),wn.data(),N,0,N,1.0,dnf.memptr());
+          break;
+        case(2):
+          lip_kernels::lip_eval_range<2,N>(x,xn.data(),wn.data(),N,0,N,1.0,dnf.memptr());
+          break;
+        default:
+          LIPBasis::eval_prim_dnf(x,dnf,n,element_length);
+        }
+      }
+
+      using LIPBasis::eval_dnf;
+      /// Evaluate nth derivatives of the enabled polynomials at given points
+      void eval_dnf(const arma::vec & x, arma::mat & dnf, int n, double element_length) const override {
+        // The enabled functions are always a contiguous range for LIPs
+        switch(n) {
+        case(0):
+          eval_enabled<0>(x,dnf,1.0);
+          break;
+        case(1):
+          eval_enabled<1>(x,dnf,1.0/element_length);
+          break;
+        case(2):
+          eval_enabled<2>(x,dnf,1.0/(element_length*element_length));
+          break;
+        default:
+          LIPBasis::eval_dnf(x,dnf,n,element_length);
+        }
+      }
+    };
+
+    /// Get a fixed-size LIP basis for the given nodes, or nullptr if there is no specialization for the number of nodes
+    LIPBasis * get_fixed_lip_basis(const arma::vec & x, int id);
+  }
+}
+#endif
@@ -36,6 +36,27 @@ namespace helfem {
       }
     }
 
+    arma::vec GaussianNucleus::V(const arma::vec & R) const {
+      const double t0(-Z*M_2_SQRTPI*mu);
+      arma::vec pot(R.n_elem);
+      for(size_t i=0;i<R.n_elem;i++) {
+        if(R(i) <= Rcut) {
+          double mur2 = mu*R(i)*mu*R(i);
+          pot(i) = t0*( 1.0 + (-1.0/3.0 + (1.0/10.0 - 1.0/42.0*mur2)*mur2)*mur2);
+        } else {
+          pot(i) = -Z*erf(mu*R(i))/R(i);
+        }
+      }
+      return pot;
+    }
+
+    std::vector<double> GaussianNucleus::breakpoints() const {
+      // erfc(6) = 2e-17, so the potential is -Z/r beyond mu r = 6.
+      // The inner piece is split once more at the width of the charge
+      // distribution, where erf(mu r)/r changes its behavior.
+      return std::vector<double>({1.0/mu, 6.0/mu});
+    }
+
     double GaussianNucleus::get_mu() const {
       return mu;
     }
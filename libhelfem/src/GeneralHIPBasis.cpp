@@ -29,9 +29,7 @@ namespace helfem {
       nnodes=x.n_elem;
 
       // Construct the necessary LIP basis
-      arma::vec xlip, wlip;
-      ::lobatto_compute(nfuncs,xlip,wlip);
-      lip = polynomial_basis::LIPBasis(xlip);
+      lip = polynomial_basis::LIPBasis(::lobatto_rule(nfuncs).x);
 
       printf("Setting up %i-node %i:th order HIPs from a %i-node LIP basis.\n", nnodes, nder, nfuncs);
 
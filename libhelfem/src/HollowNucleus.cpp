@@ -14,6 +14,7 @@
  * of the License, or (at your option) any later version.
  */
 #include "HollowNucleus.h"
+#include <algorithm>
 
 namespace helfem {
   namespace modelpotential {
@@ -31,6 +32,18 @@ namespace helfem {
       }
     }
 
+    arma::vec HollowNucleus::V(const arma::vec & r) const {
+      arma::vec pot(r.n_elem);
+      for(size_t i=0;i<r.n_elem;i++)
+        pot(i) = -Z/std::max(r(i),R);
+      return pot;
+    }
+
+    std::vector<double> HollowNucleus::breakpoints() const {
+      // The potential is constant inside the shell
+      return std::vector<double>({R});
+    }
+
     double HollowNucleus::get_R() const {
       return R;
     }
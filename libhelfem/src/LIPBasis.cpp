@@ -17,6 +17,13 @@ namespace helfem {
       if(std::abs(x(x.n_elem-1)-1)>=sqrt(DBL_EPSILON))
         throw std::logic_error("LIP rightmost node is not at -1!\n");
 
+      // Barycentric weights
+      bw.ones(x0.n_elem);
+      for(size_t i=0;i<x0.n_elem;i++)
+        for(size_t j=0;j<x0.n_elem;j++)
+          if(j!=i)
+            bw(i)/=x0(i)-x0(j);
+
       // One overlapping function
       noverlap=1;
       nprim=x0.n_elem;
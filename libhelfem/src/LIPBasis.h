@@ -26,6 +26,8 @@ namespace helfem {
     protected:
       /// Control nodes
       arma::vec x0;
+      /// Barycentric weights 1/prod_{j!=i} (x0_i - x0_j)
+      arma::vec bw;
     public:
       /// Dummy constructor
       LIPBasis();
@@ -29,5 +29,9 @@ namespace helfem {
         pot(i)=V(r(i));
       return pot;
     }
+
+    std::vector<double> ModelPotential::breakpoints() const {
+      return std::vector<double>();
+    }
   }
 }
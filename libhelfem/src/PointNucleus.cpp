@@ -26,5 +26,9 @@ namespace helfem {
     double PointNucleus::V(double R) const {
       return -Z/R;
     }
+
+    arma::vec PointNucleus::V(const arma::vec & R) const {
+      return -Z/R;
+    }
   }
 }
@@ -17,6 +17,7 @@
 #include "PolynomialBasis.h"
 #include "lobatto.h"
 #include "LIPBasis.h"
+#include "FixedLIPBasis.h"
 #include "HIPBasis.h"
 #include "GeneralHIPBasis.h"
 #include "LegendreBasis.h"
@@ -43,17 +44,17 @@ namespace helfem {
 
       case(4):
         {
-          arma::vec x, w;
-          ::lobatto_compute(Nnodes,x,w);
-          poly=new polynomial_basis::LIPBasis(x,primbas);
+          const arma::vec & x(::lobatto_rule(Nnodes).x);
+          poly=polynomial_basis::get_fixed_lip_basis(x,primbas);
+          if(!poly)
+            poly=new polynomial_basis::LIPBasis(x,primbas);
           printf("Basis set composed of %i-node LIPs with Gauss-Lobatto nodes.\n",Nnodes);
           break;
         }
 
       case(5):
         {
-          arma::vec x, w;
-          ::lobatto_compute(Nnodes,x,w);
+          const arma::vec & x(::lobatto_rule(Nnodes).x);
           poly=new polynomial_basis::HIPBasis(x,primbas);
           printf("Basis set composed of %i-node HIPs with Gauss-Lobatto nodes.\n",Nnodes);
           break;
@@ -66,8 +67,7 @@ namespace helfem {
       case(10):
       case(11):
         {
-          arma::vec x, w;
-          ::lobatto_compute(Nnodes,x,w);
+          const arma::vec & x(::lobatto_rule(Nnodes).x);
           int nder=primbas-6;
           poly=new polynomial_basis::GeneralHIPBasis(x,primbas,nder);
           printf("Basis set composed of %i-node %i:th order HIPs with Gauss-Lobatto nodes.\n",Nnodes,nder);
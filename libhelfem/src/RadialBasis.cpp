@@ -19,6 +19,7 @@
 #include "quadrature.h"
 #include "utils.h"
 #include <cfloat>
+#include <algorithm>
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -51,10 +52,25 @@ namespace helfem {
           // first derivative etc.
           taylor_df[i] = fem.eval_dnf(origin, i+1, iel);
         }
+        set_taylor_horner();
 
         // Adjust cutoff
         set_small_r_taylor_cutoff();
 
+        // Tabulate the primitive functions and the basis functions
+        // at the quadrature points; these are needed by all the
+        // matrix element routines and the density grids. The Taylor
+        // series near the origin is folded into the tables, so the
+        // first element needs no special handling afterwards.
+        fem.tabulate(xq, 2);
+        bf_xq.resize(fem.get_nelem());
+        df_xq.resize(fem.get_nelem());
+        lf_xq.resize(fem.get_nelem());
+        for(size_t iel=0;iel<fem.get_nelem();iel++) {
+          bf_xq[iel]=get_bf(xq, iel);
+          df_xq[iel]=get_df(xq, iel);
+          lf_xq[iel]=get_lf(xq, iel);
+        }
       }
 
       void RadialBasis::set_small_r_taylor_cutoff() {
@@ -175,6 +191,10 @@ namespace helfem {
         return fem.get_poly_nnodes();
       }
 
+      arma::ivec RadialBasis::get_element_nnodes() const {
+        return fem.get_element_nnodes();
+      }
+
       double RadialBasis::get_small_r_taylor_cutoff() const {
         return small_r_taylor_cutoff;
       }
@@ -187,25 +207,107 @@ namespace helfem {
         return taylor_diff;
       }
 
-      arma::mat RadialBasis::radial_integral(int Rexp, size_t iel) const {
-        std::function<double(double)> rpowL = [Rexp](double r){return std::pow(r,Rexp+2);};
-        std::function<arma::mat(const arma::vec &,size_t)> radial_bf;
-        radial_bf = [this](const arma::vec & xq_, size_t iel_) { return this->get_bf(xq_, iel_); };
-        arma::mat ret(fem.matrix_element(iel, radial_bf, radial_bf, xq, wq, rpowL));
+      arma::mat RadialBasis::radial_integral(const arma::mat & bf_c, int Rexp, size_t iel) const {
+        // Radii and total weight per point
+        arma::vec r(fem.eval_coord(xq, iel));
+        arma::vec wp(wq*fem.scaling_factor(iel));
+        wp%=arma::pow(r,Rexp+2);
+
+        // Include weight in the lh operand
+        arma::mat lhbf(bf_c);
+        for(size_t i=0;i<lhbf.n_cols;i++)
+          lhbf.col(i)%=wp;
+
+        arma::mat ret(arma::trans(lhbf)*bf_c);
         if(ret.has_nan()) {
           printf("radial_integral(%i,%i) has NaN!\n",Rexp,(int) iel);
         }
         return ret;
       }
 
+      std::vector<arma::mat> RadialBasis::compute_radial_moments(int Rexp) const {
+        std::vector<arma::mat> mom(fem.get_nelem());
+        for(size_t iel=0;iel<fem.get_nelem();iel++)
+          mom[iel]=radial_integral(bf_xq[iel], Rexp, iel);
+        return mom;
+      }
+
+      arma::mat RadialBasis::radial_integral(int Rexp, size_t iel) const {
+        arma::mat ret;
+#ifdef _OPENMP
+#pragma omp critical(radial_moments)
+#endif
+        {
+          std::map<int, std::vector<arma::mat>>::const_iterator it(moments.find(Rexp));
+          if(it == moments.end())
+            it = moments.insert(std::make_pair(Rexp, compute_radial_moments(Rexp))).first;
+          ret = it->second[iel];
+        }
+        return ret;
+      }
+
+      void RadialBasis::precompute_radial_moments(const std::vector<int> & nlist) const {
+#ifdef _OPENMP
+#pragma omp critical(radial_moments)
+#endif
+        {
+          // Moments that have not been computed yet
+          std::vector<int> todo;
+          for(size_t i=0;i<nlist.size();i++)
+            if(moments.find(nlist[i]) == moments.end() && std::find(todo.begin(),todo.end(),nlist[i]) == todo.end())
+              todo.push_back(nlist[i]);
+
+          // All (n, element) pairs are independent
+          const size_t Nel(fem.get_nelem());
+          std::vector< std::vector<arma::mat> > mom(todo.size(), std::vector<arma::mat>(Nel));
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
+          for(size_t i=0;i<todo.size();i++)
+            for(size_t iel=0;iel<Nel;iel++)
+              mom[i][iel]=radial_integral(bf_xq[iel], todo[i], iel);
+
+          for(size_t i=0;i<todo.size();i++)
+            moments.insert(std::make_pair(todo[i], mom[i]));
+        }
+      }
+
       arma::mat RadialBasis::bessel_il_integral(int L, double lambda, size_t iel) const {
-        std::function<double(double)> besselil = [L, lambda](double r) { return utils::bessel_il(r*lambda, L); };
-        return fem.matrix_element(iel, false, false, xq, wq, besselil);
+        auto besselil = [L, lambda](const arma::vec & r) {
+          arma::vec il(r.n_elem);
+          for(size_t i=0;i<r.n_elem;i++)
+            il(i)=utils::bessel_il(r(i)*lambda, L);
+          return il;
+        };
+        auto fbf = [this](const arma::vec & x, size_t iel_) { return this->fem.eval_f(x, iel_); };
+        return fem.matrix_element_inline(iel, fbf, fbf, xq, wq, besselil);
       }
 
       arma::mat RadialBasis::bessel_kl_integral(int L, double lambda, size_t iel) const {
-        std::function<double(double)> besselkl = [L, lambda](double r) { return utils::bessel_kl(r*lambda, L); };
-        return fem.matrix_element(iel, false, false, xq, wq, besselkl);
+        auto besselkl = [L, lambda](const arma::vec & r) {
+          arma::vec kl(r.n_elem);
+          for(size_t i=0;i<r.n_elem;i++)
+            kl(i)=utils::bessel_kl(r(i)*lambda, L);
+          return kl;
+        };
+        auto fbf = [this](const arma::vec & x, size_t iel_) { return this->fem.eval_f(x, iel_); };
+        return fem.matrix_element_inline(iel, fbf, fbf, xq, wq, besselkl);
+      }
+
+      void RadialBasis::bessel_integrals(int Lmax, double lambda, size_t iel, std::vector<arma::mat> & il, std::vector<arma::mat> & kl) const {
+        // Bessel functions at the quadrature points for all L
+        arma::vec lr(fem.eval_coord(xq, iel)*lambda);
+        arma::mat ilr(utils::bessel_il_array(lr, Lmax));
+        arma::mat klr(utils::bessel_kl_array(lr, Lmax));
+
+        arma::vec wp(wq*fem.scaling_factor(iel));
+        const arma::mat & bf(bf_xq[iel]);
+        il.resize(Lmax+1);
+        kl.resize(Lmax+1);
+        for(int L=0;L<=Lmax;L++) {
+          il[L]=polynomial_basis::FiniteElementBasis::weighted_product(bf, wp%ilr.col(L), bf);
+          kl[L]=polynomial_basis::FiniteElementBasis::weighted_product(bf, wp%klr.col(L), bf);
+        }
       }
 
       arma::mat RadialBasis::radial_integral(const RadialBasis &rh, int n, bool lhder,
@@ -309,62 +411,118 @@ namespace helfem {
       }
 
       arma::mat RadialBasis::kinetic(size_t iel) const {
-        std::function<double(double)> dummy;
-        return 0.5*fem.matrix_element(iel, true, true, xq, wq, dummy);
+        auto dbf = [this](const arma::vec & x, size_t iel_) { return this->fem.eval_df(x, iel_); };
+        return 0.5*fem.matrix_element_inline(iel, dbf, dbf, xq, wq);
       }
 
       arma::mat RadialBasis::kinetic_l(size_t iel) const {
-        std::function<double(double)> dummy;
-        std::function<arma::mat(const arma::vec &,size_t)> radial_bf;
-        radial_bf = [this](const arma::vec & xq_, size_t iel_) { return this->get_bf(xq_, iel_); };
-
-        return 0.5 * fem.matrix_element(iel, radial_bf, radial_bf, xq, wq, dummy);
+        return 0.5 * fem.matrix_element_inline(iel, tabulated_bf(), tabulated_bf(), xq, wq);
       }
 
       arma::mat RadialBasis::nuclear(size_t iel) const {
-        std::function<double(double)> r = [](double r){return r;};
-        std::function<arma::mat(const arma::vec &,size_t)> radial_bf;
-        radial_bf = [this](const arma::vec & xq_, size_t iel_) { return this->get_bf(xq_, iel_); };
-        return -fem.matrix_element(iel, radial_bf, radial_bf, xq, wq, r);
-      }
+        auto r = [](const arma::vec & r_) -> const arma::vec & { return r_; };
+        return -fem.matrix_element_inline(iel, tabulated_bf(), tabulated_bf(), xq, wq, r);
+      }
+
+      arma::vec exponential_remainder(const arma::vec & x, int N) {
+        // Computes N! (exp(x) - sum_{k<N} x^k/k!)
+        arma::vec R(x.n_elem);
+
+        // For x < N+1 the subtraction suffers from cancellation, so use
+        // the series of the remainder x^N sum_j x^j N!/(N+j)! instead;
+        // its terms decrease monotonically for such x
+        arma::uvec small(arma::find(x < N+1.0));
+        if(small.n_elem) {
+          arma::vec xs(x(small));
+          arma::vec term(arma::ones<arma::vec>(xs.n_elem));
+          arma::vec sum(term);
+          for(int j=1; j<1000; j++) {
+            term%=xs/(N+j);
+            sum+=term;
+            if(arma::max(term) <= DBL_EPSILON)
+              break;
+          }
+          R(small)=arma::pow(xs,N)%sum;
+        }
+
+        // Elsewhere the direct formula is stable
+        arma::uvec large(arma::find(x >= N+1.0));
+        if(large.n_elem) {
+          arma::vec xl(x(large));
+          // Truncated Taylor series by Horner's rule
+          arma::vec poly(xl.n_elem, arma::fill::zeros);
+          if(N>0) {
+            poly.ones();
+            for(int k=N-1; k>=1; k--)
+              poly = 1.0 + poly%xl/k;
+          }
+          double fact=1.0;
+          for(int k=1; k<=N; k++)
+            fact*=k;
+          R(large)=fact*(arma::exp(xl)-poly);
+        }
 
-      int factorial(int n) {
-	if (n==0)
-	  return 1;
-	int fact=1;
-	for (int k=0; k<n; k++)
-	  fact *= k+1;
-	return fact;
+        return R;
       }
 
       arma::mat RadialBasis::exponential_confinement(size_t iel, int N, double r_0) const {
-	std::function<double(double)> r_exp = [r_0, N](double r) {
-	  const double r_ratio = r/r_0;
-	  double fact = 1.0;
-	  
-	  double V=0.0;
-	  double r_ratio_pow_k = 1.0;
-	  for (int k=0; k<N; k++) {
-	    // r^k / k!
-	    V -= r_ratio_pow_k / fact;
-	    // Prepare values for next iteration
-	    fact *= k+1;
-	    r_ratio_pow_k *= r_ratio;
-	  }
-	  V += std::exp(r_ratio);
-	  V *= factorial(N);
-	  V *= std::pow(r, 2);
-	  return V;
+	auto r_exp = [r_0, N](const arma::vec & r) {
+	  // N! (exp(r/r_0) - sum_{k<N} (r/r_0)^k/k!) r^2
+	  arma::vec V(exponential_remainder(r/r_0, N));
+	  return arma::vec(V%arma::square(r));
+	};
+	return fem.matrix_element_inline(iel, tabulated_bf(), tabulated_bf(), xq, wq, r_exp);
+      }
+
+      arma::mat RadialBasis::exponential_confinement_derivative(size_t iel, int N, double r_0) const {
+	auto r_exp = [r_0, N](const arma::vec & r) {
+	  // d/dr_0 of the above is -r/r_0^2 N! (exp(r/r_0) - sum_{k<N-1} (r/r_0)^k / k!) r^2
+	  arma::vec x(r/r_0);
+	  arma::vec dV(-N*exponential_remainder(x, N-1)%x/r_0);
+	  return arma::vec(dV%arma::square(r));
 	};
-	std::function<arma::mat(const arma::vec &, size_t)> radial_bf;
-	radial_bf = [this](const arma::vec & xq_, size_t iel_) { return this->get_bf(xq_, iel_); };
-	return fem.matrix_element(iel, radial_bf, radial_bf, xq, wq, r_exp);
+	return fem.matrix_element_inline(iel, tabulated_bf(), tabulated_bf(), xq, wq, r_exp);
       }
 
       arma::mat RadialBasis::model_potential(const modelpotential::ModelPotential *model,
                                              size_t iel) const {
-        std::function<double(double)> modelpot = [model](double r) { return model->V(r); };
-        return fem.matrix_element(iel, false, false, xq, wq, modelpot);
+        // Element limits and the breakpoints of the model inside the element
+        const double rmin(fem.element_begin(iel));
+        const double rmax(fem.element_end(iel));
+        std::vector<double> lim(1,rmin);
+        std::vector<double> breaks(model->breakpoints());
+        std::sort(breaks.begin(), breaks.end());
+        for(double r: breaks)
+          if(r > rmin && r < rmax)
+            lim.push_back(r);
+        lim.push_back(rmax);
+
+        if(lim.size()==2) {
+          // The potential is smooth in the whole element
+          auto modelpot = [model](const arma::vec & r) { return model->V(r); };
+          auto fbf = [this](const arma::vec & x, size_t iel_) { return this->fem.eval_f(x, iel_); };
+          return fem.matrix_element_inline(iel, fbf, fbf, xq, wq, modelpot);
+        }
+
+        // Integrate over each smooth piece separately, with the
+        // quadrature rule mapped onto the piece. Inside a uniformly
+        // charged or hollow nucleus the integrand is a polynomial, and
+        // the rule is exact for it.
+        arma::mat V;
+        for(size_t ip=0; ip+1<lim.size(); ip++) {
+          const double mid(0.5*(lim[ip+1]+lim[ip]));
+          const double len(0.5*(lim[ip+1]-lim[ip]));
+          arma::vec r(mid + len*xq);
+          arma::mat bf(fem.eval_f(fem.eval_prim(r, iel), iel));
+          arma::vec w(wq*len);
+          w %= model->V(r);
+          arma::mat piece(polynomial_basis::FiniteElementBasis::weighted_product(bf, w, bf));
+          if(ip==0)
+            V=piece;
+          else
+            V+=piece;
+        }
+        return V;
       }
 
       arma::mat RadialBasis::nuclear_offcenter(size_t iel, double Rhalf, int L) const {
@@ -424,8 +582,9 @@ namespace helfem {
         }
 
         // Get lh quadrature points
-        arma::vec xi, wi;
-        chebyshev::chebyshev(Nq, xi, wi);
+        const chebyshev::Rule & rulei(chebyshev::chebyshev_rule(Nq));
+        const arma::vec & xi(rulei.x);
+        const arma::vec & wi(rulei.w);
         // and basis function values
         arma::mat ibf(fem.eval_f(xi, iel));
         double Rmini(fem.element_begin(iel));
@@ -463,7 +622,7 @@ namespace helfem {
         return tei;
       }
 
-      arma::mat RadialBasis::spherical_potential(size_t iel) const {
+      arma::mat RadialBasis::compute_spherical_potential(size_t iel) const {
         double Rmin(fem.element_begin(iel));
         double Rmax(fem.element_end(iel));
 
@@ -474,61 +633,82 @@ namespace helfem {
         return pot;
       }
 
+      arma::mat RadialBasis::spherical_potential(size_t iel) const {
+        arma::mat ret;
+#ifdef _OPENMP
+#pragma omp critical(spherical_potentials)
+#endif
+        {
+          if(sph_potentials.size() != fem.get_nelem()) {
+            std::vector<arma::mat> pot(fem.get_nelem());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+            for(size_t jel=0;jel<pot.size();jel++)
+              pot[jel]=compute_spherical_potential(jel);
+            sph_potentials=pot;
+          }
+          ret = sph_potentials[iel];
+        }
+        return ret;
+      }
+
       arma::mat RadialBasis::get_bf(size_t iel) const {
+        // Values at the quadrature points have been tabulated
+        if(iel < bf_xq.size())
+          return bf_xq[iel];
         return get_bf(xq, iel);
       }
 
-      void RadialBasis::get_taylor(const arma::vec & r, const arma::uvec & taylorind, arma::mat & val, int ider) const {
-        if(taylorind[0]!=0 || taylorind[taylorind.n_elem-1] != taylorind.n_elem-1)
-          throw std::logic_error("Taylor points not consecutive!\n");
-
+      void RadialBasis::set_taylor_horner() {
         // The series of B(r)/r is
         //  [B(0) + B'(0)r + 1/2 B''(0) r^2 + ...]/r
         //= B'(0) + 1/2 B''(0) r + 1/6 B'''(0) r^2 + ...
-
-        /*
-        if(taylor_order<3 || taylor_order>9) {
-          std::ostringstream oss;
-          oss << "Got taylor_order = " << taylor_order << ". Taylor expansion order needs to be 3 <= taylor_order <= 9.\n";
-          throw std::logic_error(oss.str());
-        }
-        */
-
-        // Coefficients of the various derivatives in the expansion of
-        // the function itself. Note that the zeroth element already
-        // corresponds to the first derivative!
-        arma::vec taylorcoeff(taylor_order);
-        taylorcoeff(0) = 1.0;
-        for(int i=1; i<taylor_order; i++)
-          taylorcoeff(i) = taylorcoeff(i-1)/(i+1);
-        // and the corresponding r exponents
-        arma::ivec rexp(arma::linspace<arma::ivec>(0,taylor_order-1,taylor_order));
-
-        // Compute derivatives: c r^n -> c n r^(n-1)
-        for(int i=0; i<taylor_order; i++) {
-          for(int d=0; d<ider; d++) {
-            taylorcoeff(i) *= rexp(i);
-            rexp(i)--;
+        // so the coefficient of r^i is B^(i+1)(0)/(i+1)!. Note that
+        // the zeroth element of taylor_df already corresponds to the
+        // first derivative!
+        const size_t nfun(taylor_order>0 ? taylor_df[0].n_elem : 0);
+        taylor_horner.resize(3);
+        for(int ider=0; ider<3; ider++) {
+          // Terms below ider vanish in the derivative
+          int nterm(std::max(taylor_order-ider, 0));
+          taylor_horner[ider].zeros(nterm, nfun);
+
+          double taylorcoeff(1.0);
+          for(int i=0; i<taylor_order; i++) {
+            if(i>0)
+              taylorcoeff /= i+1;
+            if(i<ider)
+              continue;
+            // Compute derivatives: c r^n -> c n r^(n-1)
+            double c(taylorcoeff);
+            for(int d=0; d<ider; d++)
+              c *= i-d;
+            taylor_horner[ider].row(i-ider) = c*taylor_df[i];
           }
         }
+      }
 
-        // Exponentiate r
-        std::vector<arma::vec> rexpval(taylor_order);
-        for(int i=ider; i < taylor_order; i++) {
-          if(rexp[i]<0)
-            throw std::logic_error("This should not have happened!\n");
-          rexpval[i] = arma::pow(r, rexp[i]);
+      void RadialBasis::get_taylor(const arma::vec & r, const arma::uvec & taylorind, arma::mat & val, int ider) const {
+        if(taylorind[0]!=0 || taylorind[taylorind.n_elem-1] != taylorind.n_elem-1)
+          throw std::logic_error("Taylor points not consecutive!\n");
+        if(ider<0 || ider>=(int) taylor_horner.size())
+          throw std::logic_error("Taylor series only available up to the second derivative!\n");
+
+        // Evaluate the series for all functions at once by Horner's rule
+        const arma::mat & coeff(taylor_horner[ider]);
+        const size_t nt(taylorind.n_elem);
+        if(coeff.n_rows == 0) {
+          val.rows(0, nt-1).zeros();
+          return;
         }
-
-        // Collect results
-        for(size_t ifun = 0; ifun < val.n_cols; ifun++)
-          for(size_t ir = 0; ir < taylorind.n_elem; ir++) {
-            val(ir, ifun) = 0.0;
-            // Terms below this are zero
-            for(int iterm=ider;iterm < taylor_order;iterm++) {
-              val(ir, ifun) += taylorcoeff[iterm]*taylor_df[iterm](ifun)*rexpval[iterm](ir);
-            }
-          }
+        arma::vec rt(r.subvec(0, nt-1));
+        arma::mat poly(arma::ones<arma::vec>(nt)*coeff.row(coeff.n_rows-1));
+        for(size_t k=coeff.n_rows-1; k>0; k--) {
+          poly.each_col() %= rt;
+          poly.each_row() += coeff.row(k-1);
+        }
+        val.rows(0, nt-1) = poly;
       }
 
       arma::vec RadialBasis::eval_orbs(const arma::mat & C, double r) const {
@@ -552,6 +732,70 @@ namespace helfem {
         }
       }
 
+      arma::vec RadialBasis::get_prim(const arma::vec & r, size_t iel) const {
+        return fem.eval_prim(r, iel);
+      }
+
+      std::vector<arma::uvec> RadialBasis::sort_points(const arma::vec & r) const {
+        const double rmax(fem.element_end(fem.get_nelem()-1));
+        // Element of each point
+        std::vector<size_t> count(fem.get_nelem(),0);
+        std::vector<size_t> elem(r.n_elem);
+        for(size_t i=0;i<r.n_elem;i++) {
+          if(r(i) > rmax) {
+            elem[i]=count.size();
+            continue;
+          }
+          elem[i]=fem.find_element(r(i));
+          count[elem[i]]++;
+        }
+
+        std::vector<arma::uvec> idx(count.size());
+        for(size_t iel=0;iel<count.size();iel++) {
+          idx[iel].set_size(count[iel]);
+          count[iel]=0;
+        }
+        for(size_t i=0;i<r.n_elem;i++)
+          if(elem[i]<idx.size())
+            idx[elem[i]](count[elem[i]]++)=i;
+
+        return idx;
+      }
+
+      arma::mat RadialBasis::eval_orbs(const arma::mat & C, const arma::vec & r) const {
+        // The wave function is zero outside the basis
+        arma::mat val(r.n_elem, C.n_cols, arma::fill::zeros);
+        std::vector<arma::uvec> idx(sort_points(r));
+        for(size_t iel=0;iel<idx.size();iel++) {
+          if(!idx[iel].n_elem)
+            continue;
+          size_t ifirst, ilast;
+          get_idx(iel, ifirst, ilast);
+          arma::vec rel(r(idx[iel]));
+          val.rows(idx[iel])=get_bf(get_prim(rel, iel), iel)*C.rows(ifirst, ilast);
+        }
+        return val;
+      }
+
+      arma::vec RadialBasis::eval_density(const arma::mat & P, const arma::vec & r) const {
+        if (P.n_rows != Nbf() || P.n_cols != Nbf())
+          throw std::logic_error("eval_density expects a radial density matrix\n");
+
+        arma::vec den(r.n_elem, arma::fill::zeros);
+        std::vector<arma::uvec> idx(sort_points(r));
+        for(size_t iel=0;iel<idx.size();iel++) {
+          if(!idx[iel].n_elem)
+            continue;
+          size_t ifirst, ilast;
+          get_idx(iel, ifirst, ilast);
+          arma::vec rel(r(idx[iel]));
+          arma::mat bf(get_bf(get_prim(rel, iel), iel));
+          // Contract all the points at once: sum_uv B_u P_uv B_v
+          den(idx[iel])=arma::sum((bf*P.submat(ifirst, ifirst, ilast, ilast)) % bf, 1);
+        }
+        return den;
+      }
+
       arma::mat RadialBasis::get_bf(const arma::vec & x, size_t iel) const {
         // Element function values at quadrature points are
         arma::mat val(fem.eval_f(x, iel));
@@ -576,6 +820,9 @@ namespace helfem {
       }
 
       arma::mat RadialBasis::get_df(size_t iel) const {
+        // Values at the quadrature points have been tabulated
+        if(iel < df_xq.size())
+          return df_xq[iel];
         return get_df(xq ,iel);
       }
 
@@ -605,6 +852,9 @@ namespace helfem {
       }
 
       arma::mat RadialBasis::get_lf(size_t iel) const {
+        // Values at the quadrature points have been tabulated
+        if(iel < lf_xq.size())
+          return lf_xq[iel];
         return get_lf(xq, iel);
       }
 
@@ -716,6 +966,18 @@ namespace helfem {
         // C_ui B_u'(0)
         return der * Csub;
       }
+
+      arma::mat RadialBasis::hard_wall_derivative() const {
+        // Coordinate of the wall is the end of the last element
+        arma::vec x(1);
+        x(0) = 1.0;
+
+        // B_u'(R); the functions vanish at the wall
+        arma::mat der(fem.eval_df(x, fem.get_nelem()-1));
+
+        // dE/dR = -1/2 sum_uv P_uv B_u'(R) B_v'(R)
+        return -0.5 * arma::trans(der) * der;
+      }
     } // namespace basis
   } // namespace atomic
 } // namespace helfem
@@ -26,5 +26,9 @@ namespace helfem {
     double RadialPotential::V(double R) const {
       return std::pow(R,n);
     }
+
+    arma::vec RadialPotential::V(const arma::vec & R) const {
+      return arma::pow(R,(double) n);
+    }
   }
 }
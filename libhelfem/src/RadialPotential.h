@@ -31,6 +31,8 @@ namespace helfem {
       ~RadialPotential();
       /// Potential
       double V(double r) const override;
+      /// Potential at a batch of points
+      arma::vec V(const arma::vec & r) const override;
     };
   }
 }
@@ -27,8 +27,9 @@ namespace helfem {
 
     static double normalization_slice(int N, std::function<double(double)> & phif) {
       // Get quadrature rule
-      arma::vec x, w;
-      chebyshev::chebyshev(N,x,w);
+      const chebyshev::Rule & rule(chebyshev::chebyshev_rule(N));
+      const arma::vec & x(rule.x);
+      const arma::vec & w(rule.w);
 
       // Evaluate normalization by adaptive quadrature
       double h = 1e-1; // Slice size
@@ -60,8 +61,9 @@ namespace helfem {
 
     static double normalization_chebyshev(int N, std::function<double(double)> & phif) {
       // Get quadrature rule
-      arma::vec r, wr;
-      chebyshev::radial_chebyshev(N,r,wr);
+      const chebyshev::Rule & rule(chebyshev::radial_chebyshev_rule(N));
+      const arma::vec & r(rule.x);
+      const arma::vec & wr(rule.w);
 
       // Integrand
       arma::vec f(N);
@@ -198,6 +200,23 @@ namespace helfem {
       return std::pow(Z,2)*val;
     }
 
+    arma::vec RegularizedNucleus::V(const arma::vec & r) const {
+      const double Zrcut(std::cbrt(DBL_EPSILON));
+      const double Zsq(Z*Z);
+      arma::vec pot(r.n_elem);
+      for(size_t i=0;i<r.n_elem;i++) {
+        double Zr=Z*r(i);
+        pot(i)=Zsq*((Zr <= Zrcut) ? modelpotential::V_taylor(a,b,Zr) : modelpotential::V_analytic(a,b,Zr));
+      }
+      return pot;
+    }
+
+    std::vector<double> RegularizedNucleus::breakpoints() const {
+      // V(Z,r) = Z^2 V(1,Zr) only contains erf(aZr) and exp(-(aZr)^2)
+      // terms on top of -Z/r, which vanish beyond aZr = 6
+      return std::vector<double>({1.0/(a*Z), 6.0/(a*Z)});
+    }
+
     double RegularizedNucleus::get_a() const {
       return a;
     }
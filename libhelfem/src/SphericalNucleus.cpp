@@ -35,6 +35,20 @@ namespace helfem {
       }
     }
 
+    arma::vec SphericalNucleus::V(const arma::vec & r) const {
+      const double c0(-Z/(2.0*R0));
+      const double iR0sq(1.0/(R0*R0));
+      arma::vec pot(r.n_elem);
+      for(size_t i=0;i<r.n_elem;i++)
+        pot(i) = (r(i)>=R0) ? -Z/r(i) : c0*(3.0-r(i)*r(i)*iR0sq);
+      return pot;
+    }
+
+    std::vector<double> SphericalNucleus::breakpoints() const {
+      // The potential is a quadratic polynomial inside the nucleus
+      return std::vector<double>({R0});
+    }
+
     double SphericalNucleus::get_R0() const {
       return R0;
     }
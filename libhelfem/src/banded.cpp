@@ -0,0 +1,168 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "banded.h"
+#include <algorithm>
+#include <stdexcept>
+
+extern "C" {
+  /// Cholesky factorization of a positive definite band matrix
+  void dpbtrf_(const char * uplo, const arma::blas_int * n, const arma::blas_int * kd, double * ab, const arma::blas_int * ldab, arma::blas_int * info);
+  /// Solution of a linear system with a factorized positive definite band matrix
+  void dpbtrs_(const char * uplo, const arma::blas_int * n, const arma::blas_int * kd, const arma::blas_int * nrhs, const double * ab, const arma::blas_int * ldab, double * b, const arma::blas_int * ldb, arma::blas_int * info);
+  /// Generalized symmetric-definite band eigenproblem
+  void dsbgv_(const char * jobz, const char * uplo, const arma::blas_int * n, const arma::blas_int * ka, const arma::blas_int * kb, double * ab, const arma::blas_int * ldab, double * bb, const arma::blas_int * ldbb, double * w, double * z, const arma::blas_int * ldz, double * work, arma::blas_int * info);
+}
+
+namespace helfem {
+  namespace utils {
+    SymBandMatrix::SymBandMatrix() : n(0), kd(0), factorized(false) {
+    }
+
+    SymBandMatrix::SymBandMatrix(size_t n_, size_t kd_) : n(n_), kd(kd_), factorized(false) {
+      ab.zeros(kd+1,n);
+    }
+
+    SymBandMatrix::SymBandMatrix(const arma::mat & A, size_t kd_) : n(A.n_rows), kd(kd_), factorized(false) {
+      if(A.n_rows != A.n_cols)
+        throw std::logic_error("Band matrix must be square!\n");
+      ab.zeros(kd+1,n);
+      for(size_t j=0;j<n;j++)
+        for(size_t i=(j>kd ? j-kd : 0);i<=j;i++)
+          ab(kd+i-j,j)=A(i,j);
+    }
+
+    size_t SymBandMatrix::size() const {
+      return n;
+    }
+
+    size_t SymBandMatrix::bandwidth() const {
+      return kd;
+    }
+
+    const arma::mat & SymBandMatrix::band() const {
+      return ab;
+    }
+
+    double SymBandMatrix::operator()(size_t i, size_t j) const {
+      if(factorized)
+        throw std::logic_error("Band matrix holds its Cholesky factor!\n");
+      if(i>j)
+        std::swap(i,j);
+      if(j-i>kd)
+        return 0.0;
+      return ab(kd+i-j,j);
+    }
+
+    void SymBandMatrix::add_block(size_t i0, const arma::mat & blk) {
+      if(factorized)
+        throw std::logic_error("Band matrix holds its Cholesky factor!\n");
+      if(blk.n_rows != blk.n_cols || i0+blk.n_rows > n)
+        throw std::logic_error("Block does not fit in band matrix!\n");
+      if(blk.n_rows > kd+1)
+        throw std::logic_error("Block is wider than the band!\n");
+      for(size_t j=0;j<blk.n_cols;j++)
+        for(size_t i=0;i<=j;i++)
+          ab(kd+i-j,i0+j)+=blk(i,j);
+    }
+
+    arma::mat SymBandMatrix::dense() const {
+      if(factorized)
+        throw std::logic_error("Band matrix holds its Cholesky factor!\n");
+      arma::mat A(n,n,arma::fill::zeros);
+      for(size_t j=0;j<n;j++)
+        for(size_t i=(j>kd ? j-kd : 0);i<=j;i++) {
+          A(i,j)=ab(kd+i-j,j);
+          A(j,i)=A(i,j);
+        }
+      return A;
+    }
+
+    arma::mat SymBandMatrix::operator*(const arma::mat & B) const {
+      if(factorized)
+        throw std::logic_error("Band matrix holds its Cholesky factor!\n");
+      if(B.n_rows != n)
+        throw std::logic_error("Matrix sizes do not match!\n");
+      arma::mat AB(n,B.n_cols,arma::fill::zeros);
+      for(size_t c=0;c<B.n_cols;c++)
+        for(size_t j=0;j<n;j++) {
+          // Diagonal
+          AB(j,c)+=ab(kd,j)*B(j,c);
+          // Off-diagonal elements in column j, and their transposes
+          for(size_t i=(j>kd ? j-kd : 0);i<j;i++) {
+            double a(ab(kd+i-j,j));
+            AB(i,c)+=a*B(j,c);
+            AB(j,c)+=a*B(i,c);
+          }
+        }
+      return AB;
+    }
+
+    bool SymBandMatrix::cholesky() {
+      if(factorized)
+        return true;
+      char uplo='U';
+      arma::blas_int N(n), KD(kd), ldab(kd+1), info(0);
+      dpbtrf_(&uplo,&N,&KD,ab.memptr(),&ldab,&info);
+      if(info)
+        return false;
+      factorized=true;
+      return true;
+    }
+
+    arma::mat SymBandMatrix::solve(const arma::mat & B) const {
+      if(!factorized)
+        throw std::logic_error("Band matrix has not been factorized!\n");
+      if(B.n_rows != n)
+        throw std::logic_error("Matrix sizes do not match!\n");
+      arma::mat X(B);
+      char uplo='U';
+      arma::blas_int N(n), KD(kd), nrhs(B.n_cols), ldab(kd+1), ldb(n), info(0);
+      dpbtrs_(&uplo,&N,&KD,&nrhs,ab.memptr(),&ldab,X.memptr(),&ldb,&info);
+      if(info)
+        throw std::runtime_error("Band matrix solve failed!\n");
+      return X;
+    }
+
+    bool is_banded(const arma::mat & A, size_t kd) {
+      for(size_t j=0;j<A.n_cols;j++) {
+        for(size_t i=0;i+kd<j;i++)
+          if(A(i,j)!=0.0)
+            return false;
+        for(size_t i=j+kd+1;i<A.n_rows;i++)
+          if(A(i,j)!=0.0)
+            return false;
+      }
+      return true;
+    }
+
+    bool eig_gsym_banded(arma::vec & E, arma::mat & C, const SymBandMatrix & A, const SymBandMatrix & B) {
+      if(A.size() != B.size())
+        throw std::logic_error("Matrix sizes do not match!\n");
+
+      // The routine overwrites its inputs
+      arma::mat ab(A.band()), bb(B.band());
+      char jobz='V', uplo='U';
+      arma::blas_int N(A.size()), ka(A.bandwidth()), kb(B.bandwidth()), ldab(ab.n_rows), ldbb(bb.n_rows), ldz(N), info(0);
+      if(kb>ka)
+        throw std::logic_error("Metric may not be wider than the matrix!\n");
+      E.zeros(N);
+      C.zeros(N,N);
+      arma::vec work(3*N);
+      dsbgv_(&jobz,&uplo,&N,&ka,&kb,ab.memptr(),&ldab,bb.memptr(),&ldbb,E.memptr(),C.memptr(),&ldz,work.memptr(),&info);
+      return info==0;
+    }
+  }
+}
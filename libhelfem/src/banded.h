@@ -0,0 +1,79 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef BANDED_H
+#define BANDED_H
+
+#include <armadillo>
+
+namespace helfem {
+  namespace utils {
+    /**
+     * Symmetric band matrix, stored in the LAPACK upper band format.
+     * Finite element matrices of local operators only couple functions
+     * in the same element, so their half bandwidth is the number of
+     * functions in an element minus one, and the storage is O(N kd)
+     * instead of O(N^2).
+     */
+    class SymBandMatrix {
+      /// Size of the matrix
+      size_t n;
+      /// Number of superdiagonals
+      size_t kd;
+      /// Band storage: A(i,j) = ab(kd+i-j,j) for j-kd <= i <= j
+      arma::mat ab;
+      /// Is the matrix holding its Cholesky factor?
+      bool factorized;
+
+    public:
+      /// Dummy constructor
+      SymBandMatrix();
+      /// Zero matrix of size n with kd superdiagonals
+      SymBandMatrix(size_t n, size_t kd);
+      /// Pack the band of a dense symmetric matrix
+      SymBandMatrix(const arma::mat & A, size_t kd);
+
+      /// Size of the matrix
+      size_t size() const;
+      /// Number of superdiagonals
+      size_t bandwidth() const;
+      /// Raw band storage
+      const arma::mat & band() const;
+
+      /// Get element, zero outside the band
+      double operator()(size_t i, size_t j) const;
+      /// Add a dense symmetric block whose first row and column is i0
+      void add_block(size_t i0, const arma::mat & blk);
+      /// Unpack into a dense matrix
+      arma::mat dense() const;
+
+      /// Product with a dense matrix
+      arma::mat operator*(const arma::mat & B) const;
+
+      /// Cholesky factorization in place, returns false if the matrix is not positive definite
+      bool cholesky();
+      /// Solve A X = B with the Cholesky factor
+      arma::mat solve(const arma::mat & B) const;
+    };
+
+    /// Check whether a dense matrix vanishes outside kd diagonals from the main diagonal
+    bool is_banded(const arma::mat & A, size_t kd);
+
+    /// Solve the generalized eigenvalue problem A C = B C E, where B is positive definite, in band storage
+    bool eig_gsym_banded(arma::vec & E, arma::mat & C, const SymBandMatrix & A, const SymBandMatrix & B);
+  }
+}
+
+#endif
@@ -14,12 +14,15 @@
  * of the License, or (at your option) any later version.
  */
 #include "chebyshev.h"
+#include <map>
+#include <memory>
+#include <mutex>
 
 namespace helfem {
   namespace chebyshev {
     // Modified Gauss-Chebyshev quadrature of the second kind for calculating
     // \int_{-1}^{1} f(x) dx
-    void chebyshev(int n, arma::vec & x, arma::vec & w) {
+    static void compute_chebyshev(int n, arma::vec & x, arma::vec & w) {
       // Resize vectors to correct size
       x.zeros(n);
       w.zeros(n);
@@ -52,10 +55,11 @@ namespace helfem {
       w=reverse(w);
     }
 
-    void radial_chebyshev(int nrad, arma::vec & rad, arma::vec & wrad) {
+    static void compute_radial_chebyshev(int nrad, arma::vec & rad, arma::vec & wrad) {
       // Get Chebyshev nodes and weights for radial part
-      arma::vec xc, wc;
-      chebyshev(nrad,xc,wc);
+      const Rule & rule(chebyshev_rule(nrad));
+      const arma::vec & xc(rule.x);
+      const arma::vec & wc(rule.w);
 
       // Compute radii
       rad.zeros(nrad);
@@ -74,5 +78,40 @@ namespace helfem {
         wrad(ixc) = w;
       }
     }
+
+    /// Look up a rule in the cache, computing it if necessary
+    static const Rule & cached_rule(int n, void (*compute)(int, arma::vec &, arma::vec &), std::map<int, std::unique_ptr<Rule>> & cache, std::mutex & lock) {
+      std::lock_guard<std::mutex> guard(lock);
+      std::unique_ptr<Rule> & rule(cache[n]);
+      if(!rule) {
+        rule.reset(new Rule);
+        compute(n,rule->x,rule->w);
+      }
+      return *rule;
+    }
+
+    const Rule & chebyshev_rule(int n) {
+      static std::mutex lock;
+      static std::map<int, std::unique_ptr<Rule>> cache;
+      return cached_rule(n,compute_chebyshev,cache,lock);
+    }
+
+    const Rule & radial_chebyshev_rule(int n) {
+      static std::mutex lock;
+      static std::map<int, std::unique_ptr<Rule>> cache;
+      return cached_rule(n,compute_radial_chebyshev,cache,lock);
+    }
+
+    void chebyshev(int n, arma::vec & x, arma::vec & w) {
+      const Rule & rule(chebyshev_rule(n));
+      x=rule.x;
+      w=rule.w;
+    }
+
+    void radial_chebyshev(int n, arma::vec & r, arma::vec & wr) {
+      const Rule & rule(radial_chebyshev_rule(n));
+      r=rule.x;
+      wr=rule.w;
+    }
   }
 }
@@ -20,17 +20,30 @@
 
 namespace helfem {
   namespace chebyshev {
+    /// Quadrature nodes and weights
+    struct Rule {
+      /// Nodes
+      arma::vec x;
+      /// Weights
+      arma::vec w;
+    };
+
     /**
        Modified Gauss-Chebyshev quadrature of the second kind for calculating
        \f$ \int_{-1}^{1} f(x) dx \f$
     */
     void chebyshev(int n, arma::vec & x, arma::vec & w);
+    /// Get a Gauss-Chebyshev rule from the process-wide cache. Thread
+    /// safe; the reference stays valid until the program exits.
+    const Rule & chebyshev_rule(int n);
 
     /// Modified Gauss-Chebyshev quadrature of the second kind for
     /// calculating \f$\int_{0}^{\infty} f(r) dr\f$. NB! For
     /// integration in spherical coordinates, you need to plug in the
     /// r^2 factor as well.
     void radial_chebyshev(int n, arma::vec & r, arma::vec & wr);
+    /// Get a radial Gauss-Chebyshev rule from the process-wide cache
+    const Rule & radial_chebyshev_rule(int n);
   }
 }
 
@@ -20,6 +20,7 @@
 #include <cfloat>
 #include <stdexcept>
 #include <cstdio>
+#include <vector>
 
 // For factorials
 extern "C" {
@@ -193,6 +194,91 @@ namespace helfem {
           return Phi_general(n,Xi,xi);
         }
       }
+
+      /// Maximum k in the short-range expansion, see Phi_short
+      static const unsigned int short_kmax=31;
+
+      arma::mat Phi(unsigned int n, const arma::vec & r1, const arma::vec & r2) {
+        // Factorial coefficients of F_m, m = 0, ..., n in equation (22)
+        arma::mat Fcoef(n+1,n+1,arma::fill::zeros);
+        for(unsigned int m=0;m<=n;m++)
+          for(unsigned int p=0;p<=m;p++)
+            Fcoef(p,m)=factorial(m+p)/(factorial(p)*factorial(m-p));
+
+        // Damping functions for the points in both sets, computed
+        // when the point first appears as the larger argument
+        arma::vec pts(arma::join_cols(r1,r2));
+        arma::mat D(short_kmax+1,pts.n_elem);
+        std::vector<bool> Ddone(pts.n_elem,false);
+
+        arma::mat ret(r1.n_elem,r2.n_elem);
+        std::vector<double> Fm(n+1);
+        for(size_t k=0;k<r2.n_elem;k++)
+          for(size_t i=0;i<r1.n_elem;i++) {
+            // Index of the larger argument
+            size_t iX(r1(i)>=r2(k) ? i : r1.n_elem+k);
+            double Xi(std::max(r1(i),r2(k)));
+            double xi(std::min(r1(i),r2(k)));
+
+            if(xi < 0.4 || (Xi < 0.5 && xi < 2*Xi)) {
+              // Short-range Taylor polynomial, as in Phi_short
+              if(xi == 0.0 && n>0) {
+                ret(i,k)=0.0;
+                continue;
+              } else if(n == 0 && xi == 0.0 && Xi == 0.0) {
+                ret(i,k)=1.0;
+                continue;
+              }
+              if(!Ddone[iX]) {
+                for(unsigned int kk=0;kk<=short_kmax;kk++)
+                  D(kk,iX)=Dnk(n,kk,Xi);
+                Ddone[iX]=true;
+              }
+
+              double xi2(xi*xi);
+              double xpow(std::pow(xi,n));
+              double PhiS = 0.0;
+              double dPhi = 0.0;
+              double tol=DBL_EPSILON;
+              for(unsigned int kk=0; kk<=short_kmax; kk+=2) {
+                dPhi = D(kk,iX)*xpow + D(kk+1,iX)*xpow*xi2;
+                xpow*=xi2*xi2;
+                PhiS += dPhi;
+                if(std::abs(dPhi) < tol*std::abs(PhiS)) break;
+              }
+              if(std::abs(dPhi) >= tol*std::abs(PhiS))
+                fprintf(stderr,"Warning - short-range Phi not converged at xi= %e: dPhi= %e, Phi= %e ratio %e\n",xi,dPhi,PhiS,dPhi/PhiS);
+              ret(i,k)=PhiS/std::pow(Xi,n+1);
+
+            } else {
+              // General expansion as in Phi_general, with the
+              // exponentials shared by all F_m
+              double explus(std::exp(-std::pow(Xi+xi,2)));
+              double exminus(std::exp(-std::pow(Xi-xi,2)));
+              double prefac(-1.0/(4.0*Xi*xi));
+              for(unsigned int m=0;m<=n;m++) {
+                double F=0.0;
+                double prefacp(prefac);
+                for(unsigned int p=0;p<=m;p++) {
+                  F += prefacp * Fcoef(p,m) * (((m-p)%2 ? -1.0 : 1.0) * explus - exminus);
+                  prefacp*=prefac;
+                }
+                Fm[m]=2.0/sqrt(M_PI)*F;
+              }
+
+              double sum = 0.0;
+              double Xim(1.0), xim(1.0);
+              for(unsigned int m=1;m<=n;m++) {
+                Xim*=Xi;
+                xim*=xi;
+                sum += Fm[n-m]*((Xim*Xim + xim*xim)/(Xim*xim));
+              }
+              ret(i,k)=Fm[n] + sum + Hn(n,Xi,xi);
+            }
+          }
+
+        return ret;
+      }
     }
   }
 }
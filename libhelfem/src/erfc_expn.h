@@ -16,6 +16,8 @@
 #ifndef ATOMIC_ERFC_EXPN_H
 #define ATOMIC_ERFC_EXPN_H
 
+#include <armadillo>
+
 namespace helfem {
   namespace atomic {
     namespace erfc_expn {
@@ -33,6 +35,13 @@ namespace helfem {
        * interactions", J. Phys. A: Math. Gen. 39, 8613 (2006).
        */
       double Phi(unsigned int n, double Xi, double xi);
+
+      /**
+       * Evaluates Phi(n, r1(i), r2(k)) on the whole product grid. The
+       * damping functions and the factorial coefficients are computed
+       * once per point instead of once per pair.
+       */
+      arma::mat Phi(unsigned int n, const arma::vec & r1, const arma::vec & r2);
     }
   }
 }
@@ -0,0 +1,160 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef POLYNOMIAL_BASIS_LIP_KERNELS_H
+#define POLYNOMIAL_BASIS_LIP_KERNELS_H
+
+#include <algorithm>
+#include <armadillo>
+
+namespace helfem {
+  namespace polynomial_basis {
+    /**
+     * Evaluation kernels for Lagrange and Hermite interpolating
+     * polynomials, used by the generated LIPBasis_eval.cpp and
+     * HIPBasis_eval.cpp.
+     *
+     * The nth derivative of l_i(x) = w_i prod_{j!=i} (x-x_j) is
+     * obtained from the Taylor coefficients of l_i(x+t), which follow
+     * by multiplying in one factor (x - x_j + t) at a time. Points are
+     * handled in blocks of fixed size, so the inner loops have fixed
+     * trip counts and no branches; the node count can be fixed at
+     * compile time as well.
+     */
+    namespace lip_kernels {
+      /// Number of points handled at once
+      const size_t BLOCK=8;
+
+      /// Factorial
+      constexpr double factorial(int n) {
+        return n<=1 ? 1.0 : n*factorial(n-1);
+      }
+
+      /// Multiply the Taylor coefficients by the factor (x - x0 + t)
+      template<int ORDER>
+      inline void multiply_factor(const double * xb, double x0, double c[][BLOCK]) {
+        for(size_t j=0;j<BLOCK;j++) {
+          const double d(xb[j]-x0);
+          for(int k=ORDER;k>0;k--)
+            c[k][j]=c[k][j]*d+c[k-1][j];
+          c[0][j]*=d;
+        }
+      }
+
+      /**
+       * Taylor coefficients l_fi(x+t) = sum_k c[k] t^k, k <= ORDER, of
+       * the Lagrange polynomial fi at a block of points. NNODES is the
+       * number of nodes, or 0 if it's only known at runtime.
+       */
+      template<int ORDER, int NNODES>
+      inline void taylor_block(const double * xb, const double * x0, const double * bw, size_t nnodes, size_t fi, double c[][BLOCK]) {
+        const size_t N(NNODES ? NNODES : nnodes);
+        for(size_t j=0;j<BLOCK;j++) {
+          c[0][j]=bw[fi];
+          for(int k=1;k<=ORDER;k++)
+            c[k][j]=0.0;
+        }
+        for(size_t ip=0;ip<fi;ip++)
+          multiply_factor<ORDER>(xb,x0[ip],c);
+        for(size_t ip=fi+1;ip<N;ip++)
+          multiply_factor<ORDER>(xb,x0[ip],c);
+      }
+
+      /// Load a block of points, padding the tail with the last point
+      inline size_t load_block(const arma::vec & x, size_t i0, double xb[BLOCK]) {
+        const size_t nb(std::min(BLOCK,(size_t) (x.n_elem-i0)));
+        for(size_t j=0;j<BLOCK;j++)
+          xb[j]=x(i0+std::min(j,nb-1));
+        return nb;
+      }
+
+      /**
+       * ORDERth derivative of the LIPs f0 <= fi < f1 at the points x,
+       * multiplied by scale and written in the x.n_elem x (f1-f0)
+       * column-major buffer out.
+       */
+      template<int ORDER, int NNODES>
+      void lip_eval_range(const arma::vec & x, const double * x0, const double * bw, size_t nnodes, size_t f0, size_t f1, double scale, double * out) {
+        const size_t N(NNODES ? NNODES : nnodes);
+        const double fac(scale*factorial(ORDER));
+        double xb[BLOCK];
+        double c[ORDER+1][BLOCK];
+        for(size_t i0=0;i0<x.n_elem;i0+=BLOCK) {
+          const size_t nb(load_block(x,i0,xb));
+          for(size_t fi=f0;fi<f1;fi++) {
+            taylor_block<ORDER,NNODES>(xb,x0,bw,N,fi,c);
+            for(size_t j=0;j<nb;j++)
+              out[(fi-f0)*x.n_elem+i0+j]=fac*c[ORDER][j];
+          }
+        }
+      }
+
+      /**
+       * ORDERth derivative of the LIPs at the points x, written in
+       * the x.n_elem x x0.n_elem column-major buffer out.
+       */
+      template<int ORDER, int NNODES>
+      void lip_eval(const arma::vec & x, const arma::vec & x0, const arma::vec & bw, double * out) {
+        const size_t N(NNODES ? NNODES : x0.n_elem);
+        lip_eval_range<ORDER,NNODES>(x,x0.memptr(),bw.memptr(),N,0,N,1.0,out);
+      }
+
+      /**
+       * ORDERth derivative of the HIPs at the points x, written in
+       * the x.n_elem x 2*x0.n_elem column-major buffer out. The first
+       * function of each node is [1 - 2(x-xi) l_i'(xi)] l_i(x)^2 and
+       * the second is (x-xi) l_i(x)^2 scaled by the element length.
+       */
+      template<int ORDER, int NNODES>
+      void hip_eval(const arma::vec & x, const arma::vec & x0, const arma::vec & bw, const arma::vec & lipxi, double element_length, double * out) {
+        const size_t N(NNODES ? NNODES : x0.n_elem);
+        const double fac(factorial(ORDER));
+        // Index of the next to last coefficient; only used for ORDER>0
+        const int km(ORDER>0 ? ORDER-1 : 0);
+        double xb[BLOCK];
+        double c[ORDER+1][BLOCK];
+        for(size_t i0=0;i0<x.n_elem;i0+=BLOCK) {
+          const size_t nb(load_block(x,i0,xb));
+          for(size_t fi=0;fi<N;fi++) {
+            taylor_block<ORDER,NNODES>(xb,x0.memptr(),bw.memptr(),N,fi,c);
+
+            double h1[BLOCK], h3[BLOCK];
+            for(size_t j=0;j<BLOCK;j++) {
+              // Taylor coefficients of l_i^2
+              double s=0.0, sm=0.0;
+              for(int k=0;k<=ORDER;k++)
+                s+=c[k][j]*c[ORDER-k][j];
+              for(int k=0;k<=km;k++)
+                sm+=c[k][j]*c[km-k][j];
+              if(ORDER==0)
+                sm=0.0;
+
+              const double dx(xb[j]-x0(fi));
+              const double f1(1.0-2.0*dx*lipxi(fi));
+              const double df1(-2.0*lipxi(fi));
+              h1[j]=f1*s+df1*sm;
+              h3[j]=dx*s+sm;
+            }
+            for(size_t j=0;j<nb;j++) {
+              out[2*fi*x.n_elem+i0+j]=fac*h1[j];
+              out[(2*fi+1)*x.n_elem+i0+j]=fac*h3[j]*element_length;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+#endif
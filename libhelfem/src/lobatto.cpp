@@ -15,6 +15,10 @@
  */
 #include "lobatto.h"
 #include <cfloat>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 void lobatto_set(int order, arma::vec & xtab, arma::vec & weight)
 
@@ -585,7 +589,7 @@ void lobatto_set(int order, arma::vec & xtab, arma::vec & weight)
 }
 
 
-void lobatto_compute (int n, arma::vec & x, arma::vec & w)
+static void lobatto_newton (int n, arma::vec & x, arma::vec & w)
 
 /******************************************************************************/
 /*
@@ -662,19 +666,6 @@ void lobatto_compute (int n, arma::vec & x, arma::vec & w)
   double test, error;
   double tolerance;
 
-  if ( n < 2 )
-  {
-    std::ostringstream oss;
-    oss << "Lobatto called with n="<<n<<", but n>=2 is required.\n";
-    throw std::runtime_error(oss.str());
-  }
-
-  if(n<20) {
-    // Use tabled weights and nodes
-    lobatto_set(n,x,w);
-    return;
-  }
-
   // Resize tables to correct length
   x.resize(n);
   w.resize(n);
@@ -688,8 +679,8 @@ void lobatto_compute (int n, arma::vec & x, arma::vec & w)
     x[i] = cos ( M_PI * ( double ) ( i ) / ( double ) ( n - 1 ) );
   }
 
-   double xold[n];
-   double p[n*n];
+   std::vector<double> xold(n);
+   std::vector<double> p(n*n);
 
   do
   {
@@ -741,3 +732,33 @@ void lobatto_compute (int n, arma::vec & x, arma::vec & w)
   }
 }
 /******************************************************************************/
+
+const LobattoRule & lobatto_rule(int n) {
+  if ( n < 2 )
+  {
+    std::ostringstream oss;
+    oss << "Lobatto called with n="<<n<<", but n>=2 is required.\n";
+    throw std::runtime_error(oss.str());
+  }
+
+  static std::mutex lock;
+  static std::map<int, std::unique_ptr<LobattoRule>> cache;
+
+  std::lock_guard<std::mutex> guard(lock);
+  std::unique_ptr<LobattoRule> & rule(cache[n]);
+  if(!rule) {
+    rule.reset(new LobattoRule);
+    if(n<20)
+      // Use tabled weights and nodes
+      lobatto_set(n,rule->x,rule->w);
+    else
+      lobatto_newton(n,rule->x,rule->w);
+  }
+  return *rule;
+}
+
+void lobatto_compute (int n, arma::vec & x, arma::vec & w) {
+  const LobattoRule & rule(lobatto_rule(n));
+  x=rule.x;
+  w=rule.w;
+}
@@ -18,6 +18,18 @@
 
 #include <armadillo>
 
+/// Gauss-Lobatto nodes and weights
+struct LobattoRule {
+  /// Nodes
+  arma::vec x;
+  /// Weights
+  arma::vec w;
+};
+
+/// Get a Gauss-Lobatto rule from the process-wide cache. Thread safe;
+/// the reference stays valid until the program exits.
+const LobattoRule & lobatto_rule(int n);
+
 /// Compute a Gauss-Lobatto quadrature rule for \f$ \int_{-1}^1 f(x)dx \approx \frac 2 {n(n-1)} \left[ f(-1) + f(1) \right] + \sum_{i=2}^{n-1} w_i f(x_i) \f$
 void lobatto_compute ( int n, arma::vec & x, arma::vec & w);
 
@@ -16,7 +16,9 @@
 #include "quadrature.h"
 #include "erfc_expn.h"
 #include "chebyshev.h"
+#include "lobatto.h"
 #include "utils.h"
+#include <algorithm>
 
 namespace helfem {
   namespace quadrature {
@@ -57,7 +59,63 @@ namespace helfem {
       return inner;
     }
 
-    arma::mat twoe_inner_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, const std::function<double(double,double)> & fsmallbig, const std::function<double(double)> & fbig) {
+    /// Number of Gauss-Lobatto points that integrates fsmallbig B_k B_l exactly when fsmallbig is a polynomial of degree kdeg, or 0 if the kernel is not polynomial
+    static int exact_lobatto_points(const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int kdeg) {
+      if(kdeg<0)
+        return 0;
+      // The basis functions are polynomials of degree nprim-1, and an
+      // n-point Lobatto rule is exact up to degree 2n-3
+      int deg(2*(poly->get_nprim()-1)+kdeg);
+      return std::max(2,(deg+4)/2);
+    }
+
+    /**
+     * Computes the integrals \f$ \int_{r_s}^{r_{s+1}} f(r, r_{s+1})
+     * B_k(r) B_l(r) dr \f$ over the consecutive segments given by rb
+     * with an npoints Gauss-Lobatto rule. The segments share their
+     * end points, so the basis is evaluated in a single batch at
+     * nseg*(npoints-1)+1 points. Returns a nbf^2 x nseg matrix.
+     */
+    static arma::mat segment_integrals(const arma::vec & rb, double rmin0, double rmax0, int npoints, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, const std::function<double(double,double)> & fsmallbig) {
+      const LobattoRule & rule(::lobatto_rule(npoints));
+      const size_t nseg(rb.n_elem-1);
+      const size_t stride(npoints-1);
+
+      // Midpoint and half-length of original interval
+      double rmid0(0.5*(rmax0+rmin0));
+      double rlen0(0.5*(rmax0-rmin0));
+
+      // Quadrature points in all segments
+      arma::vec r(nseg*stride+1);
+      for(size_t is=0;is<nseg;is++) {
+        double rmid(0.5*(rb(is+1)+rb(is)));
+        double rlen(0.5*(rb(is+1)-rb(is)));
+        for(size_t j=0;j<stride;j++)
+          r(is*stride+j)=rmid+rlen*rule.x(j);
+      }
+      r(nseg*stride)=rb(nseg);
+
+      // Evaluate the polynomials at all the points at once
+      arma::mat bf(poly->eval_dnf((r-rmid0*arma::ones<arma::vec>(r.n_elem))/rlen0,0,rlen0));
+
+      arma::mat seg(bf.n_cols*bf.n_cols,nseg);
+      for(size_t is=0;is<nseg;is++) {
+        double rlen(0.5*(rb(is+1)-rb(is)));
+        arma::vec wp(npoints);
+        for(int j=0;j<npoints;j++)
+          wp(j)=rule.w(j)*rlen*fsmallbig(r(is*stride+j),rb(is+1));
+
+        arma::mat bfs(bf.rows(is*stride,is*stride+stride));
+        arma::mat wbf(bfs);
+        for(size_t i=0;i<wbf.n_cols;i++)
+          wbf.col(i)%=wp;
+        seg.col(is)=arma::vectorise(arma::trans(wbf)*bfs);
+      }
+
+      return seg;
+    }
+
+    arma::mat twoe_inner_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, const std::function<double(double,double)> & fsmallbig, const std::function<double(double)> & fbig, int kdeg) {
       // Midpoint is at
       double rmid(0.5*(rmax+rmin));
       // and half-length of interval is
@@ -66,11 +124,20 @@ namespace helfem {
       arma::vec r(rmid*arma::ones<arma::vec>(x.n_elem)+rlen*x);
 
       // Compute the "inner" integrals as function of r.
-      // Every subinterval uses a fresh nquad points!
       arma::mat inner(x.n_elem,std::pow(poly->get_nbf(),2));
-      inner.row(0)=arma::trans(twoe_inner_integral_wrk(rmin, r(0), rmin, rmax, x, wx, poly, fsmallbig, fbig));
-      for(size_t ip=1;ip<x.n_elem;ip++)
-        inner.row(ip)=arma::trans(twoe_inner_integral_wrk(r(ip-1), r(ip), rmin, rmax, x, wx, poly, fsmallbig, fbig));
+      int nlob(exact_lobatto_points(poly,kdeg));
+      if(nlob>0 && nlob<(int) x.n_elem) {
+        // Polynomial integrand: a short exact rule per subinterval suffices
+        arma::vec rb(x.n_elem+1);
+        rb(0)=rmin;
+        rb.subvec(1,x.n_elem)=r;
+        inner=arma::trans(segment_integrals(rb, rmin, rmax, nlob, poly, fsmallbig));
+      } else {
+        // Every subinterval uses a fresh nquad points!
+        inner.row(0)=arma::trans(twoe_inner_integral_wrk(rmin, r(0), rmin, rmax, x, wx, poly, fsmallbig, fbig));
+        for(size_t ip=1;ip<x.n_elem;ip++)
+          inner.row(ip)=arma::trans(twoe_inner_integral_wrk(r(ip-1), r(ip), rmin, rmax, x, wx, poly, fsmallbig, fbig));
+      }
 
       // For numerical stability, each integral segment is scaled by
       // R^(-L-1), since first integrating r^L and then multiplying by
@@ -86,7 +153,8 @@ namespace helfem {
       // Kernel functions
       std::function<double(double,double)> fsmallbig = [L](double r, double R) {return std::pow(r/R,L)/R;};
       std::function<double(double)> fbig = [L](double r) {return std::pow(r,-L-1);};
-      return twoe_inner_integral(rmin, rmax, x, wx, poly, fsmallbig, fbig);
+      // The kernel is a polynomial of degree L in r
+      return twoe_inner_integral(rmin, rmax, x, wx, poly, fsmallbig, fbig, L);
     }
 
     arma::mat twoe_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L) {
@@ -129,7 +197,7 @@ namespace helfem {
       // Kernel functions
       std::function<double(double,double)> fsmallbig = [L, lambda](double r, double R) {return utils::bessel_il(r*lambda,L)*utils::bessel_kl(R*lambda,L);};
       std::function<double(double)> fbig = [L, lambda](double r) {return utils::bessel_kl(r*lambda,L);};
-      return twoe_inner_integral(rmin, rmax, x, wx, poly, fsmallbig, fbig);
+      return twoe_inner_integral(rmin, rmax, x, wx, poly, fsmallbig, fbig, -1);
     }
 
     arma::mat yukawa_integral(double rmin, double rmax, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, double lambda) {
@@ -193,10 +261,7 @@ namespace helfem {
       arma::vec rk(rmidk*arma::ones<arma::vec>(xk.n_elem)+rlenk*xk);
 
       // Green's function
-      arma::mat Fn(ri.n_elem,rk.n_elem);
-      for(size_t i=0;i<ri.n_elem;i++)
-        for(size_t k=0;k<rk.n_elem;k++)
-          Fn(i,k) = atomic::erfc_expn::Phi(L,mu*ri(i),mu*rk(k));
+      arma::mat Fn(atomic::erfc_expn::Phi(L,mu*ri,mu*rk));
 
       // Product functions
       arma::mat bfprodij(bfi.n_rows,bfi.n_cols*bfi.n_cols);
@@ -241,11 +306,20 @@ namespace helfem {
       std::function<double(double,double)> fsmallbig = [](double r, double R) {return 1.0/R;};
       std::function<double(double,double)> fbigsmall = [](double r, double R) {return 1/r;};
 
-      // Every subinterval uses a fresh nquad points!
-      for(size_t ip=0;ip<x.n_elem;ip++) {
-        double low = ip ? r(ip-1) : rmin;
-        double high = r(ip);
-        zero.col(ip)=twoe_inner_integral_wrk(low, high, rmin, rmax, x, wx, poly, fsmallbig, fbig);
+      int nlob(exact_lobatto_points(poly,0));
+      if(nlob<(int) x.n_elem) {
+        // The integrand is a polynomial, so a short exact rule suffices
+        arma::vec rb(x.n_elem+1);
+        rb(0)=rmin;
+        rb.subvec(1,x.n_elem)=r;
+        zero=segment_integrals(rb, rmin, rmax, nlob, poly, fsmallbig);
+      } else {
+        // Every subinterval uses a fresh nquad points!
+        for(size_t ip=0;ip<x.n_elem;ip++) {
+          double low = ip ? r(ip-1) : rmin;
+          double high = r(ip);
+          zero.col(ip)=twoe_inner_integral_wrk(low, high, rmin, rmax, x, wx, poly, fsmallbig, fbig);
+        }
       }
       for(size_t ip=0;ip<x.n_elem;ip++) {
         double low = r(ip);
@@ -253,19 +327,26 @@ namespace helfem {
         minusone.col(ip)=twoe_inner_integral_wrk(low, high, rmin, rmax, x, wx, poly, fbigsmall, fsmall);
       }
 
-      // The potential itself
+      // The potential itself, accumulated with running sums over the
+      // segments
       arma::mat V(std::pow(poly->get_nbf(),2),x.n_elem);
-      V.zeros();
-      for(size_t ip=0;ip<x.n_elem;ip++) {
-        // \int_0^r Bi(r) Bj(r) dr
-        for(size_t jp=0;jp<=ip;jp++)
-          V.col(ip)+=zero.col(jp)*r(jp);
-        // divided by r
+      // \int_0^r Bi(r) Bj(r) dr
+      arma::vec cumzero(zero.col(0)*r(0));
+      V.col(0)=cumzero;
+      for(size_t ip=1;ip<x.n_elem;ip++) {
+        cumzero+=zero.col(ip)*r(ip);
+        V.col(ip)=cumzero;
+      }
+      // divided by r
+      for(size_t ip=0;ip<x.n_elem;ip++)
         V.col(ip) /= r(ip);
 
-        // plus the integral to infinity \int_r^\infty r^{-1} Bi(r) Bj(r) dr
-        for(size_t jp=ip;jp<x.n_elem;jp++)
-          V.col(ip)+=minusone.col(jp);
+      // plus the integral to infinity \int_r^\infty r^{-1} Bi(r) Bj(r) dr
+      arma::vec cumone(minusone.col(x.n_elem-1));
+      V.col(x.n_elem-1)+=cumone;
+      for(size_t ip=x.n_elem-1;ip>0;ip--) {
+        cumone+=minusone.col(ip-1);
+        V.col(ip-1)+=cumone;
       }
 
       // Should be returned as transpose
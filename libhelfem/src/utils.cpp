@@ -15,6 +15,7 @@
  */
 #include "utils.h"
 #include <cmath>
+#include <vector>
 
 extern "C" {
 #include <gsl/gsl_sf_bessel.h>
@@ -69,6 +70,33 @@ namespace helfem {
       return ret;
     }
 
+    arma::mat bessel_il_array(const arma::vec & r, int Lmax) {
+      arma::mat ret(r.n_elem, Lmax+1);
+      std::vector<double> il(Lmax+1);
+      for(size_t i=0; i<r.n_elem; i++) {
+        // GSL runs the recurrence on the scaled functions, which
+        // don't overflow; the scaling is only undone at the end
+        gsl_sf_bessel_il_scaled_array(Lmax, r(i), il.data());
+        double scale(exp(std::abs(r(i))));
+        for(int L=0; L<=Lmax; L++)
+          ret(i,L) = scale*il[L];
+      }
+      return ret;
+    }
+
+    arma::mat bessel_kl_array(const arma::vec & r, int Lmax) {
+      arma::mat ret(r.n_elem, Lmax+1);
+      std::vector<double> kl(Lmax+1);
+      for(size_t i=0; i<r.n_elem; i++) {
+        // Upward recurrence on the scaled functions, see above
+        gsl_sf_bessel_kl_scaled_array(Lmax, r(i), kl.data());
+        double scale(exp(-r(i)) / M_PI_2);
+        for(int L=0; L<=Lmax; L++)
+          ret(i,L) = scale*kl[L];
+      }
+      return ret;
+    }
+
     arma::mat product_tei(const arma::mat & ijint, const arma::mat & klint) {
       const size_t Ni(ijint.n_rows);
       const size_t Nj(ijint.n_cols);
@@ -153,6 +181,195 @@ namespace helfem {
       return ktei;
     }
 
+    /// Index of the pair (i,j), i>=j, in lower triangular packed storage
+    static inline size_t pair_index(size_t i, size_t j) {
+      return (i>=j) ? i*(i+1)/2+j : j*(j+1)/2+i;
+    }
+
+    size_t packed_tei_size(size_t N) {
+      size_t Np(N*(N+1)/2);
+      return Np*(Np+1)/2;
+    }
+
+    arma::vec pack_tei(const arma::mat & tei, size_t N) {
+      if(tei.n_rows != N*N || tei.n_cols != N*N) {
+        std::ostringstream oss;
+        oss << "Invalid input tei: was supposed to be " << N*N << " x " << N*N << " but got " << tei.n_rows << " x " << tei.n_cols << "!\n";
+        throw std::logic_error(oss.str());
+      }
+
+      arma::vec ptei(packed_tei_size(N));
+      for(size_t ii=0;ii<N;ii++)
+        for(size_t jj=0;jj<=ii;jj++) {
+          size_t ij(pair_index(ii,jj));
+          for(size_t kk=0;kk<N;kk++)
+            for(size_t ll=0;ll<=kk;ll++) {
+              size_t kl(pair_index(kk,ll));
+              if(kl>ij)
+                continue;
+              // (ij|kl) in Armadillo compatible indexing
+              ptei(pair_index(ij,kl))=tei(jj*N+ii,ll*N+kk);
+            }
+        }
+
+      return ptei;
+    }
+
+    arma::mat unpack_tei(const arma::vec & ptei, size_t N) {
+      if(ptei.n_elem != packed_tei_size(N))
+        throw std::logic_error("Packed tei does not match the number of functions!\n");
+
+      arma::mat tei(N*N,N*N);
+      for(size_t ii=0;ii<N;ii++)
+        for(size_t jj=0;jj<N;jj++)
+          for(size_t kk=0;kk<N;kk++)
+            for(size_t ll=0;ll<N;ll++)
+              tei(jj*N+ii,ll*N+kk)=ptei(pair_index(pair_index(ii,jj),pair_index(kk,ll)));
+
+      return tei;
+    }
+
+    template<typename T> static arma::Mat<T> packed_coulomb_wrk(const arma::Col<T> & ptei, const arma::Mat<T> & P) {
+      const size_t N(P.n_rows);
+      const size_t Np(N*(N+1)/2);
+      if(P.n_cols != N || ptei.n_elem != packed_tei_size(N))
+        throw std::logic_error("Packed tei does not match the density matrix!\n");
+
+      // Symmetrized density in pair storage, since (ij|kl) = (ij|lk)
+      arma::Col<T> Ppair(Np);
+      for(size_t kk=0;kk<N;kk++) {
+        for(size_t ll=0;ll<kk;ll++)
+          Ppair(pair_index(kk,ll))=P(kk,ll)+P(ll,kk);
+        Ppair(pair_index(kk,kk))=P(kk,kk);
+      }
+
+      // Symmetric matrix - vector product in packed storage
+      arma::Col<T> Jpair(Np,arma::fill::zeros);
+      const T * t(ptei.memptr());
+      for(size_t ij=0;ij<Np;ij++) {
+        T Jij(0.0);
+        for(size_t kl=0;kl<ij;kl++) {
+          Jij+=t[kl]*Ppair(kl);
+          Jpair(kl)+=t[kl]*Ppair(ij);
+        }
+        Jpair(ij)+=Jij+t[ij]*Ppair(ij);
+        t+=ij+1;
+      }
+
+      arma::Mat<T> J(N,N);
+      for(size_t ii=0;ii<N;ii++)
+        for(size_t jj=0;jj<=ii;jj++)
+          J(ii,jj)=J(jj,ii)=Jpair(pair_index(ii,jj));
+
+      return J;
+    }
+
+    template<typename T> static arma::Mat<T> packed_exchange_wrk(const arma::Col<T> & ptei, const arma::Mat<T> & P) {
+      const size_t N(P.n_rows);
+      if(P.n_cols != N || ptei.n_elem != packed_tei_size(N))
+        throw std::logic_error("Packed tei does not match the density matrix!\n");
+
+      arma::Mat<T> K(N,N,arma::fill::zeros);
+      // Integrals (ij|kl) for fixed kl
+      arma::Mat<T> G(N,N);
+      for(size_t kk=0;kk<N;kk++)
+        for(size_t ll=0;ll<=kk;ll++) {
+          // Unpack the block; G is symmetric
+          size_t kl(pair_index(kk,ll));
+          for(size_t jj=0;jj<N;jj++)
+            for(size_t ii=0;ii<=jj;ii++)
+              G(ii,jj)=G(jj,ii)=ptei(pair_index(pair_index(ii,jj),kl));
+
+          // K(jk) += (ij|kl) P(il), and by symmetry K(jl) += (ij|lk) P(ik)
+          K.col(kk)+=G*P.col(ll);
+          if(kk!=ll)
+            K.col(ll)+=G*P.col(kk);
+        }
+
+      return K;
+    }
+
+    arma::mat packed_coulomb(const arma::vec & ptei, const arma::mat & P) {
+      return packed_coulomb_wrk<double>(ptei,P);
+    }
+
+    arma::fmat packed_coulomb(const arma::fvec & ptei, const arma::fmat & P) {
+      return packed_coulomb_wrk<float>(ptei,P);
+    }
+
+    arma::mat packed_exchange(const arma::vec & ptei, const arma::mat & P) {
+      return packed_exchange_wrk<double>(ptei,P);
+    }
+
+    arma::fmat packed_exchange(const arma::fvec & ptei, const arma::fmat & P) {
+      return packed_exchange_wrk<float>(ptei,P);
+    }
+
+    arma::mat factor_tei(const arma::mat & tei, double thr) {
+      arma::vec lambda;
+      arma::mat V;
+      if(!arma::eig_sym(lambda,V,tei))
+        throw std::logic_error("Eigendecomposition of two-electron integrals failed!\n");
+      const double lmax(lambda.n_elem ? lambda(lambda.n_elem-1) : 0.0);
+      // The in-element Coulomb kernel is positive semidefinite, so
+      // significant negative eigenvalues mean the block can't be factorized
+      if(lmax<=0.0 || lambda(0) < -thr*lmax)
+        return arma::mat();
+
+      arma::uvec keep(arma::find(lambda > thr*lmax));
+      return V.cols(keep)*arma::diagmat(arma::sqrt(lambda(keep)));
+    }
+
+    arma::mat factored_coulomb(const arma::mat & B, const arma::mat & P) {
+      const size_t N(P.n_rows);
+      if(P.n_cols != N || B.n_rows != N*N)
+        throw std::logic_error("Factorized tei does not match the density matrix!\n");
+      arma::vec J(B*(B.t()*arma::vectorise(P)));
+      return arma::reshape(J,N,N);
+    }
+
+    arma::mat factored_exchange(const arma::mat & B, const arma::mat & P) {
+      const size_t N(P.n_rows);
+      if(P.n_cols != N || B.n_rows != N*N)
+        throw std::logic_error("Factorized tei does not match the density matrix!\n");
+
+      // (ij|kl) = sum_r B_r(i,j) B_r(k,l) so K = sum_r B_r^T P B_r^T
+      arma::mat K(N,N,arma::fill::zeros);
+      for(size_t r=0;r<B.n_cols;r++) {
+        const arma::mat Br(const_cast<double *>(B.colptr(r)),N,N,false,true);
+        K+=Br.t()*P*Br.t();
+      }
+      return K;
+    }
+
+    arma::rowvec real_column_dot(const arma::cx_mat & A, const arma::cx_mat & B) {
+      if(A.n_rows != B.n_rows || A.n_cols != B.n_cols)
+        throw std::logic_error("Matrices in column dot product do not match!\n");
+
+      arma::rowvec d(A.n_cols);
+      // Real and imaginary parts are interleaved in memory
+      const size_t N(2*A.n_rows);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for(size_t ip=0;ip<A.n_cols;ip++) {
+        const double * a((const double *) A.colptr(ip));
+        const double * b((const double *) B.colptr(ip));
+        double sum=0.0;
+        for(size_t i=0;i<N;i+=2)
+          sum+=a[i]*b[i]-a[i+1]*b[i+1];
+        d(ip)=sum;
+      }
+
+      return d;
+    }
+
+    arma::rowvec real_column_dot(const arma::mat & A, const arma::mat & B) {
+      if(A.n_rows != B.n_rows || A.n_cols != B.n_cols)
+        throw std::logic_error("Matrices in column dot product do not match!\n");
+      return arma::sum(A%B,0);
+    }
+
     int stricmp(const std::string & str1, const std::string & str2) {
       return strcasecmp(str1.c_str(),str2.c_str());
     }
@@ -37,6 +37,10 @@ namespace helfem {
     double bessel_kl(double x, int L);
     /// Modified Bessel function
     arma::vec bessel_kl(const arma::vec & x, int L);
+    /// Modified Bessel functions i_L(x) for all L <= Lmax at once, as a x.n_elem x (Lmax+1) matrix
+    arma::mat bessel_il_array(const arma::vec & x, int Lmax);
+    /// Modified Bessel functions k_L(x) for all L <= Lmax at once, as a x.n_elem x (Lmax+1) matrix
+    arma::mat bessel_kl_array(const arma::vec & x, int Lmax);
 
     /// Form two-electron integrals from product of large-r and small-r radial moment matrices
     arma::mat product_tei(const arma::mat & big, const arma::mat & small);
@@ -47,6 +51,32 @@ namespace helfem {
     /// Permute indices (ij|kl) -> (jk|il)
     arma::mat exchange_tei(const arma::mat & tei, size_t Ni, size_t Nj, size_t Nk, size_t Nl);
 
+    /// Number of symmetry-unique elements in a packed in-element (ij|kl) block of N functions
+    size_t packed_tei_size(size_t N);
+    /// Pack an in-element (ij|kl) block using the 8-fold permutational symmetry
+    arma::vec pack_tei(const arma::mat & tei, size_t N);
+    /// Unpack an in-element (ij|kl) block
+    arma::mat unpack_tei(const arma::vec & ptei, size_t N);
+    /// Coulomb contraction J(ij) = (ij|kl) P(kl) with packed integrals
+    arma::mat packed_coulomb(const arma::vec & ptei, const arma::mat & P);
+    /// Exchange contraction K(jk) = (ij|kl) P(il) with packed integrals
+    arma::mat packed_exchange(const arma::vec & ptei, const arma::mat & P);
+    /// Single precision Coulomb contraction with packed integrals
+    arma::fmat packed_coulomb(const arma::fvec & ptei, const arma::fmat & P);
+    /// Single precision exchange contraction with packed integrals
+    arma::fmat packed_exchange(const arma::fvec & ptei, const arma::fmat & P);
+    /// Factorize an in-element (ij|kl) block as B B^T, dropping eigenvalues below thr times the largest; empty if the block is not positive semidefinite
+    arma::mat factor_tei(const arma::mat & tei, double thr);
+    /// Coulomb contraction J(ij) = (ij|kl) P(kl) with factorized integrals
+    arma::mat factored_coulomb(const arma::mat & B, const arma::mat & P);
+    /// Exchange contraction K(jk) = (ij|kl) P(il) with factorized integrals
+    arma::mat factored_exchange(const arma::mat & B, const arma::mat & P);
+
+    /// Real parts of the column-wise products d(p) = sum_i A(i,p) B(i,p), computed in one pass
+    arma::rowvec real_column_dot(const arma::cx_mat & A, const arma::cx_mat & B);
+    /// Same for real matrices
+    arma::rowvec real_column_dot(const arma::mat & A, const arma::mat & B);
+
     /// Case independent string comparison
     int stricmp(const std::string & str1, const std::string & str2);
   }
@@ -21,8 +21,11 @@
 #include "../general/gaunt.h"
 #include "utils.h"
 #include "../general/scf_helpers.h"
+#include "../general/threading.h"
+#include <algorithm>
 #include <cassert>
 #include <cfloat>
+#include <sstream>
 #include <helfem.h>
 
 #ifdef _OPENMP
@@ -32,10 +35,10 @@
 namespace helfem {
   namespace atomic {
     namespace basis {
-      TwoDBasis::TwoDBasis() {
+      TwoDBasis::TwoDBasis() : direct_ktei(false), single_prec(false), tei_factor_thr(0.0), kscreen(0.0), kscreen_fraction(0.0) {
       }
 
-      TwoDBasis::TwoDBasis(int Z_, modelpotential::nuclear_model_t model_, double Rrms_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, bool zeroder_, int n_quad, const arma::vec & bval, int taylor_order, const arma::ivec & lval_, const arma::ivec & mval_, int Zl_, int Zr_, double Rhalf_) {
+      TwoDBasis::TwoDBasis(int Z_, modelpotential::nuclear_model_t model_, double Rrms_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, bool zeroder_, int n_quad, const arma::vec & bval, int taylor_order, const arma::ivec & lval_, const arma::ivec & mval_, int Zl_, int Zr_, double Rhalf_, const arma::ivec & el_nnodes) {
         // Nuclear charge
         Z=Z_;
         Zl=Zl_;
@@ -49,12 +52,135 @@ namespace helfem {
         bool zero_deriv_left=false;
         bool zero_func_right=true;
         zeroder=zeroder_;
-        polynomial_basis::FiniteElementBasis fem(poly, bval, zero_func_left, zero_deriv_left, zero_func_right, zeroder);
-        radial=RadialBasis(fem, n_quad, taylor_order);
+        if(el_nnodes.n_elem) {
+          // Polynomials of different order in the elements
+          if(el_nnodes.n_elem+1 != bval.n_elem)
+            throw std::logic_error("Need a number of nodes for every element!\n");
+          std::vector< std::shared_ptr<const polynomial_basis::PolynomialBasis> > polys(el_nnodes.n_elem);
+          for(size_t iel=0;iel<el_nnodes.n_elem;iel++)
+            polys[iel]=std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(poly->get_id(),el_nnodes(iel)));
+          polynomial_basis::FiniteElementBasis fem(polys, bval, zero_func_left, zero_deriv_left, zero_func_right, zeroder);
+          radial=RadialBasis(fem, n_quad, taylor_order);
+        } else {
+          polynomial_basis::FiniteElementBasis fem(poly, bval, zero_func_left, zero_deriv_left, zero_func_right, zeroder);
+          radial=RadialBasis(fem, n_quad, taylor_order);
+        }
 
         // Construct angular basis
         lval=lval_;
         mval=mval_;
+
+        // Exchange integrals are stored by default
+        direct_ktei=false;
+        // Double precision integrals by default
+        single_prec=false;
+        // Threads share the integrals by default
+        numa_partition=false;
+        batched_exchange=false;
+        // Full in-element integrals by default
+        tei_factor_thr=0.0;
+        // No exchange screening by default
+        kscreen=0.0;
+        kscreen_fraction=0.0;
+      }
+
+      void TwoDBasis::set_exchange_screening(double thr) {
+        kscreen=thr;
+      }
+
+      double TwoDBasis::get_exchange_screening_fraction() const {
+        return kscreen_fraction;
+      }
+
+      void TwoDBasis::set_single_precision(bool sp) {
+        single_prec=sp;
+        if(single_prec) {
+          prim_tei_f.resize(prim_tei.size());
+          prim_ktei_f.resize(prim_ktei.size());
+          if(numa_partition) {
+            // Only the in-element blocks are nonzero; convert them on
+            // the threads that own them
+            const size_t Nel(radial.Nel());
+            const size_t N_L(Nel ? prim_tei.size()/(Nel*Nel) : 0);
+            element_partition([&](size_t iel) {
+                                for(size_t L=0;L<N_L;L++) {
+                                  const size_t idx(Nel*Nel*L + iel*Nel + iel);
+                                  prim_tei_f[idx]=arma::conv_to<arma::fvec>::from(prim_tei[idx]);
+                                  if(prim_ktei.size())
+                                    prim_ktei_f[idx]=arma::conv_to<arma::fmat>::from(prim_ktei[idx]);
+                                }
+                              });
+          } else {
+            for(size_t i=0;i<prim_tei.size();i++)
+              prim_tei_f[i]=arma::conv_to<arma::fvec>::from(prim_tei[i]);
+            for(size_t i=0;i<prim_ktei.size();i++)
+              prim_ktei_f[i]=arma::conv_to<arma::fmat>::from(prim_ktei[i]);
+          }
+        } else {
+          // Free the copies
+          prim_tei_f.clear();
+          prim_ktei_f.clear();
+        }
+      }
+
+      bool TwoDBasis::get_single_precision() const {
+        return single_prec;
+      }
+
+      void TwoDBasis::set_numa_partition(bool numa) {
+        numa_partition=numa;
+#ifdef _OPENMP
+        if(numa_partition && omp_get_proc_bind()==omp_proc_bind_false)
+          printf("Warning: NUMA partitioning of the integrals needs bound threads, e.g. OMP_PROC_BIND=close and OMP_PLACES=cores.\n");
+#endif
+      }
+
+      void TwoDBasis::set_batched_exchange(bool batched) {
+        batched_exchange=batched;
+      }
+
+      void TwoDBasis::set_tei_factorization(double thr) {
+        tei_factor_thr=thr;
+      }
+
+      bool TwoDBasis::factor_block(size_t idx, size_t Ni, const arma::mat & tei) {
+        if(tei_factor_thr<=0.0)
+          return false;
+        arma::mat B(utils::factor_tei(tei,tei_factor_thr));
+        // Coulomb costs 2 Ni^2 r and exchange 2 Ni^3 r flops with the
+        // factors, against Ni^4/2 and Ni^4 with the full block
+        if(!B.n_elem || 4*B.n_cols >= 3*Ni)
+          return false;
+        tei_factor[idx]=B;
+        return true;
+      }
+
+      double TwoDBasis::in_element_norm(size_t idx) const {
+        if(tei_factor.size() && tei_factor[idx].n_elem)
+          return arma::norm(tei_factor[idx].t()*tei_factor[idx],"fro");
+        // Each unique integral appears at most 8 times in the full block
+        return std::sqrt(8.0)*arma::norm(prim_tei[idx],2);
+      }
+
+      void TwoDBasis::element_partition(const std::function<void(size_t)> & f) const {
+        const size_t Nel(radial.Nel());
+        /*
+          Static schedules of the same loop over the same team hand
+          each thread the same iterations, so the element blocks are
+          always processed by the thread that first touched them. The
+          even and odd elements are done in separate passes, since
+          neighbouring elements share a boundary function.
+        */
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+        for(size_t parity=0;parity<2;parity++) {
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+          for(size_t iel=parity;iel<Nel;iel+=2)
+            f(iel);
+        }
       }
 
       TwoDBasis::~TwoDBasis() {
@@ -108,10 +234,120 @@ namespace helfem {
         return radial.get_poly_nnodes();
       }
 
+      arma::ivec TwoDBasis::get_element_nnodes() const {
+        return radial.get_element_nnodes();
+      }
+
+      std::string TwoDBasis::fingerprint() const {
+        std::ostringstream oss;
+        oss.precision(17);
+        oss << "atomic Z=" << Z << " Zl=" << Zl << " Zr=" << Zr << " Rhalf=" << Rhalf << " model=" << (int) model << " Rrms=" << Rrms;
+        oss << " poly=" << get_poly_id() << " zeroder=" << zeroder << " nquad=" << get_nquad() << " taylor=" << get_taylor_order();
+        arma::ivec nnodes(get_element_nnodes());
+        oss << " nnodes=";
+        for(size_t i=0;i<nnodes.n_elem;i++)
+          oss << " " << nnodes(i);
+        arma::vec bval(get_bval());
+        oss << " bval=";
+        for(size_t i=0;i<bval.n_elem;i++)
+          oss << " " << bval(i);
+        oss << " lm=";
+        for(size_t i=0;i<lval.n_elem;i++)
+          oss << " " << lval(i) << "," << mval(i);
+        return scf::hash_string(oss.str());
+      }
+
       int TwoDBasis::get_zeroder() const {
         return zeroder;
       }
 
+      const gaunt::Gaunt & TwoDBasis::get_gaunt() const {
+#ifdef _OPENMP
+#pragma omp critical(twodbasis_gaunt)
+#endif
+        if(!gaunt_table) {
+          int gmax(std::max(arma::max(lval),arma::max(mval)));
+          // The middle index also has to cover the sin^2 coupling in Bz_field
+          gaunt_table=std::make_shared<gaunt::Gaunt>(gmax,std::max(2*gmax,4),gmax);
+        }
+        return *gaunt_table;
+      }
+
+      /// Sort couplings by channel
+      static bool coupling_channel_less(const angular_coupling_t & lh, const angular_coupling_t & rh) {
+        if(lh.L != rh.L)
+          return lh.L < rh.L;
+        return lh.M < rh.M;
+      }
+
+      const angular_coupling_list_t & TwoDBasis::get_angular_couplings() const {
+        const gaunt::Gaunt & gaunt(get_gaunt());
+#ifdef _OPENMP
+#pragma omp critical(twodbasis_couplings)
+#endif
+        if(!ang_couplings) {
+          std::shared_ptr<angular_coupling_list_t> cpl(std::make_shared<angular_coupling_list_t>());
+          cpl->offset.resize(lval.n_elem+1);
+          for(size_t iang=0;iang<lval.n_elem;iang++) {
+            cpl->offset[iang]=cpl->list.size();
+            int li(lval(iang));
+            int mi(mval(iang));
+            for(size_t jang=0;jang<lval.n_elem;jang++) {
+              int lj(lval(jang));
+              int mj(mval(jang));
+              int M(mi-mj);
+              for(int L=std::max(std::abs(li-lj),std::abs(M));L<=li+lj;L++) {
+                double c(gaunt.coeff(li,mi,L,M,lj,mj));
+                if(c==0.0)
+                  continue;
+                angular_coupling_t entry;
+                entry.iang=iang;
+                entry.jang=jang;
+                entry.L=L;
+                entry.M=M;
+                entry.cpl=c;
+                cpl->list.push_back(entry);
+              }
+            }
+            std::stable_sort(cpl->list.begin()+cpl->offset[iang],cpl->list.end(),coupling_channel_less);
+          }
+          cpl->offset[lval.n_elem]=cpl->list.size();
+
+          // Pair ordering, so that each density block is only touched once
+          cpl->pair_order.resize(cpl->list.size());
+          for(size_t i=0;i<cpl->list.size();i++)
+            cpl->pair_order[i]=i;
+          const std::vector<angular_coupling_t> & list(cpl->list);
+          std::stable_sort(cpl->pair_order.begin(),cpl->pair_order.end(),[&list](size_t lh, size_t rh) {
+            if(list[lh].iang != list[rh].iang)
+              return list[lh].iang < list[rh].iang;
+            if(list[lh].jang != list[rh].jang)
+              return list[lh].jang < list[rh].jang;
+            return list[lh].L < list[rh].L;
+          });
+          for(size_t i=0;i<cpl->pair_order.size();i++) {
+            const angular_coupling_t & c(list[cpl->pair_order[i]]);
+            if(i==0 || c.iang != list[cpl->pair_order[i-1]].iang || c.jang != list[cpl->pair_order[i-1]].jang)
+              cpl->pair_offset.push_back(i);
+          }
+          cpl->pair_offset.push_back(cpl->pair_order.size());
+
+          // Channel ordering, so that the channels can be handled in parallel
+          cpl->channel_order=cpl->pair_order;
+          std::stable_sort(cpl->channel_order.begin(),cpl->channel_order.end(),[&list](size_t lh, size_t rh) {
+            return coupling_channel_less(list[lh],list[rh]);
+          });
+          for(size_t i=0;i<cpl->channel_order.size();i++) {
+            const angular_coupling_t & c(list[cpl->channel_order[i]]);
+            if(i==0 || coupling_channel_less(list[cpl->channel_order[i-1]],c))
+              cpl->channel_offset.push_back(i);
+          }
+          cpl->channel_offset.push_back(cpl->channel_order.size());
+          ang_couplings=cpl;
+        }
+        return *ang_couplings;
+      }
+
       size_t TwoDBasis::Ndummy() const {
         return lval.n_elem*radial.Nbf();
       }
@@ -320,7 +556,7 @@ namespace helfem {
         for(size_t iang=0;iang<lval.n_elem;iang++)
           set_sub(O,iang,iang,Orad);
 
-        return remove_boundaries(O);
+        return O;
       }
 
       arma::mat TwoDBasis::overlap() const {
@@ -372,7 +608,7 @@ namespace helfem {
           }
         }
 
-        return remove_boundaries(T);
+        return T;
       }
 
       arma::mat TwoDBasis::nuclear() const {
@@ -420,8 +656,7 @@ namespace helfem {
               }
             }
 
-            int gmax(std::max(arma::max(lval),arma::max(mval)));
-            gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
+            const gaunt::Gaunt & gaunt(get_gaunt());
 
             /// Loop over basis set
 #ifdef _OPENMP
@@ -451,7 +686,7 @@ namespace helfem {
             }
           }
 
-          return remove_boundaries(V);
+          return V;
         }
       }
 
@@ -474,15 +709,16 @@ namespace helfem {
 	for(size_t iang=0;iang<lval.n_elem;iang++)
 	  set_sub(V,iang,iang,Vrad);
 
-        return remove_boundaries(V);
+        return V;
       }
 
       arma::mat TwoDBasis::confinement(const int N, const double r_0, const int iconf) const {
         // Full matrix
         arma::mat O(Ndummy(),Ndummy());
         O.zeros();
-	if(N==0)
-	  return remove_boundaries(O);
+	// Hard wall is handled by the basis set itself
+	if(N==0 || iconf==3)
+	  return O;
 
 	// Build radial elements
         size_t Nrad(radial.Nbf());
@@ -518,7 +754,57 @@ namespace helfem {
         for(size_t iang=0;iang<lval.n_elem;iang++)
           set_sub(O,iang,iang,Orad);
 
-        return remove_boundaries(O);
+        return O;
+      }
+
+      arma::mat TwoDBasis::confinement_derivative(const int N, const double r_0, const int iconf) const {
+        // Full matrix
+        arma::mat O(Ndummy(),Ndummy());
+        O.zeros();
+	if(N==0 && iconf!=3)
+	  return O;
+
+	// Build radial elements
+        size_t Nrad(radial.Nbf());
+        arma::mat Orad(Nrad,Nrad);
+        Orad.zeros();
+
+	if (iconf==3) {
+	  // Hard wall at the end of the basis
+	  size_t ifirst, ilast;
+	  radial.get_idx(radial.Nel()-1,ifirst,ilast);
+	  Orad.submat(ifirst,ifirst,ilast,ilast)+=radial.hard_wall_derivative();
+
+	} else if (iconf==1) {
+	  // Loop over elements
+	  for(size_t iel=0;iel<radial.Nel();iel++) {
+	    // Where are we in the matrix?
+	    size_t ifirst, ilast;
+	    radial.get_idx(iel,ifirst,ilast);
+	    Orad.submat(ifirst,ifirst,ilast,ilast)+=radial.radial_integral(N,iel);
+	  }
+	  // d/dr_0 r_0^-N = -N r_0^(-N-1)
+	  if(N<0)
+	    Orad *= N*std::pow(r_0, -N-1);
+	  else
+	    Orad *= -N*std::pow(r_0, -N-1);
+
+	} else if (iconf==2) {
+	  // Loop over elements
+	  for(size_t iel=0;iel<radial.Nel();iel++) {
+	    // Where are we in the matrix?
+	    size_t ifirst, ilast;
+	    radial.get_idx(iel,ifirst,ilast);
+	    Orad.submat(ifirst,ifirst,ilast,ilast)+=radial.exponential_confinement_derivative(iel, N, r_0);
+	  }
+	}
+	else throw std::logic_error("Case not implemented!\n");
+
+        // Fill elements
+        for(size_t iang=0;iang<lval.n_elem;iang++)
+          set_sub(O,iang,iang,Orad);
+
+        return O;
       }
 
       arma::mat TwoDBasis::dipole_z() const {
@@ -539,8 +825,7 @@ namespace helfem {
           Orad.submat(ifirst,ifirst,ilast,ilast)+=radial.radial_integral(1,iel);
         }
 
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,1,gmax);
+        const gaunt::Gaunt & gaunt(get_gaunt());
 
         // Fill elements
         for(size_t iang=0;iang<lval.n_elem;iang++) {
@@ -558,7 +843,7 @@ namespace helfem {
           }
         }
 
-        return remove_boundaries(V);
+        return V;
       }
 
       arma::mat TwoDBasis::quadrupole_zz() const {
@@ -579,8 +864,7 @@ namespace helfem {
           Orad.submat(ifirst,ifirst,ilast,ilast)+=radial.radial_integral(2,iel);
         }
 
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,2,gmax);
+        const gaunt::Gaunt & gaunt(get_gaunt());
 
         // Fill elements
         for(size_t iang=0;iang<lval.n_elem;iang++) {
@@ -601,7 +885,7 @@ namespace helfem {
           }
         }
 
-        return remove_boundaries(V);
+        return V;
       }
 
       arma::mat TwoDBasis::Bz_field(double B) const {
@@ -625,8 +909,7 @@ namespace helfem {
         arma::mat V(Ndummy(),Ndummy());
         V.zeros();
 
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,4,gmax);
+        const gaunt::Gaunt & gaunt(get_gaunt());
 
         // Fill elements
         for(size_t iang=0;iang<lval.n_elem;iang++) {
@@ -649,7 +932,7 @@ namespace helfem {
           }
         }
 
-        return remove_boundaries(V);
+        return V;
       }
 
       size_t TwoDBasis::mem_1el() const {
@@ -664,7 +947,7 @@ namespace helfem {
         return 2*N_L*Nel*Nprim*Nprim*sizeof(double);
       }
 
-      size_t TwoDBasis::mem_2el_aux() const {
+      size_t TwoDBasis::mem_2el_aux(bool exchange, bool direct) const {
         // Auxiliary integrals required up to
         size_t N_L(2*arma::max(lval)+1);
         // Number of elements
@@ -674,48 +957,40 @@ namespace helfem {
 
         // Memory use is thus
         //return 2*N_L*Nel*Nel*Nprim*Nprim*Nprim*Nprim*sizeof(double);
-        // No off-diagonal storage
-        return 2*N_L*Nel*Nprim*Nprim*Nprim*Nprim*sizeof(double);
+        // No off-diagonal storage; the Coulomb integrals are packed,
+        // the exchange-ordered copy is stored in full unless the
+        // exchange integrals are formed on the fly
+        size_t Nk((exchange && !direct) ? Nprim*Nprim*Nprim*Nprim : 0);
+        return N_L*Nel*(utils::packed_tei_size(Nprim)+Nk)*sizeof(double);
       }
 
-
-      void TwoDBasis::compute_tei(bool exchange) {
-        // Number of distinct L values is
+      size_t TwoDBasis::mem_2el_rs() const {
         size_t N_L(2*arma::max(lval)+1);
         size_t Nel(radial.Nel());
+        size_t Nprim(radial.max_Nprim());
 
-        // Compute disjoint integrals
-        disjoint_L.resize(Nel*N_L);
-        disjoint_m1L.resize(Nel*N_L);
-        for(size_t L=0;L<N_L;L++)
-          for(size_t iel=0;iel<Nel;iel++) {
-            disjoint_L[L*Nel+iel]=radial.radial_integral(L,iel);
-            disjoint_m1L[L*Nel+iel]=radial.radial_integral(-L-1,iel);
-          }
+        // All element pairs are stored in exchange order
+        return N_L*Nel*Nel*Nprim*Nprim*Nprim*Nprim*sizeof(double);
+      }
 
-        // Form two-electron integrals
-        prim_tei.resize(Nel*Nel*N_L);
-#ifdef _OPENMP
-#pragma omp parallel for collapse(2)
-#endif
-        for(size_t L=0;L<N_L;L++) {
-          for(size_t iel=0;iel<Nel;iel++) {
-            // In-element integral
-            prim_tei[Nel*Nel*L + iel*Nel + iel]=radial.twoe_integral(L,iel);
 
-            /*
-              for(size_t jel=0;jel<Nel;jel++) {
-	      // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
-	      const arma::mat & iint=(iel>jel) ? disjoint_m1L[L*Nel+iel] : disjoint_L[L*Nel+iel];
-	      const arma::mat & jint=(iel>jel) ? disjoint_L[L*Nel+jel] : disjoint_m1L[L*Nel+jel];
+      void TwoDBasis::compute_tei(bool exchange, bool direct) {
+        direct_ktei=direct;
 
-	      // Store integrals
-	      prim_tei[Nel*Nel*L + iel*Nel + jel]=utils::product_tei(iint,jint);
-              }
-              }
-            */
-          }
+        // Number of distinct L values is
+        size_t N_L(2*arma::max(lval)+1);
+        size_t Nel(radial.Nel());
+
+        // Radial moments r^L and r^(-L-1) for the disjoint integrals
+        // are computed in parallel from the tabulated basis functions
+        std::vector<int> Rexps;
+        for(size_t L=0;L<N_L;L++) {
+          Rexps.push_back(L);
+          Rexps.push_back(-((int) L)-1);
         }
+        radial.precompute_radial_moments(Rexps);
+        disjoint_L.resize(Nel*N_L);
+        disjoint_m1L.resize(Nel*N_L);
 
         /*
           The exchange matrix is given by
@@ -727,31 +1002,70 @@ namespace helfem {
           K(jk) = (jk;il) P(il)
           so we don't have to reform the permutations in the exchange routine.
         */
-        if(exchange) {
+        if(exchange && !direct)
           prim_ktei.resize(Nel*Nel*N_L);
+        else
+          prim_ktei.clear();
+
+        // Form two-electron integrals
+        prim_tei.resize(Nel*Nel*N_L);
+        tei_factor.clear();
+        tei_factor.resize(Nel*Nel*N_L);
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2)
+#pragma omp parallel
+#endif
+        {
+          // Disjoint integrals are copied from the cache; the threads go
+          // on to the in-element integrals without waiting
+#ifdef _OPENMP
+#pragma omp for collapse(2) nowait
 #endif
           for(size_t L=0;L<N_L;L++)
             for(size_t iel=0;iel<Nel;iel++) {
-              // Diagonal integrals
-              size_t Ni(radial.Nprim(iel));
-              prim_ktei[Nel*Nel*L + iel*Nel + iel]=utils::exchange_tei(prim_tei[Nel*Nel*L + iel*Nel + iel],Ni,Ni,Ni,Ni);
-
-              // Off-diagonal integrals (not used since faster to contract
-              // the integrals in factorized form)
-              /*
-                for(size_t jel=0;jel<iel;jel++) {
-                size_t Nj(radial.Nprim(jel));
-                prim_ktei[Nel*Nel*L + iel*Nel + jel]=utils::exchange_tei(prim_tei[Nel*Nel*L + iel*Nel + jel],Ni,Ni,Nj,Nj);
-                }
-                for(size_t jel=iel+1;jel<Nel;jel++) {
-                size_t Nj(radial.Nprim(jel));
-                prim_ktei[Nel*Nel*L + iel*Nel + jel]=utils::exchange_tei(prim_tei[Nel*Nel*L + iel*Nel + jel],Ni,Ni,Nj,Nj);
-                }
-              */
+              disjoint_L[L*Nel+iel]=radial.radial_integral(L,iel);
+              disjoint_m1L[L*Nel+iel]=radial.radial_integral(-L-1,iel);
             }
+
+          // In-element integrals
+          auto in_element = [&](size_t L, size_t iel) {
+                              size_t Ni(radial.Nprim(iel));
+                              arma::mat tei(radial.twoe_integral(L,iel));
+                              if(factor_block(Nel*Nel*L + iel*Nel + iel,Ni,tei))
+                                return;
+                              if(exchange && !direct)
+                                prim_ktei[Nel*Nel*L + iel*Nel + iel]=utils::exchange_tei(tei,Ni,Ni,Ni,Ni);
+                              // Only the symmetry-unique integrals are stored
+                              prim_tei[Nel*Nel*L + iel*Nel + iel]=utils::pack_tei(tei,Ni);
+                            };
+
+          if(numa_partition) {
+            // Same partition as the in-element exchange contraction
+            for(size_t parity=0;parity<2;parity++) {
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+              for(size_t iel=parity;iel<Nel;iel+=2)
+                for(size_t L=0;L<N_L;L++)
+                  in_element(L,iel);
+            }
+          } else {
+#ifdef _OPENMP
+#pragma omp for collapse(2) schedule(dynamic)
+#endif
+            for(size_t L=0;L<N_L;L++)
+              for(size_t iel=0;iel<Nel;iel++)
+                in_element(L,iel);
+          }
         }
+
+        /*
+          Off-diagonal exchange integrals are not used since it is faster
+          to contract the integrals in factorized form.
+        */
+
+        // Refresh the single precision copies
+        if(single_prec)
+          set_single_precision(true);
       }
 
       void TwoDBasis::compute_yukawa(double lambda_) {
@@ -762,14 +1076,8 @@ namespace helfem {
         size_t N_L(2*arma::max(lval)+1);
         size_t Nel(radial.Nel());
 
-        // Compute disjoint integrals
         disjoint_iL.resize(Nel*N_L);
         disjoint_kL.resize(Nel*N_L);
-        for(size_t L=0;L<N_L;L++)
-          for(size_t iel=0;iel<Nel;iel++) {
-            disjoint_iL[L*Nel+iel]=radial.bessel_il_integral(L,lambda,iel);
-            disjoint_kL[L*Nel+iel]=radial.bessel_kl_integral(L,lambda,iel);
-          }
 
         /*
           The exchange matrix is given by
@@ -783,14 +1091,36 @@ namespace helfem {
         */
         rs_ktei.resize(Nel*Nel*N_L);
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2)
+#pragma omp parallel
+#endif
+        {
+          // Disjoint integrals
+#ifdef _OPENMP
+#pragma omp for nowait
 #endif
-        for(size_t L=0;L<N_L;L++)
           for(size_t iel=0;iel<Nel;iel++) {
-            // Diagonal integrals
-            size_t Ni(radial.Nprim(iel));
-            rs_ktei[Nel*Nel*L + iel*Nel + iel]=utils::exchange_tei(radial.yukawa_integral(L,lambda,iel),Ni,Ni,Ni,Ni);
+            // All L values from a single evaluation of the Bessel functions
+            std::vector<arma::mat> il, kl;
+            radial.bessel_integrals(N_L-1,lambda,iel,il,kl);
+            for(size_t L=0;L<N_L;L++) {
+              disjoint_iL[L*Nel+iel]=il[L];
+              disjoint_kL[L*Nel+iel]=kl[L];
+            }
           }
+
+#ifdef _OPENMP
+#pragma omp for collapse(2) schedule(dynamic)
+#endif
+          for(size_t L=0;L<N_L;L++)
+            for(size_t iel=0;iel<Nel;iel++) {
+              // Diagonal integrals
+              size_t Ni(radial.Nprim(iel));
+              rs_ktei[Nel*Nel*L + iel*Nel + iel]=utils::exchange_tei(radial.yukawa_integral(L,lambda,iel),Ni,Ni,Ni,Ni);
+            }
+        }
+
+        // Norms for screening
+        compute_rs_norms();
       }
 
       void TwoDBasis::compute_erfc(double mu) {
@@ -816,8 +1146,10 @@ namespace helfem {
           so we don't have to reform the permutations in the exchange routine.
         */
         rs_ktei.resize(Nel*Nel*N_L);
+        // The in-element integrals use a finer inner grid and are more
+        // expensive than the rest
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2)
+#pragma omp parallel for collapse(3) schedule(dynamic)
 #endif
         for(size_t L=0;L<N_L;L++)
           for(size_t iel=0;iel<Nel;iel++) {
@@ -828,158 +1160,246 @@ namespace helfem {
               rs_ktei[Nel*Nel*L + iel*Nel + kel]=utils::exchange_tei(radial.erfc_integral(L,lambda,iel,kel),Ni,Ni,Nk,Nk);
             }
           }
+
+        // Norms for screening
+        compute_rs_norms();
+      }
+
+      void TwoDBasis::compute_rs_norms() {
+        rs_ktei_norm.zeros(rs_ktei.size());
+        for(size_t i=0;i<rs_ktei.size();i++)
+          if(rs_ktei[i].n_elem)
+            rs_ktei_norm(i)=arma::norm(rs_ktei[i],"fro");
+      }
+
+      void TwoDBasis::get_tei(std::vector<arma::mat> & L, std::vector<arma::mat> & m1L, std::vector<arma::mat> & tei) const {
+        L=disjoint_L;
+        m1L=disjoint_m1L;
+        // Packed integrals are stored as column vectors
+        tei.resize(prim_tei.size());
+        for(size_t i=0;i<prim_tei.size();i++) {
+          if(tei_factor.size() && tei_factor[i].n_elem) {
+            size_t iel(i%(radial.Nel()*radial.Nel()) / radial.Nel());
+            tei[i]=utils::pack_tei(tei_factor[i]*tei_factor[i].t(),radial.Nprim(iel));
+          } else
+            tei[i]=prim_tei[i];
+        }
+      }
+
+      void TwoDBasis::set_tei(bool exchange, bool direct, const std::vector<arma::mat> & L, const std::vector<arma::mat> & m1L, const std::vector<arma::mat> & tei) {
+        size_t N_L(2*arma::max(lval)+1);
+        size_t Nel(radial.Nel());
+        if(L.size() != Nel*N_L || m1L.size() != Nel*N_L || tei.size() != Nel*Nel*N_L)
+          throw std::logic_error("Two-electron integrals do not match the basis set!\n");
+
+        direct_ktei=direct;
+        disjoint_L=L;
+        disjoint_m1L=m1L;
+        prim_tei.resize(tei.size());
+        for(size_t i=0;i<tei.size();i++)
+          prim_tei[i]=arma::vectorise(tei[i]);
+        tei_factor.clear();
+        tei_factor.resize(tei.size());
+
+        // Exchange-ordered integrals and factors are cheap to reform
+        prim_ktei.clear();
+        if(exchange && !direct)
+          prim_ktei.resize(Nel*Nel*N_L);
+        if(tei_factor_thr>0.0 || prim_ktei.size()) {
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(dynamic)
+#endif
+          for(size_t iL=0;iL<N_L;iL++)
+            for(size_t iel=0;iel<Nel;iel++) {
+              size_t Ni(radial.Nprim(iel));
+              size_t idx(Nel*Nel*iL + iel*Nel + iel);
+              arma::mat full(utils::unpack_tei(prim_tei[idx],Ni));
+              if(factor_block(idx,Ni,full)) {
+                prim_tei[idx].reset();
+                continue;
+              }
+              if(prim_ktei.size())
+                prim_ktei[idx]=utils::exchange_tei(full,Ni,Ni,Ni,Ni);
+            }
+        }
+
+        // Refresh the single precision copies
+        if(single_prec)
+          set_single_precision(true);
+      }
+
+      void TwoDBasis::get_rs_integrals(std::vector<arma::mat> & ktei, std::vector<arma::mat> & iL, std::vector<arma::mat> & kL) const {
+        ktei=rs_ktei;
+        iL=disjoint_iL;
+        kL=disjoint_kL;
+      }
+
+      void TwoDBasis::set_rs_integrals(bool yukawa_, double lambda_, const std::vector<arma::mat> & ktei, const std::vector<arma::mat> & iL, const std::vector<arma::mat> & kL) {
+        size_t N_L(2*arma::max(lval)+1);
+        size_t Nel(radial.Nel());
+        if(ktei.size() != Nel*Nel*N_L)
+          throw std::logic_error("Range-separated integrals do not match the basis set!\n");
+        if(yukawa_ && (iL.size() != Nel*N_L || kL.size() != Nel*N_L))
+          throw std::logic_error("Yukawa auxiliary integrals do not match the basis set!\n");
+
+        yukawa=yukawa_;
+        lambda=lambda_;
+        rs_ktei=ktei;
+        disjoint_iL=iL;
+        disjoint_kL=kL;
+        compute_rs_norms();
       }
 
       arma::mat TwoDBasis::coulomb(const arma::mat & P0) const {
         if(!prim_tei.size())
           throw std::logic_error("Primitive teis have not been computed!\n");
 
-        // Extend to boundaries
-        arma::mat P(expand_boundaries(P0));
+        // The atomic basis has no dummy functions, so the density is used as such
+        const arma::mat & P(P0);
 
         // Number of radial elements
         size_t Nel(radial.Nel());
         // Number of radial functions
         size_t Nrad(radial.Nbf());
-        // Gaunt coefficient table
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
+        // Nonzero angular couplings
+        const angular_coupling_list_t & couplings(get_angular_couplings());
 
         // maximal M value
         int Mmax=arma::max(mval)-arma::min(mval);
 
-        // Radial helper matrices
-        std::vector< std::vector<arma::mat> > Paux(2*arma::max(lval)+1);
-        for(int L=0;L<(int) Paux.size();L++) {
-          Paux[L].resize(2*Mmax+1);
-          for(int M=-std::min(L,Mmax);M<=std::min(L,Mmax);M++) {
-            Paux[L][M+Mmax].zeros(Nrad,Nrad);
-          }
-        }
-
-        // Form radial helpers: contract ket
-        for(size_t kang=0;kang<lval.n_elem;kang++) {
-          for(size_t lang=0;lang<lval.n_elem;lang++) {
-            // l and m values
-            int lk(lval(kang));
-            int mk(mval(kang));
-            int ll(lval(lang));
-            int ml(mval(lang));
-            // RH m value
-            int M(mk-ml);
-            // M values match. Loop over possible couplings
-            int Lmin=std::max(std::abs(lk-ll),abs(M));
-            int Lmax=lk+ll;
-            for(int L=Lmin;L<=Lmax;L++) {
-              // Calculate coupling coefficient
-              double cpl(gaunt.coeff(lk,mk,L,M,ll,ml));
-              // Increment
-              Paux[L][M+Mmax]+=cpl*P.submat(kang*Nrad,lang*Nrad,(kang+1)*Nrad-1,(lang+1)*Nrad-1);
+        // Radial helper matrices, stored as [L*NM+M+Mmax] in memory
+        // from the scratch arena
+        ArenaLease arena(scratch);
+        const int NL(2*arma::max(lval)+1);
+        const int NM(2*Mmax+1);
+        std::vector<arma::mat> Paux, Jaux;
+        Paux.reserve(NL*NM);
+        Jaux.reserve(NL*NM);
+        for(int L=0;L<NL;L++)
+          for(int M=-Mmax;M<=Mmax;M++) {
+            if(std::abs(M)<=std::min(L,Mmax)) {
+              arena->push_zeros(Paux,Nrad,Nrad);
+              arena->push_zeros(Jaux,Nrad,Nrad);
+            } else {
+              Paux.emplace_back();
+              Jaux.emplace_back();
             }
           }
-        }
 
-        // Helper matrices
-        std::vector< std::vector<arma::mat> > Jaux(2*arma::max(lval)+1);
-        for(int L=0;L<(int) Jaux.size();L++) {
-          Jaux[L].resize(2*Mmax+1);
-          for(int M=-std::min(L,Mmax);M<=std::min(L,Mmax);M++) {
-            Jaux[L][M+Mmax].zeros(Nrad,Nrad);
+        // Form radial helpers: contract ket. Each thread handles
+        // whole (L,M) channels, so no reduction is necessary.
+        const std::vector<size_t> & corder(couplings.channel_order);
+        const std::vector<size_t> & coffset(couplings.channel_offset);
+        const size_t Nchannel(coffset.size()-1);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for(size_t ich=0;ich<Nchannel;ich++) {
+          const angular_coupling_t & c0(couplings.list[corder[coffset[ich]]]);
+          arma::mat & Pch(Paux[c0.L*NM+c0.M+Mmax]);
+          for(size_t ic=coffset[ich];ic<coffset[ich+1];ic++) {
+            const angular_coupling_t & c(couplings.list[corder[ic]]);
+            size_t kang(c.iang);
+            size_t lang(c.jang);
+            Pch+=c.cpl*P.submat(kang*Nrad,lang*Nrad,(kang+1)*Nrad-1,(lang+1)*Nrad-1);
           }
         }
-        // Contract integrals
-        for(int L=0;L<(int) Paux.size();L++) {
-          const double Lfac=4.0*M_PI/(2*L+1);
-
-          for(int M=-std::min(L,Mmax);M<=std::min(L,Mmax);M++) {
-            for(size_t jel=0;jel<Nel;jel++) {
-              size_t jfirst, jlast;
-              radial.get_idx(jel,jfirst,jlast);
-              size_t Nj(jlast-jfirst+1);
-
-              // Get density submatrices
-              arma::mat Psub(Paux[L][M+Mmax].submat(jfirst,jfirst,jlast,jlast));
 
-              // Contract integrals
-              double jsmall = Lfac*arma::trace(disjoint_L[L*Nel+jel]*Psub);
-              double jbig = Lfac*arma::trace(disjoint_m1L[L*Nel+jel]*Psub);
+        // Contract integrals; only the channels with couplings are needed
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for(size_t ich=0;ich<Nchannel;ich++) {
+          const int L(couplings.list[corder[coffset[ich]]].L);
+          const int M(couplings.list[corder[coffset[ich]]].M);
+          const double Lfac=4.0*M_PI/(2*L+1);
 
-              // Increment J: jel>iel
-              for(size_t iel=0;iel<jel;iel++) {
-                size_t ifirst, ilast;
-                radial.get_idx(iel,ifirst,ilast);
+          // Traces of the density with the disjoint integrals
+          arma::vec jsmall(Nel), jbig(Nel);
+          for(size_t jel=0;jel<Nel;jel++) {
+            size_t jfirst, jlast;
+            radial.get_idx(jel,jfirst,jlast);
 
-                const arma::mat & iint=disjoint_L[L*Nel+iel];
-                Jaux[L][M+Mmax].submat(ifirst,ifirst,ilast,ilast)+=jbig*iint;
-              }
+            // Get density submatrices
+            arma::mat Psub(Paux[L*NM+M+Mmax].submat(jfirst,jfirst,jlast,jlast));
 
-              // Increment J: jel<iel
-              for(size_t iel=jel+1;iel<Nel;iel++) {
-                size_t ifirst, ilast;
-                radial.get_idx(iel,ifirst,ilast);
-
-                const arma::mat & iint=disjoint_m1L[L*Nel+iel];
-                Jaux[L][M+Mmax].submat(ifirst,ifirst,ilast,ilast)+=jsmall*iint;
-              }
+            // Contract integrals
+            jsmall(jel) = Lfac*arma::trace(disjoint_L[L*Nel+jel]*Psub);
+            jbig(jel) = Lfac*arma::trace(disjoint_m1L[L*Nel+jel]*Psub);
 
-              // In-element contribution
-              {
-                size_t iel=jel;
-                size_t ifirst=jfirst;
-                size_t ilast=jlast;
-                size_t Ni=Nj;
+            // In-element contribution
+            {
+              size_t iel=jel;
+              size_t ifirst=jfirst;
+              size_t ilast=jlast;
 
-                // Contract integrals
-                Psub.reshape(Nj*Nj,1);
+              // Contract integrals
+              const size_t idx(Nel*Nel*L + iel*Nel + jel);
+              arma::mat Jsub;
+              if(tei_factor[idx].n_elem)
+                Jsub=Lfac*utils::factored_coulomb(tei_factor[idx],Psub);
+              else if(single_prec)
+                Jsub=Lfac*arma::conv_to<arma::mat>::from(utils::packed_coulomb(prim_tei_f[idx],arma::conv_to<arma::fmat>::from(Psub)));
+              else
+                Jsub=Lfac*utils::packed_coulomb(prim_tei[idx],Psub);
+
+              Jaux[L*NM+M+Mmax].submat(ifirst,ifirst,ilast,ilast)+=Jsub;
+            }
+          }
 
-                const size_t idx(Nel*Nel*L + iel*Nel + jel);
-                arma::mat Jsub(Lfac*(prim_tei[idx]*Psub));
-                Jsub.reshape(Ni,Ni);
+          // Element iel gets jbig from all jel>iel and jsmall from all
+          // jel<iel: suffix and prefix sums
+          arma::vec bigsum(Nel), smallsum(Nel);
+          bigsum(Nel-1)=0.0;
+          for(size_t iel=Nel-1;iel>0;iel--)
+            bigsum(iel-1)=bigsum(iel)+jbig(iel);
+          smallsum(0)=0.0;
+          for(size_t iel=1;iel<Nel;iel++)
+            smallsum(iel)=smallsum(iel-1)+jsmall(iel-1);
 
-                Jaux[L][M+Mmax].submat(ifirst,ifirst,ilast,ilast)+=Jsub;
-              }
-            }
+          for(size_t iel=0;iel<Nel;iel++) {
+            size_t ifirst, ilast;
+            radial.get_idx(iel,ifirst,ilast);
+            Jaux[L*NM+M+Mmax].submat(ifirst,ifirst,ilast,ilast)+=bigsum(iel)*disjoint_L[L*Nel+iel]+smallsum(iel)*disjoint_m1L[L*Nel+iel];
           }
         }
 
-        // Full Coulomb matrix
+        // Full Coulomb matrix. The coupling G(lj mj, L M, li mi)
+        // goes into the (iang, jang) block; every block is written by
+        // a single thread.
         arma::mat J(Ndummy(),Ndummy());
         J.zeros();
-        for(size_t iang=0;iang<lval.n_elem;iang++) {
-          for(size_t jang=0;jang<lval.n_elem;jang++) {
-            // l and m values
-            int li(lval(iang));
-            int mi(mval(iang));
-            int lj(lval(jang));
-            int mj(mval(jang));
-            // LH m value
-            int M(mj-mi);
-
-            int Lmin=std::max(std::abs(lj-li),abs(M));
-            int Lmax=lj+li;
-            for(int L=Lmin;L<=Lmax;L++) {
-              // Coupling
-              double cpl(gaunt.coeff(lj,mj,L,M,li,mi));
-              if(cpl!=0.0) {
-                J.submat(iang*Nrad,jang*Nrad,(iang+1)*Nrad-1,(jang+1)*Nrad-1)+=cpl*Jaux[L][M+Mmax];
-              }
-            }
+        const std::vector<size_t> & porder(couplings.pair_order);
+        const std::vector<size_t> & poffset(couplings.pair_offset);
+        const size_t Npair(poffset.size()-1);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for(size_t ipair=0;ipair<Npair;ipair++) {
+          const angular_coupling_t & c0(couplings.list[porder[poffset[ipair]]]);
+          size_t jang(c0.iang);
+          size_t iang(c0.jang);
+
+          arma::mat Jsub(Nrad,Nrad,arma::fill::zeros);
+          for(size_t ip=poffset[ipair];ip<poffset[ipair+1];ip++) {
+            const angular_coupling_t & c(couplings.list[porder[ip]]);
+            Jsub+=c.cpl*Jaux[c.L*NM+c.M+Mmax];
           }
+          J.submat(iang*Nrad,jang*Nrad,(iang+1)*Nrad-1,(jang+1)*Nrad-1)=Jsub;
         }
 
-        return remove_boundaries(J);
+        return J;
       }
 
       arma::mat TwoDBasis::exchange(const arma::mat & P0) const {
-        if(!prim_ktei.size())
+        if(!prim_tei.size() || (!direct_ktei && !prim_ktei.size()))
           throw std::logic_error("Primitive teis have not been computed!\n");
 
-        // Extend to boundaries
-        arma::mat P(expand_boundaries(P0));
+        // The atomic basis has no dummy functions, so the density is used as such
+        const arma::mat & P(P0);
 
-        // Gaunt coefficient table
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
+        // Nonzero angular couplings
+        const angular_coupling_list_t & couplings(get_angular_couplings());
 
         // Number of radial elements
         size_t Nel(radial.Nel());
@@ -997,8 +1417,52 @@ namespace helfem {
         const int nth(1);
 #endif
         std::vector<arma::vec> mem_Ksub(nth);
-        std::vector<arma::vec> mem_Psub(nth);
-        std::vector<arma::vec> mem_T(nth);
+
+        /*
+          The disjoint element pairs are handled in the expanded
+          space where every element has its own copy of the shared
+          boundary functions. There, the products with the per-element
+          integral matrices are done for a whole row or column panel of
+          elements at a time, instead of as Nel^2 tiny matrix products.
+        */
+        std::vector<size_t> eoff(Nel+1);
+        eoff[0]=0;
+        for(size_t iel=0;iel<Nel;iel++) {
+          size_t ifirst, ilast;
+          radial.get_idx(iel,ifirst,ilast);
+          eoff[iel+1]=eoff[iel]+ilast-ifirst+1;
+        }
+        const size_t Nexp(eoff[Nel]);
+
+        // Norms of the integral blocks for screening
+        size_t N_L(2*arma::max(lval)+1);
+        arma::mat normL(Nel,N_L), normm1L(Nel,N_L), normin(Nel,N_L);
+        for(size_t L=0;L<N_L;L++)
+          for(size_t iel=0;iel<Nel;iel++) {
+            normL(iel,L)=arma::norm(disjoint_L[L*Nel+iel],"fro");
+            normm1L(iel,L)=arma::norm(disjoint_m1L[L*Nel+iel],"fro");
+            normin(iel,L)=in_element_norm(Nel*Nel*L + iel*Nel + iel);
+          }
+        // Screening statistics
+        size_t nblocks=0, nskipped=0;
+
+        // In-element contraction K(jk) += (jk;il) R(il) for channel L
+        auto in_element = [&](size_t L, size_t iel, const arma::mat & Rsub, arma::mat & Ksub) {
+                            const size_t idx(Nel*Nel*L + iel*Nel + iel);
+                            if(tei_factor[idx].n_elem)
+                              Ksub+=arma::vectorise(utils::factored_exchange(tei_factor[idx],Rsub));
+                            else if(single_prec) {
+                              arma::fmat Rsubf(arma::conv_to<arma::fmat>::from(Rsub));
+                              if(direct_ktei)
+                                Ksub+=arma::conv_to<arma::vec>::from(arma::vectorise(utils::packed_exchange(prim_tei_f[idx],Rsubf)));
+                              else
+                                Ksub+=arma::conv_to<arma::vec>::from(prim_ktei_f[idx]*arma::vectorise(Rsubf));
+                            } else if(direct_ktei)
+                              // Permute the packed integrals on the fly
+                              Ksub+=arma::vectorise(utils::packed_exchange(prim_tei[idx],Rsub));
+                            else
+                              Ksub+=prim_ktei[idx]*arma::vectorise(Rsub);
+                          };
 
 #ifdef _OPENMP
 #pragma omp parallel
@@ -1010,69 +1474,158 @@ namespace helfem {
           const int ith(0);
 #endif
           // These are only small submatrices!
-          mem_Psub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
           mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-          mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
+          // Expanded space density, helper and exchange matrices, and
+          // the radial helpers, in the thread's scratch arena
+          ArenaLease arena(scratch);
+          std::vector<arma::mat> work;
+          work.reserve(3);
+          for(size_t i=0;i<3;i++)
+            arena->push_zeros(work,Nexp,Nexp);
+          arma::mat & Rexp(work[0]);
+          arma::mat & Texp(work[1]);
+          arma::mat & Kexp(work[2]);
+          std::vector<arma::mat> Rmat;
+          Rmat.reserve(N_L);
+          for(size_t i=0;i<N_L;i++)
+            arena->push_zeros(Rmat,Nrad,Nrad);
 
           // Increment
 #ifdef _OPENMP
-#pragma omp for collapse(2)
+#pragma omp for collapse(2) reduction(+:nblocks,nskipped)
 #endif
           for(size_t jang=0;jang<lval.n_elem;jang++) {
             for(size_t kang=0;kang<lval.n_elem;kang++) {
-              int lj(lval(jang));
-              int mj(mval(jang));
-
-              int lk(lval(kang));
-              int mk(mval(kang));
-
               // Form radial helpers
-              size_t N_L(2*arma::max(lval)+1);
-              std::vector<arma::mat> Rmat(N_L);
               for(size_t i=0;i<N_L;i++) {
-                Rmat[i].zeros(Nrad,Nrad);
+                Rmat[i].zeros();
               }
               // Is there a coupling to the channel?
               std::vector<bool> couple(N_L,false);
 
-              // Perform angular sums
-              for(size_t iang=0;iang<lval.n_elem;iang++) {
-                int li(lval(iang));
-                int mi(mval(iang));
-
-                for(size_t lang=0;lang<lval.n_elem;lang++) {
-                  int ll(lval(lang));
-                  int ml(mval(lang));
-
-                  // LH m value
-                  int M(mj-mi);
-                  // RH m value
-                  int Mp(mk-ml);
-                  if(M!=Mp)
-                    continue;
-
-                  // Do we have any density in this block?
-                  double bdens(arma::norm(P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1),"fro"));
-                  //printf("(%i %i) (%i %i) density block norm %e\n",li,mi,ll,ml,bdens);
-                  if(bdens<10*DBL_EPSILON)
-                    continue;
-
-                  // M values match. Loop over possible couplings
-                  int Lmin=std::max(std::max(std::abs(li-lj),std::abs(lk-ll)),abs(M));
-                  int Lmax=std::min(li+lj,lk+ll);
+              // Perform angular sums over the nonzero couplings. Both
+              // lists are sorted by channel, so the (L,M) channels
+              // shared by jang and kang are found by a merge.
+              size_t ij(couplings.offset[jang]), ijend(couplings.offset[jang+1]);
+              size_t ik(couplings.offset[kang]), ikend(couplings.offset[kang+1]);
+              while(ij<ijend && ik<ikend) {
+                const angular_coupling_t & cj(couplings.list[ij]);
+                const angular_coupling_t & ck(couplings.list[ik]);
+                if(coupling_channel_less(cj,ck)) {
+                  ij++;
+                  continue;
+                }
+                if(coupling_channel_less(ck,cj)) {
+                  ik++;
+                  continue;
+                }
 
-                  for(int L=Lmin;L<=Lmax;L++) {
-                    // Calculate total coupling coefficient
-                    double cpl(gaunt.coeff(lj,mj,L,M,li,mi)*gaunt.coeff(lk,mk,L,M,ll,ml));
-                    if(cpl==0.0)
+                // Find the end of the channel
+                size_t jend(ij), kend(ik);
+                while(jend<ijend && !coupling_channel_less(cj,couplings.list[jend]))
+                  jend++;
+                while(kend<ikend && !coupling_channel_less(ck,couplings.list[kend]))
+                  kend++;
+
+                // L factor
+                const int L(cj.L);
+                double Lfac=4.0*M_PI/(2*L+1);
+
+                for(size_t a=ij;a<jend;a++) {
+                  size_t iang(couplings.list[a].jang);
+                  for(size_t b=ik;b<kend;b++) {
+                    size_t lang(couplings.list[b].jang);
+
+                    // Do we have any density in this block?
+                    double bdens(arma::norm(P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1),"fro"));
+                    if(bdens<10*DBL_EPSILON)
                       continue;
 
-                    // L factor
-                    double Lfac=4.0*M_PI/(2*L+1);
+                    // Total coupling coefficient
+                    double cpl(couplings.list[a].cpl*couplings.list[b].cpl);
                     Rmat[L]+=(Lfac*cpl)*P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1);
                     couple[L]=true;
                   }
                 }
+
+                ij=jend;
+                ik=kend;
+              }
+
+              // Disjoint element pairs
+              Kexp.zeros();
+              // Screened in-element blocks
+              std::vector<arma::uvec> inscreen(N_L);
+              for(size_t L=0;L<N_L;L++) {
+                if(!couple[L])
+                  continue;
+
+                // Gather the density to the expanded space
+                arma::mat Rnorm(Nel,Nel);
+                for(size_t iel=0;iel<Nel;iel++) {
+                  size_t ifirst, ilast;
+                  radial.get_idx(iel,ifirst,ilast);
+                  for(size_t jel=0;jel<Nel;jel++) {
+                    size_t jfirst, jlast;
+                    radial.get_idx(jel,jfirst,jlast);
+                    Rexp.submat(eoff[iel],eoff[jel],eoff[iel+1]-1,eoff[jel+1]-1)=Rmat[L].submat(ifirst,jfirst,ilast,jlast);
+                    Rnorm(iel,jel)=arma::norm(Rexp.submat(eoff[iel],eoff[jel],eoff[iel+1]-1,eoff[jel+1]-1),"fro");
+                  }
+                }
+
+                // Bounds ||K(iel,jel)|| <= ||iint|| ||R(iel,jel)|| ||jint||
+                arma::umat keep(Nel,Nel,arma::fill::ones);
+                inscreen[L].ones(Nel);
+                if(kscreen>0.0) {
+                  for(size_t iel=0;iel<Nel;iel++)
+                    for(size_t jel=0;jel<Nel;jel++) {
+                      double bound;
+                      if(iel<jel)
+                        bound=normL(iel,L)*Rnorm(iel,jel)*normm1L(jel,L);
+                      else if(iel>jel)
+                        bound=normm1L(iel,L)*Rnorm(iel,jel)*normL(jel,L);
+                      else
+                        bound=normin(iel,L)*Rnorm(iel,jel);
+                      keep(iel,jel)=(bound>=kscreen);
+                    }
+                  inscreen[L]=keep.diag();
+                }
+                nblocks+=keep.n_elem;
+                nskipped+=keep.n_elem-arma::accu(keep);
+
+                // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
+                // T(iel,jel) = R(iel,jel) jint(jel)^T, one column panel at a time.
+                // Only the range of element blocks that survive screening is computed.
+                Texp.zeros();
+                for(size_t jel=0;jel<Nel;jel++) {
+                  // Rows iel<jel
+                  size_t imin=0;
+                  while(imin<jel && !keep(imin,jel))
+                    imin++;
+                  if(imin<jel)
+                    Texp.submat(eoff[imin],eoff[jel],eoff[jel]-1,eoff[jel+1]-1)=Rexp.submat(eoff[imin],eoff[jel],eoff[jel]-1,eoff[jel+1]-1)*arma::trans(disjoint_m1L[L*Nel+jel]);
+                  // Rows iel>jel
+                  size_t imax=Nel-1;
+                  while(imax>jel && !keep(imax,jel))
+                    imax--;
+                  if(imax>jel)
+                    Texp.submat(eoff[jel+1],eoff[jel],eoff[imax+1]-1,eoff[jel+1]-1)=Rexp.submat(eoff[jel+1],eoff[jel],eoff[imax+1]-1,eoff[jel+1]-1)*arma::trans(disjoint_L[L*Nel+jel]);
+                }
+                // K(iel,jel) += iint(iel) T(iel,jel), one row panel at a time
+                for(size_t iel=0;iel<Nel;iel++) {
+                  // Columns jel>iel
+                  size_t jmax=Nel-1;
+                  while(jmax>iel && !keep(iel,jmax))
+                    jmax--;
+                  if(jmax>iel)
+                    Kexp.submat(eoff[iel],eoff[iel+1],eoff[iel+1]-1,eoff[jmax+1]-1)+=disjoint_L[L*Nel+iel]*Texp.submat(eoff[iel],eoff[iel+1],eoff[iel+1]-1,eoff[jmax+1]-1);
+                  // Columns jel<iel
+                  size_t jmin=0;
+                  while(jmin<iel && !keep(iel,jmin))
+                    jmin++;
+                  if(jmin<iel)
+                    Kexp.submat(eoff[iel],eoff[jmin],eoff[iel+1]-1,eoff[iel]-1)+=disjoint_m1L[L*Nel+iel]*Texp.submat(eoff[iel],eoff[jmin],eoff[iel+1]-1,eoff[iel]-1);
+                }
               }
 
               // Loop over elements: output
@@ -1090,6 +1643,10 @@ namespace helfem {
                   size_t Nj(jlast-jfirst+1);
 
                   if(iel == jel) {
+                    // Done below, in batches on the threads that own the integrals
+                    if(numa_partition || batched_exchange)
+                      continue;
+
                     /*
                       The exchange matrix is given by
                       K(jk) = (ij|kl) P(il)
@@ -1105,46 +1662,18 @@ namespace helfem {
                     Ksub.zeros();
 
                     for(size_t L=0;L<N_L;L++) {
-                      if(!couple[L])
+                      if(!couple[L] || !inscreen[L](iel))
                         continue;
-                      Ksub+=prim_ktei[Nel*Nel*L + iel*Nel + jel]*arma::vectorise(Rmat[L].submat(ifirst,jfirst,ilast,jlast));
+                      in_element(L,iel,Rmat[L].submat(ifirst,jfirst,ilast,jlast),Ksub);
                     }
                     Ksub.reshape(Ni,Nj);
 
                     // Increment global exchange matrix
                     K.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)-=Ksub;
 
-                    //arma::vec Ptgt(arma::vectorise(P.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)));
-                    //printf("(%i %i) (%i %i) (%i %i) (%i %i) [%i %i]\n",li,mi,lj,mj,lk,mk,ll,ml,L,M);
-                    //printf("Element %i - %i contribution to exchange energy % .10e\n",(int) iel,(int) jel,-0.5*arma::dot(Ksub,Ptgt));
-
                   } else {
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
-                    Ksub.zeros();
-
-                    for(size_t L=0;L<N_L;L++) {
-                      if(!couple[L])
-                        continue;
-
-                      // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
-                      const arma::mat & iint=(iel>jel) ? disjoint_m1L[L*Nel+iel] : disjoint_L[L*Nel+iel];
-                      const arma::mat & jint=(iel>jel) ? disjoint_L[L*Nel+jel] : disjoint_m1L[L*Nel+jel];
-
-                      // Get density submatrix (Niel x Njel)
-                      arma::mat Psub(mem_Psub[ith].memptr(),Ni,Nj,false,true);
-                      Psub=Rmat[L].submat(ifirst,jfirst,ilast,jlast);
-
-                      // Calculate helper
-                      arma::mat T(mem_T[ith].memptr(),Ni,Nj,false,true);
-                      // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
-                      T=Psub*arma::trans(jint);
-
-                      // Increment
-                      Ksub+=iint*T;
-                    }
-
-                    K.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)-=Ksub;
+                    // Scatter the disjoint contribution from the expanded space
+                    K.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)-=Kexp.submat(eoff[iel],eoff[jel],eoff[iel+1]-1,eoff[jel+1]-1);
                   }
                 }
               }
@@ -1152,19 +1681,144 @@ namespace helfem {
           }
         }
 
-        return remove_boundaries(K);
+        if(numa_partition || batched_exchange) {
+          // Norms of the density blocks
+          const size_t Nang(lval.n_elem);
+          arma::mat Pnorm(Nang,Nang);
+          for(size_t iang=0;iang<Nang;iang++)
+            for(size_t lang=0;lang<Nang;lang++)
+              Pnorm(iang,lang)=arma::norm(P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1),"fro");
+
+          /*
+            In-element contributions, element by element in the
+            partition used to compute the integrals. The densities of
+            a batch of angular pairs are collected as the columns of
+            one matrix per L, so each integral block enters a single
+            matrix-matrix product instead of one matrix-vector product
+            per pair.
+          */
+          const size_t Npair(Nang*Nang);
+          const size_t Nbatch(std::min<size_t>(Npair,256));
+          element_partition([&](size_t iel) {
+                              size_t ifirst, ilast;
+                              radial.get_idx(iel,ifirst,ilast);
+                              const size_t Ni(ilast-ifirst+1);
+
+                              std::vector<arma::mat> Rb(N_L);
+                              std::vector<bool> used(N_L);
+                              arma::mat Kb(Ni*Ni,Nbatch);
+                              std::vector<bool> nonzero(Nbatch);
+                              for(size_t p0=0;p0<Npair;p0+=Nbatch) {
+                                const size_t np(std::min(Nbatch,Npair-p0));
+                                for(size_t L=0;L<N_L;L++) {
+                                  Rb[L].zeros(Ni*Ni,np);
+                                  used[L]=false;
+                                }
+                                std::fill(nonzero.begin(),nonzero.end(),false);
+
+                                for(size_t ip=0;ip<np;ip++) {
+                                  const size_t jang((p0+ip)/Nang);
+                                  const size_t kang((p0+ip)%Nang);
+
+                                  // Angular sums over the shared channels,
+                                  // as in the loop above
+                                  size_t ij(couplings.offset[jang]), ijend(couplings.offset[jang+1]);
+                                  size_t ik(couplings.offset[kang]), ikend(couplings.offset[kang+1]);
+                                  while(ij<ijend && ik<ikend) {
+                                    const angular_coupling_t & cj(couplings.list[ij]);
+                                    const angular_coupling_t & ck(couplings.list[ik]);
+                                    if(coupling_channel_less(cj,ck)) {
+                                      ij++;
+                                      continue;
+                                    }
+                                    if(coupling_channel_less(ck,cj)) {
+                                      ik++;
+                                      continue;
+                                    }
+                                    size_t jend(ij), kend(ik);
+                                    while(jend<ijend && !coupling_channel_less(cj,couplings.list[jend]))
+                                      jend++;
+                                    while(kend<ikend && !coupling_channel_less(ck,couplings.list[kend]))
+                                      kend++;
+
+                                    const int L(cj.L);
+                                    double Lfac=4.0*M_PI/(2*L+1);
+                                    arma::mat Rsub(Rb[L].colptr(ip),Ni,Ni,false,true);
+                                    bool coupled=false;
+                                    for(size_t a=ij;a<jend;a++) {
+                                      size_t iang(couplings.list[a].jang);
+                                      for(size_t b=ik;b<kend;b++) {
+                                        size_t lang(couplings.list[b].jang);
+                                        if(Pnorm(iang,lang)<10*DBL_EPSILON)
+                                          continue;
+                                        double cpl(couplings.list[a].cpl*couplings.list[b].cpl);
+                                        Rsub+=(Lfac*cpl)*P.submat(iang*Nrad+ifirst,lang*Nrad+ifirst,iang*Nrad+ilast,lang*Nrad+ilast);
+                                        coupled=true;
+                                      }
+                                    }
+                                    // Screened blocks are dropped from the batch
+                                    if(coupled && kscreen>0.0 && normin(iel,L)*arma::norm(Rsub,"fro")<kscreen) {
+                                      Rsub.zeros();
+                                      coupled=false;
+                                    }
+                                    if(coupled) {
+                                      used[L]=true;
+                                      nonzero[ip]=true;
+                                    }
+                                    ij=jend;
+                                    ik=kend;
+                                  }
+                                }
+
+                                // Contract the batch
+                                arma::mat Kbatch(Kb.memptr(),Ni*Ni,np,false,true);
+                                Kbatch.zeros();
+                                for(size_t L=0;L<N_L;L++) {
+                                  if(!used[L])
+                                    continue;
+                                  const size_t idx(Nel*Nel*L + iel*Nel + iel);
+                                  if(direct_ktei || tei_factor[idx].n_elem) {
+                                    for(size_t ip=0;ip<np;ip++) {
+                                      if(!nonzero[ip])
+                                        continue;
+                                      arma::vec Kcol(Kbatch.colptr(ip),Ni*Ni,false,true);
+                                      arma::mat Rsub(Rb[L].colptr(ip),Ni,Ni,false,true);
+                                      in_element(L,iel,Rsub,Kcol);
+                                    }
+                                  } else if(single_prec)
+                                    Kbatch+=arma::conv_to<arma::mat>::from(prim_ktei_f[idx]*arma::conv_to<arma::fmat>::from(Rb[L]));
+                                  else
+                                    Kbatch+=prim_ktei[idx]*Rb[L];
+                                }
+
+                                // Scatter
+                                for(size_t ip=0;ip<np;ip++) {
+                                  if(!nonzero[ip])
+                                    continue;
+                                  const size_t jang((p0+ip)/Nang);
+                                  const size_t kang((p0+ip)%Nang);
+                                  arma::mat Ksub(Kbatch.colptr(ip),Ni,Ni,false,true);
+                                  K.submat(jang*Nrad+ifirst,kang*Nrad+ifirst,jang*Nrad+ilast,kang*Nrad+ilast)-=Ksub;
+                                }
+                              }
+                            });
+        }
+
+        // Fraction of element blocks skipped by screening
+        kscreen_fraction = nblocks ? ((double) nskipped)/nblocks : 0.0;
+
+        return K;
       }
 
       arma::mat TwoDBasis::rs_exchange(const arma::mat & P0) const {
         if(!rs_ktei.size())
           throw std::logic_error("Primitive teis have not been computed!\n");
 
-        // Extend to boundaries
-        arma::mat P(expand_boundaries(P0));
+        // The atomic basis has no dummy functions, so the density is used as such
+        const arma::mat & P(P0);
 
-        // Gaunt coefficient table
-        int gmax(std::max(arma::max(lval),arma::max(mval)));
-        gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
+        // Nonzero angular couplings
+        const angular_coupling_list_t & couplings(get_angular_couplings());
 
         // Number of radial elements
         size_t Nel(radial.Nel());
@@ -1185,6 +1839,18 @@ namespace helfem {
         std::vector<arma::vec> mem_Psub(nth);
         std::vector<arma::vec> mem_T(nth);
 
+        // Norms of the disjoint integral blocks for screening
+        size_t N_L(2*arma::max(lval)+1);
+        arma::mat normiL(Nel,N_L,arma::fill::zeros), normkL(Nel,N_L,arma::fill::zeros);
+        if(yukawa)
+          for(size_t L=0;L<N_L;L++)
+            for(size_t iel=0;iel<Nel;iel++) {
+              normiL(iel,L)=arma::norm(disjoint_iL[L*Nel+iel],"fro");
+              normkL(iel,L)=arma::norm(disjoint_kL[L*Nel+iel],"fro");
+            }
+        // Screening statistics
+        size_t nblocks=0, nskipped=0;
+
 #ifdef _OPENMP
 #pragma omp parallel
 #endif
@@ -1198,66 +1864,73 @@ namespace helfem {
           mem_Psub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
           mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
           mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
+          // Radial helpers in the thread's scratch arena
+          ArenaLease arena(scratch);
+          std::vector<arma::mat> Rmat;
+          Rmat.reserve(N_L);
+          for(size_t i=0;i<N_L;i++)
+            arena->push_zeros(Rmat,Nrad,Nrad);
 
           // Increment
 #ifdef _OPENMP
-#pragma omp for collapse(2)
+#pragma omp for collapse(2) reduction(+:nblocks,nskipped)
 #endif
           for(size_t jang=0;jang<lval.n_elem;jang++) {
             for(size_t kang=0;kang<lval.n_elem;kang++) {
-              int lj(lval(jang));
-              int mj(mval(jang));
-
-              int lk(lval(kang));
-              int mk(mval(kang));
-
               // Form radial helpers
-              size_t N_L(2*arma::max(lval)+1);
-              std::vector<arma::mat> Rmat(N_L);
               for(size_t i=0;i<N_L;i++) {
-                Rmat[i].zeros(Nrad,Nrad);
+                Rmat[i].zeros();
               }
               // Is there a coupling to the channel?
               std::vector<bool> couple(N_L,false);
 
-              // Perform angular sums
-              for(size_t iang=0;iang<lval.n_elem;iang++) {
-                int li(lval(iang));
-                int mi(mval(iang));
-
-                for(size_t lang=0;lang<lval.n_elem;lang++) {
-                  int ll(lval(lang));
-                  int ml(mval(lang));
-
-                  // LH m value
-                  int M(mj-mi);
-                  // RH m value
-                  int Mp(mk-ml);
-                  if(M!=Mp)
-                    continue;
-
-                  // Do we have any density in this block?
-                  double bdens(arma::norm(P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1),"fro"));
-                  //printf("(%i %i) (%i %i) density block norm %e\n",li,mi,ll,ml,bdens);
-                  if(bdens<10*DBL_EPSILON)
-                    continue;
-
-                  // M values match. Loop over possible couplings
-                  int Lmin=std::max(std::max(std::abs(li-lj),std::abs(lk-ll)),abs(M));
-                  int Lmax=std::min(li+lj,lk+ll);
+              // Perform angular sums over the nonzero couplings. Both
+              // lists are sorted by channel, so the (L,M) channels
+              // shared by jang and kang are found by a merge.
+              size_t ij(couplings.offset[jang]), ijend(couplings.offset[jang+1]);
+              size_t ik(couplings.offset[kang]), ikend(couplings.offset[kang+1]);
+              while(ij<ijend && ik<ikend) {
+                const angular_coupling_t & cj(couplings.list[ij]);
+                const angular_coupling_t & ck(couplings.list[ik]);
+                if(coupling_channel_less(cj,ck)) {
+                  ij++;
+                  continue;
+                }
+                if(coupling_channel_less(ck,cj)) {
+                  ik++;
+                  continue;
+                }
 
-                  for(int L=Lmin;L<=Lmax;L++) {
-                    // Calculate total coupling coefficient
-                    double cpl(gaunt.coeff(lj,mj,L,M,li,mi)*gaunt.coeff(lk,mk,L,M,ll,ml));
-                    if(cpl==0.0)
+                // Find the end of the channel
+                size_t jend(ij), kend(ik);
+                while(jend<ijend && !coupling_channel_less(cj,couplings.list[jend]))
+                  jend++;
+                while(kend<ikend && !coupling_channel_less(ck,couplings.list[kend]))
+                  kend++;
+
+                // L factor
+                const int L(cj.L);
+                double Lfac = yukawa ? 4.0*M_PI*lambda :  4.0*M_PI*lambda/(2*L+1);
+
+                for(size_t a=ij;a<jend;a++) {
+                  size_t iang(couplings.list[a].jang);
+                  for(size_t b=ik;b<kend;b++) {
+                    size_t lang(couplings.list[b].jang);
+
+                    // Do we have any density in this block?
+                    double bdens(arma::norm(P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1),"fro"));
+                    if(bdens<10*DBL_EPSILON)
                       continue;
 
-                    // L factor
-                    double Lfac = yukawa ? 4.0*M_PI*lambda :  4.0*M_PI*lambda/(2*L+1);
+                    // Total coupling coefficient
+                    double cpl(couplings.list[a].cpl*couplings.list[b].cpl);
                     Rmat[L]+=(Lfac*cpl)*P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1);
                     couple[L]=true;
                   }
                 }
+
+                ij=jend;
+                ik=kend;
               }
 
               // Loop over elements: output
@@ -1293,7 +1966,15 @@ namespace helfem {
                     for(size_t L=0;L<N_L;L++) {
                       if(!couple[L])
                         continue;
-                      Ksub+=rs_ktei[Nel*Nel*L + iel*Nel + jel]*arma::vectorise(Rmat[L].submat(ifirst,jfirst,ilast,jlast));
+                      const size_t idx(Nel*Nel*L + iel*Nel + jel);
+                      if(kscreen>0.0) {
+                        nblocks++;
+                        if(rs_ktei_norm(idx)*arma::norm(Rmat[L].submat(ifirst,jfirst,ilast,jlast),"fro")<kscreen) {
+                          nskipped++;
+                          continue;
+                        }
+                      }
+                      Ksub+=rs_ktei[idx]*arma::vectorise(Rmat[L].submat(ifirst,jfirst,ilast,jlast));
                     }
                     Ksub.reshape(Ni,Nj);
 
@@ -1317,6 +1998,17 @@ namespace helfem {
                       arma::mat Psub(mem_Psub[ith].memptr(),Ni,Nj,false,true);
                       Psub=Rmat[L].submat(ifirst,jfirst,ilast,jlast);
 
+                      // Bound ||K|| <= ||iint|| ||P|| ||jint||
+                      if(kscreen>0.0) {
+                        double inorm=(iel>jel) ? normkL(iel,L) : normiL(iel,L);
+                        double jnorm=(iel>jel) ? normiL(jel,L) : normkL(jel,L);
+                        nblocks++;
+                        if(inorm*arma::norm(Psub,"fro")*jnorm<kscreen) {
+                          nskipped++;
+                          continue;
+                        }
+                      }
+
                       // Calculate helper
                       arma::mat T(mem_T[ith].memptr(),Ni,Nj,false,true);
                       // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
@@ -1334,7 +2026,227 @@ namespace helfem {
           }
         }
 
-        return remove_boundaries(K);
+        // Fraction of element blocks skipped by screening
+        kscreen_fraction = nblocks ? ((double) nskipped)/nblocks : 0.0;
+
+        return K;
+      }
+
+      std::vector<arma::mat> TwoDBasis::exchange_multi(const std::vector<arma::mat> & P0, double kfull, double kshort) const {
+        if(kfull!=0.0 && (!prim_tei.size() || (!direct_ktei && !prim_ktei.size())))
+          throw std::logic_error("Primitive teis have not been computed!\n");
+        if(kshort!=0.0 && !rs_ktei.size())
+          throw std::logic_error("Range-separated teis have not been computed!\n");
+
+        // The atomic basis has no dummy functions, so the densities are used as such
+        const size_t Nd(P0.size());
+        const std::vector<arma::mat> & P(P0);
+        std::vector<arma::mat> K(Nd);
+        for(size_t d=0;d<Nd;d++)
+          K[d].zeros(Ndummy(),Ndummy());
+
+        // Nonzero angular couplings
+        const angular_coupling_list_t & couplings(get_angular_couplings());
+
+        // Number of radial elements
+        size_t Nel(radial.Nel());
+        // Number of radial basis functions
+        size_t Nrad(radial.Nbf());
+        // Number of distinct L values
+        size_t N_L(2*arma::max(lval)+1);
+
+        // Norms of the integral blocks for screening
+        arma::mat normL(Nel,N_L,arma::fill::zeros), normm1L(Nel,N_L,arma::fill::zeros), normin(Nel,N_L,arma::fill::zeros);
+        arma::mat normiL(Nel,N_L,arma::fill::zeros), normkL(Nel,N_L,arma::fill::zeros);
+        for(size_t L=0;L<N_L;L++)
+          for(size_t iel=0;iel<Nel;iel++) {
+            if(kfull!=0.0) {
+              normL(iel,L)=arma::norm(disjoint_L[L*Nel+iel],"fro");
+              normm1L(iel,L)=arma::norm(disjoint_m1L[L*Nel+iel],"fro");
+              normin(iel,L)=in_element_norm(Nel*Nel*L + iel*Nel + iel);
+            }
+            if(kshort!=0.0 && yukawa) {
+              normiL(iel,L)=arma::norm(disjoint_iL[L*Nel+iel],"fro");
+              normkL(iel,L)=arma::norm(disjoint_kL[L*Nel+iel],"fro");
+            }
+          }
+        // Screening statistics
+        size_t nblocks=0, nskipped=0;
+
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:nblocks,nskipped)
+#endif
+        {
+          // Is the block below the screening threshold? The counters
+          // are the thread's private copies here
+          auto screened = [&](double bound) {
+                            if(kscreen<=0.0)
+                              return false;
+                            nblocks++;
+                            if(bound<kscreen) {
+                              nskipped++;
+                              return true;
+                            }
+                            return false;
+                          };
+
+          // Radial helpers of each density in the thread's scratch
+          // arena, without the L factors which differ between kernels
+          ArenaLease arena(scratch);
+          std::vector<arma::mat> Rmat;
+          Rmat.reserve(Nd*N_L);
+          for(size_t i=0;i<Nd*N_L;i++)
+            arena->push_zeros(Rmat,Nrad,Nrad);
+          // Densities and exchange blocks of all the densities as columns
+          arma::mat Rstack, Kstack;
+
+#ifdef _OPENMP
+#pragma omp for collapse(2)
+#endif
+          for(size_t jang=0;jang<lval.n_elem;jang++) {
+            for(size_t kang=0;kang<lval.n_elem;kang++) {
+              for(size_t i=0;i<Rmat.size();i++)
+                Rmat[i].zeros();
+              std::vector<bool> couple(N_L,false);
+
+              // Angular sums over the channels shared by jang and kang,
+              // done once for all the densities
+              size_t ij(couplings.offset[jang]), ijend(couplings.offset[jang+1]);
+              size_t ik(couplings.offset[kang]), ikend(couplings.offset[kang+1]);
+              while(ij<ijend && ik<ikend) {
+                const angular_coupling_t & cj(couplings.list[ij]);
+                const angular_coupling_t & ck(couplings.list[ik]);
+                if(coupling_channel_less(cj,ck)) {
+                  ij++;
+                  continue;
+                }
+                if(coupling_channel_less(ck,cj)) {
+                  ik++;
+                  continue;
+                }
+                size_t jend(ij), kend(ik);
+                while(jend<ijend && !coupling_channel_less(cj,couplings.list[jend]))
+                  jend++;
+                while(kend<ikend && !coupling_channel_less(ck,couplings.list[kend]))
+                  kend++;
+
+                const int L(cj.L);
+                for(size_t a=ij;a<jend;a++) {
+                  size_t iang(couplings.list[a].jang);
+                  for(size_t b=ik;b<kend;b++) {
+                    size_t lang(couplings.list[b].jang);
+                    double cpl(couplings.list[a].cpl*couplings.list[b].cpl);
+                    for(size_t d=0;d<Nd;d++) {
+                      // Do we have any density in this block?
+                      double bdens(arma::norm(P[d].submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1),"fro"));
+                      if(bdens<10*DBL_EPSILON)
+                        continue;
+                      Rmat[d*N_L+L]+=cpl*P[d].submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1);
+                      couple[L]=true;
+                    }
+                  }
+                }
+
+                ij=jend;
+                ik=kend;
+              }
+
+              for(size_t iel=0;iel<Nel;iel++) {
+                size_t ifirst, ilast;
+                radial.get_idx(iel,ifirst,ilast);
+                const size_t Ni(ilast-ifirst+1);
+
+                for(size_t jel=0;jel<Nel;jel++) {
+                  size_t jfirst, jlast;
+                  radial.get_idx(jel,jfirst,jlast);
+                  const size_t Nj(jlast-jfirst+1);
+
+                  Kstack.zeros(Ni*Nj,Nd);
+                  for(size_t L=0;L<N_L;L++) {
+                    if(!couple[L])
+                      continue;
+
+                    // Collect the density blocks
+                    Rstack.set_size(Ni*Nj,Nd);
+                    for(size_t d=0;d<Nd;d++)
+                      Rstack.col(d)=arma::vectorise(Rmat[d*N_L+L].submat(ifirst,jfirst,ilast,jlast));
+                    const double rnorm(arma::norm(Rstack,"fro"));
+
+                    // Full-range kernel
+                    if(kfull!=0.0) {
+                      const double Lfac=4.0*M_PI/(2*L+1);
+                      if(iel == jel) {
+                        const size_t idx(Nel*Nel*L + iel*Nel + iel);
+                        if(!screened(Lfac*normin(iel,L)*rnorm)) {
+                          if(tei_factor[idx].n_elem) {
+                            for(size_t d=0;d<Nd;d++) {
+                              arma::mat Rsub(Rstack.colptr(d),Ni,Ni,false,true);
+                              Kstack.col(d)+=(kfull*Lfac)*arma::vectorise(utils::factored_exchange(tei_factor[idx],Rsub));
+                            }
+                          } else if(direct_ktei) {
+                            for(size_t d=0;d<Nd;d++) {
+                              arma::mat Rsub(Rstack.colptr(d),Ni,Ni,false,true);
+                              if(single_prec)
+                                Kstack.col(d)+=(kfull*Lfac)*arma::conv_to<arma::vec>::from(arma::vectorise(utils::packed_exchange(prim_tei_f[idx],arma::conv_to<arma::fmat>::from(Rsub))));
+                              else
+                                Kstack.col(d)+=(kfull*Lfac)*arma::vectorise(utils::packed_exchange(prim_tei[idx],Rsub));
+                            }
+                          } else if(single_prec)
+                            Kstack+=(kfull*Lfac)*arma::conv_to<arma::mat>::from(prim_ktei_f[idx]*arma::conv_to<arma::fmat>::from(Rstack));
+                          else
+                            Kstack+=(kfull*Lfac)*prim_ktei[idx]*Rstack;
+                        }
+                      } else {
+                        // When r(iel)>r(jel), iel gets -1-L, jel gets L.
+                        const arma::mat & iint=(iel>jel) ? disjoint_m1L[L*Nel+iel] : disjoint_L[L*Nel+iel];
+                        const arma::mat & jint=(iel>jel) ? disjoint_L[L*Nel+jel] : disjoint_m1L[L*Nel+jel];
+                        double inorm=(iel>jel) ? normm1L(iel,L) : normL(iel,L);
+                        double jnorm=(iel>jel) ? normL(jel,L) : normm1L(jel,L);
+                        if(!screened(Lfac*inorm*rnorm*jnorm))
+                          for(size_t d=0;d<Nd;d++) {
+                            arma::mat Rsub(Rstack.colptr(d),Ni,Nj,false,true);
+                            Kstack.col(d)+=(kfull*Lfac)*arma::vectorise(iint*Rsub*arma::trans(jint));
+                          }
+                      }
+                    }
+
+                    // Range-separated kernel
+                    if(kshort!=0.0) {
+                      const double Lfac = yukawa ? 4.0*M_PI*lambda :  4.0*M_PI*lambda/(2*L+1);
+                      // error function does not factorize
+                      if(!yukawa || iel == jel) {
+                        const size_t idx(Nel*Nel*L + iel*Nel + jel);
+                        if(!screened(Lfac*rs_ktei_norm(idx)*rnorm))
+                          Kstack+=(kshort*Lfac)*rs_ktei[idx]*Rstack;
+                      } else {
+                        const arma::mat & iint=(iel>jel) ? disjoint_kL[L*Nel+iel] : disjoint_iL[L*Nel+iel];
+                        const arma::mat & jint=(iel>jel) ? disjoint_iL[L*Nel+jel] : disjoint_kL[L*Nel+jel];
+                        double inorm=(iel>jel) ? normkL(iel,L) : normiL(iel,L);
+                        double jnorm=(iel>jel) ? normiL(jel,L) : normkL(jel,L);
+                        if(!screened(Lfac*inorm*rnorm*jnorm))
+                          for(size_t d=0;d<Nd;d++) {
+                            arma::mat Rsub(Rstack.colptr(d),Ni,Nj,false,true);
+                            Kstack.col(d)+=(kshort*Lfac)*arma::vectorise(iint*Rsub*arma::trans(jint));
+                          }
+                      }
+                    }
+                  }
+
+                  // Increment global exchange matrices
+                  for(size_t d=0;d<Nd;d++) {
+                    arma::mat Ksub(Kstack.colptr(d),Ni,Nj,false,true);
+                    K[d].submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)-=Ksub;
+                  }
+                }
+              }
+            }
+          }
+        }
+
+        // Fraction of element blocks skipped by screening
+        kscreen_fraction = nblocks ? ((double) nskipped)/nblocks : 0.0;
+
+        return K;
       }
 
       arma::mat TwoDBasis::remove_boundaries(const arma::mat & Fnob) const {
@@ -1344,16 +2256,8 @@ namespace helfem {
           throw std::logic_error(oss.str());
         }
 
-        // Get indices
-        arma::uvec idx(pure_indices());
-
-        // Matrix with the boundary conditions removed
-        arma::mat Fpure(Fnob(idx,idx));
-
-        //Fnob.print("Input: w/o built-in boundaries");
-        //Fpure.print("Output: w built-in boundaries");
-
-        return Fpure;
+        // The atomic basis has no dummy functions, see pure_indices()
+        return Fnob;
       }
 
       arma::mat TwoDBasis::expand_boundaries(const arma::mat & Ppure) const {
@@ -1363,29 +2267,31 @@ namespace helfem {
           throw std::logic_error(oss.str());
         }
 
-        // Get indices
-        arma::uvec idx(pure_indices());
-
-        // Matrix with the boundary conditions removed
-        arma::mat Pnob(Ndummy(),Ndummy());
-        Pnob.zeros();
-        Pnob(idx,idx)=Ppure;
-
-        //Ppure.print("Input: w built-in boundaries");
-        //Pnob.print("Output: w/o built-in boundaries");
-
-        return Pnob;
+        // The atomic basis has no dummy functions, see pure_indices()
+        return Ppure;
       }
 
       std::vector<arma::mat> TwoDBasis::get_prim_tei() const {
-        return prim_tei;
+        std::vector<arma::mat> tei(prim_tei.size());
+        for(size_t i=0;i<prim_tei.size();i++)
+          if(tei_factor.size() && tei_factor[i].n_elem)
+            tei[i]=tei_factor[i]*tei_factor[i].t();
+          else if(prim_tei[i].n_elem) {
+            size_t iel(i%(radial.Nel()*radial.Nel()) / radial.Nel());
+            tei[i]=utils::unpack_tei(prim_tei[i],radial.Nprim(iel));
+          }
+        return tei;
       }
 
       arma::cx_mat TwoDBasis::eval_bf(size_t iel, double cth, double phi) const {
-        // Evaluate spherical harmonics
+        return eval_bf(iel,::spherical_harmonics_all(arma::max(lval),cth,phi));
+      }
+
+      arma::cx_mat TwoDBasis::eval_bf(size_t iel, const arma::cx_vec & ylm) const {
+        // Pick out the spherical harmonics
         arma::cx_vec sph(lval.n_elem);
         for(size_t i=0;i<lval.n_elem;i++)
-          sph(i)=::spherical_harmonics(lval(i),mval(i),cth,phi);
+          sph(i)=ylm(::spherical_harmonics_index(lval(i),mval(i)));
 
         // Evaluate radial functions
         arma::mat rad(radial.get_bf(iel));
@@ -1399,10 +2305,14 @@ namespace helfem {
       }
 
       void TwoDBasis::eval_df(size_t iel, double cth, double phi, arma::cx_mat & dr, arma::cx_mat & dth, arma::cx_mat & dphi) const {
-        // Evaluate spherical harmonics
+        eval_df(iel,cth,phi,::spherical_harmonics_all(arma::max(lval),cth,phi),dr,dth,dphi);
+      }
+
+      void TwoDBasis::eval_df(size_t iel, double cth, double phi, const arma::cx_vec & ylm, arma::cx_mat & dr, arma::cx_mat & dth, arma::cx_mat & dphi) const {
+        // Pick out the spherical harmonics
         arma::cx_vec sph(lval.n_elem);
         for(size_t i=0;i<lval.n_elem;i++)
-          sph(i)=::spherical_harmonics(lval(i),mval(i),cth,phi);
+          sph(i)=ylm(::spherical_harmonics_index(lval(i),mval(i)));
 
         // Evaluate radial functions
         arma::mat frad(radial.get_bf(iel));
@@ -1430,17 +2340,21 @@ namespace helfem {
           // Angular factor
           std::complex<double> angfac(m*cotth*sph(i));
           if(mval(i)<lval(i))
-            angfac+=sqrt((l-m)*(l+m+1))*std::exp(std::complex<double>(0,-phi))*::spherical_harmonics(lval(i),mval(i)+1,cth,phi);
+            angfac+=sqrt((l-m)*(l+m+1))*std::exp(std::complex<double>(0,-phi))*ylm(::spherical_harmonics_index(l,m+1));
 
           dth.cols(i*frad.n_cols,(i+1)*frad.n_cols-1)=angfac*frad;
         }
       }
 
       arma::cx_mat TwoDBasis::eval_lf(size_t iel, double cth, double phi) const {
-        // Evaluate spherical harmonics
+        return eval_lf(iel,::spherical_harmonics_all(arma::max(lval),cth,phi));
+      }
+
+      arma::cx_mat TwoDBasis::eval_lf(size_t iel, const arma::cx_vec & ylm) const {
+        // Pick out the spherical harmonics
         arma::cx_vec sph(lval.n_elem);
         for(size_t i=0;i<lval.n_elem;i++)
-          sph(i)=::spherical_harmonics(lval(i),mval(i),cth,phi);
+          sph(i)=ylm(::spherical_harmonics_index(lval(i),mval(i)));
 
         // Evaluate radial functions
         arma::vec r(radial.get_r(iel));
@@ -1463,6 +2377,51 @@ namespace helfem {
         return lf;
       }
 
+      arma::cx_mat TwoDBasis::eval_bf(size_t iel, const arma::vec & r, const arma::vec & cth, const arma::vec & phi) const {
+        if(r.n_elem != cth.n_elem || r.n_elem != phi.n_elem)
+          throw std::logic_error("Inconsistent number of points in eval_bf!\n");
+        // Spherical harmonics at all the points: (lmax+1)^2 x Npoints
+        arma::cx_mat ylm(::spherical_harmonics_all(arma::max(lval),cth,phi));
+        // Radial functions
+        arma::cx_mat rad(arma::conv_to<arma::cx_mat>::from(radial.get_bf(radial.get_prim(r,iel),iel)));
+
+        arma::cx_mat bf(rad.n_rows,lval.n_elem*rad.n_cols);
+        for(size_t i=0;i<lval.n_elem;i++) {
+          arma::cx_vec sph(ylm.row(::spherical_harmonics_index(lval(i),mval(i))).st());
+          bf.cols(i*rad.n_cols,(i+1)*rad.n_cols-1)=rad.each_col() % sph;
+        }
+        return bf;
+      }
+
+      arma::cx_mat TwoDBasis::eval_orbs(const arma::mat & C, const arma::vec & r, const arma::vec & cth, const arma::vec & phi) const {
+        arma::cx_mat orbs(r.n_elem,C.n_cols,arma::fill::zeros);
+        std::vector<arma::uvec> idx(radial.sort_points(r));
+        for(size_t iel=0;iel<idx.size();iel++) {
+          if(!idx[iel].n_elem)
+            continue;
+          arma::vec rel(r(idx[iel])), cel(cth(idx[iel])), pel(phi(idx[iel]));
+          arma::cx_mat Csub(arma::conv_to<arma::cx_mat>::from(arma::mat(C.rows(bf_list(iel)))));
+          orbs.rows(idx[iel])=eval_bf(iel,rel,cel,pel)*Csub;
+        }
+        return orbs;
+      }
+
+      arma::vec TwoDBasis::electron_density(const arma::mat & P, const arma::vec & r, const arma::vec & cth, const arma::vec & phi) const {
+        arma::vec den(r.n_elem,arma::fill::zeros);
+        std::vector<arma::uvec> idx(radial.sort_points(r));
+        for(size_t iel=0;iel<idx.size();iel++) {
+          if(!idx[iel].n_elem)
+            continue;
+          arma::vec rel(r(idx[iel])), cel(cth(idx[iel])), pel(phi(idx[iel]));
+          arma::uvec bfidx(bf_list(iel));
+          arma::cx_mat Psub(arma::conv_to<arma::cx_mat>::from(arma::mat(P.submat(bfidx,bfidx))));
+          arma::cx_mat bf(eval_bf(iel,rel,cel,pel));
+          // sum_uv B_u P_uv B_v^* for all the points at once
+          den(idx[iel])=arma::real(arma::sum((bf*Psub) % arma::conj(bf),1));
+        }
+        return den;
+      }
+
       arma::uvec TwoDBasis::bf_list(size_t iel) const {
         // Radial functions in element
         size_t ifirst, ilast;
@@ -1485,6 +2444,19 @@ namespace helfem {
         return idx;
       }
 
+      arma::vec TwoDBasis::bf_bound(size_t iel) const {
+        // Largest radial values
+        arma::mat rad(radial.get_bf(iel));
+        arma::rowvec rmax(arma::max(arma::abs(rad),0));
+
+        // |Y_lm| <= sqrt((2l+1)/(4 pi))
+        arma::vec bound(lval.n_elem*rad.n_cols);
+        for(size_t i=0;i<lval.n_elem;i++)
+          bound.subvec(i*rad.n_cols,(i+1)*rad.n_cols-1)=sqrt((2*lval(i)+1)/(4.0*M_PI))*arma::trans(rmax);
+
+        return bound;
+      }
+
       size_t TwoDBasis::get_rad_Nel() const {
         return radial.Nel();
       }
@@ -1504,21 +2476,21 @@ namespace helfem {
         // Total number of radial functions
         size_t Nrad(radial.Nbf());
 
-        // Expand density matrix to boundary conditions
-        arma::mat P(expand_boundaries(P0));
+        // The atomic basis has no dummy functions, so the density is used as such
+        const arma::mat & P(P0);
 
-        // Loop over angular momentum
-        double nucden=0.0;
+        // Loop over angular momentum; the terms are summed in a fixed order
+        std::vector<double> nucden(lval.n_elem,0.0);
 #ifdef _OPENMP
-#pragma omp parallel for reduction(+:nucden)
+#pragma omp parallel for
 #endif
         for(size_t iam=0;iam<lval.n_elem;iam++) {
           // Integration over angles yields extra factor 4 pi that must be removed
-          nucden+=radial.nuclear_density(P.submat(Nrad*iam,Nrad*iam,Nrad*(iam+1)-1,Nrad*(iam+1)-1))/(4.0*M_PI);
+          nucden[iam]=radial.nuclear_density(P.submat(Nrad*iam,Nrad*iam,Nrad*(iam+1)-1,Nrad*(iam+1)-1))/(4.0*M_PI);
         }
 
         arma::vec den(1);
-        den(0)=nucden;
+        den(0)=threading::pairwise_sum(nucden);
 
         return den;
       }
@@ -1530,21 +2502,21 @@ namespace helfem {
         // Total number of radial functions
         size_t Nrad(radial.Nbf());
 
-        // Expand density matrix to boundary conditions
-        arma::mat P(expand_boundaries(P0));
+        // The atomic basis has no dummy functions, so the density is used as such
+        const arma::mat & P(P0);
 
-        // Loop over angular momentum
-        double nucden=0.0;
+        // Loop over angular momentum; the terms are summed in a fixed order
+        std::vector<double> nucden(lval.n_elem,0.0);
 #ifdef _OPENMP
-#pragma omp parallel for reduction(+:nucden)
+#pragma omp parallel for
 #endif
         for(size_t iam=0;iam<lval.n_elem;iam++) {
           // Integration over angles yields extra factor 4 pi that must be removed
-          nucden+=radial.nuclear_density_gradient(P.submat(Nrad*iam,Nrad*iam,Nrad*(iam+1)-1,Nrad*(iam+1)-1))/(4.0*M_PI);
+          nucden[iam]=radial.nuclear_density_gradient(P.submat(Nrad*iam,Nrad*iam,Nrad*(iam+1)-1,Nrad*(iam+1)-1))/(4.0*M_PI);
         }
 
         arma::vec den(1);
-        den(0)=nucden;
+        den(0)=threading::pairwise_sum(nucden);
 
         return den;
       }
@@ -19,11 +19,43 @@
 #include <armadillo>
 #include "../general/model_potential.h"
 #include "../general/sap.h"
+#include "../general/gaunt.h"
+#include "../general/arena.h"
 #include <RadialBasis.h>
+#include <functional>
+#include <memory>
 
 namespace helfem {
   namespace atomic {
     namespace basis {
+      /// Nonzero angular coupling G(l_i m_i, L M, l_j m_j) with M = m_i - m_j
+      typedef struct {
+        /// First angular function
+        size_t iang;
+        /// Second angular function
+        size_t jang;
+        /// Coupling channel
+        int L, M;
+        /// Gaunt coefficient
+        double cpl;
+      } angular_coupling_t;
+
+      /// List of nonzero angular couplings
+      typedef struct {
+        /// Couplings sorted by first function, then by channel (L,M)
+        std::vector<angular_coupling_t> list;
+        /// Couplings of first function iang are in [offset[iang], offset[iang+1])
+        std::vector<size_t> offset;
+        /// Indices into the list ordered by function pair, then by L
+        std::vector<size_t> pair_order;
+        /// Runs of equal function pairs in pair_order
+        std::vector<size_t> pair_offset;
+        /// Indices into the list ordered by channel (L,M), then by function pair
+        std::vector<size_t> channel_order;
+        /// Runs of equal channels in channel_order
+        std::vector<size_t> channel_offset;
+      } angular_coupling_list_t;
+
       /// Two-dimensional basis set
       class TwoDBasis {
         /// Nuclear charge
@@ -58,12 +90,50 @@ namespace helfem {
         std::vector<arma::mat> disjoint_L, disjoint_m1L;
         /// Auxiliary integrals for Yukawa separation
         std::vector<arma::mat> disjoint_iL, disjoint_kL;
-        /// Primitive two-electron integrals: <Nel^2 * (2L+1)>
-        std::vector<arma::mat> prim_tei;
+        /// Primitive two-electron integrals in packed storage: <Nel^2 * (2L+1)>
+        std::vector<arma::vec> prim_tei;
         /// Primitive two-electron integrals: <Nel^2 * (2L+1)> sorted for exchange
         std::vector<arma::mat> prim_ktei;
         /// Primitive range-separated two-electron integrals: <Nel^2 * (2L+1)> sorted for exchange
         std::vector<arma::mat> rs_ktei;
+        /// Form exchange-ordered integrals on the fly instead of storing prim_ktei?
+        bool direct_ktei;
+        /// Use the single precision copies of the in-element integrals?
+        bool single_prec;
+        /// Partition the in-element integrals and their contraction by element?
+        bool numa_partition;
+        /// Contract the in-element exchange integrals in batches of angular pairs?
+        bool batched_exchange;
+        /// Low-rank factors B of the in-element integrals, (ij|kl) = B(ij,r) B(kl,r); prim_tei and prim_ktei are empty for the factorized blocks
+        std::vector<arma::mat> tei_factor;
+        /// Relative eigenvalue threshold for the factorization, 0 for none
+        double tei_factor_thr;
+        /// Single precision copy of prim_tei
+        std::vector<arma::fvec> prim_tei_f;
+        /// Single precision copy of prim_ktei
+        std::vector<arma::fmat> prim_ktei_f;
+        /// Norms of the range-separated exchange integral blocks
+        arma::vec rs_ktei_norm;
+        /// Screening threshold for element blocks in exchange
+        double kscreen;
+        /// Fraction of element blocks skipped in the last exchange build
+        mutable double kscreen_fraction;
+
+        /// Gaunt coefficient table, built on first use and shared between copies
+        mutable std::shared_ptr<const gaunt::Gaunt> gaunt_table;
+        /// Nonzero angular couplings, built on first use and shared between copies
+        mutable std::shared_ptr<const angular_coupling_list_t> ang_couplings;
+        /// Scratch memory for the temporaries of the Fock builds
+        mutable ArenaPool scratch;
+
+        /// Run f(iel) over all elements in a fixed static partition
+        /// over the threads, even elements first, then odd ones
+        void element_partition(const std::function<void(size_t)> & f) const;
+
+        /// Factorize an in-element integral block if that makes its contractions cheaper
+        bool factor_block(size_t idx, size_t Ni, const arma::mat & tei);
+        /// Norm estimate of an in-element integral block for exchange screening
+        double in_element_norm(size_t idx) const;
 
         /// Add to radial submatrix
         void add_sub(arma::mat & M, size_t iang, size_t jang, const arma::mat & Msub) const;
@@ -75,7 +145,7 @@ namespace helfem {
       public:
         TwoDBasis();
         /// Constructor
-        TwoDBasis(int Z, modelpotential::nuclear_model_t model, double Rrms, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, bool zeroder, int n_quad, const arma::vec & bval, int taylor_order, const arma::ivec & lval, const arma::ivec & mval, int Zl, int Zr, double Rhalf);
+        TwoDBasis(int Z, modelpotential::nuclear_model_t model, double Rrms, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, bool zeroder, int n_quad, const arma::vec & bval, int taylor_order, const arma::ivec & lval, const arma::ivec & mval, int Zl, int Zr, double Rhalf, const arma::ivec & el_nnodes=arma::ivec());
         /// Destructor
         ~TwoDBasis();
 
@@ -106,29 +176,50 @@ namespace helfem {
         int get_poly_id() const;
         /// Get number of nodes in polynomial
         int get_poly_nnodes() const;
+        /// Get number of nodes in the polynomial of each element
+        arma::ivec get_element_nnodes() const;
+        /// Hash identifying the basis set and the nuclei, for reusing data between runs
+        std::string fingerprint() const;
         /// Is derivative zeroed at infinity?
         int get_zeroder() const;
 
+        /// Get Gaunt coefficient table
+        const gaunt::Gaunt & get_gaunt() const;
+        /// Get list of nonzero angular couplings
+        const angular_coupling_list_t & get_angular_couplings() const;
+
         /// Get indices of real basis functions
         arma::uvec pure_indices() const;
         /// Expand boundary conditions
         arma::mat expand_boundaries(const arma::mat & H) const;
         /// Remove boundary conditions
         arma::mat remove_boundaries(const arma::mat & H) const;
+        /// Compute norms of the range-separated exchange blocks for screening
+        void compute_rs_norms();
 
         /// Memory for one-electron integral matrix
         size_t mem_1el() const;
         /// Memory for auxiliary one-electron integrals (off-center nuclei)
         size_t mem_1el_aux() const;
         /// Memory for auxiliary two-electron integrals
-        size_t mem_2el_aux() const;
+        size_t mem_2el_aux(bool exchange=true, bool direct=false) const;
+        /// Memory for range-separated exchange integrals
+        size_t mem_2el_rs() const;
 
-        /// Compute two-electron integrals
-        void compute_tei(bool exchange);
+        /// Compute two-electron integrals; direct forms the exchange-ordered integrals on the fly
+        void compute_tei(bool exchange, bool direct=false);
         /// Compute range-separated two-electron integrals
         void compute_yukawa(double lambda);
         /// Compute range-separated two-electron integrals
         void compute_erfc(double mu);
+        /// Get the two-electron integrals for caching
+        void get_tei(std::vector<arma::mat> & L, std::vector<arma::mat> & m1L, std::vector<arma::mat> & tei) const;
+        /// Set two-electron integrals loaded from a cache; the exchange-ordered integrals are formed from them
+        void set_tei(bool exchange, bool direct, const std::vector<arma::mat> & L, const std::vector<arma::mat> & m1L, const std::vector<arma::mat> & tei);
+        /// Get the range-separated integrals for caching
+        void get_rs_integrals(std::vector<arma::mat> & ktei, std::vector<arma::mat> & iL, std::vector<arma::mat> & kL) const;
+        /// Set range-separated integrals loaded from a cache
+        void set_rs_integrals(bool yukawa, double lambda, const std::vector<arma::mat> & ktei, const std::vector<arma::mat> & iL, const std::vector<arma::mat> & kL);
 
         /// Number of basis functions
         size_t Nbf() const;
@@ -160,6 +251,8 @@ namespace helfem {
         arma::mat nuclear() const;
 	/// Form confinement potential matrix
 	arma::mat confinement(const int N, const double r_0, const int iconf) const;
+	/// Form derivative of confinement potential matrix wrt the confinement radius
+	arma::mat confinement_derivative(const int N, const double r_0, const int iconf) const;
 	/// Form model potential matrix
 	arma::mat model_potential(const modelpotential::ModelPotential * model) const;
         /// Form dipole coupling matrix
@@ -176,12 +269,40 @@ namespace helfem {
         /// Form density matrix
         arma::mat form_density(const arma::mat & C, size_t nocc) const;
 
+        /// Set screening threshold for element blocks in exchange, 0 to disable
+        void set_exchange_screening(double thr);
+        /// Get fraction of element blocks skipped in the last exchange build
+        double get_exchange_screening_fraction() const;
+        /// Switch the in-element Coulomb and exchange contractions to single precision integrals
+        void set_single_precision(bool sp);
+        /// Are single precision integrals in use?
+        bool get_single_precision() const;
+        /// Compute and contract the in-element integrals in the same
+        /// static partition by element, so that with bound threads the
+        /// integral blocks stay on the NUMA node of their first touch.
+        /// Must be set before compute_tei.
+        void set_numa_partition(bool numa);
+        /// Contract the in-element exchange integrals for batches of
+        /// angular pairs with matrix-matrix products
+        void set_batched_exchange(bool batched);
+        /// Factorize the in-element integrals to low rank, keeping
+        /// eigenvalues above thr times the largest one; 0 disables the
+        /// factorization. Must be set before compute_tei.
+        void set_tei_factorization(double thr);
+
         /// Form Coulomb matrix
         arma::mat coulomb(const arma::mat & P) const;
         /// Form exchange matrix
         arma::mat exchange(const arma::mat & P) const;
         /// Form range-separated exchange matrix
         arma::mat rs_exchange(const arma::mat & P) const;
+        /**
+         * Form kfull*exchange(P) + kshort*rs_exchange(P) for several
+         * densities at once. The angular sums are done once for all
+         * the densities, and each integral block is contracted with
+         * all of them in a single matrix product.
+         */
+        std::vector<arma::mat> exchange_multi(const std::vector<arma::mat> & P, double kfull, double kshort) const;
 
         /// Get primitive integrals
         std::vector<arma::mat> get_prim_tei() const;
@@ -203,8 +324,28 @@ namespace helfem {
         void eval_df(size_t iel, double cth, double phi, arma::cx_mat & dr, arma::cx_mat & dth, arma::cx_mat & dphi) const;
         /// Evaluate Laplacian of basis functions
         arma::cx_mat eval_lf(size_t iel, double cth, double phi) const;
+        /// Evaluate basis functions from the values of all spherical harmonics up to lmax at the point
+        arma::cx_mat eval_bf(size_t iel, const arma::cx_vec & ylm) const;
+        /// Evaluate basis functions derivatives from the values of all spherical harmonics up to lmax at the point
+        void eval_df(size_t iel, double cth, double phi, const arma::cx_vec & ylm, arma::cx_mat & dr, arma::cx_mat & dth, arma::cx_mat & dphi) const;
+        /// Evaluate Laplacian of basis functions from the values of all spherical harmonics up to lmax at the point
+        arma::cx_mat eval_lf(size_t iel, const arma::cx_vec & ylm) const;
+        /// Evaluate basis functions in element at radii r and angles (cth, phi): Npoints x Nbf(iel)
+        arma::cx_mat eval_bf(size_t iel, const arma::vec & r, const arma::vec & cth, const arma::vec & phi) const;
+        /**
+         * Evaluate orbitals at an arbitrary set of points given in
+         * spherical coordinates: Npoints x Norbs. The points are sorted
+         * by element, each element is evaluated once for all its points,
+         * and the orbitals are formed by a single matrix product per
+         * element. Points outside the basis are zero.
+         */
+        arma::cx_mat eval_orbs(const arma::mat & C, const arma::vec & r, const arma::vec & cth, const arma::vec & phi) const;
+        /// Evaluate the electron density at an arbitrary set of points, as in eval_orbs
+        arma::vec electron_density(const arma::mat & P, const arma::vec & r, const arma::vec & cth, const arma::vec & phi) const;
         /// Get list of basis function indices in element
         arma::uvec bf_list(size_t iel) const;
+        /// Upper bounds for the magnitudes of the functions in element on the quadrature points
+        arma::vec bf_bound(size_t iel) const;
 
         /// Get number of radial elements
         size_t get_rad_Nel() const;
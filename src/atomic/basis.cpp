@@ -116,6 +116,65 @@ namespace helfem {
         return bval;
       }
 
+      double confinement_potential(int iconf, int conf_N, double conf_R, double r) {
+        double x(r/conf_R);
+        if(iconf==1) {
+          // Same sign convention as in TwoDBasis::confinement
+          if(conf_N<0)
+            return -std::pow(x, conf_N);
+          return std::pow(x, conf_N);
+        } else if(iconf==2) {
+          // N! (exp(x) - sum_{k<N} x^k/k!)
+          double term=1.0, sum=0.0, fact=1.0;
+          for(int k=0;k<conf_N;k++) {
+            sum+=term;
+            term*=x/(k+1);
+            fact*=k+1;
+          }
+          return fact*(std::exp(x)-sum);
+        } else
+          throw std::logic_error("Case not implemented!\n");
+      }
+
+      double confinement_truncation(int iconf, int conf_N, double conf_R, double rmax, double thr) {
+        if(thr<=0.0)
+          return rmax;
+        if(conf_N<=0)
+          throw std::logic_error("Grid truncation requires a confining potential!\n");
+
+        // In the classically forbidden region the density decays as
+        // exp(-2 int sqrt(2 V(r)) dr); integrate outwards from the
+        // wall until the density has decreased by thr
+        double target(-std::log(thr));
+        size_t nstep=10000;
+        double dr((rmax-conf_R)/nstep);
+        double expn=0.0;
+        for(size_t i=0;i<nstep;i++) {
+          double r(conf_R+(i+0.5)*dr);
+          expn+=2.0*sqrt(2.0*confinement_potential(iconf,conf_N,conf_R,r))*dr;
+          if(expn>=target)
+            return conf_R+(i+1)*dr;
+        }
+        return rmax;
+      }
+
+      arma::vec confinement_grid(int num_el, double rmax, int igrid, double zexp, int num_el_conf, int iconf, int conf_N, double conf_R, double thr) {
+        if(conf_R<=0.0 || conf_R>=rmax)
+          throw std::logic_error("Confinement radius must be between zero and Rmax!\n");
+
+        // Truncate the grid where the density is negligible
+        double rtrunc(confinement_truncation(iconf,conf_N,conf_R,rmax,thr));
+        if(rtrunc<rmax)
+          printf("Grid truncated at %e due to confinement\n",rtrunc);
+
+        // Usual grid inside the wall
+        arma::vec bin(utils::get_grid(conf_R,num_el,igrid,zexp));
+        // and a uniform grid in the wall region
+        arma::vec bwall(utils::get_grid(rtrunc-conf_R,num_el_conf,1,1.0));
+
+        return concatenate_grid(bin,bwall);
+      }
+
       arma::vec form_grid(modelpotential::nuclear_model_t model, double Rrms, int Nelem, double Rmax, int igrid, double zexp, int Nelem0, int igrid0, double zexp0, int Z, int Zl, int Zr, double Rhalf) {
         // Construct the radial basis
         arma::vec bval;
@@ -150,6 +209,39 @@ namespace helfem {
         return bval;
       }
 
+      arma::vec refine_grid(const arma::vec & bval, const arma::vec & err, double theta) {
+        if(err.n_elem+1 != bval.n_elem)
+          throw std::logic_error("Need an error estimate for every element!\n");
+        if(theta<=0.0 || theta>1.0)
+          throw std::logic_error("Refinement fraction must be in (0,1]!\n");
+
+        // Mark the smallest set of elements that carries the wanted
+        // fraction of the total squared error
+        arma::vec err2(arma::square(err));
+        arma::uvec order(arma::sort_index(err2,"descend"));
+        arma::uvec split(err.n_elem,arma::fill::zeros);
+        double total(arma::sum(err2)), marked=0.0;
+        for(size_t i=0;i<order.n_elem;i++) {
+          if(marked>=theta*total)
+            break;
+          split(order(i))=1;
+          marked+=err2(order(i));
+        }
+
+        // Split the marked elements in half. The polynomials on the
+        // old element are exactly representable on the two halves, so
+        // the refined basis contains the old one.
+        std::vector<double> bnew;
+        for(size_t iel=0;iel<err.n_elem;iel++) {
+          bnew.push_back(bval(iel));
+          if(split(iel))
+            bnew.push_back(0.5*(bval(iel)+bval(iel+1)));
+        }
+        bnew.push_back(bval(bval.n_elem-1));
+
+        return arma::conv_to<arma::vec>::from(bnew);
+      }
+
       void angular_basis(int lmax, int mmax, arma::ivec & lval, arma::ivec & mval) {
         size_t nang=0;
         for(int l=0;l<=lmax;l++)
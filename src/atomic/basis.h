@@ -31,8 +31,16 @@ namespace helfem {
       arma::vec finite_nuclear_grid(int num_el, double rmax, int igrid, double zexp, int num_el_nuc, double rnuc, int igrid_nuc, double zexp_nuc);
       /// Get the element grid in the case of off-center nuclei
       arma::vec offcenter_nuclear_grid(int num_el0, int Zm, int Zlr, double Rhalf, int num_el, double rmax, int igrid, double zexp);
+      /// Value of the confinement potential at r
+      double confinement_potential(int iconf, int conf_N, double conf_R, double r);
+      /// Radius beyond which the confinement potential makes the density negligible (WKB estimate)
+      double confinement_truncation(int iconf, int conf_N, double conf_R, double rmax, double thr);
+      /// Get the element grid for a confined atom: elements are clustered at the confinement wall, and the grid is truncated where the density becomes negligible
+      arma::vec confinement_grid(int num_el, double rmax, int igrid, double zexp, int num_el_conf, int iconf, int conf_N, double conf_R, double thr);
       /// Form the grid in the general case, using the above routines
       arma::vec form_grid(modelpotential::nuclear_model_t model, double Rrms, int Nelem, double Rmax, int igrid, double zexp, int Nelem0, int igrid0, double zexp0, int Z, int Zl, int Zr, double Rhalf);
+      /// Refine the grid by splitting the elements with the largest error estimates, until the split elements carry the fraction theta of the total squared error
+      arma::vec refine_grid(const arma::vec & bval, const arma::vec & err, double theta);
 
       /// Constructs an angular basis
       void angular_basis(int lmax, int mmax, arma::ivec & lval, arma::ivec & mval);
@@ -14,6 +14,7 @@
  * of the License, or (at your option) any later version.
  */
 
+#include <algorithm>
 #include <cfloat>
 #include <cmath>
 #include <cstdio>
@@ -24,6 +25,10 @@
 #include "../general/dftfuncs.h"
 // Angular quadrature
 #include "../general/angular.h"
+#include "utils.h"
+#include "../general/timer.h"
+#include "../general/blockscatter.h"
+#include "../general/threading.h"
 
 // OpenMP parallellization for XC calculations
 #ifdef _OPENMP
@@ -33,202 +38,181 @@
 namespace helfem {
   namespace atomic {
     namespace dftgrid {
-      DFTGridWorker::DFTGridWorker() {
+      DFTGridWorker::DFTGridWorker() : angrule(NULL), ylm(NULL), real_ylm(false), use_real(false) {
       }
 
-      DFTGridWorker::DFTGridWorker(const helfem::atomic::basis::TwoDBasis * basp_, int lang, int mang) : basp(basp_) {
+      DFTGridWorker::DFTGridWorker(const helfem::atomic::basis::TwoDBasis * basp_, int lang_, int mang_) : basp(basp_), lang(lang_), mang(mang_) {
         do_grad=false;
         do_tau=false;
         do_lapl=false;
 
         // Get angular grid
-        helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
+        angrule=&helfem::angular::angular_rule(lang,mang);
+        ylm=&helfem::angular::spherical_harmonics_table(lang,mang,arma::max(basp->get_lval()));
+
+        // The density can be evaluated with real spherical harmonics
+        // if the angular basis is closed under m -> -m
+        arma::ivec lval(basp->get_lval());
+        arma::ivec mval(basp->get_mval());
+        real_ylm=true;
+        use_real=false;
+        ylm_partner.zeros(lval.n_elem);
+        for(size_t i=0;i<lval.n_elem;i++) {
+          arma::uvec idx(arma::find(lval==lval(i) && mval==-mval(i)));
+          if(!idx.n_elem) {
+            real_ylm=false;
+            break;
+          }
+          ylm_partner(i)=idx(0);
+        }
       }
 
       DFTGridWorker::~DFTGridWorker() {
       }
 
-      void DFTGridWorker::update_density(const arma::mat & P0) {
-        // Update values of density
-        if(!P0.n_elem) {
-          throw std::runtime_error("Error - density matrix is empty!\n");
-        }
-        arma::mat P(basp->expand_boundaries(P0)(bf_ind,bf_ind));
-
-        // Non-polarized calculation.
-        polarized=false;
+      bool DFTGridWorker::real_density(const arma::mat & P, arma::mat & Pr) const {
+        // P_r = U^* P U^T
+        arma::cx_mat Pc(arma::conj(Ureal)*P*arma::strans(Ureal));
+        Pr=arma::real(Pc);
+        return arma::norm(arma::imag(Pc),"fro") <= 1e-10*std::max(1.0,arma::norm(Pr,"fro"));
+      }
 
+      template<typename T> void DFTGridWorker::density_wrk(const arma::Mat<T> & P, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) {
         // Update density vector
-        Pv=P*arma::conj(bf);
+        arma::Mat<T> Pv=P*arma::conj(f);
 
         // Calculate density
-        rho.zeros(1,wtot.n_elem);
-        for(size_t ip=0;ip<wtot.n_elem;ip++)
-          rho(0,ip)=std::real(arma::dot(Pv.col(ip),bf.col(ip)));
+        rho=utils::real_column_dot(Pv,f);
 
         // Calculate gradient
         if(do_grad) {
           grho.zeros(3,wtot.n_elem);
-          sigma.zeros(1,wtot.n_elem);
-          for(size_t ip=0;ip<wtot.n_elem;ip++) {
-            // Calculate values
-            double g_rad=grho(0,ip)=2.0*std::real(arma::dot(Pv.col(ip),bf_rho.col(ip)))/scale_r(ip);
-            double g_th=grho(1,ip)=2.0*std::real(arma::dot(Pv.col(ip),bf_theta.col(ip)))/scale_theta(ip);
-            double g_phi=grho(2,ip)=2.0*std::real(arma::dot(Pv.col(ip),bf_phi.col(ip)))/scale_phi(ip);
-            // Compute sigma as well
-            sigma(0,ip)=g_rad*g_rad + g_th*g_th + g_phi*g_phi;
-          }
+          grho.row(0)=2.0*utils::real_column_dot(Pv,f_rho)/scale_r;
+          grho.row(1)=2.0*utils::real_column_dot(Pv,f_theta)/scale_theta;
+          grho.row(2)=2.0*utils::real_column_dot(Pv,f_phi)/scale_phi;
+          // Compute sigma as well
+          sigma=arma::sum(arma::square(grho),0);
         }
 
         // Calculate laplacian and kinetic energy density
         if(do_tau || do_lapl) {
-          // Adjust size of grid
-          tau.zeros(1,wtot.n_elem);
-
           // Update helpers
-          Pv_rho=P*arma::conj(bf_rho);
-          Pv_theta=P*arma::conj(bf_theta);
-          Pv_phi=P*arma::conj(bf_phi);
-
-          // Calculate values
-          for(size_t ip=0;ip<wtot.n_elem;ip++) {
-            // Gradient term
-            double kinrho(std::real(arma::dot(Pv_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2));
-            double kintheta(std::real(arma::dot(Pv_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2));
-            double kinphi(std::real(arma::dot(Pv_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2));
-            double kin(kinrho + kintheta + kinphi);
+          arma::Mat<T> Pv_rho=P*arma::conj(f_rho);
+          arma::Mat<T> Pv_theta=P*arma::conj(f_theta);
+          arma::Mat<T> Pv_phi=P*arma::conj(f_phi);
 
-            // Store values
-            tau(0,ip)=0.5*kin;
-          }
+          // Gradient term, shared by tau and the laplacian
+          arma::rowvec kin(utils::real_column_dot(Pv_rho,f_rho)/arma::square(scale_r) + utils::real_column_dot(Pv_theta,f_theta)/arma::square(scale_theta) + utils::real_column_dot(Pv_phi,f_phi)/arma::square(scale_phi));
+          tau=0.5*kin;
 
           if(do_lapl) {
-            // Adjust size of grid
-            lapl.zeros(1,wtot.n_elem);
-            // Calculate values
-            for(size_t ip=0;ip<wtot.n_elem;ip++) {
-              // Gradient term
-              double kinrho(std::real(arma::dot(Pv_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2));
-              double kintheta(std::real(arma::dot(Pv_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2));
-              double kinphi(std::real(arma::dot(Pv_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2));
-              double kin(kinrho + kintheta + kinphi);
-              // Laplacian term
-              double lap(std::real(arma::dot(Pv.col(ip),bf_lapl.col(ip))));
-
-              // Store values
-              lapl(0,ip)=2.0*(kin + lap);
-            }
+            // Laplacian term
+            lapl=2.0*(kin + utils::real_column_dot(Pv,f_lapl));
           }
         }
       }
 
-      void DFTGridWorker::update_density(const arma::mat & Pa0, const arma::mat & Pb0) {
-        if(!Pa0.n_elem || !Pb0.n_elem) {
-          throw std::runtime_error("Error - density matrix is empty!\n");
-        }
-
-        // Polarized calculation.
-        polarized=true;
-
-        // Update density vector
-        arma::mat Pa(basp->expand_boundaries(Pa0)(bf_ind,bf_ind));
-        arma::mat Pb(basp->expand_boundaries(Pb0)(bf_ind,bf_ind));
-
-        Pav=Pa*arma::conj(bf);
-        Pbv=Pb*arma::conj(bf);
+      template<typename T> void DFTGridWorker::density_wrk(const arma::Mat<T> & Pa, const arma::Mat<T> & Pb, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) {
+        arma::Mat<T> Pav=Pa*arma::conj(f);
+        arma::Mat<T> Pbv=Pb*arma::conj(f);
 
         // Calculate density
         rho.zeros(2,wtot.n_elem);
-        for(size_t ip=0;ip<wtot.n_elem;ip++) {
-          rho(0,ip)=std::real(arma::dot(Pav.col(ip),bf.col(ip)));
-          rho(1,ip)=std::real(arma::dot(Pbv.col(ip),bf.col(ip)));
-
-          /*
-            double na=compute_density(Pa0,*basp,grid[ip].r);
-            double nb=compute_density(Pb0,*basp,grid[ip].r);
-            if(fabs(da-na)>1e-6 || fabs(db-nb)>1e-6)
-            printf("Density at point % .3f % .3f % .3f: %e vs %e, %e vs %e\n",grid[ip].r.x,grid[ip].r.y,grid[ip].r.z,da,na,db,nb);
-          */
-        }
+        rho.row(0)=utils::real_column_dot(Pav,f);
+        rho.row(1)=utils::real_column_dot(Pbv,f);
 
         // Calculate gradient
-
         if(do_grad) {
           grho.zeros(6,wtot.n_elem);
+          grho.row(0)=2.0*utils::real_column_dot(Pav,f_rho)/scale_r;
+          grho.row(1)=2.0*utils::real_column_dot(Pav,f_theta)/scale_theta;
+          grho.row(2)=2.0*utils::real_column_dot(Pav,f_phi)/scale_phi;
+          grho.row(3)=2.0*utils::real_column_dot(Pbv,f_rho)/scale_r;
+          grho.row(4)=2.0*utils::real_column_dot(Pbv,f_theta)/scale_theta;
+          grho.row(5)=2.0*utils::real_column_dot(Pbv,f_phi)/scale_phi;
+
+          // Compute sigma as well
           sigma.zeros(3,wtot.n_elem);
-          for(size_t ip=0;ip<wtot.n_elem;ip++) {
-            double ga_rad=grho(0,ip)=2.0*std::real(arma::dot(Pav.col(ip),bf_rho.col(ip)))/scale_r(ip);
-            double ga_th=grho(1,ip)=2.0*std::real(arma::dot(Pav.col(ip),bf_theta.col(ip)))/scale_theta(ip);
-            double ga_phi=grho(2,ip)=2.0*std::real(arma::dot(Pav.col(ip),bf_phi.col(ip)))/scale_phi(ip);
-
-            double gb_rad=grho(3,ip)=2.0*std::real(arma::dot(Pbv.col(ip),bf_rho.col(ip)))/scale_r(ip);
-            double gb_th=grho(4,ip)=2.0*std::real(arma::dot(Pbv.col(ip),bf_theta.col(ip)))/scale_theta(ip);
-            double gb_phi=grho(5,ip)=2.0*std::real(arma::dot(Pbv.col(ip),bf_phi.col(ip)))/scale_phi(ip);
-
-            // Compute sigma as well
-            sigma(0,ip)=ga_rad*ga_rad + ga_th*ga_th + ga_phi*ga_phi;
-            sigma(1,ip)=ga_rad*gb_rad + ga_th*gb_th + ga_phi*gb_phi;
-            sigma(2,ip)=gb_rad*gb_rad + gb_th*gb_th + gb_phi*gb_phi;
-          }
+          sigma.row(0)=arma::sum(arma::square(grho.rows(0,2)),0);
+          sigma.row(1)=arma::sum(grho.rows(0,2)%grho.rows(3,5),0);
+          sigma.row(2)=arma::sum(arma::square(grho.rows(3,5)),0);
         }
 
         // Calculate kinetic energy density
         if(do_tau || do_lapl) {
-          // Adjust size of grid
-          tau.resize(2,wtot.n_elem);
-
           // Update helpers
-          Pav_rho=Pa*arma::conj(bf_rho);
-          Pav_theta=Pa*arma::conj(bf_theta);
-          Pav_phi=Pa*arma::conj(bf_phi);
-
-          Pbv_rho=Pb*arma::conj(bf_rho);
-          Pbv_theta=Pb*arma::conj(bf_theta);
-          Pbv_phi=Pb*arma::conj(bf_phi);
-
-          // Calculate values
-          for(size_t ip=0;ip<wtot.n_elem;ip++) {
-            // Gradient term
-            double kinar=std::real(arma::dot(Pav_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2);
-            double kinath=std::real(arma::dot(Pav_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2);
-            double kinaphi=std::real(arma::dot(Pav_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2);
-            double kina(kinar + kinath + kinaphi);
-
-            double kinbr=std::real(arma::dot(Pbv_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2);
-            double kinbth=std::real(arma::dot(Pbv_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2);
-            double kinbphi=std::real(arma::dot(Pbv_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2);
-            double kinb(kinbr + kinbth + kinbphi);
-
-            // Store values
-            tau(0,ip)=0.5*kina;
-            tau(1,ip)=0.5*kinb;
-          }
+          arma::Mat<T> Pav_rho=Pa*arma::conj(f_rho);
+          arma::Mat<T> Pav_theta=Pa*arma::conj(f_theta);
+          arma::Mat<T> Pav_phi=Pa*arma::conj(f_phi);
+
+          arma::Mat<T> Pbv_rho=Pb*arma::conj(f_rho);
+          arma::Mat<T> Pbv_theta=Pb*arma::conj(f_theta);
+          arma::Mat<T> Pbv_phi=Pb*arma::conj(f_phi);
+
+          // Gradient terms, shared by tau and the laplacian
+          arma::rowvec kina(utils::real_column_dot(Pav_rho,f_rho)/arma::square(scale_r) + utils::real_column_dot(Pav_theta,f_theta)/arma::square(scale_theta) + utils::real_column_dot(Pav_phi,f_phi)/arma::square(scale_phi));
+          arma::rowvec kinb(utils::real_column_dot(Pbv_rho,f_rho)/arma::square(scale_r) + utils::real_column_dot(Pbv_theta,f_theta)/arma::square(scale_theta) + utils::real_column_dot(Pbv_phi,f_phi)/arma::square(scale_phi));
+
+          tau.zeros(2,wtot.n_elem);
+          tau.row(0)=0.5*kina;
+          tau.row(1)=0.5*kinb;
+
           if(do_lapl) {
-            // Adjust size of grid
+            // Laplacian terms
             lapl.zeros(2,wtot.n_elem);
-            // Calculate values
-            for(size_t ip=0;ip<wtot.n_elem;ip++) {
-              // Gradient term
-              double kinar=std::real(arma::dot(Pav_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2);
-              double kinath=std::real(arma::dot(Pav_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2);
-              double kinaphi=std::real(arma::dot(Pav_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2);
-              double kina(kinar + kinath + kinaphi);
-
-              double kinbr=std::real(arma::dot(Pbv_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2);
-              double kinbth=std::real(arma::dot(Pbv_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2);
-              double kinbphi=std::real(arma::dot(Pbv_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2);
-              double kinb(kinbr + kinbth + kinbphi);
-
-              // Laplacian term
-              double lapa(std::real(arma::dot(Pav.col(ip),bf_lapl.col(ip))));
-              double lapb(std::real(arma::dot(Pbv.col(ip),bf_lapl.col(ip))));
-
-              // Store values
-              lapl(0,ip)=2.0*(kina + lapa);
-              lapl(1,ip)=2.0*(kinb + lapb);
-            }
+            lapl.row(0)=2.0*(kina + utils::real_column_dot(Pav,f_lapl));
+            lapl.row(1)=2.0*(kinb + utils::real_column_dot(Pbv,f_lapl));
+          }
+        }
+      }
+
+      void DFTGridWorker::update_density(const arma::mat & P0) {
+        // Update values of density
+        if(!P0.n_elem) {
+          throw std::runtime_error("Error - density matrix is empty!\n");
+        }
+        // The atomic basis has no dummy functions, so the block is gathered directly
+        arma::mat P(P0(bf_ind,bf_ind));
+
+        // Non-polarized calculation.
+        polarized=false;
+
+        if(use_real) {
+          arma::mat Pr;
+          if(real_density(P,Pr)) {
+            density_wrk<double>(Pr,rbf,rbf_rho,rbf_theta,rbf_phi,rbf_lapl);
+            return;
+          }
+          // The density is not symmetric in m
+          form_complex_bf();
+        }
+        density_wrk< std::complex<double> >(arma::conv_to<arma::cx_mat>::from(P),bf,bf_rho,bf_theta,bf_phi,bf_lapl);
+      }
+
+      void DFTGridWorker::update_density(const arma::mat & Pa0, const arma::mat & Pb0) {
+        if(!Pa0.n_elem || !Pb0.n_elem) {
+          throw std::runtime_error("Error - density matrix is empty!\n");
+        }
+
+        // Polarized calculation.
+        polarized=true;
+
+        arma::mat Pa(Pa0(bf_ind,bf_ind));
+        arma::mat Pb(Pb0(bf_ind,bf_ind));
+
+        if(use_real) {
+          arma::mat Par, Pbr;
+          // Both densities are needed, so no short-circuit
+          bool areal(real_density(Pa,Par));
+          bool breal(real_density(Pb,Pbr));
+          if(areal && breal) {
+            density_wrk<double>(Par,Pbr,rbf,rbf_rho,rbf_theta,rbf_phi,rbf_lapl);
+            return;
           }
+          // The density is not symmetric in m
+          form_complex_bf();
         }
+        density_wrk< std::complex<double> >(arma::conv_to<arma::cx_mat>::from(Pa),arma::conv_to<arma::cx_mat>::from(Pb),bf,bf_rho,bf_theta,bf_phi,bf_lapl);
       }
 
       double DFTGridWorker::compute_Nel() const {
@@ -376,20 +360,64 @@ namespace helfem {
       }
 
       void DFTGridWorker::compute_xc(int func_id, const arma::vec & p, double thr, bool pot) {
+        XCFunctional func(func_id,polarized,p,thr);
+        compute_xc(func,pot);
+      }
+
+      void DFTGridWorker::compute_xc(const XCFunctional & func, bool pot) {
+        std::vector<DFTGridWorker *> batch(1,this);
+        compute_xc(batch,func,pot);
+      }
+
+      void DFTGridWorker::compute_xc(const std::vector<DFTGridWorker *> & batch, const XCFunctional & xcfunc, bool pot) {
         // Compute exchange-correlation functional
+        if(!batch.size())
+          return;
+        const bool polarized(batch[0]->polarized);
+        if(xcfunc.is_polarized() != polarized)
+          throw std::logic_error("Functional was initialized for the wrong spin polarization!\n");
 
         // Which functional is in question?
         bool gga, mgga_t, mgga_l;
-        is_gga_mgga(func_id,gga,mgga_t,mgga_l);
+        xcfunc.get_family(gga,mgga_t,mgga_l);
+        const bool has_energy(xcfunc.has_exc());
 
         // Update controlling flags for eval_Fxc (exchange and correlation
         // parts might be of different type)
-        do_gga=do_gga || gga || mgga_t || mgga_l;
-        do_mgga_t=do_mgga_t || mgga_t;
-        do_mgga_l=do_mgga_l || mgga_l;
+        for(size_t ib=0;ib<batch.size();ib++) {
+          DFTGridWorker & w(*batch[ib]);
+          if(w.polarized != polarized)
+            throw std::logic_error("Mixed spin polarization in XC batch!\n");
+          w.do_gga=w.do_gga || gga || mgga_t || mgga_l;
+          w.do_mgga_t=w.do_mgga_t || mgga_t;
+          w.do_mgga_l=w.do_mgga_l || mgga_l;
+        }
+
+        // Collect the densities of the batch into contiguous arrays;
+        // libxc stores the spin components of each point consecutively
+        arma::mat rho, sigma, lapl, tau;
+        if(batch.size()==1) {
+          rho=batch[0]->rho;
+          if(gga || mgga_t || mgga_l)
+            sigma=batch[0]->sigma;
+          if(mgga_l)
+            lapl=batch[0]->lapl;
+          if(mgga_t)
+            tau=batch[0]->tau;
+        } else {
+          for(size_t ib=0;ib<batch.size();ib++) {
+            rho=arma::join_rows(rho,batch[ib]->rho);
+            if(gga || mgga_t || mgga_l)
+              sigma=arma::join_rows(sigma,batch[ib]->sigma);
+            if(mgga_l)
+              lapl=arma::join_rows(lapl,batch[ib]->lapl);
+            if(mgga_t)
+              tau=arma::join_rows(tau,batch[ib]->tau);
+          }
+        }
 
         // Amount of grid points
-        const size_t N=wtot.n_elem;
+        const size_t N=rho.n_cols;
 
         // Work arrays - exchange and correlation are computed separately
         arma::rowvec exc_wrk;
@@ -398,66 +426,43 @@ namespace helfem {
         arma::mat vlapl_wrk;
         arma::mat vtau_wrk;
 
-        if(has_exc(func_id))
-          exc_wrk.zeros(exc.n_elem);
+        if(has_energy)
+          exc_wrk.zeros(N);
         if(pot) {
-          vxc_wrk.zeros(vxc.n_rows,vxc.n_cols);
+          vxc_wrk.zeros(rho.n_rows,N);
           if(gga || mgga_t || mgga_l)
-            vsigma_wrk.zeros(vsigma.n_rows,vsigma.n_cols);
+            vsigma_wrk.zeros(sigma.n_rows,N);
           if(mgga_t)
-            vtau_wrk.zeros(vtau.n_rows,vtau.n_cols);
+            vtau_wrk.zeros(tau.n_rows,N);
           if(mgga_l)
-            vlapl_wrk.zeros(vlapl.n_rows,vlapl.n_cols);
+            vlapl_wrk.zeros(lapl.n_rows,N);
         }
 
-        // Spin variable for libxc
-        int nspin;
-        if(!polarized)
-          nspin=XC_UNPOLARIZED;
-        else
-          nspin=XC_POLARIZED;
-
-        // Initialize libxc worker
-        xc_func_type func;
-        if(xc_func_init(&func, func_id, nspin) != 0) {
-          std::ostringstream oss;
-          oss << "Functional "<<func_id<<" not found!";
-          throw std::runtime_error(oss.str());
-        }
-        // Set density threshold
-        xc_func_set_dens_threshold(&func, thr);
-
-        // Set parameters
-        if(p.n_elem) {
-          // Check sanity
-          if(p.n_elem != (arma::uword) xc_func_info_get_n_ext_params((xc_func_info_type *)func.info))
-            throw std::logic_error("Incompatible number of parameters!\n");
-          arma::vec phlp(p);
-          xc_func_set_ext_params(&func, phlp.memptr());
-        }
+        // The functional has been initialized once for the whole SCF
+        xc_func_type *func(xcfunc.get());
 
         // Evaluate functionals.
-        if(has_exc(func_id)) {
+        if(has_energy) {
           if(pot) {
             if(mgga_t || mgga_l) {// meta-GGA
               double * laplp = mgga_l ? lapl.memptr() : NULL;
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_exc_vxc(&func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
+              xc_lda_exc_vxc(func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
           } else {
             if(mgga_t || mgga_l) { // meta-GGA
               double * laplp = mgga_l ? lapl.memptr() : NULL;
               double * taup = mgga_t ? tau.memptr() : NULL;
-              xc_mgga_exc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
+              xc_mgga_exc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
             } else if(gga) // GGA
-              xc_gga_exc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
+              xc_gga_exc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
             else // LDA
-              xc_lda_exc(&func, N, rho.memptr(), exc_wrk.memptr());
+              xc_lda_exc(func, N, rho.memptr(), exc_wrk.memptr());
           }
 
         } else {
@@ -467,29 +472,34 @@ namespace helfem {
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_vxc(&func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_vxc(func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_vxc(&func, N, rho.memptr(), vxc_wrk.memptr());
+              xc_lda_vxc(func, N, rho.memptr(), vxc_wrk.memptr());
           }
         }
 
         // Sum to total arrays containing both exchange and correlation
-        if(has_exc(func_id))
-          exc+=exc_wrk;
-        if(pot) {
-          if(mgga_l)
-            vlapl+=vlapl_wrk;
-          if(mgga_t)
-            vtau+=vtau_wrk;
-          if(mgga_t || mgga_l || gga)
-            vsigma+=vsigma_wrk;
-          vxc+=vxc_wrk;
+        size_t ioff=0;
+        for(size_t ib=0;ib<batch.size();ib++) {
+          DFTGridWorker & w(*batch[ib]);
+          const size_t Nw=w.rho.n_cols;
+          if(Nw) {
+            if(has_energy)
+              w.exc+=exc_wrk.cols(ioff,ioff+Nw-1);
+            if(pot) {
+              if(mgga_l)
+                w.vlapl+=vlapl_wrk.cols(ioff,ioff+Nw-1);
+              if(mgga_t)
+                w.vtau+=vtau_wrk.cols(ioff,ioff+Nw-1);
+              if(mgga_t || mgga_l || gga)
+                w.vsigma+=vsigma_wrk.cols(ioff,ioff+Nw-1);
+              w.vxc+=vxc_wrk.cols(ioff,ioff+Nw-1);
+            }
+          }
+          ioff+=Nw;
         }
-
-        // Free functional
-        xc_func_end(&func);
       }
 
       double DFTGridWorker::eval_Exc() const {
@@ -504,7 +514,11 @@ namespace helfem {
         // Calculate in subspace
         arma::mat S(bf_ind.n_elem,bf_ind.n_elem);
         S.zeros();
-        increment_lda< std::complex<double> >(S,wtot,bf);
+        if(use_real) {
+          increment_lda<double>(S,wtot,rbf);
+          S=arma::real(arma::trans(Ureal)*S*Ureal);
+        } else
+          increment_lda< std::complex<double> >(S,wtot,bf);
         // Increment
         So.submat(bf_ind,bf_ind)+=S;
       }
@@ -513,47 +527,40 @@ namespace helfem {
         // Calculate in subspace
         arma::mat T(bf_ind.n_elem,bf_ind.n_elem);
         T.zeros();
-        increment_lda< std::complex<double> >(T,wtot/arma::square(scale_r),bf_rho);
-        increment_lda< std::complex<double> >(T,wtot/arma::square(scale_theta),bf_theta);
-        increment_lda< std::complex<double> >(T,wtot/arma::square(scale_phi),bf_phi);
+        if(use_real) {
+          increment_lda<double>(T,wtot/arma::square(scale_r),rbf_rho);
+          increment_lda<double>(T,wtot/arma::square(scale_theta),rbf_theta);
+          increment_lda<double>(T,wtot/arma::square(scale_phi),rbf_phi);
+          T=arma::real(arma::trans(Ureal)*T*Ureal);
+        } else {
+          increment_lda< std::complex<double> >(T,wtot/arma::square(scale_r),bf_rho);
+          increment_lda< std::complex<double> >(T,wtot/arma::square(scale_theta),bf_theta);
+          increment_lda< std::complex<double> >(T,wtot/arma::square(scale_phi),bf_phi);
+        }
         // Increment
         To.submat(bf_ind,bf_ind)+=0.5*T;
       }
 
-      void DFTGridWorker::eval_Fxc(arma::mat & Ho) const {
-        if(polarized) {
-          throw std::runtime_error("Refusing to compute restricted Fock matrix with unrestricted density.\n");
-        }
-
-        // Work matrix
-        arma::mat H(bf_ind.n_elem,bf_ind.n_elem);
-        H.zeros();
-
-        {
-          // LDA potential
-          arma::rowvec vrho(vxc.row(0));
-          // Multiply weights into potential
-          vrho%=wtot;
-          // Increment matrix
-          increment_lda< std::complex<double> >(H,vrho,bf);
-        }
+      template<typename T> void DFTGridWorker::Fxc_wrk(arma::mat & H, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) const {
+        // LDA potential, multiplied by the weights
+        arma::rowvec vrho(vxc.row(0)%wtot);
 
+        arma::mat gr;
         if(do_gga) {
           // Get vsigma
           arma::rowvec vs(vsigma.row(0));
           // Get grad rho
           arma::uvec idx(arma::linspace<arma::uvec>(0,2,3));
-          arma::mat gr(arma::trans(grho.rows(idx)));
+          gr=arma::trans(grho.rows(idx));
           // Multiply grad rho by vsigma and the weights
           for(size_t i=0;i<gr.n_rows;i++) {
             gr(i,0)*=2.0*wtot(i)*vs(i)/scale_r(i);
             gr(i,1)*=2.0*wtot(i)*vs(i)/scale_theta(i);
             gr(i,2)*=2.0*wtot(i)*vs(i)/scale_phi(i);
           }
-          // Increment matrix
-          increment_gga< std::complex<double> >(H,gr,bf,bf_rho,bf_theta,bf_phi);
         }
 
+        arma::mat vt;
         if(do_mgga_t || do_mgga_l) {
           arma::rowvec vtl(wtot.n_elem, arma::fill::zeros);
           if(do_mgga_t)
@@ -562,46 +569,46 @@ namespace helfem {
             vtl += 2.0*vlapl.row(0);
           vtl %= wtot;
 
-          increment_lda< std::complex<double> >(H,vtl/arma::square(scale_r),bf_rho);
-          increment_lda< std::complex<double> >(H,vtl/arma::square(scale_theta),bf_theta);
-          increment_lda< std::complex<double> >(H,vtl/arma::square(scale_phi),bf_phi);
-        }
-        if(do_mgga_l) {
-          arma::rowvec vl(vlapl.row(0)%wtot);
-          increment_mgga_lapl< std::complex<double> >(H,vl,bf,bf_lapl);
+          vt.zeros(3,wtot.n_elem);
+          vt.row(0)=vtl/arma::square(scale_r);
+          vt.row(1)=vtl/arma::square(scale_theta);
+          vt.row(2)=vtl/arma::square(scale_phi);
         }
+        arma::rowvec vl;
+        if(do_mgga_l)
+          vl=vlapl.row(0)%wtot;
+
+        increment_fock<T>(H,vrho,gr,vt,vl,f,f_rho,f_theta,f_phi,f_lapl);
+      }
 
+      void DFTGridWorker::eval_Fxc(arma::mat & Ho) const {
+        arma::mat H;
+        eval_Fxc_block(H);
         Ho(bf_ind,bf_ind)+=H;
       }
 
-      void DFTGridWorker::eval_Fxc(arma::mat & Hao, arma::mat & Hbo, bool beta) const {
-        if(!polarized) {
-          throw std::runtime_error("Refusing to compute unrestricted Fock matrix with restricted density.\n");
+      void DFTGridWorker::eval_Fxc_block(arma::mat & H) const {
+        if(polarized) {
+          throw std::runtime_error("Refusing to compute restricted Fock matrix with unrestricted density.\n");
         }
 
-        arma::mat Ha, Hb;
-        Ha.zeros(bf_ind.n_elem,bf_ind.n_elem);
-        if(beta)
-          Hb.zeros(bf_ind.n_elem,bf_ind.n_elem);
-
-        {
-          // LDA potential
-          arma::rowvec vrhoa(vxc.row(0));
-          // Multiply weights into potential
-          vrhoa%=wtot;
-          // Increment matrix
-          increment_lda< std::complex<double> >(Ha,vrhoa,bf);
+        H.zeros(bf_ind.n_elem,bf_ind.n_elem);
+        if(use_real) {
+          Fxc_wrk<double>(H,rbf,rbf_rho,rbf_theta,rbf_phi,rbf_lapl);
+          // Back to the complex functions
+          H=arma::real(arma::trans(Ureal)*H*Ureal);
+        } else
+          Fxc_wrk< std::complex<double> >(H,bf,bf_rho,bf_theta,bf_phi,bf_lapl);
+      }
 
-          if(beta) {
-            arma::rowvec vrhob(vxc.row(1));
-            vrhob%=wtot;
-            increment_lda< std::complex<double> >(Hb,vrhob,bf);
-          }
-        }
-        if(Ha.has_nan() || (beta && Hb.has_nan()))
-          //throw std::logic_error("NaN encountered!\n");
-          fprintf(stderr,"NaN in Hamiltonian!\n");
+      template<typename T> void DFTGridWorker::Fxc_wrk(arma::mat & Ha, arma::mat & Hb, bool beta, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) const {
+        // LDA potential, multiplied by the weights
+        arma::rowvec vrhoa(vxc.row(0)%wtot);
+        arma::rowvec vrhob;
+        if(beta)
+          vrhob=vxc.row(1)%wtot;
 
+        arma::mat gr_a, gr_b;
         if(do_gga) {
           // Get vsigma
           arma::rowvec vs_aa(vsigma.row(0));
@@ -614,64 +621,82 @@ namespace helfem {
           arma::mat gr_b0(arma::trans(grho.rows(idxb)));
 
           // Multiply grad rho by vsigma and the weights
-          arma::mat gr_a(gr_a0);
+          gr_a=gr_a0;
           for(size_t i=0;i<gr_a.n_rows;i++) {
             gr_a(i,0)=wtot(i)*(2.0*vs_aa(i)*gr_a0(i,0) + vs_ab(i)*gr_b0(i,0))/scale_r(i);
             gr_a(i,1)=wtot(i)*(2.0*vs_aa(i)*gr_a0(i,1) + vs_ab(i)*gr_b0(i,1))/scale_theta(i);
             gr_a(i,2)=wtot(i)*(2.0*vs_aa(i)*gr_a0(i,2) + vs_ab(i)*gr_b0(i,2))/scale_phi(i);
           }
-          // Increment matrix
-          increment_gga< std::complex<double> >(Ha,gr_a,bf,bf_rho,bf_theta,bf_phi);
 
           if(beta) {
             arma::rowvec vs_bb(vsigma.row(2));
-            arma::mat gr_b(gr_b0);
+            gr_b=gr_b0;
             for(size_t i=0;i<gr_b.n_rows;i++) {
               gr_b(i,0)=wtot(i)*(2.0*vs_bb(i)*gr_b0(i,0) + vs_ab(i)*gr_a0(i,0))/scale_r(i);
               gr_b(i,1)=wtot(i)*(2.0*vs_bb(i)*gr_b0(i,1) + vs_ab(i)*gr_a0(i,1))/scale_theta(i);
               gr_b(i,2)=wtot(i)*(2.0*vs_bb(i)*gr_b0(i,2) + vs_ab(i)*gr_a0(i,2))/scale_phi(i);
             }
-            increment_gga< std::complex<double> >(Hb,gr_b,bf,bf_rho,bf_theta,bf_phi);
           }
         }
 
-
-        if(do_mgga_t) {
-          arma::rowvec vtl_a(wtot.n_elem, arma::fill::zeros);
-          if(do_mgga_t)
-            vtl_a += 0.5*vtau.row(0);
-          if(do_mgga_l)
-            vtl_a += 2.0*vlapl.row(0);
-          vtl_a %= wtot;
-
-          increment_lda< std::complex<double> >(Ha,vtl_a/arma::square(scale_r),bf_rho);
-          increment_lda< std::complex<double> >(Ha,vtl_a/arma::square(scale_theta),bf_theta);
-          increment_lda< std::complex<double> >(Ha,vtl_a/arma::square(scale_phi),bf_phi);
-          if(beta) {
-            arma::rowvec vtl_b(wtot.n_elem, arma::fill::zeros);
+        arma::mat vt_a, vt_b;
+        arma::rowvec vl_a, vl_b;
+        if(do_mgga_t || do_mgga_l) {
+          for(int is=0;is<(beta ? 2 : 1);is++) {
+            arma::rowvec vtl(wtot.n_elem, arma::fill::zeros);
             if(do_mgga_t)
-              vtl_b += 0.5*vtau.row(1);
+              vtl += 0.5*vtau.row(is);
             if(do_mgga_l)
-              vtl_b += 2.0*vlapl.row(1);
-            vtl_b %= wtot;
-
-            increment_lda< std::complex<double> >(Hb,vtl_b/arma::square(scale_r),bf_rho);
-            increment_lda< std::complex<double> >(Hb,vtl_b/arma::square(scale_theta),bf_theta);
-            increment_lda< std::complex<double> >(Hb,vtl_b/arma::square(scale_phi),bf_phi);
+              vtl += 2.0*vlapl.row(is);
+            vtl %= wtot;
+
+            arma::mat & vt(is ? vt_b : vt_a);
+            vt.zeros(3,wtot.n_elem);
+            vt.row(0)=vtl/arma::square(scale_r);
+            vt.row(1)=vtl/arma::square(scale_theta);
+            vt.row(2)=vtl/arma::square(scale_phi);
           }
         }
         if(do_mgga_l) {
-          arma::rowvec vl_a(vlapl.row(0)%wtot);
-          arma::rowvec vl_b(vlapl.row(1)%wtot);
-          increment_mgga_lapl< std::complex<double> >(Ha,vl_a,bf,bf_lapl);
-          increment_mgga_lapl< std::complex<double> >(Hb,vl_b,bf,bf_lapl);
+          vl_a=vlapl.row(0)%wtot;
+          if(beta)
+            vl_b=vlapl.row(1)%wtot;
         }
 
+        increment_fock<T>(Ha,vrhoa,gr_a,vt_a,vl_a,f,f_rho,f_theta,f_phi,f_lapl);
+        if(beta)
+          increment_fock<T>(Hb,vrhob,gr_b,vt_b,vl_b,f,f_rho,f_theta,f_phi,f_lapl);
+        if(Ha.has_nan() || (beta && Hb.has_nan()))
+          //throw std::logic_error("NaN encountered!\n");
+          fprintf(stderr,"NaN in Hamiltonian!\n");
+      }
+
+      void DFTGridWorker::eval_Fxc(arma::mat & Hao, arma::mat & Hbo, bool beta) const {
+        arma::mat Ha, Hb;
+        eval_Fxc_block(Ha,Hb,beta);
         Hao(bf_ind,bf_ind)+=Ha;
         if(beta)
           Hbo(bf_ind,bf_ind)+=Hb;
       }
 
+      void DFTGridWorker::eval_Fxc_block(arma::mat & Ha, arma::mat & Hb, bool beta) const {
+        if(!polarized) {
+          throw std::runtime_error("Refusing to compute unrestricted Fock matrix with restricted density.\n");
+        }
+
+        Ha.zeros(bf_ind.n_elem,bf_ind.n_elem);
+        if(beta)
+          Hb.zeros(bf_ind.n_elem,bf_ind.n_elem);
+        if(use_real) {
+          Fxc_wrk<double>(Ha,Hb,beta,rbf,rbf_rho,rbf_theta,rbf_phi,rbf_lapl);
+          // Back to the complex functions
+          Ha=arma::real(arma::trans(Ureal)*Ha*Ureal);
+          if(beta)
+            Hb=arma::real(arma::trans(Ureal)*Hb*Ureal);
+        } else
+          Fxc_wrk< std::complex<double> >(Ha,Hb,beta,bf,bf_rho,bf_theta,bf_phi,bf_lapl);
+      }
+
       void DFTGridWorker::check_grad_tau_lapl(int x_func, int c_func) {
         // Do we need gradients?
         do_grad=false;
@@ -707,9 +732,32 @@ namespace helfem {
         do_lapl=lap_;
       }
 
+      void DFTGridWorker::set_angular_grid(int lang_, int mang_) {
+        if(lang_==lang && mang_==mang)
+          return;
+        lang=lang_;
+        mang=mang_;
+        angrule=&helfem::angular::angular_rule(lang,mang);
+        ylm=&helfem::angular::spherical_harmonics_table(lang,mang,arma::max(basp->get_lval()));
+      }
+
+      void DFTGridWorker::get_angular_grid(int & lang_, int & mang_) const {
+        lang_=lang;
+        mang_=mang;
+      }
+
+      size_t DFTGridWorker::get_nang() const {
+        return angrule->w.n_elem;
+      }
+
       void DFTGridWorker::compute_bf(size_t iel) {
+        const arma::vec & cth(angrule->cth);
+        const arma::vec & phi(angrule->phi);
+        const arma::vec & wang(angrule->w);
+
         // Update function list
         bf_ind=basp->bf_list(iel);
+        use_real=false;
 
         // Get radii and radial weights
         arma::vec r(basp->get_r(iel));
@@ -747,7 +795,7 @@ namespace helfem {
         // Loop over angular grid
         for(size_t ia=0;ia<cth.n_elem;ia++) {
           // Evaluate basis functions at angular point
-          arma::cx_mat abf(basp->eval_bf(iel, cth(ia), phi(ia)));
+          arma::cx_mat abf(basp->eval_bf(iel, ylm->col(ia)));
           if(abf.n_cols != bf_ind.n_elem) {
             std::ostringstream oss;
             oss << "Mismatch! Have " << bf_ind.n_elem << " basis function indices but " << abf.n_cols << " basis functions!\n";
@@ -765,7 +813,7 @@ namespace helfem {
 
           for(size_t ia=0;ia<cth.n_elem;ia++) {
             // Evaluate basis functions at angular point
-            basp->eval_df(iel, cth(ia), phi(ia), dr, dth, dphi);
+            basp->eval_df(iel, cth(ia), phi(ia), ylm->col(ia), dr, dth, dphi);
             if(dr.n_cols != bf_ind.n_elem) {
               std::ostringstream oss;
               oss << "Mismatch! Have " << bf_ind.n_elem << " basis function indices but " << dr.n_cols << " basis functions!\n";
@@ -783,7 +831,7 @@ namespace helfem {
           // Loop over angular grid
           for(size_t ia=0;ia<cth.n_elem;ia++) {
             // Evaluate basis functions at angular point
-            arma::cx_mat alf(basp->eval_lf(iel, cth(ia), phi(ia)));
+            arma::cx_mat alf(basp->eval_lf(iel, ylm->col(ia)));
             if(alf.n_cols != bf_ind.n_elem) {
               std::ostringstream oss;
               oss << "Mismatch! Have " << bf_ind.n_elem << " basis function indices but " << alf.n_cols << " basis functions!\n";
@@ -793,138 +841,483 @@ namespace helfem {
             bf_lapl.cols(ia*wrad.n_elem,(ia+1)*wrad.n_elem-1)=arma::trans(alf);
           }
         }
+
+        if(real_ylm)
+          form_real_bf();
+      }
+
+      void DFTGridWorker::form_real_bf() {
+        // Form the transformation; functions are ordered as iang*Nr + ir
+        arma::ivec mval(basp->get_mval());
+        size_t Nr=bf_ind.n_elem/mval.n_elem;
+        const double isq2=1.0/sqrt(2.0);
+        const std::complex<double> iu(0.0,1.0);
+        Ureal.zeros(bf_ind.n_elem,bf_ind.n_elem);
+        for(size_t iang=0;iang<mval.n_elem;iang++) {
+          int m=mval(iang);
+          double s=(std::abs(m)%2) ? -1.0 : 1.0;
+          size_t jang=ylm_partner(iang);
+          for(size_t ir=0;ir<Nr;ir++) {
+            size_t i=iang*Nr+ir;
+            size_t j=jang*Nr+ir;
+            if(m==0) {
+              Ureal(i,i)=1.0;
+            } else if(m>0) {
+              // sqrt(2) Re Y_lm
+              Ureal(i,i)=isq2;
+              Ureal(i,j)=s*isq2;
+            } else {
+              // sqrt(2) Im Y_l|m|
+              Ureal(i,j)=-iu*isq2;
+              Ureal(i,i)=iu*s*isq2;
+            }
+          }
+        }
+
+        // The result is real by construction
+        rbf=arma::real(Ureal*bf);
+        bf.clear();
+        if(do_grad) {
+          rbf_rho=arma::real(Ureal*bf_rho);
+          rbf_theta=arma::real(Ureal*bf_theta);
+          rbf_phi=arma::real(Ureal*bf_phi);
+          bf_rho.clear();
+          bf_theta.clear();
+          bf_phi.clear();
+        }
+        if(do_lapl) {
+          rbf_lapl=arma::real(Ureal*bf_lapl);
+          bf_lapl.clear();
+        }
+        use_real=true;
+      }
+
+      void DFTGridWorker::form_complex_bf() {
+        if(!use_real)
+          return;
+        arma::cx_mat Uinv(arma::trans(Ureal));
+        bf=Uinv*arma::conv_to<arma::cx_mat>::from(rbf);
+        rbf.clear();
+        if(do_grad) {
+          bf_rho=Uinv*arma::conv_to<arma::cx_mat>::from(rbf_rho);
+          bf_theta=Uinv*arma::conv_to<arma::cx_mat>::from(rbf_theta);
+          bf_phi=Uinv*arma::conv_to<arma::cx_mat>::from(rbf_phi);
+          rbf_rho.clear();
+          rbf_theta.clear();
+          rbf_phi.clear();
+        }
+        if(do_lapl) {
+          bf_lapl=Uinv*arma::conv_to<arma::cx_mat>::from(rbf_lapl);
+          rbf_lapl.clear();
+        }
+        use_real=false;
+      }
+
+      void DFTGridWorker::save_bf(bf_cache_t & c) const {
+        c.lang=lang;
+        c.mang=mang;
+        c.grad=do_grad;
+        c.lapl=do_lapl;
+        c.bf_ind=bf_ind;
+        c.wtot=wtot;
+        c.scale_r=scale_r;
+        c.scale_theta=scale_theta;
+        c.scale_phi=scale_phi;
+        c.real=use_real;
+        if(use_real) {
+          c.Ureal=Ureal;
+          c.rbf=rbf;
+          if(do_grad) {
+            c.rbf_rho=rbf_rho;
+            c.rbf_theta=rbf_theta;
+            c.rbf_phi=rbf_phi;
+          }
+          if(do_lapl)
+            c.rbf_lapl=rbf_lapl;
+          return;
+        }
+        c.bf=bf;
+        if(do_grad) {
+          c.bf_rho=bf_rho;
+          c.bf_theta=bf_theta;
+          c.bf_phi=bf_phi;
+        }
+        if(do_lapl)
+          c.bf_lapl=bf_lapl;
       }
 
-      DFTGrid::DFTGrid() {
+      void DFTGridWorker::load_bf(const bf_cache_t & c) {
+        bf_ind=c.bf_ind;
+        wtot=c.wtot;
+        scale_r=c.scale_r;
+        scale_theta=c.scale_theta;
+        scale_phi=c.scale_phi;
+        use_real=c.real;
+        if(use_real) {
+          Ureal=c.Ureal;
+          rbf=c.rbf;
+          if(do_grad) {
+            rbf_rho=c.rbf_rho;
+            rbf_theta=c.rbf_theta;
+            rbf_phi=c.rbf_phi;
+          }
+          if(do_lapl)
+            rbf_lapl=c.rbf_lapl;
+          return;
+        }
+        bf=c.bf;
+        if(do_grad) {
+          bf_rho=c.bf_rho;
+          bf_theta=c.bf_theta;
+          bf_phi=c.bf_phi;
+        }
+        if(do_lapl)
+          bf_lapl=c.bf_lapl;
       }
 
-      DFTGrid::DFTGrid(const helfem::atomic::basis::TwoDBasis * basp_, int lang_, int mang_) : basp(basp_), lang(lang_), mang(mang_) {
-        arma::vec cth, phi, wang;
-        helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
-        printf("DFT angular grid of order l=%i m=%i has %i points\n",lang,mang,(int) wang.n_elem);
+      /// Memory used by a cache entry
+      static size_t cache_memory(const bf_cache_t & c) {
+        size_t n=(c.wtot.n_elem+c.scale_r.n_elem+c.scale_theta.n_elem+c.scale_phi.n_elem)*sizeof(double);
+        n+=c.bf_ind.n_elem*sizeof(arma::uword);
+        n+=(c.bf.n_elem+c.bf_rho.n_elem+c.bf_theta.n_elem+c.bf_phi.n_elem+c.bf_lapl.n_elem+c.Ureal.n_elem)*sizeof(std::complex<double>);
+        n+=(c.rbf.n_elem+c.rbf_rho.n_elem+c.rbf_theta.n_elem+c.rbf_phi.n_elem+c.rbf_lapl.n_elem)*sizeof(double);
+        return n;
+      }
+
+      DFTGrid::DFTGrid() : cache_budget(0), cache_used(0), xc_batch(1), prune_thr(0.0), thread_timing(false) {
+      }
+
+      DFTGrid::DFTGrid(const helfem::atomic::basis::TwoDBasis * basp_, int lang_, int mang_) : basp(basp_), lang(lang_), mang(mang_), cache_budget(0), cache_used(0), xc_batch(1), prune_thr(0.0), thread_timing(false) {
+        printf("DFT angular grid of order l=%i m=%i has %i points\n",lang,mang,(int) helfem::angular::angular_rule(lang,mang).w.n_elem);
       }
 
       DFTGrid::~DFTGrid() {
       }
 
+      void DFTGrid::set_bf_cache(size_t budget) {
+        cache_budget=budget;
+        cache_used=0;
+        cache.clear();
+        if(cache_budget)
+          cache.resize(basp->get_rad_Nel());
+      }
+
+      void DFTGrid::set_xc_batch(size_t nbatch) {
+        xc_batch=std::max(nbatch,(size_t) 1);
+      }
+
+      void DFTGrid::set_thread_timing(bool timing) {
+        thread_timing=timing;
+      }
+
+      void DFTGrid::set_pruning(double thr) {
+        prune_thr=thr;
+      }
+
+      void DFTGrid::angular_order(size_t iel, const arma::mat & Pabs, int & l, int & m) const {
+        arma::ivec lval(basp->get_lval());
+        arma::ivec mval(arma::abs(basp->get_mval()));
+        arma::uvec idx(basp->bf_list(iel));
+        arma::vec bound(basp->bf_bound(iel));
+        const size_t Nr=idx.n_elem/lval.n_elem;
+
+        // Bounds for the density contributions of the blocks
+        arma::mat Pb(Pabs(idx,idx)%(bound*arma::trans(bound)));
+        const double pmax(Pb.max());
+
+        // Largest angular momenta in the significant part of the density
+        int Lrho=0, Mrho=0;
+        for(size_t ia=0;ia<lval.n_elem;ia++)
+          for(size_t ja=0;ja<lval.n_elem;ja++) {
+            if(lval(ia)+lval(ja)<=Lrho && mval(ia)+mval(ja)<=Mrho)
+              continue;
+            if(Pb.submat(ia*Nr,ja*Nr,(ia+1)*Nr-1,(ja+1)*Nr-1).max() > prune_thr*pmax) {
+              Lrho=std::max(Lrho,(int) (lval(ia)+lval(ja)));
+              Mrho=std::max(Mrho,(int) (mval(ia)+mval(ja)));
+            }
+          }
+
+        // Same rule as the default in the main program, with 2*lmax
+        // from the bra and ket and the rest from the density
+        l=std::min(lang,(int) (2*arma::max(lval)+Lrho+10));
+        m=std::min(mang,(int) (2*arma::max(mval)+Mrho+5));
+      }
+
+      void DFTGrid::print_pruning(size_t nang, size_t nel) const {
+        printf("Pruned angular grids have %.1f%% of the points of the full grid\n",100.0*nang/(nel*helfem::angular::angular_rule(lang,mang).w.n_elem));
+      }
+
+      double DFTGrid::density_bound(size_t iel, const arma::mat & Pabs) const {
+        // rho(r) = sum_uv P_uv chi_u(r) chi_v(r)^* <= sum_uv |P_uv| max|chi_u| max|chi_v|
+        arma::uvec idx(basp->bf_list(iel));
+        arma::vec bound(basp->bf_bound(iel));
+        return arma::as_scalar(arma::trans(bound)*Pabs(idx,idx)*bound);
+      }
+
+      void DFTGrid::compute_bf(DFTGridWorker & grid, size_t iel) {
+        bool grad, tau, lapl;
+        grid.get_grad_tau_lapl(grad,tau,lapl);
+        int l, m;
+        grid.get_angular_grid(l,m);
+
+        // Use the cached values if they have everything that is needed
+        if(iel<cache.size()) {
+          const bf_cache_t & c(cache[iel]);
+          if((c.bf.n_elem || c.rbf.n_elem) && c.lang==l && c.mang==m && (c.grad || !grad) && (c.lapl || !lapl)) {
+            grid.load_bf(c);
+            return;
+          }
+        }
+
+        grid.compute_bf(iel);
+        if(iel<cache.size()) {
+          // Store the values if they fit in the budget; otherwise they
+          // are recomputed on every call
+          bf_cache_t c;
+          grid.save_bf(c);
+          size_t mem(cache_memory(c));
+          size_t oldmem(cache_memory(cache[iel]));
+          bool store;
+#ifdef _OPENMP
+#pragma omp critical(atomic_bf_cache)
+#endif
+          {
+            store=(cache_used-oldmem+mem <= cache_budget);
+            if(store)
+              cache_used+=mem-oldmem;
+          }
+          if(store)
+            cache[iel]=c;
+        }
+      }
+
       void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, arma::mat & H, double & Exc, double & Nel, double & Ekin, double thr) {
         H.zeros(P.n_rows,P.n_rows);
 
-        double exc=0.0;
-        double ekin=0.0;
-        double nel=0.0;
-        double lapl=0;
+        // The functionals are only initialized when the settings change
+        XCFunctional::update(xfunc,x_func,false,x_pars,thr);
+        XCFunctional::update(cfunc,c_func,false,c_pars,thr);
+
+        const size_t Nrad(basp->get_rad_Nel());
+        // Contributions of each element, summed in a fixed order at the
+        // end so that the result does not depend on the threading
+        std::vector<double> el_exc(Nrad,0.0), el_ekin(Nrad,0.0), el_nel(Nrad,0.0), el_lapl(Nrad,0.0);
+
+        // Elements where the density is below the threshold don't contribute
+        arma::mat Pabs(arma::abs(P));
+        size_t nskip=0;
+        size_t nang=0;
+
+        // Element blocks are added into the full matrix concurrently
+        std::vector<arma::uvec> elidx(Nrad);
+        for(size_t iel=0;iel<Nrad;iel++)
+          elidx[iel]=basp->bf_list(iel);
+        BlockScatter scatter(elidx);
+
+        // Busy time of each thread
+        std::vector<double> tthr;
+        if(thread_timing) {
+#ifdef _OPENMP
+          tthr.assign(omp_get_max_threads(),0.0);
+#else
+          tthr.assign(1,0.0);
+#endif
+        }
 #ifdef _OPENMP
-#pragma omp parallel reduction(+:exc,nel,lapl)
+#pragma omp parallel reduction(+:nskip,nang)
 #endif
         {
-          DFTGridWorker grid(basp,lang,mang);
-          grid.check_grad_tau_lapl(x_func,c_func);
-
+          // One worker per element in the batch
+          std::vector<DFTGridWorker> grid(xc_batch,DFTGridWorker(basp,lang,mang));
+          for(size_t i=0;i<grid.size();i++)
+            grid[i].check_grad_tau_lapl(x_func,c_func);
+          std::vector<DFTGridWorker *> batch;
+          std::vector<size_t> batch_el;
+          double tbusy=0.0;
+
+          // The cost per element is uneven, so the elements are handed
+          // out dynamically. The element blocks are scattered into the
+          // shared matrix, so all the elements can be done in one pass.
+          std::vector<arma::mat> Hel(xc_batch);
+          const size_t nbatch((Nrad+xc_batch-1)/xc_batch);
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
-          for(size_t iel=0;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
-            grid.update_density(P);
-            nel+=grid.compute_Nel();
-            ekin+=grid.compute_Ekin();
-            lapl+=grid.compute_laplsum();
+          for(size_t ib=0;ib<nbatch;ib++) {
+            Timer tb;
+            batch.clear();
+            batch_el.clear();
+            for(size_t ie=ib*xc_batch;ie<std::min((ib+1)*xc_batch,Nrad);ie++) {
+              if(density_bound(ie,Pabs)<thr) {
+                nskip++;
+                continue;
+              }
+              DFTGridWorker & w(grid[batch.size()]);
+              if(prune_thr>0.0) {
+                int l, m;
+                angular_order(ie,Pabs,l,m);
+                w.set_angular_grid(l,m);
+              }
+              compute_bf(w,ie);
+              nang+=w.get_nang();
+              w.update_density(P);
+              el_nel[ie]=w.compute_Nel();
+              el_ekin[ie]=w.compute_Ekin();
+              el_lapl[ie]=w.compute_laplsum();
+              w.init_xc();
+              batch.push_back(&w);
+              batch_el.push_back(ie);
+            }
 
-            grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func, x_pars, thr);
-            if(c_func>0)
-              grid.compute_xc(c_func, c_pars, thr);
+            if(xfunc)
+              DFTGridWorker::compute_xc(batch, *xfunc);
+            if(cfunc)
+              DFTGridWorker::compute_xc(batch, *cfunc);
 
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(H);
+            for(size_t i=0;i<batch.size();i++) {
+              el_exc[batch_el[i]]=batch[i]->eval_Exc();
+              batch[i]->eval_Fxc_block(Hel[i]);
+              scatter.add(H,Hel[i],batch_el[i]);
+            }
+            tbusy+=tb.get();
           }
+
+          if(thread_timing) {
 #ifdef _OPENMP
-#pragma omp for
+            tthr[omp_get_thread_num()]=tbusy;
+#else
+            tthr[0]=tbusy;
 #endif
-          for(size_t iel=1;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
-            grid.update_density(P);
-            nel+=grid.compute_Nel();
-            ekin+=grid.compute_Ekin();
-            lapl+=grid.compute_laplsum();
-
-            grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func, x_pars, thr);
-            if(c_func>0)
-              grid.compute_xc(c_func, c_pars, thr);
-
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(H);
           }
         }
+        if(thread_timing)
+          print_thread_load(tthr);
 
         // Save outputs
-        Exc=exc;
-        Ekin=ekin;
-        Nel=nel;
-
-        printf("Integral over laplacian %e\n",lapl);
+        Exc=threading::pairwise_sum(el_exc);
+        Ekin=threading::pairwise_sum(el_ekin);
+        Nel=threading::pairwise_sum(el_nel);
+
+        printf("Integral over laplacian %e\n",threading::pairwise_sum(el_lapl));
+        if(nskip)
+          printf("Skipped %i of %i radial elements below the density threshold\n",(int) nskip,(int) Nrad);
+        if(prune_thr>0.0 && Nrad>nskip)
+          print_pruning(nang,Nrad-nskip);
       }
 
       void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & Pa, const arma::mat & Pb, arma::mat & Ha, arma::mat & Hb, double & Exc, double & Nel, double & Ekin, bool beta, double thr) {
         Ha.zeros(Pa.n_rows,Pa.n_rows);
         Hb.zeros(Pb.n_rows,Pb.n_rows);
 
-        double exc=0.0;
-        double nel=0.0;
-        double ekin=0.0;
+        // The functionals are only initialized when the settings change
+        XCFunctional::update(xfunc,x_func,true,x_pars,thr);
+        XCFunctional::update(cfunc,c_func,true,c_pars,thr);
+
+        const size_t Nrad(basp->get_rad_Nel());
+        // Contributions of each element, summed in a fixed order at the
+        // end so that the result does not depend on the threading
+        std::vector<double> el_exc(Nrad,0.0), el_ekin(Nrad,0.0), el_nel(Nrad,0.0);
+
+        // Elements where the density is below the threshold don't contribute
+        arma::mat Pabs(arma::abs(Pa)+arma::abs(Pb));
+        size_t nskip=0;
+        size_t nang=0;
+
+        // Element blocks are added into the full matrix concurrently
+        std::vector<arma::uvec> elidx(Nrad);
+        for(size_t iel=0;iel<Nrad;iel++)
+          elidx[iel]=basp->bf_list(iel);
+        BlockScatter scatter(elidx);
+
+        // Busy time of each thread
+        std::vector<double> tthr;
+        if(thread_timing) {
+#ifdef _OPENMP
+          tthr.assign(omp_get_max_threads(),0.0);
+#else
+          tthr.assign(1,0.0);
+#endif
+        }
 #ifdef _OPENMP
-#pragma omp parallel reduction(+:exc,nel)
+#pragma omp parallel reduction(+:nskip,nang)
 #endif
         {
-          DFTGridWorker grid(basp,lang,mang);
-          grid.check_grad_tau_lapl(x_func,c_func);
-
+          // One worker per element in the batch
+          std::vector<DFTGridWorker> grid(xc_batch,DFTGridWorker(basp,lang,mang));
+          for(size_t i=0;i<grid.size();i++)
+            grid[i].check_grad_tau_lapl(x_func,c_func);
+          std::vector<DFTGridWorker *> batch;
+          std::vector<size_t> batch_el;
+          double tbusy=0.0;
+
+          // The cost per element is uneven, so the elements are handed
+          // out dynamically. The element blocks are scattered into the
+          // shared matrix, so all the elements can be done in one pass.
+          std::vector<arma::mat> Hel(xc_batch), Hbel(xc_batch);
+          const size_t nbatch((Nrad+xc_batch-1)/xc_batch);
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
-          for(size_t iel=0;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
-            grid.update_density(Pa,Pb);
-            nel+=grid.compute_Nel();
-            ekin+=grid.compute_Ekin();
-
-            grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func, x_pars, thr);
-            if(c_func>0)
-              grid.compute_xc(c_func, c_pars, thr);
+          for(size_t ib=0;ib<nbatch;ib++) {
+            Timer tb;
+            batch.clear();
+            batch_el.clear();
+            for(size_t ie=ib*xc_batch;ie<std::min((ib+1)*xc_batch,Nrad);ie++) {
+              if(density_bound(ie,Pabs)<thr) {
+                nskip++;
+                continue;
+              }
+              DFTGridWorker & w(grid[batch.size()]);
+              if(prune_thr>0.0) {
+                int l, m;
+                angular_order(ie,Pabs,l,m);
+                w.set_angular_grid(l,m);
+              }
+              compute_bf(w,ie);
+              nang+=w.get_nang();
+              w.update_density(Pa,Pb);
+              el_nel[ie]=w.compute_Nel();
+              el_ekin[ie]=w.compute_Ekin();
+              w.init_xc();
+              batch.push_back(&w);
+              batch_el.push_back(ie);
+            }
 
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(Ha,Hb,beta);
+            if(xfunc)
+              DFTGridWorker::compute_xc(batch, *xfunc);
+            if(cfunc)
+              DFTGridWorker::compute_xc(batch, *cfunc);
+
+            for(size_t i=0;i<batch.size();i++) {
+              el_exc[batch_el[i]]=batch[i]->eval_Exc();
+              batch[i]->eval_Fxc_block(Hel[i],Hbel[i],beta);
+              scatter.add(Ha,Hel[i],batch_el[i]);
+              if(beta)
+                scatter.add(Hb,Hbel[i],batch_el[i]);
+            }
+            tbusy+=tb.get();
           }
+
+          if(thread_timing) {
 #ifdef _OPENMP
-#pragma omp for
+            tthr[omp_get_thread_num()]=tbusy;
+#else
+            tthr[0]=tbusy;
 #endif
-          for(size_t iel=1;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
-            grid.update_density(Pa,Pb);
-            nel+=grid.compute_Nel();
-            ekin+=grid.compute_Ekin();
-
-            grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func, x_pars, thr);
-            if(c_func>0)
-              grid.compute_xc(c_func, c_pars, thr);
-
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(Ha,Hb,beta);
           }
         }
+        if(thread_timing)
+          print_thread_load(tthr);
 
         // Save outputs
-        Exc=exc;
-        Ekin=ekin;
-        Nel=nel;
+        Exc=threading::pairwise_sum(el_exc);
+        Ekin=threading::pairwise_sum(el_ekin);
+        Nel=threading::pairwise_sum(el_nel);
+
+        if(nskip)
+          printf("Skipped %i of %i radial elements below the density threshold\n",(int) nskip,(int) Nrad);
+        if(prune_thr>0.0 && Nrad>nskip)
+          print_pruning(nang,Nrad-nskip);
       }
 
       arma::mat DFTGrid::eval_overlap() {
@@ -939,17 +1332,17 @@ namespace helfem {
           grid.set_grad_tau_lapl(false,false,false);
 
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
           for(size_t iel=0;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
+            compute_bf(grid,iel);
             grid.eval_overlap(S);
           }
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
           for(size_t iel=1;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
+            compute_bf(grid,iel);
             grid.eval_overlap(S);
           }
         }
@@ -969,17 +1362,17 @@ namespace helfem {
           grid.set_grad_tau_lapl(true,false,false);
 
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
           for(size_t iel=0;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
+            compute_bf(grid,iel);
             grid.eval_kinetic(T);
           }
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
           for(size_t iel=1;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
+            compute_bf(grid,iel);
             grid.eval_kinetic(T);
           }
         }
@@ -18,19 +18,49 @@
 #define ATOMIC_DFTGRID_H
 
 #include "basis.h"
+#include "../general/angular.h"
+#include "../general/dftfuncs.h"
 
 namespace helfem {
   namespace atomic {
     namespace dftgrid {
 
+      /// Basis function values in an element, cached between Fock builds
+      typedef struct {
+        /// Angular rule the values were computed on
+        int lang, mang;
+        /// Are the gradients included?
+        bool grad;
+        /// Are the laplacians included?
+        bool lapl;
+        /// List of basis functions in element
+        arma::uvec bf_ind;
+        /// Total quadrature weight
+        arma::rowvec wtot;
+        /// Scale factors
+        arma::rowvec scale_r, scale_theta, scale_phi;
+        /// Function values, gradients and laplacians
+        arma::cx_mat bf, bf_rho, bf_theta, bf_phi, bf_lapl;
+        /// Are the values stored in the real spherical harmonics basis?
+        bool real;
+        /// Complex to real transformation in the element
+        arma::cx_mat Ureal;
+        /// Function values, gradients and laplacians in the real basis
+        arma::mat rbf, rbf_rho, rbf_theta, rbf_phi, rbf_lapl;
+      } bf_cache_t;
+
       /// Worker class
       class DFTGridWorker {
       protected:
         /// Basis set
         const helfem::atomic::basis::TwoDBasis *basp;
 
-        /// Angular grid
-        arma::vec cth, phi, wang;
+        /// Angular rule
+        int lang, mang;
+        /// Angular grid, shared by all workers
+        const helfem::angular::angular_rule_t * angrule;
+        /// Spherical harmonics on the angular grid, shared by all workers
+        const arma::cx_mat * ylm;
         /// Total quadrature weight
         arma::rowvec wtot;
 
@@ -50,11 +80,30 @@ namespace helfem {
         /// Values of laplacians in grid points, (3*Nbf) * Ngrid
         arma::cx_mat bf_lapl;
 
-        /// Density helper matrices: P_{uv} chi_v, and P_{uv} nabla(chi_v)
-        arma::cx_mat Pv, Pv_rho, Pv_theta, Pv_phi;
-        /// Same for spin-polarized
-        arma::cx_mat Pav, Pav_rho, Pav_theta, Pav_phi;
-        arma::cx_mat Pbv, Pbv_rho, Pbv_theta, Pbv_phi;
+        /// Does every (l,m) in the basis have a (l,-m) partner?
+        bool real_ylm;
+        /// Partner (l,-m) of each angular function
+        arma::uvec ylm_partner;
+        /// Are the functions currently stored in the real basis?
+        bool use_real;
+        /// Complex to real spherical harmonics transformation in the element
+        arma::cx_mat Ureal;
+        /// Function values and derivatives in the real spherical harmonics basis
+        arma::mat rbf, rbf_rho, rbf_theta, rbf_phi, rbf_lapl;
+
+        /// Transform the functions into the real basis
+        void form_real_bf();
+        /// Transform the functions back into the complex basis
+        void form_complex_bf();
+        /// Transform density matrix into the real basis; returns false if it is not real there
+        bool real_density(const arma::mat & P, arma::mat & Pr) const;
+
+        /// Density evaluation kernels
+        template<typename T> void density_wrk(const arma::Mat<T> & P, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl);
+        template<typename T> void density_wrk(const arma::Mat<T> & Pa, const arma::Mat<T> & Pb, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl);
+        /// Fock matrix kernels
+        template<typename T> void Fxc_wrk(arma::mat & H, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) const;
+        template<typename T> void Fxc_wrk(arma::mat & Ha, arma::mat & Hb, bool beta, const arma::Mat<T> & f, const arma::Mat<T> & f_rho, const arma::Mat<T> & f_theta, const arma::Mat<T> & f_phi, const arma::Mat<T> & f_lapl) const;
 
         /// Is gradient needed?
         bool do_grad;
@@ -117,9 +166,19 @@ namespace helfem {
         void get_grad_tau_lapl(bool & grad, bool & tau, bool & lapl) const;
         /// Set necessity of computing gradient and laplacians, necessary for compute_bf!
         void set_grad_tau_lapl(bool grad, bool tau, bool lapl);
+        /// Change the angular rule, necessary for compute_bf!
+        void set_angular_grid(int lang, int mang);
+        /// Get the angular rule
+        void get_angular_grid(int & lang, int & mang) const;
+        /// Get the number of angular points
+        size_t get_nang() const;
 
         /// Compute basis functions on grid points
         void compute_bf(size_t iel);
+        /// Store basis functions in cache entry
+        void save_bf(bf_cache_t & c) const;
+        /// Load basis functions from cache entry
+        void load_bf(const bf_cache_t & c);
         /// Free memory
         void free();
 
@@ -141,6 +200,10 @@ namespace helfem {
         /// array. thr is density screening value. Pot toggles
         /// evaluation of potential
         void compute_xc(int func_id, const arma::vec & params, double thr, bool pot=true);
+        /// Same, with an already initialized functional
+        void compute_xc(const XCFunctional & func, bool pot=true);
+        /// Same, but with a single libxc call over the points of all workers in the batch
+        static void compute_xc(const std::vector<DFTGridWorker *> & batch, const XCFunctional & func, bool pot=true);
         /// Evaluate exchange/correlation energy
         double eval_Exc() const;
         /// Zero out energy
@@ -157,6 +220,10 @@ namespace helfem {
         void eval_Fxc(arma::mat & H) const;
         /// Evaluate Fock matrix, unrestricted calculation
         void eval_Fxc(arma::mat & Ha, arma::mat & Hb, bool beta=true) const;
+        /// Evaluate the element block of the Fock matrix, restricted calculation
+        void eval_Fxc_block(arma::mat & H) const;
+        /// Evaluate the element blocks of the Fock matrix, unrestricted calculation
+        void eval_Fxc_block(arma::mat & Ha, arma::mat & Hb, bool beta=true) const;
       };
 
       /// Wrapper routine
@@ -167,6 +234,29 @@ namespace helfem {
         /// Angular rule
         int lang, mang;
 
+        /// Memory budget of the basis function cache in bytes
+        size_t cache_budget;
+        /// Memory used by the basis function cache
+        size_t cache_used;
+        /// Cached basis functions in each element
+        std::vector<bf_cache_t> cache;
+        /// Number of elements whose points are passed to libxc together
+        size_t xc_batch;
+        /// Relative threshold for angular pruning, 0 to use the full rule everywhere
+        double prune_thr;
+        /// Print per-thread busy times of the XC quadrature?
+        bool thread_timing;
+        /// Exchange and correlation functionals, kept between calls
+        std::shared_ptr<const XCFunctional> xfunc, cfunc;
+        /// Pruned angular rule for element from the angular content of the density
+        void angular_order(size_t iel, const arma::mat & Pabs, int & l, int & m) const;
+        /// Print statistics on the pruned grid
+        void print_pruning(size_t nang, size_t nel) const;
+        /// Compute basis functions in element, or get them from the cache
+        void compute_bf(DFTGridWorker & grid, size_t iel);
+        /// Upper bound for the density in element, given the absolute values of the expanded density matrix
+        double density_bound(size_t iel, const arma::mat & Pabs) const;
+
       public:
         /// Dummy constructor
         DFTGrid();
@@ -175,6 +265,15 @@ namespace helfem {
         /// Destructor
         ~DFTGrid();
 
+        /// Cache basis function values between calls, up to the given memory in bytes; 0 disables the cache
+        void set_bf_cache(size_t budget);
+        /// Evaluate the functional over the points of this many elements at a time
+        void set_xc_batch(size_t nbatch);
+        /// Prune the angular rule in each element, dropping density matrix blocks below thr relative to the largest one
+        void set_pruning(double thr);
+        /// Toggle printout of per-thread busy times in the XC quadrature
+        void set_thread_timing(bool timing);
+
         /// Compute Fock matrix, exchange-correlation energy and integrated electron density, restricted case
         void eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, arma::mat & H, double & Exc, double & Nel, double & Ekin, double thr);
         /// Compute Fock matrix, exchange-correlation energy and integrated electron density, unrestricted case
@@ -207,6 +306,67 @@ namespace helfem {
         H+=arma::real(fhlp*arma::trans(f));
       }
 
+      /**
+       * Fused quadrature of all terms of the Fock matrix, H += S + S^T with
+       *   S = Re[ (vrho/2 f + sum_c gn_c f_c + vl l) f^H + sum_c (vt_c/2 f_c) f_c^H ],
+       * which needs one product for LDA and GGA and three more for
+       * meta-GGA. gn (Np x 3), vt (3 x Np) and vl (Np) may be empty.
+       */
+      template<typename T> void increment_fock(arma::mat & H, const arma::rowvec & vrho, const arma::mat & gn, const arma::mat & vt, const arma::rowvec & vl, const arma::Mat<T> & f, const arma::Mat<T> & f_x, const arma::Mat<T> & f_y, const arma::Mat<T> & f_z, const arma::Mat<T> & l) {
+        if(f.n_cols != vrho.n_elem) {
+          std::ostringstream oss;
+          oss << "Number of functions " << f.n_cols << " and potential values " << vrho.n_elem << " do not match!\n";
+          throw std::runtime_error(oss.str());
+        }
+        if(H.n_rows != f.n_rows || H.n_cols != f.n_rows) {
+          std::ostringstream oss;
+          oss << "Size of basis function (" << f.n_rows << "," << f.n_cols << ") and Fock matrix (" << H.n_rows << "," << H.n_cols << ") doesn't match!\n";
+          throw std::runtime_error(oss.str());
+        }
+        if((gn.n_elem || vt.n_elem) && (f.n_rows != f_x.n_rows || f.n_cols != f_x.n_cols || f.n_rows != f_y.n_rows || f.n_cols != f_y.n_cols || f.n_rows != f_z.n_rows || f.n_cols != f_z.n_cols)) {
+          throw std::runtime_error("Sizes of basis function and derivative matrices doesn't match!\n");
+        }
+        if(vl.n_elem && (l.n_rows != f.n_rows || l.n_cols != f.n_cols)) {
+          throw std::runtime_error("Sizes of basis function and Laplacian matrices doesn't match!\n");
+        }
+
+        // Scaled functions that multiply f^H
+        arma::Mat<T> g(f.n_rows,f.n_cols);
+        for(size_t j=0;j<f.n_cols;j++) {
+          const double w=0.5*vrho(j);
+          for(size_t i=0;i<f.n_rows;i++)
+            g(i,j)=w*f(i,j);
+        }
+        if(gn.n_elem) {
+          for(size_t j=0;j<f.n_cols;j++) {
+            const double gx=gn(j,0), gy=gn(j,1), gz=gn(j,2);
+            for(size_t i=0;i<f.n_rows;i++)
+              g(i,j)+=gx*f_x(i,j)+gy*f_y(i,j)+gz*f_z(i,j);
+          }
+        }
+        if(vl.n_elem) {
+          for(size_t j=0;j<f.n_cols;j++)
+            for(size_t i=0;i<f.n_rows;i++)
+              g(i,j)+=vl(j)*l(i,j);
+        }
+        arma::mat S(arma::real(g*arma::trans(f)));
+
+        if(vt.n_elem) {
+          const arma::Mat<T> * fc[3]={&f_x, &f_y, &f_z};
+          for(int c=0;c<3;c++) {
+            const arma::Mat<T> & fx(*fc[c]);
+            for(size_t j=0;j<fx.n_cols;j++) {
+              const double w=0.5*vt(c,j);
+              for(size_t i=0;i<fx.n_rows;i++)
+                g(i,j)=w*fx(i,j);
+            }
+            S+=arma::real(g*arma::trans(fx));
+          }
+        }
+
+        H+=S+arma::trans(S);
+      }
+
       /// BLAS routine for GGA-type quadrature
       template<typename T> void increment_gga(arma::mat & H, const arma::mat & gn, const arma::Mat<T> & f, arma::Mat<T> f_x, arma::Mat<T> f_y, arma::Mat<T> f_z) {
         if(gn.n_cols!=3) {
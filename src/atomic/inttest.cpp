@@ -18,10 +18,31 @@
 #include "chebyshev.h"
 #include "lobatto.h"
 #include "LIPBasis.h"
+#include "basis.h"
+#include "../general/cmdline.h"
+#include "../general/timer.h"
+#include "../general/scf_helpers.h"
 
 using namespace helfem;
 
-void run(double R, int n_quad) {
+/// Result of the integral test for one basis
+typedef struct {
+  /// Parameters of the basis
+  int primbas, nnodes, nelem, lmax;
+  /// Number of basis functions
+  size_t nbf;
+  /// Errors of the overlap, kinetic, nuclear attraction, Coulomb and exchange matrices wrt the reference quadrature
+  double dS, dT, dV, dJ, dK;
+  /// Error in the hydrogenic ground state energy
+  double dE;
+  /// Self-interaction error tr P(J-K)/2 of the one-electron density
+  double dSIE;
+  /// Time taken by the one-electron matrices, the two-electron integrals, J and K
+  double t1e, ttei, tJ, tK;
+} itest_t;
+
+/// Error in the TEIs of two linear elements wrt the analytical values
+double analytical_test(double R, int n_quad) {
   // Basis functions on [0, R]: x/R, (R-x)/R.
 
   // Get primitive polynomial representation for LIP
@@ -46,10 +67,6 @@ void run(double R, int n_quad) {
   teiishould.col(2)=teiishould.col(1);
   teiishould.col(3)=arma::square(r)/(3.0*R*R);
 
-  r.save("r.dat",arma::raw_ascii);
-  teiinner.save("teii_q.dat",arma::raw_ascii);
-  teiishould.save("teii.dat",arma::raw_ascii);
-
   teiishould-=teiinner;
   printf("Error in inner integral is %e\n",arma::norm(teiishould,"fro"));
 
@@ -97,20 +114,127 @@ void run(double R, int n_quad) {
   // Symmetrization and coefficient
   tei=4.0*M_PI*(tei+tei.t())*R;
 
-  tei.print("Analytical");
-  teiq.print("Quadrature");
   teiq-=tei;
-  teiq.print("Difference");
+  printf("Error in two-electron integral is %e\n",arma::norm(teiq,"fro"));
+  return arma::norm(teiq,"fro");
+}
+
+/// Basis set for the given parameters
+static atomic::basis::TwoDBasis get_basis(int Z, int primbas, int nnodes, int nelem, int lmax, double Rmax, int nquad) {
+  auto poly(std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(primbas,nnodes)));
+  arma::vec bval(atomic::basis::form_grid(modelpotential::POINT_NUCLEUS, 0.0, nelem, Rmax, 4, 2.0, 0, 4, 2.0, Z, 0, 0, 0.0));
+  arma::ivec lval, mval;
+  atomic::basis::angular_basis(lmax,lmax,lval,mval);
+  return atomic::basis::TwoDBasis(Z, modelpotential::POINT_NUCLEUS, 0.0, poly, false, nquad, bval, poly->get_nprim()-1, lval, mval, 0, 0, 0.0);
+}
+
+/// Test the integrals of a single basis against a reference with a denser quadrature
+static itest_t run_basis(int Z, int primbas, int nnodes, int nelem, int lmax, double Rmax, int refquad) {
+  itest_t r;
+  r.primbas=primbas;
+  r.nnodes=nnodes;
+  r.nelem=nelem;
+  r.lmax=lmax;
+
+  Timer t;
+  int nquad(5*nnodes);
+  atomic::basis::TwoDBasis basis(get_basis(Z,primbas,nnodes,nelem,lmax,Rmax,nquad));
+  atomic::basis::TwoDBasis ref(get_basis(Z,primbas,nnodes,nelem,lmax,Rmax,refquad*nquad));
+  r.nbf=basis.Nbf();
+
+  // One-electron integrals
+  t.set();
+  arma::mat S(basis.overlap());
+  arma::mat T(basis.kinetic());
+  arma::mat V(basis.nuclear());
+  r.t1e=t.get();
+  arma::mat Sref(ref.overlap());
+  arma::mat Tref(ref.kinetic());
+  arma::mat Vref(ref.nuclear());
+  r.dS=arma::abs(S-Sref).max();
+  r.dT=arma::abs(T-Tref).max();
+  r.dV=arma::abs(V-Vref).max();
+
+  // Hydrogenic ground state
+  arma::mat Sinvh(basis.Sinvh(true,0));
+  arma::vec E;
+  arma::mat C;
+  scf::eig_gsym(E,C,T+V,Sinvh);
+  r.dE=E(0)+0.5*Z*Z;
+
+  // Two-electron integrals
+  t.set();
+  basis.compute_tei(true);
+  r.ttei=t.get();
+  ref.compute_tei(true);
+
+  // Test density is the hydrogenic ground state
+  arma::mat P(scf::form_density(C,1));
+  t.set();
+  arma::mat J(basis.coulomb(P));
+  r.tJ=t.get();
+  t.set();
+  arma::mat K(basis.exchange(P));
+  r.tK=t.get();
+  r.dJ=arma::abs(J-ref.coulomb(P)).max();
+  r.dK=arma::abs(K-ref.exchange(P)).max();
+  // Exchange cancels Coulomb for a single electron; K is returned with the negative sign
+  r.dSIE=0.5*arma::trace(P*(J+K));
+
+  printf("%7i %6i %5i %4i %6i % 9.2e % 9.2e % 9.2e % 9.2e % 9.2e % 9.2e % 9.2e %9.3f %9.3f %9.3f %9.3f\n",r.primbas,r.nnodes,r.nelem,r.lmax,(int) r.nbf,r.dS,r.dT,r.dV,r.dJ,r.dK,r.dE,r.dSIE,r.t1e,r.ttei,r.tJ,r.tK);
+  fflush(stdout);
+  return r;
 }
 
 int main(int argc, char **argv) {
-  if(argc!=3) {
-    printf("Usage: %s nquad R\n",argv[0]);
-    return 1;
+  cmdline::parser parser;
+  parser.add<int>("nquad", 0, "quadrature points in the analytical test of two linear elements", false, 10);
+  parser.add<double>("R", 0, "element length in the analytical test", false, 1.0);
+  parser.add<std::string>("primbas", 0, "list of primitive radial bases", false, "4");
+  parser.add<std::string>("nnodes", 0, "list of numbers of nodes per element", false, "6,10,15");
+  parser.add<std::string>("nelem", 0, "list of numbers of radial elements", false, "5,10");
+  parser.add<std::string>("lmax", 0, "list of maximal angular momenta", false, "0,2");
+  parser.add<int>("Z", 0, "nuclear charge", false, 1);
+  parser.add<double>("Rmax", 0, "practical infinity in au", false, 40.0);
+  parser.add<int>("refquad", 0, "factor by which the reference quadrature is denser", false, 4);
+  parser.add<std::string>("output", 0, "output file for the results", false, "atomic_itest.csv");
+  parser.parse_check(argc, argv);
+
+  analytical_test(parser.get<double>("R"),parser.get<int>("nquad"));
+
+  arma::vec primbas(scf::parse_list(parser.get<std::string>("primbas")));
+  arma::vec nnodes(scf::parse_list(parser.get<std::string>("nnodes")));
+  arma::vec nelem(scf::parse_list(parser.get<std::string>("nelem")));
+  arma::vec lmax(scf::parse_list(parser.get<std::string>("lmax")));
+  int Z(parser.get<int>("Z"));
+  double Rmax(parser.get<double>("Rmax"));
+  int refquad(parser.get<int>("refquad"));
+  std::string output(parser.get<std::string>("output"));
+
+  printf("\nErrors wrt %i times denser quadrature, hydrogenic energy and self-interaction errors, and timings in seconds\n",refquad);
+  printf("%7s %6s %5s %4s %6s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n","primbas","nnodes","nelem","lmax","Nbf","dS","dT","dV","dJ","dK","dE","SIE","t(1e)","t(tei)","t(J)","t(K)");
+  std::vector<itest_t> results;
+  for(size_t ip=0;ip<primbas.n_elem;ip++)
+    for(size_t in=0;in<nnodes.n_elem;in++)
+      for(size_t ie=0;ie<nelem.n_elem;ie++)
+        for(size_t il=0;il<lmax.n_elem;il++) {
+          try {
+            results.push_back(run_basis(Z,(int) primbas(ip),(int) nnodes(in),(int) nelem(ie),(int) lmax(il),Rmax,refquad));
+          } catch(std::exception & e) {
+            printf("primbas=%i nnodes=%i nelem=%i lmax=%i failed: %s",(int) primbas(ip),(int) nnodes(in),(int) nelem(ie),(int) lmax(il),e.what());
+          }
+        }
+
+  FILE *out=fopen(output.c_str(),"w");
+  if(!out)
+    throw std::runtime_error("Error opening output " + output + "\n");
+  fprintf(out,"primbas,nnodes,nelem,lmax,nbf,dS,dT,dV,dJ,dK,dE,SIE,t1e,ttei,tJ,tK\n");
+  for(size_t i=0;i<results.size();i++) {
+    const itest_t & r(results[i]);
+    fprintf(out,"%i,%i,%i,%i,%zu,%.9e,%.9e,%.9e,%.9e,%.9e,%.9e,%.9e,%.6e,%.6e,%.6e,%.6e\n",r.primbas,r.nnodes,r.nelem,r.lmax,r.nbf,r.dS,r.dT,r.dV,r.dJ,r.dK,r.dE,r.dSIE,r.t1e,r.ttei,r.tJ,r.tK);
   }
+  fclose(out);
+  printf("\nResults written to %s\n",output.c_str());
 
-  int nquad(atoi(argv[1]));
-  double R(atof(argv[2]));
-  run(R,nquad);
   return 0;
 }
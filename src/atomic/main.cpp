@@ -15,18 +15,75 @@
  */
 #include "../general/cmdline.h"
 #include "../general/checkpoint.h"
+#include "../general/checkpoint_writer.h"
 #include "../general/constants.h"
 #include "../general/diis.h"
+#include "../general/lbfgs.h"
 #include "../general/dftfuncs.h"
 #include "../general/elements.h"
 #include "../general/timer.h"
+#include "../general/profiler.h"
+#include "../general/threading.h"
+#include "../general/memory_plan.h"
 #include "../general/scf_helpers.h"
 #include "basis.h"
+#include "utils.h"
 #include "dftgrid.h"
 #include <cfloat>
+#include <iomanip>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace helfem;
 
+/**
+ * Run the calculation in a coarse basis as a separate process, with
+ * the same settings except for the basis size, saving the result to
+ * the given checkpoint for use as a guess.
+ */
+void run_coarse_stage(int argc, char **argv, const std::vector<std::string> & replace, const std::vector<std::string> & extra) {
+  // Drop the options that are replaced, in both the --name=value and
+  // the --name value forms
+  std::vector<std::string> args;
+  args.push_back(argv[0]);
+  for(int i=1;i<argc;i++) {
+    std::string arg(argv[i]);
+    bool drop=false, takes_next=false;
+    for(size_t j=0;j<replace.size();j++) {
+      const std::string name("--"+replace[j]);
+      if(arg==name) {
+        drop=true;
+        takes_next=true;
+      } else if(arg.compare(0,name.size()+1,name+"=")==0)
+        drop=true;
+    }
+    if(!drop)
+      args.push_back(arg);
+    else if(takes_next)
+      i++;
+  }
+  args.insert(args.end(),extra.begin(),extra.end());
+
+  std::vector<char *> cargs;
+  for(size_t i=0;i<args.size();i++)
+    cargs.push_back(const_cast<char *>(args[i].c_str()));
+  cargs.push_back(NULL);
+
+  fflush(stdout);
+  pid_t pid(fork());
+  if(pid<0)
+    throw std::runtime_error("Could not fork the coarse basis calculation.\n");
+  if(pid==0) {
+    execv("/proc/self/exe",cargs.data());
+    execvp(argv[0],cargs.data());
+    _exit(127);
+  }
+  int status;
+  if(waitpid(pid,&status,0)<0 || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+    throw std::runtime_error("The coarse basis calculation failed.\n");
+}
+
 void classify_orbitals(const arma::mat & C, const arma::ivec & lvals, const arma::ivec & mvals, const std::vector<arma::uvec> & lmidx) {
   for(size_t io=0;io<C.n_cols;io++) {
     arma::vec orb(C.col(io));
@@ -56,6 +113,27 @@ void normalize_matrix(arma::mat & M, const arma::vec & norm) {
       M(i,j)*=norm(i)*norm(j);
 }
 
+/// Parse a list of charge and spin states of the form Q:M,Q:M,...
+std::vector< std::pair<int,int> > parse_states(const std::string & str) {
+  std::vector< std::pair<int,int> > states;
+  std::istringstream iss(str);
+  std::string entry;
+  while(std::getline(iss,entry,',')) {
+    if(entry.find_first_not_of(" ")==std::string::npos)
+      continue;
+    int Q, M;
+    char sep;
+    std::istringstream ess(entry);
+    if(!(ess >> Q >> sep >> M) || sep!=':') {
+      std::ostringstream oss;
+      oss << "Invalid state \"" << entry << "\", should be of the form Q:M!\n";
+      throw std::logic_error(oss.str());
+    }
+    states.push_back(std::make_pair(Q,M));
+  }
+  return states;
+}
+
 int main(int argc, char **argv) {
   cmdline::parser parser;
 
@@ -79,8 +157,12 @@ int main(int argc, char **argv) {
   parser.add<int>("nelem", 0, "number of elements", true);
   parser.add<int>("nelem0", 0, "number of elements between center and off-center nuclei", false, 0);
   parser.add<int>("nnodes", 0, "number of nodes per element", false, 15);
+  parser.add<std::string>("nnodes_list", 0, "number of nodes in each element from the nucleus outwards, at most nnodes; the last value is used for the remaining elements", false, "");
   parser.add<int>("nquad", 0, "number of quadrature points", false, 0);
   parser.add<int>("maxit", 0, "maximum number of iterations", false, 50);
+  parser.add<double>("sp_thr", 0, "DIIS error below which single precision integrals are replaced by double precision ones, 0 for double precision throughout", false, 0.0);
+  parser.add<int>("incfock", 0, "incremental Fock builds: full rebuild every incfock iterations, 0 for full builds only", false, 0);
+  parser.add<bool>("concurrent", 0, "run the Coulomb, exchange and exchange-correlation builds concurrently, dividing the threads between them", false, false);
   parser.add<double>("convthr", 0, "convergence threshold", false, 1e-7);
   parser.add<double>("Ez", 0, "electric dipole field", false, 0.0);
   parser.add<double>("Qzz", 0, "electric quadrupole field", false, 0.0);
@@ -90,32 +172,84 @@ int main(int argc, char **argv) {
   parser.add<int>("ldft", 0, "theta rule for dft quadrature (0 for auto)", false, 0);
   parser.add<int>("mdft", 0, "phi rule for dft quadrature (0 for auto)", false, 0);
   parser.add<double>("dftthr", 0, "density threshold for dft", false, 1e-12);
+  parser.add<double>("dft_cache", 0, "memory in MiB for caching basis functions on the DFT grid, 0 to recompute them on every build", false, 0.0);
+  parser.add<bool>("dft_timing", 0, "print per-thread busy times of the XC quadrature", false, false);
+  parser.add<double>("dft_prune", 0, "relative density matrix threshold for pruning the angular DFT grid in each element, 0 to use the full grid", false, 0.0);
+  parser.add<int>("dft_batch", 0, "number of radial elements whose grid points are passed to libxc at once", false, 1);
   parser.add<int>("restricted", 0, "spin-restricted orbitals", false, -1);
   parser.add<int>("symmetry", 0, "force orbital symmetry", false, 1);
   parser.add<int>("primbas", 0, "primitive radial basis", false, 4);
   parser.add<double>("diiseps", 0, "when to start mixing in diis", false, 1e-2);
   parser.add<double>("diisthr", 0, "when to switch over fully to diis", false, 1e-3);
   parser.add<int>("diisorder", 0, "length of diis history", false, 5);
+  parser.add<bool>("adiis_stop", 0, "stop using ADIIS for good once the DIIS error falls below diisthr", false, false);
   parser.add<int>("readocc", 0, "read occupations from file, use until nth build", false, 0);
+  parser.add<int>("davidson", 0, "solve the occupied and this many virtual orbitals with the Davidson method, 0 for full diagonalization", false, 0);
+  parser.add<double>("davidson_thr", 0, "residual threshold for the Davidson solver", false, 1e-8);
+  parser.add<bool>("orth_scf", 0, "keep the Fock matrices and the DIIS history in the orthonormal basis", false, false);
   parser.add<double>("perturb", 0, "randomly perturb initial guess", false, 0.0);
   parser.add<int>("seed", 0, "seed for random perturbation", false, 0);
   parser.add<int>("iguess", 0, "guess: 0 for core, 1 for GSZ, 2 for SAP, 3 for TF", false, 2);
   parser.add<int>("finitenuc", 0, "finite nuclear model", false, 0);
   parser.add<double>("Rrms", 0, "finite nuclear rms radius", false, 0.0);
+  parser.add<std::string>("extpot", 0, "file with a tabulated radial potential r V(r) added to the nuclear attraction", false, "");
   parser.add<std::string>("load", 0, "load guess from checkpoint", false, "");
   parser.add<std::string>("save", 0, "save calculation to checkpoint", false, "helfem.chk");
+  parser.add<int>("coarse_nnodes", 0, "converge first with this many nodes per element and continue from the projected orbitals, 0 to run directly", false, 0);
+  parser.add<int>("coarse_nelem", 0, "number of elements in the coarse basis, 0 for nelem", false, 0);
+  parser.add<double>("coarse_convthr", 0, "convergence threshold in the coarse basis, 0 for convthr", false, 0.0);
+  parser.add<std::string>("guess_cache", 0, "checkpoint file for caching the guess potentials between runs", false, "");
+  parser.add<int>("chkpt_every", 0, "save the SCF matrices to the checkpoint every n iterations, 0 for only at the end of the SCF", false, 1);
+  parser.add<bool>("chkpt_restart", 0, "only save the density matrices and orbitals needed for restarting during the SCF", false, false);
+  parser.add<bool>("chkpt_compact", 0, "only save the basis, orbitals, occupations and energies; matrices that can be regenerated from the basis are left out", false, false);
+  parser.add<int>("chkpt_compress", 0, "deflate level for the matrices in the checkpoint, 0 for no compression", false, 0);
+  parser.add<bool>("resume", 0, "resume an interrupted SCF from the save checkpoint, including the DIIS history", false, false);
+  parser.add<std::string>("rs_cache", 0, "checkpoint file for caching range-separated integrals between runs", false, "");
+  parser.add<std::string>("integral_cache", 0, "checkpoint file for caching the integrals of the basis set between runs", false, "");
   parser.add<std::string>("x_pars", 0, "file for parameters for exchange functional", false, "");
   parser.add<std::string>("c_pars", 0, "file for parameters for correlation functional", false, "");
   parser.add<bool>("maverage", 0, "average Fock matrix over m values", false, false);
   parser.add<double>("dampfock", 0, "damping factor for off-diagonal elents", false, 0.7);
   parser.add<double>("dampthr", 0, "damping threshold", false, 0.1);
+  parser.add<int>("qn_stall", 0, "switch to quasi-Newton orbital rotations once the DIIS error has not decreased in this many iterations, 0 to disable", false, 0);
+  parser.add<double>("qn_step", 0, "trust radius for the quasi-Newton orbital rotations", false, 0.5);
+  parser.add<double>("smear_T", 0, "initial temperature for fermi smearing of the occupations, 0 to disable", false, 0.0);
+  parser.add<double>("smear_anneal", 0, "factor by which the smearing temperature is lowered on every iteration", false, 0.7);
+  parser.add<double>("smear_Tmin", 0, "final smearing temperature", false, 1e-4);
+  parser.add<bool>("smear_integer", 0, "switch to integer occupations at the final smearing temperature", false, true);
   parser.add<bool>("zeroder", 0, "zero derivative at Rmax?", false, false);
   parser.add<int>("taylor_order", 0, "order of Taylor expansion near the nucleus", false, -1);
-  parser.add<int>("iconf", 0, "type of confinement potential: 1 for polynomial, 2 for exponential", false, 0);
+  parser.add<int>("iconf", 0, "type of confinement potential: 1 for polynomial, 2 for exponential, 3 for hard wall", false, 0);
   parser.add<int>("conf_N", 0, "exponent in confinement potential", false, 0);
   parser.add<double>("conf_R", 0, "confinement radius", false, 0.0);
+  parser.add<std::string>("conf_R_list", 0, "list of confinement radii to scan", false, "");
+  parser.add<std::string>("Ez_list", 0, "list of electric dipole fields to scan for the polarizabilities", false, "");
+  parser.add<std::string>("Qzz_list", 0, "list of electric quadrupole fields to scan for the quadrupole response", false, "");
+  parser.add<std::string>("states", 0, "further charge and spin states Q:M to solve with the same integrals and grid, e.g. 1:2,-1:2", false, "");
+  parser.add<std::string>("omega_scan", 0, "list of range-separation parameters at which to evaluate the ionization potential tuning condition", false, "");
+  parser.add<bool>("omega_tune", 0, "tune the range-separation parameter so that -eps_HOMO equals the ionization potential", false, false);
+  parser.add<int>("omega_maxit", 0, "maximum number of range-separation tuning steps", false, 10);
+  parser.add<double>("omega_thr", 0, "convergence threshold for the range-separation tuning condition", false, 1e-5);
+  parser.add<bool>("response", 0, "compute the static dipole and quadrupole polarizabilities by coupled-perturbed SCF", false, false);
+  parser.add<std::string>("tei_storage", 0, "storage of exchange integrals: full or direct (formed on the fly)", false, "full");
+  parser.add<double>("kscreen", 0, "screening threshold for element blocks in exchange, 0 to disable", false, 1e-12);
+  parser.add<bool>("kbatch", 0, "contract the in-element exchange integrals for batches of angular pairs with matrix-matrix products", false, false);
+  parser.add<double>("tei_lowrank", 0, "relative eigenvalue threshold for low-rank factorization of the in-element two-electron integrals, 0 for full integrals", false, 0.0);
+  parser.add<bool>("numa", 0, "compute and contract the in-element integrals in a fixed partition by element, for first-touch placement with bound threads", false, false);
+  parser.add<int>("nelem_conf", 0, "number of elements in the confinement wall region, 0 for normal grid", false, 0);
+  parser.add<double>("conf_thr", 0, "density threshold for truncating the grid in the confinement wall", false, 1e-12);
+  parser.add<std::string>("profile", 0, "write timing profile to file (.json or .csv)", false, "");
+  parser.add<int>("threads", 0, "number of threads, 0 for the OpenMP default", false, 0);
+  parser.add<std::string>("threading", 0, "threading policy: auto runs BLAS serially within the parallel loops, blas leaves it to the library", false, "");
+  parser.add<std::string>("max_memory", 0, "memory budget such as 500M or 4G used to choose the integral storage modes, empty for unlimited", false, "");
   parser.parse_check(argc, argv);
 
+  std::string profile(parser.get<std::string>("profile"));
+  if(profile.size())
+    profiler::enable(profile);
+  threading::configure(parser.get<std::string>("threading"),parser.get<int>("threads"));
+  threading::print();
+
   // Get parameters
   double Rmax(parser.get<double>("Rmax"));
   int igrid(parser.get<int>("grid"));
@@ -128,6 +262,8 @@ int main(int argc, char **argv) {
 
   int maxit(parser.get<int>("maxit"));
   double convthr(parser.get<double>("convthr"));
+  int davidson(parser.get<int>("davidson"));
+  double davidson_thr(parser.get<double>("davidson_thr"));
 
   bool diag(parser.get<bool>("diag"));
   int restr(parser.get<int>("restricted"));
@@ -141,6 +277,7 @@ int main(int argc, char **argv) {
   int Nelem(parser.get<int>("nelem"));
   // Number of nodes
   int Nnodes(parser.get<int>("nnodes"));
+  arma::vec nnodes_list(scf::parse_list(parser.get<std::string>("nnodes_list")));
   int taylor_order(parser.get<int>("taylor_order"));
 
   // Order of quadrature rule
@@ -153,9 +290,14 @@ int main(int argc, char **argv) {
   int ldft(parser.get<int>("ldft"));
   int mdft(parser.get<int>("mdft"));
   double dftthr(parser.get<double>("dftthr"));
+  double dft_cache(parser.get<double>("dft_cache"));
+  bool dft_timing(parser.get<bool>("dft_timing"));
+  int dft_batch(parser.get<int>("dft_batch"));
+  double dft_prune(parser.get<double>("dft_prune"));
 
   int finitenuc(parser.get<int>("finitenuc"));
   double Rrms(parser.get<double>("Rrms"));
+  std::string extpot(parser.get<std::string>("extpot"));
 
   // Nuclear charge
   int Z(get_Z(parser.get<std::string>("Z")));
@@ -171,6 +313,8 @@ int main(int argc, char **argv) {
   double diiseps=parser.get<double>("diiseps");
   double diisthr=parser.get<double>("diisthr");
   int diisorder=parser.get<int>("diisorder");
+  bool adiis_stop=parser.get<bool>("adiis_stop");
+  bool orth_scf=parser.get<bool>("orth_scf");
 
   std::string method(parser.get<std::string>("method"));
 
@@ -178,19 +322,144 @@ int main(int argc, char **argv) {
   int seed=parser.get<int>("seed");
 
   std::string save(parser.get<std::string>("save"));
+  int chkpt_every(parser.get<int>("chkpt_every"));
+  bool chkpt_restart(parser.get<bool>("chkpt_restart"));
+  bool chkpt_compact(parser.get<bool>("chkpt_compact"));
+  int chkpt_compress(parser.get<int>("chkpt_compress"));
+  bool resume(parser.get<bool>("resume"));
+  std::string rs_cache(parser.get<std::string>("rs_cache"));
+  std::string integral_cache(parser.get<std::string>("integral_cache"));
+  // The range-separated integrals go in the same file by default
+  if(rs_cache.empty())
+    rs_cache=integral_cache;
   std::string load(parser.get<std::string>("load"));
+  std::string guess_cache(parser.get<std::string>("guess_cache"));
+
+  // Coarse-to-fine continuation: converge the SCF in a small basis
+  // and start the calculation from its orbitals
+  int coarse_nnodes(parser.get<int>("coarse_nnodes"));
+  int coarse_nelem(parser.get<int>("coarse_nelem"));
+  double coarse_convthr(parser.get<double>("coarse_convthr"));
+  if((coarse_nnodes>0 || coarse_nelem>0) && !load.size() && !resume) {
+    std::vector<std::string> replace={"load", "save", "profile", "coarse_nnodes", "coarse_nelem", "coarse_convthr"};
+    std::vector<std::string> extra;
+    std::string coarse_save(save+".coarse");
+    extra.push_back("--save="+coarse_save);
+    if(coarse_nnodes>0) {
+      replace.push_back("nnodes");
+      extra.push_back("--nnodes="+std::to_string(coarse_nnodes));
+    }
+    if(coarse_nelem>0) {
+      replace.push_back("nelem");
+      extra.push_back("--nelem="+std::to_string(coarse_nelem));
+    }
+    if(coarse_convthr>0.0) {
+      std::ostringstream oss;
+      oss << "--convthr=" << std::setprecision(17) << coarse_convthr;
+      replace.push_back("convthr");
+      extra.push_back(oss.str());
+    }
+
+    printf("\nConverging the SCF first in the coarse basis\n");
+    Timer tcoarse;
+    {
+      profiler::Region rcoarse("coarse_stage");
+      run_coarse_stage(argc, argv, replace, extra);
+    }
+    printf("Coarse basis calculation done in %.6f, continuing in the full basis\n\n",tcoarse.get());
+    load=coarse_save;
+  }
 
   std::string xparf(parser.get<std::string>("x_pars"));
   std::string cparf(parser.get<std::string>("c_pars"));
 
   double dampfock(parser.get<double>("dampfock"));
   double dampthr(parser.get<double>("dampthr"));
+  int qn_stall(parser.get<int>("qn_stall"));
+  double qn_step(parser.get<double>("qn_step"));
+  const scf::FermiSmearing smearing(parser.get<double>("smear_T"),parser.get<double>("smear_anneal"),parser.get<double>("smear_Tmin"),parser.get<bool>("smear_integer"));
 
   bool zeroder(parser.get<bool>("zeroder"));
 
   int conf_N(parser.get<int>("conf_N"));
   double conf_R(parser.get<double>("conf_R"));
   int iconf(parser.get<int>("iconf"));
+  int Nelem_conf(parser.get<int>("nelem_conf"));
+  double conf_thr(parser.get<double>("conf_thr"));
+  // Storage of the two-electron integrals
+  bool tei_direct;
+  {
+    std::string tei_storage(parser.get<std::string>("tei_storage"));
+    if(helfem::utils::stricmp(tei_storage,"full")==0)
+      tei_direct=false;
+    else if(helfem::utils::stricmp(tei_storage,"direct")==0)
+      tei_direct=true;
+    else
+      throw std::logic_error("Unknown tei_storage " + tei_storage + "!\n");
+  }
+  // Screening threshold in exchange
+  double kscreen(parser.get<double>("kscreen"));
+  // Single precision integrals during the initial iterations
+  double sp_thr(parser.get<double>("sp_thr"));
+  // NUMA partitioning of the in-element integrals
+  bool numa(parser.get<bool>("numa"));
+  // Batched in-element exchange
+  bool kbatch(parser.get<bool>("kbatch"));
+  // Memory budget
+  size_t max_memory(scf::parse_memory(parser.get<std::string>("max_memory")));
+  // Confinement radius scan
+  arma::vec conf_R_list(scf::parse_list(parser.get<std::string>("conf_R_list")));
+  bool confscan=(conf_R_list.n_elem>0);
+  if(confscan) {
+    if(!conf_N)
+      throw std::logic_error("Confinement radius scan requires a confinement potential!\n");
+    if(iconf==3)
+      throw std::logic_error("Confinement radius scan is not possible with a hard wall, since the basis depends on the radius!\n");
+    conf_R=conf_R_list(0);
+  }
+  // Finite field scan
+  arma::vec Ez_list(scf::parse_list(parser.get<std::string>("Ez_list")));
+  arma::vec Qzz_list(scf::parse_list(parser.get<std::string>("Qzz_list")));
+  bool fieldscan=(Ez_list.n_elem>0 || Qzz_list.n_elem>0);
+  if(fieldscan) {
+    if(confscan)
+      throw std::logic_error("Field and confinement radius scans can't be combined!\n");
+    if(Ez_list.n_elem && Qzz_list.n_elem)
+      throw std::logic_error("Scan either the dipole or the quadrupole field, not both!\n");
+    if(Ez_list.n_elem<2 && Qzz_list.n_elem<2)
+      throw std::logic_error("Field scan requires at least two field strengths!\n");
+  }
+  // Number of points in the scan
+  size_t nscan(std::max(conf_R_list.n_elem,std::max(Ez_list.n_elem,Qzz_list.n_elem)));
+  if(!nscan)
+    nscan=1;
+  // Further charge and spin states, solved after the reference state
+  std::vector< std::pair<int,int> > states(parse_states(parser.get<std::string>("states")));
+  if(states.size() && (nscan>1 || confscan))
+    throw std::logic_error("Further states can't be combined with a scan!\n");
+  if(!confscan)
+    conf_R_list=conf_R*arma::ones<arma::vec>(nscan);
+  if(Ez_list.n_elem)
+    Ez=Ez_list(0);
+  else
+    Ez_list=Ez*arma::ones<arma::vec>(nscan);
+  if(Qzz_list.n_elem)
+    Qzz=Qzz_list(0);
+  else
+    Qzz_list=Qzz*arma::ones<arma::vec>(nscan);
+  // Are electric fields present at any point?
+  bool efield(arma::any(Ez_list!=0.0) || arma::any(Qzz_list!=0.0));
+  // Hard wall confinement: the basis is truncated at the wall
+  bool confined(conf_N || iconf==3);
+  if(iconf==3) {
+    if(conf_R<=0.0)
+      throw std::logic_error("Hard wall confinement requires a positive conf_R!\n");
+    if(zeroder)
+      throw std::logic_error("Hard wall confinement requires the functions to vanish at the wall; don't use zeroder!\n");
+    if(Nelem_conf)
+      throw std::logic_error("nelem_conf is not used with hard wall confinement!\n");
+    Rmax=conf_R;
+  }
 
   // Set parameters if necessary
   arma::vec xpars, cpars;
@@ -203,14 +472,29 @@ int main(int argc, char **argv) {
     cpars.t().print("Correlation functional parameters");
   }
 
-  // Open checkpoint in save mode
-  Checkpoint chkpt(save,true);
+  // Open checkpoint in save mode; when resuming, keep its contents
+  if(resume && !file_exists(save))
+    throw std::runtime_error("Cannot resume, checkpoint file \"" + save + "\" does not exist!\n");
+  Checkpoint chkpt(save,true,!resume);
+  if(resume && !chkpt.exist("scf_iter"))
+    throw std::runtime_error("Cannot resume, checkpoint file \"" + save + "\" has no SCF state!\n");
+  chkpt.set_compression(chkpt_compress);
+  // The SCF matrices are saved in the background
+  CheckpointWriter chkwriter(chkpt,chkpt_every,chkpt_restart || chkpt_compact);
+  // Matrices that can be regenerated from the basis are left out of
+  // compact checkpoints
+  auto write_derived = [&](const std::string & name, const arma::mat & M) {
+    if(!chkpt_compact)
+      chkpt.write(name,M);
+  };
 
   // Read occupations from file?
   int readocc=parser.get<int>("readocc");
   if(readocc<0)
     readocc=INT_MAX;
   arma::imat occs;
+  if(readocc && states.size())
+    throw std::logic_error("Further states can't be combined with occupations read from file!\n");
   if(readocc) {
     occs.load("occs.dat",arma::raw_ascii);
     if(symm == 2 && occs.n_cols != 4) {
@@ -221,12 +505,17 @@ int main(int argc, char **argv) {
     }
   }
 
+  if(smearing.active() && readocc)
+    throw std::logic_error("Fermi smearing can't be combined with occupations read from file!\n");
+
   if(parser.get<bool>("angstrom")) {
     // Convert to atomic units
     Rhalf*=ANGSTROMINBOHR;
   }
 
   scf::parse_nela_nelb(nela,nelb,Q,M,Z+Zl+Zr);
+  // Spin restriction of the further states
+  const int restr_states(restr);
   if(restr==-1) {
     // If number of electrons differs then unrestrict
     restr=(nela==nelb);
@@ -249,9 +538,14 @@ int main(int argc, char **argv) {
   else if(Nquad<2*poly->get_nbf())
     throw std::logic_error("Insufficient radial quadrature.\n");
 
-  // Set default order of Taylor expansion
-  if(taylor_order==-1)
-    taylor_order = poly->get_nprim()-1;
+  // Set default order of Taylor expansion; it is only used in the first element
+  if(taylor_order==-1) {
+    if(nnodes_list.n_elem) {
+      std::unique_ptr<polynomial_basis::PolynomialBasis> p0(polynomial_basis::get_basis(primbas,(int) nnodes_list(0)));
+      taylor_order = p0->get_nprim()-1;
+    } else
+      taylor_order = poly->get_nprim()-1;
+  }
 
   printf("Using %i point quadrature rule.\n",Nquad);
   printf("Angular grid spanning from l=0..%i, m=%i..%i.\n",lmax,-mmax,mmax);
@@ -260,10 +554,30 @@ int main(int argc, char **argv) {
   arma::ivec lval, mval;
   atomic::basis::angular_basis(lmax,mmax,lval,mval);
   // and the radial one
-  arma::vec bval=atomic::basis::form_grid((modelpotential::nuclear_model_t) finitenuc, Rrms, Nelem, Rmax, igrid, zexp, Nelem0, igrid0, zexp0, Z, Zl, Zr, Rhalf);
+  arma::vec bval;
+  if(Nelem_conf) {
+    if(finitenuc || Zl != 0 || Zr != 0)
+      throw std::logic_error("Confinement grid is only supported for a single point nucleus!\n");
+    bval=atomic::basis::confinement_grid(Nelem, Rmax, igrid, zexp, Nelem_conf, iconf, conf_N, conf_R, conf_thr);
+    bval.print("Grid");
+  } else {
+    bval=atomic::basis::form_grid((modelpotential::nuclear_model_t) finitenuc, Rrms, Nelem, Rmax, igrid, zexp, Nelem0, igrid0, zexp0, Z, Zl, Zr, Rhalf);
+  }
+
+  // Polynomial order in each element
+  arma::ivec el_nnodes;
+  if(nnodes_list.n_elem) {
+    el_nnodes.zeros(bval.n_elem-1);
+    for(size_t iel=0;iel<el_nnodes.n_elem;iel++) {
+      el_nnodes(iel)=(int) nnodes_list(std::min<size_t>(iel,nnodes_list.n_elem-1));
+      if(el_nnodes(iel)<2 || el_nnodes(iel)>Nnodes)
+        throw std::logic_error("The nodes in each element must be between 2 and nnodes!\n");
+    }
+    el_nnodes.t().print("Nodes per element");
+  }
 
   atomic::basis::TwoDBasis basis;
-  basis=atomic::basis::TwoDBasis(Z, (modelpotential::nuclear_model_t) finitenuc, Rrms, poly, zeroder, Nquad, bval, taylor_order, lval, mval, Zl, Zr, Rhalf);
+  basis=atomic::basis::TwoDBasis(Z, (modelpotential::nuclear_model_t) finitenuc, Rrms, poly, zeroder, Nquad, bval, taylor_order, lval, mval, Zl, Zr, Rhalf, el_nnodes);
   chkpt.write(basis);
   printf("Basis set consists of %i angular shells composed of %i radial functions, totaling %i basis functions\n",(int) basis.Nang(), (int) basis.Nrad(), (int) basis.Nbf());
   printf("%ith order Taylor series used to evaluate basis functions for r <= %e, error %e\n",taylor_order, basis.get_small_r_taylor_cutoff(), basis.get_taylor_diff());
@@ -280,7 +594,7 @@ int main(int argc, char **argv) {
 
   // Symmetry indices
   std::vector<arma::uvec> dsym;
-  if(symm==2 && (Ez!=0.0 || Qzz!=0.0)) {
+  if(symm==2 && efield) {
     printf("Warning - asked for full orbital symmetry in presence of electric field. Relaxing restriction.\n");
     symm=1;
   }
@@ -291,6 +605,13 @@ int main(int argc, char **argv) {
   if(symm)
     dsym=basis.get_sym_idx(symm);
 
+  // Without external fields or off-center nuclei, the one-electron
+  // problem is block diagonal in (l,m), so the half-inverse overlap and
+  // the guess orbitals can be formed block by block
+  bool spherical=(!efield && Bz==0.0 && Zl==0 && Zr==0);
+  if(spherical)
+    printf("One-electron Hamiltonian is block diagonal in (l,m): using %i blocks\n",(int) basis.get_sym_idx(2).size());
+
   arma::ivec lvals, mvals;
   lvals=basis.get_l();
   mvals=basis.get_m();
@@ -303,6 +624,8 @@ int main(int argc, char **argv) {
   for(int l=0; l< (int) l_idx.size(); l++)
     for(int m=-l;m<=l;m++)
       l_idx[l].push_back(basis.lm_indices(l,m));
+  // Symmetrization of the Fock matrix is compiled once
+  const scf::FockSymmetrizer fock_symm(basis.Nbf(), symm ? dsym : std::vector<arma::uvec>(), maverage ? l_idx : std::vector< std::vector<arma::uvec> >());
 
   // Forced occupations?
   arma::ivec occnuma, occnumb;
@@ -366,14 +689,90 @@ int main(int argc, char **argv) {
   else
     printf("\nA pure exchange functional used, no exact exchange.\n");
 
+  // Scan or tuning of the range-separation parameter. The ion is
+  // solved as a further state after the neutral at each omega.
+  scf::OmegaTuning omega_tuning(scf::parse_list(parser.get<std::string>("omega_scan")),parser.get<bool>("omega_tune"),parser.get<int>("omega_maxit"),parser.get<double>("omega_thr"));
+  std::pair<int,int> omega_neutral, omega_ion;
+  if(omega_tuning.active()) {
+    if(!(erfc || yukawa))
+      throw std::logic_error("Tuning the range-separation parameter requires a range-separated functional!\n");
+    if(states.size())
+      throw std::logic_error("Range-separation tuning can't be combined with further states!\n");
+    if(nscan>1 || confscan)
+      throw std::logic_error("Range-separation tuning can't be combined with a scan!\n");
+    if(readocc)
+      throw std::logic_error("Range-separation tuning can't be combined with occupations read from file!\n");
+    if(resume)
+      throw std::logic_error("Range-separation tuning can't be resumed!\n");
+    if(nela+nelb<2)
+      throw std::logic_error("Range-separation tuning requires at least two electrons!\n");
+    omega_neutral=std::make_pair(Q,M);
+    omega_ion=std::make_pair(Q+1,(M>1) ? M-1 : 2);
+    states.push_back(omega_ion);
+
+    double omega0;
+    if(omega_tuning.next(omega0) && omega0!=omega) {
+      omega=omega0;
+      xpars=set_range_separation(x_func,xpars,omega);
+      printf("Range-separation parameter set to omega = % .6f\n",omega);
+    }
+  }
+  // Range-separation parameter of each further state
+  std::vector<double> states_omega(states.size(),omega);
+
+  if(max_memory) {
+    // Plan the large allocations and pick storage modes that fit
+    scf::MemoryPlan plan(max_memory);
+    // Overlap, kinetic, nuclear, core and orthogonalizing matrices
+    plan.set("one-electron matrices",5*basis.mem_1el());
+    // Orbitals, densities, Coulomb, exchange and Fock matrices for both spins
+    plan.set("SCF matrices",10*basis.mem_1el());
+    // Fock, density and error matrices for both spins
+    plan.set("DIIS history",6*diisorder*basis.mem_1el());
+    plan.set("auxiliary one-electron integrals",basis.mem_1el_aux());
+    plan.set("two-electron integrals",basis.mem_2el_aux(kfrac!=0.0,tei_direct));
+    if(kshort!=0.0)
+      plan.set("range-separated integrals",basis.mem_2el_rs());
+    if(sp_thr>0.0)
+      plan.set("single precision copies",basis.mem_2el_aux(kfrac!=0.0,tei_direct)/2);
+    if(dft && dft_cache>0.0)
+      plan.set("DFT basis function cache",(size_t) (dft_cache*1024.0*1024.0));
+
+    // The basis function cache can shrink to whatever is left over
+    if(!plan.fits() && dft && dft_cache>0.0) {
+      plan.remove("DFT basis function cache");
+      dft_cache=plan.available()/(1024.0*1024.0);
+      if(dft_cache>0.0)
+        plan.set("DFT basis function cache",(size_t) (dft_cache*1024.0*1024.0));
+      printf("Reduced the DFT basis function cache to %s to fit the memory budget\n",scf::memory_size((size_t) (dft_cache*1024.0*1024.0)).c_str());
+    }
+    // The single precision copies are only a speedup
+    if(!plan.fits() && sp_thr>0.0) {
+      plan.remove("single precision copies");
+      sp_thr=0.0;
+      printf("Switched off single precision integrals to fit the memory budget\n");
+    }
+    // Form the exchange-ordered integrals on the fly
+    if(!plan.fits() && kfrac!=0.0 && !tei_direct) {
+      tei_direct=true;
+      plan.set("two-electron integrals",basis.mem_2el_aux(kfrac!=0.0,tei_direct));
+      printf("Switched to direct exchange integrals to fit the memory budget\n");
+    }
+    plan.print();
+    plan.check();
+  }
+
   Timer timer;
 
+  // Integrals are cached by the basis set fingerprint
+  const std::string fingerprint(basis.fingerprint());
+
   // Form overlap matrix
-  arma::mat S(basis.overlap());
-  chkpt.write("S",S);
+  arma::mat S(cached_matrix(integral_cache,"S_"+fingerprint,[&](){return basis.overlap();}));
+  write_derived("S",S);
   // Form kinetic energy matrix
-  arma::mat T(basis.kinetic());
-  chkpt.write("T",T);
+  arma::mat T(cached_matrix(integral_cache,"T_"+fingerprint,[&](){return basis.kinetic();}));
+  write_derived("T",T);
 
   // Form DFT grid
   helfem::atomic::dftgrid::DFTGrid grid;
@@ -397,6 +796,14 @@ int main(int argc, char **argv) {
 
     // Form grid
     grid=helfem::atomic::dftgrid::DFTGrid(&basis,ldft,mdft);
+    if(dft_cache>0.0)
+      grid.set_bf_cache((size_t) (dft_cache*1024.0*1024.0));
+    if(dft_timing)
+      grid.set_thread_timing(true);
+    if(dft_batch>1)
+      grid.set_xc_batch(dft_batch);
+    if(dft_prune>0.0)
+      grid.set_pruning(dft_prune);
 
     // Basis function norms
     arma::vec bfnorm(arma::pow(arma::diagvec(S),-0.5));
@@ -436,16 +843,24 @@ int main(int argc, char **argv) {
 
   // Get half-inverse
   timer.set();
-  arma::mat Sinvh(basis.Sinvh(!diag,symm));
-  chkpt.write("Sinvh",Sinvh);
+  arma::mat Sinvh(basis.Sinvh(!diag,spherical ? 2 : symm));
+  write_derived("Sinvh",Sinvh);
   printf("Half-inverse formed in %.6f\n",timer.get());
+  // Symmetry blocked orthogonalizer, reused by every diagonalization
+  scf::SymmetryOrthogonalizer symorth;
+  if(symm)
+    symorth=scf::SymmetryOrthogonalizer(Sinvh,dsym);
+  // Orthogonalizer for the one-electron problem
+  scf::SymmetryOrthogonalizer lmorth;
+  if(spherical)
+    lmorth=scf::SymmetryOrthogonalizer(Sinvh,basis.get_sym_idx(2));
   {
     arma::mat Smo(Sinvh.t()*S*Sinvh);
     Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
     printf("Orbital orthonormality deviation is %e\n",arma::norm(Smo,"fro"));
   }
   arma::mat Sh(basis.Shalf(!diag,symm));
-  chkpt.write("Sh",Sh);
+  write_derived("Sh",Sh);
   printf("Half-overlap formed in %.6f\n",timer.get());
   {
     arma::mat Smo(Sh.t()*Sinvh);
@@ -457,35 +872,71 @@ int main(int argc, char **argv) {
   Timer tnuc;
   if(Zl!=0 || Zr !=0)
     printf("Computing nuclear attraction integrals\n");
-  arma::mat Vnuc=basis.nuclear();
-  chkpt.write("Vuc",Vnuc);
+  arma::mat Vnuc(cached_matrix(integral_cache,"Vnuc_"+fingerprint,[&](){return basis.nuclear();}));
+  if(extpot.size()) {
+    // Spherical external potential, e.g. a screening potential
+    modelpotential::TabulatedRadialPotential tabpot(extpot);
+    printf("Adding tabulated potential from %s to the nuclear attraction\n",extpot.c_str());
+    Vnuc+=basis.model_potential(&tabpot);
+  }
+  write_derived("Vuc",Vnuc);
   if(Zl!=0 || Zr !=0)
     printf("Done in %.6f\n",tnuc.get());
 
-  // Confinement potential
-  arma::mat Vconf(basis.Nbf(),basis.Nbf(),arma::fill::zeros);
+  // The confinement and field couplings are only formed, and
+  // checkpointed, when they are in use; an empty matrix stands for zero
+  arma::mat Vconf;
   if(conf_N) {
     printf("Computing confinement potential\n");
-    arma::mat Vconf=basis.confinement(conf_N, conf_R, iconf);
+    Vconf=basis.confinement(conf_N, conf_R, iconf);
+    write_derived("Vconf",Vconf);
   }
-  chkpt.write("Vconf",Vconf);
-  
-  // Dipole coupling
-  arma::mat dip(basis.dipole_z());
-  chkpt.write("dip",dip);
-  // Quadrupole coupling
-  arma::mat quad(basis.quadrupole_zz());
-  chkpt.write("quad",quad);
+
+  // Dipole and quadrupole coupling, formed on first use
+  arma::mat dip, quad;
+  auto multipole_matrices = [&]() {
+    if(dip.n_elem)
+      return;
+    dip=basis.dipole_z();
+    write_derived("dip",dip);
+    quad=basis.quadrupole_zz();
+    write_derived("quad",quad);
+  };
 
   // Electric field coupling (minus sign cancels one from charge)
-  arma::mat Vel(Ez*dip + Qzz*quad/3.0);
-  chkpt.write("Vel",Vel);
+  arma::mat Vel;
+  auto electric_coupling = [&]() {
+    multipole_matrices();
+    Vel=Ez*dip + Qzz*quad/3.0;
+    write_derived("Vel",Vel);
+  };
+  if(Ez!=0.0 || Qzz!=0.0 || fieldscan)
+    electric_coupling();
   // Magnetic field coupling
-  arma::mat Vmag(basis.Bz_field(Bz));
-  chkpt.write("Vmag",Vmag);
+  arma::mat Vmag;
+  if(Bz!=0.0) {
+    Vmag=basis.Bz_field(Bz);
+    write_derived("Vmag",Vmag);
+  }
+
+  // Adds the couplings that are in use to a core Hamiltonian
+  auto add_couplings = [&](arma::mat & H, bool confinement) {
+    if(Vel.n_elem)
+      H+=Vel;
+    if(Vmag.n_elem)
+      H+=Vmag;
+    if(confinement && Vconf.n_elem)
+      H+=Vconf;
+  };
+  // Expectation value of a coupling that may be absent
+  auto coupling_energy = [](const arma::mat & Pmat, const arma::mat & V) {
+    return V.n_elem ? arma::trace(Pmat*V) : 0.0;
+  };
+
   // Form Hamiltonian
-  arma::mat H0(T+Vnuc+Vel+Vmag+Vconf);
-  chkpt.write("H0",H0);
+  arma::mat H0(T+Vnuc);
+  add_couplings(H0,true);
+  write_derived("H0",H0);
 
   printf("One-electron matrices formed in %.6f\n",timer.get());
 
@@ -500,7 +951,15 @@ int main(int argc, char **argv) {
   timer.set();
   {
     arma::mat Ca, Cb;
-    if(load.size()) {
+    if(resume) {
+      printf("Orbitals from interrupted calculation\n");
+      chkpt.read("Ca",Ca);
+      chkpt.read("Cb",Cb);
+      chkpt.read("Ea",Ea);
+      chkpt.read("Eb",Eb);
+      if(Ca.n_rows != Sinvh.n_rows || Cb.n_rows != Sinvh.n_rows)
+        throw std::runtime_error("Cannot resume, the basis set differs from the one in the checkpoint!\n");
+    } else if(load.size()) {
       printf("Guess orbitals from checkpoint\n");
 
       // Load checkpoint
@@ -509,8 +968,25 @@ int main(int argc, char **argv) {
       atomic::basis::TwoDBasis oldbasis;
       loadchk.read(oldbasis);
 
+      // Compact checkpoints hold no derived matrices, so these are
+      // rebuilt from the old basis and orbitals
       arma::mat oldSinvh;
-      loadchk.read("Sinvh",oldSinvh);
+      if(loadchk.exist("Sinvh"))
+        loadchk.read("Sinvh",oldSinvh);
+      else
+        oldSinvh=oldbasis.Sinvh(!diag,symm);
+      auto read_fock = [&](const std::string & spin) {
+        arma::mat F;
+        if(loadchk.exist("F"+spin)) {
+          loadchk.read("F"+spin,F);
+        } else {
+          arma::mat C, E;
+          loadchk.read("C"+spin,C);
+          loadchk.read("E"+spin,E);
+          F=scf::fock_from_orbitals(oldbasis.overlap(),C,arma::vectorise(E));
+        }
+        return F;
+      };
 
       // Interbasis overlap
       arma::mat S12(basis.overlap(oldbasis));
@@ -528,7 +1004,7 @@ int main(int argc, char **argv) {
 	  arma::mat F;
 
 	  // Load Fock matrix
-	  loadchk.read("Fa",F);
+	  F=read_fock("a");
 	  // Project onto the old orthogonal basis
 	  F=arma::trans(oldSinvh)*F*oldSinvh;
 	  // Project onto the new basis
@@ -537,12 +1013,12 @@ int main(int argc, char **argv) {
 	  F=SSinvh*F*arma::trans(SSinvh);
 	  // Diagonalize
 	  if(symm)
-	    scf::eig_gsym_sub(Ea,Ca,F,Sinvh,dsym);
+	    symorth.eig(Ea,Ca,F);
 	  else
 	    scf::eig_gsym(Ea,Ca,F,Sinvh);
 
 	  // Load Fock matrix
-	  loadchk.read("Fb",F);
+	  F=read_fock("b");
 	  // Project onto the old orthogonal basis
 	  F=arma::trans(oldSinvh)*F*oldSinvh;
 	  // Project onto the new basis
@@ -551,7 +1027,7 @@ int main(int argc, char **argv) {
 	  F=SSinvh*F*arma::trans(SSinvh);
 	  // Diagonalize
 	  if(symm)
-	    scf::eig_gsym_sub(Eb,Cb,F,Sinvh,dsym);
+	    symorth.eig(Eb,Cb,F);
 	  else
 	    scf::eig_gsym(Eb,Cb,F,Sinvh);
 	}
@@ -631,14 +1107,38 @@ int main(int argc, char **argv) {
         throw std::logic_error("Unsupported guess\n");
       }
 
-      // Form guess Hamiltonian
-      arma::mat Hguess(T+Vel+Vmag+basis.model_potential(model));
-      // and free memory
+      // The model potential only depends on the basis set and the
+      // guess, so it can be reused from an earlier run
+      arma::mat Vguess;
+      std::string guess_entry("guess_"+basis.fingerprint()+"_"+std::to_string(iguess));
+      bool cached=false;
+      if(guess_cache.size() && file_exists(guess_cache)) {
+        Checkpoint cache(guess_cache,false);
+        cached=cache.read_cached(guess_entry,Vguess);
+        if(cached && (Vguess.n_rows != T.n_rows || Vguess.n_cols != T.n_cols))
+          cached=false;
+      }
+      if(cached) {
+        printf("Guess potential read from %s\n",guess_cache.c_str());
+      } else {
+        Vguess=basis.model_potential(model);
+        if(guess_cache.size()) {
+          Checkpoint cache(guess_cache,true,false);
+          cache.write_cached(guess_entry,Vguess);
+        }
+      }
+      // Free memory
       delete model;
 
+      // Form guess Hamiltonian
+      arma::mat Hguess(T+Vguess);
+      add_couplings(Hguess,false);
+
       // Diagonalize the hamiltonian
-      if(symm)
-        scf::eig_gsym_sub(Ea,Ca,Hguess,Sinvh,dsym);
+      if(spherical)
+        lmorth.eig(Ea,Ca,Hguess);
+      else if(symm)
+        symorth.eig(Ea,Ca,Hguess);
       else
         scf::eig_gsym(Ea,Ca,Hguess,Sinvh);
 
@@ -657,7 +1157,7 @@ int main(int argc, char **argv) {
     }
 
     // Perturb guess
-    if(perturb) {
+    if(perturb && !resume) {
       // Generate norb x norb rotation matrix
       arma::arma_rng::set_seed(seed);
       Ca*=scf::perturbation_matrix(Ca.n_cols,perturb);
@@ -695,299 +1195,1001 @@ int main(int argc, char **argv) {
   }
   printf("Initial guess performed in %.6f\n",timer.get());
 
-  printf("Computing two-electron integrals\n");
+  printf("Computing two-electron integrals, %s storage requires %s\n",tei_direct ? "direct" : "full",scf::memory_size(basis.mem_2el_aux(kfrac!=0.0,tei_direct)).c_str());
   fflush(stdout);
   timer.set();
-  basis.compute_tei(kfrac!=0.0);
-  if(yukawa)
-    basis.compute_yukawa(omega);
-  else if(erfc)
-    basis.compute_erfc(omega);
+  profiler::Region rtei("compute_tei");
+  basis.set_numa_partition(numa);
+  basis.set_tei_factorization(parser.get<double>("tei_lowrank"));
+  basis.set_batched_exchange(kbatch);
+  {
+    bool cached=false;
+    if(integral_cache.size() && file_exists(integral_cache)) {
+      Checkpoint teichk(integral_cache,false);
+      cached=teichk.read_tei(basis,kfrac!=0.0,tei_direct);
+      if(cached)
+        printf("Two-electron integrals loaded from %s\n",integral_cache.c_str());
+    }
+    if(!cached) {
+      basis.compute_tei(kfrac!=0.0,tei_direct);
+      if(integral_cache.size()) {
+        Checkpoint teichk(integral_cache,true,false);
+        teichk.write_tei(basis);
+      }
+    }
+  }
+  basis.set_exchange_screening(kscreen);
+  if(sp_thr>0.0) {
+    printf("Using single precision integrals until DIIS error is below %e\n",sp_thr);
+    basis.set_single_precision(true);
+  }
+  // Range-separated integrals at the current omega
+  auto rs_integrals=[&]() {
+    bool cached=false;
+    if(rs_cache.size() && file_exists(rs_cache)) {
+      Checkpoint rschk(rs_cache,false);
+      cached=rschk.read_rs_integrals(basis,yukawa,omega);
+      if(cached)
+        printf("Range-separated integrals loaded from %s\n",rs_cache.c_str());
+    }
+    if(!cached) {
+      if(yukawa)
+        basis.compute_yukawa(omega);
+      else
+        basis.compute_erfc(omega);
+      if(rs_cache.size()) {
+        Checkpoint rschk(rs_cache,true,false);
+        rschk.write_rs_integrals(basis,yukawa,omega);
+      }
+    }
+  };
+  if(yukawa || erfc)
+    rs_integrals();
+  rtei.stop();
   printf("Done in %.6f\n",timer.get());
 
   double Ekin=0.0, Epot=0.0, Ecoul=0.0, Exx=0.0, Exc=0.0, Eefield=0.0, Emfield=0.0, Econf=0.0, Etot=0.0;
   double Eold=0.0;
 
   bool usediis=true, useadiis=true, diiscomb=false;
-  uDIIS diis(S,Sinvh,diiscomb,usediis,diiseps,diisthr,useadiis,true,diisorder);
+  // In the orthonormal basis the overlap is the unit matrix
+  arma::mat Iorth;
+  if(orth_scf)
+    Iorth.eye(Sinvh.n_cols,Sinvh.n_cols);
+  uDIIS diis(orth_scf ? Iorth : S,orth_scf ? Iorth : Sinvh,diiscomb,usediis,diiseps,diisthr,useadiis,true,diisorder);
+  diis.set_adiis_stop(adiis_stop);
+  diis.set_orthonormal(orth_scf);
+  // Transforms the occupied orbitals to the orthonormal basis
+  arma::mat SSinvh;
+  if(orth_scf)
+    SSinvh=S*Sinvh;
   double diiserr;
 
+  // Resume from the last saved iteration
+  int istart=1;
+  size_t iRstart=0;
+  if(resume) {
+    int it, iR;
+    bool sp;
+    chkpt.read("scf_iter",it);
+    chkpt.read("scf_iR",iR);
+    chkpt.read("scf_Eold",Eold);
+    chkpt.read("scf_single_precision",sp);
+    bool orth(false);
+    if(chkpt.exist("scf_orthonormal"))
+      chkpt.read("scf_orthonormal",orth);
+    if(orth!=orth_scf)
+      throw std::runtime_error("Cannot resume, the DIIS history in the checkpoint is in another basis!\n");
+    if(chkpt.exist("diis"))
+      diis.load(chkpt,"diis");
+    else
+      printf("No DIIS history in the checkpoint, starting a new one\n");
+    if(sp!=basis.get_single_precision())
+      basis.set_single_precision(sp);
+    istart=std::min(it+1,maxit);
+    iRstart=iR;
+    if(iRstart>=nscan+states.size())
+      throw std::runtime_error("Cannot resume, the scan differs from the one in the checkpoint!\n");
+    printf("Resuming SCF at iteration %i\n",istart);
+  }
+
   // Density matrices
   arma::mat P, Pa, Pb;
 
-  for(int i=1;i<=maxit;i++) {
-    printf("\n**** Iteration %i ****\n\n",i);
+  // Results of the confinement radius scan
+  arma::mat confscan_E(conf_R_list.n_elem,4,arma::fill::zeros);
+  // Results of the field scan: Ez, Qzz, Etot, <z>, <zz>
+  arma::mat fieldscan_E(conf_R_list.n_elem,5,arma::fill::zeros);
+  // Derivative of the energy wrt the confinement radius
+  double dEconf=0.0;
+  // Results for the radii finished before the interruption
+  for(size_t iR=0;iR<std::min<size_t>(iRstart,nscan) && confscan;iR++) {
+    std::ostringstream oss;
+    oss << "conf_R_" << iR;
+    std::string grp(oss.str());
+    chkpt.read(grp + "/conf_R",confscan_E(iR,0));
+    chkpt.read(grp + "/Etot",confscan_E(iR,1));
+    chkpt.read(grp + "/Econf",confscan_E(iR,2));
+    chkpt.read(grp + "/dEconf",confscan_E(iR,3));
+  }
+  for(size_t iR=0;iR<std::min<size_t>(iRstart,nscan) && fieldscan;iR++) {
+    std::ostringstream oss;
+    oss << "field_" << iR;
+    arma::mat row;
+    chkpt.read(oss.str() + "/result",row);
+    fieldscan_E.row(iR)=row;
+  }
 
-    // Form density matrix
-    Pa=scf::form_density(Caocc,nela);
-    Pb=scf::form_density(Cbocc,nelb);
-    if(Pb.n_rows == 0)
-      Pb.zeros(Pa.n_rows,Pa.n_cols);
-    P=Pa+Pb;
+  // Incremental Fock builds: J and K are linear in the density, so
+  // only the change from the reference density needs to be contracted
+  int incfock(parser.get<int>("incfock"));
+  int nincr=0;
+  arma::mat Pa_ref, Pb_ref, J_ref, Ka_ref, Kb_ref;
+
+  // Concurrent Fock builds, balanced by the timings of the last iteration
+  bool concurrent(parser.get<bool>("concurrent"));
+  double tJ_last=0.0, tK_last=0.0, txc_last=0.0;
+
+  // Results of the state in the given checkpoint group
+  auto save_state=[&](const std::string & grp) {
+    chkpt.create_group(grp);
+    chkpt.write(grp + "/Q",Q);
+    chkpt.write(grp + "/M",M);
+    chkpt.write(grp + "/nela",nela);
+    chkpt.write(grp + "/nelb",nelb);
+    chkpt.write(grp + "/restricted",restr);
+    arma::vec Ecomp={Ekin, Epot, Ecoul, Exx, Exc, Eefield, Emfield, Econf, Etot, dEconf};
+    chkpt.write(grp + "/energies",arma::mat(Ecomp));
+    chkpt.write(grp + "/Pa",Pa);
+    chkpt.write(grp + "/Pb",Pb);
+    chkpt.write(grp + "/Ca",arma::mat(arma::join_rows(Caocc,Cavirt)));
+    chkpt.write(grp + "/Cb",arma::mat(arma::join_rows(Cbocc,Cbvirt)));
+    chkpt.write(grp + "/Ea",arma::mat(Ea));
+    chkpt.write(grp + "/Eb",arma::mat(Eb));
+  };
+  // Orbitals of the state in the given checkpoint group, split by the current occupations
+  auto load_orbitals=[&](const std::string & grp) {
+    arma::mat Ca, Cb, Eam, Ebm;
+    chkpt.read(grp + "/Ca",Ca);
+    chkpt.read(grp + "/Cb",Cb);
+    chkpt.read(grp + "/Ea",Eam);
+    chkpt.read(grp + "/Eb",Ebm);
+    Ea=arma::vectorise(Eam);
+    Eb=arma::vectorise(Ebm);
+    if(Ca.n_cols<(size_t) nela || Cb.n_cols<(size_t) nelb)
+      throw std::runtime_error("Not enough orbitals in the reference state!\n");
+    Caocc=Ca.cols(0,nela-1);
+    Cavirt=(Ca.n_cols>(size_t) nela) ? arma::mat(Ca.cols(nela,Ca.n_cols-1)) : arma::mat(Ca.n_rows,0);
+    Cbocc=nelb ? arma::mat(Cb.cols(0,nelb-1)) : arma::mat();
+    Cbvirt=(Cb.n_cols>(size_t) nelb) ? arma::mat(Cb.cols(nelb,Cb.n_cols-1)) : arma::mat(Cb.n_rows,0);
+  };
+
+  // Checkpoint groups of the neutral at each omega of the tuning
+  std::vector<size_t> omega_groups;
+  for(size_t iR=iRstart;iR<nscan+states.size();iR++) {
+    if(iR>=nscan) {
+      // A further charge or spin state. The one-electron matrices, the
+      // two-electron integrals and the DFT grid are reused, and the SCF
+      // is started from the last solution of the same state, or from
+      // the orbitals of the reference state
+      const size_t is(iR-nscan);
+      Q=states[is].first;
+      M=states[is].second;
+      if(states_omega[is]!=omega) {
+        // Only the range-separated integrals depend on omega
+        omega=states_omega[is];
+        printf("\n**** Range-separation parameter omega = % .8f ****\n\n",omega);
+        xpars=set_range_separation(x_func,xpars,omega);
+        timer.set();
+        rs_integrals();
+        printf("Range-separated integrals formed in %.6f\n",timer.get());
+      }
+      nela=nelb=0;
+      scf::parse_nela_nelb(nela,nelb,Q,M,Z+Zl+Zr);
+      if(nela<1)
+        throw std::logic_error("Further states must have at least one electron!\n");
+      restr=(restr_states==-1) ? (nela==nelb) : restr_states;
+      printf("\n**** State Q = %i, M = %i: %s calculation with %i alpha and %i beta electrons ****\n\n",Q,M,rcalc[restr].c_str(),nela,nelb);
+      if(!(resume && iR==iRstart)) {
+        std::string guess("state_0");
+        for(size_t js=is;js>0;js--)
+          if(states[js-1]==states[is]) {
+            std::ostringstream oss;
+            oss << "state_" << js;
+            guess=oss.str();
+            break;
+          }
+        load_orbitals(guess);
+        diis.clear();
+        // Force a full Fock build
+        J_ref.reset();
+        Eold=0.0;
+      }
+    } else if(iR>0 && fieldscan) {
+      // Only the field coupling changes; the one-electron matrices,
+      // the two-electron integrals and the DFT grid are reused, and the
+      // SCF is started from the previous orbitals and DIIS history
+      Ez=Ez_list(iR);
+      Qzz=Qzz_list(iR);
+      printf("\n**** Electric field Ez = % .6e, Qzz = % .6e ****\n\n",Ez,Qzz);
+      electric_coupling();
+      H0=T+Vnuc;
+      add_couplings(H0,true);
+      write_derived("H0",H0);
+    } else if(iR>0) {
+      // Only the confinement potential changes; the basis set, the
+      // two-electron integrals and the DFT grid are reused, and the
+      // SCF is started from the previous orbitals and DIIS history
+      conf_R=conf_R_list(iR);
+      printf("\n**** Confinement radius % .6f ****\n\n",conf_R);
+      timer.set();
+      Vconf=basis.confinement(conf_N, conf_R, iconf);
+      write_derived("Vconf",Vconf);
+      H0=T+Vnuc;
+      add_couplings(H0,true);
+      write_derived("H0",H0);
+      printf("Confinement potential formed in %.6f\n",timer.get());
+    }
 
-    chkpt.write("P",P);
-    chkpt.write("Pa",Pa);
-    chkpt.write("Pb",Pb);
+    // Quasi-Newton orbital rotations, taken over once DIIS stalls
+    PreconditionedLBFGS qn;
+    arma::vec qn_x;
+    bool qn_active=false, qn_prev=false;
+    int qn_nostall=0;
+    double qn_best=DBL_MAX, qn_trust=qn_step;
+
+    // Smeared occupations and the orbitals carrying them. The first
+    // iteration uses the integer occupations of the guess.
+    scf::FermiSmearing smear(smearing);
+    if(smear.active() && restr && nela!=nelb)
+      throw std::logic_error("Fermi smearing is not available for restricted open-shell calculations!\n");
+    arma::vec occa, occb;
+    arma::mat Casmear, Cbsmear;
+    double Esmear=0.0;
+
+    for(int i=istart;i<=maxit;i++) {
+      printf("\n**** Iteration %i ****\n\n",i);
+      profiler::Region rscf("scf");
+
+      // Form density matrix
+      bool smeared(smear.active() && Casmear.n_cols);
+      if(smeared) {
+        Pa=scf::form_density(Casmear,occa);
+        Pb=scf::form_density(Cbsmear,occb);
+      } else {
+        Pa=scf::form_density(Caocc,nela);
+        Pb=scf::form_density(Cbocc,nelb);
+      }
+      if(Pb.n_rows == 0)
+        Pb.zeros(Pa.n_rows,Pa.n_cols);
+      P=Pa+Pb;
 
-    printf("Tr Pa = %f\n",arma::trace(Pa*S));
-    if(nelb)
-      printf("Tr Pb = %f\n",arma::trace(Pb*S));
-    fflush(stdout);
-
-    Ekin=arma::trace(P*T);
-    Epot=arma::trace(P*Vnuc);
-    Eefield=arma::trace(P*Vel);
-    Emfield=arma::trace(P*Vmag)-Bz/2.0*(nela-nelb);
-    Econf=arma::trace(P*Vconf);
-
-    // Form Coulomb matrix
-    timer.set();
-    arma::mat J(basis.coulomb(P));
-    double tJ(timer.get());
-    Ecoul=0.5*arma::trace(P*J);
-    printf("Coulomb energy %.10e % .6f\n",Ecoul,tJ);
-    fflush(stdout);
-
-    chkpt.write("J",J);
-
-    // Form exchange matrix
-    timer.set();
-    arma::mat Ka, Kb;
-    if(kfrac!=0.0 || kshort!=0.0) {
-      Ka.zeros(Caocc.n_rows,Caocc.n_rows);
-      Kb.zeros(Caocc.n_rows,Caocc.n_rows);
-      if(kfrac!=0.0)
-        Ka+=kfrac*basis.exchange(Pa);
-      if(omega!=0.0)
-        Ka+=kshort*basis.rs_exchange(Pa);
-
-      if(nelb) {
+      chkwriter.write("P",P,!chkpt_compact);
+      chkwriter.write("Pa",Pa,!chkpt_compact);
+      chkwriter.write("Pb",Pb,!chkpt_compact);
+
+      printf("Tr Pa = %f\n",arma::trace(Pa*S));
+      if(nelb)
+        printf("Tr Pb = %f\n",arma::trace(Pb*S));
+      fflush(stdout);
+
+      Ekin=arma::trace(P*T);
+      Epot=arma::trace(P*Vnuc);
+      Eefield=coupling_energy(P,Vel);
+      Emfield=coupling_energy(P,Vmag)-Bz/2.0*(nela-nelb);
+      Econf=coupling_energy(P,Vconf);
+
+      // Incremental or full build?
+      bool incr(incfock>0 && J_ref.n_elem && nincr<incfock);
+      if(incr) {
+        nincr++;
+        printf("Incremental Fock build %i of %i\n",nincr,incfock);
+      } else
+        nincr=0;
+      arma::mat dPa(incr ? arma::mat(Pa-Pa_ref) : Pa);
+      arma::mat dPb(incr ? arma::mat(Pb-Pb_ref) : Pb);
+
+      // The Coulomb, exchange and exchange-correlation builds are
+      // independent, and may be run concurrently
+      arma::mat J, Ka, Kb, XCa, XCb;
+      bool dok(kfrac!=0.0 || kshort!=0.0);
+      double tJ=0.0, tK=0.0, txc=0.0;
+      double nelnum=0.0, ekin=0.0;
+      Exc=0.0;
+      std::vector< std::function<void()> > builds;
+
+      // Form Coulomb matrix
+      builds.push_back([&]() {
+        Timer tbuild;
+        profiler::Region rJ("J");
+        J=basis.coulomb(dPa+dPb);
+        if(incr)
+          J+=J_ref;
+        rJ.stop();
+        tJ=tbuild.get();
+      });
+
+      // Form exchange matrix
+      if(dok)
+        builds.push_back([&]() {
+          Timer tbuild;
+          profiler::Region rK("K");
+          Ka.zeros(Caocc.n_rows,Caocc.n_rows);
+          Kb.zeros(Caocc.n_rows,Caocc.n_rows);
+
+          // Densities to contract
+          std::vector<arma::mat> Pk;
+          Pk.push_back(dPa);
+          bool beta(nelb && !(restr && nela==nelb));
+          if(beta)
+            Pk.push_back(dPb);
+
+          // The NUMA partitioned contraction is only available separately
+          if(!numa && (Pk.size()>1 || (kfrac!=0.0 && omega!=0.0))) {
+            // Both spins and both kernels in a single pass
+            std::vector<arma::mat> Kk(basis.exchange_multi(Pk,kfrac,(omega!=0.0) ? kshort : 0.0));
+            Ka+=Kk[0];
+            if(beta)
+              Kb+=Kk[1];
+          } else {
+            if(kfrac!=0.0)
+              Ka+=kfrac*basis.exchange(dPa);
+            if(omega!=0.0)
+              Ka+=kshort*basis.rs_exchange(dPa);
+            if(beta) {
+              if(kfrac!=0.0)
+                Kb+=kfrac*basis.exchange(dPb);
+              if(omega!=0.0)
+                Kb+=kshort*basis.rs_exchange(dPb);
+            }
+          }
+          if(incr)
+            Ka+=Ka_ref;
+
+          if(nelb) {
+            if(!beta)
+              Kb=Ka;
+            else if(incr)
+              Kb+=Kb_ref;
+          }
+          rK.stop();
+          tK=tbuild.get();
+        });
+
+      // Exchange-correlation
+      if(dft)
+        builds.push_back([&]() {
+          Timer tbuild;
+          profiler::Region rxc("XC");
+          if(restr && nela==nelb) {
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, P, XCa, Exc, nelnum, ekin, dftthr);
+            XCb=XCa;
+          } else {
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa, Pb, XCa, XCb, Exc, nelnum, ekin, nelb>0, dftthr);
+          }
+          rxc.stop();
+          txc=tbuild.get();
+        });
+
+      if(concurrent && builds.size()>1) {
+        // The threads are divided by the timings of the last
+        // iteration; the first iteration is run sequentially
+        std::vector<double> weights;
+        weights.push_back(tJ_last);
+        if(dok)
+          weights.push_back(tK_last);
+        if(dft)
+          weights.push_back(txc_last);
+        threading::run_concurrently(builds, weights);
+      } else
+        for(size_t ib=0;ib<builds.size();ib++)
+          builds[ib]();
+      tJ_last=tJ;
+      tK_last=tK;
+      txc_last=txc;
+
+      Ecoul=0.5*arma::trace(P*J);
+      printf("Coulomb energy %.10e % .6f\n",Ecoul,tJ);
+      fflush(stdout);
+
+      chkwriter.write("J",J);
+
+      if(dok) {
+        Exx=0.5*arma::trace(Pa*Ka);
+        if(Kb.n_rows == Pb.n_rows && Kb.n_cols == Pb.n_cols)
+          Exx+=0.5*arma::trace(Pb*Kb);
+        printf("Exchange energy %.10e % .6f\n",Exx,tK);
+        if(kscreen>0.0)
+          printf("Exchange screening skipped %.1f %% of element blocks\n",100.0*basis.get_exchange_screening_fraction());
+      } else {
+        Exx=0.0;
+      }
+      fflush(stdout);
+
+      chkwriter.write("Ka",Ka);
+      chkwriter.write("Kb",Kb);
+
+      // Update the reference for incremental builds
+      if(incfock>0) {
+        Pa_ref=Pa;
+        Pb_ref=Pb;
+        J_ref=J;
+        Ka_ref=Ka;
+        Kb_ref=Kb;
+      }
+
+      if(dft) {
+        printf("DFT energy %.10e % .6f\n",Exc,txc);
+        printf("Error in integrated number of electrons % e\n",nelnum-nela-nelb);
+        if(ekin!=0.0)
+          printf("Error in integral of kinetic energy density % e\n",ekin-Ekin);
+      }
+      fflush(stdout);
+      chkwriter.write("XCa",XCa);
+      chkwriter.write("XCb",XCb);
+
+      // Fock matrices
+      arma::mat Fa(H0+J);
+      arma::mat Fb(H0+J);
+      if(Ka.n_rows == Fa.n_rows) {
+        Fa+=Ka;
+      }
+      if(Kb.n_rows == Fb.n_rows) {
+        Fb+=Kb;
+      }
+      if(dft) {
+        Fa+=XCa;
+        if(nelb>0) {
+          Fb+=XCb;
+        }
+      }
+      if(Bz!=0.0) {
+        // Add in the B*Sz term
+        Fa-=Bz*S/2.0;
+        Fb+=Bz*S/2.0;
+      }
+
+      // m averaging and enforcement of the symmetry of the Fock matrix
+      fock_symm.apply(Fa);
+      fock_symm.apply(Fb);
+
+      // ROHF update to Fock matrix
+      if(restr && nela!=nelb)
+        scf::ROHF_update(Fa,Fb,P,Sh,Sinvh,nela,nelb);
+
+      chkwriter.write("Fa",Fa);
+      chkwriter.write("Fb",Fb);
+
+      // Update energy
+      Etot=Ekin+Epot+Eefield+Emfield+Ecoul+Exx+Exc+Enucr+Econf;
+      double dE=Etot-Eold;
+
+      if(smeared)
+        printf("Smearing temperature %e, -TS = % .10e\n",smear.temperature(),Esmear);
+      printf("Total energy is % .10f\n",Etot);
+      if(i>1)
+        printf("Energy changed by %e\n",dE);
+      Eold=Etot;
+      fflush(stdout);
+
+      /*
+        S.print("S");
+        T.print("T");
+        Vnuc.print("Vnuc");
+        Ca.print("Ca");
+        Pa.print("Pa");
+        J.print("J");
+        Ka.print("Ka");
+
+        arma::mat Jmo(Ca.t()*J*Ca);
+        arma::mat Kmo(Ca.t()*Ka*Ca);
+        Jmo.submat(0,0,10,10).print("Jmo");
+        Kmo.submat(0,0,10,10).print("Kmo");
+
+
+        Kmo+=Jmo;
+        Kmo.print("Jmo+Kmo");
+
+        Fa.print("Fa");
+        arma::mat Fao(Sinvh.t()*Fa*Sinvh);
+        Fao.print("Fao");
+        Sinvh.print("Sinvh");
+      */
+
+      /*
+        arma::mat Jmo(Ca.t()*J*Ca);
+        arma::mat Kmo(Ca.t()*Ka*Ca);
+        arma::mat Fmo(Ca.t()*Fa*Ca);
+        Jmo=Jmo.submat(0,0,4,4);
+        Kmo=Kmo.submat(0,0,4,4);
+        Fmo=Fmo.submat(0,0,4,4);
+        Jmo.print("J");
+        Kmo.print("K");
+        Fmo.print("F");
+      */
+
+      // Fock and density matrices in the orthonormal basis. The density
+      // is formed from the occupied orbitals, so only one N^3 product
+      // per spin is needed for the Fock matrix.
+      arma::mat Foa, Fob, Poa, Pob;
+      if(orth_scf) {
+        Foa=Sinvh.t()*Fa*Sinvh;
+        if(smeared)
+          Poa=scf::form_density(arma::mat(SSinvh.t()*Casmear),occa);
+        else
+          Poa=nela ? scf::form_density(arma::mat(SSinvh.t()*Caocc),nela) : arma::zeros<arma::mat>(Foa.n_rows,Foa.n_cols);
         if(restr && nela==nelb) {
-          Kb=Ka;
+          Fob=Foa;
+          Pob=Poa;
         } else {
-          if(kfrac!=0.0)
-            Kb+=kfrac*basis.exchange(Pb);
-          if(omega!=0.0)
-            Kb+=kshort*basis.rs_exchange(Pb);
+          Fob=Sinvh.t()*Fb*Sinvh;
+          if(smeared)
+            Pob=scf::form_density(arma::mat(SSinvh.t()*Cbsmear),occb);
+          else
+            Pob=nelb ? scf::form_density(arma::mat(SSinvh.t()*Cbocc),nelb) : arma::zeros<arma::mat>(Fob.n_rows,Fob.n_cols);
         }
       }
 
-      double tK(timer.get());
-      Exx=0.5*arma::trace(Pa*Ka);
-      if(Kb.n_rows == Pb.n_rows && Kb.n_cols == Pb.n_cols)
-        Exx+=0.5*arma::trace(Pb*Kb);
-      printf("Exchange energy %.10e % .6f\n",Exx,tK);
-    } else {
-      Exx=0.0;
-    }
-    fflush(stdout);
+      // Update DIIS
+      timer.set();
+      profiler::Region rdiis("DIIS");
+      if(orth_scf)
+        diis.update(Foa,Fob,Poa,Pob,Etot,diiserr);
+      else
+        diis.update(Fa,Fb,Pa,Pb,Etot,diiserr);
+      printf("DIIS error is %e, update done in %.6f\n",diiserr,timer.get());
+      fflush(stdout);
 
-    chkpt.write("Ka",Ka);
-    chkpt.write("Kb",Kb);
+      // The quasi-Newton step needs the Fock matrices of the current orbitals
+      arma::mat Fa_scf, Fb_scf;
+      if(qn_stall>0) {
+        Fa_scf=Fa;
+        Fb_scf=Fb;
+      }
 
-    // Exchange-correlation
-    Exc=0.0;
-    arma::mat XCa, XCb;
-    if(dft) {
+      // Solve DIIS to get Fock update
       timer.set();
-      double nelnum;
-      double ekin;
-      if(restr && nela==nelb) {
-        grid.eval_Fxc(x_func, xpars, c_func, cpars, P, XCa, Exc, nelnum, ekin, dftthr);
-        XCb=XCa;
-      } else {
-        grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa, Pb, XCa, XCb, Exc, nelnum, ekin, nelb>0, dftthr);
+      // The orthonormal Fock matrices are diagonalized directly unless
+      // damping, the Davidson or the symmetry-adapted solver is used
+      bool orth_diag=orth_scf && !symm && davidson==0 && !(dampfock != 1.0 && diiserr >= dampthr);
+      if(orth_scf) {
+        diis.solve_F(Foa,Fob);
+        if(!orth_diag) {
+          Fa=SSinvh*Foa*SSinvh.t();
+          Fb=SSinvh*Fob*SSinvh.t();
+        }
+      } else
+        diis.solve_F(Fa,Fb);
+      rdiis.stop();
+      printf("DIIS solution done in %.6f\n",timer.get());
+      fflush(stdout);
+
+      // Have we converged? Note that DIIS error is still wrt full space,
+      // not active space. The smearing has to be fully annealed first.
+      bool convd=(diiserr<convthr) && (std::abs(dE)<convthr) && (!smear.active() || smear.annealed());
+
+      // Switch to double precision integrals; the SCF must not
+      // converge with single precision integrals
+      if(basis.get_single_precision() && (diiserr<sp_thr || convd)) {
+        printf("Switching to double precision integrals\n");
+        basis.set_single_precision(false);
+        // Force a full Fock build
+        J_ref.reset();
+        convd=false;
       }
-      double txc(timer.get());
-      printf("DFT energy %.10e % .6f\n",Exc,txc);
-      printf("Error in integrated number of electrons % e\n",nelnum-nela-nelb);
-      if(ekin!=0.0)
-        printf("Error in integral of kinetic energy density % e\n",ekin-Ekin);
-    }
-    fflush(stdout);
-    chkpt.write("XCa",XCb);
-    chkpt.write("XCb",XCb);
-
-    // Fock matrices
-    arma::mat Fa(H0+J);
-    arma::mat Fb(H0+J);
-    if(Ka.n_rows == Fa.n_rows) {
-      Fa+=Ka;
-    }
-    if(Kb.n_rows == Fb.n_rows) {
-      Fb+=Kb;
-    }
-    if(dft) {
-      Fa+=XCa;
-      if(nelb>0) {
-        Fb+=XCb;
+
+      // Quasi-Newton step? This needs all the orbitals, and is not
+      // available for ROHF
+      bool qnstep=false;
+      if(qn_stall>0 && !convd && i>=readocc && !smear.active() && !(restr && nela!=nelb) && nela>0 && Cavirt.n_cols>0 && Caocc.n_cols+Cavirt.n_cols==Sinvh.n_cols) {
+        if(diiserr<qn_best) {
+          qn_best=diiserr;
+          qn_nostall=0;
+        } else
+          qn_nostall++;
+        if(!qn_active && qn_nostall>=qn_stall) {
+          printf("DIIS has stalled, switching to quasi-Newton orbital rotations\n");
+          qn_active=true;
+        }
+        qnstep=qn_active;
+      }
+      if(qnstep && qn_prev && dE>0.0) {
+        // The last step went uphill: restart the history with a smaller trust radius
+        qn_trust*=0.5;
+        qn.clear();
+        qn_x.reset();
+        printf("Energy increased, quasi-Newton trust radius reduced to %e\n",qn_trust);
+      }
+      qn_prev=qnstep;
+
+      // Damping? This needs all the orbitals, which the Davidson solver
+      // doesn't produce
+      bool damped=(!qnstep && !smear.active() && dampfock != 1.0 && diiserr >= dampthr);
+      if(damped && Caocc.n_cols+Cavirt.n_cols==Sinvh.n_cols) {
+        printf("Damping off-diagonal elements of Fock matrix by % .3f\n",dampfock);
+        if(nela && Fa.n_rows > (size_t) nela) {
+          arma::mat Ca(arma::join_rows(Caocc, Cavirt));
+          arma::mat focka_mo(Ca.t()*Fa*Ca);
+          focka_mo.submat(0,nela,nela-1,focka_mo.n_rows-1) *= dampfock;
+          focka_mo.submat(nela,0,focka_mo.n_rows-1,nela-1) *= dampfock;
+          Fa = S*Ca*focka_mo*Ca.t()*S;
+        }
+        if(nelb && Fb.n_rows > (size_t) nelb) {
+          arma::mat Cb(arma::join_rows(Cbocc, Cbvirt));
+          arma::mat fockb_mo(Cb.t()*Fb*Cb);
+          fockb_mo.submat(0,nelb,nelb-1,fockb_mo.n_rows-1) *= dampfock;
+          fockb_mo.submat(nelb,0,fockb_mo.n_rows-1,nelb-1) *= dampfock;
+          Fb = S*Cb*fockb_mo*Cb.t()*S;
+        }
       }
-    }
-    if(Bz!=0.0) {
-      // Add in the B*Sz term
-      Fa-=Bz*S/2.0;
-      Fb+=Bz*S/2.0;
-    }
 
-    // m averaging?
-    if(maverage) {
-      Fa=scf::fock_symmetry_average(Fa,l_idx);
-      Fb=scf::fock_symmetry_average(Fb,l_idx);
-    }
-    // Enforce symmetry of Fock matrix
-    if(symm) {
-      Fa=scf::enforce_fock_symmetry(Fa,dsym);
-      Fb=scf::enforce_fock_symmetry(Fb,dsym);
-    }
+      // Diagonalize Fock matrix to get new orbitals
+      timer.set();
+      profiler::Region rdiag("diag");
+      arma::mat Ca, Cb;
+      // The lowest orbitals can be solved iteratively, starting from the
+      // orbitals of the previous iteration
+      bool iterative=(!qnstep && davidson>0 && !damped && i>=readocc);
+      if(qnstep) {
+        // Gradient wrt the virtual-occupied rotations of both spins
+        bool rclosed(restr && nela==nelb);
+        Ca=arma::join_rows(Caocc,Cavirt);
+        arma::mat Fmoa(Ca.t()*Fa_scf*Ca);
+        arma::mat Fmob;
+        size_t nrota(Cavirt.n_cols*nela), nrotb(0);
+        bool rotb(!rclosed && nelb>0 && Cbvirt.n_cols>0);
+        if(rotb) {
+          Cb=arma::join_rows(Cbocc,Cbvirt);
+          Fmob=Cb.t()*Fb_scf*Cb;
+          nrotb=Cbvirt.n_cols*nelb;
+        } else if(!rclosed) {
+          Cb=arma::join_rows(Cbocc,Cbvirt);
+        }
 
-    // ROHF update to Fock matrix
-    if(restr && nela!=nelb)
-      scf::ROHF_update(Fa,Fb,P,Sh,Sinvh,nela,nelb);
-
-    chkpt.write("Fa",Fa);
-    chkpt.write("Fb",Fb);
-
-    // Update energy
-    Etot=Ekin+Epot+Eefield+Emfield+Ecoul+Exx+Exc+Enucr+Econf;
-    double dE=Etot-Eold;
-
-    printf("Total energy is % .10f\n",Etot);
-    if(i>1)
-      printf("Energy changed by %e\n",dE);
-    Eold=Etot;
-    fflush(stdout);
-
-    /*
-      S.print("S");
-      T.print("T");
-      Vnuc.print("Vnuc");
-      Ca.print("Ca");
-      Pa.print("Pa");
-      J.print("J");
-      Ka.print("Ka");
-
-      arma::mat Jmo(Ca.t()*J*Ca);
-      arma::mat Kmo(Ca.t()*Ka*Ca);
-      Jmo.submat(0,0,10,10).print("Jmo");
-      Kmo.submat(0,0,10,10).print("Kmo");
-
-
-      Kmo+=Jmo;
-      Kmo.print("Jmo+Kmo");
-
-      Fa.print("Fa");
-      arma::mat Fao(Sinvh.t()*Fa*Sinvh);
-      Fao.print("Fao");
-      Sinvh.print("Sinvh");
-    */
-
-    /*
-      arma::mat Jmo(Ca.t()*J*Ca);
-      arma::mat Kmo(Ca.t()*Ka*Ca);
-      arma::mat Fmo(Ca.t()*Fa*Ca);
-      Jmo=Jmo.submat(0,0,4,4);
-      Kmo=Kmo.submat(0,0,4,4);
-      Fmo=Fmo.submat(0,0,4,4);
-      Jmo.print("J");
-      Kmo.print("K");
-      Fmo.print("F");
-    */
-
-    // Update DIIS
-    timer.set();
-    diis.update(Fa,Fb,Pa,Pb,Etot,diiserr);
-    printf("DIIS error is %e, update done in %.6f\n",diiserr,timer.get());
-    fflush(stdout);
-
-    // Solve DIIS to get Fock update
-    timer.set();
-    diis.solve_F(Fa,Fb);
-    printf("DIIS solution done in %.6f\n",timer.get());
-    fflush(stdout);
-
-    // Have we converged? Note that DIIS error is still wrt full space, not active space.
-    bool convd=(diiserr<convthr) && (std::abs(dE)<convthr);
-
-    // Damping?
-    if(dampfock != 1.0 && diiserr >= dampthr) {
-      printf("Damping off-diagonal elements of Fock matrix by % .3f\n",dampfock);
-      if(nela && Fa.n_rows > (size_t) nela) {
-        arma::mat Ca(arma::join_rows(Caocc, Cavirt));
-        arma::mat focka_mo(Ca.t()*Fa*Ca);
-        focka_mo.submat(0,nela,nela-1,focka_mo.n_rows-1) *= dampfock;
-        focka_mo.submat(nela,0,focka_mo.n_rows-1,nela-1) *= dampfock;
-        Fa = S*Ca*focka_mo*Ca.t()*S;
+        // Rotations only mix orbitals of the same symmetry
+        arma::mat maska(scf::rotation_mask(scf::orbital_symmetries(Ca,dsym),nela));
+        arma::mat maskb;
+        if(rotb)
+          maskb=scf::rotation_mask(scf::orbital_symmetries(Cb,dsym),nelb);
+
+        arma::vec g(nrota+nrotb), h0(nrota+nrotb), mask(nrota+nrotb);
+        {
+          arma::mat ga(Fmoa.submat(nela,0,Fmoa.n_rows-1,nela-1));
+          arma::vec ea(arma::diagvec(Fmoa));
+          arma::mat ha(ga.n_rows,ga.n_cols);
+          for(size_t io=0;io<ha.n_cols;io++)
+            for(size_t iv=0;iv<ha.n_rows;iv++)
+              ha(iv,io)=std::max(ea(nela+iv)-ea(io),0.1);
+          g.subvec(0,nrota-1)=arma::vectorise(ga%maska);
+          h0.subvec(0,nrota-1)=arma::vectorise(ha);
+          mask.subvec(0,nrota-1)=arma::vectorise(maska);
+          Ea=ea;
+        }
+        if(rotb) {
+          arma::mat gb(Fmob.submat(nelb,0,Fmob.n_rows-1,nelb-1));
+          arma::vec eb(arma::diagvec(Fmob));
+          arma::mat hb(gb.n_rows,gb.n_cols);
+          for(size_t io=0;io<hb.n_cols;io++)
+            for(size_t iv=0;iv<hb.n_rows;iv++)
+              hb(iv,io)=std::max(eb(nelb+iv)-eb(io),0.1);
+          g.subvec(nrota,nrota+nrotb-1)=arma::vectorise(gb%maskb);
+          h0.subvec(nrota,nrota+nrotb-1)=arma::vectorise(hb);
+          mask.subvec(nrota,nrota+nrotb-1)=arma::vectorise(maskb);
+          Eb=eb;
+        }
+
+        // Quasi-Newton step, limited to the trust radius
+        if(qn_x.n_elem != g.n_elem) {
+          qn.clear();
+          qn_x.zeros(g.n_elem);
+        }
+        qn.set_diagonal(h0);
+        qn.update(qn_x,g);
+        arma::vec p(-qn.solve());
+        p%=mask;
+        double pmax(arma::max(arma::abs(p)));
+        if(pmax>qn_trust)
+          p*=qn_trust/pmax;
+        qn_x+=p;
+        printf("Quasi-Newton orbital rotation with largest angle %e\n",std::min(pmax,qn_trust));
+
+        Ca=scf::rotate_orbitals(Ca,arma::reshape(p.subvec(0,nrota-1),Cavirt.n_cols,nela));
+        if(rclosed) {
+          Cb=Ca;
+          Eb=Ea;
+        } else if(rotb)
+          Cb=scf::rotate_orbitals(Cb,arma::reshape(p.subvec(nrota,nrota+nrotb-1),Cbvirt.n_cols,nelb));
+      } else if(iterative) {
+        const size_t neig(std::min<size_t>(std::max(nela,nelb)+davidson,Fa.n_rows));
+        Ca=arma::join_rows(Caocc,Cavirt);
+        iterative=scf::eig_davidson(Ea,Ca,Fa,S,neig,100,davidson_thr);
+        if(restr && nela==nelb) {
+          Eb=Ea;
+          Cb=Ca;
+        } else if(iterative) {
+          Cb=arma::join_rows(Cbocc,Cbvirt);
+          iterative=scf::eig_davidson(Eb,Cb,Fb,S,neig,100,davidson_thr);
+        }
+        if(!iterative)
+          printf("Davidson solver did not converge, switching to full diagonalization\n");
       }
-      if(nelb && Fb.n_rows > (size_t) nelb) {
-        arma::mat Cb(arma::join_rows(Cbocc, Cbvirt));
-        arma::mat fockb_mo(Cb.t()*Fb*Cb);
-        fockb_mo.submat(0,nelb,nelb-1,fockb_mo.n_rows-1) *= dampfock;
-        fockb_mo.submat(nelb,0,fockb_mo.n_rows-1,nelb-1) *= dampfock;
-        Fb = S*Cb*fockb_mo*Cb.t()*S;
+      if(!iterative && !qnstep) {
+        if(orth_diag)
+          scf::eig_orth(Ea,Ca,Foa,Sinvh);
+        else if(symm)
+          symorth.eig(Ea,Ca,Fa);
+        else
+          scf::eig_gsym(Ea,Ca,Fa,Sinvh);
+        // Enforce occupation according to specified symmetry
+        if(i<readocc) {
+          scf::enforce_occupations(Ca,Ea,S,occnuma,occsym);
+        }
+
+        if(restr && nela==nelb) {
+          Eb=Ea;
+          Cb=Ca;
+        } else {
+          if(orth_diag)
+            scf::eig_orth(Eb,Cb,Fob,Sinvh);
+          else if(symm)
+            symorth.eig(Eb,Cb,Fb);
+          else
+            scf::eig_gsym(Eb,Cb,Fb,Sinvh);
+        }
+        // Enforce occupation according to specified symmetry
+        if(i<readocc) {
+          scf::enforce_occupations(Cb,Eb,S,occnumb,occsym);
+        }
+      }
+
+      chkwriter.write("Ca",Ca,true);
+      chkwriter.write("Cb",Cb,true);
+      chkwriter.write("Ea",Ea,true);
+      chkwriter.write("Eb",Eb,true);
+
+      Caocc=Ca.cols(0,nela-1);
+      if(Ca.n_cols>(size_t) nela)
+        Cavirt=Ca.cols(nela,Ca.n_cols-1);
+      if(nelb>0)
+        Cbocc=Cb.cols(0,nelb-1);
+      if(Cb.n_cols>(size_t) nelb)
+        Cbvirt=Cb.cols(nelb,Cb.n_cols-1);
+
+      // Smeared occupations of the new orbitals, after which the
+      // temperature is lowered
+      if(smear.active()) {
+        occa=smear.occupations(Ea,nela);
+        Casmear=Ca.cols(0,occa.n_elem-1);
+        occb=smear.occupations(Eb,nelb);
+        Cbsmear=occb.n_elem ? arma::mat(Cb.cols(0,occb.n_elem-1)) : arma::mat(Ca.n_rows,0);
+        Esmear=smear.entropy_energy(occa)+smear.entropy_energy(occb);
+        printf("Smearing occupies %i alpha and %i beta orbitals\n",(int) occa.n_elem,(int) occb.n_elem);
+        if(smear.anneal_step()) {
+          printf("Smearing annealed, switching to integer occupations\n");
+          diis.clear();
+        }
+      }
+      rdiag.stop();
+      if(qnstep)
+        printf("Quasi-Newton step done in %.6f\n",timer.get());
+      else if(iterative)
+        printf("Davidson solution done in %.6f\n",timer.get());
+      else if(symm)
+        printf("Subspace diagonalization done in %.6f\n",timer.get());
+      else
+        printf("Full diagonalization done in %.6f\n",timer.get());
+
+      if(Ea.n_elem>(size_t)nela)
+        printf("Alpha HOMO-LUMO gap is % .3f eV\n",(Ea(nela)-Ea(nela-1))*HARTREEINEV);
+      if(nelb && Eb.n_elem>(size_t)nelb)
+        printf("Beta  HOMO-LUMO gap is % .3f eV\n",(Eb(nelb)-Eb(nelb-1))*HARTREEINEV);
+      fflush(stdout);
+
+      printf("\n");
+      printf("Alpha orbital symmetries\n");
+      classify_orbitals(Caocc,lvals,mvals,lmidx);
+      if(nelb>0) {
+        printf("\n");
+        printf("Beta orbital symmetries\n");
+        classify_orbitals(Cbocc,lvals,mvals,lmidx);
       }
+      printf("\n");
+
+      // State needed to resume the SCF
+      chkwriter.write("scf_iter",i,true);
+      chkwriter.write("scf_iR",(int) iR,true);
+      chkwriter.write("scf_Eold",Eold,true);
+      chkwriter.write("scf_single_precision",basis.get_single_precision(),true);
+      chkwriter.write("scf_orthonormal",orth_scf,true);
+      profiler::Region rchk("checkpoint");
+      if(!chkpt_compact)
+        chkwriter.write_diis("diis",diis,true);
+      chkwriter.iteration(i);
+      rchk.stop();
+      rscf.stop();
+      profiler::print_iteration(i);
+      if(convd)
+        break;
+    }
+    // Make sure the final matrices are on disk
+    chkwriter.finish();
+    // The following radii start from the first iteration
+    istart=1;
+
+    if(confined) {
+      // Hellmann-Feynman derivative of the energy wrt the confinement radius
+      dEconf=arma::trace(P*basis.confinement_derivative(conf_N, conf_R, iconf));
+      printf("Energy derivative wrt confinement radius % .10e\n",dEconf);
+      printf("Pressure -dE/dV at confinement radius % .10e\n",-dEconf/(4.0*M_PI*conf_R*conf_R));
+      fflush(stdout);
     }
 
-    // Diagonalize Fock matrix to get new orbitals
-    timer.set();
-    arma::mat Ca, Cb;
-    if(symm)
-      scf::eig_gsym_sub(Ea,Ca,Fa,Sinvh,dsym);
-    else
-      scf::eig_gsym(Ea,Ca,Fa,Sinvh);
-    // Enforce occupation according to specified symmetry
-    if(i<readocc) {
-      scf::enforce_occupations(Ca,Ea,S,occnuma,occsym);
+    if(confscan) {
+      // Save results for this radius in a separate group
+      std::ostringstream oss;
+      oss << "conf_R_" << iR;
+      std::string grp(oss.str());
+      chkpt.create_group(grp);
+      chkpt.write(grp + "/conf_R",conf_R);
+      chkpt.write(grp + "/Etot",Etot);
+      chkpt.write(grp + "/Econf",Econf);
+      chkpt.write(grp + "/dEconf",dEconf);
+      chkpt.write(grp + "/Pa",Pa);
+      chkpt.write(grp + "/Pb",Pb);
+      chkpt.write(grp + "/Ca",arma::mat(arma::join_rows(Caocc,Cavirt)));
+      chkpt.write(grp + "/Cb",arma::mat(arma::join_rows(Cbocc,Cbvirt)));
+      chkpt.write(grp + "/Ea",arma::mat(Ea));
+      chkpt.write(grp + "/Eb",arma::mat(Eb));
+
+      confscan_E(iR,0)=conf_R;
+      confscan_E(iR,1)=Etot;
+      confscan_E(iR,2)=Econf;
+      confscan_E(iR,3)=dEconf;
     }
 
-    if(restr && nela==nelb) {
-      Eb=Ea;
-      Cb=Ca;
-    } else {
-      if(symm)
-        scf::eig_gsym_sub(Eb,Cb,Fb,Sinvh,dsym);
-      else
-        scf::eig_gsym(Eb,Cb,Fb,Sinvh);
+    if(fieldscan) {
+      fieldscan_E(iR,0)=Ez;
+      fieldscan_E(iR,1)=Qzz;
+      fieldscan_E(iR,2)=Etot;
+      fieldscan_E(iR,3)=arma::trace(P*dip);
+      fieldscan_E(iR,4)=arma::trace(P*quad);
+
+      // Save results for this field in a separate group
+      std::ostringstream oss;
+      oss << "field_" << iR;
+      std::string grp(oss.str());
+      chkpt.create_group(grp);
+      chkpt.write(grp + "/result",arma::mat(fieldscan_E.row(iR)));
+      chkpt.write(grp + "/Pa",Pa);
+      chkpt.write(grp + "/Pb",Pb);
     }
-    // Enforce occupation according to specified symmetry
-    if(i<readocc) {
-      scf::enforce_occupations(Cb,Eb,S,occnumb,occsym);
+
+    if(states.size()) {
+      // The reference state is stored as state_0
+      std::ostringstream oss;
+      oss << "state_" << ((iR>=nscan) ? iR-nscan+1 : 0);
+      save_state(oss.str());
     }
 
-    chkpt.write("Ca",Ca);
-    chkpt.write("Cb",Cb);
-    chkpt.write("Ea",Ea);
-    chkpt.write("Eb",Eb);
+    if(omega_tuning.active() && iR>=nscan && states[iR-nscan]==omega_ion) {
+      // The neutral at this omega was solved just before the ion
+      std::ostringstream oss;
+      oss << "state_" << iR-nscan;
+      std::string grp(oss.str());
+      int nelan, nelbn;
+      arma::mat En, Ean, Ebn;
+      chkpt.read(grp + "/nela",nelan);
+      chkpt.read(grp + "/nelb",nelbn);
+      chkpt.read(grp + "/energies",En);
+      chkpt.read(grp + "/Ea",Ean);
+      chkpt.read(grp + "/Eb",Ebn);
+      double ehomo(Ean(nelan-1));
+      if(nelbn)
+        ehomo=std::max(ehomo,Ebn(nelbn-1));
+      omega_tuning.add(omega,En(8),Etot,ehomo);
+      omega_groups.push_back(iR-nscan);
+
+      double omega_next;
+      if(omega_tuning.next(omega_next)) {
+        states.push_back(omega_neutral);
+        states_omega.push_back(omega_next);
+        states.push_back(omega_ion);
+        states_omega.push_back(omega_next);
+      }
+    }
+  }
 
-    Caocc=Ca.cols(0,nela-1);
-    if(Ca.n_cols>(size_t) nela)
-      Cavirt=Ca.cols(nela,Ca.n_cols-1);
-    if(nelb>0)
-      Cbocc=Cb.cols(0,nelb-1);
-    if(Cb.n_cols>(size_t) nelb)
-      Cbvirt=Cb.cols(nelb,Cb.n_cols-1);
-    if(symm)
-      printf("Subspace diagonalization done in %.6f\n",timer.get());
-    else
-      printf("Full diagonalization done in %.6f\n",timer.get());
+  if(states.size()) {
+    // Summary of the states: Q, M, Etot, and the energy relative to the reference state
+    arma::mat states_E(states.size()+1,4);
+    for(size_t is=0;is<=states.size();is++) {
+      std::ostringstream oss;
+      oss << "state_" << is;
+      std::string grp(oss.str());
+      int Qs, Ms;
+      arma::mat E;
+      chkpt.read(grp + "/Q",Qs);
+      chkpt.read(grp + "/M",Ms);
+      chkpt.read(grp + "/energies",E);
+      states_E(is,0)=Qs;
+      states_E(is,1)=Ms;
+      states_E(is,2)=E(8);
+      states_E(is,3)=E(8)-states_E(0,2);
+    }
+    printf("\nCharge and spin states\n");
+    printf("%4s %4s %20s %20s %14s\n","Q","M","Etot","Etot-Eref","Etot-Eref (eV)");
+    for(size_t is=0;is<states_E.n_rows;is++)
+      printf("%4i %4i % 20.10f % 20.10f % 14.6f\n",(int) states_E(is,0),(int) states_E(is,1),states_E(is,2),states_E(is,3),states_E(is,3)*HARTREEINEV);
+    chkpt.write("states",states_E);
+    printf("\n");
 
-    if(Ea.n_elem>(size_t)nela)
-      printf("Alpha HOMO-LUMO gap is % .3f eV\n",(Ea(nela)-Ea(nela-1))*HARTREEINEV);
-    if(nelb && Eb.n_elem>(size_t)nelb)
-      printf("Beta  HOMO-LUMO gap is % .3f eV\n",(Eb(nelb)-Eb(nelb-1))*HARTREEINEV);
-    fflush(stdout);
+    // The analysis below is done for the reference state; with the
+    // tuning, for the neutral at the best omega
+    size_t iref(0);
+    if(omega_tuning.active()) {
+      omega_tuning.print();
+      arma::mat tab(omega_tuning.table());
+      chkpt.write("omega_scan",tab);
+      double wopt(omega_tuning.optimum());
+      chkpt.write("omega_tuned",wopt);
+      for(size_t i=0;i<tab.n_rows;i++)
+        if(tab(i,0)==wopt)
+          iref=omega_groups[i];
+      if(wopt!=omega) {
+        omega=wopt;
+        xpars=set_range_separation(x_func,xpars,omega);
+        rs_integrals();
+      }
+    }
+    std::ostringstream ossref;
+    ossref << "state_" << iref;
+    std::string grp(ossref.str());
+    chkpt.read(grp + "/Q",Q);
+    chkpt.read(grp + "/M",M);
+    chkpt.read(grp + "/nela",nela);
+    chkpt.read(grp + "/nelb",nelb);
+    chkpt.read(grp + "/restricted",restr);
+    arma::mat E;
+    chkpt.read(grp + "/energies",E);
+    Ekin=E(0); Epot=E(1); Ecoul=E(2); Exx=E(3); Exc=E(4);
+    Eefield=E(5); Emfield=E(6); Econf=E(7); Etot=E(8); dEconf=E(9);
+    chkpt.read(grp + "/Pa",Pa);
+    chkpt.read(grp + "/Pb",Pb);
+    P=Pa+Pb;
+    load_orbitals(grp);
+  }
 
+  if(confscan) {
+    printf("\nConfinement radius scan\n");
+    printf("%12s %20s %20s %20s\n","conf_R","Etot","Econf","dE/dconf_R");
+    for(size_t iR=0;iR<confscan_E.n_rows;iR++)
+      printf("%12.6f % 20.10f % 20.10f % 20.10e\n",confscan_E(iR,0),confscan_E(iR,1),confscan_E(iR,2),confscan_E(iR,3));
+    chkpt.write("confscan",confscan_E);
     printf("\n");
-    printf("Alpha orbital symmetries\n");
-    classify_orbitals(Caocc,lvals,mvals,lmidx);
-    if(nelb>0) {
-      printf("\n");
-      printf("Beta orbital symmetries\n");
-      classify_orbitals(Cbocc,lvals,mvals,lmidx);
+  }
+
+  if(fieldscan) {
+    bool dipscan(Ez_list.n_elem && arma::any(Ez_list!=Ez_list(0)));
+    arma::vec F(fieldscan_E.col(dipscan ? 0 : 1));
+    printf("\nElectric field scan\n");
+    printf("%14s %14s %20s %20s %20s\n","Ez","Qzz","Etot","<z>","<zz>");
+    for(size_t iR=0;iR<fieldscan_E.n_rows;iR++)
+      printf("% 14.6e % 14.6e % 20.10f % 20.10e % 20.10e\n",fieldscan_E(iR,0),fieldscan_E(iR,1),fieldscan_E(iR,2),fieldscan_E(iR,3),fieldscan_E(iR,4));
+    chkpt.write("fieldscan",fieldscan_E);
+
+    // Fit the Taylor series of the energy in the field
+    arma::vec dE(scf::field_derivatives(F,fieldscan_E.col(2)));
+    chkpt.write("fieldscan_derivatives",arma::mat(dE));
+    printf("\nDerivatives of the energy wrt the %s field at zero field\n",dipscan ? "dipole" : "quadrupole");
+    for(size_t k=0;k<dE.n_elem;k++)
+      printf("d^%iE/dF^%i = % .10e\n",(int) k,(int) k,dE(k));
+    if(dipscan) {
+      // E(F) = E0 - mu F - alpha F^2/2 - beta F^3/6 - gamma F^4/24
+      const char * names[]={"dipole moment mu","polarizability alpha","first hyperpolarizability beta","second hyperpolarizability gamma"};
+      for(size_t k=1;k<dE.n_elem;k++)
+        printf("%-34s % .10e\n",names[k-1],-dE(k));
     }
     printf("\n");
-
-    if(convd)
-      break;
   }
 
   printf("%-21s energy: % .16f\n","Kinetic",Ekin);
@@ -1001,11 +2203,90 @@ int main(int argc, char **argv) {
   printf("%-21s energy: % .16f\n", "Confinement potential",Econf);
   printf("%-21s energy: % .16f\n","Total",Etot);
   printf("%-21s energy: % .16f\n","Virial ratio",-Etot/Ekin);
+  if(confined) {
+    printf("\n");
+    printf("Energy derivative wrt confinement radius % .16e\n",dEconf);
+    printf("Pressure -dE/dV at confinement radius    % .16e\n",-dEconf/(4.0*M_PI*conf_R*conf_R));
+  }
 
   printf("\n");
+  multipole_matrices();
   printf("Electronic dipole     moment % .16e\n",-arma::trace(dip*P));
   printf("Electronic quadrupole moment % .16e\n",-arma::trace(quad*P));
 
+  if(parser.get<bool>("response")) {
+    if(restr && nela!=nelb)
+      printf("\nCoupled-perturbed SCF is not available for ROHF\n");
+    else if(Caocc.n_cols+Cavirt.n_cols!=Sinvh.n_cols || Ea.n_elem!=Sinvh.n_cols)
+      printf("\nCoupled-perturbed SCF requires all the orbitals\n");
+    else {
+      bool rclosed(restr && nela==nelb);
+      std::vector<arma::mat> C;
+      std::vector<arma::vec> E;
+      std::vector<size_t> nocc;
+      C.push_back(arma::join_rows(Caocc,Cavirt));
+      E.push_back(Ea);
+      nocc.push_back(nela);
+      if(!rclosed) {
+        C.push_back(arma::join_rows(Cbocc,Cbvirt));
+        E.push_back(Eb);
+        nocc.push_back(nelb);
+      }
+
+      // Response Fock matrices of the ground state, the XC kernel is
+      // applied by central differences of the XC potential
+      scf::response_fock_t G=[&](const std::vector<arma::mat> & P1) {
+        arma::mat P1a(P1[0]);
+        arma::mat P1b(rclosed ? P1[0] : P1[1]);
+        arma::mat J(basis.coulomb(P1a+P1b));
+        std::vector<arma::mat> G1(P1.size(),J);
+        if(kfrac!=0.0 || omega!=0.0) {
+          std::vector<arma::mat> K(basis.exchange_multi(P1,kfrac,(omega!=0.0) ? kshort : 0.0));
+          for(size_t is=0;is<P1.size();is++)
+            G1[is]+=K[is];
+        }
+        if(dft) {
+          double h(1e-4/std::max(arma::norm(P1a+P1b,"fro"),DBL_EPSILON));
+          double exc, nelnum, ekin;
+          if(rclosed) {
+            arma::mat XCp, XCm;
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, P+h*(P1a+P1b), XCp, exc, nelnum, ekin, dftthr);
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, P-h*(P1a+P1b), XCm, exc, nelnum, ekin, dftthr);
+            G1[0]+=(XCp-XCm)/(2.0*h);
+          } else {
+            arma::mat XCap, XCbp, XCam, XCbm;
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa+h*P1a, Pb+h*P1b, XCap, XCbp, exc, nelnum, ekin, nelb>0, dftthr);
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa-h*P1a, Pb-h*P1b, XCam, XCbm, exc, nelnum, ekin, nelb>0, dftthr);
+            G1[0]+=(XCap-XCam)/(2.0*h);
+            if(nelb>0)
+              G1[1]+=(XCbp-XCbm)/(2.0*h);
+          }
+        }
+        return G1;
+      };
+
+      // The perturbations are the ones coupling to Ez and Qzz
+      multipole_matrices();
+      const char * names[]={"dipole","quadrupole"};
+      const arma::mat Vpert[]={dip, quad/3.0};
+      arma::vec alpha(2);
+      for(int ip=0;ip<2;ip++) {
+        printf("\nSolving the static %s response\n",names[ip]);
+        timer.set();
+        std::vector<arma::mat> P1(scf::cpscf(C,E,nocc,Vpert[ip],G,convthr,maxit));
+        arma::mat P1tot(rclosed ? arma::mat(2.0*P1[0]) : arma::mat(P1[0]+P1[1]));
+        // E(F) = E0 - mu F - alpha F^2/2
+        alpha(ip)=-arma::trace(P1tot*Vpert[ip]);
+        printf("Static %s response solved in %.6f\n",names[ip],timer.get());
+      }
+      chkpt.write("alpha_dipole",alpha(0));
+      chkpt.write("alpha_quadrupole",alpha(1));
+      printf("\n");
+      printf("Static dipole     polarizability % .16e\n",alpha(0));
+      printf("Static quadrupole polarizability % .16e\n",alpha(1));
+    }
+  }
+
   // Electron density at nucleus
   if(Z!=0) {
     double nanuc=basis.nuclear_density(Pa)(0);
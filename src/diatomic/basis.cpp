@@ -23,9 +23,13 @@
 #include "utils.h"
 #include "../general/timer.h"
 #include "../general/scf_helpers.h"
+#include "../general/scratchfile.h"
 #include <algorithm>
 #include <cassert>
 #include <cfloat>
+#include <map>
+#include <sstream>
+#include <tuple>
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -191,23 +195,29 @@ namespace helfem {
       }
 
       arma::mat RadialBasis::Plm_integral(int k, size_t iel, int L, int M, const legendretable::LegendreTable & legtab) const {
-        std::function<double(double)> Plm;
-        if(k!=0) {
-          Plm = [legtab, k, L, M](double mu) { return std::sinh(mu)*std::pow(std::cosh(mu), k)*legtab.get_Plm(L,M,cosh(mu)); };
-        } else {
-          Plm = [legtab, L, M](double mu) { return std::sinh(mu)*legtab.get_Plm(L,M,cosh(mu)); };
-        }
-        return fem.matrix_element(iel, false, false, xq, wq, Plm);
+        // Legendre functions at the element's quadrature points
+        arma::vec plm(legtab.get_Plm(L,M,iel,0,xq.n_elem));
+        auto bf = [this](const arma::vec & x, size_t i) { return fem.eval_f(x, i); };
+        auto Plm = [&plm, k](const arma::vec & mu) {
+          arma::vec w(arma::sinh(mu)%plm);
+          if(k!=0)
+            w%=arma::pow(arma::cosh(mu), k);
+          return w;
+        };
+        return fem.matrix_element_inline(iel, bf, bf, xq, wq, Plm);
       }
 
       arma::mat RadialBasis::Qlm_integral(int k, size_t iel, int L, int M, const legendretable::LegendreTable & legtab) const {
-        std::function<double(double)> Qlm;
-        if(k!=0) {
-          Qlm = [legtab, k, L, M](double mu) { return std::sinh(mu)*std::pow(std::cosh(mu), k)*legtab.get_Qlm(L,M,cosh(mu)); };
-        } else {
-          Qlm = [legtab, L, M](double mu) { return std::sinh(mu)*legtab.get_Qlm(L,M,cosh(mu)); };
-        }
-        return fem.matrix_element(iel, false, false, xq, wq, Qlm);
+        // Legendre functions at the element's quadrature points
+        arma::vec qlm(legtab.get_Qlm(L,M,iel,0,xq.n_elem));
+        auto bf = [this](const arma::vec & x, size_t i) { return fem.eval_f(x, i); };
+        auto Qlm = [&qlm, k](const arma::vec & mu) {
+          arma::vec w(arma::sinh(mu)%qlm);
+          if(k!=0)
+            w%=arma::pow(arma::cosh(mu), k);
+          return w;
+        };
+        return fem.matrix_element_inline(iel, bf, bf, xq, wq, Qlm);
       }
 
       arma::mat RadialBasis::kinetic() const {
@@ -221,46 +231,44 @@ namespace helfem {
 
         // Integral by quadrature
         std::shared_ptr<const helfem::polynomial_basis::PolynomialBasis> p(fem.get_basis(iel));
-        arma::mat tei(quadrature::twoe_integral(mumin,mumax,alpha,beta,xq,wq,p,L,M,legtab));
+        arma::mat tei(quadrature::twoe_integral(mumin,mumax,alpha,beta,xq,wq,p,L,M,legtab,iel));
 
         return tei;
       }
 
-      arma::vec RadialBasis::get_chmu_quad() const {
+      arma::vec RadialBasis::get_chmu_quad(size_t iel) const {
         // Quadrature points for normal integrals
-        arma::vec muq(fem.get_nelem()*xq.n_elem*(xq.n_elem+1));
+        arma::vec muq(xq.n_elem*(xq.n_elem+1));
         size_t ioff=0;
 
-        for(size_t iel=0;iel<fem.get_nelem();iel++) {
-          // Element ranges from
-          double mumin0=fem.element_begin(iel);
-          double mumax0=fem.element_end(iel);
-
-          // Midpoint is at
-          double mumid0(0.5*(mumax0+mumin0));
-          // and half-length of interval is
-          double mulen0(0.5*(mumax0-mumin0));
-          // mu values are then
-          arma::vec mu0(mumid0*arma::ones<arma::vec>(xq.n_elem)+mulen0*xq);
-
-          // Store values
-          muq.subvec(ioff,ioff+mu0.n_elem-1)=mu0;
-          ioff+=mu0.n_elem;
-
-          // Subintervals for in-element two-electron integrals
-          for(size_t isub=0;isub<xq.n_elem;isub++) {
-            double mumin = (isub==0) ? mumin0 : mu0(isub-1);
-            double mumax = mu0(isub);
-
-            double mumid(0.5*(mumax+mumin));
-            double mulen(0.5*(mumax-mumin));
-            arma::vec mu(mumid*arma::ones<arma::vec>(xq.n_elem)+mulen*xq);
-            muq.subvec(ioff,ioff+mu.n_elem-1)=mu;
-            ioff+=mu.n_elem;
-          }
+        // Element ranges from
+        double mumin0=fem.element_begin(iel);
+        double mumax0=fem.element_end(iel);
+
+        // Midpoint is at
+        double mumid0(0.5*(mumax0+mumin0));
+        // and half-length of interval is
+        double mulen0(0.5*(mumax0-mumin0));
+        // mu values are then
+        arma::vec mu0(mumid0*arma::ones<arma::vec>(xq.n_elem)+mulen0*xq);
+
+        // Store values
+        muq.subvec(ioff,ioff+mu0.n_elem-1)=mu0;
+        ioff+=mu0.n_elem;
+
+        // Subintervals for in-element two-electron integrals
+        for(size_t isub=0;isub<xq.n_elem;isub++) {
+          double mumin = (isub==0) ? mumin0 : mu0(isub-1);
+          double mumax = mu0(isub);
+
+          double mumid(0.5*(mumax+mumin));
+          double mulen(0.5*(mumax-mumin));
+          arma::vec mu(mumid*arma::ones<arma::vec>(xq.n_elem)+mulen*xq);
+          muq.subvec(ioff,ioff+mu.n_elem-1)=mu;
+          ioff+=mu.n_elem;
         }
 
-        return arma::cosh(arma::sort(muq,"ascend"));
+        return arma::cosh(muq);
       }
 
       arma::mat RadialBasis::get_bf(size_t iel) const {
@@ -301,7 +309,35 @@ namespace helfem {
         }
       }
 
-      TwoDBasis::TwoDBasis() {
+      /// Gaunt tables are shared by all bases with the same angular limits
+      static gaunt::Gaunt cached_gaunt(int lrval, int midval, int Mmax) {
+        static std::map< std::tuple<int,int,int>, gaunt::Gaunt > cache;
+        std::tuple<int,int,int> key(lrval,midval,Mmax);
+
+        gaunt::Gaunt g;
+        bool found=false;
+#ifdef _OPENMP
+#pragma omp critical(diatomic_gaunt_cache)
+#endif
+        {
+          auto it(cache.find(key));
+          if(it!=cache.end()) {
+            g=it->second;
+            found=true;
+          }
+        }
+        if(found)
+          return g;
+
+        g=gaunt::Gaunt(lrval,Mmax,midval,Mmax,lrval,Mmax);
+#ifdef _OPENMP
+#pragma omp critical(diatomic_gaunt_cache)
+#endif
+        cache[key]=g;
+        return g;
+      }
+
+      TwoDBasis::TwoDBasis() : leg_Lpad(-1), leg_Lmax(-1), leg_Mmax(-1), scratch_ktei(false), part_index(0), part_count(1) {
       }
 
       TwoDBasis::TwoDBasis(int Z1_, int Z2_, double Rhalf_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, int n_quad, const arma::vec & bval, const arma::ivec & lval_, const arma::ivec & mval_, int lpad, bool legendre) {
@@ -323,6 +359,10 @@ namespace helfem {
 
         // Gaunt coefficients
         int gmax(arma::max(lval)+2);
+        leg_Lpad=leg_Lmax=leg_Mmax=-1;
+        scratch_ktei=false;
+        part_index=0;
+        part_count=1;
 
         // Legendre function values
         if(legendre) {
@@ -385,21 +425,18 @@ namespace helfem {
           Timer t;
           printf("Computing Gaunt coefficients ... ");
           fflush(stdout);
-          gaunt=gaunt::Gaunt(lrval,Mmax,midval,Mmax,lrval,Mmax);
+          gaunt=cached_gaunt(lrval,midval,Mmax);
           printf("done (% .3f s)\n",t.get());
           fflush(stdout);
 
-          t.set();
-          printf("Computing Legendre function values ... ");
-          fflush(stdout);
+          // Angular couplings of the Coulomb matrix
+          form_coulomb_couplings();
 
-          // Fill table with necessary values
-          legtab=legendretable::LegendreTable(Lmax+lpad,Lmax,Mmax);
-          arma::vec chmu(radial.get_chmu_quad());
-          for(size_t i=0;i<chmu.n_elem;i++)
-            legtab.compute(chmu(i));
-          printf("done (% .3f s)\n",t.get());
-          fflush(stdout);
+          // The Legendre function values are computed when they are
+          // first needed, unless they are read in from a checkpoint
+          leg_Lpad=Lmax+lpad;
+          leg_Lmax=Lmax;
+          leg_Mmax=Mmax;
 
         } else {
           // One-electron matrices need gmax,5,gmax
@@ -407,10 +444,144 @@ namespace helfem {
           int midval(5);
           int Mmax=arma::max(mval)-arma::min(mval);
 
-          gaunt=gaunt::Gaunt(lrval,Mmax,midval,Mmax,lrval,Mmax);
+          gaunt=cached_gaunt(lrval,midval,Mmax);
         }
       }
 
+      void TwoDBasis::form_coulomb_couplings() {
+        size_t Nang(lval.n_elem);
+        Jcoupling.clear();
+        Jcoupling_block.assign(Nang*Nang+1,0);
+        Jcoupling_LM.assign(LM_map.size(),std::vector<size_t>());
+
+        for(size_t kang=0;kang<Nang;kang++) {
+          for(size_t lang=0;lang<Nang;lang++) {
+            Jcoupling_block[kang*Nang+lang]=Jcoupling.size();
+
+            // l and m values
+            int lk(lval(kang));
+            int mk(mval(kang));
+            int ll(lval(lang));
+            int ml(mval(lang));
+            // RH m value
+            int M(mk-ml);
+            // Loop over possible couplings
+            int Lmin=std::max(std::abs(lk-ll)-2,abs(M));
+            int Lmax=lk+ll+2;
+            for(int L=Lmin;L<=Lmax;L++) {
+              coulomb_coupling_t c;
+              c.kang=kang;
+              c.lang=lang;
+              c.iLM=LMind(L,M);
+              c.cpl0=gaunt.mod_coeff(lk,mk,L,M,ll,ml);
+              c.cpl2=gaunt.coeff(lk,mk,L,M,ll,ml);
+              if(c.cpl0==0.0 && c.cpl2==0.0)
+                continue;
+              Jcoupling_LM[c.iLM].push_back(Jcoupling.size());
+              Jcoupling.push_back(c);
+            }
+          }
+        }
+        Jcoupling_block[Nang*Nang]=Jcoupling.size();
+
+        // (L,M) channels of each (L,|M|) channel
+        lm_LM.assign(lm_map.size(),std::vector<size_t>());
+        for(size_t iLM=0;iLM<LM_map.size();iLM++)
+          lm_LM[lmind(LM_map[iLM].first,LM_map[iLM].second)].push_back(iLM);
+      }
+
+      void TwoDBasis::set_partition(size_t ipart, size_t npart) {
+        if(npart==0 || ipart>=npart)
+          throw std::logic_error("Invalid partition of the two-electron channels!\n");
+        part_index=ipart;
+        part_count=npart;
+      }
+
+      bool TwoDBasis::owns_channel(size_t ilm) const {
+        return ilm%part_count == part_index;
+      }
+
+      void TwoDBasis::set_tei_scratch(const std::string & fname) {
+        tei_scratch=fname;
+      }
+
+      void TwoDBasis::get_tei_channel(size_t ilm, bool exchange, std::vector<arma::mat> & buf, std::vector<const arma::mat *> & tei) const {
+        size_t Nel(radial.Nel());
+        tei.resize(4*Nel);
+        if(teistore) {
+          buf=teistore->read(exchange ? lm_map.size()+ilm : ilm);
+          for(size_t i=0;i<tei.size();i++)
+            tei[i]=&buf[i];
+        } else {
+          const std::vector<arma::mat> * src[4];
+          if(exchange) {
+            src[0]=&prim_ktei00;
+            src[1]=&prim_ktei02;
+            src[2]=&prim_ktei20;
+            src[3]=&prim_ktei22;
+          } else {
+            src[0]=&prim_tei00;
+            src[1]=&prim_tei02;
+            src[2]=&prim_tei20;
+            src[3]=&prim_tei22;
+          }
+          for(size_t k=0;k<4;k++)
+            for(size_t iel=0;iel<Nel;iel++)
+              tei[k*Nel+iel]=&((*src[k])[Nel*Nel*ilm + iel*Nel + iel]);
+        }
+      }
+
+      void TwoDBasis::compute_tei_scratch(bool exchange) {
+        size_t Nel(radial.Nel());
+
+        // Any in-core integrals are not needed
+        prim_tei00.clear();
+        prim_tei02.clear();
+        prim_tei20.clear();
+        prim_tei22.clear();
+        prim_ktei00.clear();
+        prim_ktei02.clear();
+        prim_ktei20.clear();
+        prim_ktei22.clear();
+
+        // Records 0 ... N_lm-1 are the Coulomb integrals and N_lm
+        // ... 2 N_lm-1 the exchange-sorted integrals of each channel
+        teistore.reset();
+        teistore=std::make_shared<ScratchFile>(tei_scratch,2*lm_map.size());
+        scratch_ktei=exchange;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for(size_t ilm=0;ilm<lm_map.size();ilm++) {
+          if(!owns_channel(ilm))
+            continue;
+          int L(lm_map[ilm].first);
+          int M(lm_map[ilm].second);
+
+          std::vector<arma::mat> rec(4*Nel);
+          for(size_t iel=0;iel<Nel;iel++) {
+            rec[iel]=radial.twoe_integral(0,0,iel,L,M,legtab);
+            rec[Nel+iel]=radial.twoe_integral(0,2,iel,L,M,legtab);
+            rec[2*Nel+iel]=radial.twoe_integral(2,0,iel,L,M,legtab);
+            rec[3*Nel+iel]=radial.twoe_integral(2,2,iel,L,M,legtab);
+          }
+          teistore->write(ilm,rec);
+
+          if(exchange) {
+            for(size_t iel=0;iel<Nel;iel++) {
+              size_t Ni(radial.Nprim(iel));
+              for(size_t k=0;k<4;k++)
+                rec[k*Nel+iel]=utils::exchange_tei(rec[k*Nel+iel],Ni,Ni,Ni,Ni);
+            }
+            teistore->write(lm_map.size()+ilm,rec);
+          }
+        }
+
+        printf("Two-electron integrals stored in scratch file %s (%s)\n",tei_scratch.c_str(),scf::memory_size(teistore->get_size()).c_str());
+        fflush(stdout);
+      }
+
       TwoDBasis::~TwoDBasis() {
       }
 
@@ -426,6 +597,12 @@ namespace helfem {
         return Rhalf;
       }
 
+      void TwoDBasis::set_Rhalf(double Rhalf_) {
+        if(Rhalf_<=0.0)
+          throw std::logic_error("Bond length must be positive.\n");
+        Rhalf=Rhalf_;
+      }
+
       arma::ivec TwoDBasis::get_lval() const {
         return lval;
       }
@@ -454,6 +631,22 @@ namespace helfem {
         return radial.get_poly_nnodes();
       }
 
+      std::string TwoDBasis::fingerprint() const {
+        std::ostringstream oss;
+        oss.precision(17);
+        oss << "diatomic Z1=" << get_Z1() << " Z2=" << get_Z2() << " Rhalf=" << get_Rhalf();
+        oss << " poly=" << get_poly_id() << " nnodes=" << get_poly_nnodes() << " nquad=" << get_nquad();
+        arma::vec bval(get_bval());
+        oss << " bval=";
+        for(size_t i=0;i<bval.n_elem;i++)
+          oss << " " << bval(i);
+        arma::ivec lv(get_lval()), mv(get_mval());
+        oss << " lm=";
+        for(size_t i=0;i<lv.n_elem;i++)
+          oss << " " << lv(i) << "," << mv(i);
+        return scf::hash_string(oss.str());
+      }
+
       size_t TwoDBasis::Ndummy() const {
         return lval.n_elem*radial.Nbf();
       }
@@ -1158,12 +1351,60 @@ namespace helfem {
         // Number of primitive functions per element
         size_t Nprim(radial.max_Nprim());
 
+        // Only the channels of this partition are stored
+        N_LM=(N_LM+part_count-1-part_index)/part_count;
+
         // No off-diagonal storage
         return 4*N_LM*Nel*Nprim*Nprim*Nprim*Nprim*sizeof(double);
       }
 
 
+      std::vector<arma::vec> TwoDBasis::legendre_points() const {
+        std::vector<arma::vec> chmu(radial.Nel());
+        for(size_t iel=0;iel<chmu.size();iel++)
+          chmu[iel]=radial.get_chmu_quad(iel);
+        return chmu;
+      }
+
+      void TwoDBasis::compute_legendre_table() {
+        if(leg_Lmax<0)
+          throw std::logic_error("Basis was initialized without Legendre functions!\n");
+
+        Timer t;
+        printf("Computing Legendre function values ... ");
+        fflush(stdout);
+        legtab=legendretable::LegendreTable(leg_Lpad,leg_Lmax,leg_Mmax,legendre_points());
+        printf("done (% .3f s)\n",t.get());
+        fflush(stdout);
+      }
+
+      const legendretable::LegendreTable & TwoDBasis::get_legendre_table() {
+        if(!legtab.get_Nel())
+          compute_legendre_table();
+        return legtab;
+      }
+
+      bool TwoDBasis::set_legendre_table(const legendretable::LegendreTable & tab) {
+        if(tab.get_Lpad()!=leg_Lpad || tab.get_Lmax()!=leg_Lmax || tab.get_Mmax()!=leg_Mmax)
+          return false;
+
+        // The table must have been computed at the same points
+        std::vector<arma::vec> chmu(legendre_points());
+        std::vector<arma::vec> xi(tab.get_xi());
+        if(chmu.size()!=xi.size())
+          return false;
+        for(size_t iel=0;iel<chmu.size();iel++)
+          if(chmu[iel].n_elem!=xi[iel].n_elem || arma::any(chmu[iel]!=xi[iel]))
+            return false;
+
+        legtab=tab;
+        return true;
+      }
+
       void TwoDBasis::compute_tei(bool exchange) {
+        if(!legtab.get_Nel())
+          compute_legendre_table();
+
         // Number of distinct L values is
         size_t Nel(radial.Nel());
 
@@ -1176,6 +1417,8 @@ namespace helfem {
 #pragma omp parallel for
 #endif
         for(size_t ilm=0;ilm<lm_map.size();ilm++) {
+          if(!owns_channel(ilm))
+            continue;
           int L(lm_map[ilm].first);
           int M(lm_map[ilm].second);
           for(size_t iel=0;iel<Nel;iel++) {
@@ -1186,6 +1429,13 @@ namespace helfem {
           }
         }
 
+        // Two-electron integrals are kept on disk
+        if(tei_scratch.size()) {
+          compute_tei_scratch(exchange);
+          return;
+        }
+        teistore.reset();
+
         // Form primitive two-electron integrals
         prim_tei00.resize(Nel*Nel*lm_map.size());
         prim_tei02.resize(Nel*Nel*lm_map.size());
@@ -1193,6 +1443,8 @@ namespace helfem {
         prim_tei22.resize(Nel*Nel*lm_map.size());
 
         for(size_t ilm=0;ilm<lm_map.size();ilm++) {
+          if(!owns_channel(ilm))
+            continue;
           int L(lm_map[ilm].first);
           int M(lm_map[ilm].second);
 
@@ -1264,6 +1516,8 @@ namespace helfem {
           prim_ktei22.resize(prim_tei22.size());
           for(size_t ilm=0;ilm<lm_map.size();ilm++)
             for(size_t iel=0;iel<Nel;iel++) {
+              if(!owns_channel(ilm))
+                continue;
               // Diagonal integrals
               {
                 size_t idx=Nel*Nel*ilm + iel*Nel + iel;
@@ -1357,7 +1611,7 @@ namespace helfem {
       }
 
       arma::mat TwoDBasis::coulomb(const arma::mat & P0) const {
-        if(!prim_tei00.size())
+        if(!prim_tei00.size() && !teistore)
           throw std::logic_error("Primitive teis have not been computed!\n");
 
         // Extend to boundaries
@@ -1368,128 +1622,149 @@ namespace helfem {
         // Number of radial functions
         size_t Nrad(radial.Nbf());
 
+        // Only the diagonal element blocks of the radial helpers are
+        // ever used, so they are stored packed one after the other
+        std::vector<size_t> eloff(Nel+1,0);
+        for(size_t iel=0;iel<Nel;iel++) {
+          size_t ifirst, ilast;
+          radial.get_idx(iel,ifirst,ilast);
+          eloff[iel+1]=eloff[iel]+(ilast-ifirst+1)*(ilast-ifirst+1);
+        }
+
         // Radial helper matrices
-        std::vector<arma::mat> Paux0(LM_map.size());
-        std::vector<arma::mat> Paux2(LM_map.size());
+        std::vector<arma::vec> Paux0(LM_map.size());
+        std::vector<arma::vec> Paux2(LM_map.size());
         for(size_t i=0;i<Paux0.size();i++) {
-          Paux0[i].zeros(Nrad,Nrad);
-          Paux2[i].zeros(Nrad,Nrad);
+          Paux0[i].zeros(eloff[Nel]);
+          Paux2[i].zeros(eloff[Nel]);
         }
 
-        // Form radial helpers: contract ket
-        for(size_t kang=0;kang<lval.n_elem;kang++) {
-          for(size_t lang=0;lang<lval.n_elem;lang++) {
-            // l and m values
-            int lk(lval(kang));
-            int mk(mval(kang));
-            int ll(lval(lang));
-            int ml(mval(lang));
-            // RH m value
-            int M(mk-ml);
-            // M values match. Loop over possible couplings
-            int Lmin=std::max(std::abs(lk-ll)-2,abs(M));
-            int Lmax=lk+ll+2;
-            for(int L=Lmin;L<=Lmax;L++) {
-              const size_t iLM(LMind(L,M));
-              // Calculate coupling coefficients
-              double cpl0(gaunt.mod_coeff(lk,mk,L,M,ll,ml));
-              double cpl2(gaunt.coeff(lk,mk,L,M,ll,ml));
-              // Increment
-              arma::mat Prad(P.submat(kang*Nrad,lang*Nrad,(kang+1)*Nrad-1,(lang+1)*Nrad-1));
-              if(cpl0!=0.0)
-                Paux0[iLM]+=cpl0*Prad;
-              if(cpl2!=0.0)
-                Paux2[iLM]+=cpl2*Prad;
+        // Form radial helpers: contract ket. The channels are
+        // independent, so each thread handles its own (L,M) values.
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for(size_t iLM=0;iLM<LM_map.size();iLM++) {
+          for(size_t ic=0;ic<Jcoupling_LM[iLM].size();ic++) {
+            const coulomb_coupling_t & c(Jcoupling[Jcoupling_LM[iLM][ic]]);
+            const size_t kang(c.kang);
+            const size_t lang(c.lang);
+            for(size_t jel=0;jel<Nel;jel++) {
+              size_t jfirst, jlast;
+              radial.get_idx(jel,jfirst,jlast);
+              const auto Pblock(P.submat(kang*Nrad+jfirst,lang*Nrad+jfirst,kang*Nrad+jlast,lang*Nrad+jlast));
+              const size_t Nj(jlast-jfirst+1);
+              if(c.cpl0!=0.0) {
+                arma::mat Pb(Paux0[iLM].memptr()+eloff[jel],Nj,Nj,false,true);
+                Pb+=c.cpl0*Pblock;
+              }
+              if(c.cpl2!=0.0) {
+                arma::mat Pb(Paux2[iLM].memptr()+eloff[jel],Nj,Nj,false,true);
+                Pb+=c.cpl2*Pblock;
+              }
             }
           }
         }
 
         // Coulomb helpers
-        std::vector<arma::mat> Jaux0(LM_map.size());
-        std::vector<arma::mat> Jaux2(LM_map.size());
+        std::vector<arma::vec> Jaux0(LM_map.size());
+        std::vector<arma::vec> Jaux2(LM_map.size());
         for(size_t i=0;i<Jaux0.size();i++) {
-          Jaux0[i].zeros(Nrad,Nrad);
-          Jaux2[i].zeros(Nrad,Nrad);
+          Jaux0[i].zeros(eloff[Nel]);
+          Jaux2[i].zeros(eloff[Nel]);
         }
-        for(size_t iLM=0;iLM<LM_map.size();iLM++) {
-          // Values of L and M
-          int L(LM_map[iLM].first);
-          int M(LM_map[iLM].second);
+        // The channels are processed in the order the in-element
+        // integrals are stored, reading each (L,|M|) channel once
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for(size_t ilm=0;ilm<lm_map.size();ilm++) {
+          if(!owns_channel(ilm))
+            continue;
+          // In-element integrals of the channel
+          std::vector<arma::mat> teibuf;
+          std::vector<const arma::mat *> tei;
+          get_tei_channel(ilm,false,teibuf,tei);
 
-          // Helpers
-          const size_t ilm(lmind(L,M));
-          const double LMfac(4.0*M_PI*std::pow(Rhalf,5)*std::pow(-1.0,M)/factorial_ratio(L+std::abs(M),L-std::abs(M)));
+          for(size_t iiLM=0;iiLM<lm_LM[ilm].size();iiLM++) {
+            // Values of L and M
+            const size_t iLM(lm_LM[ilm][iiLM]);
+            int L(LM_map[iLM].first);
+            int M(LM_map[iLM].second);
 
-          // Loop over input elements
-          for(size_t jel=0;jel<Nel;jel++) {
-            size_t jfirst, jlast;
-            radial.get_idx(jel,jfirst,jlast);
-            size_t Nj(jlast-jfirst+1);
-
-            // Get density submatrices
-            arma::mat Psub0(Paux0[iLM].submat(jfirst,jfirst,jlast,jlast));
-            arma::mat Psub2(Paux2[iLM].submat(jfirst,jfirst,jlast,jlast));
-
-            // Contract integrals
-            double jsmall0 = LMfac*arma::trace(disjoint_P0[ilm*Nel+jel]*Psub0);
-            double jbig0 = LMfac*arma::trace(disjoint_Q0[ilm*Nel+jel]*Psub0);
-            double jsmall2 = LMfac*arma::trace(disjoint_P2[ilm*Nel+jel]*Psub2);
-            double jbig2 = LMfac*arma::trace(disjoint_Q2[ilm*Nel+jel]*Psub2);
-
-            // Increment J: jel>iel
-            double ifac0(jbig0 - jbig2);
-            double ifac2(-jbig0 + jbig2);
-            for(size_t iel=0;iel<jel;iel++) {
-              size_t ifirst, ilast;
-              radial.get_idx(iel,ifirst,ilast);
+            // Helpers
+            const double LMfac(4.0*M_PI*std::pow(Rhalf,5)*std::pow(-1.0,M)/factorial_ratio(L+std::abs(M),L-std::abs(M)));
 
-              const arma::mat & iint0=disjoint_P0[ilm*Nel+iel];
-              const arma::mat & iint2=disjoint_P2[ilm*Nel+iel];
-              Jaux0[iLM].submat(ifirst,ifirst,ilast,ilast)+=iint0*ifac0;
-              Jaux2[iLM].submat(ifirst,ifirst,ilast,ilast)+=iint2*ifac2;
-            }
+            // Disjoint contributions of the input elements
+            arma::vec jsmall(Nel), jbig(Nel);
 
-            // Increment J: jel<iel
-            ifac0=jsmall0 - jsmall2;
-            ifac2=-jsmall0 + jsmall2;
-            for(size_t iel=jel+1;iel<Nel;iel++) {
-              size_t ifirst, ilast;
-              radial.get_idx(iel,ifirst,ilast);
+            // Loop over input elements
+            for(size_t jel=0;jel<Nel;jel++) {
+              size_t jfirst, jlast;
+              radial.get_idx(jel,jfirst,jlast);
+              size_t Nj(jlast-jfirst+1);
 
-              const arma::mat & iint0=disjoint_Q0[ilm*Nel+iel];
-              const arma::mat & iint2=disjoint_Q2[ilm*Nel+iel];
-              Jaux0[iLM].submat(ifirst,ifirst,ilast,ilast)+=iint0*ifac0;
-              Jaux2[iLM].submat(ifirst,ifirst,ilast,ilast)+=iint2*ifac2;
+              // Get density submatrices
+              arma::mat Psub0(Paux0[iLM].memptr()+eloff[jel],Nj,Nj);
+              arma::mat Psub2(Paux2[iLM].memptr()+eloff[jel],Nj,Nj);
+
+              // Contract integrals
+              double jsmall0 = LMfac*arma::trace(disjoint_P0[ilm*Nel+jel]*Psub0);
+              double jbig0 = LMfac*arma::trace(disjoint_Q0[ilm*Nel+jel]*Psub0);
+              double jsmall2 = LMfac*arma::trace(disjoint_P2[ilm*Nel+jel]*Psub2);
+              double jbig2 = LMfac*arma::trace(disjoint_Q2[ilm*Nel+jel]*Psub2);
+              jsmall(jel) = jsmall0 - jsmall2;
+              jbig(jel) = jbig0 - jbig2;
+
+              // In-element contribution
+              {
+                size_t iel=jel;
+                size_t Ni=Nj;
+
+                // Contract integrals
+                arma::mat Jsub0(Ni*Ni,1);
+                Jsub0.zeros();
+                arma::mat Jsub2(Ni*Ni,1);
+                Jsub2.zeros();
+
+                Psub0.reshape(Nj*Nj,1);
+                Psub2.reshape(Nj*Nj,1);
+
+                Jsub0+=LMfac*((*tei[iel])*Psub0);
+                Jsub0-=LMfac*((*tei[Nel+iel])*Psub2);
+                Jsub2-=LMfac*((*tei[2*Nel+iel])*Psub0);
+                Jsub2+=LMfac*((*tei[3*Nel+iel])*Psub2);
+
+                Jsub0.reshape(Ni,Ni);
+                Jsub2.reshape(Ni,Ni);
+
+                // Increment global Coulomb matrix
+                arma::mat J0(Jaux0[iLM].memptr()+eloff[iel],Ni,Ni,false,true);
+                J0+=Jsub0;
+                arma::mat J2(Jaux2[iLM].memptr()+eloff[iel],Ni,Ni,false,true);
+                J2+=Jsub2;
+              }
             }
 
-            // In-element contribution
-            {
-              size_t iel=jel;
-              size_t ifirst=jfirst;
-              size_t ilast=jlast;
-              size_t Ni=Nj;
+            // Element iel gets jbig from all jel>iel and jsmall from all
+            // jel<iel: suffix and prefix sums
+            arma::vec bigsum(Nel), smallsum(Nel);
+            bigsum(Nel-1)=0.0;
+            for(size_t iel=Nel-1;iel>0;iel--)
+              bigsum(iel-1)=bigsum(iel)+jbig(iel);
+            smallsum(0)=0.0;
+            for(size_t iel=1;iel<Nel;iel++)
+              smallsum(iel)=smallsum(iel-1)+jsmall(iel-1);
 
-              // Contract integrals
-              arma::mat Jsub0(Ni*Ni,1);
-              Jsub0.zeros();
-              arma::mat Jsub2(Ni*Ni,1);
-              Jsub2.zeros();
-
-              Psub0.reshape(Nj*Nj,1);
-              Psub2.reshape(Nj*Nj,1);
-
-              const size_t idx(Nel*Nel*ilm + iel*Nel + jel);
-              Jsub0+=LMfac*(prim_tei00[idx]*Psub0);
-              Jsub0-=LMfac*(prim_tei02[idx]*Psub2);
-              Jsub2-=LMfac*(prim_tei20[idx]*Psub0);
-              Jsub2+=LMfac*(prim_tei22[idx]*Psub2);
-
-              Jsub0.reshape(Ni,Ni);
-              Jsub2.reshape(Ni,Ni);
-
-              // Increment global Coulomb matrix
-              Jaux0[iLM].submat(ifirst,ifirst,ilast,ilast)+=Jsub0;
-              Jaux2[iLM].submat(ifirst,ifirst,ilast,ilast)+=Jsub2;
+            for(size_t iel=0;iel<Nel;iel++) {
+              size_t ifirst, ilast;
+              radial.get_idx(iel,ifirst,ilast);
+              size_t Ni(ilast-ifirst+1);
+
+              arma::mat J0(Jaux0[iLM].memptr()+eloff[iel],Ni,Ni,false,true);
+              J0+=disjoint_P0[ilm*Nel+iel]*bigsum(iel)+disjoint_Q0[ilm*Nel+iel]*smallsum(iel);
+              arma::mat J2(Jaux2[iLM].memptr()+eloff[iel],Ni,Ni,false,true);
+              J2-=disjoint_P2[ilm*Nel+iel]*bigsum(iel)+disjoint_Q2[ilm*Nel+iel]*smallsum(iel);
             }
           }
         }
@@ -1497,30 +1772,24 @@ namespace helfem {
         // Full Coulomb matrix
         arma::mat J(Ndummy(),Ndummy());
         J.zeros();
-        for(size_t iang=0;iang<lval.n_elem;iang++) {
-          for(size_t jang=0;jang<lval.n_elem;jang++) {
-            // l and m values
-            int li(lval(iang));
-            int mi(mval(iang));
-            int lj(lval(jang));
-            int mj(mval(jang));
-            // LH m value
-            int M(mj-mi);
-
-            int Lmin=std::max(std::abs(lj-li)-2,abs(M));
-            int Lmax=lj+li+2;
-            for(int L=Lmin;L<=Lmax;L++) {
-              const size_t iLM(LMind(L,M));
-
-              // Couplings
-              double cpl0(gaunt.mod_coeff(lj,mj,L,M,li,mi));
-              if(cpl0!=0.0) {
-                J.submat(iang*Nrad,jang*Nrad,(iang+1)*Nrad-1,(jang+1)*Nrad-1)+=cpl0*Jaux0[iLM];
-              }
-
-              double cpl2(gaunt.coeff(lj,mj,L,M,li,mi));
-              if(cpl2!=0.0) {
-                J.submat(iang*Nrad,jang*Nrad,(iang+1)*Nrad-1,(jang+1)*Nrad-1)+=cpl2*Jaux2[iLM];
+        // The (iang,jang) block couples like the (jang,iang) ket block
+        const size_t Nang(lval.n_elem);
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2)
+#endif
+        for(size_t iang=0;iang<Nang;iang++) {
+          for(size_t jang=0;jang<Nang;jang++) {
+            for(size_t ic=Jcoupling_block[jang*Nang+iang];ic<Jcoupling_block[jang*Nang+iang+1];ic++) {
+              const coulomb_coupling_t & c(Jcoupling[ic]);
+              // Only the element blocks of the radial block are nonzero
+              for(size_t iel=0;iel<Nel;iel++) {
+                size_t ifirst, ilast;
+                radial.get_idx(iel,ifirst,ilast);
+                size_t Ni(ilast-ifirst+1);
+                if(c.cpl0!=0.0)
+                  J.submat(iang*Nrad+ifirst,jang*Nrad+ifirst,iang*Nrad+ilast,jang*Nrad+ilast)+=c.cpl0*arma::mat(Jaux0[c.iLM].memptr()+eloff[iel],Ni,Ni,false,true);
+                if(c.cpl2!=0.0)
+                  J.submat(iang*Nrad+ifirst,jang*Nrad+ifirst,iang*Nrad+ilast,jang*Nrad+ilast)+=c.cpl2*arma::mat(Jaux2[c.iLM].memptr()+eloff[iel],Ni,Ni,false,true);
               }
             }
           }
@@ -1530,6 +1799,11 @@ namespace helfem {
       }
 
       arma::mat TwoDBasis::exchange(const arma::mat & P0) const {
+        if(teistore) {
+          if(!scratch_ktei)
+            throw std::logic_error("Exchange-sorted teis have not been computed!\n");
+          return exchange_scratch(expand_boundaries(P0));
+        }
         if(!prim_ktei00.size())
           throw std::logic_error("Primitive teis have not been computed!\n");
 
@@ -1583,19 +1857,15 @@ namespace helfem {
               int lk(lval(kang));
               int mk(mval(kang));
 
-              // Form radial helpers
+              // Radial helpers, allocated only for the channels that
+              // couple to this angular block
               std::vector<arma::mat> Rmat00(lm_map.size());
               std::vector<arma::mat> Rmat02(lm_map.size());
               std::vector<arma::mat> Rmat20(lm_map.size());
               std::vector<arma::mat> Rmat22(lm_map.size());
-              for(size_t i=0;i<lm_map.size();i++) {
-                Rmat00[i].zeros(Nrad,Nrad);
-                Rmat02[i].zeros(Nrad,Nrad);
-                Rmat20[i].zeros(Nrad,Nrad);
-                Rmat22[i].zeros(Nrad,Nrad);
-              }
               // Is there a coupling to the channel?
               std::vector<bool> couple(lm_map.size(),false);
+              bool anycouple=false;
 
               // Perform angular sums
               for(size_t iang=0;iang<lval.n_elem;iang++) {
@@ -1636,20 +1906,33 @@ namespace helfem {
 
                     // Index in the L,|M| table
                     const size_t ilm(lmind(L,M));
+                    if(!owns_channel(ilm))
+                      continue;
                     const double LMfac(4.0*M_PI*std::pow(Rhalf,5)*std::pow(-1.0,M)/factorial_ratio(L+std::abs(M),L-std::abs(M)));
 
                     arma::mat Psub(mem_Psub[ith].memptr(),Nrad,Nrad,false,true);
                     Psub=P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1);
 
+                    if(!couple[ilm]) {
+                      Rmat00[ilm].zeros(Nrad,Nrad);
+                      Rmat02[ilm].zeros(Nrad,Nrad);
+                      Rmat20[ilm].zeros(Nrad,Nrad);
+                      Rmat22[ilm].zeros(Nrad,Nrad);
+                      couple[ilm]=true;
+                      anycouple=true;
+                    }
                     Rmat00[ilm]+=(LMfac*cpl00)*Psub;
                     Rmat02[ilm]+=(LMfac*cpl02)*Psub;
                     Rmat20[ilm]+=(LMfac*cpl20)*Psub;
                     Rmat22[ilm]+=(LMfac*cpl22)*Psub;
-                    couple[ilm]=true;
                   }
                 }
               }
 
+              // The angular block of the exchange matrix vanishes
+              if(!anycouple)
+                continue;
+
               // Loop over elements: output
               for(size_t iel=0;iel<Nel;iel++) {
                 size_t ifirst, ilast;
@@ -1732,6 +2015,143 @@ namespace helfem {
         return remove_boundaries(K);
       }
 
+      arma::mat TwoDBasis::exchange_scratch(const arma::mat & P) const {
+        // Number of radial elements
+        size_t Nel(radial.Nel());
+        // Number of radial basis functions
+        size_t Nrad(radial.Nbf());
+        // Number of angular functions
+        size_t Nang(lval.n_elem);
+
+        // Full exchange matrix
+        arma::mat K(Ndummy(),Ndummy());
+        K.zeros();
+
+        // Which density blocks are nonzero
+        arma::umat nonzero(Nang,Nang);
+        for(size_t iang=0;iang<Nang;iang++)
+          for(size_t lang=0;lang<Nang;lang++)
+            nonzero(iang,lang)=(arma::norm(P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1),"fro")>=10*DBL_EPSILON);
+
+        /*
+          The integrals are read in one (L,|M|) channel at a time,
+          while the next channel is prefetched, and the contributions
+          of the channel to all the angular blocks of the exchange
+          matrix are formed in parallel.
+        */
+        std::vector<arma::mat> teibuf;
+        std::vector<const arma::mat *> ktei;
+        for(size_t ilm=0;ilm<lm_map.size();ilm++) {
+          if(!owns_channel(ilm))
+            continue;
+          teistore->prefetch(lm_map.size()+ilm+1);
+          get_tei_channel(ilm,true,teibuf,ktei);
+
+          const int L(lm_map[ilm].first);
+          const int absM(lm_map[ilm].second);
+
+#ifdef _OPENMP
+#pragma omp parallel for collapse(2) schedule(dynamic)
+#endif
+          for(size_t jang=0;jang<Nang;jang++) {
+            for(size_t kang=0;kang<Nang;kang++) {
+              int lj(lval(jang));
+              int mj(mval(jang));
+              int lk(lval(kang));
+              int mk(mval(kang));
+
+              // Radial helpers for this channel
+              arma::mat Rmat00(Nrad,Nrad,arma::fill::zeros);
+              arma::mat Rmat02(Nrad,Nrad,arma::fill::zeros);
+              arma::mat Rmat20(Nrad,Nrad,arma::fill::zeros);
+              arma::mat Rmat22(Nrad,Nrad,arma::fill::zeros);
+              bool couple=false;
+
+              // Perform angular sums
+              for(size_t iang=0;iang<Nang;iang++) {
+                int li(lval(iang));
+                int mi(mval(iang));
+                // LH m value
+                int M(mj-mi);
+                if(std::abs(M)!=absM)
+                  continue;
+
+                for(size_t lang=0;lang<Nang;lang++) {
+                  int ll(lval(lang));
+                  int ml(mval(lang));
+                  // RH m value must match
+                  if(mk-ml!=M)
+                    continue;
+                  if(!nonzero(iang,lang))
+                    continue;
+
+                  int Lmin=std::max(std::max(std::abs(li-lj),std::abs(lk-ll))-2,abs(M));
+                  int Lmax=std::min(li+lj,lk+ll)+2;
+                  if(L<Lmin || L>Lmax)
+                    continue;
+
+                  // Calculate total coupling coefficient
+                  double cpl00(gaunt.mod_coeff(lj,mj,L,M,li,mi)*gaunt.mod_coeff(lk,mk,L,M,ll,ml));
+                  double cpl02(-gaunt.mod_coeff(lj,mj,L,M,li,mi)*gaunt.coeff(lk,mk,L,M,ll,ml));
+                  double cpl20(-gaunt.coeff(lj,mj,L,M,li,mi)*gaunt.mod_coeff(lk,mk,L,M,ll,ml));
+                  double cpl22(gaunt.coeff(lj,mj,L,M,li,mi)*gaunt.coeff(lk,mk,L,M,ll,ml));
+                  if(cpl00==0.0 && cpl02==0.0 && cpl20==0.0 && cpl22==0.0)
+                    continue;
+
+                  const double LMfac(4.0*M_PI*std::pow(Rhalf,5)*std::pow(-1.0,M)/factorial_ratio(L+std::abs(M),L-std::abs(M)));
+                  arma::mat Psub(P.submat(iang*Nrad,lang*Nrad,(iang+1)*Nrad-1,(lang+1)*Nrad-1));
+                  Rmat00+=(LMfac*cpl00)*Psub;
+                  Rmat02+=(LMfac*cpl02)*Psub;
+                  Rmat20+=(LMfac*cpl20)*Psub;
+                  Rmat22+=(LMfac*cpl22)*Psub;
+                  couple=true;
+                }
+              }
+              if(!couple)
+                continue;
+
+              // Loop over elements
+              for(size_t iel=0;iel<Nel;iel++) {
+                size_t ifirst, ilast;
+                radial.get_idx(iel,ifirst,ilast);
+                size_t Ni(ilast-ifirst+1);
+
+                for(size_t jel=0;jel<Nel;jel++) {
+                  size_t jfirst, jlast;
+                  radial.get_idx(jel,jfirst,jlast);
+                  size_t Nj(jlast-jfirst+1);
+
+                  arma::mat Ksub;
+                  if(iel == jel) {
+                    // In-element integrals, see exchange() for the ordering
+                    Ksub=(*ktei[iel])*arma::vectorise(Rmat00.submat(ifirst,jfirst,ilast,jlast));
+                    Ksub+=(*ktei[Nel+iel])*arma::vectorise(Rmat02.submat(ifirst,jfirst,ilast,jlast));
+                    Ksub+=(*ktei[2*Nel+iel])*arma::vectorise(Rmat20.submat(ifirst,jfirst,ilast,jlast));
+                    Ksub+=(*ktei[3*Nel+iel])*arma::vectorise(Rmat22.submat(ifirst,jfirst,ilast,jlast));
+                    Ksub.reshape(Ni,Nj);
+                    Ksub*=-1.0;
+                  } else {
+                    // Disjoint integrals. When r(iel)>r(jel), iel gets Q, jel gets P.
+                    const arma::mat & iint0=(iel>jel) ? disjoint_Q0[ilm*Nel+iel] : disjoint_P0[ilm*Nel+iel];
+                    const arma::mat & iint2=(iel>jel) ? disjoint_Q2[ilm*Nel+iel] : disjoint_P2[ilm*Nel+iel];
+                    const arma::mat & jint0=(iel>jel) ? disjoint_P0[ilm*Nel+jel] : disjoint_Q0[ilm*Nel+jel];
+                    const arma::mat & jint2=(iel>jel) ? disjoint_P2[ilm*Nel+jel] : disjoint_Q2[ilm*Nel+jel];
+
+                    Ksub=-iint0*(Rmat00.submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint0) + Rmat02.submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint2));
+                    Ksub-=iint2*(Rmat20.submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint0) + Rmat22.submat(ifirst,jfirst,ilast,jlast)*arma::trans(jint2));
+                  }
+
+                  // Each thread has its own angular block of K
+                  K.submat(jang*Nrad+ifirst,kang*Nrad+jfirst,jang*Nrad+ilast,kang*Nrad+jlast)+=Ksub;
+                }
+              }
+            }
+          }
+        }
+
+        return remove_boundaries(K);
+      }
+
       arma::mat TwoDBasis::remove_boundaries(const arma::mat & Fnob) const {
         if(Fnob.n_rows != Ndummy() || Fnob.n_cols != Ndummy()) {
           std::ostringstream oss;
@@ -1739,14 +2159,23 @@ namespace helfem {
           throw std::logic_error(oss.str());
         }
 
-        // Get indices
-        arma::uvec idx(pure_indices());
-
-        // Matrix with the boundary conditions removed
-        arma::mat Fpure(Fnob(idx,idx));
-
-        //Fnob.print("Input: w/o built-in boundaries");
-        //Fpure.print("Output: w built-in boundaries");
+        // Matrix with the boundary conditions removed. The pure
+        // functions of each shell are contiguous, so the matrix is
+        // copied block by block; shells with m != 0 drop their first
+        // radial function.
+        const size_t Nr(radial.Nbf());
+        arma::mat Fpure(Nbf(),Nbf());
+        size_t joff=0;
+        for(size_t j=0;j<mval.n_elem;j++) {
+          const size_t js(mval(j)!=0);
+          size_t ioff=0;
+          for(size_t i=0;i<mval.n_elem;i++) {
+            const size_t is(mval(i)!=0);
+            Fpure.submat(ioff,joff,ioff+Nr-is-1,joff+Nr-js-1)=Fnob.submat(i*Nr+is,j*Nr+js,(i+1)*Nr-1,(j+1)*Nr-1);
+            ioff+=Nr-is;
+          }
+          joff+=Nr-js;
+        }
 
         return Fpure;
       }
@@ -1758,18 +2187,62 @@ namespace helfem {
           throw std::logic_error(oss.str());
         }
 
-        // Get indices
-        arma::uvec idx(pure_indices());
+        // Matrix without the boundary conditions, copied block by block
+        const size_t Nr(radial.Nbf());
+        arma::mat Pnob(Ndummy(),Ndummy(),arma::fill::zeros);
+        size_t joff=0;
+        for(size_t j=0;j<mval.n_elem;j++) {
+          const size_t js(mval(j)!=0);
+          size_t ioff=0;
+          for(size_t i=0;i<mval.n_elem;i++) {
+            const size_t is(mval(i)!=0);
+            Pnob.submat(i*Nr+is,j*Nr+js,(i+1)*Nr-1,(j+1)*Nr-1)=Ppure.submat(ioff,joff,ioff+Nr-is-1,joff+Nr-js-1);
+            ioff+=Nr-is;
+          }
+          joff+=Nr-js;
+        }
 
-        // Matrix with the boundary conditions removed
-        arma::mat Pnob(Ndummy(),Ndummy());
-        Pnob.zeros();
-        Pnob(idx,idx)=Ppure;
+        return Pnob;
+      }
 
-        //Ppure.print("Input: w built-in boundaries");
-        //Pnob.print("Output: w/o built-in boundaries");
+      arma::mat TwoDBasis::expand_boundaries(const arma::mat & Ppure, const arma::uvec & idx) const {
+        if(Ppure.n_rows != Nbf() || Ppure.n_cols != Nbf()) {
+          std::ostringstream oss;
+          oss << "Matrix does not have expected size! Got " << Ppure.n_rows << " x " << Ppure.n_cols << ", expected " << Nbf() << " x " << Nbf() << "!\n";
+          throw std::logic_error(oss.str());
+        }
 
-        return Pnob;
+        // Offsets of the shells in the pure basis
+        const size_t Nr(radial.Nbf());
+        std::vector<size_t> shoff(mval.n_elem);
+        for(size_t i=0, ioff=0;i<mval.n_elem;i++) {
+          shoff[i]=ioff;
+          ioff+=Nr-(mval(i)!=0);
+        }
+
+        // Map the dummy indices onto the pure ones; the dropped
+        // functions stay zero
+        arma::uvec ipure(idx.n_elem), ikeep(idx.n_elem);
+        size_t nkeep=0;
+        for(size_t k=0;k<idx.n_elem;k++) {
+          if(idx(k)>=Ndummy())
+            throw std::logic_error("Dummy index out of bounds!\n");
+          const size_t iang(idx(k)/Nr), irad(idx(k)%Nr), is(mval(iang)!=0);
+          if(irad<is)
+            continue;
+          ipure(nkeep)=shoff[iang]+irad-is;
+          ikeep(nkeep)=k;
+          nkeep++;
+        }
+
+        arma::mat Psub(idx.n_elem,idx.n_elem,arma::fill::zeros);
+        if(nkeep) {
+          ipure=ipure.head(nkeep);
+          ikeep=ikeep.head(nkeep);
+          Psub(ikeep,ikeep)=Ppure(ipure,ipure);
+        }
+
+        return Psub;
       }
 
       void TwoDBasis::set_zero(int lmax, arma::mat & M) const {
@@ -2013,6 +2486,10 @@ namespace helfem {
         return radial.get_bf(iel);
       }
 
+      arma::mat TwoDBasis::get_rad_df(size_t iel) const {
+        return radial.get_df(iel);
+      }
+
       arma::vec TwoDBasis::get_wrad(size_t iel) const {
         return radial.get_wrad(iel);
       }
@@ -20,6 +20,8 @@
 #include "FiniteElementBasis.h"
 #include "../general/gaunt.h"
 #include "../general/legendretable.h"
+#include "../general/scratchfile.h"
+#include <memory>
 
 namespace helfem {
   namespace diatomic {
@@ -84,8 +86,12 @@ namespace helfem {
         /// Compute primitive two-electron integral
         arma::mat twoe_integral(int alpha, int beta, size_t iel, int L, int M, const legendretable::LegendreTable & legtab) const;
 
-        /// Get quadrature points
-        arma::vec get_chmu_quad() const;
+        /**
+         * Get cosh(mu) at the quadrature points of an element: the
+         * element's own points, followed by the points of each of the
+         * subintervals used for the in-element two-electron integrals
+         */
+        arma::vec get_chmu_quad(size_t iel) const;
         /// Evaluate basis functions at quadrature points
         arma::mat get_bf(size_t iel) const;
         /// Evaluate basis functions at wanted point in [-1,1]
@@ -128,6 +134,28 @@ namespace helfem {
         gaunt::Gaunt gaunt;
         /// Legendre function table
         legendretable::LegendreTable legtab;
+        /// Parameters of the Legendre function table
+        int leg_Lpad, leg_Lmax, leg_Mmax;
+        /// Points the Legendre functions are needed at
+        std::vector<arma::vec> legendre_points() const;
+        /// Compute the Legendre function table
+        void compute_legendre_table();
+
+        /// Coupling of the angular block (kang, lang) to an (L,M) channel
+        typedef struct {
+          size_t kang, lang, iLM;
+          double cpl0, cpl2;
+        } coulomb_coupling_t;
+        /// Nonzero Coulomb couplings, ordered by angular block
+        std::vector<coulomb_coupling_t> Jcoupling;
+        /// Offset of each angular block kang*Nang+lang in Jcoupling
+        std::vector<size_t> Jcoupling_block;
+        /// Indices of the couplings of each (L,M) channel
+        std::vector< std::vector<size_t> > Jcoupling_LM;
+        /// Form the Coulomb coupling lists
+        void form_coulomb_couplings();
+        /// (L,M) channels belonging to each (L,|M|) channel
+        std::vector< std::vector<size_t> > lm_LM;
 
         /// L, |M| map
         std::vector<lmidx_t> lm_map;
@@ -142,6 +170,27 @@ namespace helfem {
         /// Primitive two-electron integrals: <Nel^2 * N_L> sorted for exchange
         std::vector<arma::mat> prim_ktei00, prim_ktei02, prim_ktei20, prim_ktei22;
 
+        /// Scratch file for the primitive two-electron integrals, empty for in-core storage
+        std::string tei_scratch;
+        /// Out-of-core primitive two-electron integrals
+        std::shared_ptr<ScratchFile> teistore;
+        /// Are exchange-sorted integrals in the scratch file?
+        bool scratch_ktei;
+        /// Partition of the (L,|M|) channels handled by this basis
+        size_t part_index, part_count;
+        /// Is the (L,|M|) channel in this partition?
+        bool owns_channel(size_t ilm) const;
+        /// Compute the primitive two-electron integrals into the scratch file
+        void compute_tei_scratch(bool exchange);
+        /**
+         * Get the in-element integrals of an (L,|M|) channel in the
+         * order 00, 02, 20, 22 for each element. The integrals are
+         * read into buf if they are stored out of core.
+         */
+        void get_tei_channel(size_t ilm, bool exchange, std::vector<arma::mat> & buf, std::vector<const arma::mat *> & tei) const;
+        /// Exchange matrix with the integrals streamed from disk
+        arma::mat exchange_scratch(const arma::mat & P) const;
+
         /// Add to radial submatrix
         void add_sub(arma::mat & M, size_t iang, size_t jang, const arma::mat & Msub) const;
         /// Set radial submatrix
@@ -168,6 +217,13 @@ namespace helfem {
         int get_Z2() const;
         /// Get Rhalf
         double get_Rhalf() const;
+        /**
+         * Change the bond length. The basis functions are defined in
+         * the scaled prolate spheroidal coordinates, so the primitive
+         * two-electron integrals and the Legendre table stay valid;
+         * only the Rhalf prefactors of the integrals change.
+         */
+        void set_Rhalf(double Rhalf);
 
         /// Get l values
         arma::ivec get_lval() const;
@@ -186,11 +242,15 @@ namespace helfem {
         int get_poly_order() const;
         /// Get polynomial basis order
         int get_poly_nnodes() const;
+        /// Hash identifying the basis set and the nuclei, for reusing data between runs
+        std::string fingerprint() const;
 
         /// Get indices of real basis functions
         arma::uvec pure_indices() const;
         /// Expand boundary conditions
         arma::mat expand_boundaries(const arma::mat & H) const;
+        /// Block H(idx,idx) of the expanded matrix for the given dummy indices, without forming the full expansion
+        arma::mat expand_boundaries(const arma::mat & H, const arma::uvec & idx) const;
         /// Remove boundary conditions
         arma::mat remove_boundaries(const arma::mat & H) const;
 
@@ -201,6 +261,22 @@ namespace helfem {
         /// Memory for auxiliary two-electron integrals
         size_t mem_2el_aux() const;
 
+        /// Get the Legendre function table, computing it if necessary
+        const legendretable::LegendreTable & get_legendre_table();
+        /// Use a precomputed Legendre function table; returns false if it does not match the basis
+        bool set_legendre_table(const legendretable::LegendreTable & tab);
+
+        /**
+         * Only handle the (L,|M|) channels ilm with ilm % npart ==
+         * ipart in the two-electron integrals. The Coulomb and
+         * exchange matrices are then partial, and summing them over
+         * all the partitions gives the full matrices, so the work and
+         * memory can be split between processes with a single
+         * reduction per build.
+         */
+        void set_partition(size_t ipart, size_t npart);
+        /// Store the primitive two-electron integrals in a scratch file instead of memory
+        void set_tei_scratch(const std::string & fname);
         /// Compute two-electron integrals
         void compute_tei(bool exchange);
 
@@ -294,6 +370,8 @@ namespace helfem {
         arma::vec get_r(size_t iel) const;
         /// Get radial basis functions
         arma::mat get_rad_bf(size_t iel) const;
+        /// Get radial basis function derivatives
+        arma::mat get_rad_df(size_t iel) const;
 
         /// Electron density at nuclei
         arma::vec nuclear_density(const arma::mat & P) const;
@@ -22,6 +22,7 @@
 #include "twodquadrature.h"
 #include <cfloat>
 #include <climits>
+#include <memory>
 
 using namespace helfem;
 
@@ -36,6 +37,8 @@ int main(int argc, char **argv) {
   parser.add<double>("maxexp", 0, "minimum exponent", false, 1e10);
   parser.add<int>("nexp", 0, "number of points in exponent scan", false, 501);
   parser.add<int>("iprobe", 0, "probe to use: 0 for gto, 1 for sto", false, 0);
+  parser.add<int>("exponent_batch", 0, "number of exponents per projection batch, 0 for all at once", false, 0);
+  parser.add<std::string>("output", 0, "checkpoint file to store the profiles in, empty for separate text files", false, "completeness.chk");
   parser.parse_check(argc, argv);
 
   // Get parameters
@@ -46,6 +49,8 @@ int main(int argc, char **argv) {
   double maxexp(parser.get<double>("maxexp"));
   int nexp(parser.get<int>("nexp"));
   int iprobe(parser.get<int>("iprobe"));
+  int nbatch(parser.get<int>("exponent_batch"));
+  std::string output(parser.get<std::string>("output"));
 
   // Load checkpoint
   Checkpoint loadchk(load,false);
@@ -54,16 +59,19 @@ int main(int argc, char **argv) {
   loadchk.read(basis);
   // Sinvh
   arma::mat Sinvh;
-  loadchk.read("Sinvh",Sinvh);
+  if(loadchk.exist("Sinvh"))
+    loadchk.read("Sinvh",Sinvh);
+  else
+    // Compact checkpoint
+    Sinvh=basis.Sinvh(true,0);
   arma::mat Sinv(Sinvh*arma::trans(Sinvh));
-  // Orbitals
-  arma::mat Ca, Cb;
-  loadchk.read("Ca",Ca);
-  loadchk.read("Cb",Cb);
   // Number of occupied orbitals
   int nela, nelb;
   loadchk.read("nela",nela);
   loadchk.read("nelb",nelb);
+  // Orbitals are mapped in; only the occupied ones are touched
+  const arma::mat Ca(loadchk.map("Ca"));
+  const arma::mat Cb(nelb ? loadchk.map("Cb") : arma::mat());
   // Nuclear charges
   int Z1, Z2;
   loadchk.read("Z1",Z1);
@@ -82,8 +90,22 @@ int main(int argc, char **argv) {
   // Exponents
   arma::vec expn(arma::exp10(arma::linspace<arma::vec>(log10(minexp),log10(maxexp),nexp)));
 
-  // Compute radial functions
-  arma::vec r(arma::linspace<arma::vec>(0.0,100.0,1000));
+  // By default, all exponents are handled at once so that the basis functions are only evaluated once
+  arma::uword exponent_batch_size = (nbatch>0) ? nbatch : expn.n_elem;
+
+  // All the profiles go in a single file
+  std::unique_ptr<Checkpoint> outchk;
+  if(output.size()) {
+    outchk.reset(new Checkpoint(output,true));
+    outchk->open();
+    outchk->write("exponents",arma::mat(expn));
+  }
+  std::function<void(const std::string & name, const arma::mat & profile)> save_profile = [&outchk](const std::string & name, const arma::mat & profile) {
+    if(outchk)
+      outchk->write(name,profile);
+    else
+      profile.save(name+".dat",arma::raw_ascii);
+  };
 
   for(size_t im=0;im<muni.size();im++) {
     int m=muni(im);
@@ -186,7 +208,6 @@ int main(int argc, char **argv) {
           throw std::logic_error("Unknown probe\n");
 
         // Loop over batches of exponents
-        arma::uword exponent_batch_size = 200;
         for(arma::uword exponent_batch = 0; exponent_batch <= expn.n_elem/exponent_batch_size; exponent_batch++) {
           arma::uword istart = exponent_batch_size*exponent_batch;
           arma::uword iend = std::min(exponent_batch_size*(exponent_batch+1), expn.n_elem) - 1;
@@ -283,23 +304,20 @@ int main(int argc, char **argv) {
         // Save importance profile
         {
           std::ostringstream oss;
-          oss << "importance0_" << lcao << "_" << indices[icen] << "_" << l << "_" << m << ".dat";
-          I0 = I0.t();
-          I0.save(oss.str(),arma::raw_ascii);
+          oss << "importance0_" << lcao << "_" << indices[icen] << "_" << l << "_" << m;
+          save_profile(oss.str(),I0.t());
         }
         {
           std::ostringstream oss;
-          oss << "importance_" << lcao << "_" << indices[icen] << "_" << l << "_" << m << ".dat";
-          I = I.t();
-          I.save(oss.str(),arma::raw_ascii);
+          oss << "importance_" << lcao << "_" << indices[icen] << "_" << l << "_" << m;
+          save_profile(oss.str(),I.t());
         }
 
         // Save completeness profile
         {
           std::ostringstream oss;
-          oss << "completeness_" << lcao << "_" << indices[icen] << "_" << l << "_" << m << ".dat";
-          Y = Y.t();
-          Y.save(oss.str(),arma::raw_ascii);
+          oss << "completeness_" << lcao << "_" << indices[icen] << "_" << l << "_" << m;
+          save_profile(oss.str(),Y.t());
         }
 
         /*
@@ -319,5 +337,10 @@ int main(int argc, char **argv) {
     }
   }
 
+  if(outchk) {
+    outchk->close();
+    printf("Profiles saved in %s\n",output.c_str());
+  }
+
   return 0;
 }
@@ -38,6 +38,7 @@ int main(int argc, char **argv) {
   parser.add<int>("lang", 0, "number of quadrature points in nu (automatic default)", false, -1);
   parser.add<int>("mang", 0, "number of quadrature points in phi (automatic default)", false, -1);
   parser.add<std::string>("output", 0, "save density to file", false, "density.hdf5");
+  parser.add<bool>("orbitals", 0, "save also the values of the occupied orbitals", false, false);
   parser.parse_check(argc, argv);
 
   // Get parameters
@@ -50,6 +51,7 @@ int main(int argc, char **argv) {
   int mang(parser.get<int>("mang"));
 
   std::string output(parser.get<std::string>("output"));
+  bool orbitals(parser.get<bool>("orbitals"));
 
   // Load checkpoint
   Checkpoint loadchk(load,false);
@@ -65,17 +67,18 @@ int main(int argc, char **argv) {
   if(mang<=0)
     mang=4*arma::max(arma::abs(basis.get_mval()))+5;
 
-  arma::vec cth, phi, wang;
-  helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
+  const helfem::angular::angular_rule_t & angrule(helfem::angular::angular_rule(lang,mang));
+  const arma::vec & cth(angrule.cth);
+  const arma::vec & phi(angrule.phi);
+  const arma::vec & wang(angrule.w);
   printf("Using angular quadrature grid with L=%i M=%i with %i points\n",lang,mang,(int) cth.n_elem);
 
-  // Density matrix
-  arma::mat Ca, Cb;
-  loadchk.read("Ca",Ca);
-  loadchk.read("Cb",Cb);
+  // Orbitals are mapped in; only the occupied ones are touched
   int nela, nelb;
   loadchk.read("nela",nela);
   loadchk.read("nelb",nelb);
+  const arma::mat Ca(loadchk.map("Ca"));
+  const arma::mat Cb(nelb ? loadchk.map("Cb") : arma::mat());
 
   // mu array
   std::vector<arma::vec> mu(basis.get_rad_Nel()), wmu(basis.get_rad_Nel());
@@ -93,10 +96,10 @@ int main(int argc, char **argv) {
   // Pretabulate basis function data
   arma::ivec lval(basis.get_lval());
   arma::ivec mval(basis.get_mval());
+  const arma::cx_mat & ylm(helfem::angular::spherical_harmonics_table(lang,mang,arma::max(lval)));
   arma::cx_mat sph(wang.n_elem,lval.n_elem);
   for(size_t il=0;il<lval.n_elem;il++)
-    for(size_t iang=0;iang<wang.n_elem;iang++)
-      sph(iang,il)=::spherical_harmonics(lval(il),mval(il),cth(iang),phi(iang));
+    sph.col(il)=arma::trans(ylm.row(::spherical_harmonics_index(lval(il),mval(il))));
 
   // Evaluate radial functions
   std::vector<arma::mat> radbf(basis.get_rad_Nel());
@@ -104,56 +107,68 @@ int main(int argc, char **argv) {
     radbf[iel] = basis.get_rad_bf(iel);
   }
 
-  // Density arrays
-  arma::vec dena(Ngrid,arma::fill::zeros), denb(Ngrid,arma::fill::zeros), dV(Ngrid,arma::fill::zeros);
-  arma::mat orba(Ngrid,nela,arma::fill::zeros), orbb(Ngrid,nelb,arma::fill::zeros);
+  // The output is written element by element as it is computed
+  Checkpoint savechk(output,true);
+  savechk.open();
+  const std::vector<std::string> vecnames({"mu","dV","cth","phi","P","Pa","Pb"});
+  for(size_t i=0;i<vecnames.size();i++)
+    savechk.create(vecnames[i],Ngrid,1);
+  if(orbitals) {
+    savechk.create("orba.re",Ngrid,nela);
+    savechk.create("orba.im",Ngrid,nela);
+    if(nelb) {
+      savechk.create("orbb.re",Ngrid,nelb);
+      savechk.create("orbb.im",Ngrid,nelb);
+    }
+  }
 
-  arma::vec mugrid(Ngrid,arma::fill::zeros);
-  arma::vec cthgrid(Ngrid,arma::fill::zeros);
-  arma::vec phigrid(Ngrid,arma::fill::zeros);
-  arma::cx_mat orbagrid(Ngrid,nela,arma::fill::zeros);
-  arma::cx_mat orbbgrid;
-  if(nelb)
-    orbbgrid.zeros(Ngrid,nelb);
+  // Number of grid points in an element
+  const size_t Nrad(mu[0].n_elem);
+  const size_t Nblock(Nrad*wang.n_elem);
 
+  double Na=0.0, Nb=0.0;
   arma::cx_mat Sa(nela,nela,arma::fill::zeros), Sb;
   if(nelb>0)
     Sb.zeros(nelb,nelb);
 
-  size_t igrid=0;
-  // Loop over radial elements
-  for(size_t iel=0;iel<mu.size();iel++) {
-    // Get the list of basis functions in the element in the dummy
-    // indexing
-    arma::uvec bidx=basis.bf_list(iel);
-
-    // Orbital submatrices
-    arma::mat Casub(Ca.cols(0,nela-1));
-    Casub = Casub.rows(bidx);
-    arma::mat Cbsub;
-    if(nelb) {
-      Cbsub=Cb.cols(0,nelb-1);
-      Cbsub=Cbsub.rows(bidx);
-    }
-
-    // Radial values
-    arma::vec r(mu[iel]);
-    arma::vec wr(wmu[iel]);
-
-    // Loop over angular output grid
-    for(size_t iang=0;iang<wang.n_elem;iang++) {
-      // Loop over radial points
-      for(size_t irad=0;irad<radbf[iel].n_rows;irad++) {
-        // Form matrix of basis function values
-        arma::cx_rowvec bf(bidx.n_elem);
-        {
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+  {
+    arma::cx_mat Sawrk(Sa), Sbwrk(Sb);
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,1) reduction(+:Na,Nb)
+#endif
+    for(size_t iel=0;iel<mu.size();iel++) {
+      // Get the list of basis functions in the element in the dummy
+      // indexing
+      arma::uvec bidx=basis.bf_list(iel);
+
+      // Orbital submatrices
+      arma::mat Casub(Ca.submat(bidx,arma::regspace<arma::uvec>(0,nela-1)));
+      arma::mat Cbsub;
+      if(nelb)
+        Cbsub=Cb.submat(bidx,arma::regspace<arma::uvec>(0,nelb-1));
+
+      // Radial values
+      const arma::vec & r(mu[iel]);
+      const arma::vec & wr(wmu[iel]);
+
+      // Basis function values and grid data in the element, ordered
+      // by angular and then radial point
+      arma::cx_mat bf(Nblock,bidx.n_elem);
+      arma::vec mugrid(Nblock), cthgrid(Nblock), phigrid(Nblock), dV(Nblock);
+      for(size_t iang=0;iang<wang.n_elem;iang++) {
+        for(size_t irad=0;irad<Nrad;irad++) {
+          size_t ip=iang*Nrad+irad;
           size_t ioff=0;
           // Loop over angular basis
           for(size_t il=0;il<lval.n_elem;il++) {
             // Loop over in-element radial functions
             size_t firstfun = ((iel==0) && (mval(il)!=0)) ? 1 : 0;
             for(size_t ifun=firstfun;ifun<radbf[iel].n_cols;ifun++) {
-              bf(ioff++) = sph(iang,il)*radbf[iel](irad,ifun);
+              bf(ip,ioff++) = sph(iang,il)*radbf[iel](irad,ifun);
             }
           }
           if(ioff != bidx.n_elem) {
@@ -161,74 +176,86 @@ int main(int argc, char **argv) {
             fflush(stdout);
             throw std::logic_error("Indexing problem!\n");
           }
-        }
-
-        // Compute orbital values
-        arma::cx_rowvec orbaval = bf*Casub;
-        arma::cx_rowvec orbbval;
-        if(nelb)
-          orbbval = bf*Cbsub;
-
-        // Store result
-        dena(igrid)=std::real(arma::cdot(orbaval,orbaval));
-        denb(igrid)=nelb ? std::real(arma::cdot(orbbval,orbbval)) : 0.0;
 
-        // Store grid values
-        mugrid(igrid) = r(irad);
-        cthgrid(igrid) = cth(iang);
-        phigrid(igrid) = phi(iang);
+          // Store grid values
+          mugrid(ip) = r(irad);
+          cthgrid(ip) = cth(iang);
+          phigrid(ip) = phi(iang);
 
-        // Volume element is
-        double shmu(sinh(r(irad)));
-        double chmu(cosh(r(irad)));
-        dV(igrid)=std::pow(basis.get_Rhalf(),3)*shmu*(chmu*chmu - cth(iang)*cth(iang))*wr(irad)*wang(iang);
-
-        // Orbital values
-        orbagrid.row(igrid) = orbaval;
-        if(nelb)
-          orbbgrid.row(igrid) = orbbval;
-
-        Sa += arma::trans(orbaval)*dV(igrid)*orbaval;
-        if(nelb)
-          Sb += arma::trans(orbbval)*dV(igrid)*orbbval;
+          // Volume element is
+          double shmu(sinh(r(irad)));
+          double chmu(cosh(r(irad)));
+          dV(ip)=std::pow(basis.get_Rhalf(),3)*shmu*(chmu*chmu - cth(iang)*cth(iang))*wr(irad)*wang(iang);
+        }
+      }
 
-        igrid++;
+      // Orbital values
+      arma::cx_mat orbaval(bf*Casub), orbbval;
+      if(nelb)
+        orbbval=bf*Cbsub;
+
+      // Densities
+      arma::vec dena(arma::sum(arma::square(arma::real(orbaval))+arma::square(arma::imag(orbaval)),1));
+      arma::vec denb(Nblock,arma::fill::zeros);
+      if(nelb)
+        denb=arma::sum(arma::square(arma::real(orbbval))+arma::square(arma::imag(orbbval)),1);
+
+      Na+=arma::dot(dena,dV);
+      Nb+=arma::dot(denb,dV);
+
+      arma::cx_vec cdV(dV,arma::zeros<arma::vec>(Nblock));
+      Sawrk += arma::trans(orbaval)*(orbaval.each_col()%cdV);
+      if(nelb)
+        Sbwrk += arma::trans(orbbval)*(orbbval.each_col()%cdV);
+
+      // Write out the element's block
+      size_t r0(iel*Nblock);
+#ifdef _OPENMP
+#pragma omp critical(density_grid_output)
+#endif
+      {
+        savechk.write_rows("mu",mugrid,r0);
+        savechk.write_rows("dV",dV,r0);
+        savechk.write_rows("cth",cthgrid,r0);
+        savechk.write_rows("phi",phigrid,r0);
+        savechk.write_rows("P",dena+denb,r0);
+        savechk.write_rows("Pa",dena,r0);
+        savechk.write_rows("Pb",denb,r0);
+        if(orbitals) {
+          savechk.write_rows("orba.re",arma::real(orbaval),r0);
+          savechk.write_rows("orba.im",arma::imag(orbaval),r0);
+          if(nelb) {
+            savechk.write_rows("orbb.re",arma::real(orbbval),r0);
+            savechk.write_rows("orbb.im",arma::imag(orbbval),r0);
+          }
+        }
       }
     }
-  }
-  if(igrid != dena.n_elem)
-    throw std::logic_error("Indexing error!\n");
 
-  // Total density
-  arma::vec den(dena+denb);
+#ifdef _OPENMP
+#pragma omp critical(density_grid_overlap)
+#endif
+    {
+      Sa+=Sawrk;
+      if(nelb)
+        Sb+=Sbwrk;
+    }
+  }
 
-  printf("Norm of Pa on grid is %e\n",arma::sum(dena%dV));
-  printf("Norm of Pb on grid is %e\n",arma::sum(denb%dV));
-  printf("Norm of P on grid is %e\n",arma::sum(den%dV));
+  printf("Norm of Pa on grid is %e\n",Na);
+  printf("Norm of Pb on grid is %e\n",Nb);
+  printf("Norm of P on grid is %e\n",Na+Nb);
 
   printf("Alpha-alpha orbital non-orthonormality %e\n",arma::norm(Sa-arma::eye<arma::cx_mat>(Sa.n_rows,Sa.n_cols),"fro"));
   if(nelb)
     printf("Beta-beta   orbital non-orthonormality %e\n",arma::norm(Sb-arma::eye<arma::cx_mat>(Sb.n_rows,Sb.n_cols),"fro"));
 
-  Checkpoint savechk(output,true);
-  savechk.write("mu",mugrid);
-  savechk.write("dV",dV);
-  savechk.write("cth",cthgrid);
-  savechk.write("phi",phigrid);
-  savechk.write("P",den);
-  savechk.write("Pa",dena);
-  savechk.write("Pb",denb);
-  savechk.write("orba.re",arma::real(orbagrid));
-  savechk.write("orba.im",arma::imag(orbagrid));
-  if(nelb) {
-    savechk.write("orbb.re",arma::real(orbbgrid));
-    savechk.write("orbb.im",arma::imag(orbbgrid));
-  }
   savechk.write("Rh",basis.get_Rhalf());
   savechk.write("Z1",basis.get_Z1());
   savechk.write("Z2",basis.get_Z2());
   int mmax = arma::max(basis.get_mval());
   savechk.write("mmax",mmax);
+  savechk.close();
   printf("Saved density to file %s\n",output.c_str());
 
   return 0;
@@ -35,6 +35,7 @@ int main(int argc, char **argv) {
   parser.add<double>("zmax", 0, "z max", false, 5.0);
   parser.add<int>("Nz", 0, "number of points in z", false, 101);
   parser.add<std::string>("savedens", 0, "save density to file", false, "density.dat");
+  parser.add<std::string>("lines", 0, "file with x and y values of a batch of lines, one per row", false, "");
   parser.parse_check(argc, argv);
 
   // Get parameters
@@ -45,63 +46,94 @@ int main(int argc, char **argv) {
   double zmax(parser.get<double>("zmax"));
   std::string savedens(parser.get<std::string>("savedens"));
   int Nz(parser.get<int>("Nz"));
-  
+  std::string lines(parser.get<std::string>("lines"));
+
   // Load checkpoint
   Checkpoint loadchk(load,false);
   // Basis set
   diatomic::basis::TwoDBasis basis;
   loadchk.read(basis);
   // Density matrix
-  arma::mat Pa, Pb;
-  loadchk.read("Pa",Pa);
-  loadchk.read("Pb",Pb);
+  const arma::mat Pa(loadchk.map("Pa"));
+  const arma::mat Pb(loadchk.map("Pb"));
   // Rhalf
   double Rhalf;
   loadchk.read("Rhalf",Rhalf);
 
   const arma::vec z(arma::linspace<arma::vec>(zmin,zmax,Nz));
-  
-  // Solve for phi angle
-  const double phi(atan2(y,x));
-  const double xysq(x*x+y*y);
-
-  // Densities
-  arma::mat den(Nz,4);
-  den.zeros();
-  for(size_t iz=0;iz<z.n_elem;iz++) {
-    // Compute distances of point from the two nuclei
-    double ra(sqrt(std::pow(z(iz)+Rhalf,2)+xysq));
-    double rb(sqrt(std::pow(z(iz)-Rhalf,2)+xysq));
-
-    // xi and eta are
-    double xi((ra+rb)/(2*Rhalf));
-    double eta((ra-rb)/(2*Rhalf));
-
-    // Sanity check
-    if(eta<-1.0)
-      eta=-1.0;
-    if(eta>1.0)
-      eta=1.0;
-
-    // so mu is
-    double mu(utils::arcosh(xi));
-
-    // Check range: is mu outside of basis set?
-    if(mu>basis.get_mumax())
-      continue;
-
-    // Evaluate basis functions
-    arma::cx_vec bf(basis.eval_bf(mu, eta, phi));
-
-    // Evaluate density at the point
-    den(iz,0)=z(iz);
-    den(iz,1)=std::real(arma::as_scalar(bf.t()*Pa*bf));
-    den(iz,2)=std::real(arma::as_scalar(bf.t()*Pb*bf));
-    den(iz,3)=den(iz,1)+den(iz,2);
+
+  // Lines to evaluate
+  arma::mat xy;
+  if(lines.size()) {
+    xy.load(lines,arma::raw_ascii);
+    if(xy.n_cols < 2)
+      throw std::logic_error("Must have at least two columns in line data.\n");
+  } else {
+    xy.zeros(1,2);
+    xy(0,0)=x;
+    xy(0,1)=y;
   }
 
+  // Densities of the batch are written out line by line
+  FILE *out=fopen(savedens.c_str(),"w");
+  if(!out)
+    throw std::runtime_error("Error opening density file " + savedens + ".\n");
   printf("Saving density to file %s\n",savedens.c_str());
-  den.save(savedens,arma::raw_ascii);
+
+  for(size_t iline=0;iline<xy.n_rows;iline++) {
+    // Solve for phi angle
+    const double phi(atan2(xy(iline,1),xy(iline,0)));
+    const double xysq(xy(iline,0)*xy(iline,0)+xy(iline,1)*xy(iline,1));
+
+    // Densities
+    arma::mat den(Nz,4);
+    den.zeros();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,16)
+#endif
+    for(size_t iz=0;iz<z.n_elem;iz++) {
+      // Compute distances of point from the two nuclei
+      double ra(sqrt(std::pow(z(iz)+Rhalf,2)+xysq));
+      double rb(sqrt(std::pow(z(iz)-Rhalf,2)+xysq));
+
+      // xi and eta are
+      double xi((ra+rb)/(2*Rhalf));
+      double eta((ra-rb)/(2*Rhalf));
+
+      // Sanity check
+      if(eta<-1.0)
+        eta=-1.0;
+      if(eta>1.0)
+        eta=1.0;
+
+      // so mu is
+      double mu(utils::arcosh(xi));
+
+      // Check range: is mu outside of basis set?
+      if(mu>basis.get_mumax())
+        continue;
+
+      // Evaluate basis functions
+      arma::cx_vec bf(basis.eval_bf(mu, eta, phi));
+
+      // Evaluate density at the point
+      den(iz,0)=z(iz);
+      den(iz,1)=std::real(arma::as_scalar(bf.t()*Pa*bf));
+      den(iz,2)=std::real(arma::as_scalar(bf.t()*Pb*bf));
+      den(iz,3)=den(iz,1)+den(iz,2);
+    }
+
+    // Lines in a batch are separated by blank lines and prefixed by x and y
+    if(lines.size() && iline)
+      fprintf(out,"\n\n");
+    for(size_t iz=0;iz<den.n_rows;iz++) {
+      if(lines.size())
+        fprintf(out,"% .16e % .16e ",xy(iline,0),xy(iline,1));
+      fprintf(out,"% .16e % .16e % .16e % .16e\n",den(iz,0),den(iz,1),den(iz,2),den(iz,3));
+    }
+    fflush(out);
+  }
+  fclose(out);
 
   return 0;
 }
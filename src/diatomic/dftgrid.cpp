@@ -24,6 +24,11 @@
 #include "../general/dftfuncs.h"
 // Angular quadrature
 #include "../general/angular.h"
+#include "../general/spherical_harmonics.h"
+#include "utils.h"
+#include "../general/timer.h"
+#include "../general/blockscatter.h"
+#include "../general/threading.h"
 
 // OpenMP parallellization for XC calculations
 #ifdef _OPENMP
@@ -33,7 +38,7 @@
 namespace helfem {
   namespace diatomic {
     namespace dftgrid {
-      DFTGridWorker::DFTGridWorker() {
+      DFTGridWorker::DFTGridWorker() : angrule(NULL), rad_iel(-1) {
       }
 
       DFTGridWorker::DFTGridWorker(const helfem::diatomic::basis::TwoDBasis * basp_, int lang, int mang) : basp(basp_) {
@@ -42,7 +47,38 @@ namespace helfem {
         do_lapl=false;
 
         // Get angular grid
-        helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
+        angrule=&helfem::angular::angular_rule(lang,mang);
+        const arma::vec & cth(angrule->cth);
+        const arma::vec & phi(angrule->phi);
+        sth.zeros(cth.n_elem);
+        for(size_t ia=0;ia<cth.n_elem;ia++)
+          sth(ia)=sqrt(1.0 - cth(ia)*cth(ia));
+
+        // Angular factors are the same at every radial point
+        arma::ivec lval(basp->get_lval());
+        arma::ivec mval(basp->get_mval());
+        ang_bf.zeros(lval.n_elem,cth.n_elem);
+        ang_dth.zeros(lval.n_elem,cth.n_elem);
+        ang_dphi.zeros(lval.n_elem,cth.n_elem);
+        const arma::cx_mat & ylm(helfem::angular::spherical_harmonics_table(lang,mang,arma::max(lval)));
+        for(size_t ia=0;ia<cth.n_elem;ia++) {
+          // cot th = 1/tan th = cos th / sin th
+          double cotth=cth(ia)/sth(ia);
+          for(size_t i=0;i<lval.n_elem;i++) {
+            int l(lval(i));
+            int m(mval(i));
+            std::complex<double> sph(ylm(::spherical_harmonics_index(l,m),ia));
+
+            std::complex<double> angfac(m*cotth*sph);
+            if(m<l)
+              angfac+=sqrt((l-m)*(l+m+1))*std::exp(std::complex<double>(0,-phi(ia)))*ylm(::spherical_harmonics_index(l,m+1),ia);
+
+            ang_bf(i,ia)=std::conj(sph);
+            ang_dth(i,ia)=std::conj(angfac);
+            ang_dphi(i,ia)=std::conj(std::complex<double>(0.0,m)*sph);
+          }
+        }
+        rad_iel=-1;
       }
 
       DFTGridWorker::~DFTGridWorker() {
@@ -53,7 +89,7 @@ namespace helfem {
         if(!P0.n_elem) {
           throw std::runtime_error("Error - density matrix is empty!\n");
         }
-        arma::mat P(basp->expand_boundaries(P0)(bf_ind,bf_ind));
+        arma::mat P(basp->expand_boundaries(P0,bf_ind));
 
         // Non-polarized calculation.
         polarized=false;
@@ -62,54 +98,28 @@ namespace helfem {
         Pv=P*arma::conj(bf);
 
         // Calculate density
-        rho.zeros(1,wtot.n_elem);
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-        for(size_t ip=0;ip<wtot.n_elem;ip++)
-          rho(0,ip)=std::real(arma::dot(Pv.col(ip),bf.col(ip)));
+        rho=utils::real_column_dot(Pv,bf);
 
         // Calculate gradient
         if(do_grad) {
           grho.zeros(3,wtot.n_elem);
-          sigma.zeros(1,wtot.n_elem);
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-          for(size_t ip=0;ip<wtot.n_elem;ip++) {
-            // Calculate values
-            double g_rad=grho(0,ip)=2.0*std::real(arma::dot(Pv.col(ip),bf_rho.col(ip)))/scale_r(ip);
-            double g_th=grho(1,ip)=2.0*std::real(arma::dot(Pv.col(ip),bf_theta.col(ip)))/scale_theta(ip);
-            double g_phi=grho(2,ip)=2.0*std::real(arma::dot(Pv.col(ip),bf_phi.col(ip)))/scale_phi(ip);
-            // Compute sigma as well
-            sigma(0,ip)=g_rad*g_rad + g_th*g_th + g_phi*g_phi;
-          }
+          grho.row(0)=2.0*utils::real_column_dot(Pv,bf_rho)/scale_r;
+          grho.row(1)=2.0*utils::real_column_dot(Pv,bf_theta)/scale_theta;
+          grho.row(2)=2.0*utils::real_column_dot(Pv,bf_phi)/scale_phi;
+          // Compute sigma as well
+          sigma=arma::sum(arma::square(grho),0);
         }
 
         // Calculate laplacian and kinetic energy density
         if(do_tau) {
-          // Adjust size of grid
-          tau.zeros(1,wtot.n_elem);
-
           // Update helpers
           Pv_rho=P*arma::conj(bf_rho);
           Pv_theta=P*arma::conj(bf_theta);
           Pv_phi=P*arma::conj(bf_phi);
 
-          // Calculate values
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-          for(size_t ip=0;ip<wtot.n_elem;ip++) {
-            // Gradient term
-            double kinrho(std::real(arma::dot(Pv_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2));
-            double kintheta(std::real(arma::dot(Pv_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2));
-            double kinphi(std::real(arma::dot(Pv_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2));
-            double kin(kinrho + kintheta + kinphi);
-
-            // Store values
-            tau(0,ip)=0.5*kin;
-          }
+          // Gradient term, shared by tau and the laplacian
+          arma::rowvec kin(utils::real_column_dot(Pv_rho,bf_rho)/arma::square(scale_r) + utils::real_column_dot(Pv_theta,bf_theta)/arma::square(scale_theta) + utils::real_column_dot(Pv_phi,bf_phi)/arma::square(scale_phi));
+          tau=0.5*kin;
         }
 
         if(do_lapl)
@@ -125,58 +135,36 @@ namespace helfem {
         polarized=true;
 
         // Update density vector
-        arma::mat Pa(basp->expand_boundaries(Pa0)(bf_ind,bf_ind));
-        arma::mat Pb(basp->expand_boundaries(Pb0)(bf_ind,bf_ind));
+        arma::mat Pa(basp->expand_boundaries(Pa0,bf_ind));
+        arma::mat Pb(basp->expand_boundaries(Pb0,bf_ind));
 
         Pav=Pa*arma::conj(bf);
         Pbv=Pb*arma::conj(bf);
 
         // Calculate density
         rho.zeros(2,wtot.n_elem);
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-        for(size_t ip=0;ip<wtot.n_elem;ip++) {
-          rho(0,ip)=std::real(arma::dot(Pav.col(ip),bf.col(ip)));
-          rho(1,ip)=std::real(arma::dot(Pbv.col(ip),bf.col(ip)));
-
-          /*
-            double na=compute_density(Pa0,*basp,grid[ip].r);
-            double nb=compute_density(Pb0,*basp,grid[ip].r);
-            if(fabs(da-na)>1e-6 || fabs(db-nb)>1e-6)
-            printf("Density at point % .3f % .3f % .3f: %e vs %e, %e vs %e\n",grid[ip].r.x,grid[ip].r.y,grid[ip].r.z,da,na,db,nb);
-          */
-        }
+        rho.row(0)=utils::real_column_dot(Pav,bf);
+        rho.row(1)=utils::real_column_dot(Pbv,bf);
 
         // Calculate gradient
-
         if(do_grad) {
           grho.zeros(6,wtot.n_elem);
+          grho.row(0)=2.0*utils::real_column_dot(Pav,bf_rho)/scale_r;
+          grho.row(1)=2.0*utils::real_column_dot(Pav,bf_theta)/scale_theta;
+          grho.row(2)=2.0*utils::real_column_dot(Pav,bf_phi)/scale_phi;
+          grho.row(3)=2.0*utils::real_column_dot(Pbv,bf_rho)/scale_r;
+          grho.row(4)=2.0*utils::real_column_dot(Pbv,bf_theta)/scale_theta;
+          grho.row(5)=2.0*utils::real_column_dot(Pbv,bf_phi)/scale_phi;
+
+          // Compute sigma as well
           sigma.zeros(3,wtot.n_elem);
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-          for(size_t ip=0;ip<wtot.n_elem;ip++) {
-            double ga_rad=grho(0,ip)=2.0*std::real(arma::dot(Pav.col(ip),bf_rho.col(ip)))/scale_r(ip);
-            double ga_th=grho(1,ip)=2.0*std::real(arma::dot(Pav.col(ip),bf_theta.col(ip)))/scale_theta(ip);
-            double ga_phi=grho(2,ip)=2.0*std::real(arma::dot(Pav.col(ip),bf_phi.col(ip)))/scale_phi(ip);
-
-            double gb_rad=grho(3,ip)=2.0*std::real(arma::dot(Pbv.col(ip),bf_rho.col(ip)))/scale_r(ip);
-            double gb_th=grho(4,ip)=2.0*std::real(arma::dot(Pbv.col(ip),bf_theta.col(ip)))/scale_theta(ip);
-            double gb_phi=grho(5,ip)=2.0*std::real(arma::dot(Pbv.col(ip),bf_phi.col(ip)))/scale_phi(ip);
-
-            // Compute sigma as well
-            sigma(0,ip)=ga_rad*ga_rad + ga_th*ga_th + ga_phi*ga_phi;
-            sigma(1,ip)=ga_rad*gb_rad + ga_th*gb_th + ga_phi*gb_phi;
-            sigma(2,ip)=gb_rad*gb_rad + gb_th*gb_th + gb_phi*gb_phi;
-          }
+          sigma.row(0)=arma::sum(arma::square(grho.rows(0,2)),0);
+          sigma.row(1)=arma::sum(grho.rows(0,2)%grho.rows(3,5),0);
+          sigma.row(2)=arma::sum(arma::square(grho.rows(3,5)),0);
         }
 
         // Calculate kinetic energy density
         if(do_tau) {
-          // Adjust size of grid
-          tau.resize(2,wtot.n_elem);
-
           // Update helpers
           Pav_rho=Pa*arma::conj(bf_rho);
           Pav_theta=Pa*arma::conj(bf_theta);
@@ -186,26 +174,13 @@ namespace helfem {
           Pbv_theta=Pb*arma::conj(bf_theta);
           Pbv_phi=Pb*arma::conj(bf_phi);
 
-          // Calculate values
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-          for(size_t ip=0;ip<wtot.n_elem;ip++) {
-            // Gradient term
-            double kinar=std::real(arma::dot(Pav_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2);
-            double kinath=std::real(arma::dot(Pav_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2);
-            double kinaphi=std::real(arma::dot(Pav_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2);
-            double kina(kinar + kinath + kinaphi);
-
-            double kinbr=std::real(arma::dot(Pbv_rho.col(ip),bf_rho.col(ip)))/std::pow(scale_r(ip),2);
-            double kinbth=std::real(arma::dot(Pbv_theta.col(ip),bf_theta.col(ip)))/std::pow(scale_theta(ip),2);
-            double kinbphi=std::real(arma::dot(Pbv_phi.col(ip),bf_phi.col(ip)))/std::pow(scale_phi(ip),2);
-            double kinb(kinbr + kinbth + kinbphi);
-
-            // Store values
-            tau(0,ip)=0.5*kina;
-            tau(1,ip)=0.5*kinb;
-          }
+          // Gradient terms, shared by tau and the laplacian
+          arma::rowvec kina(utils::real_column_dot(Pav_rho,bf_rho)/arma::square(scale_r) + utils::real_column_dot(Pav_theta,bf_theta)/arma::square(scale_theta) + utils::real_column_dot(Pav_phi,bf_phi)/arma::square(scale_phi));
+          arma::rowvec kinb(utils::real_column_dot(Pbv_rho,bf_rho)/arma::square(scale_r) + utils::real_column_dot(Pbv_theta,bf_theta)/arma::square(scale_theta) + utils::real_column_dot(Pbv_phi,bf_phi)/arma::square(scale_phi));
+
+          tau.zeros(2,wtot.n_elem);
+          tau.row(0)=0.5*kina;
+          tau.row(1)=0.5*kinb;
           if(do_lapl)
             throw std::logic_error("Laplacian not implemented!\n");
         }
@@ -341,11 +316,19 @@ namespace helfem {
       }
 
       void DFTGridWorker::compute_xc(int func_id, const arma::vec & p, double thr, bool pot) {
+        XCFunctional func(func_id,polarized,p,thr);
+        compute_xc(func,pot);
+      }
+
+      void DFTGridWorker::compute_xc(const XCFunctional & xcfunc, bool pot) {
         // Compute exchange-correlation functional
+        if(xcfunc.is_polarized() != polarized)
+          throw std::logic_error("Functional was initialized for the wrong spin polarization!\n");
 
         // Which functional is in question?
         bool gga, mgga_t, mgga_l;
-        is_gga_mgga(func_id,gga,mgga_t,mgga_l);
+        xcfunc.get_family(gga,mgga_t,mgga_l);
+        const bool has_energy(xcfunc.has_exc());
 
         // Update controlling flags for eval_Fxc (exchange and correlation
         // parts might be of different type)
@@ -363,7 +346,7 @@ namespace helfem {
         arma::mat vlapl_wrk;
         arma::mat vtau_wrk;
 
-        if(has_exc(func_id))
+        if(has_energy)
           exc_wrk.zeros(exc.n_elem);
         if(pot) {
           vxc_wrk.zeros(vxc.n_rows,vxc.n_cols);
@@ -375,54 +358,31 @@ namespace helfem {
             vlapl_wrk.zeros(vlapl.n_rows,vlapl.n_cols);
         }
 
-        // Spin variable for libxc
-        int nspin;
-        if(!polarized)
-          nspin=XC_UNPOLARIZED;
-        else
-          nspin=XC_POLARIZED;
-
-        // Initialize libxc worker
-        xc_func_type func;
-        if(xc_func_init(&func, func_id, nspin) != 0) {
-          std::ostringstream oss;
-          oss << "Functional "<<func_id<<" not found!";
-          throw std::runtime_error(oss.str());
-        }
-        // Set density threshold
-        xc_func_set_dens_threshold(&func, thr);
-
-        // Set parameters
-        if(p.n_elem) {
-          // Check sanity
-          if(p.n_elem != (arma::uword) xc_func_info_get_n_ext_params((xc_func_info_type *)func.info))
-            throw std::logic_error("Incompatible number of parameters!\n");
-          arma::vec phlp(p);
-          xc_func_set_ext_params(&func, phlp.memptr());
-        }
+        // The functional has been initialized once for the whole SCF
+        xc_func_type *func(xcfunc.get());
 
         // Evaluate functionals.
-        if(has_exc(func_id)) {
+        if(has_energy) {
           if(pot) {
             if(mgga_t || mgga_l) {// meta-GGA
               double * laplp = mgga_l ? lapl.memptr() : NULL;
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_exc_vxc(&func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
+              xc_lda_exc_vxc(func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
           } else {
             if(mgga_t || mgga_l) { // meta-GGA
               double * laplp = mgga_l ? lapl.memptr() : NULL;
               double * taup = mgga_t ? tau.memptr() : NULL;
-              xc_mgga_exc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
+              xc_mgga_exc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
             } else if(gga) // GGA
-              xc_gga_exc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
+              xc_gga_exc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
             else // LDA
-              xc_lda_exc(&func, N, rho.memptr(), exc_wrk.memptr());
+              xc_lda_exc(func, N, rho.memptr(), exc_wrk.memptr());
           }
 
         } else {
@@ -432,19 +392,16 @@ namespace helfem {
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_vxc(&func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_vxc(func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_vxc(&func, N, rho.memptr(), vxc_wrk.memptr());
+              xc_lda_vxc(func, N, rho.memptr(), vxc_wrk.memptr());
           }
         }
 
-        // Free functional
-        xc_func_end(&func);
-
         // Sum to total arrays containing both exchange and correlation
-        if(has_exc(func_id))
+        if(has_energy)
           exc+=exc_wrk;
         if(pot) {
           if(mgga_l)
@@ -497,81 +454,77 @@ namespace helfem {
       }
 
       void DFTGridWorker::eval_Fxc(arma::mat & Ho) const {
-        if(polarized) {
-          throw std::runtime_error("Refusing to compute restricted Fock matrix with unrestricted density.\n");
-        }
-
         // Work matrix
         arma::mat H(bf_ind.n_elem,bf_ind.n_elem);
         H.zeros();
+        increment_Fxc_block(H);
+        Ho(bf_ind,bf_ind)+=H;
+      }
 
-        {
-          // LDA potential
-          arma::rowvec vrho(vxc.row(0));
-          // Multiply weights into potential
-          vrho%=wtot;
-          // Increment matrix
-          increment_lda< std::complex<double> >(H,vrho,bf);
+      void DFTGridWorker::increment_Fxc_block(arma::mat & H) const {
+        if(polarized) {
+          throw std::runtime_error("Refusing to compute restricted Fock matrix with unrestricted density.\n");
         }
+        if(H.n_rows != bf_ind.n_elem || H.n_cols != bf_ind.n_elem)
+          throw std::logic_error("Fock matrix block does not match the element!\n");
+
+        // LDA potential, multiplied by the weights
+        arma::rowvec vrho(vxc.row(0)%wtot);
 
+        arma::mat gr;
         if(do_gga) {
           // Get vsigma
           arma::rowvec vs(vsigma.row(0));
           // Get grad rho
           arma::uvec idx(arma::linspace<arma::uvec>(0,2,3));
-          arma::mat gr(arma::trans(grho.rows(idx)));
+          gr=arma::trans(grho.rows(idx));
           // Multiply grad rho by vsigma and the weights
           for(size_t i=0;i<gr.n_rows;i++) {
             gr(i,0)*=2.0*wtot(i)*vs(i)/scale_r(i);
             gr(i,1)*=2.0*wtot(i)*vs(i)/scale_theta(i);
             gr(i,2)*=2.0*wtot(i)*vs(i)/scale_phi(i);
           }
-          // Increment matrix
-          increment_gga< std::complex<double> >(H,gr,bf,bf_rho,bf_theta,bf_phi);
         }
 
+        arma::mat vt;
         if(do_mgga_t) {
-          arma::rowvec vt(vtau.row(0));
-          vt%=0.5*wtot;
-
-          increment_lda< std::complex<double> >(H,vt/arma::square(scale_r),bf_rho);
-          increment_lda< std::complex<double> >(H,vt/arma::square(scale_theta),bf_theta);
-          increment_lda< std::complex<double> >(H,vt/arma::square(scale_phi),bf_phi);
+          arma::rowvec vtw(0.5*vtau.row(0)%wtot);
+          vt.zeros(3,wtot.n_elem);
+          vt.row(0)=vtw/arma::square(scale_r);
+          vt.row(1)=vtw/arma::square(scale_theta);
+          vt.row(2)=vtw/arma::square(scale_phi);
         }
         if(do_mgga_l)
           throw std::logic_error("Laplacian not implemented!\n");
 
-        Ho(bf_ind,bf_ind)+=H;
+        increment_fock< std::complex<double> >(H,vrho,gr,vt,arma::rowvec(),bf,bf_rho,bf_theta,bf_phi,arma::cx_mat());
       }
 
       void DFTGridWorker::eval_Fxc(arma::mat & Hao, arma::mat & Hbo, bool beta) const {
-        if(!polarized) {
-          throw std::runtime_error("Refusing to compute unrestricted Fock matrix with restricted density.\n");
-        }
-
         arma::mat Ha, Hb;
         Ha.zeros(bf_ind.n_elem,bf_ind.n_elem);
         if(beta)
           Hb.zeros(bf_ind.n_elem,bf_ind.n_elem);
+        increment_Fxc_block(Ha,Hb,beta);
+        Hao(bf_ind,bf_ind)+=Ha;
+        if(beta)
+          Hbo(bf_ind,bf_ind)+=Hb;
+      }
 
-        {
-          // LDA potential
-          arma::rowvec vrhoa(vxc.row(0));
-          // Multiply weights into potential
-          vrhoa%=wtot;
-          // Increment matrix
-          increment_lda< std::complex<double> >(Ha,vrhoa,bf);
-
-          if(beta) {
-            arma::rowvec vrhob(vxc.row(1));
-            vrhob%=wtot;
-            increment_lda< std::complex<double> >(Hb,vrhob,bf);
-          }
+      void DFTGridWorker::increment_Fxc_block(arma::mat & Ha, arma::mat & Hb, bool beta) const {
+        if(!polarized) {
+          throw std::runtime_error("Refusing to compute unrestricted Fock matrix with restricted density.\n");
         }
-        if(Ha.has_nan() || (beta && Hb.has_nan()))
-          //throw std::logic_error("NaN encountered!\n");
-          fprintf(stderr,"NaN in Hamiltonian!\n");
+        if(Ha.n_rows != bf_ind.n_elem || Ha.n_cols != bf_ind.n_elem || (beta && (Hb.n_rows != bf_ind.n_elem || Hb.n_cols != bf_ind.n_elem)))
+          throw std::logic_error("Fock matrix block does not match the element!\n");
+
+        // LDA potential, multiplied by the weights
+        arma::rowvec vrhoa(vxc.row(0)%wtot);
+        arma::rowvec vrhob;
+        if(beta)
+          vrhob=vxc.row(1)%wtot;
 
+        arma::mat gr_a, gr_b;
         if(do_gga) {
           // Get vsigma
           arma::rowvec vs_aa(vsigma.row(0));
@@ -584,51 +537,45 @@ namespace helfem {
           arma::mat gr_b0(arma::trans(grho.rows(idxb)));
 
           // Multiply grad rho by vsigma and the weights
-          arma::mat gr_a(gr_a0);
+          gr_a=gr_a0;
           for(size_t i=0;i<gr_a.n_rows;i++) {
             gr_a(i,0)=wtot(i)*(2.0*vs_aa(i)*gr_a0(i,0) + vs_ab(i)*gr_b0(i,0))/scale_r(i);
             gr_a(i,1)=wtot(i)*(2.0*vs_aa(i)*gr_a0(i,1) + vs_ab(i)*gr_b0(i,1))/scale_theta(i);
             gr_a(i,2)=wtot(i)*(2.0*vs_aa(i)*gr_a0(i,2) + vs_ab(i)*gr_b0(i,2))/scale_phi(i);
           }
-          // Increment matrix
-          increment_gga< std::complex<double> >(Ha,gr_a,bf,bf_rho,bf_theta,bf_phi);
 
           if(beta) {
             arma::rowvec vs_bb(vsigma.row(2));
-            arma::mat gr_b(gr_b0);
+            gr_b=gr_b0;
             for(size_t i=0;i<gr_b.n_rows;i++) {
               gr_b(i,0)=wtot(i)*(2.0*vs_bb(i)*gr_b0(i,0) + vs_ab(i)*gr_a0(i,0))/scale_r(i);
               gr_b(i,1)=wtot(i)*(2.0*vs_bb(i)*gr_b0(i,1) + vs_ab(i)*gr_a0(i,1))/scale_theta(i);
               gr_b(i,2)=wtot(i)*(2.0*vs_bb(i)*gr_b0(i,2) + vs_ab(i)*gr_a0(i,2))/scale_phi(i);
             }
-            increment_gga< std::complex<double> >(Hb,gr_b,bf,bf_rho,bf_theta,bf_phi);
           }
         }
 
-
+        arma::mat vt_a, vt_b;
         if(do_mgga_t) {
-          arma::rowvec vt_a(vtau.row(0));
-          vt_a%=0.5*wtot;
-
-          increment_lda< std::complex<double> >(Ha,vt_a/arma::square(scale_r),bf_rho);
-          increment_lda< std::complex<double> >(Ha,vt_a/arma::square(scale_theta),bf_theta);
-          increment_lda< std::complex<double> >(Ha,vt_a/arma::square(scale_phi),bf_phi);
-          if(beta) {
-            arma::rowvec vt_b(vtau.row(1));
-            vt_b%=0.5*wtot;
-
-            increment_lda< std::complex<double> >(Hb,vt_b/arma::square(scale_r),bf_rho);
-            increment_lda< std::complex<double> >(Hb,vt_b/arma::square(scale_theta),bf_theta);
-            increment_lda< std::complex<double> >(Hb,vt_b/arma::square(scale_phi),bf_phi);
+          for(int is=0;is<(beta ? 2 : 1);is++) {
+            arma::rowvec vtw(0.5*vtau.row(is)%wtot);
+            arma::mat & vt(is ? vt_b : vt_a);
+            vt.zeros(3,wtot.n_elem);
+            vt.row(0)=vtw/arma::square(scale_r);
+            vt.row(1)=vtw/arma::square(scale_theta);
+            vt.row(2)=vtw/arma::square(scale_phi);
           }
         }
         if(do_mgga_l) {
           throw std::logic_error("Laplacian not implemented!\n");
         }
 
-        Hao(bf_ind,bf_ind)+=Ha;
+        increment_fock< std::complex<double> >(Ha,vrhoa,gr_a,vt_a,arma::rowvec(),bf,bf_rho,bf_theta,bf_phi,arma::cx_mat());
         if(beta)
-          Hbo(bf_ind,bf_ind)+=Hb;
+          increment_fock< std::complex<double> >(Hb,vrhob,gr_b,vt_b,arma::rowvec(),bf,bf_rho,bf_theta,bf_phi,arma::cx_mat());
+        if(Ha.has_nan() || (beta && Hb.has_nan()))
+          //throw std::logic_error("NaN encountered!\n");
+          fprintf(stderr,"NaN in Hamiltonian!\n");
       }
 
       void DFTGridWorker::check_grad_tau_lapl(int x_func, int c_func) {
@@ -670,82 +617,73 @@ namespace helfem {
         // Update function list
         bf_ind=basp->bf_list_dummy(iel);
 
+        // The radial functions are evaluated for all the quadrature
+        // points of the element at once
+        if(iel != rad_iel || (do_grad && !rad_df.n_elem)) {
+          rad_bf=basp->get_rad_bf(iel);
+          rad_r=basp->get_r(iel);
+          rad_w=basp->get_wrad(iel);
+          if(do_grad)
+            rad_df=basp->get_rad_df(iel);
+          else
+            rad_df.reset();
+          rad_iel=iel;
+        }
+        const size_t nrad(rad_bf.n_cols);
+        if(bf_ind.n_elem != ang_bf.n_rows*nrad) {
+          std::ostringstream oss;
+          oss << "Mismatch! Have " << bf_ind.n_elem << " basis function indices but " << ang_bf.n_rows*nrad << " basis functions!\n";
+          throw std::logic_error(oss.str());
+        }
+
+        const arma::vec & wang(angrule->w);
+
         // Get radial weights. Only do one radial quadrature point at a
         // time, since this is an easy way to save a lot of memory.
-        arma::vec wrad(1), r(1);
-        wrad(0)=basp->get_wrad(iel)(irad);
-        r(0)=basp->get_r(iel)(irad);
+        double wrad(rad_w(irad));
+        double r(rad_r(irad));
 
         double Rhalf(basp->get_Rhalf());
 
         // Calculate helpers
-        arma::vec shmu(arma::sinh(r));
-
-        arma::vec sth(cth.n_elem);
-        for(size_t ia=0;ia<cth.n_elem;ia++)
-          sth(ia)=sqrt(1.0 - cth(ia)*cth(ia));
+        double shmu(std::sinh(r));
 
         // Radial is
-        scale_r.resize(wrad.n_elem*wang.n_elem);
+        scale_r.resize(wang.n_elem);
         for(size_t ia=0;ia<wang.n_elem;ia++)
-          for(size_t ir=0;ir<wrad.n_elem;ir++)
-            // h_mu = R_{h}\sqrt{\sinh^{2}\mu+\sin^{2}\nu}
-            scale_r(ia*wrad.n_elem+ir)=Rhalf*sqrt(std::pow(shmu(ir),2) + std::pow(sth(ia),2));
+          // h_mu = R_{h}\sqrt{\sinh^{2}\mu+\sin^{2}\nu}
+          scale_r(ia)=Rhalf*sqrt(std::pow(shmu,2) + std::pow(sth(ia),2));
         // Theta is same as radial
         scale_theta=scale_r;
         // phi is simple
-        scale_phi.resize(wrad.n_elem*wang.n_elem);
+        scale_phi.resize(wang.n_elem);
         for(size_t ia=0;ia<wang.n_elem;ia++)
-          for(size_t ir=0;ir<wrad.n_elem;ir++)
-            scale_phi(ia*wrad.n_elem+ir)=Rhalf*shmu(ir)*sth(ia);
+          scale_phi(ia)=Rhalf*shmu*sth(ia);
         // Update total weights
-        wtot.zeros(wrad.n_elem*wang.n_elem);
+        wtot.zeros(wang.n_elem);
         for(size_t ia=0;ia<wang.n_elem;ia++)
-          for(size_t ir=0;ir<wrad.n_elem;ir++) {
-            size_t idx=ia*wrad.n_elem+ir;
-            // sin(th) is already contained within wang, but we don't want to divide by it since it may be zero.
-            wtot(idx)=wang(ia)*wrad(ir)*std::pow(Rhalf,3)*shmu(ir)*(std::pow(shmu(ir),2)+std::pow(sth(ia),2));
-          }
+          // sin(th) is already contained within wang, but we don't want to divide by it since it may be zero.
+          wtot(ia)=wang(ia)*wrad*std::pow(Rhalf,3)*shmu*(std::pow(shmu,2)+std::pow(sth(ia),2));
 
-        // Compute basis function values
-        bf.zeros(bf_ind.n_elem,wtot.n_elem);
-        // Loop over angular grid
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-        for(size_t ia=0;ia<cth.n_elem;ia++) {
-          // Evaluate basis functions at angular point
-          arma::cx_mat abf(basp->eval_bf(iel, irad, cth(ia), phi(ia)));
-          if(abf.n_cols != bf_ind.n_elem) {
-            std::ostringstream oss;
-            oss << "Mismatch! Have " << bf_ind.n_elem << " basis function indices but " << abf.n_cols << " basis functions!\n";
-            throw std::logic_error(oss.str());
-          }
-          // Store functions
-          bf.cols(ia*wrad.n_elem,(ia+1)*wrad.n_elem-1)=arma::trans(abf);
-        }
+        // Radial function values at the point
+        arma::cx_vec frad(arma::trans(rad_bf.row(irad)),arma::zeros<arma::vec>(nrad));
 
-        if(do_grad) {
-          bf_rho.zeros(bf_ind.n_elem,wtot.n_elem);
-          bf_theta.zeros(bf_ind.n_elem,wtot.n_elem);
-          bf_phi.zeros(bf_ind.n_elem,wtot.n_elem);
+        // Basis function values are outer products of the radial and
+        // angular factors, one angular shell at a time
+        bf.set_size(bf_ind.n_elem,wtot.n_elem);
+        for(size_t i=0;i<ang_bf.n_rows;i++)
+          bf.rows(i*nrad,(i+1)*nrad-1)=frad*ang_bf.row(i);
 
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-          for(size_t ia=0;ia<cth.n_elem;ia++) {
-            // Evaluate basis functions at angular point
-            arma::cx_mat dr, dth, dphi;
-            basp->eval_df(iel, irad, cth(ia), phi(ia), dr, dth, dphi);
-            if(dr.n_cols != bf_ind.n_elem) {
-              std::ostringstream oss;
-              oss << "Mismatch! Have " << bf_ind.n_elem << " basis function indices but " << dr.n_cols << " basis functions!\n";
-              throw std::logic_error(oss.str());
-            }
-            // Store functions
-            bf_rho.cols(ia*wrad.n_elem,(ia+1)*wrad.n_elem-1)=arma::trans(dr);
-            bf_theta.cols(ia*wrad.n_elem,(ia+1)*wrad.n_elem-1)=arma::trans(dth);
-            bf_phi.cols(ia*wrad.n_elem,(ia+1)*wrad.n_elem-1)=arma::trans(dphi);
+        if(do_grad) {
+          arma::cx_vec drad(arma::trans(rad_df.row(irad)),arma::zeros<arma::vec>(nrad));
+
+          bf_rho.set_size(bf_ind.n_elem,wtot.n_elem);
+          bf_theta.set_size(bf_ind.n_elem,wtot.n_elem);
+          bf_phi.set_size(bf_ind.n_elem,wtot.n_elem);
+          for(size_t i=0;i<ang_bf.n_rows;i++) {
+            bf_rho.rows(i*nrad,(i+1)*nrad-1)=drad*ang_bf.row(i);
+            bf_theta.rows(i*nrad,(i+1)*nrad-1)=frad*ang_dth.row(i);
+            bf_phi.rows(i*nrad,(i+1)*nrad-1)=frad*ang_dphi.row(i);
           }
         }
 
@@ -754,43 +692,172 @@ namespace helfem {
         }
       }
 
-      DFTGrid::DFTGrid() {
+      void DFTGridWorker::save_bf(bf_cache_t & c) const {
+        c.grad=do_grad;
+        c.bf_ind=bf_ind;
+        c.wtot=wtot;
+        c.scale_r=scale_r;
+        c.scale_theta=scale_theta;
+        c.scale_phi=scale_phi;
+        c.bf=bf;
+        if(do_grad) {
+          c.bf_rho=bf_rho;
+          c.bf_theta=bf_theta;
+          c.bf_phi=bf_phi;
+        }
+      }
+
+      void DFTGridWorker::load_bf(const bf_cache_t & c) {
+        bf_ind=c.bf_ind;
+        wtot=c.wtot;
+        scale_r=c.scale_r;
+        scale_theta=c.scale_theta;
+        scale_phi=c.scale_phi;
+        bf=c.bf;
+        if(do_grad) {
+          bf_rho=c.bf_rho;
+          bf_theta=c.bf_theta;
+          bf_phi=c.bf_phi;
+        }
+      }
+
+      /// Memory used by a cache entry
+      static size_t cache_memory(const bf_cache_t & c) {
+        size_t n=(c.wtot.n_elem+c.scale_r.n_elem+c.scale_theta.n_elem+c.scale_phi.n_elem)*sizeof(double);
+        n+=c.bf_ind.n_elem*sizeof(arma::uword);
+        n+=(c.bf.n_elem+c.bf_rho.n_elem+c.bf_theta.n_elem+c.bf_phi.n_elem)*sizeof(std::complex<double>);
+        return n;
       }
 
-      DFTGrid::DFTGrid(const helfem::diatomic::basis::TwoDBasis * basp_, int lang_, int mang_) : basp(basp_), lang(lang_), mang(mang_) {
-        arma::vec cth, phi, wang;
-        helfem::angular::angular_chebyshev(lang,mang,cth,phi,wang);
-        printf("DFT angular grid of order l=%i m=%i has %i points\n",lang,mang,(int) wang.n_elem);
+      DFTGrid::DFTGrid() : cache_budget(0), cache_used(0), thread_timing(false), part_index(0), part_count(1) {
+      }
+
+      DFTGrid::DFTGrid(const helfem::diatomic::basis::TwoDBasis * basp_, int lang_, int mang_) : basp(basp_), lang(lang_), mang(mang_), cache_budget(0), cache_used(0), thread_timing(false), part_index(0), part_count(1) {
+        printf("DFT angular grid of order l=%i m=%i has %i points\n",lang,mang,(int) helfem::angular::angular_rule(lang,mang).w.n_elem);
       }
 
       DFTGrid::~DFTGrid() {
       }
 
+      void DFTGrid::set_thread_timing(bool timing) {
+        thread_timing=timing;
+      }
+
+      void DFTGrid::set_partition(size_t ipart, size_t npart) {
+        if(npart==0 || ipart>=npart)
+          throw std::logic_error("Invalid partition of the radial elements!\n");
+        part_index=ipart;
+        part_count=npart;
+      }
+
+      void DFTGrid::set_bf_cache(size_t budget) {
+        cache_budget=budget;
+        cache_used=0;
+        cache.clear();
+        if(cache_budget) {
+          cache.resize(basp->get_rad_Nel());
+          for(size_t iel=0;iel<cache.size();iel++)
+            cache[iel].resize(basp->get_r(iel).n_elem);
+        }
+      }
+
+      void DFTGrid::compute_bf(DFTGridWorker & grid, size_t iel, size_t irad) {
+        bool grad, tau, lapl;
+        grid.get_grad_tau_lapl(grad,tau,lapl);
+
+        // Use the cached values if they have everything that is needed
+        if(iel<cache.size()) {
+          const bf_cache_t & c(cache[iel][irad]);
+          if(c.bf.n_elem && (c.grad || !grad)) {
+            grid.load_bf(c);
+            return;
+          }
+        }
+
+        grid.compute_bf(iel,irad);
+        if(iel<cache.size()) {
+          // Store the values if they fit in the budget; otherwise they
+          // are recomputed on every call
+          bf_cache_t c;
+          grid.save_bf(c);
+          size_t mem(cache_memory(c));
+          size_t oldmem(cache_memory(cache[iel][irad]));
+          bool store;
+#ifdef _OPENMP
+#pragma omp critical(diatomic_bf_cache)
+#endif
+          {
+            store=(cache_used-oldmem+mem <= cache_budget);
+            if(store)
+              cache_used+=mem-oldmem;
+          }
+          if(store)
+            cache[iel][irad]=c;
+        }
+      }
+
       void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, arma::mat & H, double & Exc, double & Nel, double & Ekin, double thr) {
+        // The functionals are only initialized when the settings change
+        XCFunctional::update(xfunc,x_func,false,x_pars,thr);
+        XCFunctional::update(cfunc,c_func,false,c_pars,thr);
+
         H.zeros(basp->Ndummy(),basp->Ndummy());
 
-        double exc=0.0;
-        double ekin=0.0;
-        double nel=0.0;
+        // Contributions of each element, summed in a fixed order at the
+        // end so that the result does not depend on the threading
+        const size_t Nrad(basp->get_rad_Nel());
+        std::vector<double> el_exc(Nrad,0.0), el_ekin(Nrad,0.0), el_nel(Nrad,0.0);
+        // Element blocks are added into the full matrix concurrently
+        std::vector<arma::uvec> elidx(basp->get_rad_Nel());
+        for(size_t iel=0;iel<elidx.size();iel++)
+          elidx[iel]=basp->bf_list_dummy(iel);
+        BlockScatter scatter(elidx);
+
+        // Busy time of each thread
+        std::vector<double> tthr;
+        if(thread_timing) {
+#ifdef _OPENMP
+          tthr.assign(omp_get_max_threads(),0.0);
+#else
+          tthr.assign(1,0.0);
+#endif
+        }
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
         {
           DFTGridWorker grid(basp,lang,mang);
           grid.check_grad_tau_lapl(x_func,c_func);
+          double tbusy=0.0;
 
+          // The cost per element is uneven, so the elements are handed
+          // out dynamically. The Fock matrix is accumulated within the
+          // element, and its block is scattered into the shared matrix
+          // once all the radial points have been done.
+          arma::mat Hel;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
           for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
+            if(iel%part_count != part_index)
+              continue;
+            Timer tel;
+            const arma::uvec & ind(elidx[iel]);
+            Hel.zeros(ind.n_elem,ind.n_elem);
             for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-              grid.compute_bf(iel,irad);
+              compute_bf(grid,iel,irad);
               grid.update_density(P);
-              nel+=grid.compute_Nel();
-              ekin+=grid.compute_Ekin();
+              el_nel[iel]+=grid.compute_Nel();
+              el_ekin[iel]+=grid.compute_Ekin();
 
               grid.init_xc();
-              if(x_func>0)
-                grid.compute_xc(x_func, x_pars, thr);
-              if(c_func>0)
-                grid.compute_xc(c_func, c_pars, thr);
+              if(xfunc)
+                grid.compute_xc(*xfunc);
+              if(cfunc)
+                grid.compute_xc(*cfunc);
 
-              exc+=grid.eval_Exc();
-              grid.eval_Fxc(H);
+              el_exc[iel]+=grid.eval_Exc();
+              grid.increment_Fxc_block(Hel);
 
 #if 0
               std::ostringstream oss;
@@ -798,43 +865,94 @@ namespace helfem {
               grid.save(oss.str());
 #endif
             }
+            scatter.add(H,Hel,iel);
+            tbusy+=tel.get();
+          }
+
+          if(thread_timing) {
+#ifdef _OPENMP
+            tthr[omp_get_thread_num()]=tbusy;
+#else
+            tthr[0]=tbusy;
+#endif
           }
         }
+        if(thread_timing)
+          print_thread_load(tthr);
 
         // Save outputs
-        Exc=exc;
-        Ekin=ekin;
-        Nel=nel;
+        Exc=threading::pairwise_sum(el_exc);
+        Ekin=threading::pairwise_sum(el_ekin);
+        Nel=threading::pairwise_sum(el_nel);
 
         H=basp->remove_boundaries(H);
       }
 
       void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & Pa, const arma::mat & Pb, arma::mat & Ha, arma::mat & Hb, double & Exc, double & Nel, double & Ekin, bool beta, double thr) {
+        // The functionals are only initialized when the settings change
+        XCFunctional::update(xfunc,x_func,true,x_pars,thr);
+        XCFunctional::update(cfunc,c_func,true,c_pars,thr);
+
         Ha.zeros(basp->Ndummy(),basp->Ndummy());
         Hb.zeros(basp->Ndummy(),basp->Ndummy());
 
-        double exc=0.0;
-        double nel=0.0;
-        double ekin=0.0;
+        // Contributions of each element, summed in a fixed order at the
+        // end so that the result does not depend on the threading
+        const size_t Nrad(basp->get_rad_Nel());
+        std::vector<double> el_exc(Nrad,0.0), el_ekin(Nrad,0.0), el_nel(Nrad,0.0);
+        // Element blocks are added into the full matrix concurrently
+        std::vector<arma::uvec> elidx(basp->get_rad_Nel());
+        for(size_t iel=0;iel<elidx.size();iel++)
+          elidx[iel]=basp->bf_list_dummy(iel);
+        BlockScatter scatter(elidx);
+
+        // Busy time of each thread
+        std::vector<double> tthr;
+        if(thread_timing) {
+#ifdef _OPENMP
+          tthr.assign(omp_get_max_threads(),0.0);
+#else
+          tthr.assign(1,0.0);
+#endif
+        }
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
         {
           DFTGridWorker grid(basp,lang,mang);
           grid.check_grad_tau_lapl(x_func,c_func);
+          double tbusy=0.0;
 
+          // The cost per element is uneven, so the elements are handed
+          // out dynamically. The Fock matrix is accumulated within the
+          // element, and its block is scattered into the shared matrix
+          // once all the radial points have been done.
+          arma::mat Hel, Hbel;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
           for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
+            if(iel%part_count != part_index)
+              continue;
+            Timer tel;
+            const arma::uvec & ind(elidx[iel]);
+            Hel.zeros(ind.n_elem,ind.n_elem);
+            if(beta)
+              Hbel.zeros(ind.n_elem,ind.n_elem);
             for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-              grid.compute_bf(iel,irad);
+              compute_bf(grid,iel,irad);
               grid.update_density(Pa,Pb);
-              nel+=grid.compute_Nel();
-              ekin+=grid.compute_Ekin();
+              el_nel[iel]+=grid.compute_Nel();
+              el_ekin[iel]+=grid.compute_Ekin();
 
               grid.init_xc();
-              if(x_func>0)
-                grid.compute_xc(x_func, x_pars, thr);
-              if(c_func>0)
-                grid.compute_xc(c_func, c_pars, thr);
+              if(xfunc)
+                grid.compute_xc(*xfunc);
+              if(cfunc)
+                grid.compute_xc(*cfunc);
 
-              exc+=grid.eval_Exc();
-              grid.eval_Fxc(Ha,Hb,beta);
+              el_exc[iel]+=grid.eval_Exc();
+              grid.increment_Fxc_block(Hel,Hbel,beta);
 
 #if 0
               std::ostringstream oss;
@@ -842,13 +960,27 @@ namespace helfem {
               grid.save(oss.str());
 #endif
             }
+            scatter.add(Ha,Hel,iel);
+            if(beta)
+              scatter.add(Hb,Hbel,iel);
+            tbusy+=tel.get();
+          }
+
+          if(thread_timing) {
+#ifdef _OPENMP
+            tthr[omp_get_thread_num()]=tbusy;
+#else
+            tthr[0]=tbusy;
+#endif
           }
         }
+        if(thread_timing)
+          print_thread_load(tthr);
 
         // Save outputs
-        Exc=exc;
-        Ekin=ekin;
-        Nel=nel;
+        Exc=threading::pairwise_sum(el_exc);
+        Ekin=threading::pairwise_sum(el_ekin);
+        Nel=threading::pairwise_sum(el_nel);
 
         // Clean up matrices
         Ha=basp->remove_boundaries(Ha);
@@ -865,7 +997,7 @@ namespace helfem {
 
           for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
             for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-              grid.compute_bf(iel,irad);
+              compute_bf(grid,iel,irad);
               grid.eval_overlap(S);
             }
           }
@@ -885,7 +1017,7 @@ namespace helfem {
 
           for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
             for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-              grid.compute_bf(iel,irad);
+              compute_bf(grid,iel,irad);
               grid.eval_kinetic(T);
             }
           }
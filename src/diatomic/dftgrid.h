@@ -18,19 +18,53 @@
 #define DFTGRID
 
 #include "basis.h"
+#include "../general/dftfuncs.h"
+#include "../general/angular.h"
 
 namespace helfem {
   namespace diatomic {
     namespace dftgrid {
 
+      /// Basis function values at a radial point, cached between Fock builds
+      typedef struct {
+        /// Are the gradients included?
+        bool grad;
+        /// List of basis functions in element
+        arma::uvec bf_ind;
+        /// Total quadrature weight
+        arma::rowvec wtot;
+        /// Scale factors
+        arma::rowvec scale_r, scale_theta, scale_phi;
+        /// Function values and gradients
+        arma::cx_mat bf, bf_rho, bf_theta, bf_phi;
+      } bf_cache_t;
+
       /// Worker class
       class DFTGridWorker {
       protected:
         /// Basis set
         const helfem::diatomic::basis::TwoDBasis *basp;
       
-        /// Angular grid
-        arma::vec cth, phi, wang;
+        /// Angular grid, shared by all workers
+        const helfem::angular::angular_rule_t * angrule;
+        /// sin(theta) on the angular grid
+        arma::vec sth;
+        /**
+         * Complex conjugates of the angular factors of the basis
+         * functions, Nang x Ngrid, computed once for the grid. The
+         * values at a radial point are outer products of these with
+         * the radial functions.
+         */
+        arma::cx_mat ang_bf;
+        /// Same for the theta and phi derivatives
+        arma::cx_mat ang_dth, ang_dphi;
+        /// Element for which the radial functions are stored
+        size_t rad_iel;
+        /// Radial functions and derivatives at all quadrature points of the element
+        arma::mat rad_bf, rad_df;
+        /// Radial quadrature points and weights of the element
+        arma::vec rad_r, rad_w;
+
         /// Total quadrature weight
         arma::rowvec wtot;
 
@@ -120,6 +154,10 @@ namespace helfem {
 
         /// Compute basis functions on grid points
         void compute_bf(size_t iel, size_t irad);
+        /// Store basis functions in cache entry
+        void save_bf(bf_cache_t & c) const;
+        /// Load basis functions from cache entry
+        void load_bf(const bf_cache_t & c);
         /// Free memory
         void free();
         /// Save data
@@ -141,6 +179,8 @@ namespace helfem {
         /// array. thr gives density screening threshold. Pot toggles
         /// evaluation of potential
         void compute_xc(int func_id, const arma::vec & params, double thr, bool pot=true);
+        /// Same, with an already initialized functional
+        void compute_xc(const XCFunctional & func, bool pot=true);
         /// Evaluate exchange/correlation energy
         double eval_Exc() const;
         /// Zero out energy
@@ -157,6 +197,10 @@ namespace helfem {
         void eval_Fxc(arma::mat & H) const;
         /// Evaluate Fock matrix, unrestricted calculation
         void eval_Fxc(arma::mat & Ha, arma::mat & Hb, bool beta=true) const;
+        /// Increment the element block of the Fock matrix, restricted calculation
+        void increment_Fxc_block(arma::mat & H) const;
+        /// Increment the element blocks of the Fock matrix, unrestricted calculation
+        void increment_Fxc_block(arma::mat & Ha, arma::mat & Hb, bool beta=true) const;
       };
 
       /// Wrapper routine
@@ -167,6 +211,21 @@ namespace helfem {
         /// Angular rule
         int lang, mang;
 
+        /// Memory budget of the basis function cache in bytes
+        size_t cache_budget;
+        /// Memory used by the basis function cache
+        size_t cache_used;
+        /// Cached basis functions for each element and radial point
+        std::vector< std::vector<bf_cache_t> > cache;
+        /// Compute basis functions at radial point, or get them from the cache
+        void compute_bf(DFTGridWorker & grid, size_t iel, size_t irad);
+        /// Print per-thread busy times of the XC quadrature?
+        bool thread_timing;
+        /// Exchange and correlation functionals, kept between calls
+        std::shared_ptr<const XCFunctional> xfunc, cfunc;
+        /// Partition of the radial elements handled by this grid
+        size_t part_index, part_count;
+
       public:
         /// Dummy constructor
         DFTGrid();
@@ -175,6 +234,18 @@ namespace helfem {
         /// Destructor
         ~DFTGrid();
 
+        /// Cache basis function values between calls, up to the given memory in bytes; 0 disables the cache
+        void set_bf_cache(size_t budget);
+        /// Toggle printout of per-thread busy times in the XC quadrature
+        void set_thread_timing(bool timing);
+        /**
+         * Only integrate over the radial elements iel with iel % npart
+         * == ipart in eval_Fxc. The returned matrices and energies are
+         * then partial sums over the grid, which add up to the full
+         * values over all the partitions.
+         */
+        void set_partition(size_t ipart, size_t npart);
+
         /// Compute Fock matrix, exchange-correlation energy and integrated electron density, restricted case
         void eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::mat & P, arma::mat & H, double & Exc, double & Nel, double & Ekin, double thr);
         /// Compute Fock matrix, exchange-correlation energy and integrated electron density, unrestricted case
@@ -207,6 +278,67 @@ namespace helfem {
         H+=arma::real(fhlp*arma::trans(f));
       }
 
+      /**
+       * Fused quadrature of all terms of the Fock matrix, H += S + S^T with
+       *   S = Re[ (vrho/2 f + sum_c gn_c f_c + vl l) f^H + sum_c (vt_c/2 f_c) f_c^H ],
+       * which needs one product for LDA and GGA and three more for
+       * meta-GGA. gn (Np x 3), vt (3 x Np) and vl (Np) may be empty.
+       */
+      template<typename T> void increment_fock(arma::mat & H, const arma::rowvec & vrho, const arma::mat & gn, const arma::mat & vt, const arma::rowvec & vl, const arma::Mat<T> & f, const arma::Mat<T> & f_x, const arma::Mat<T> & f_y, const arma::Mat<T> & f_z, const arma::Mat<T> & l) {
+        if(f.n_cols != vrho.n_elem) {
+          std::ostringstream oss;
+          oss << "Number of functions " << f.n_cols << " and potential values " << vrho.n_elem << " do not match!\n";
+          throw std::runtime_error(oss.str());
+        }
+        if(H.n_rows != f.n_rows || H.n_cols != f.n_rows) {
+          std::ostringstream oss;
+          oss << "Size of basis function (" << f.n_rows << "," << f.n_cols << ") and Fock matrix (" << H.n_rows << "," << H.n_cols << ") doesn't match!\n";
+          throw std::runtime_error(oss.str());
+        }
+        if((gn.n_elem || vt.n_elem) && (f.n_rows != f_x.n_rows || f.n_cols != f_x.n_cols || f.n_rows != f_y.n_rows || f.n_cols != f_y.n_cols || f.n_rows != f_z.n_rows || f.n_cols != f_z.n_cols)) {
+          throw std::runtime_error("Sizes of basis function and derivative matrices doesn't match!\n");
+        }
+        if(vl.n_elem && (l.n_rows != f.n_rows || l.n_cols != f.n_cols)) {
+          throw std::runtime_error("Sizes of basis function and Laplacian matrices doesn't match!\n");
+        }
+
+        // Scaled functions that multiply f^H
+        arma::Mat<T> g(f.n_rows,f.n_cols);
+        for(size_t j=0;j<f.n_cols;j++) {
+          const double w=0.5*vrho(j);
+          for(size_t i=0;i<f.n_rows;i++)
+            g(i,j)=w*f(i,j);
+        }
+        if(gn.n_elem) {
+          for(size_t j=0;j<f.n_cols;j++) {
+            const double gx=gn(j,0), gy=gn(j,1), gz=gn(j,2);
+            for(size_t i=0;i<f.n_rows;i++)
+              g(i,j)+=gx*f_x(i,j)+gy*f_y(i,j)+gz*f_z(i,j);
+          }
+        }
+        if(vl.n_elem) {
+          for(size_t j=0;j<f.n_cols;j++)
+            for(size_t i=0;i<f.n_rows;i++)
+              g(i,j)+=vl(j)*l(i,j);
+        }
+        arma::mat S(arma::real(g*arma::trans(f)));
+
+        if(vt.n_elem) {
+          const arma::Mat<T> * fc[3]={&f_x, &f_y, &f_z};
+          for(int c=0;c<3;c++) {
+            const arma::Mat<T> & fx(*fc[c]);
+            for(size_t j=0;j<fx.n_cols;j++) {
+              const double w=0.5*vt(c,j);
+              for(size_t i=0;i<fx.n_rows;i++)
+                g(i,j)=w*fx(i,j);
+            }
+            S+=arma::real(g*arma::trans(fx));
+          }
+        }
+
+        H+=S+arma::trans(S);
+      }
+
       /// BLAS routine for GGA-type quadrature
       template<typename T> void increment_gga(arma::mat & H, const arma::mat & gn, const arma::Mat<T> & f, arma::Mat<T> f_x, arma::Mat<T> f_y, arma::Mat<T> f_z) {
         if(gn.n_cols!=3) {
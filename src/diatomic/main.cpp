@@ -15,10 +15,14 @@
  */
 #include "../general/cmdline.h"
 #include "../general/checkpoint.h"
+#include "../general/checkpoint_writer.h"
 #include "../general/constants.h"
 #include "../general/diis.h"
 #include "../general/dftfuncs.h"
 #include "../general/timer.h"
+#include "../general/profiler.h"
+#include "../general/threading.h"
+#include "../general/memory_plan.h"
 #include "utils.h"
 #include "../general/elements.h"
 #include "../general/scf_helpers.h"
@@ -82,56 +86,50 @@ void normalize_matrix(arma::mat & M, const arma::vec & norm) {
       M(i,j)*=norm(i)*norm(j);
 }
 
-int main(int argc, char **argv) {
-  cmdline::parser parser;
+bool same_basis(const diatomic::basis::TwoDBasis & lh, const diatomic::basis::TwoDBasis & rh) {
+  if(lh.get_Rhalf() != rh.get_Rhalf())
+    return false;
+  if(lh.get_poly_id() != rh.get_poly_id() || lh.get_poly_nnodes() != rh.get_poly_nnodes())
+    return false;
+  if(lh.get_nquad() != rh.get_nquad())
+    return false;
+
+  arma::vec lbval(lh.get_bval()), rbval(rh.get_bval());
+  if(lbval.n_elem != rbval.n_elem || arma::any(lbval != rbval))
+    return false;
+  arma::ivec llval(lh.get_lval()), rlval(rh.get_lval());
+  if(llval.n_elem != rlval.n_elem || arma::any(llval != rlval))
+    return false;
+  arma::ivec lmval(lh.get_mval()), rmval(rh.get_mval());
+  if(lmval.n_elem != rmval.n_elem || arma::any(lmval != rmval))
+    return false;
+
+  return true;
+}
 
-  // full option name, no short option, description, argument required
-  parser.add<std::string>("Z1", 0, "first nuclear charge", true);
-  parser.add<std::string>("Z2", 0, "second nuclear charge", true);
-  parser.add<double>("Rbond", 0, "internuclear distance", true);
-  parser.add<bool>("angstrom", 0, "input distances in angstrom", false, false);
-  parser.add<int>("nela", 0, "number of alpha electrons", false, 0);
-  parser.add<int>("nelb", 0, "number of beta  electrons", false, 0);
-  parser.add<int>("Q", 0, "charge state", false, 0);
-  parser.add<int>("M", 0, "spin multiplicity", false, 0);
-  parser.add<std::string>("lmax", 0, "maximum l quantum number", true, "");
-  parser.add<int>("mmax", 0, "maximum m quantum number", false, -1);
-  parser.add<int>("lpad", 0, "padding for max l for more accurate Qlm recursion", false, 10);
-  parser.add<double>("Rmax", 0, "practical infinity in au", false, 40.0);
-  parser.add<int>("grid", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
-  parser.add<double>("zexp", 0, "parameter in radial grid", false, 1.0);
-  parser.add<int>("nelem", 0, "number of elements", true);
-  parser.add<int>("nnodes", 0, "number of nodes per element", false, 15);
-  parser.add<int>("nquad", 0, "number of quadrature points", false, 0);
-  parser.add<int>("maxit", 0, "maximum number of iterations", false, 50);
-  parser.add<double>("convthr", 0, "convergence threshold", false, 1e-7);
-  parser.add<double>("Ez", 0, "electric dipole field", false, 0.0);
-  parser.add<double>("Qzz", 0, "electric quadrupole field", false, 0.0);
-  parser.add<double>("Bz", 0, "magnetic dipole field", false, 0.0);
-  parser.add<bool>("diag", 0, "exact diagonalization", false, 1);
-  parser.add<int>("finitenuc", 0, "finite nuclear model", false, false);
-  parser.add<double>("Rrms1", 0, "nucleus 1 radius", false, 0.0);
-  parser.add<double>("Rrms2", 0, "nucleus 2 radius", false, 0.0);
-  parser.add<std::string>("method", 0, "method to use", false, "HF");
-  parser.add<int>("ldft", 0, "theta rule for dft quadrature (0 for auto)", false, 0);
-  parser.add<int>("mdft", 0, "phi rule for dft quadrature (0 for auto)", false, 0);
-  parser.add<double>("dftthr", 0, "density threshold for dft", false, 1e-12);
-  parser.add<int>("restricted", 0, "spin-restricted orbitals", false, -1);
-  parser.add<int>("symmetry", 0, "force orbital symmetry", false, 1);
-  parser.add<int>("primbas", 0, "primitive radial basis", false, 4);
-  parser.add<double>("diiseps", 0, "when to start mixing in diis", false, 1e-2);
-  parser.add<double>("diisthr", 0, "when to switch over fully to diis", false, 1e-3);
-  parser.add<int>("diisorder", 0, "length of diis history", false, 5);
-  parser.add<int>("readocc", 0, "read occupations from file, use until nth build", false, 0);
-  parser.add<double>("perturb", 0, "randomly perturb initial guess", false, 0.0);
-  parser.add<int>("seed", 0, "seed for random perturbation", false, 0);
-  parser.add<int>("iguess", 0, "guess: 0 for core, 1 for GSZ, 2 for SAP, 3 for TF", false, 2);
-  parser.add<std::string>("load", 0, "load guess from checkpoint", false, "");
-  parser.add<std::string>("save", 0, "save calculation to checkpoint", false, "helfem.chk");
-  parser.add<std::string>("x_pars", 0, "file for parameters for exchange functional", false, "");
-  parser.add<std::string>("c_pars", 0, "file for parameters for correlation functional", false, "");
-  parser.add<bool>("maverage", 0, "average Fock matrix over m values", false, false);
-  parser.parse_check(argc, argv);
+/// Data carried over between the points of a bond length scan
+typedef struct {
+  /// Basis set, shared by all the points
+  std::shared_ptr<diatomic::basis::TwoDBasis> basis;
+  /// Have the two-electron integrals been computed?
+  bool tei;
+  /// Bond length of the previous point
+  double Rbond;
+  /// Orbitals of the previous point
+  arma::mat Ca, Cb;
+  /// Orbital energies of the previous point
+  arma::vec Ea, Eb;
+  /// Energy components and Hellmann-Feynman force of the last point
+  double Ekin, Epot, Enucr, Ecoul, Exx, Exc, Etot, force;
+  /// Is this a field scan at fixed geometry?
+  bool fieldscan;
+  /// Fields of the point in a field scan
+  double Ez, Qzz;
+  /// Total dipole and quadrupole moments of the last point
+  double dipole, quadrupole;
+} scan_t;
+
+static int run_point(cmdline::parser & parser, double Rbond, scan_t * scan) {
 
   // Get parameters
   double Rmax(parser.get<double>("Rmax"));
@@ -140,9 +138,16 @@ int main(int argc, char **argv) {
   double Ez(parser.get<double>("Ez"));
   double Qzz(parser.get<double>("Qzz"));
   double Bz(parser.get<double>("Bz"));
+  if(scan && scan->fieldscan) {
+    Ez=scan->Ez;
+    Qzz=scan->Qzz;
+  }
 
   int maxit(parser.get<int>("maxit"));
   double convthr(parser.get<double>("convthr"));
+  int davidson(parser.get<int>("davidson"));
+  double davidson_thr(parser.get<double>("davidson_thr"));
+  scf::FermiSmearing smear(parser.get<double>("smear_T"),parser.get<double>("smear_anneal"),parser.get<double>("smear_Tmin"),parser.get<bool>("smear_integer"));
 
   bool diag(parser.get<bool>("diag"));
   int restr(parser.get<int>("restricted"));
@@ -166,11 +171,12 @@ int main(int argc, char **argv) {
   int ldft(parser.get<int>("ldft"));
   int mdft(parser.get<int>("mdft"));
   double dftthr(parser.get<double>("dftthr"));
+  double dft_cache(parser.get<double>("dft_cache"));
+  bool dft_timing(parser.get<bool>("dft_timing"));
 
   // Nuclear charge
   int Z1(get_Z(parser.get<std::string>("Z1")));
   int Z2(get_Z(parser.get<std::string>("Z2")));
-  double Rbond(parser.get<double>("Rbond"));
   // Number of occupied states
   int nela(parser.get<int>("nela"));
   int nelb(parser.get<int>("nelb"));
@@ -185,6 +191,7 @@ int main(int argc, char **argv) {
   double diiseps=parser.get<double>("diiseps");
   double diisthr=parser.get<double>("diisthr");
   int diisorder=parser.get<int>("diisorder");
+  bool adiis_stop=parser.get<bool>("adiis_stop");
 
   std::string method(parser.get<std::string>("method"));
 
@@ -192,11 +199,22 @@ int main(int argc, char **argv) {
   int seed=parser.get<int>("seed");
 
   std::string save(parser.get<std::string>("save"));
+  int chkpt_every(parser.get<int>("chkpt_every"));
+  bool chkpt_restart(parser.get<bool>("chkpt_restart"));
+  bool chkpt_compact(parser.get<bool>("chkpt_compact"));
+  int chkpt_compress(parser.get<int>("chkpt_compress"));
   std::string load(parser.get<std::string>("load"));
+  std::string guess_cache(parser.get<std::string>("guess_cache"));
+  std::string integral_cache(parser.get<std::string>("integral_cache"));
 
   std::string xparf(parser.get<std::string>("x_pars"));
   std::string cparf(parser.get<std::string>("c_pars"));
 
+  int iconf(parser.get<int>("iconf"));
+  int conf_N(parser.get<int>("conf_N"));
+  double conf_R(parser.get<double>("conf_R"));
+  bool conf_ellipsoidal(parser.get<bool>("conf_ellipsoidal"));
+
   // Set parameters if necessary
   arma::vec xpars, cpars;
   if(xparf.size()) {
@@ -210,6 +228,15 @@ int main(int argc, char **argv) {
 
   // Open checkpoint in save mode
   Checkpoint chkpt(save,true);
+  chkpt.set_compression(chkpt_compress);
+  // The SCF matrices are saved in the background
+  CheckpointWriter chkwriter(chkpt,chkpt_every,chkpt_restart || chkpt_compact);
+  // Matrices that can be regenerated from the basis are left out of
+  // compact checkpoints
+  auto write_derived = [&](const std::string & name, const arma::mat & M) {
+    if(!chkpt_compact)
+      chkpt.write(name,M);
+  };
 
   // Read occupations from file?
   int readocc=parser.get<int>("readocc");
@@ -223,16 +250,15 @@ int main(int argc, char **argv) {
     }
   }
 
-  if(parser.get<bool>("angstrom")) {
-    // Convert to atomic units
-    Rbond*=ANGSTROMINBOHR;
-  }
-
   scf::parse_nela_nelb(nela,nelb,Q,M,Z1+Z2);
   if(restr==-1) {
     // If number of electrons differs then unrestrict
     restr=(nela==nelb);
   }
+  if(smear.active() && restr && nela!=nelb)
+    throw std::logic_error("Fermi smearing is not available for restricted open-shell calculations!\n");
+  if(smear.active() && readocc)
+    throw std::logic_error("Fermi smearing can't be combined with occupations read from file!\n");
   chkpt.write("nela",nela);
   chkpt.write("nelb",nelb);
 
@@ -273,10 +299,22 @@ int main(int argc, char **argv) {
   diatomic::basis::lm_to_l_m(lmmax,lval,mval);
 
   double Rhalf(0.5*Rbond);
-  double mumax(utils::arcosh(Rmax/Rhalf));
-  arma::vec bval(atomic::basis::normal_grid(Nelem, mumax, igrid, zexp));
-
-  diatomic::basis::TwoDBasis basis(Z1, Z2, Rhalf, poly, Nquad, bval, lval, mval, lpad);
+  std::shared_ptr<diatomic::basis::TwoDBasis> basp;
+  bool reuse(scan && scan->basis);
+  if(reuse) {
+    // The radial grid is kept fixed in the scaled coordinates, so
+    // only the Rhalf prefactors of the integrals need to be updated
+    basp=scan->basis;
+    basp->set_Rhalf(Rhalf);
+    printf("Reusing basis set from previous geometry, practical infinity is now at %e\n",Rmax*Rbond/scan->Rbond);
+  } else {
+    double mumax(utils::arcosh(Rmax/Rhalf));
+    arma::vec bval(atomic::basis::normal_grid(Nelem, mumax, igrid, zexp));
+    basp=std::make_shared<diatomic::basis::TwoDBasis>(Z1, Z2, Rhalf, poly, Nquad, bval, lval, mval, lpad);
+    if(scan)
+      scan->basis=basp;
+  }
+  diatomic::basis::TwoDBasis & basis(*basp);
   chkpt.write(basis);
   printf("Basis set consists of %i angular shells composed of %i radial functions, totaling %i basis functions\n",(int) basis.Nang(), (int) basis.Nrad(), (int) basis.Nbf());
 
@@ -330,6 +368,8 @@ int main(int argc, char **argv) {
       entry.push_back(basis.m_indices(-m));
     mavg_idx.push_back(entry);
   }
+  // Symmetrization of the Fock matrix is compiled once
+  const scf::FockSymmetrizer fock_symm(basis.Nbf(), symm ? dsym : std::vector<arma::uvec>(), maverage ? mavg_idx : std::vector< std::vector<arma::uvec> >());
 
   // Forced occupations?
   arma::ivec occnuma, occnumb;
@@ -398,14 +438,56 @@ int main(int argc, char **argv) {
   else
     printf("\nA pure exchange functional used, no exact exchange.\n");
 
+  std::string tei_scratch(parser.get<std::string>("tei_scratch"));
+  size_t max_memory(scf::parse_memory(parser.get<std::string>("max_memory")));
+  if(max_memory) {
+    // Plan the large allocations and pick storage modes that fit
+    scf::MemoryPlan plan(max_memory);
+    // Overlap, kinetic, nuclear, core and orthogonalizing matrices
+    plan.set("one-electron matrices",5*basis.mem_1el());
+    // Orbitals, densities, Coulomb, exchange and Fock matrices for both spins
+    plan.set("SCF matrices",10*basis.mem_1el());
+    // Fock, density and error matrices for both spins
+    plan.set("DIIS history",6*diisorder*basis.mem_1el());
+    plan.set("auxiliary one-electron integrals",basis.mem_1el_aux());
+    if(!tei_scratch.size() && !reuse)
+      plan.set("two-electron integrals",basis.mem_2el_aux());
+    if(dft && dft_cache>0.0)
+      plan.set("DFT basis function cache",(size_t) (dft_cache*1024.0*1024.0));
+
+    // The basis function cache can shrink to whatever is left over
+    if(!plan.fits() && dft && dft_cache>0.0) {
+      plan.remove("DFT basis function cache");
+      dft_cache=plan.available()/(1024.0*1024.0);
+      if(dft_cache>0.0)
+        plan.set("DFT basis function cache",(size_t) (dft_cache*1024.0*1024.0));
+      printf("Reduced the DFT basis function cache to %s to fit the memory budget\n",scf::memory_size((size_t) (dft_cache*1024.0*1024.0)).c_str());
+    }
+    // Move the integrals out of core
+    if(!plan.fits() && !tei_scratch.size() && !reuse) {
+      tei_scratch=save+".tei";
+      plan.remove("two-electron integrals");
+      printf("Moved the two-electron integrals out of core to fit the memory budget\n");
+    }
+    plan.print();
+    plan.check();
+  }
+  if(tei_scratch.size() && !reuse) {
+    printf("Two-electron integrals will be stored out of core in %s\n",tei_scratch.c_str());
+    basis.set_tei_scratch(tei_scratch);
+  }
+
   Timer timer;
 
+  // Integrals are cached by the basis set fingerprint
+  const std::string fingerprint(basis.fingerprint());
+
   // Form overlap matrix
-  arma::mat S(basis.overlap());
-  chkpt.write("S",S);
+  arma::mat S(cached_matrix(integral_cache,"S_"+fingerprint,[&](){return basis.overlap();}));
+  write_derived("S",S);
   // Form kinetic energy matrix
-  arma::mat T(basis.kinetic());
-  chkpt.write("T",T);
+  arma::mat T(cached_matrix(integral_cache,"T_"+fingerprint,[&](){return basis.kinetic();}));
+  write_derived("T",T);
 
   helfem::diatomic::dftgrid::DFTGrid grid;
   if(dft) {
@@ -430,6 +512,10 @@ int main(int argc, char **argv) {
 
     // Form grid
     grid=helfem::diatomic::dftgrid::DFTGrid(&basis,ldft,mdft);
+    if(dft_cache>0.0)
+      grid.set_bf_cache((size_t) (dft_cache*1024.0*1024.0));
+    if(dft_timing)
+      grid.set_thread_timing(true);
 
     // Basis function norms
     arma::vec bfnorm(arma::pow(arma::diagvec(S),-0.5));
@@ -469,15 +555,19 @@ int main(int argc, char **argv) {
   // Get half-inverse
   timer.set();
   arma::mat Sinvh(basis.Sinvh(!diag,symm));
-  chkpt.write("Sinvh",Sinvh);
+  write_derived("Sinvh",Sinvh);
   printf("Half-inverse formed in %.6f\n",timer.get());
+  // Symmetry blocked orthogonalizer, reused by every diagonalization
+  scf::SymmetryOrthogonalizer symorth;
+  if(symm)
+    symorth=scf::SymmetryOrthogonalizer(Sinvh,dsym);
   {
     arma::mat Smo(Sinvh.t()*S*Sinvh);
     Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
     printf("Orbital orthonormality deviation is %e\n",arma::norm(Smo,"fro"));
   }
   arma::mat Sh(basis.Shalf(!diag,symm));
-  chkpt.write("Sh",Sh);
+  write_derived("Sh",Sh);
   printf("Half-overlap formed in %.6f\n",timer.get());
   {
     arma::mat Smo(Sh.t()*Sinvh);
@@ -489,7 +579,7 @@ int main(int argc, char **argv) {
   Timer tnuc;
   arma::mat Vnuc;
   if(finitenuc==0)
-    Vnuc=basis.nuclear();
+    Vnuc=cached_matrix(integral_cache,"Vnuc_"+fingerprint,[&](){return basis.nuclear();});
   else {
     modelpotential::ModelPotential *pot1(modelpotential::get_nuclear_model((modelpotential::nuclear_model_t) (finitenuc-1),Z1,Rrms1));
     modelpotential::ModelPotential *pot2(modelpotential::get_nuclear_model((modelpotential::nuclear_model_t) (finitenuc-1),Z2,Rrms2));
@@ -512,28 +602,99 @@ int main(int argc, char **argv) {
   }
   chkpt.write("Vnuc",Vnuc);
 
-  // Dipole coupling
-  const arma::mat dip(basis.dipole_z());
-  chkpt.write("dip",dip);
-  // Quadrupole coupling
-  const arma::mat quad(basis.quadrupole_zz());
-  chkpt.write("quad",quad);
+  // The confinement and field couplings are only formed, and
+  // checkpointed, when they are in use; an empty matrix stands for zero
+  arma::mat Vconf;
+  if(conf_N) {
+    if(parser.get<bool>("angstrom"))
+      conf_R*=ANGSTROMINBOHR;
+
+    // Is the matrix available in the checkpoint we're loading from?
+    bool cached=false;
+    if(load.size()) {
+      Checkpoint loadchk(load,false);
+      if(loadchk.exist("Vconf") && loadchk.exist("conf_R")) {
+        int oldiconf, oldconf_N;
+        double oldconf_R;
+        bool oldconf_ellipsoidal;
+        loadchk.read("iconf",oldiconf);
+        loadchk.read("conf_N",oldconf_N);
+        loadchk.read("conf_R",oldconf_R);
+        loadchk.read("conf_ellipsoidal",oldconf_ellipsoidal);
+
+        diatomic::basis::TwoDBasis oldbasis;
+        loadchk.read(oldbasis);
+        if(oldiconf==iconf && oldconf_N==conf_N && oldconf_R==conf_R && oldconf_ellipsoidal==conf_ellipsoidal && same_basis(basis,oldbasis) && loadchk.exist("Vconf")) {
+          loadchk.read("Vconf",Vconf);
+          cached=true;
+          printf("Confinement potential read from checkpoint\n");
+        }
+      }
+    }
+
+    if(!cached) {
+      printf("Computing confinement potential\n");
+      Timer tconf;
+      int lquad = (ldft>0) ? ldft : 4*arma::max(lmmax)+12;
+      helfem::diatomic::twodquad::TwoDGrid qgrid(&basis,lquad);
+      Vconf=qgrid.confinement(iconf, conf_N, conf_R, conf_ellipsoidal);
+      printf("Done in %.6f\n",tconf.get());
+    }
+    write_derived("Vconf",Vconf);
+  }
+  chkpt.write("iconf",iconf);
+  chkpt.write("conf_N",conf_N);
+  chkpt.write("conf_R",conf_R);
+  chkpt.write("conf_ellipsoidal",conf_ellipsoidal);
+
+  // Dipole and quadrupole coupling, formed on first use
+  arma::mat dip, quad;
+  auto multipole_matrices = [&]() {
+    if(dip.n_elem)
+      return;
+    dip=basis.dipole_z();
+    write_derived("dip",dip);
+    quad=basis.quadrupole_zz();
+    write_derived("quad",quad);
+  };
 
   // Nuclear dipole and quadrupole
   const double nucdip=(Z2-Z1)*Rhalf;
   const double nucquad=(Z1+Z2)*Rhalf*Rhalf;
 
   // Electric field coupling (minus sign cancels one from charge)
-  const arma::mat Vel(Ez*dip + Qzz*quad/3.0);
-  chkpt.write("Vel",Vel);
+  arma::mat Vel;
+  if(Ez!=0.0 || Qzz!=0.0) {
+    multipole_matrices();
+    Vel=Ez*dip + Qzz*quad/3.0;
+    write_derived("Vel",Vel);
+  }
   // Magnetic field coupling
-  arma::mat Vmag(basis.Bz_field(Bz));
-  chkpt.write("Vmag",Vmag);
+  arma::mat Vmag;
+  if(Bz!=0.0) {
+    Vmag=basis.Bz_field(Bz);
+    write_derived("Vmag",Vmag);
+  }
   const double Enucfield(-Ez*nucdip - Qzz*nucquad/3.0);
 
+  // Adds the couplings that are in use to a core Hamiltonian
+  auto add_couplings = [&](arma::mat & H, bool confinement) {
+    if(Vel.n_elem)
+      H+=Vel;
+    if(Vmag.n_elem)
+      H+=Vmag;
+    if(confinement && Vconf.n_elem)
+      H+=Vconf;
+  };
+  // Expectation value of a coupling that may be absent
+  auto coupling_energy = [](const arma::mat & Pmat, const arma::mat & V) {
+    return V.n_elem ? arma::trace(Pmat*V) : 0.0;
+  };
+
   // Form Hamiltonian
-  const arma::mat H0(T+Vnuc+Vel+Vmag);
-  chkpt.write("H0",H0);
+  arma::mat H0(T+Vnuc);
+  add_couplings(H0,true);
+  write_derived("H0",H0);
 
   printf("One-electron matrices formed in %.6f\n",timer.get());
 
@@ -548,7 +709,16 @@ int main(int argc, char **argv) {
   timer.set();
   {
     arma::mat Ca, Cb;
-    if(load.size()) {
+    if(scan && scan->Ca.n_elem) {
+      printf("Guess orbitals from previous geometry\n");
+      // The overlap matrix scales as Rhalf^3, so the scaled orbitals
+      // are orthonormal also at the new geometry
+      double fac(std::pow(scan->Rbond/Rbond,1.5));
+      Ca=fac*scan->Ca;
+      Cb=fac*scan->Cb;
+      Ea=scan->Ea;
+      Eb=scan->Eb;
+    } else if(load.size()) {
       printf("Guess orbitals from checkpoint\n");
 
       // Load checkpoint
@@ -557,8 +727,25 @@ int main(int argc, char **argv) {
       diatomic::basis::TwoDBasis oldbasis;
       loadchk.read(oldbasis);
 
+      // Compact checkpoints hold no derived matrices, so these are
+      // rebuilt from the old basis and orbitals
       arma::mat oldSinvh;
-      loadchk.read("Sinvh",oldSinvh);
+      if(loadchk.exist("Sinvh"))
+        loadchk.read("Sinvh",oldSinvh);
+      else
+        oldSinvh=oldbasis.Sinvh(!diag,symm);
+      auto read_fock = [&](const std::string & spin) {
+        arma::mat F;
+        if(loadchk.exist("F"+spin)) {
+          loadchk.read("F"+spin,F);
+        } else {
+          arma::mat C, E;
+          loadchk.read("C"+spin,C);
+          loadchk.read("E"+spin,E);
+          F=scf::fock_from_orbitals(oldbasis.overlap(),C,arma::vectorise(E));
+        }
+        return F;
+      };
 
       // Interbasis overlap
       arma::mat S12(basis.overlap(oldbasis));
@@ -576,7 +763,7 @@ int main(int argc, char **argv) {
 	  arma::mat F;
 
 	  // Load Fock matrix
-	  loadchk.read("Fa",F);
+	  F=read_fock("a");
 	  // Project onto the old orthogonal basis
 	  F=arma::trans(oldSinvh)*F*oldSinvh;
 	  // Project onto the new basis
@@ -585,12 +772,12 @@ int main(int argc, char **argv) {
 	  F=SSinvh*F*arma::trans(SSinvh);
 	  // Diagonalize
 	  if(symm)
-	    scf::eig_gsym_sub(Ea,Ca,F,Sinvh,dsym);
+	    symorth.eig(Ea,Ca,F);
 	  else
 	    scf::eig_gsym(Ea,Ca,F,Sinvh);
 
 	  // Load Fock matrix
-	  loadchk.read("Fb",F);
+	  F=read_fock("b");
 	  // Project onto the old orthogonal basis
 	  F=arma::trans(oldSinvh)*F*oldSinvh;
 	  // Project onto the new basis
@@ -599,7 +786,7 @@ int main(int argc, char **argv) {
 	  F=SSinvh*F*arma::trans(SSinvh);
 	  // Diagonalize
 	  if(symm)
-	    scf::eig_gsym_sub(Eb,Cb,F,Sinvh,dsym);
+	    symorth.eig(Eb,Cb,F);
 	  else
 	    scf::eig_gsym(Eb,Cb,F,Sinvh);
 	}
@@ -685,25 +872,48 @@ int main(int argc, char **argv) {
 
       // Quadrature grid
       int lquad = (ldft>0) ? ldft : 4*arma::max(lmmax)+12;
-      helfem::diatomic::twodquad::TwoDGrid qgrid;
-      qgrid=helfem::diatomic::twodquad::TwoDGrid(&basis,lquad);
-
-      arma::mat Squad(qgrid.overlap());
-      Squad-=S;
-      arma::vec bfnorm(arma::pow(arma::diagvec(S),-0.5));
-      normalize_matrix(Squad,bfnorm);
-
-      double Serr(arma::norm(Squad,"fro"));
-      printf("Error in overlap matrix evaluated on two-dimensional grid is %e\n",Serr);
-      fflush(stdout);
 
-      arma::mat Hguess(T+Vel+Vmag+qgrid.model_potential(p1,p2));
+      // The model potential only depends on the basis set, the grid
+      // and the guess, so it can be reused from an earlier run
+      arma::mat Vguess;
+      std::string guess_entry("guess_"+basis.fingerprint()+"_"+std::to_string(lquad)+"_"+std::to_string(iguess));
+      bool cached=false;
+      if(guess_cache.size() && file_exists(guess_cache)) {
+        Checkpoint cache(guess_cache,false);
+        cached=cache.read_cached(guess_entry,Vguess);
+        if(cached && (Vguess.n_rows != T.n_rows || Vguess.n_cols != T.n_cols))
+          cached=false;
+      }
+      if(cached) {
+        printf("Guess potential read from %s\n",guess_cache.c_str());
+      } else {
+        helfem::diatomic::twodquad::TwoDGrid qgrid;
+        qgrid=helfem::diatomic::twodquad::TwoDGrid(&basis,lquad);
+
+        arma::mat Squad(qgrid.overlap());
+        Squad-=S;
+        arma::vec bfnorm(arma::pow(arma::diagvec(S),-0.5));
+        normalize_matrix(Squad,bfnorm);
+
+        double Serr(arma::norm(Squad,"fro"));
+        printf("Error in overlap matrix evaluated on two-dimensional grid is %e\n",Serr);
+        fflush(stdout);
+
+        Vguess=qgrid.model_potential(p1,p2);
+        if(guess_cache.size()) {
+          Checkpoint cache(guess_cache,true,false);
+          cache.write_cached(guess_entry,Vguess);
+        }
+      }
       delete p1;
       delete p2;
 
+      arma::mat Hguess(T+Vguess);
+      add_couplings(Hguess,false);
+
       // Diagonalize
       if(symm)
-        scf::eig_gsym_sub(Ea,Ca,Hguess,Sinvh,dsym);
+        symorth.eig(Ea,Ca,Hguess);
       else
         scf::eig_gsym(Ea,Ca,Hguess,Sinvh);
 
@@ -760,35 +970,90 @@ int main(int argc, char **argv) {
   }
   printf("Initial guess performed in %.6f\n",timer.get());
 
-  printf("Computing two-electron integrals\n");
-  fflush(stdout);
-  timer.set();
-  basis.compute_tei(kfrac!=0.0);
-  printf("Done in %.6f\n",timer.get());
+  // Reuse the Legendre function values from the integral cache or
+  // the checkpoint we're loading from
+  bool legendre_cached=false;
+  if(integral_cache.size() && file_exists(integral_cache)) {
+    Checkpoint cache(integral_cache,false);
+    legendre_cached=cache.read_legendre_table(basis,"legendre_"+fingerprint);
+    if(legendre_cached)
+      printf("Legendre function values read from %s\n",integral_cache.c_str());
+  }
+  if(!legendre_cached && load.size()) {
+    Checkpoint loadchk(load,false);
+    if(loadchk.read_legendre_table(basis))
+      printf("Legendre function values read from checkpoint\n");
+  }
+
+  // The two-electron integrals don't depend on the bond length
+  if(!scan || !scan->tei) {
+    printf("Computing two-electron integrals\n");
+    fflush(stdout);
+    timer.set();
+    profiler::Region rtei("compute_tei");
+    basis.compute_tei(kfrac!=0.0);
+    rtei.stop();
+    printf("Done in %.6f\n",timer.get());
+    if(scan)
+      scan->tei=true;
+  }
+  chkpt.write_legendre_table(basis);
+  if(integral_cache.size() && !legendre_cached) {
+    Checkpoint cache(integral_cache,true,false);
+    cache.write_legendre_table(basis,"legendre_"+fingerprint);
+  }
 
-  double Ekin=0.0, Epot=0.0, Ecoul=0.0, Exx=0.0, Exc=0.0, Eefield=0.0, Emfield=0.0, Etot=0.0;
+  double Ekin=0.0, Epot=0.0, Ecoul=0.0, Exx=0.0, Exc=0.0, Eefield=0.0, Emfield=0.0, Econf=0.0, Etot=0.0;
   double Eold=0.0;
 
   bool usediis=true, useadiis=true, diiscomb=false;
   uDIIS diis(S,Sinvh,diiscomb,usediis,diiseps,diisthr,useadiis,true,diisorder);
+  diis.set_adiis_stop(adiis_stop);
+  // The matrices are block diagonal in the orbital symmetries, so only
+  // the diagonal blocks need to be kept in the DIIS history
+  if(symm)
+    diis.set_symmetry_blocks(dsym);
   double diiserr;
 
   // Density matrices
   arma::mat P, Pa, Pb;
 
+  // Incremental Fock builds: J and K are linear in the density, so
+  // only the change from the reference density needs to be contracted
+  int incfock(parser.get<int>("incfock"));
+  int nincr=0;
+  arma::mat Pa_ref, Pb_ref, J_ref, Ka_ref, Kb_ref;
+
+  // Concurrent Fock builds, balanced by the timings of the last iteration
+  bool concurrent(parser.get<bool>("concurrent"));
+  double tJ_last=0.0, tK_last=0.0, txc_last=0.0;
+
+  // Smeared occupations and the orbitals carrying them. The first
+  // iteration uses the integer occupations of the guess.
+  arma::vec occa, occb;
+  arma::mat Casmear, Cbsmear;
+  double Esmear=0.0;
+
   for(int i=1;i<=maxit;i++) {
     printf("\n**** Iteration %i ****\n\n",i);
+    profiler::Region rscf("scf");
 
     // Form density matrix
-    Pa=scf::form_density(Caocc,nela);
-    Pb=scf::form_density(Cbocc,nelb);
+    bool smeared(smear.active() && Casmear.n_cols);
+    if(smeared) {
+      Pa=scf::form_density(Casmear,occa);
+      Pb=scf::form_density(Cbsmear,occb);
+    } else {
+      Pa=scf::form_density(Caocc,nela);
+      Pb=scf::form_density(Cbocc,nelb);
+    }
     if(Pb.n_rows == 0)
       Pb.zeros(Pa.n_rows,Pa.n_cols);
     P=Pa+Pb;
 
-    chkpt.write("P",P);
-    chkpt.write("Pa",Pa);
-    chkpt.write("Pb",Pb);
+    chkwriter.write("P",P,!chkpt_compact);
+    chkwriter.write("Pa",Pa,!chkpt_compact);
+    chkwriter.write("Pb",Pb,!chkpt_compact);
 
     printf("Tr Pa = %f\n",arma::trace(Pa*S));
     if(nelb)
@@ -797,32 +1062,100 @@ int main(int argc, char **argv) {
 
     Ekin=arma::trace(P*T);
     Epot=arma::trace(P*Vnuc);
-    Eefield=arma::trace(P*Vel);
-    Emfield=arma::trace(P*Vmag)-Bz/2.0*(nela-nelb);
+    Eefield=coupling_energy(P,Vel);
+    Emfield=coupling_energy(P,Vmag)-Bz/2.0*(nela-nelb);
+    Econf=coupling_energy(P,Vconf);
+
+    // Incremental or full build?
+    bool incr(incfock>0 && J_ref.n_elem && nincr<incfock);
+    if(incr) {
+      nincr++;
+      printf("Incremental Fock build %i of %i\n",nincr,incfock);
+    } else
+      nincr=0;
+    arma::mat dPa(incr ? arma::mat(Pa-Pa_ref) : Pa);
+    arma::mat dPb(incr ? arma::mat(Pb-Pb_ref) : Pb);
+
+    // The Coulomb, exchange and exchange-correlation builds are
+    // independent, and may be run concurrently
+    arma::mat J, Ka, Kb, XCa, XCb;
+    double tJ=0.0, tK=0.0, txc=0.0;
+    double nelnum=0.0, ekin=0.0;
+    Exc=0.0;
+    std::vector< std::function<void()> > builds;
 
     // Form Coulomb matrix
-    timer.set();
-    arma::mat J(basis.coulomb(P));
-    double tJ(timer.get());
+    builds.push_back([&]() {
+      Timer tbuild;
+      profiler::Region rJ("J");
+      J=basis.coulomb(dPa+dPb);
+      if(incr)
+        J+=J_ref;
+      rJ.stop();
+      tJ=tbuild.get();
+    });
+
+    // Form exchange matrix
+    if(kfrac!=0.0)
+      builds.push_back([&]() {
+        Timer tbuild;
+        profiler::Region rK("K");
+        Ka=kfrac*basis.exchange(dPa);
+        if(incr)
+          Ka+=Ka_ref;
+
+        if(nelb) {
+          if(restr && nela==nelb)
+            Kb=Ka;
+          else {
+            Kb=kfrac*basis.exchange(dPb);
+            if(incr)
+              Kb+=Kb_ref;
+          }
+        } else
+          Kb.zeros(Cbocc.n_rows,Cbocc.n_rows);
+        rK.stop();
+        tK=tbuild.get();
+      });
+
+    // Exchange-correlation
+    if(dft)
+      builds.push_back([&]() {
+        Timer tbuild;
+        profiler::Region rxc("XC");
+        if(restr && nela==nelb) {
+          grid.eval_Fxc(x_func, xpars, c_func, cpars, P, XCa, Exc, nelnum, ekin, dftthr);
+          XCb=XCa;
+        } else {
+          grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa, Pb, XCa, XCb, Exc, nelnum, ekin, nelb>0, dftthr);
+        }
+        rxc.stop();
+        txc=tbuild.get();
+      });
+
+    if(concurrent && builds.size()>1) {
+      // The threads are divided by the timings of the last
+      // iteration; the first iteration is run sequentially
+      std::vector<double> weights;
+      weights.push_back(tJ_last);
+      if(kfrac!=0.0)
+        weights.push_back(tK_last);
+      if(dft)
+        weights.push_back(txc_last);
+      threading::run_concurrently(builds, weights);
+    } else
+      for(size_t ib=0;ib<builds.size();ib++)
+        builds[ib]();
+    tJ_last=tJ;
+    tK_last=tK;
+    txc_last=txc;
+
     Ecoul=0.5*arma::trace(P*J);
     printf("Coulomb energy %.10e % .6f\n",Ecoul,tJ);
     fflush(stdout);
-    chkpt.write("J",J);
+    chkwriter.write("J",J);
 
-    // Form exchange matrix
-    timer.set();
-    arma::mat Ka, Kb;
     if(kfrac!=0.0) {
-      Ka=kfrac*basis.exchange(Pa);
-
-      if(nelb) {
-        if(restr && nela==nelb)
-          Kb=Ka;
-        else
-          Kb=kfrac*basis.exchange(Pb);
-      } else
-        Kb.zeros(Cbocc.n_rows,Cbocc.n_rows);
-      double tK(timer.get());
       Exx=0.5*arma::trace(Pa*Ka);
       if(Kb.n_rows == Pb.n_rows && Kb.n_cols == Pb.n_cols)
         Exx+=0.5*arma::trace(Pb*Kb);
@@ -832,23 +1165,19 @@ int main(int argc, char **argv) {
     }
     fflush(stdout);
 
-    chkpt.write("Ka",Ka);
-    chkpt.write("Kb",Kb);
+    chkwriter.write("Ka",Ka);
+    chkwriter.write("Kb",Kb);
+
+    // Update the reference for incremental builds
+    if(incfock>0) {
+      Pa_ref=Pa;
+      Pb_ref=Pb;
+      J_ref=J;
+      Ka_ref=Ka;
+      Kb_ref=Kb;
+    }
 
-    // Exchange-correlation
-    Exc=0.0;
-    arma::mat XCa, XCb;
     if(dft) {
-      timer.set();
-      double nelnum;
-      double ekin;
-      if(restr && nela==nelb) {
-        grid.eval_Fxc(x_func, xpars, c_func, cpars, P, XCa, Exc, nelnum, ekin, dftthr);
-        XCb=XCa;
-      } else {
-        grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa, Pb, XCa, XCb, Exc, nelnum, ekin, nelb>0, dftthr);
-      }
-      double txc(timer.get());
       printf("DFT energy %.10e % .6f\n",Exc,txc);
       printf("Error in integrated number of electrons % e\n",nelnum-nela-nelb);
       if(ekin!=0.0)
@@ -856,8 +1185,8 @@ int main(int argc, char **argv) {
     }
     fflush(stdout);
 
-    chkpt.write("XCa",XCa);
-    chkpt.write("XCb",XCb);
+    chkwriter.write("XCa",XCa);
+    chkwriter.write("XCb",XCb);
 
     // Fock matrices
     arma::mat Fa(H0+J);
@@ -880,28 +1209,23 @@ int main(int argc, char **argv) {
       Fb+=Bz*S/2.0;
     }
 
-    // m averaging?
-    if(maverage) {
-      Fa=scf::fock_symmetry_average(Fa,mavg_idx);
-      Fb=scf::fock_symmetry_average(Fb,mavg_idx);
-    }
-    // Enforce symmetry of Fock matrix
-    if(symm) {
-      Fa=scf::enforce_fock_symmetry(Fa,dsym);
-      Fb=scf::enforce_fock_symmetry(Fb,dsym);
-    }
+    // m averaging and enforcement of the symmetry of the Fock matrix
+    fock_symm.apply(Fa);
+    fock_symm.apply(Fb);
 
     // ROHF update to Fock matrix
     if(restr && nela!=nelb)
       scf::ROHF_update(Fa,Fb,P,Sh,Sinvh,nela,nelb);
 
-    chkpt.write("Fa",Fa);
-    chkpt.write("Fb",Fb);
+    chkwriter.write("Fa",Fa);
+    chkwriter.write("Fb",Fb);
 
     // Update energy
-    Etot=Ekin+Epot+Eefield+Emfield+Ecoul+Exx+Exc+Enucr+Enucfield;
+    Etot=Ekin+Epot+Eefield+Emfield+Ecoul+Exx+Exc+Enucr+Enucfield+Econf;
     double dE=Etot-Eold;
 
+    if(smeared)
+      printf("Smearing temperature %e, -TS = % .10e\n",smear.temperature(),Esmear);
     printf("Total energy is % .10f\n",Etot);
     if(i>1)
       printf("Energy changed by %e\n",dE);
@@ -910,6 +1234,7 @@ int main(int argc, char **argv) {
 
     // Update DIIS
     timer.set();
+    profiler::Region rdiis("DIIS");
     diis.update(Fa,Fb,Pa,Pb,Etot,diiserr);
     printf("DIIS error is %e, update done in %.6f\n",diiserr,timer.get());
     fflush(stdout);
@@ -917,42 +1242,64 @@ int main(int argc, char **argv) {
     // Solve DIIS to get Fock update
     timer.set();
     diis.solve_F(Fa,Fb);
+    rdiis.stop();
     printf("DIIS solution done in %.6f\n",timer.get());
     fflush(stdout);
 
-    // Have we converged? Note that DIIS error is still wrt full space, not active space.
-    bool convd=(diiserr<convthr) && (std::abs(dE)<convthr);
+    // Have we converged? Note that DIIS error is still wrt full space,
+    // not active space. The smearing has to be fully annealed first.
+    bool convd=(diiserr<convthr) && (std::abs(dE)<convthr) && (!smear.active() || smear.annealed());
 
     // Diagonalize Fock matrix to get new orbitals
     timer.set();
+    profiler::Region rdiag("diag");
     arma::mat Ca, Cb;
-    if(symm)
-      scf::eig_gsym_sub(Ea,Ca,Fa,Sinvh,dsym);
-    else
-      scf::eig_gsym(Ea,Ca,Fa,Sinvh);
-    // Enforce occupation according to specified symmetry
-    if(i<readocc) {
-      scf::enforce_occupations(Ca,Ea,S,occnuma,occsym);
+    // The lowest orbitals can be solved iteratively, starting from the
+    // orbitals of the previous iteration
+    bool iterative=(davidson>0 && i>=readocc);
+    if(iterative) {
+      const size_t neig(std::min<size_t>(std::max(nela,nelb)+davidson,Fa.n_rows));
+      Ca=arma::join_rows(Caocc,Cavirt);
+      iterative=scf::eig_davidson(Ea,Ca,Fa,S,neig,100,davidson_thr);
+      if(restr && nela==nelb) {
+        Eb=Ea;
+        Cb=Ca;
+      } else if(iterative) {
+        Cb=arma::join_rows(Cbocc,Cbvirt);
+        iterative=scf::eig_davidson(Eb,Cb,Fb,S,neig,100,davidson_thr);
+      }
+      if(!iterative)
+        printf("Davidson solver did not converge, switching to full diagonalization\n");
     }
-
-    if(restr && nela==nelb) {
-      Eb=Ea;
-      Cb=Ca;
-    } else {
+    if(!iterative) {
       if(symm)
-        scf::eig_gsym_sub(Eb,Cb,Fb,Sinvh,dsym);
+        symorth.eig(Ea,Ca,Fa);
       else
-        scf::eig_gsym(Eb,Cb,Fb,Sinvh);
-    }
-    // Enforce occupation according to specified symmetry
-    if(i<readocc) {
-      scf::enforce_occupations(Cb,Eb,S,occnumb,occsym);
+        scf::eig_gsym(Ea,Ca,Fa,Sinvh);
+      // Enforce occupation according to specified symmetry
+      if(i<readocc) {
+        scf::enforce_occupations(Ca,Ea,S,occnuma,occsym);
+      }
+
+      if(restr && nela==nelb) {
+        Eb=Ea;
+        Cb=Ca;
+      } else {
+        if(symm)
+          symorth.eig(Eb,Cb,Fb);
+        else
+          scf::eig_gsym(Eb,Cb,Fb,Sinvh);
+      }
+      // Enforce occupation according to specified symmetry
+      if(i<readocc) {
+        scf::enforce_occupations(Cb,Eb,S,occnumb,occsym);
+      }
     }
 
-    chkpt.write("Ca",Ca);
-    chkpt.write("Cb",Cb);
-    chkpt.write("Ea",Ea);
-    chkpt.write("Eb",Eb);
+    chkwriter.write("Ca",Ca,true);
+    chkwriter.write("Cb",Cb,true);
+    chkwriter.write("Ea",Ea,true);
+    chkwriter.write("Eb",Eb,true);
 
     Caocc=Ca.cols(0,nela-1);
     if(Ca.n_cols>(size_t) nela)
@@ -961,7 +1308,25 @@ int main(int argc, char **argv) {
       Cbocc=Cb.cols(0,nelb-1);
     if(Cb.n_cols>(size_t) nelb)
       Cbvirt=Cb.cols(nelb,Cb.n_cols-1);
-    if(symm)
+
+    // Smeared occupations of the new orbitals, after which the
+    // temperature is lowered
+    if(smear.active()) {
+      occa=smear.occupations(Ea,nela);
+      Casmear=Ca.cols(0,occa.n_elem-1);
+      occb=smear.occupations(Eb,nelb);
+      Cbsmear=occb.n_elem ? arma::mat(Cb.cols(0,occb.n_elem-1)) : arma::mat(Ca.n_rows,0);
+      Esmear=smear.entropy_energy(occa)+smear.entropy_energy(occb);
+      printf("Smearing occupies %i alpha and %i beta orbitals\n",(int) occa.n_elem,(int) occb.n_elem);
+      if(smear.anneal_step()) {
+        printf("Smearing annealed, switching to integer occupations\n");
+        diis.clear();
+      }
+    }
+    rdiag.stop();
+    if(iterative)
+      printf("Davidson solution done in %.6f\n",timer.get());
+    else if(symm)
       printf("Subspace diagonalization done in %.6f\n",timer.get());
     else
       printf("Full diagonalization done in %.6f\n",timer.get());
@@ -982,9 +1347,16 @@ int main(int argc, char **argv) {
     }
     printf("\n");
 
+    profiler::Region rchk("checkpoint");
+    chkwriter.iteration(i);
+    rchk.stop();
+    rscf.stop();
+    profiler::print_iteration(i);
     if(convd)
       break;
   }
+  // Make sure the final matrices are on disk
+  chkwriter.finish();
 
   printf("%-21s energy: % .16f\n","Kinetic",Ekin);
   printf("%-21s energy: % .16f\n","Nuclear attraction",Epot);
@@ -995,13 +1367,35 @@ int main(int argc, char **argv) {
   printf("%-21s energy: % .16f\n","Electric field",Eefield);
   printf("%-21s energy: % .16f\n","Magnetic field",Emfield);
   printf("%-21s energy: % .16f\n","Nucleus-field",Enucfield);
+  printf("%-21s energy: % .16f\n","Confinement potential",Econf);
   printf("%-21s energy: % .16f\n","Total",Etot);
   printf("%-21s energy: % .16f\n","Virial ratio",-Etot/Ekin);
 
   printf("%-21s  force: %e\n", "Hellmann-Feynman", (2*Ekin+Epot+Enucr+Ecoul+Exx+Exc)/Rbond);
 
+  if(scan) {
+    scan->Rbond=Rbond;
+    scan->Ca=arma::join_rows(Caocc,Cavirt);
+    scan->Cb=arma::join_rows(Cbocc,Cbvirt);
+    scan->Ea=Ea;
+    scan->Eb=Eb;
+    scan->Ekin=Ekin;
+    scan->Epot=Epot;
+    scan->Enucr=Enucr;
+    scan->Ecoul=Ecoul;
+    scan->Exx=Exx;
+    scan->Exc=Exc;
+    scan->Etot=Etot;
+    scan->force=(2*Ekin+Epot+Enucr+Ecoul+Exx+Exc)/Rbond;
+  }
+
+  multipole_matrices();
   double eldip=-arma::trace(dip*P);
   double elquad=-arma::trace(quad*P);
+  if(scan) {
+    scan->dipole=eldip+nucdip;
+    scan->quadrupole=elquad+nucquad;
+  }
 
   printf("\n");
   printf("Electronic dipole     moment % .16e\n",eldip);
@@ -1011,6 +1405,78 @@ int main(int argc, char **argv) {
   printf("Nuclear    quadrupole moment % .16e\n",nucquad);
   printf("Total      quadrupole moment % .16e\n",elquad+nucquad);
 
+  if(parser.get<bool>("response")) {
+    if(restr && nela!=nelb)
+      printf("\nCoupled-perturbed SCF is not available for ROHF\n");
+    else if(Caocc.n_cols+Cavirt.n_cols!=Sinvh.n_cols || Ea.n_elem!=Sinvh.n_cols)
+      printf("\nCoupled-perturbed SCF requires all the orbitals\n");
+    else {
+      bool rclosed(restr && nela==nelb);
+      std::vector<arma::mat> C;
+      std::vector<arma::vec> E;
+      std::vector<size_t> nocc;
+      C.push_back(arma::join_rows(Caocc,Cavirt));
+      E.push_back(Ea);
+      nocc.push_back(nela);
+      if(!rclosed) {
+        C.push_back(arma::join_rows(Cbocc,Cbvirt));
+        E.push_back(Eb);
+        nocc.push_back(nelb);
+      }
+
+      // Response Fock matrices of the ground state, the XC kernel is
+      // applied by central differences of the XC potential
+      scf::response_fock_t G=[&](const std::vector<arma::mat> & P1) {
+        arma::mat P1a(P1[0]);
+        arma::mat P1b(rclosed ? P1[0] : P1[1]);
+        arma::mat J(basis.coulomb(P1a+P1b));
+        std::vector<arma::mat> G1(P1.size(),J);
+        if(kfrac!=0.0) {
+          for(size_t is=0;is<P1.size();is++)
+            G1[is]+=kfrac*basis.exchange(P1[is]);
+        }
+        if(dft) {
+          double h(1e-4/std::max(arma::norm(P1a+P1b,"fro"),DBL_EPSILON));
+          double exc, nelnum, ekin;
+          if(rclosed) {
+            arma::mat XCp, XCm;
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, P+h*(P1a+P1b), XCp, exc, nelnum, ekin, dftthr);
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, P-h*(P1a+P1b), XCm, exc, nelnum, ekin, dftthr);
+            G1[0]+=(XCp-XCm)/(2.0*h);
+          } else {
+            arma::mat XCap, XCbp, XCam, XCbm;
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa+h*P1a, Pb+h*P1b, XCap, XCbp, exc, nelnum, ekin, nelb>0, dftthr);
+            grid.eval_Fxc(x_func, xpars, c_func, cpars, Pa-h*P1a, Pb-h*P1b, XCam, XCbm, exc, nelnum, ekin, nelb>0, dftthr);
+            G1[0]+=(XCap-XCam)/(2.0*h);
+            if(nelb>0)
+              G1[1]+=(XCbp-XCbm)/(2.0*h);
+          }
+        }
+        return G1;
+      };
+
+      // The perturbations are the ones coupling to Ez and Qzz
+      const char * names[]={"dipole","quadrupole"};
+      multipole_matrices();
+      const arma::mat Vpert[]={dip, quad/3.0};
+      arma::vec alpha(2);
+      for(int ip=0;ip<2;ip++) {
+        printf("\nSolving the static %s response\n",names[ip]);
+        timer.set();
+        std::vector<arma::mat> P1(scf::cpscf(C,E,nocc,Vpert[ip],G,convthr,maxit));
+        arma::mat P1tot(rclosed ? arma::mat(2.0*P1[0]) : arma::mat(P1[0]+P1[1]));
+        // E(F) = E0 - mu F - alpha F^2/2
+        alpha(ip)=-arma::trace(P1tot*Vpert[ip]);
+        printf("Static %s response solved in %.6f\n",names[ip],timer.get());
+      }
+      chkpt.write("alpha_dipole",alpha(0));
+      chkpt.write("alpha_quadrupole",alpha(1));
+      printf("\n");
+      printf("Static dipole     polarizability % .16e\n",alpha(0));
+      printf("Static quadrupole polarizability % .16e\n",alpha(1));
+    }
+  }
+
   printf("\n");
   printf("Nuclear electron densities\n");
   arma::vec nucdena(basis.nuclear_density(Pa));
@@ -1088,3 +1554,197 @@ int main(int argc, char **argv) {
   return 0;
 
 }
+
+int main(int argc, char **argv) {
+  cmdline::parser parser;
+
+  // full option name, no short option, description, argument required
+  parser.add<std::string>("Z1", 0, "first nuclear charge", true);
+  parser.add<std::string>("Z2", 0, "second nuclear charge", true);
+  parser.add<double>("Rbond", 0, "internuclear distance", false, 0.0);
+  parser.add<bool>("angstrom", 0, "input distances in angstrom", false, false);
+  parser.add<int>("nela", 0, "number of alpha electrons", false, 0);
+  parser.add<int>("nelb", 0, "number of beta  electrons", false, 0);
+  parser.add<int>("Q", 0, "charge state", false, 0);
+  parser.add<int>("M", 0, "spin multiplicity", false, 0);
+  parser.add<std::string>("lmax", 0, "maximum l quantum number", true, "");
+  parser.add<int>("mmax", 0, "maximum m quantum number", false, -1);
+  parser.add<int>("lpad", 0, "padding for max l for more accurate Qlm recursion", false, 10);
+  parser.add<double>("Rmax", 0, "practical infinity in au", false, 40.0);
+  parser.add<int>("grid", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
+  parser.add<double>("zexp", 0, "parameter in radial grid", false, 1.0);
+  parser.add<int>("nelem", 0, "number of elements", true);
+  parser.add<int>("nnodes", 0, "number of nodes per element", false, 15);
+  parser.add<int>("nquad", 0, "number of quadrature points", false, 0);
+  parser.add<int>("maxit", 0, "maximum number of iterations", false, 50);
+  parser.add<int>("incfock", 0, "incremental Fock builds: full rebuild every incfock iterations, 0 for full builds only", false, 0);
+  parser.add<bool>("concurrent", 0, "run the Coulomb, exchange and exchange-correlation builds concurrently, dividing the threads between them", false, false);
+  parser.add<double>("convthr", 0, "convergence threshold", false, 1e-7);
+  parser.add<double>("Ez", 0, "electric dipole field", false, 0.0);
+  parser.add<double>("Qzz", 0, "electric quadrupole field", false, 0.0);
+  parser.add<double>("Bz", 0, "magnetic dipole field", false, 0.0);
+  parser.add<bool>("diag", 0, "exact diagonalization", false, 1);
+  parser.add<int>("finitenuc", 0, "finite nuclear model", false, false);
+  parser.add<double>("Rrms1", 0, "nucleus 1 radius", false, 0.0);
+  parser.add<double>("Rrms2", 0, "nucleus 2 radius", false, 0.0);
+  parser.add<std::string>("method", 0, "method to use", false, "HF");
+  parser.add<int>("ldft", 0, "theta rule for dft quadrature (0 for auto)", false, 0);
+  parser.add<int>("mdft", 0, "phi rule for dft quadrature (0 for auto)", false, 0);
+  parser.add<double>("dftthr", 0, "density threshold for dft", false, 1e-12);
+  parser.add<double>("dft_cache", 0, "memory in MiB for caching basis functions on the DFT grid, 0 to recompute them on every build", false, 0.0);
+  parser.add<bool>("dft_timing", 0, "print per-thread busy times of the XC quadrature", false, false);
+  parser.add<int>("restricted", 0, "spin-restricted orbitals", false, -1);
+  parser.add<int>("symmetry", 0, "force orbital symmetry", false, 1);
+  parser.add<int>("primbas", 0, "primitive radial basis", false, 4);
+  parser.add<double>("diiseps", 0, "when to start mixing in diis", false, 1e-2);
+  parser.add<double>("diisthr", 0, "when to switch over fully to diis", false, 1e-3);
+  parser.add<int>("diisorder", 0, "length of diis history", false, 5);
+  parser.add<bool>("adiis_stop", 0, "stop using ADIIS for good once the DIIS error falls below diisthr", false, false);
+  parser.add<int>("readocc", 0, "read occupations from file, use until nth build", false, 0);
+  parser.add<int>("davidson", 0, "solve the occupied and this many virtual orbitals with the Davidson method, 0 for full diagonalization", false, 0);
+  parser.add<double>("smear_T", 0, "initial temperature for fermi smearing of the occupations, 0 to disable", false, 0.0);
+  parser.add<double>("smear_anneal", 0, "factor by which the smearing temperature is lowered on every iteration", false, 0.7);
+  parser.add<double>("smear_Tmin", 0, "final smearing temperature", false, 1e-4);
+  parser.add<bool>("smear_integer", 0, "switch to integer occupations at the final smearing temperature", false, true);
+  parser.add<double>("davidson_thr", 0, "residual threshold for the Davidson solver", false, 1e-8);
+  parser.add<double>("perturb", 0, "randomly perturb initial guess", false, 0.0);
+  parser.add<int>("seed", 0, "seed for random perturbation", false, 0);
+  parser.add<int>("iguess", 0, "guess: 0 for core, 1 for GSZ, 2 for SAP, 3 for TF", false, 2);
+  parser.add<std::string>("load", 0, "load guess from checkpoint", false, "");
+  parser.add<std::string>("save", 0, "save calculation to checkpoint", false, "helfem.chk");
+  parser.add<std::string>("integral_cache", 0, "checkpoint file for caching the integrals of the basis set between runs", false, "");
+  parser.add<std::string>("guess_cache", 0, "checkpoint file for caching the guess potentials between runs", false, "");
+  parser.add<int>("chkpt_every", 0, "save the SCF matrices to the checkpoint every n iterations, 0 for only at the end of the SCF", false, 1);
+  parser.add<bool>("chkpt_restart", 0, "only save the density matrices and orbitals needed for restarting during the SCF", false, false);
+  parser.add<bool>("chkpt_compact", 0, "only save the basis, orbitals, occupations and energies; matrices that can be regenerated from the basis are left out", false, false);
+  parser.add<int>("chkpt_compress", 0, "deflate level for the matrices in the checkpoint, 0 for no compression", false, 0);
+  parser.add<std::string>("x_pars", 0, "file for parameters for exchange functional", false, "");
+  parser.add<std::string>("c_pars", 0, "file for parameters for correlation functional", false, "");
+  parser.add<bool>("maverage", 0, "average Fock matrix over m values", false, false);
+  parser.add<int>("iconf", 0, "type of confinement potential: 1 for polynomial, 2 for exponential", false, 0);
+  parser.add<int>("conf_N", 0, "exponent in confinement potential", false, 0);
+  parser.add<double>("conf_R", 0, "confinement radius", false, 0.0);
+  parser.add<bool>("conf_ellipsoidal", 0, "ellipsoidal instead of spherical confinement", false, false);
+  parser.add<std::string>("profile", 0, "write timing profile to file (.json or .csv)", false, "");
+  parser.add<int>("threads", 0, "number of threads, 0 for the OpenMP default", false, 0);
+  parser.add<std::string>("threading", 0, "threading policy: auto runs BLAS serially within the parallel loops, blas leaves it to the library", false, "");
+  parser.add<std::string>("tei_scratch", 0, "keep the two-electron integrals in this scratch file instead of memory", false, "");
+  parser.add<std::string>("max_memory", 0, "memory budget such as 500M or 4G used to choose the integral storage modes, empty for unlimited", false, "");
+  parser.add<std::string>("Rscan", 0, "comma separated list of internuclear distances to scan", false, "");
+  parser.add<std::string>("scan_output", 0, "file for the energies along the scan", false, "scan.dat");
+  parser.add<std::string>("Ez_list", 0, "list of electric dipole fields to scan at the given bond length for the polarizabilities", false, "");
+  parser.add<std::string>("Qzz_list", 0, "list of electric quadrupole fields to scan at the given bond length for the quadrupole response", false, "");
+  parser.add<bool>("response", 0, "compute the static dipole and quadrupole polarizabilities by coupled-perturbed SCF", false, false);
+  parser.parse_check(argc, argv);
+
+  std::string profile(parser.get<std::string>("profile"));
+  if(profile.size())
+    profiler::enable(profile);
+  threading::configure(parser.get<std::string>("threading"),parser.get<int>("threads"));
+  threading::print();
+
+  double Rbond(parser.get<double>("Rbond"));
+  std::string Rscan(parser.get<std::string>("Rscan"));
+  double Rfac(parser.get<bool>("angstrom") ? ANGSTROMINBOHR : 1.0);
+
+  arma::vec Ez_list(scf::parse_list(parser.get<std::string>("Ez_list")));
+  arma::vec Qzz_list(scf::parse_list(parser.get<std::string>("Qzz_list")));
+  if(Ez_list.n_elem || Qzz_list.n_elem) {
+    if(Rscan.size())
+      throw std::logic_error("Field and bond length scans can't be combined!\n");
+    if(Ez_list.n_elem && Qzz_list.n_elem)
+      throw std::logic_error("Scan either the dipole or the quadrupole field, not both!\n");
+    if(Rbond<=0.0)
+      throw std::logic_error("Must specify a positive bond length.\n");
+    bool dipscan(Ez_list.n_elem>0);
+    arma::vec F(dipscan ? Ez_list : Qzz_list);
+    if(F.n_elem<2)
+      throw std::logic_error("Field scan requires at least two field strengths!\n");
+
+    // The basis set and the two-electron integrals are formed once,
+    // and each field starts from the orbitals of the previous one
+    scan_t scan;
+    scan.tei=false;
+    scan.Rbond=0.0;
+    scan.fieldscan=true;
+    scan.Ez=parser.get<double>("Ez");
+    scan.Qzz=parser.get<double>("Qzz");
+    arma::mat fieldscan_E(F.n_elem,5);
+    for(size_t i=0;i<F.n_elem;i++) {
+      if(dipscan)
+        scan.Ez=F(i);
+      else
+        scan.Qzz=F(i);
+      printf("\nField scan point %i/%i: Ez = % .6e, Qzz = % .6e\n",(int) i+1,(int) F.n_elem,scan.Ez,scan.Qzz);
+      run_point(parser, Rfac*Rbond, &scan);
+      fieldscan_E(i,0)=scan.Ez;
+      fieldscan_E(i,1)=scan.Qzz;
+      fieldscan_E(i,2)=scan.Etot;
+      fieldscan_E(i,3)=scan.dipole;
+      fieldscan_E(i,4)=scan.quadrupole;
+    }
+
+    printf("\nElectric field scan\n");
+    printf("%14s %14s %20s %20s %20s\n","Ez","Qzz","Etot","dipole","quadrupole");
+    for(size_t i=0;i<fieldscan_E.n_rows;i++)
+      printf("% 14.6e % 14.6e % 20.10f % 20.10e % 20.10e\n",fieldscan_E(i,0),fieldscan_E(i,1),fieldscan_E(i,2),fieldscan_E(i,3),fieldscan_E(i,4));
+    fieldscan_E.save(parser.get<std::string>("scan_output"),arma::raw_ascii);
+
+    // Fit the Taylor series of the energy in the field
+    arma::vec dE(scf::field_derivatives(F,fieldscan_E.col(2)));
+    printf("\nDerivatives of the energy wrt the %s field at zero field\n",dipscan ? "dipole" : "quadrupole");
+    for(size_t k=0;k<dE.n_elem;k++)
+      printf("d^%iE/dF^%i = % .10e\n",(int) k,(int) k,dE(k));
+    if(dipscan) {
+      // E(F) = E0 - mu F - alpha F^2/2 - beta F^3/6 - gamma F^4/24
+      const char * names[]={"dipole moment mu","polarizability alpha","first hyperpolarizability beta","second hyperpolarizability gamma"};
+      for(size_t k=1;k<dE.n_elem;k++)
+        printf("%-34s % .10e\n",names[k-1],-dE(k));
+    }
+    return 0;
+  }
+
+  if(!Rscan.size()) {
+    if(Rbond<=0.0)
+      throw std::logic_error("Must specify a positive bond length.\n");
+    return run_point(parser, Rfac*Rbond, NULL);
+  }
+
+  // Parse list of bond lengths
+  std::vector<double> Rvals;
+  {
+    std::stringstream ss(Rscan);
+    while( ss.good() ) {
+      std::string substr;
+      getline( ss, substr, ',' );
+      if(substr.size())
+        Rvals.push_back(Rfac*atof(substr.c_str()));
+    }
+  }
+  if(!Rvals.size())
+    throw std::logic_error("Empty bond length scan.\n");
+  for(size_t i=0;i<Rvals.size();i++)
+    if(Rvals[i]<=0.0)
+      throw std::logic_error("Bond lengths in scan must be positive.\n");
+
+  std::string scan_output(parser.get<std::string>("scan_output"));
+  FILE *out=fopen(scan_output.c_str(),"w");
+  if(!out)
+    throw std::runtime_error("Error opening scan output file " + scan_output + ".\n");
+  fprintf(out,"# %21s %22s %22s %22s %22s %22s %22s %22s %22s\n","R","Etot","Ekin","Epot","Enucr","Ecoul","Exx","Exc","force");
+
+  scan_t scan;
+  scan.tei=false;
+  scan.Rbond=0.0;
+  scan.fieldscan=false;
+  for(size_t i=0;i<Rvals.size();i++) {
+    printf("\nBond length scan point %i/%i: R = %.6f\n",(int) i+1,(int) Rvals.size(),Rvals[i]);
+    run_point(parser, Rvals[i], &scan);
+    fprintf(out,"% .16e % .16e % .16e % .16e % .16e % .16e % .16e % .16e % .16e\n",Rvals[i],scan.Etot,scan.Ekin,scan.Epot,scan.Enucr,scan.Ecoul,scan.Exx,scan.Exc,scan.force);
+    fflush(out);
+  }
+  fclose(out);
+  printf("\nBond length scan written to %s\n",scan_output.c_str());
+
+  return 0;
+}
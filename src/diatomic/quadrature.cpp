@@ -19,7 +19,7 @@
 namespace helfem {
   namespace diatomic {
     namespace quadrature {
-      static arma::vec twoe_inner_integral_wrk(double mumin, double mumax, double mumin0, double mumax0, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab) {
+      static arma::vec twoe_inner_integral_wrk(double mumin, double mumax, double mumin0, double mumax0, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab, size_t iel, size_t ip0) {
         // Midpoint is at
         double mumid(0.5*(mumax+mumin));
         // and half-length of interval is
@@ -40,7 +40,7 @@ namespace helfem {
           // cosh term
           wp%=arma::pow(chmu,l);
         // Legendre polynomial
-        wp%=tab.get_Plm(L,M,chmu);
+        wp%=tab.get_Plm(L,M,iel,ip0,x.n_elem);
 
         // Calculate x values the polynomials should be evaluated at
         arma::vec xpoly((mu-mumid0*arma::ones<arma::vec>(x.n_elem))/mulen0);
@@ -58,7 +58,7 @@ namespace helfem {
         return inner;
       }
 
-      arma::mat twoe_inner_integral(double mumin, double mumax, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab) {
+      arma::mat twoe_inner_integral(double mumin, double mumax, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab, size_t iel) {
         // Midpoint is at
         double mumid(0.5*(mumax+mumin));
         // and half-length of interval is
@@ -68,15 +68,16 @@ namespace helfem {
 
         // Compute the "inner" integrals as function of r.
         arma::mat inner(x.n_elem,std::pow(poly->get_nbf(),2));
-        inner.row(0)=arma::trans(twoe_inner_integral_wrk(mumin, mu(0), mumin, mumax, l, x, wx, poly, L, M, tab));
-        // Every subinterval uses a fresh nquad points!
+        inner.row(0)=arma::trans(twoe_inner_integral_wrk(mumin, mu(0), mumin, mumax, l, x, wx, poly, L, M, tab, iel, x.n_elem));
+        // Every subinterval uses a fresh nquad points, which are stored
+        // in the table after the element's own quadrature points
         for(size_t ip=1;ip<x.n_elem;ip++)
-          inner.row(ip)=inner.row(ip-1)+arma::trans(twoe_inner_integral_wrk(mu(ip-1), mu(ip), mumin, mumax, l, x, wx, poly, L, M, tab));
+          inner.row(ip)=inner.row(ip-1)+arma::trans(twoe_inner_integral_wrk(mu(ip-1), mu(ip), mumin, mumax, l, x, wx, poly, L, M, tab, iel, (ip+1)*x.n_elem));
 
         return inner;
       }
 
-      static arma::mat twoe_integral_wrk(double mumin, double mumax, int k, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab) {
+      static arma::mat twoe_integral_wrk(double mumin, double mumax, int k, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab, size_t iel) {
 #ifndef ARMA_NO_DEBUG
         if(x.n_elem != wx.n_elem) {
           std::ostringstream oss;
@@ -93,7 +94,7 @@ namespace helfem {
         arma::vec chmu(arma::cosh(mu));
 
         // Compute the inner integrals
-        arma::mat inner(twoe_inner_integral(mumin, mumax, l, x, wx, poly, L, M, tab));
+        arma::mat inner(twoe_inner_integral(mumin, mumax, l, x, wx, poly, L, M, tab, iel));
 
         // Evaluate basis functions at quadrature points
         arma::mat bf(poly->eval_dnf(x, 0, mulen));
@@ -108,7 +109,7 @@ namespace helfem {
         wp%=arma::sinh(mu);
         if(k!=0)
           wp%=arma::pow(chmu,k);
-        wp%=tab.get_Qlm(L,M,chmu);
+        wp%=tab.get_Qlm(L,M,iel,0,x.n_elem);
 
         for(size_t i=0;i<bfprod.n_cols;i++)
           bfprod.col(i)%=wp;
@@ -119,8 +120,8 @@ namespace helfem {
         return ints;
       }
 
-      arma::mat twoe_integral(double mumin, double mumax, int k, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab) {
-        return twoe_integral_wrk(mumin,mumax,k,l,x,wx,poly,L,M,tab) + arma::trans(twoe_integral_wrk(mumin,mumax,l,k,x,wx,poly,L,M,tab));
+      arma::mat twoe_integral(double mumin, double mumax, int k, int l, const arma::vec & x, const arma::vec & wx, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, int L, int M, const legendretable::LegendreTable & tab, size_t iel) {
+        return twoe_integral_wrk(mumin,mumax,k,l,x,wx,poly,L,M,tab,iel) + arma::trans(twoe_integral_wrk(mumin,mumax,l,k,x,wx,poly,L,M,tab,iel));
       }
     }
   }
@@ -19,6 +19,9 @@
 #include "../general/lcao.h"
 #include "../general/model_potential.h"
 #include "utils.h"
+#include <map>
+#include <sstream>
+#include <tuple>
 extern "C" {
 // Legendre polynomials
 #include <gsl/gsl_sf_legendre.h>
@@ -214,20 +217,42 @@ namespace helfem {
         double Rhalf(basp->get_Rhalf());
         arma::vec chmu(arma::cosh(r));
 
-        itg.zeros(1,wtot.n_elem);
+        // Distances to the nuclei on the whole grid
+        arma::vec r1(wtot.n_elem), r2(wtot.n_elem);
         for(size_t ia=0;ia<wang.n_elem;ia++)
           for(size_t ir=0;ir<wrad.n_elem;ir++) {
             size_t idx=ia*wrad.n_elem+ir;
+            r1(idx)=Rhalf*(chmu(ir) + cth(ia));
+            r2(idx)=Rhalf*(chmu(ir) - cth(ia));
+          }
+
+        // Evaluate the potentials in a single batch
+        arma::vec V1(p1->V(r1));
+        arma::vec V2(p2->V(r2));
+
+        itg.zeros(1,wtot.n_elem);
+        for(size_t idx=0;idx<wtot.n_elem;idx++) {
+          if(std::isnormal(V1(idx)))
+            itg(idx)+=V1(idx);
+          if(std::isnormal(V2(idx)))
+            itg(idx)+=V2(idx);
+        }
+      }
 
-            double r1=Rhalf*(chmu(ir) + cth(ia));
-            double r2=Rhalf*(chmu(ir) - cth(ia));
+      void TwoDGridWorker::confinement(int iconf, int conf_N, double conf_R, bool ellipsoidal) {
+        double Rhalf(basp->get_Rhalf());
+        arma::vec chmu(arma::cosh(r));
+        arma::vec shmu(arma::sinh(r));
 
-	    double V1(p1->V(r1));
-	    double V2(p2->V(r2));
-	    if(std::isnormal(V1))
-	      itg(idx)+=V1;
-	    if(std::isnormal(V2))
-	      itg(idx)+=V2;
+        itg.zeros(1,wtot.n_elem);
+        for(size_t ia=0;ia<wang.n_elem;ia++)
+          for(size_t ir=0;ir<wrad.n_elem;ir++) {
+            size_t idx=ia*wrad.n_elem+ir;
+
+            // Distance from the center: r^2 = R^2 (sinh^2 mu + cos^2 nu),
+            // while surfaces of constant mu are ellipsoids with semimajor axis R cosh mu
+            double rc = ellipsoidal ? Rhalf*chmu(ir) : Rhalf*sqrt(shmu(ir)*shmu(ir) + cth(ia)*cth(ia));
+            itg(idx)=atomic::basis::confinement_potential(iconf, conf_N, conf_R, rc);
           }
       }
 
@@ -307,20 +332,14 @@ namespace helfem {
 
       void TwoDGridWorker::gto(int l, const arma::vec & expn, probe_t p) {
         std::function<arma::vec(double r)> compute_gto = [expn, l](double r) {
-          arma::vec f(expn.n_elem);
-          for(size_t ix=0;ix<expn.n_elem;ix++)
-            f(ix)=lcao::radial_GTO(r,l,expn(ix));
-          return f;
+          return lcao::radial_GTO(r,l,expn);
         };
         ao_projection(compute_gto, p);
       }
 
       void TwoDGridWorker::sto(int l, const arma::vec & expn, probe_t p) {
         std::function<arma::vec(double r)> compute_sto = [expn, l](double r) {
-          arma::vec f(expn.n_elem);
-          for(size_t ix=0;ix<expn.n_elem;ix++)
-            f(ix)=lcao::radial_STO(r,l,expn(ix));
-          return f;
+          return lcao::radial_STO(r,l,expn);
         };
         ao_projection(compute_sto, p);
       }
@@ -339,10 +358,10 @@ namespace helfem {
         Vo+=itg*arma::diagmat(wtot)*arma::trans(itg);
       }
 
-      TwoDGrid::TwoDGrid() {
+      TwoDGrid::TwoDGrid() : lh_Z(0), rh_Z(0) {
       }
 
-      TwoDGrid::TwoDGrid(const helfem::diatomic::basis::TwoDBasis * basp_, int lang_) : basp(basp_), lang(lang_) {
+      TwoDGrid::TwoDGrid(const helfem::diatomic::basis::TwoDBasis * basp_, int lang_) : basp(basp_), lang(lang_), lh_Z(0), rh_Z(0) {
       }
 
       TwoDGrid::~TwoDGrid() {
@@ -355,19 +374,35 @@ namespace helfem {
         // Get unique m values in basis set
         arma::ivec muni(basp->get_mval());
         muni=muni(arma::find_unique(muni));
-        {
-          TwoDGridWorker grid(basp,lang);
+        accumulate(H, [&muni, p1, p2](TwoDGridWorker & grid, arma::mat & Hwrk, size_t iel, size_t irad) {
+                        for(size_t im=0;im<muni.n_elem;im++) {
+                          grid.compute_bf(iel,irad,muni(im));
+                          grid.model_potential(p1, p2);
+                          grid.eval_pot(Hwrk);
+                        }
+                      });
 
-          for(size_t im=0;im<muni.n_elem;im++) {
-            for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-              for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-                grid.compute_bf(iel,irad,muni(im));
-                grid.model_potential(p1, p2);
-                grid.eval_pot(H);
-              }
-            }
-          }
-        }
+        H=basp->remove_boundaries(H);
+
+        return H;
+      }
+
+      arma::mat TwoDGrid::confinement(int iconf, int conf_N, double conf_R, bool ellipsoidal) {
+        arma::mat H;
+        H.zeros(basp->Ndummy(),basp->Ndummy());
+        if(conf_N==0)
+          return basp->remove_boundaries(H);
+
+        // Get unique m values in basis set
+        arma::ivec muni(basp->get_mval());
+        muni=muni(arma::find_unique(muni));
+        accumulate(H, [&muni, iconf, conf_N, conf_R, ellipsoidal](TwoDGridWorker & grid, arma::mat & Hwrk, size_t iel, size_t irad) {
+                        for(size_t im=0;im<muni.n_elem;im++) {
+                          grid.compute_bf(iel,irad,muni(im));
+                          grid.confinement(iconf, conf_N, conf_R, ellipsoidal);
+                          grid.eval_pot(Hwrk);
+                        }
+                      });
 
         H=basp->remove_boundaries(H);
 
@@ -381,93 +416,92 @@ namespace helfem {
         // Get unique m values in basis set
         arma::ivec muni(basp->get_mval());
         muni=muni(arma::find_unique(muni));
-        {
-          TwoDGridWorker grid(basp,lang);
-
-          for(size_t im=0;im<muni.n_elem;im++) {
-            for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-              for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-                grid.compute_bf(iel,irad,muni(im));
-                grid.unit_pot();
-                grid.eval_pot(S);
-              }
-            }
-          }
-        }
+        accumulate(S, [&muni](TwoDGridWorker & grid, arma::mat & Swrk, size_t iel, size_t irad) {
+                        for(size_t im=0;im<muni.n_elem;im++) {
+                          grid.compute_bf(iel,irad,muni(im));
+                          grid.unit_pot();
+                          grid.eval_pot(Swrk);
+                        }
+                      });
 
         S=basp->remove_boundaries(S);
 
         return S;
       }
 
-      arma::mat TwoDGrid::gto_projection(int l, int m, const arma::vec & expn, probe_t p) {
+      void TwoDGrid::accumulate(arma::mat & M, const std::function<void(TwoDGridWorker & grid, arma::mat & Mwrk, size_t iel, size_t irad)> & integrand) const {
+        // List of radial quadrature points
+        std::vector<std::pair<size_t, size_t>> points;
+        for(size_t iel=0;iel<basp->get_rad_Nel();iel++)
+          for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++)
+            points.push_back(std::make_pair(iel,irad));
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+        {
+          TwoDGridWorker grid(basp,lang);
+          arma::mat Mwrk(arma::zeros<arma::mat>(M.n_rows,M.n_cols));
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+          for(size_t ip=0;ip<points.size();ip++)
+            integrand(grid,Mwrk,points[ip].first,points[ip].second);
+#ifdef _OPENMP
+#pragma omp critical(twodgrid_accumulate)
+#endif
+          M+=Mwrk;
+        }
+      }
+
+      arma::mat TwoDGrid::lcao_projection(int l, int m, const arma::vec & expn, probe_t p, bool sto) {
         arma::mat S;
         S.zeros(expn.n_elem,basp->Ndummy());
-        TwoDGridWorker grid(basp,lang);
-
-        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-          for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-            grid.compute_bf(iel,irad,m);
-            grid.gto(l, expn, p);
-            grid.multiply_Plm(l, m, p);
-            grid.eval_proj(S);
-          }
-        }
+        accumulate(S, [l, m, &expn, p, sto](TwoDGridWorker & grid, arma::mat & Swrk, size_t iel, size_t irad) {
+                        grid.compute_bf(iel,irad,m);
+                        if(sto)
+                          grid.sto(l, expn, p);
+                        else
+                          grid.gto(l, expn, p);
+                        grid.multiply_Plm(l, m, p);
+                        grid.eval_proj(Swrk);
+                      });
 
         S=S.cols(basp->pure_indices());
 
         return S;
       }
 
+      arma::mat TwoDGrid::gto_projection(int l, int m, const arma::vec & expn, probe_t p) {
+        return lcao_projection(l, m, expn, p, false);
+      }
+
       arma::mat TwoDGrid::gto_overlap(int l, int m, const arma::vec & expn, probe_t p) {
         arma::mat S;
         S.zeros(expn.n_elem,expn.n_elem);
-        TwoDGridWorker grid(basp,lang);
-
-        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-          for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-            grid.compute_bf(iel,irad,m);
-            grid.gto(l, expn, p);
-            grid.multiply_Plm(l, m, p);
-            grid.eval_proj_overlap(S);
-          }
-        }
+        accumulate(S, [l, m, &expn, p](TwoDGridWorker & grid, arma::mat & Swrk, size_t iel, size_t irad) {
+                        grid.compute_bf(iel,irad,m);
+                        grid.gto(l, expn, p);
+                        grid.multiply_Plm(l, m, p);
+                        grid.eval_proj_overlap(Swrk);
+                      });
 
         return S;
       }
 
       arma::mat TwoDGrid::sto_projection(int l, int m, const arma::vec & expn, probe_t p) {
-        arma::mat S;
-        S.zeros(expn.n_elem,basp->Ndummy());
-        TwoDGridWorker grid(basp,lang);
-
-        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-          for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-            grid.compute_bf(iel,irad,m);
-            grid.sto(l, expn, p);
-            grid.multiply_Plm(l, m, p);
-            grid.eval_proj(S);
-          }
-        }
-
-        S=S.cols(basp->pure_indices());
-
-        return S;
+        return lcao_projection(l, m, expn, p, true);
       }
 
       arma::mat TwoDGrid::sto_overlap(int l, int m, const arma::vec & expn, probe_t p) {
         arma::mat S;
         S.zeros(expn.n_elem,expn.n_elem);
-        TwoDGridWorker grid(basp,lang);
-
-        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-          for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-            grid.compute_bf(iel,irad,m);
-            grid.sto(l, expn, p);
-            grid.multiply_Plm(l, m, p);
-            grid.eval_proj_overlap(S);
-          }
-        }
+        accumulate(S, [l, m, &expn, p](TwoDGridWorker & grid, arma::mat & Swrk, size_t iel, size_t irad) {
+                        grid.compute_bf(iel,irad,m);
+                        grid.sto(l, expn, p);
+                        grid.multiply_Plm(l, m, p);
+                        grid.eval_proj_overlap(Swrk);
+                      });
 
         return S;
       }
@@ -475,6 +509,7 @@ namespace helfem {
       arma::mat TwoDGrid::atomic_projection(int l, int m, probe_t p) {
         arma::mat C;
         sadatom::basis::TwoDBasis basis;
+        int Z;
         if(p == PROBE_LEFT) {
           if((size_t) l>=lh_occs.n_elem)
             return C;
@@ -484,6 +519,7 @@ namespace helfem {
             return C;
           C = lh_orbs.slice(l).cols(0,nocc-1);
           basis = lh_basis;
+          Z = lh_Z;
         } else if(p == PROBE_RIGHT) {
           if((size_t) l>=rh_occs.n_elem)
             return C;
@@ -493,32 +529,74 @@ namespace helfem {
             return C;
           C = rh_orbs.slice(l).cols(0, nocc-1);
           basis = rh_basis;
+          Z = rh_Z;
         } else
           throw std::logic_error("No AOs on bond center!\n");
 
+        // Has the projection already been computed?
+        static std::map<std::tuple<int, std::string, double, int, int, int>, arma::mat> cache;
+        std::tuple<int, std::string, double, int, int, int> key(Z, fingerprint(), basp->get_Rhalf(), l, m, (int) p);
+        bool found;
+#ifdef _OPENMP
+#pragma omp critical(twodgrid_projection_cache)
+#endif
+        {
+          auto it(cache.find(key));
+          found = (it != cache.end());
+          if(found)
+            C=it->second;
+        }
+        if(found)
+          return C;
+
         std::function<arma::vec(double r)> eval_ao = [basis, C](double r) {
           return basis.eval_orbs(C, r);
         };
 
         arma::mat S;
         S.zeros(C.n_cols,basp->Ndummy());
-        TwoDGridWorker grid(basp,lang);
-
-        for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-          for(size_t irad=0;irad<basp->get_r(iel).n_elem;irad++) {
-            grid.compute_bf(iel,irad,m);
-            grid.ao_projection(eval_ao, p);
-            grid.multiply_Plm(l, m, p);
-            grid.eval_proj(S);
-          }
-        }
+        accumulate(S, [&eval_ao, l, m, p](TwoDGridWorker & grid, arma::mat & Swrk, size_t iel, size_t irad) {
+                        grid.compute_bf(iel,irad,m);
+                        grid.ao_projection(eval_ao, p);
+                        grid.multiply_Plm(l, m, p);
+                        grid.eval_proj(Swrk);
+                      });
 
         S=S.cols(basp->pure_indices());
 
+#ifdef _OPENMP
+#pragma omp critical(twodgrid_projection_cache)
+#endif
+        cache[key]=S;
+
         return S;
       }
 
-      void TwoDGrid::compute_atoms(int Zl, int Zr) {
+      std::string TwoDGrid::fingerprint() const {
+        std::ostringstream oss;
+        oss.precision(17);
+        oss << lang << " " << basp->get_poly_id() << " " << basp->get_poly_nnodes() << " " << basp->get_nquad();
+        arma::vec bval(basp->get_bval());
+        for(size_t i=0;i<bval.n_elem;i++)
+          oss << " " << bval(i);
+        arma::ivec lval(basp->get_lval()), mval(basp->get_mval());
+        for(size_t i=0;i<lval.n_elem;i++)
+          oss << " " << lval(i) << "," << mval(i);
+        return oss.str();
+      }
+
+      /// Atomic ground state used for the projections
+      typedef struct {
+        /// Basis set
+        sadatom::basis::TwoDBasis basis;
+        /// Orbitals
+        arma::cube orbs;
+        /// Occupations
+        arma::ivec occs;
+      } atomic_solution_t;
+
+      /// Solve the atom of charge Z
+      static atomic_solution_t solve_atom(int Z) {
         int primbas=4;
         int Nnodes=15;
         auto poly(std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(primbas,Nnodes)));
@@ -541,8 +619,7 @@ namespace helfem {
         double zexp0 = 2.0;
         bool zeroder = false;
 
-        arma::vec blval=atomic::basis::form_grid((modelpotential::nuclear_model_t) finitenuc, Rrms, Nelem, Rmax, igrid, zexp, Nelem0, igrid0, zexp0, Zl, 0, 0, 0.0);
-        arma::vec brval=atomic::basis::form_grid((modelpotential::nuclear_model_t) finitenuc, Rrms, Nelem, Rmax, igrid, zexp, Nelem0, igrid0, zexp0, Zr, 0, 0, 0.0);
+        arma::vec bval=atomic::basis::form_grid((modelpotential::nuclear_model_t) finitenuc, Rrms, Nelem, Rmax, igrid, zexp, Nelem0, igrid0, zexp0, Z, 0, 0, 0.0);
 
         double shift = 1.0;
         double convthr = 1e-7;
@@ -568,27 +645,50 @@ namespace helfem {
 
         int iguess=2;
 
+        sadatom::solver::SCFSolver solver(Z, finitenuc, Rrms, lmax(Z), poly, zeroder, Nquad, bval, taylor_order, x_func, c_func, maxit, shift, convthr, dftthr, diiseps, diisthr, diisorder);
+        helfem::sadatom::solver::rconf_t conf;
+        conf.orbs=sadatom::solver::OrbitalChannel(true);
+        solver.Initialize(conf.orbs,iguess);
+        conf.orbs.SetOccs(get_occs(Z));
+        solver.Solve(conf);
+
+        atomic_solution_t sol;
+        sol.basis = solver.Basis();
+        sol.orbs = conf.orbs.Coeffs();
+        sol.occs = conf.orbs.Occs();
+        return sol;
+      }
+
+      /// Get the solution for the atom of charge Z, solving it only once
+      static atomic_solution_t cached_atom(int Z) {
+        static std::map<int, atomic_solution_t> cache;
+        atomic_solution_t sol;
+#ifdef _OPENMP
+#pragma omp critical(twodgrid_atom_cache)
+#endif
+        {
+          auto it(cache.find(Z));
+          if(it == cache.end())
+            it=cache.insert(std::make_pair(Z, solve_atom(Z))).first;
+          sol=it->second;
+        }
+        return sol;
+      }
+
+      void TwoDGrid::compute_atoms(int Zl, int Zr) {
+        lh_Z = Zl;
+        rh_Z = Zr;
         if(Zl>0) {
-          sadatom::solver::SCFSolver lsolver(Zl, finitenuc, Rrms, lmax(Zl), poly, zeroder, Nquad, blval, taylor_order, x_func, c_func, maxit, shift, convthr, dftthr, diiseps, diisthr, diisorder);
-          helfem::sadatom::solver::rconf_t lconf;
-          lconf.orbs=sadatom::solver::OrbitalChannel(true);
-          lsolver.Initialize(lconf.orbs,iguess);
-          lconf.orbs.SetOccs(get_occs(Zl));
-          lsolver.Solve(lconf);
-          lh_basis = lsolver.Basis();
-          lh_orbs = lconf.orbs.Coeffs();
-          lh_occs = lconf.orbs.Occs();
+          atomic_solution_t sol(cached_atom(Zl));
+          lh_basis = sol.basis;
+          lh_orbs = sol.orbs;
+          lh_occs = sol.occs;
         }
         if(Zr>0) {
-          sadatom::solver::SCFSolver rsolver(Zr, finitenuc, Rrms, lmax(Zr), poly, zeroder, Nquad, brval, taylor_order, x_func, c_func, maxit, shift, convthr, dftthr, diiseps, diisthr, diisorder);
-          helfem::sadatom::solver::rconf_t rconf;
-          rconf.orbs=sadatom::solver::OrbitalChannel(true);
-          rsolver.Initialize(rconf.orbs,iguess);
-          rconf.orbs.SetOccs(get_occs(Zr));
-          rsolver.Solve(rconf);
-          rh_basis = rsolver.Basis();
-          rh_orbs = rconf.orbs.Coeffs();
-          rh_occs = rconf.orbs.Occs();
+          atomic_solution_t sol(cached_atom(Zr));
+          rh_basis = sol.basis;
+          rh_orbs = sol.orbs;
+          rh_occs = sol.occs;
         }
       }
     }
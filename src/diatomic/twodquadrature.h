@@ -74,6 +74,8 @@ namespace helfem {
 
         /// Compute model potential
         void model_potential(const modelpotential::ModelPotential * p1, const modelpotential::ModelPotential * p2);
+        /// Compute confinement potential; spherical around the bond midpoint or ellipsoidal with semimajor axis conf_R
+        void confinement(int iconf, int conf_N, double conf_R, bool ellipsoidal);
         /// Set unit potential
         void unit_pot();
 
@@ -108,6 +110,15 @@ namespace helfem {
         arma::cube lh_orbs, rh_orbs;
         /// Occupations
         arma::ivec lh_occs, rh_occs;
+        /// Nuclear charges
+        int lh_Z, rh_Z;
+
+        /// Compute GTO (sto=false) or STO (sto=true) projection in parallel over the quadrature points
+        arma::mat lcao_projection(int l, int m, const arma::vec & expn, probe_t p, bool sto);
+        /// Accumulate the integrand into M in parallel over the quadrature points, with per-thread copies of M
+        void accumulate(arma::mat & M, const std::function<void(TwoDGridWorker & grid, arma::mat & Mwrk, size_t iel, size_t irad)> & integrand) const;
+        /// String identifying the basis set and angular rule, for caching projections
+        std::string fingerprint() const;
 
       public:
         /// Dummy constructor
@@ -120,6 +131,9 @@ namespace helfem {
         /// Compute model potential matrix
         arma::mat model_potential(const modelpotential::ModelPotential * p1, const modelpotential::ModelPotential * p2);
 
+        /// Compute confinement potential matrix
+        arma::mat confinement(int iconf, int conf_N, double conf_R, bool ellipsoidal);
+
         /// Compute overlap matrix
         arma::mat overlap();
         /// Compute GTO projection
@@ -134,7 +148,12 @@ namespace helfem {
         /// Compute atomic orbital projection
         arma::mat atomic_projection(int l, int m, probe_t p);
 
-        /// Compute atoms
+        /**
+         * Compute atoms. The atomic solutions are cached by the
+         * nuclear charge, and the projections onto the diatomic basis
+         * by the charge, the basis set and Rhalf, so repeated
+         * calculations e.g. in a bond length scan don't redo them.
+         */
         void compute_atoms(int Zl, int Zr);
       };
     }
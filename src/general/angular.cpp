@@ -16,6 +16,11 @@
 #include "angular.h"
 #include "chebyshev.h"
 #include "lobatto.h"
+#include "spherical_harmonics.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
 
 namespace helfem {
   namespace angular {
@@ -50,11 +55,10 @@ namespace helfem {
 
     void angular_lobatto(int l, int m, arma::vec & cth, arma::vec & phi, arma::vec & wang) {
       // Get input quadrature: l part
-      arma::vec xl, wl;
-      ::lobatto_compute(l,xl,wl);
+      const LobattoRule & rule(::lobatto_rule(l));
 
       // Form compound rule
-      compound_rule(xl,wl,m,cth,phi,wang);
+      compound_rule(rule.x,rule.w,m,cth,phi,wang);
     }
 
     void angular_chebyshev(int l, arma::vec & cth, arma::vec & phi, arma::vec & wang) {
@@ -63,11 +67,40 @@ namespace helfem {
 
     void angular_chebyshev(int l, int m, arma::vec & cth, arma::vec & phi, arma::vec & wang) {
       // Get input quadrature: l part
-      arma::vec xl, wl;
-      chebyshev::chebyshev(l,xl,wl);
+      const chebyshev::Rule & rule(chebyshev::chebyshev_rule(l));
 
       // Form compound rule
-      compound_rule(xl,wl,m,cth,phi,wang);
+      compound_rule(rule.x,rule.w,m,cth,phi,wang);
+    }
+
+    const angular_rule_t & angular_rule(int l, int m, bool lobatto) {
+      static std::mutex lock;
+      static std::map<std::tuple<int, int, bool>, std::unique_ptr<angular_rule_t>> cache;
+
+      std::lock_guard<std::mutex> guard(lock);
+      std::unique_ptr<angular_rule_t> & rule(cache[std::make_tuple(l,m,lobatto)]);
+      if(!rule) {
+        rule.reset(new angular_rule_t);
+        if(lobatto)
+          angular_lobatto(l,m,rule->cth,rule->phi,rule->w);
+        else
+          angular_chebyshev(l,m,rule->cth,rule->phi,rule->w);
+      }
+      return *rule;
+    }
+
+    const arma::cx_mat & spherical_harmonics_table(int l, int m, int lmax, bool lobatto) {
+      // Get the rule before locking the table cache
+      const angular_rule_t & rule(angular_rule(l,m,lobatto));
+
+      static std::mutex lock;
+      static std::map<std::tuple<int, int, int, bool>, std::unique_ptr<arma::cx_mat>> cache;
+
+      std::lock_guard<std::mutex> guard(lock);
+      std::unique_ptr<arma::cx_mat> & table(cache[std::make_tuple(l,m,lmax,lobatto)]);
+      if(!table)
+        table.reset(new arma::cx_mat(::spherical_harmonics_all(lmax,rule.cth,rule.phi)));
+      return *table;
     }
   }
 }
@@ -32,6 +32,27 @@ namespace helfem {
     void angular_chebyshev(int l, arma::vec & cth, arma::vec & phi, arma::vec & w);
     /// Angular quadrature rule of order (l,m)
     void angular_chebyshev(int l, int m, arma::vec & cth, arma::vec & phi, arma::vec & w);
+
+    /// Compound angular quadrature rule
+    typedef struct {
+      /// cos theta values
+      arma::vec cth;
+      /// phi values
+      arma::vec phi;
+      /// Quadrature weights
+      arma::vec w;
+    } angular_rule_t;
+
+    /// Shared angular quadrature rule of order (l,m); the rules are computed once and never modified
+    const angular_rule_t & angular_rule(int l, int m, bool lobatto=false);
+
+    /**
+     * All spherical harmonics with l <= lmax on the angular
+     * quadrature rule of order (l,m), as a (lmax+1)^2 x Npoints
+     * table indexed by spherical_harmonics_index(l,m). The tables are
+     * computed once and shared by all callers.
+     */
+    const arma::cx_mat & spherical_harmonics_table(int l, int m, int lmax, bool lobatto=false);
   }
 }
 
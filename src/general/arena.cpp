@@ -0,0 +1,141 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "arena.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace helfem {
+  /// Allocations are rounded to whole cache lines
+  static const size_t arena_align=8;
+  /// Smallest block allocated, in doubles
+  static const size_t arena_min_block=1<<16;
+
+  Arena::Arena() : iblock(0), offset(0), used(0), peak(0) {
+  }
+
+  Arena::~Arena() {
+  }
+
+  double * Arena::allocate(size_t n) {
+    n=((n+arena_align-1)/arena_align)*arena_align;
+
+    // Find a block with room
+    while(iblock<blocks.size() && offset+n>sizes[iblock]) {
+      iblock++;
+      offset=0;
+    }
+    if(iblock==blocks.size()) {
+      size_t sz(std::max(n,arena_min_block));
+      blocks.push_back(std::unique_ptr<double[]>(new double[sz]));
+      sizes.push_back(sz);
+      offset=0;
+    }
+
+    double * ptr(blocks[iblock].get()+offset);
+    offset+=n;
+    used+=n;
+    peak=std::max(peak,used);
+    return ptr;
+  }
+
+  void Arena::reset() {
+    if(blocks.size()>1) {
+      // Replace the blocks by a single one that holds everything
+      blocks.clear();
+      sizes.clear();
+      blocks.push_back(std::unique_ptr<double[]>(new double[peak]));
+      sizes.push_back(peak);
+    }
+    iblock=0;
+    offset=0;
+    used=0;
+  }
+
+  size_t Arena::capacity() const {
+    size_t n=0;
+    for(size_t i=0;i<sizes.size();i++)
+      n+=sizes[i];
+    return n;
+  }
+
+  void Arena::push_zeros(std::vector<arma::mat> & list, size_t nrows, size_t ncols) {
+    if(list.size()==list.capacity())
+      throw std::logic_error("No room reserved for arena matrix!\n");
+    list.emplace_back(allocate(nrows*ncols),nrows,ncols,false,true);
+    list.back().zeros();
+  }
+
+  ArenaPool::ArenaPool() {
+  }
+
+  ArenaPool::ArenaPool(const ArenaPool &) {
+  }
+
+  ArenaPool & ArenaPool::operator=(const ArenaPool &) {
+    return *this;
+  }
+
+  ArenaPool::~ArenaPool() {
+  }
+
+  Arena * ArenaPool::acquire() {
+    std::lock_guard<std::mutex> guard(lock);
+    for(size_t i=0;i<arenas.size();i++)
+      if(!busy[i]) {
+        busy[i]=true;
+        return arenas[i].get();
+      }
+    arenas.push_back(std::unique_ptr<Arena>(new Arena()));
+    busy.push_back(true);
+    return arenas.back().get();
+  }
+
+  void ArenaPool::release(Arena * arena) {
+    arena->reset();
+    std::lock_guard<std::mutex> guard(lock);
+    for(size_t i=0;i<arenas.size();i++)
+      if(arenas[i].get()==arena)
+        busy[i]=false;
+  }
+
+  void ArenaPool::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector< std::unique_ptr<Arena> > keep;
+    std::vector<bool> keepbusy;
+    for(size_t i=0;i<arenas.size();i++)
+      if(busy[i]) {
+        keep.push_back(std::move(arenas[i]));
+        keepbusy.push_back(true);
+      }
+    arenas.swap(keep);
+    busy.swap(keepbusy);
+  }
+
+  ArenaLease::ArenaLease(ArenaPool & pool_) : pool(pool_), arena(pool_.acquire()) {
+  }
+
+  ArenaLease::~ArenaLease() {
+    pool.release(arena);
+  }
+
+  Arena & ArenaLease::operator*() const {
+    return *arena;
+  }
+
+  Arena * ArenaLease::operator->() const {
+    return arena;
+  }
+}
@@ -0,0 +1,114 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <armadillo>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace helfem {
+  /**
+   * Arena of scratch memory for the temporary matrices of the Fock
+   * builds. Memory is handed out by bumping an offset and is returned
+   * all at once by reset(), so repeated builds reuse the same memory
+   * instead of going through malloc for every helper matrix. Blocks
+   * are never moved while in use; if a build needed more than one
+   * block, they are merged into one on reset.
+   */
+  class Arena {
+    /// Memory blocks
+    std::vector< std::unique_ptr<double[]> > blocks;
+    /// Sizes of the blocks
+    std::vector<size_t> sizes;
+    /// Current block
+    size_t iblock;
+    /// Offset in the current block
+    size_t offset;
+    /// Memory in use
+    size_t used;
+    /// Largest amount of memory used between resets
+    size_t peak;
+
+  public:
+    /// Constructor
+    Arena();
+    /// Destructor
+    ~Arena();
+
+    /// Get memory for n doubles
+    double * allocate(size_t n);
+    /// Release all the memory for reuse
+    void reset();
+    /// Amount of memory held, in doubles
+    size_t capacity() const;
+
+    /// Append a zeroed matrix in the arena's memory to the list. The
+    /// matrices are constructed in place, since copies would leave the
+    /// arena, so the list must have room reserved for it.
+    void push_zeros(std::vector<arma::mat> & list, size_t nrows, size_t ncols);
+  };
+
+  /**
+   * Pool of arenas for calls that may run concurrently. Each call or
+   * thread acquires its own arena and releases it when done.
+   */
+  class ArenaPool {
+    /// The arenas
+    std::vector< std::unique_ptr<Arena> > arenas;
+    /// Is the arena in use?
+    std::vector<bool> busy;
+    /// Lock
+    std::mutex lock;
+
+  public:
+    /// Constructor
+    ArenaPool();
+    /// Copies get their own, empty pool
+    ArenaPool(const ArenaPool & rh);
+    /// Assignment keeps the pool
+    ArenaPool & operator=(const ArenaPool & rh);
+    /// Destructor
+    ~ArenaPool();
+
+    /// Get a free arena
+    Arena * acquire();
+    /// Return an arena to the pool, resetting it
+    void release(Arena * arena);
+    /// Free all memory
+    void clear();
+  };
+
+  /// Arena held for the lifetime of the object
+  class ArenaLease {
+    /// Pool
+    ArenaPool & pool;
+    /// Arena
+    Arena * arena;
+  public:
+    /// Constructor
+    ArenaLease(ArenaPool & pool);
+    /// Destructor
+    ~ArenaLease();
+    /// Access the arena
+    Arena & operator*() const;
+    /// Access the arena
+    Arena * operator->() const;
+  };
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include "blockfile.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace helfem {
+  /// Size of the header
+  static const size_t header_size=24;
+
+  /// Write the whole buffer at the given offset
+  static void write_all(int fd, const std::string & fname, const char * buf, size_t len, size_t offset) {
+    while(len) {
+      ssize_t n=pwrite(fd,buf,len,offset);
+      if(n<0) {
+        std::ostringstream oss;
+        oss << "Error writing to " << fname << ": " << strerror(errno) << "\n";
+        throw std::runtime_error(oss.str());
+      }
+      buf+=n;
+      len-=n;
+      offset+=n;
+    }
+  }
+
+  BlockFile::BlockFile(const std::string & fname_, size_t nrows_, size_t ncols_) : fname(fname_), nrows(nrows_), ncols(ncols_) {
+    fd=open(fname.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if(fd<0) {
+      std::ostringstream oss;
+      oss << "Error opening " << fname << ": " << strerror(errno) << "\n";
+      throw std::runtime_error(oss.str());
+    }
+
+    char header[header_size];
+    memcpy(header,"HELFEMBF",8);
+    uint64_t dim[2]={(uint64_t) nrows, (uint64_t) ncols};
+    memcpy(header+8,dim,sizeof(dim));
+    write_all(fd,fname,header,header_size,0);
+  }
+
+  BlockFile::~BlockFile() {
+    close(fd);
+  }
+
+  void BlockFile::write_rows(size_t row0, const arma::mat & blk) {
+    if(blk.n_rows != ncols) {
+      std::ostringstream oss;
+      oss << "Block has " << blk.n_rows << " values per row but " << fname << " has " << ncols << " columns!\n";
+      throw std::logic_error(oss.str());
+    }
+    if(row0+blk.n_cols > nrows) {
+      std::ostringstream oss;
+      oss << "Rows " << row0 << " - " << row0+blk.n_cols << " are out of bounds for " << fname << " with " << nrows << " rows!\n";
+      throw std::logic_error(oss.str());
+    }
+    // Column-major storage of blk is the row-major storage of the rows
+    write_all(fd,fname,(const char *) blk.memptr(),blk.n_elem*sizeof(double),header_size+row0*ncols*sizeof(double));
+  }
+}
@@ -0,0 +1,55 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#ifndef BLOCKFILE_H
+#define BLOCKFILE_H
+
+#include <armadillo>
+#include <string>
+
+namespace helfem {
+  /**
+   * Raw binary matrix file that is written in blocks of rows, in any
+   * order and from several threads at once.
+   *
+   * The file starts with the 8 character tag HELFEMBF followed by the
+   * number of rows and columns as 64-bit unsigned integers. The
+   * doubles follow in row-major order from byte offset 24, so the
+   * data can be memory mapped directly.
+   */
+  class BlockFile {
+    /// File descriptor
+    int fd;
+    /// Name of file
+    std::string fname;
+    /// Size of the matrix
+    size_t nrows, ncols;
+
+    BlockFile(const BlockFile &) = delete;
+    BlockFile & operator=(const BlockFile &) = delete;
+
+  public:
+    /// Create file for a nrows x ncols matrix
+    BlockFile(const std::string & fname, size_t nrows, size_t ncols);
+    /// Destructor closes the file
+    ~BlockFile();
+
+    /// Write the rows starting from row0, given as the columns of blk (ncols x number of rows)
+    void write_rows(size_t row0, const arma::mat & blk);
+  };
+}
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include "blockscatter.h"
+#include <stdexcept>
+
+namespace helfem {
+  /// Local positions of the functions of a that are also in b
+  static arma::uvec common_functions(const arma::uvec & a, const arma::uvec & b) {
+    std::vector<arma::uword> pos;
+    for(size_t i=0;i<a.n_elem;i++)
+      if(arma::any(b==a(i)))
+        pos.push_back(i);
+    return arma::conv_to<arma::uvec>::from(pos);
+  }
+
+  BlockScatter::BlockScatter(const std::vector<arma::uvec> & idx_) : idx(idx_) {
+    left.resize(idx.size());
+    right.resize(idx.size());
+    shared.resize(idx.size());
+    for(size_t iel=0;iel<idx.size();iel++) {
+      if(iel>0)
+        left[iel]=common_functions(idx[iel],idx[iel-1]);
+      if(iel+1<idx.size())
+        right[iel]=common_functions(idx[iel],idx[iel+1]);
+      shared[iel].assign(idx[iel].n_elem,0);
+      for(size_t i=0;i<left[iel].n_elem;i++)
+        shared[iel][left[iel](i)]=1;
+      for(size_t i=0;i<right[iel].n_elem;i++) {
+        if(shared[iel][right[iel](i)])
+          throw std::logic_error("Function shared with both neighbouring elements!\n");
+        shared[iel][right[iel](i)]=2;
+      }
+    }
+
+#ifdef _OPENMP
+    locks.resize(idx.size() ? idx.size()-1 : 0);
+    for(size_t i=0;i<locks.size();i++)
+      omp_init_lock(&locks[i]);
+#endif
+  }
+
+  BlockScatter::~BlockScatter() {
+#ifdef _OPENMP
+    for(size_t i=0;i<locks.size();i++)
+      omp_destroy_lock(&locks[i]);
+#endif
+  }
+
+  void BlockScatter::add_sub(arma::mat & Ho, const arma::mat & H, size_t iel, const arma::uvec & sub) const {
+    const arma::uvec & id(idx[iel]);
+    for(size_t j=0;j<sub.n_elem;j++)
+      for(size_t i=0;i<sub.n_elem;i++)
+        Ho(id(sub(i)),id(sub(j)))+=H(sub(i),sub(j));
+  }
+
+  void BlockScatter::add(arma::mat & Ho, const arma::mat & H, size_t iel) {
+    const arma::uvec & id(idx[iel]);
+    const std::vector<char> & sh(shared[iel]);
+    if(H.n_rows != id.n_elem || H.n_cols != id.n_elem)
+      throw std::logic_error("Block does not match the element!\n");
+
+    // Entries no other element can touch
+    for(size_t j=0;j<id.n_elem;j++)
+      for(size_t i=0;i<id.n_elem;i++)
+        if(!sh[i] || sh[i]!=sh[j])
+          Ho(id(i),id(j))+=H(i,j);
+
+    // Entries on the element boundaries
+    if(left[iel].n_elem) {
+#ifdef _OPENMP
+      omp_set_lock(&locks[iel-1]);
+#endif
+      add_sub(Ho,H,iel,left[iel]);
+#ifdef _OPENMP
+      omp_unset_lock(&locks[iel-1]);
+#endif
+    }
+    if(right[iel].n_elem) {
+#ifdef _OPENMP
+      omp_set_lock(&locks[iel]);
+#endif
+      add_sub(Ho,H,iel,right[iel]);
+#ifdef _OPENMP
+      omp_unset_lock(&locks[iel]);
+#endif
+    }
+  }
+}
@@ -0,0 +1,67 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#ifndef BLOCKSCATTER_H
+#define BLOCKSCATTER_H
+
+#include <armadillo>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace helfem {
+  /**
+   * Adds element blocks of a matrix into the full matrix from several
+   * threads at once, so that the element loop needs no even/odd split.
+   *
+   * Consecutive elements only share the functions on their common
+   * boundary, so the only entries two elements can both touch are in
+   * the shared x shared sub-block. Those are added under a lock per
+   * boundary; the rest of the block is added without locking.
+   */
+  class BlockScatter {
+    /// Global indices of the functions in each element
+    std::vector<arma::uvec> idx;
+    /// Local positions of the functions shared with the previous element
+    std::vector<arma::uvec> left;
+    /// Local positions of the functions shared with the next element
+    std::vector<arma::uvec> right;
+    /// Whether a local function is shared with either neighbour
+    std::vector< std::vector<char> > shared;
+#ifdef _OPENMP
+    /// Lock for each element boundary
+    std::vector<omp_lock_t> locks;
+#endif
+
+    BlockScatter(const BlockScatter &) = delete;
+    BlockScatter & operator=(const BlockScatter &) = delete;
+
+    /// Add the sub-block given by the local positions
+    void add_sub(arma::mat & Ho, const arma::mat & H, size_t iel, const arma::uvec & sub) const;
+
+  public:
+    /// Constructor, given the global function indices of each element
+    BlockScatter(const std::vector<arma::uvec> & idx);
+    /// Destructor
+    ~BlockScatter();
+
+    /// Ho(idx,idx) += H for element iel
+    void add(arma::mat & Ho, const arma::mat & H, size_t iel);
+  };
+}
+
+#endif
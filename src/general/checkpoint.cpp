@@ -16,7 +16,15 @@
 
 #include "checkpoint.h"
 #include "PolynomialBasis.h"
+#include <algorithm>
 #include <istream>
+#include <cstdio>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+}
 
 // Helper macros
 #define CHECK_OPEN() {if(!opend) {throw std::runtime_error("Cannot access checkpoint file that has not been opened!\n");}}
@@ -27,6 +35,7 @@ Checkpoint::Checkpoint(const std::string & fname, bool writem, bool trunc) {
   writemode=writem;
   filename=fname;
   opend=false;
+  deflate=0;
 
   if(writemode && (trunc || !file_exists(fname))) {
     // Truncate existing file, using default creation and access properties.
@@ -44,6 +53,8 @@ Checkpoint::Checkpoint(const std::string & fname, bool writem, bool trunc) {
 Checkpoint::~Checkpoint() {
   if(opend)
     close();
+  for(size_t i=0;i<maps.size();i++)
+    munmap(maps[i].first,maps[i].second);
 }
 
 void Checkpoint::open() {
@@ -114,6 +125,23 @@ void Checkpoint::remove(const std::string & name) {
   if(cl) close();
 }
 
+void Checkpoint::create_group(const std::string & name) {
+  CHECK_WRITE();
+
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  if(!exist(name)) {
+    hid_t group=H5Gcreate(file, name.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    H5Gclose(group);
+  }
+
+  if(cl) close();
+}
+
 void Checkpoint::write(const std::string & name, const arma::mat & m) {
   CHECK_WRITE();
 
@@ -137,26 +165,34 @@ void Checkpoint::write(const std::string & name, const arma::mat & m) {
   // Create a datatype.
   hid_t datatype=H5Tcopy(H5T_NATIVE_DOUBLE);
 
-  // Create the dataset using the defined dataspace and datatype, and
-  // default dataset creation properties.
-  hid_t dataset=H5Dcreate(file,name.c_str(),datatype,dataspace,H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  // Chunked, compressed storage?
+  hid_t plist=H5Pcreate(H5P_DATASET_CREATE);
+  if(deflate>0 && m.n_elem) {
+    // Chunks of whole columns, about half a megabyte each, so that
+    // reading a range of orbitals only touches the chunks it needs
+    hsize_t chunk[2];
+    chunk[1]=std::min<hsize_t>(m.n_rows,1<<16);
+    chunk[0]=std::min<hsize_t>(m.n_cols,std::max<hsize_t>(1,(1<<16)/chunk[1]));
+    H5Pset_chunk(plist,2,chunk);
+    H5Pset_shuffle(plist);
+    H5Pset_deflate(plist,deflate);
+  }
+
+  // Create the dataset using the defined dataspace and datatype
+  hid_t dataset=H5Dcreate(file,name.c_str(),datatype,dataspace,H5P_DEFAULT, plist, H5P_DEFAULT);
 
   // Write the data to the file.
   H5Dwrite(dataset, datatype, H5S_ALL, H5S_ALL, H5P_DEFAULT, m.memptr());
 
   // Close everything.
   H5Dclose(dataset);
+  H5Pclose(plist);
   H5Tclose(datatype);
   H5Sclose(dataspace);
   if(cl) close();
 }
 
-void Checkpoint::read(const std::string & name, arma::mat & m) {
-  bool cl=false;
-  if(!opend) {
-    open();
-    cl=true;
-  }
+hid_t Checkpoint::open_matrix(const std::string & name, hsize_t dims[2]) {
   CHECK_EXIST();
 
   // Open the dataset.
@@ -167,8 +203,11 @@ void Checkpoint::read(const std::string & name, arma::mat & m) {
 
   // Get the class info
   hid_t hclass=H5Tget_class(datatype);
+  // Close datatype
+  H5Tclose(datatype);
 
   if(hclass!=H5T_FLOAT) {
+    H5Dclose(dataset);
     std::ostringstream oss;
     oss << "Error - " << name << " is not a floating point value!\n";
     throw std::runtime_error(oss.str());
@@ -179,29 +218,266 @@ void Checkpoint::read(const std::string & name, arma::mat & m) {
   // Get number of dimensions
   int ndim = H5Sget_simple_extent_ndims(dataspace);
   if(ndim!=2) {
+    H5Sclose(dataspace);
+    H5Dclose(dataset);
     std::ostringstream oss;
     oss << "Error - " << name << " should have dimension 2, instead dimension is " << ndim << "!\n";
     throw std::runtime_error(oss.str());
   }
 
   // Get the size of the matrix
-  hsize_t dims[ndim];
   H5Sget_simple_extent_dims(dataspace,dims,NULL);
+  // Close dataspace
+  H5Sclose(dataspace);
+
+  return dataset;
+}
+
+void Checkpoint::read(const std::string & name, arma::mat & m) {
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  hsize_t dims[2];
+  hid_t dataset=open_matrix(name,dims);
 
   // Allocate memory
   m.zeros(dims[1],dims[0]);
   H5Dread(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, m.memptr());
 
-  // Close dataspace
-  H5Sclose(dataspace);
-  // Close datatype
-  H5Tclose(datatype);
   // Close dataset
   H5Dclose(dataset);
 
   if(cl) close();
 }
 
+void Checkpoint::set_compression(int level) {
+  if(level<0 || level>9)
+    throw std::logic_error("Deflate level must be between 0 and 9!\n");
+  if(level>0 && !H5Zfilter_avail(H5Z_FILTER_DEFLATE))
+    throw std::runtime_error("HDF5 was built without deflate support!\n");
+  deflate=level;
+}
+
+void Checkpoint::create(const std::string & name, arma::uword nrows, arma::uword ncols) {
+  CHECK_WRITE();
+
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  // Remove possible existing entry
+  remove(name);
+
+  hsize_t dims[2];
+  dims[1]=nrows;
+  dims[0]=ncols;
+  hid_t dataspace=H5Screate_simple(2,dims,NULL);
+  hid_t datatype=H5Tcopy(H5T_NATIVE_DOUBLE);
+
+  // Same storage layout as in write()
+  hid_t plist=H5Pcreate(H5P_DATASET_CREATE);
+  if(deflate>0 && nrows*ncols) {
+    hsize_t chunk[2];
+    chunk[1]=std::min<hsize_t>(nrows,1<<16);
+    chunk[0]=std::min<hsize_t>(ncols,std::max<hsize_t>(1,(1<<16)/chunk[1]));
+    H5Pset_chunk(plist,2,chunk);
+    H5Pset_shuffle(plist);
+    H5Pset_deflate(plist,deflate);
+  }
+
+  hid_t dataset=H5Dcreate(file,name.c_str(),datatype,dataspace,H5P_DEFAULT, plist, H5P_DEFAULT);
+
+  H5Dclose(dataset);
+  H5Pclose(plist);
+  H5Tclose(datatype);
+  H5Sclose(dataspace);
+  if(cl) close();
+}
+
+void Checkpoint::write_rows(const std::string & name, const arma::mat & block, arma::uword r0) {
+  CHECK_WRITE();
+  if(!block.n_elem)
+    return;
+
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  hsize_t dims[2];
+  hid_t dataset=open_matrix(name,dims);
+  if(block.n_cols != dims[0] || r0+block.n_rows > dims[1]) {
+    H5Dclose(dataset);
+    std::ostringstream oss;
+    oss << "Row block of " << name << " is out of bounds!\n";
+    throw std::runtime_error(oss.str());
+  }
+
+  // The file dataspace is the transpose of the matrix, so a block of
+  // rows is a block of columns in the file, which has the same
+  // layout as the column-major block in memory
+  hsize_t start[2], count[2];
+  start[0]=0;
+  start[1]=r0;
+  count[0]=block.n_cols;
+  count[1]=block.n_rows;
+  hid_t filespace=H5Dget_space(dataset);
+  H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start, NULL, count, NULL);
+  hid_t memspace=H5Screate_simple(2,count,NULL);
+
+  H5Dwrite(dataset, H5T_NATIVE_DOUBLE, memspace, filespace, H5P_DEFAULT, block.memptr());
+
+  H5Sclose(memspace);
+  H5Sclose(filespace);
+  H5Dclose(dataset);
+  if(cl) close();
+}
+
+void Checkpoint::size(const std::string & name, arma::uword & nrows, arma::uword & ncols) {
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  hsize_t dims[2];
+  hid_t dataset=open_matrix(name,dims);
+  H5Dclose(dataset);
+  nrows=dims[1];
+  ncols=dims[0];
+
+  if(cl) close();
+}
+
+void Checkpoint::read(const std::string & name, arma::mat & m, arma::uword r0, arma::uword r1, arma::uword c0, arma::uword c1) {
+  if(r1<r0 || c1<c0)
+    throw std::logic_error("Invalid submatrix range!\n");
+  read(name,m,arma::regspace<arma::uvec>(r0,r1),arma::regspace<arma::uvec>(c0,c1));
+}
+
+/// Split sorted indices into runs of consecutive indices
+static void index_runs(const arma::uvec & idx, std::vector<hsize_t> & start, std::vector<hsize_t> & count) {
+  start.clear();
+  count.clear();
+  for(size_t i=0;i<idx.n_elem;i++) {
+    if(i>0 && idx(i)<=idx(i-1))
+      throw std::logic_error("Submatrix indices must be sorted in increasing order!\n");
+    if(i>0 && idx(i)==idx(i-1)+1)
+      count.back()++;
+    else {
+      start.push_back(idx(i));
+      count.push_back(1);
+    }
+  }
+}
+
+void Checkpoint::read(const std::string & name, arma::mat & m, const arma::uvec & rows, const arma::uvec & cols) {
+  m.zeros(rows.n_elem,cols.n_elem);
+  if(!m.n_elem)
+    return;
+
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  hsize_t dims[2];
+  hid_t dataset=open_matrix(name,dims);
+  if(arma::max(rows)>=dims[1] || arma::max(cols)>=dims[0]) {
+    H5Dclose(dataset);
+    std::ostringstream oss;
+    oss << "Submatrix of " << name << " is out of bounds!\n";
+    throw std::runtime_error(oss.str());
+  }
+
+  // The file dataspace is the transpose of the matrix, so its
+  // elements are selected in the column-major order of the submatrix
+  std::vector<hsize_t> rstart, rcount, cstart, ccount;
+  index_runs(rows,rstart,rcount);
+  index_runs(cols,cstart,ccount);
+
+  hid_t filespace = H5Dget_space(dataset);
+  for(size_t ic=0;ic<cstart.size();ic++)
+    for(size_t ir=0;ir<rstart.size();ir++) {
+      hsize_t start[2], count[2];
+      start[0]=cstart[ic];
+      start[1]=rstart[ir];
+      count[0]=ccount[ic];
+      count[1]=rcount[ir];
+      H5Sselect_hyperslab(filespace,(ic==0 && ir==0) ? H5S_SELECT_SET : H5S_SELECT_OR,start,NULL,count,NULL);
+    }
+
+  hsize_t nel=m.n_elem;
+  hid_t memspace = H5Screate_simple(1,&nel,NULL);
+  H5Dread(dataset, H5T_NATIVE_DOUBLE, memspace, filespace, H5P_DEFAULT, m.memptr());
+
+  H5Sclose(memspace);
+  H5Sclose(filespace);
+  H5Dclose(dataset);
+
+  if(cl) close();
+}
+
+arma::mat Checkpoint::map(const std::string & name) {
+  if(writemode)
+    throw std::logic_error("Only checkpoints opened for reading can be memory mapped!\n");
+
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  hsize_t dims[2];
+  hid_t dataset=open_matrix(name,dims);
+
+  // The data can only be mapped if it is stored contiguously as
+  // native doubles at an aligned offset
+  hid_t plist=H5Dget_create_plist(dataset);
+  bool contiguous=(H5Pget_layout(plist)==H5D_CONTIGUOUS);
+  H5Pclose(plist);
+  hid_t datatype=H5Dget_type(dataset);
+  bool native=(H5Tequal(datatype,H5T_NATIVE_DOUBLE)>0);
+  H5Tclose(datatype);
+  haddr_t offset=H5Dget_offset(dataset);
+  H5Dclose(dataset);
+  if(cl) close();
+
+  size_t nel(dims[0]*dims[1]);
+  if(!nel || !contiguous || !native || offset==HADDR_UNDEF || offset%sizeof(double)!=0) {
+    arma::mat m;
+    read(name,m);
+    return m;
+  }
+
+  // Mappings have to start at a page boundary
+  const size_t pagesize(sysconf(_SC_PAGESIZE));
+  const size_t start(offset-offset%pagesize);
+  const size_t length(offset-start+nel*sizeof(double));
+
+  int fd=::open(filename.c_str(),O_RDONLY);
+  if(fd<0)
+    throw std::runtime_error("Could not open checkpoint file \"" + filename + "\" for memory mapping!\n");
+  void *ptr=mmap(NULL,length,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,start);
+  ::close(fd);
+  if(ptr==MAP_FAILED) {
+    arma::mat m;
+    read(name,m);
+    return m;
+  }
+  maps.push_back(std::make_pair(ptr,length));
+
+  double *data=(double *) ((char *) ptr + (offset-start));
+  return arma::mat(data,dims[1],dims[0],false,true);
+}
+
 void Checkpoint::cwrite(const std::string & name, const arma::cx_mat & m) {
   arma::mat mreal=arma::real(m);
   arma::mat mim=arma::imag(m);
@@ -498,6 +774,7 @@ void Checkpoint::write(const helfem::atomic::basis::TwoDBasis & basis) {
   write("n_quad",basis.get_nquad());
   write("poly_id",basis.get_poly_id());
   write("poly_nnodes",basis.get_poly_nnodes());
+  write("element_nnodes",basis.get_element_nnodes());
   write("zeroder",basis.get_zeroder());
   write("taylor_order",basis.get_taylor_order());
 
@@ -551,12 +828,260 @@ void Checkpoint::read(helfem::atomic::basis::TwoDBasis & basis) {
   read("lval", lval);
   read("mval", mval);
 
+  // Number of nodes in each element; older checkpoints only have uniform bases
+  arma::ivec el_nnodes;
+  if(exist("element_nnodes")) {
+    read("element_nnodes", el_nnodes);
+    if(arma::all(el_nnodes==poly_nnodes))
+      el_nnodes.clear();
+  }
+
   auto poly(std::shared_ptr<const helfem::polynomial_basis::PolynomialBasis>(helfem::polynomial_basis::get_basis(poly_id,poly_nnodes)));
-  basis=helfem::atomic::basis::TwoDBasis(Z, (helfem::modelpotential::nuclear_model_t) finitenuc, Rrms, poly, zeroder, n_quad, bval, taylor_order, lval, mval, Zl, Zr, Rhalf);
+  basis=helfem::atomic::basis::TwoDBasis(Z, (helfem::modelpotential::nuclear_model_t) finitenuc, Rrms, poly, zeroder, n_quad, bval, taylor_order, lval, mval, Zl, Zr, Rhalf, el_nnodes);
   
   if(cl) close();
 }
 
+void Checkpoint::write(const std::string & name, const std::vector<arma::mat> & v) {
+  CHECK_WRITE();
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  remove(name);
+  create_group(name);
+  write(name+"/N",(hsize_t) v.size());
+  for(size_t i=0;i<v.size();i++)
+    if(v[i].n_elem)
+      write(name+"/"+std::to_string(i),v[i]);
+
+  if(cl) close();
+}
+
+void Checkpoint::read(const std::string & name, std::vector<arma::mat> & v) {
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  hsize_t N;
+  read(name+"/N",N);
+  v.assign(N,arma::mat());
+  for(size_t i=0;i<v.size();i++) {
+    std::string entry(name+"/"+std::to_string(i));
+    if(exist(entry))
+      read(entry,v[i]);
+  }
+
+  if(cl) close();
+}
+
+/// Name of the cache entry for range-separated integrals
+static std::string rs_entry(bool yukawa, double lambda) {
+  char name[80];
+  snprintf(name,sizeof(name),"rs_%s_%.16e",yukawa ? "yukawa" : "erfc",lambda);
+  return std::string(name);
+}
+
+void Checkpoint::write_rs_integrals(const helfem::atomic::basis::TwoDBasis & basis, bool yukawa, double lambda) {
+  CHECK_WRITE();
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  std::string name(rs_entry(yukawa,lambda));
+  remove(name);
+  create_group(name);
+
+  // Radial basis fingerprint
+  write(name+"/bval",basis.get_bval());
+  write(name+"/n_quad",basis.get_nquad());
+  write(name+"/poly_id",basis.get_poly_id());
+  write(name+"/poly_nnodes",basis.get_poly_nnodes());
+  write(name+"/zeroder",basis.get_zeroder());
+  write(name+"/lmax",(int) arma::max(basis.get_lval()));
+
+  std::vector<arma::mat> ktei, iL, kL;
+  basis.get_rs_integrals(ktei,iL,kL);
+  write(name+"/ktei",ktei);
+  if(yukawa) {
+    write(name+"/iL",iL);
+    write(name+"/kL",kL);
+  }
+
+  if(cl) close();
+}
+
+bool Checkpoint::read_rs_integrals(helfem::atomic::basis::TwoDBasis & basis, bool yukawa, double lambda) {
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  std::string name(rs_entry(yukawa,lambda));
+  bool match=exist(name);
+  if(match) {
+    arma::vec bval;
+    read(name+"/bval",bval);
+    int n_quad, poly_id, poly_nnodes, zeroder, lmax;
+    read(name+"/n_quad",n_quad);
+    read(name+"/poly_id",poly_id);
+    read(name+"/poly_nnodes",poly_nnodes);
+    read(name+"/zeroder",zeroder);
+    read(name+"/lmax",lmax);
+
+    arma::vec bref(basis.get_bval());
+    match = (bval.n_elem == bref.n_elem) && (n_quad == basis.get_nquad()) && (poly_id == basis.get_poly_id()) && (poly_nnodes == basis.get_poly_nnodes()) && (zeroder == basis.get_zeroder()) && (lmax == (int) arma::max(basis.get_lval()));
+    if(match)
+      match = !arma::any(bval != bref);
+  }
+
+  if(match) {
+    std::vector<arma::mat> ktei, iL, kL;
+    read(name+"/ktei",ktei);
+    if(yukawa) {
+      read(name+"/iL",iL);
+      read(name+"/kL",kL);
+    }
+    basis.set_rs_integrals(yukawa,lambda,ktei,iL,kL);
+  }
+
+  if(cl) close();
+
+  return match;
+}
+
+void Checkpoint::write_tei(const helfem::atomic::basis::TwoDBasis & basis) {
+  CHECK_WRITE();
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  std::string name("tei_"+basis.fingerprint());
+  remove(name);
+  create_group(name);
+
+  std::vector<arma::mat> L, m1L, tei;
+  basis.get_tei(L,m1L,tei);
+  write(name+"/L",L);
+  write(name+"/m1L",m1L);
+  write(name+"/tei",tei);
+
+  if(cl) close();
+}
+
+bool Checkpoint::read_tei(helfem::atomic::basis::TwoDBasis & basis, bool exchange, bool direct) {
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  std::string name("tei_"+basis.fingerprint());
+  bool match=exist(name);
+  if(match) {
+    std::vector<arma::mat> L, m1L, tei;
+    read(name+"/L",L);
+    read(name+"/m1L",m1L);
+    read(name+"/tei",tei);
+    basis.set_tei(exchange,direct,L,m1L,tei);
+  }
+
+  if(cl) close();
+
+  return match;
+}
+
+void Checkpoint::write_legendre_table(helfem::diatomic::basis::TwoDBasis & basis, const std::string & name) {
+  CHECK_WRITE();
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  const helfem::legendretable::LegendreTable & tab(basis.get_legendre_table());
+  remove(name);
+  create_group(name);
+  write(name+"/Lpad",tab.get_Lpad());
+  write(name+"/Lmax",tab.get_Lmax());
+  write(name+"/Mmax",tab.get_Mmax());
+  std::vector<arma::vec> xi(tab.get_xi());
+  write(name+"/xi",std::vector<arma::mat>(xi.begin(),xi.end()));
+  write(name+"/Plm",arma::mat(tab.get_Plm()));
+  write(name+"/Qlm",arma::mat(tab.get_Qlm()));
+
+  if(cl) close();
+}
+
+bool Checkpoint::read_legendre_table(helfem::diatomic::basis::TwoDBasis & basis, const std::string & name) {
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  bool match=exist(name);
+  if(match) {
+    int Lpad, Lmax, Mmax;
+    read(name+"/Lpad",Lpad);
+    read(name+"/Lmax",Lmax);
+    read(name+"/Mmax",Mmax);
+    std::vector<arma::mat> xim;
+    read(name+"/xi",xim);
+    std::vector<arma::vec> xi(xim.size());
+    for(size_t i=0;i<xim.size();i++)
+      xi[i]=arma::vectorise(xim[i]);
+    arma::mat Plm, Qlm;
+    read(name+"/Plm",Plm);
+    read(name+"/Qlm",Qlm);
+
+    match=basis.set_legendre_table(helfem::legendretable::LegendreTable(Lpad,Lmax,Mmax,xi,arma::vectorise(Plm),arma::vectorise(Qlm)));
+  }
+
+  if(cl) close();
+
+  return match;
+}
+
+void Checkpoint::write_cached(const std::string & name, const arma::mat & mat) {
+  CHECK_WRITE();
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  remove(name);
+  write(name,mat);
+
+  if(cl) close();
+}
+
+bool Checkpoint::read_cached(const std::string & name, arma::mat & mat) {
+  bool cl=false;
+  if(!opend) {
+    open();
+    cl=true;
+  }
+
+  bool found=exist(name);
+  if(found)
+    read(name,mat);
+
+  if(cl) close();
+
+  return found;
+}
+
 void Checkpoint::write(const helfem::diatomic::basis::TwoDBasis & basis) {
   CHECK_WRITE();
   bool cl=false;
@@ -1008,6 +1533,21 @@ bool file_exists(const std::string & name) {
   return file.good();
 }
 
+arma::mat cached_matrix(const std::string & fname, const std::string & name, const std::function<arma::mat()> & compute) {
+  arma::mat mat;
+  if(fname.size() && file_exists(fname)) {
+    Checkpoint cache(fname,false);
+    if(cache.read_cached(name,mat))
+      return mat;
+  }
+  mat=compute();
+  if(fname.size()) {
+    Checkpoint cache(fname,true,false);
+    cache.write_cached(name,mat);
+  }
+  return mat;
+}
+
 std::string get_cwd() {
   // Initial array size
   size_t m=1024;
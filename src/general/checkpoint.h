@@ -18,6 +18,9 @@
 #define CHECKPOINT_H
 
 #include <armadillo>
+#include <functional>
+#include <utility>
+#include <vector>
 #include "../atomic/basis.h"
 #include "../diatomic/basis.h"
 
@@ -40,6 +43,10 @@ class Checkpoint {
   bool opend;
   /// The checkpoint file
   hid_t file;
+  /// Deflate level for matrices, 0 for uncompressed contiguous storage
+  int deflate;
+  /// Memory maps of matrices: start of the mapping and its length
+  std::vector< std::pair<void *, size_t> > maps;
 
   // *** Helper functions ***
 
@@ -47,6 +54,8 @@ class Checkpoint {
   void write_hbool(const std::string & name, hbool_t val);
   /// Read value
   void read_hbool(const std::string & name, hbool_t & val);
+  /// Open a matrix dataset and get its dimensions (columns first)
+  hid_t open_matrix(const std::string & name, hsize_t dims[2]);
 
  public:
   /// Create checkpoint file
@@ -74,6 +83,12 @@ class Checkpoint {
    */
   void remove(const std::string & name);
 
+  /**
+   * Create a group, unless it already exists. Entries in the group
+   * are accessed with the usual routines as "group/name".
+   */
+  void create_group(const std::string & name);
+
   /**
    * Access routines.
    *
@@ -85,6 +100,41 @@ class Checkpoint {
   /// Read matrix
   void read(const std::string & name, arma::mat & mat);
 
+  /**
+   * Store matrices written from now on in chunks compressed with the
+   * given deflate level; 0 switches back to contiguous storage. FEM
+   * matrices are mostly zero and compress very well.
+   */
+  void set_compression(int level);
+  /**
+   * Create an empty matrix to be filled in blocks of rows with
+   * write_rows, so that large data sets can be written out as they
+   * are computed. The file should be kept open while doing this.
+   */
+  void create(const std::string & name, arma::uword nrows, arma::uword ncols);
+  /// Write the rows mat(r0:r0+block.n_rows-1, :) of a created matrix
+  void write_rows(const std::string & name, const arma::mat & block, arma::uword r0);
+  /// Get the dimensions of a stored matrix
+  void size(const std::string & name, arma::uword & nrows, arma::uword & ncols);
+  /// Read the submatrix mat(r0:r1, c0:c1) without loading the rest
+  void read(const std::string & name, arma::mat & mat, arma::uword r0, arma::uword r1, arma::uword c0, arma::uword c1);
+  /**
+   * Read the submatrix mat(rows, cols) without loading the rest,
+   * e.g. the block of a pair of elements or an angular channel. The
+   * indices must be sorted in increasing order.
+   */
+  void read(const std::string & name, arma::mat & mat, const arma::uvec & rows, const arma::uvec & cols);
+
+  /**
+   * Map a matrix into memory instead of reading it, for files opened
+   * for reading only. Pages are only read in when they are accessed,
+   * and are shared between processes that map the same file. The
+   * matrix uses the mapped memory directly, so it must not outlive
+   * the checkpoint object; changes to it stay private to the
+   * process. Chunked or compressed matrices are read in normally.
+   */
+  arma::mat map(const std::string & name);
+
   /// Save complex matrix
   void cwrite(const std::string & name, const arma::cx_mat & mat);
   /// Read complex matrix
@@ -114,6 +164,35 @@ class Checkpoint {
   /// Save basis set
   void read(helfem::diatomic::basis::TwoDBasis & basis);
 
+  /// Save list of matrices as entries name/i; empty matrices are skipped
+  void write(const std::string & name, const std::vector<arma::mat> & v);
+  /// Read list of matrices
+  void read(const std::string & name, std::vector<arma::mat> & v);
+
+  /**
+   * Save the range-separated integrals of the basis set. The entries
+   * are keyed by the kernel and the range separation parameter, and
+   * the radial basis and L range they were computed with.
+   */
+  void write_rs_integrals(const helfem::atomic::basis::TwoDBasis & basis, bool yukawa, double lambda);
+  /// Load cached range-separated integrals, returns false if none match the basis set
+  bool read_rs_integrals(helfem::atomic::basis::TwoDBasis & basis, bool yukawa, double lambda);
+
+  /// Save the two-electron integrals of the basis set, keyed by the basis fingerprint
+  void write_tei(const helfem::atomic::basis::TwoDBasis & basis);
+  /// Load cached two-electron integrals, returns false if there are none for the basis set
+  bool read_tei(helfem::atomic::basis::TwoDBasis & basis, bool exchange, bool direct);
+
+  /// Save the Legendre function table of the basis set
+  void write_legendre_table(helfem::diatomic::basis::TwoDBasis & basis, const std::string & name="legendre");
+  /// Load the Legendre function table, returns false if it does not match the basis set
+  bool read_legendre_table(helfem::diatomic::basis::TwoDBasis & basis, const std::string & name="legendre");
+
+  /// Save a cached matrix, replacing any earlier entry of the same name
+  void write_cached(const std::string & name, const arma::mat & mat);
+  /// Load a cached matrix, returns false if there is no such entry
+  bool read_cached(const std::string & name, arma::mat & mat);
+
   /// Save value
   void write(const std::string & name, double val);
   /// Read value
@@ -143,6 +222,12 @@ class Checkpoint {
 /// Check for existence of file
 bool file_exists(const std::string & name);
 
+/**
+ * Read a matrix from a cache file, or compute it and store it in the
+ * cache if it is not there. An empty file name disables the cache.
+ */
+arma::mat cached_matrix(const std::string & fname, const std::string & name, const std::function<arma::mat()> & compute);
+
 /// Get current working directory
 std::string get_cwd();
 /// Change to directory, create it first if wanted
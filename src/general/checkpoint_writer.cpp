@@ -0,0 +1,102 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include "checkpoint_writer.h"
+
+CheckpointWriter::CheckpointWriter(Checkpoint & chkpt_, int every_, bool restart_only_) : chkpt(chkpt_), every(every_), restart_only(restart_only_) {
+  if(every<0)
+    throw std::logic_error("Checkpoint interval must be non-negative!\n");
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  // Don't throw from the destructor
+  if(worker.joinable())
+    worker.join();
+}
+
+void CheckpointWriter::write(const std::string & name, const arma::mat & m, bool restart) {
+  if(restart_only && !restart)
+    return;
+  pending[name]=[name, m](Checkpoint & c) { c.write(name,m); };
+}
+
+void CheckpointWriter::write(const std::string & name, double val, bool restart) {
+  if(restart_only && !restart)
+    return;
+  pending[name]=[name, val](Checkpoint & c) { c.write(name,val); };
+}
+
+void CheckpointWriter::write(const std::string & name, int val, bool restart) {
+  if(restart_only && !restart)
+    return;
+  pending[name]=[name, val](Checkpoint & c) { c.write(name,val); };
+}
+
+void CheckpointWriter::write(const std::string & name, bool val, bool restart) {
+  if(restart_only && !restart)
+    return;
+  pending[name]=[name, val](Checkpoint & c) { c.write(name,val); };
+}
+
+void CheckpointWriter::iteration(int it) {
+  if(every>0 && it%every==0)
+    submit();
+}
+
+void CheckpointWriter::finish() {
+  submit();
+  wait();
+}
+
+void CheckpointWriter::wait() {
+  if(worker.joinable())
+    worker.join();
+  if(error) {
+    std::exception_ptr err(error);
+    error=std::exception_ptr();
+    std::rethrow_exception(err);
+  }
+}
+
+void CheckpointWriter::submit() {
+  if(pending.empty())
+    return;
+
+  // Wait for the previous save to finish before reusing its buffer
+  wait();
+  writing.swap(pending);
+  pending.clear();
+  worker=std::thread(&CheckpointWriter::run, this);
+}
+
+void CheckpointWriter::run() {
+  try {
+    bool cl=false;
+    if(!chkpt.is_open()) {
+      chkpt.open();
+      cl=true;
+    }
+    for(std::map<std::string, job_t>::const_iterator it=writing.begin();it!=writing.end();++it)
+      it->second(chkpt);
+    if(cl)
+      chkpt.close();
+    else
+      chkpt.flush();
+  } catch(...) {
+    error=std::current_exception();
+  }
+  writing.clear();
+}
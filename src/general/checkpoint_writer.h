@@ -0,0 +1,91 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#ifndef CHECKPOINT_WRITER_H
+#define CHECKPOINT_WRITER_H
+
+#include "checkpoint.h"
+#include <armadillo>
+#include <exception>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+
+/**
+ * Writes the SCF matrices to the checkpoint in a background thread,
+ * so that the iterations don't wait for the disk.
+ *
+ * The matrices of the current iteration are copied into a pending
+ * buffer; when the policy says it's time to save, the buffer is
+ * swapped with the one the writer thread works on. Only the latest
+ * copy of each entry is kept, so skipped iterations cost a copy but
+ * no I/O. HDF5 is not thread safe, so the checkpoint must not be
+ * touched directly before finish() has been called.
+ */
+class CheckpointWriter {
+  /// The checkpoint file
+  Checkpoint & chkpt;
+  /// Save every n iterations, 0 for only at the end
+  int every;
+  /// Only save the quantities needed for restarting
+  bool restart_only;
+
+  /// Save routine of an entry; holds its own copy of the data
+  typedef std::function<void(Checkpoint &)> job_t;
+  /// Entries collected for the next save
+  std::map<std::string, job_t> pending;
+  /// Entries the writer thread is saving
+  std::map<std::string, job_t> writing;
+  /// The writer thread
+  std::thread worker;
+  /// Error caught in the writer thread
+  std::exception_ptr error;
+
+  /// Hand the pending entries to the writer thread
+  void submit();
+  /// Worker routine
+  void run();
+
+ public:
+  /// Constructor
+  CheckpointWriter(Checkpoint & chkpt, int every=1, bool restart_only=false);
+  /// Destructor, waits for the writes to finish
+  ~CheckpointWriter();
+
+  /// Queue an entry; restart denotes quantities needed for restarting
+  void write(const std::string & name, const arma::mat & m, bool restart=false);
+  /// Queue a value
+  void write(const std::string & name, double val, bool restart=false);
+  /// Queue a value
+  void write(const std::string & name, int val, bool restart=false);
+  /// Queue a value
+  void write(const std::string & name, bool val, bool restart=false);
+  /// Queue a DIIS history, which is saved through its save(chkpt, name) routine
+  template<typename T> void write_diis(const std::string & name, const T & diis, bool restart=false) {
+    if(restart_only && !restart)
+      return;
+    pending[name]=[name, diis](Checkpoint & c) { diis.save(c,name); };
+  }
+  /// Called at the end of SCF iteration it
+  void iteration(int it);
+  /// Save what is left and wait for the writer thread
+  void finish();
+  /// Wait for the writer thread
+  void wait();
+};
+
+#endif
@@ -14,12 +14,16 @@
  * of the License, or (at your option) any later version.
  */
 
+#include <algorithm>
 #include <string>
 #include <sstream>
 #include <stdexcept>
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "dftfuncs.h"
 #include "utils.h"
 
@@ -33,6 +37,86 @@ extern "C" {
 #define KW_NONE "none"
 #define KW_HF "hyb_x_hf"
 
+/// Initialize a libxc functional, throwing if it is not found
+static void init_functional(xc_func_type *func, int func_id, int nspin) {
+  if(xc_func_init(func, func_id, nspin) != 0) {
+    std::ostringstream oss;
+    oss << "Functional "<<func_id<<" not found!";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+/// Frees a libxc functional
+struct functional_deleter {
+  void operator()(xc_func_type *func) const {
+    xc_func_end(func);
+    delete func;
+  }
+};
+
+/// Unpolarized functionals used for the queries below are initialized once and kept
+static xc_func_type & query_functional(int func_id) {
+  static std::mutex lock;
+  static std::map<int, std::unique_ptr<xc_func_type, functional_deleter>> cache;
+  std::lock_guard<std::mutex> guard(lock);
+  std::unique_ptr<xc_func_type, functional_deleter> & func(cache[func_id]);
+  if(!func) {
+    std::unique_ptr<xc_func_type> hlp(new xc_func_type);
+    init_functional(hlp.get(), func_id, XC_UNPOLARIZED);
+    func.reset(hlp.release());
+  }
+  return *func;
+}
+
+XCFunctional::XCFunctional(int func_id_, bool polarized_, const arma::vec & params_, double thr_) : func_id(func_id_), polarized(polarized_), params(params_), thr(thr_) {
+  func=new xc_func_type;
+  try {
+    init_functional(func, func_id, polarized ? XC_POLARIZED : XC_UNPOLARIZED);
+  } catch(...) {
+    delete func;
+    throw;
+  }
+  // Set density threshold
+  xc_func_set_dens_threshold(func, thr);
+
+  // Set parameters
+  if(params.n_elem) {
+    // Check sanity
+    if(params.n_elem != (arma::uword) xc_func_info_get_n_ext_params((xc_func_info_type *)func->info)) {
+      xc_func_end(func);
+      delete func;
+      throw std::logic_error("Incompatible number of parameters!\n");
+    }
+    arma::vec phlp(params);
+    xc_func_set_ext_params(func, phlp.memptr());
+  }
+
+  is_gga_mgga(func_id,gga,mgga_t,mgga_l);
+  exc=::has_exc(func_id);
+}
+
+XCFunctional::~XCFunctional() {
+  xc_func_end(func);
+  delete func;
+}
+
+bool XCFunctional::matches(int func_id_, bool polarized_, const arma::vec & params_, double thr_) const {
+  if(func_id_ != func_id || polarized_ != polarized || thr_ != thr)
+    return false;
+  if(params_.n_elem != params.n_elem)
+    return false;
+  return arma::all(params_ == params);
+}
+
+void XCFunctional::update(std::shared_ptr<const XCFunctional> & handle, int func_id, bool polarized, const arma::vec & params, double thr) {
+  if(func_id <= 0) {
+    handle.reset();
+    return;
+  }
+  if(!handle || !handle->matches(func_id, polarized, params, thr))
+    handle=std::make_shared<const XCFunctional>(func_id, polarized, params, thr);
+}
+
 // Print keyword corresponding to functional.
 std::string get_keyword(int func_id) {
   // Check if none was specified. This is internal to ERKALE.
@@ -167,12 +251,7 @@ void print_info(int x_func, int c_func) {
 
 void print_info(int func_id) {
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0) {
-      std::ostringstream oss;
-      oss << "\nFunctional "<<func_id<<" not found!\n";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
 
 #if XC_MAJOR_VERSION < 3
     printf("'%s', defined in the reference(s):\n%s\n", func.info->name, func.info->refs);
@@ -182,7 +261,6 @@ void print_info(int func_id) {
       if(func.info->refs[i]!=NULL)
 	printf("%s (doi:%s)\n",func.info->refs[i]->ref,func.info->refs[i]->doi);
 #endif
-    xc_func_end(&func);
 
     bool gga, mgga_t, mgga_l;
     is_gga_mgga(func_id,gga,mgga_t,mgga_l);
@@ -199,12 +277,7 @@ bool is_exchange(int func_id) {
   bool ans=false;
 
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
 
     switch(func.info->kind)
       {
@@ -218,8 +291,6 @@ bool is_exchange(int func_id) {
       default:
 	ans=false;
       }
-    // Free functional
-    xc_func_end(&func);
 
   } else if(func_id==ID_HF) {
     ans=true;
@@ -235,12 +306,7 @@ bool is_exchange_correlation(int func_id) {
   bool ans=false;
 
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
 
     switch(func.info->kind)
       {
@@ -253,8 +319,6 @@ bool is_exchange_correlation(int func_id) {
       default:
 	ans=false;
       }
-    // Free functional
-    xc_func_end(&func);
   } else
     // Dummy exchange
     ans=false;
@@ -266,12 +330,7 @@ bool is_correlation(int func_id) {
   bool ans=false;
 
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
 
     switch(func.info->kind)
       {
@@ -284,8 +343,6 @@ bool is_correlation(int func_id) {
       default:
 	ans=false;
       }
-    // Free functional
-    xc_func_end(&func);
   } else
     // Dummy correlation
     ans=false;
@@ -297,12 +354,7 @@ bool is_kinetic(int func_id) {
   bool ans=false;
 
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
 
     switch(func.info->kind)
       {
@@ -315,8 +367,6 @@ bool is_kinetic(int func_id) {
       default:
 	ans=false;
       }
-    // Free functional
-    xc_func_end(&func);
   } else
     // Dummy correlation
     ans=false;
@@ -324,6 +374,18 @@ bool is_kinetic(int func_id) {
   return ans;
 }
 
+void print_thread_load(const std::vector<double> & t) {
+  if(t.size()<2)
+    return;
+  double tmin=t[0], tmax=t[0], tsum=0.0;
+  for(size_t i=0;i<t.size();i++) {
+    tmin=std::min(tmin,t[i]);
+    tmax=std::max(tmax,t[i]);
+    tsum+=t[i];
+  }
+  printf("XC thread busy times: min %.3f s, mean %.3f s, max %.3f s\n",tmin,tsum/t.size(),tmax);
+}
+
 void is_gga_mgga(int func_id, bool & gga, bool & mgga_t, bool & mgga_l) {
   // Initialize
   gga=false;
@@ -333,12 +395,7 @@ void is_gga_mgga(int func_id, bool & gga, bool & mgga_t, bool & mgga_l) {
     return;
 
   // Correlation and exchange functionals
-  xc_func_type func;
-  if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0) {
-    std::ostringstream oss;
-    oss << "Functional "<<func_id<<" not found!";
-    throw std::runtime_error(oss.str());
-  }
+  xc_func_type & func(query_functional(func_id));
 
   switch(func.info->family)
     {
@@ -381,8 +438,6 @@ void is_gga_mgga(int func_id, bool & gga, bool & mgga_t, bool & mgga_l) {
       }
     }
 
-  // Free functional
-  xc_func_end(&func);
 }
 
 double exact_exchange(int func_id) {
@@ -390,12 +445,7 @@ double exact_exchange(int func_id) {
   double f=0.0;
 
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
 
 #if XC_MAJOR_VERSION < 7
     switch(func.info->family)
@@ -420,7 +470,6 @@ double exact_exchange(int func_id) {
       f=xc_hyb_exx_coef(&func);
 #endif
 
-    xc_func_end(&func);
   } else if(func_id==ID_HF)
     f=1.0;
 
@@ -433,12 +482,7 @@ bool is_supported(int func_id) {
   bool support=true;
 
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
     // Get flag
 #if XC_MAJOR_VERSION > 6
     switch(xc_hyb_type(&func)) {
@@ -454,8 +498,6 @@ bool is_supported(int func_id) {
 #else
     support=true;
 #endif
-    // Free functional
-    xc_func_end(&func);
   }
 
   return support;
@@ -465,12 +507,7 @@ void is_range_separated(int func_id, bool & erf, bool & yukawa, bool check) {
   erf = false;
   yukawa = false;
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
     // Get flag
 #if XC_MAJOR_VERSION < 7
     erf=(func.info->flags & XC_FLAGS_HYB_CAM) || (func.info->flags & XC_FLAGS_HYB_LC);
@@ -479,8 +516,6 @@ void is_range_separated(int func_id, bool & erf, bool & yukawa, bool check) {
     erf = (xc_hyb_type(&func) == XC_HYB_CAM);
     yukawa = (xc_hyb_type(&func) == XC_HYB_CAMY);
 #endif
-    // Free functional
-    xc_func_end(&func);
   }
 
   if(check) {
@@ -509,12 +544,7 @@ void range_separation(int func_id, double & omega, double & alpha, double & beta
   beta=0.0;
 
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
 
 #if XC_MAJOR_VERSION > 6
     switch(xc_hyb_type(&func)) {
@@ -550,7 +580,6 @@ void range_separation(int func_id, double & omega, double & alpha, double & beta
       }
 #endif
 
-    xc_func_end(&func);
   } else if(func_id==ID_HF)
     alpha=1.0;
 
@@ -569,6 +598,37 @@ void range_separation(int func_id, double & omega, double & alpha, double & beta
   }
 }
 
+arma::vec set_range_separation(int func_id, const arma::vec & pars, double omega) {
+  if(func_id<=0)
+    throw std::logic_error("Range separation requires a libxc functional!\n");
+#if XC_MAJOR_VERSION >= 5
+  xc_func_type & func(query_functional(func_id));
+  int npar(xc_func_info_get_n_ext_params((xc_func_info_type *)func.info));
+
+  arma::vec p(pars);
+  if(!p.n_elem) {
+    p.zeros(npar);
+    for(int i=0;i<npar;i++)
+      p(i)=xc_func_info_get_ext_params_default_value((xc_func_info_type *)func.info,i);
+  } else if(p.n_elem != (arma::uword) npar)
+    throw std::logic_error("Incompatible number of parameters!\n");
+
+  for(int i=0;i<npar;i++)
+    if(strcmp(xc_func_info_get_ext_params_name((xc_func_info_type *)func.info,i),"_omega")==0) {
+      p(i)=omega;
+      return p;
+    }
+
+  std::ostringstream oss;
+  oss << "Functional " << get_keyword(func_id) << " does not have a range-separation parameter!\n";
+  throw std::logic_error(oss.str());
+#else
+  (void) pars;
+  (void) omega;
+  throw std::logic_error("Changing the range-separation parameter requires libxc 5 or later!\n");
+#endif
+}
+
 bool needs_VV10(int func_id, double & b, double & C) {
   b=0.0;
   C=0.0;
@@ -576,18 +636,11 @@ bool needs_VV10(int func_id, double & b, double & C) {
   bool ret=false;
 #ifdef XC_FLAGS_VV10
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
     // Get flag
     ret=func.info->flags & XC_FLAGS_VV10;
     if(ret)
       XC(nlc_coef)(&func, &b, &C);
-    // Free functional
-    xc_func_end(&func);
   }
 #endif
 
@@ -600,12 +653,7 @@ bool gradient_needed(int func_id) {
   bool grad=false;
 
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
 
     switch(func.info->family)
       {
@@ -620,8 +668,6 @@ bool gradient_needed(int func_id) {
 	grad=true;
 	break;
       }
-    // Free functional
-    xc_func_end(&func);
   }
 
   return grad;
@@ -631,12 +677,7 @@ bool tau_needed(int func_id) {
   bool tau=false;
 
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
 
     switch(func.info->family)
       {
@@ -651,8 +692,6 @@ bool tau_needed(int func_id) {
 #endif
 	break;
       }
-    // Free functional
-    xc_func_end(&func);
   }
 
   return tau;
@@ -662,12 +701,7 @@ bool laplacian_needed(int func_id) {
   bool lapl=false;
 
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
 
     switch(func.info->family)
       {
@@ -682,8 +716,6 @@ bool laplacian_needed(int func_id) {
 #endif
 	break;
       }
-    // Free functional
-    xc_func_end(&func);
   }
 
   return lapl;
@@ -693,16 +725,9 @@ bool has_exc(int func_id) {
   bool ans=true;
 
   if(func_id>0) {
-    xc_func_type func;
-    if(xc_func_init(&func, func_id, XC_UNPOLARIZED) != 0){
-      std::ostringstream oss;
-      oss << "Functional "<<func_id<<" not found!";
-      throw std::runtime_error(oss.str());
-    }
+    xc_func_type & func(query_functional(func_id));
     // Get flag
     ans=func.info->flags & XC_FLAGS_HAVE_EXC;
-    // Free functional
-    xc_func_end(&func);
   }
 
   return ans;
@@ -17,7 +17,13 @@
 #ifndef ERKALE_DFTFUNCS
 #define ERKALE_DFTFUNCS
 
+#include <armadillo>
+#include <memory>
 #include <string>
+#include <vector>
+
+// Forward declaration of the libxc functional
+struct xc_func_type;
 
 /// Struct for a functional
 typedef struct {
@@ -27,6 +33,55 @@ typedef struct {
   int func_id;
 } func_t;
 
+/**
+ * libxc functional initialized once with its parameters and density
+ * threshold. libxc does not modify the functional in the evaluation
+ * routines, so a single handle is shared by all threads and kept
+ * between SCF iterations.
+ */
+class XCFunctional {
+  /// libxc functional
+  xc_func_type *func;
+  /// Functional id
+  int func_id;
+  /// Is the functional spin polarized?
+  bool polarized;
+  /// External parameters
+  arma::vec params;
+  /// Density threshold
+  double thr;
+  /// Functional family
+  bool gga, mgga_t, mgga_l;
+  /// Is energy density available?
+  bool exc;
+
+ public:
+  /// Constructor
+  XCFunctional(int func_id, bool polarized, const arma::vec & params, double thr);
+  /// Destructor
+  ~XCFunctional();
+  /// The handle owns the libxc functional, so it is not copied
+  XCFunctional(const XCFunctional &) = delete;
+  /// The handle owns the libxc functional, so it is not copied
+  XCFunctional & operator=(const XCFunctional &) = delete;
+
+  /// Get the libxc functional
+  xc_func_type * get() const { return func; }
+  /// Get the functional id
+  int get_id() const { return func_id; }
+  /// Is the functional spin polarized?
+  bool is_polarized() const { return polarized; }
+  /// Get the functional family
+  void get_family(bool & gga_, bool & mgga_t_, bool & mgga_l_) const { gga_=gga; mgga_t_=mgga_t; mgga_l_=mgga_l; }
+  /// Does the functional have an energy density?
+  bool has_exc() const { return exc; }
+  /// Was the functional initialized with these settings?
+  bool matches(int func_id, bool polarized, const arma::vec & params, double thr) const;
+
+  /// Reinitialize the handle if the settings have changed; func_id <= 0 frees it
+  static void update(std::shared_ptr<const XCFunctional> & handle, int func_id, bool polarized, const arma::vec & params, double thr);
+};
+
 /// Print keyword corresponding to functional.
 std::string get_keyword(int func_id);
 
@@ -50,6 +105,9 @@ bool is_exchange_correlation(int func_id);
 /// Is the functional for kinetic energy? (Not used in ERKALE)
 bool is_kinetic(int func_id);
 
+/// Print the spread of per-thread busy times of a quadrature loop
+void print_thread_load(const std::vector<double> & t);
+
 /// Is functional a gga / mgga functional?
 void is_gga_mgga(int func_id, bool & gga, bool & mgga_t, bool & mgga_l);
 
@@ -64,6 +122,9 @@ bool is_range_separated(int func_id, bool check=true);
 /// Get range separation constants
 void range_separation(int func_id, double & omega, double & alpha, double & beta, bool check=true);
 
+/// Functional parameters with the range-separation constant set to omega; the defaults are used if pars is empty
+arma::vec set_range_separation(int func_id, const arma::vec & pars, double omega);
+
 /// Is VV10 needed?
 bool needs_VV10(int func_id, double & b, double & C);
 
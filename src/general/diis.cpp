@@ -16,9 +16,11 @@
 
 
 
+#include <algorithm>
 #include <cfloat>
 #include "diis.h"
 #include "lbfgs.h"
+#include "checkpoint.h"
 
 // Maximum allowed absolute weight for a Fock matrix
 #define MAXWEIGHT 10.0
@@ -33,6 +35,40 @@ bool operator<(const diis_unpol_entry_t & lhs, const diis_unpol_entry_t & rhs) {
   return lhs.E < rhs.E;
 }
 
+/// Upper triangle of an antisymmetric matrix; inner products of the full matrices are twice those of the packed vectors
+static arma::vec pack_antisymmetric(const arma::mat & E) {
+  arma::vec v(E.n_rows*(E.n_rows-1)/2);
+  size_t ioff=0;
+  for(size_t j=1;j<E.n_cols;j++)
+    for(size_t i=0;i<j;i++)
+      v(ioff++)=E(i,j);
+  return v;
+}
+
+/// tr(A B) without forming the product. Block-diagonal matrices stored
+/// as their diagonal blocks side by side are handled block by block.
+static double trace_product(const arma::mat & A, const arma::mat & B) {
+  if(A.n_cols == A.n_rows)
+    return arma::accu(A%arma::trans(B));
+
+  const size_t nb(A.n_rows);
+  double tr=0.0;
+  for(size_t ib=0;ib<A.n_cols/nb;ib++)
+    tr+=arma::accu(A.cols(ib*nb,(ib+1)*nb-1)%arma::trans(B.cols(ib*nb,(ib+1)*nb-1)));
+  return tr;
+}
+
+/// The diagonal blocks of a block-diagonal matrix side by side
+static arma::mat stack_blocks(const arma::cube & C) {
+  return arma::mat(C.memptr(), C.n_rows, C.n_cols*C.n_slices);
+}
+
+/// Copy the blocks back into a cube
+static void unstack_blocks(const arma::mat & M, arma::cube & C) {
+  C.set_size(M.n_rows, M.n_rows, M.n_cols/M.n_rows);
+  std::copy(M.memptr(), M.memptr()+M.n_elem, C.memptr());
+}
+
 DIIS::DIIS(const arma::mat & S_, const arma::mat & Sinvh_, bool usediis_, double diiseps_, double diisthr_, bool useadiis_, bool verbose_, size_t imax_) {
   S=S_;
   Sinvh=Sinvh_;
@@ -48,6 +84,93 @@ DIIS::DIIS(const arma::mat & S_, const arma::mat & Sinvh_, bool usediis_, double
 
   // No cooloff
   cooloff=0;
+  last_error=0.0;
+  adiis_stop=false;
+  diis_only=false;
+  orthonormal=false;
+}
+
+void DIIS::set_adiis_stop(bool stop) {
+  adiis_stop=stop;
+}
+
+void DIIS::set_orthonormal(bool orth) {
+  if(B.n_elem)
+    throw std::logic_error("The basis must be chosen before the DIIS history is formed!\n");
+  if(orth && sym_idx.size())
+    throw std::logic_error("Symmetry blocks are not supported in the orthonormal basis in DIIS!\n");
+  orthonormal=orth;
+}
+
+void DIIS::set_symmetry_blocks(const std::vector<arma::uvec> & idx) {
+  if(B.n_elem)
+    throw std::logic_error("Symmetry blocks must be set before the DIIS history is formed!\n");
+
+  sym_idx.clear();
+  sym_X.clear();
+  sym_off.assign(1,0);
+  size_t ncols=0;
+  for(size_t isym=0;isym<idx.size();isym++) {
+    // Columns of Sinvh that belong to this symmetry
+    arma::mat Scmp(Sinvh.rows(idx[isym]));
+    arma::vec Snrm(Scmp.n_cols);
+    for(size_t i=0;i<Snrm.n_elem;i++)
+      Snrm(i)=arma::norm(Scmp.col(i),"fro");
+    arma::uvec Sind(arma::find(Snrm));
+
+    sym_idx.push_back(idx[isym]);
+    sym_X.push_back(Scmp.cols(Sind));
+    sym_off.push_back(sym_off.back()+idx[isym].n_elem*idx[isym].n_elem);
+    ncols+=Sind.n_elem;
+  }
+  if(ncols!=Sinvh.n_cols)
+    throw std::logic_error("Orthogonalizing matrix is not blocked by symmetry in DIIS!\n");
+
+  // Packing is a plain gather of these elements
+  sym_gather.zeros(sym_off.back());
+  size_t ioff=0;
+  for(size_t isym=0;isym<sym_idx.size();isym++)
+    for(size_t j=0;j<sym_idx[isym].n_elem;j++)
+      for(size_t i=0;i<sym_idx[isym].n_elem;i++)
+        sym_gather(ioff++)=sym_idx[isym](i)+sym_idx[isym](j)*S.n_rows;
+}
+
+arma::mat DIIS::pack(const arma::mat & M) const {
+  if(!sym_idx.size())
+    return M;
+
+  arma::mat Mp(sym_gather.n_elem,1);
+  const double *m(M.memptr());
+  double *mp(Mp.memptr());
+  for(size_t i=0;i<sym_gather.n_elem;i++)
+    mp[i]=m[sym_gather(i)];
+  return Mp;
+}
+
+arma::mat DIIS::unpack(const arma::mat & Mp) const {
+  if(!sym_idx.size())
+    return Mp;
+
+  arma::mat M(S.n_rows,S.n_cols,arma::fill::zeros);
+  const double *mp(Mp.memptr());
+  double *m(M.memptr());
+  for(size_t i=0;i<sym_gather.n_elem;i++)
+    m[sym_gather(i)]=mp[i];
+  return M;
+}
+
+double DIIS::trace(const arma::mat & A, const arma::mat & B) const {
+  if(!sym_idx.size())
+    return trace_product(A,B);
+
+  double tr=0.0;
+  for(size_t isym=0;isym<sym_idx.size();isym++) {
+    size_t n(sym_idx[isym].n_elem);
+    const arma::mat Ab(const_cast<double *>(A.memptr())+sym_off[isym],n,n,false,true);
+    const arma::mat Bb(const_cast<double *>(B.memptr())+sym_off[isym],n,n,false,true);
+    tr+=arma::accu(Ab%arma::trans(Bb));
+  }
+  return tr;
 }
 
 rDIIS::rDIIS(const arma::mat & S_, const arma::mat & Sinvh_, bool usediis_, double diiseps_, double diisthr_, bool useadiis_, bool verbose_, size_t imax_) : DIIS(S_,Sinvh_,usediis_,diiseps_,diisthr_,useadiis_,verbose_,imax_) {
@@ -67,38 +190,127 @@ uDIIS::~uDIIS() {
 
 void rDIIS::clear() {
   stack.clear();
+  B.reset();
+  PF.reset();
+  adiis_w.reset();
+  diis_only=false;
 }
 
 void uDIIS::clear() {
   stack.clear();
+  B.reset();
+  PF.reset();
+  adiis_w.reset();
+  diis_only=false;
+}
+
+void DIIS::erase_tables() {
+  if(adiis_w.n_elem>1)
+    adiis_w=adiis_w.subvec(1,adiis_w.n_elem-1);
+  else
+    adiis_w.reset();
+  if(B.n_rows>1) {
+    B=B.submat(1,1,B.n_rows-1,B.n_cols-1);
+    PF=PF.submat(1,1,PF.n_rows-1,PF.n_cols-1);
+  } else {
+    B.reset();
+    PF.reset();
+  }
+}
+
+void DIIS::PiF_update() {
+  const size_t n(PF.n_rows-1);
+
+  // < P_i - P_n | F_n >
+  PiF=PF.col(n)-PF(n,n);
+  // < P_i - P_n | F_j - F_n >
+  PiFj.zeros(PF.n_rows,PF.n_cols);
+  for(size_t j=0;j<PF.n_cols;j++)
+    for(size_t i=0;i<PF.n_rows;i++)
+      PiFj(i,j)=PF(i,j)-PF(i,n)-PF(n,j)+PF(n,n);
 }
 
 void rDIIS::erase_last() {
   stack.erase(stack.begin());
+  erase_tables();
 }
 
 void uDIIS::erase_last() {
   stack.erase(stack.begin());
+  erase_tables();
+}
+
+arma::vec DIIS::error_vector(const arma::mat & F, const arma::mat & P) const {
+  if(sym_idx.size()) {
+    // The matrices are packed by symmetry
+    std::vector<arma::vec> blockerr(sym_idx.size());
+    size_t npack=0;
+    for(size_t isym=0;isym<sym_idx.size();isym++) {
+      size_t n(sym_idx[isym].n_elem);
+      const arma::mat Fb(const_cast<double *>(F.memptr())+sym_off[isym],n,n,false,true);
+      const arma::mat Pb(const_cast<double *>(P.memptr())+sym_off[isym],n,n,false,true);
+      arma::mat errmat(Fb*Pb*S(sym_idx[isym],sym_idx[isym]));
+      errmat-=arma::trans(errmat);
+      errmat=arma::trans(sym_X[isym])*errmat*sym_X[isym];
+      blockerr[isym]=pack_antisymmetric(errmat);
+      npack+=blockerr[isym].n_elem;
+    }
+    arma::vec err(npack);
+    size_t ioff=0;
+    for(size_t isym=0;isym<blockerr.size();isym++) {
+      std::copy(blockerr[isym].memptr(), blockerr[isym].memptr()+blockerr[isym].n_elem, err.memptr()+ioff);
+      ioff+=blockerr[isym].n_elem;
+    }
+    return err;
+  }
+
+  const size_t nb(S.n_rows);
+  const size_t nblocks(F.n_cols/nb);
+  if(F.n_rows != nb || F.n_cols != nblocks*nb)
+    throw std::logic_error("Matrix size does not match the overlap in DIIS!\n");
+
+  std::vector<arma::vec> blockerr(nblocks);
+  for(size_t ib=0;ib<nblocks;ib++) {
+    // Compute error matrix
+    arma::mat errmat;
+    if(orthonormal)
+      errmat=(nblocks==1) ? arma::mat(F*P) : arma::mat(F.cols(ib*nb,(ib+1)*nb-1)*P.cols(ib*nb,(ib+1)*nb-1));
+    else
+      errmat=(nblocks==1) ? arma::mat(F*P*S) : arma::mat(F.cols(ib*nb,(ib+1)*nb-1)*P.cols(ib*nb,(ib+1)*nb-1)*S);
+    // FPS - SPF
+    errmat-=arma::trans(errmat);
+    // and transform it to the orthonormal basis (1982 paper, page 557)
+    if(!orthonormal)
+      errmat=arma::trans(Sinvh)*errmat*Sinvh;
+    blockerr[ib]=pack_antisymmetric(errmat);
+  }
+  if(nblocks==1)
+    return blockerr[0];
+
+  const size_t npack(blockerr[0].n_elem);
+  arma::vec err(nblocks*npack);
+  for(size_t ib=0;ib<nblocks;ib++)
+    std::copy(blockerr[ib].memptr(), blockerr[ib].memptr()+npack, err.memptr()+ib*npack);
+  return err;
+}
+
+void rDIIS::update(const arma::cube & F, const arma::cube & P, double E, double & error) {
+  update(stack_blocks(F), stack_blocks(P), E, error);
 }
 
 void rDIIS::update(const arma::mat & F, const arma::mat & P, double E, double & error) {
   // New entry
   diis_unpol_entry_t hlp;
-  hlp.F=F;
-  hlp.P=P;
+  hlp.F=pack(F);
+  hlp.P=pack(P);
   hlp.E=E;
 
-  // Compute error matrix
-  arma::mat errmat(F*P*S);
-  // FPS - SPF
-  errmat-=arma::trans(errmat);
-  // and transform it to the orthonormal basis (1982 paper, page 557)
-  errmat=arma::trans(Sinvh)*errmat*Sinvh;
-  // and store it
-  hlp.err=arma::vectorise(errmat);
+  // Compute and store the error
+  hlp.err=error_vector(hlp.F,hlp.P);
 
   // DIIS error is
-  error=arma::max(arma::max(arma::abs(errmat)));
+  error=hlp.err.n_elem ? arma::max(arma::abs(hlp.err)) : 0.0;
+  last_error=error;
 
   // Is stack full?
   if(stack.size()==imax) {
@@ -107,54 +319,46 @@ void rDIIS::update(const arma::mat & F, const arma::mat & P, double E, double &
   // Add to stack
   stack.push_back(hlp);
 
+  // Only the new row and column of the tables need to be computed
+  const size_t n(stack.size()-1);
+  B.resize(n+1,n+1);
+  PF.resize(n+1,n+1);
+  for(size_t i=0;i<=n;i++) {
+    B(i,n)=B(n,i)=2.0*arma::dot(stack[i].err,hlp.err);
+    PF(i,n)=trace(stack[i].P,hlp.F);
+    PF(n,i)=trace(hlp.P,stack[i].F);
+  }
+
   // Update ADIIS helpers
   PiF_update();
 }
 
-void rDIIS::PiF_update() {
-  const arma::mat & Fn=stack[stack.size()-1].F;
-  const arma::mat & Pn=stack[stack.size()-1].P;
-
-  // Update matrices
-  PiF.zeros(stack.size());
-  for(size_t i=0;i<stack.size();i++)
-    PiF(i)=arma::trace((stack[i].P-Pn)*Fn);
-
-  PiFj.zeros(stack.size(),stack.size());
-  for(size_t i=0;i<stack.size();i++)
-    for(size_t j=0;j<stack.size();j++)
-      PiFj(i,j)=arma::trace((stack[i].P-Pn)*(stack[j].F-Fn));
+void uDIIS::update(const arma::cube & Fa, const arma::cube & Fb, const arma::cube & Pa, const arma::cube & Pb, double E, double & error) {
+  update(stack_blocks(Fa), stack_blocks(Fb), stack_blocks(Pa), stack_blocks(Pb), E, error);
 }
 
 void uDIIS::update(const arma::mat & Fa, const arma::mat & Fb, const arma::mat & Pa, const arma::mat & Pb, double E, double & error) {
   // New entry
   diis_pol_entry_t hlp;
-  hlp.Fa=Fa;
-  hlp.Fb=Fb;
-  hlp.Pa=Pa;
-  hlp.Pb=Pb;
+  hlp.Fa=pack(Fa);
+  hlp.Fb=pack(Fb);
+  hlp.Pa=pack(Pa);
+  hlp.Pb=pack(Pb);
   hlp.E=E;
 
-  // Compute error matrices
-  arma::mat errmata(Fa*Pa*S);
-  arma::mat errmatb(Fb*Pb*S);
-  // FPS - SPF
-  errmata-=arma::trans(errmata);
-  errmatb-=arma::trans(errmatb);
-  // and transform them to the orthonormal basis (1982 paper, page 557)
-  errmata=arma::trans(Sinvh)*errmata*Sinvh;
-  errmatb=arma::trans(Sinvh)*errmatb*Sinvh;
-  // and store it
+  // Compute the errors; the packing is linear, so the combined
+  // error is the sum of the spin errors
+  arma::vec erra(error_vector(hlp.Fa,hlp.Pa));
+  arma::vec errb(error_vector(hlp.Fb,hlp.Pb));
   if(combine) {
-    hlp.err=arma::vectorise(errmata+errmatb);
+    hlp.err=erra+errb;
   } else {
-    hlp.err.zeros(errmata.n_elem+errmatb.n_elem);
-    hlp.err.subvec(0,errmata.n_elem-1)=arma::vectorise(errmata);
-    hlp.err.subvec(errmata.n_elem,hlp.err.n_elem-1)=arma::vectorise(errmatb);
+    hlp.err=arma::join_cols(erra,errb);
   }
 
   // DIIS error is
-  error=arma::max(arma::abs(hlp.err));
+  error=hlp.err.n_elem ? arma::max(arma::abs(hlp.err)) : 0.0;
+  last_error=error;
 
   // Is stack full?
   if(stack.size()==imax) {
@@ -163,25 +367,152 @@ void uDIIS::update(const arma::mat & Fa, const arma::mat & Fb, const arma::mat &
   // Add to stack
   stack.push_back(hlp);
 
+  // Only the new row and column of the tables need to be computed
+  const size_t n(stack.size()-1);
+  B.resize(n+1,n+1);
+  PF.resize(n+1,n+1);
+  for(size_t i=0;i<=n;i++) {
+    B(i,n)=B(n,i)=2.0*arma::dot(stack[i].err,hlp.err);
+    PF(i,n)=trace(stack[i].Pa,hlp.Fa)+trace(stack[i].Pb,hlp.Fb);
+    PF(n,i)=trace(hlp.Pa,stack[i].Fa)+trace(hlp.Pb,stack[i].Fb);
+  }
+
   // Update ADIIS helpers
   PiF_update();
 }
 
-void uDIIS::PiF_update() {
-  const arma::mat & Fan=stack[stack.size()-1].Fa;
-  const arma::mat & Fbn=stack[stack.size()-1].Fb;
-  const arma::mat & Pan=stack[stack.size()-1].Pa;
-  const arma::mat & Pbn=stack[stack.size()-1].Pb;
+void DIIS::write_state(Checkpoint & chkpt, const std::string & grp) const {
+  chkpt.write(grp+"/cooloff",cooloff);
+  chkpt.write(grp+"/last_error",last_error);
+  chkpt.write(grp+"/diis_only",diis_only);
+  chkpt.write(grp+"/nsym",(int) sym_idx.size());
+  // Empty matrices can't be stored
+  std::vector<arma::mat> tables(3);
+  tables[0]=B;
+  tables[1]=PF;
+  tables[2]=adiis_w;
+  chkpt.write(grp+"/tables",tables);
+}
+
+void DIIS::read_state(Checkpoint & chkpt, const std::string & grp, size_t nstack) {
+  chkpt.read(grp+"/cooloff",cooloff);
+  chkpt.read(grp+"/last_error",last_error);
+  chkpt.read(grp+"/diis_only",diis_only);
+  // The stored matrices must be blocked in the same way
+  int nsym=0;
+  if(chkpt.exist(grp+"/nsym"))
+    chkpt.read(grp+"/nsym",nsym);
+  if(nsym != (int) sym_idx.size())
+    throw std::runtime_error("DIIS history in checkpoint was stored with different symmetry blocks!\n");
+  std::vector<arma::mat> tables;
+  chkpt.read(grp+"/tables",tables);
+  if(tables.size()!=3)
+    throw std::runtime_error("Invalid DIIS tables in checkpoint!\n");
+  B=tables[0];
+  PF=tables[1];
+  adiis_w=arma::vectorise(tables[2]);
+  if(B.n_rows!=nstack || PF.n_rows!=nstack)
+    throw std::runtime_error("DIIS tables in checkpoint don't match the stored history!\n");
+  if(nstack>imax)
+    throw std::runtime_error("DIIS history in checkpoint is longer than the maximum length!\n");
 
-  // Update matrices
-  PiF.zeros(stack.size());
-  for(size_t i=0;i<stack.size();i++)
-    PiF(i)=arma::trace((stack[i].Pa-Pan)*Fan) + arma::trace((stack[i].Pb-Pbn)*Fbn);
+  // Update ADIIS helpers
+  if(nstack)
+    PiF_update();
+  else {
+    PiF.reset();
+    PiFj.reset();
+  }
+}
 
-  PiFj.zeros(stack.size(),stack.size());
-  for(size_t i=0;i<stack.size();i++)
-    for(size_t j=0;j<stack.size();j++)
-      PiFj(i,j)=arma::trace((stack[i].Pa-Pan)*(stack[j].Fa-Fan))+arma::trace((stack[i].Pb-Pbn)*(stack[j].Fb-Fbn));
+void rDIIS::save(Checkpoint & chkpt, const std::string & grp) const {
+  std::vector<arma::mat> P(stack.size()), F(stack.size()), err(stack.size());
+  std::vector<double> E(stack.size());
+  for(size_t i=0;i<stack.size();i++) {
+    P[i]=stack[i].P;
+    F[i]=stack[i].F;
+    err[i]=stack[i].err;
+    E[i]=stack[i].E;
+  }
+
+  chkpt.create_group(grp);
+  chkpt.write(grp+"/P",P);
+  chkpt.write(grp+"/F",F);
+  chkpt.write(grp+"/err",err);
+  chkpt.write(grp+"/E",E);
+  write_state(chkpt,grp);
+}
+
+void rDIIS::load(Checkpoint & chkpt, const std::string & grp) {
+  std::vector<arma::mat> P, F, err;
+  std::vector<double> E;
+  chkpt.read(grp+"/P",P);
+  chkpt.read(grp+"/F",F);
+  chkpt.read(grp+"/err",err);
+  chkpt.read(grp+"/E",E);
+  if(F.size()!=P.size() || err.size()!=P.size() || E.size()!=P.size())
+    throw std::runtime_error("Inconsistent DIIS history in checkpoint!\n");
+
+  stack.resize(P.size());
+  for(size_t i=0;i<stack.size();i++) {
+    stack[i].P=P[i];
+    stack[i].F=F[i];
+    stack[i].err=arma::vectorise(err[i]);
+    stack[i].E=E[i];
+  }
+  read_state(chkpt,grp,stack.size());
+}
+
+void uDIIS::save(Checkpoint & chkpt, const std::string & grp) const {
+  std::vector<arma::mat> Pa(stack.size()), Pb(stack.size()), Fa(stack.size()), Fb(stack.size()), err(stack.size());
+  std::vector<double> E(stack.size());
+  for(size_t i=0;i<stack.size();i++) {
+    Pa[i]=stack[i].Pa;
+    Pb[i]=stack[i].Pb;
+    Fa[i]=stack[i].Fa;
+    Fb[i]=stack[i].Fb;
+    err[i]=stack[i].err;
+    E[i]=stack[i].E;
+  }
+
+  chkpt.create_group(grp);
+  chkpt.write(grp+"/combine",combine);
+  chkpt.write(grp+"/Pa",Pa);
+  chkpt.write(grp+"/Pb",Pb);
+  chkpt.write(grp+"/Fa",Fa);
+  chkpt.write(grp+"/Fb",Fb);
+  chkpt.write(grp+"/err",err);
+  chkpt.write(grp+"/E",E);
+  write_state(chkpt,grp);
+}
+
+void uDIIS::load(Checkpoint & chkpt, const std::string & grp) {
+  bool comb;
+  chkpt.read(grp+"/combine",comb);
+  if(comb!=combine)
+    throw std::runtime_error("DIIS history in checkpoint was made with a different error definition!\n");
+
+  std::vector<arma::mat> Pa, Pb, Fa, Fb, err;
+  std::vector<double> E;
+  chkpt.read(grp+"/Pa",Pa);
+  chkpt.read(grp+"/Pb",Pb);
+  chkpt.read(grp+"/Fa",Fa);
+  chkpt.read(grp+"/Fb",Fb);
+  chkpt.read(grp+"/err",err);
+  chkpt.read(grp+"/E",E);
+  if(Pb.size()!=Pa.size() || Fa.size()!=Pa.size() || Fb.size()!=Pa.size() || err.size()!=Pa.size() || E.size()!=Pa.size())
+    throw std::runtime_error("Inconsistent DIIS history in checkpoint!\n");
+
+  stack.resize(Pa.size());
+  for(size_t i=0;i<stack.size();i++) {
+    stack[i].Pa=Pa[i];
+    stack[i].Pb=Pb[i];
+    stack[i].Fa=Fa[i];
+    stack[i].Fb=Fb[i];
+    stack[i].err=arma::vectorise(err[i]);
+    stack[i].E=E[i];
+  }
+  read_state(chkpt,grp,stack.size());
 }
 
 arma::vec rDIIS::get_energies() const {
@@ -191,12 +522,6 @@ arma::vec rDIIS::get_energies() const {
   return E;
 }
 
-arma::mat rDIIS::get_diis_error() const {
-  arma::mat err(stack[0].err.n_elem,stack.size());
-  for(size_t i=0;i<stack.size();i++)
-    err.col(i)=stack[i].err;
-  return err;
-}
 
 arma::vec uDIIS::get_energies() const {
   arma::vec E(stack.size());
@@ -204,17 +529,10 @@ arma::vec uDIIS::get_energies() const {
     E(i)=stack[i].E;
   return E;
 }
-arma::mat uDIIS::get_diis_error() const {
-  arma::mat err(stack[0].err.n_elem,stack.size());
-  for(size_t i=0;i<stack.size();i++)
-    err.col(i)=stack[i].err;
-  return err;
-}
 
 arma::vec DIIS::get_w() {
   // DIIS error
-  arma::mat de=get_diis_error();
-  double err=arma::max(arma::abs(de.col(de.n_cols-1)));
+  double err=last_error;
 
   // Weight
   arma::vec w;
@@ -239,11 +557,19 @@ arma::vec DIIS::get_w() {
   } else if(useadiis && usediis) {
     // Sliding scale: DIIS weight
     double diisw=std::max(std::min(1.0 - (err-diisthr)/(diiseps-diisthr), 1.0), 0.0);
+    if(adiis_stop) {
+      if(err<diisthr)
+        diis_only=true;
+      if(diis_only)
+        diisw=1.0;
+    }
     // ADIIS weght
     double adiisw=1.0-diisw;
 
     // Determine cooloff
-    if(cooloff>0) {
+    if(diis_only) {
+      // ADIIS has been switched off
+    } else if(cooloff>0) {
       diisw=0.0;
       cooloff--;
     } else {
@@ -255,7 +581,7 @@ arma::vec DIIS::get_w() {
       }
     }
 
-    w.zeros(de.n_cols);
+    w.zeros(B.n_cols);
 
     // DIIS and ADIIS weights
     arma::vec wd, wa;
@@ -290,22 +616,12 @@ arma::vec DIIS::get_w() {
 }
 
 arma::vec DIIS::get_w_diis() const {
-  arma::mat errs=get_diis_error();
-  return get_w_diis_wrk(errs);
+  return get_w_diis_wrk(B);
 }
 
-arma::vec DIIS::get_w_diis_wrk(const arma::mat & errs) const {
+arma::vec DIIS::get_w_diis_wrk(const arma::mat & Berr) const {
   // Size of LA problem
-  int N=(int) errs.n_cols;
-
-  // Array holding the errors
-  arma::mat B(N,N);
-  B.zeros();
-  // Compute errors
-  for(int i=0;i<N;i++)
-    for(int j=0;j<N;j++) {
-      B(i,j)=arma::dot(errs.col(i),errs.col(j));
-    }
+  int N=(int) Berr.n_cols;
 
   /*
     The C1-DIIS method is equivalent to solving the group of linear
@@ -334,7 +650,7 @@ arma::vec DIIS::get_w_diis_wrk(const arma::mat & errs) const {
   // Singular value decomposition
   arma::mat U, V;
   arma::vec sval;
-  if(!arma::svd(U,sval,V,B,"std")) {
+  if(!arma::svd(U,sval,V,Berr,"std")) {
     throw std::logic_error("SVD failed in DIIS.\n");
   }
   //sval.print("Singular values");
@@ -384,9 +700,24 @@ void rDIIS::solve_F(arma::mat & F) {
   }
 
   // Form weighted Fock matrix
-  F.zeros();
+  arma::mat Fp(arma::zeros<arma::mat>(stack[0].F.n_rows,stack[0].F.n_cols));
   for(size_t i=0;i<stack.size();i++)
-    F+=sol(i)*stack[i].F;
+    Fp+=sol(i)*stack[i].F;
+  F=unpack(Fp);
+}
+
+void rDIIS::solve_F(arma::cube & F) {
+  arma::mat Fs(stack_blocks(F));
+  solve_F(Fs);
+  unstack_blocks(Fs,F);
+}
+
+void uDIIS::solve_F(arma::cube & Fa, arma::cube & Fb) {
+  arma::mat Fas(stack_blocks(Fa));
+  arma::mat Fbs(stack_blocks(Fb));
+  solve_F(Fas,Fbs);
+  unstack_blocks(Fas,Fa);
+  unstack_blocks(Fbs,Fb);
 }
 
 void uDIIS::solve_F(arma::mat & Fa, arma::mat & Fb) {
@@ -402,12 +733,14 @@ void uDIIS::solve_F(arma::mat & Fa, arma::mat & Fb) {
   }
 
   // Form weighted Fock matrix
-  Fa.zeros();
-  Fb.zeros();
+  arma::mat Fap(arma::zeros<arma::mat>(stack[0].Fa.n_rows,stack[0].Fa.n_cols));
+  arma::mat Fbp(arma::zeros<arma::mat>(stack[0].Fb.n_rows,stack[0].Fb.n_cols));
   for(size_t i=0;i<stack.size();i++) {
-    Fa+=sol(i)*stack[i].Fa;
-    Fb+=sol(i)*stack[i].Fb;
+    Fap+=sol(i)*stack[i].Fa;
+    Fbp+=sol(i)*stack[i].Fb;
   }
+  Fa=unpack(Fap);
+  Fb=unpack(Fbp);
 }
 
 void rDIIS::solve_P(arma::mat & P) {
@@ -423,9 +756,10 @@ void rDIIS::solve_P(arma::mat & P) {
   }
 
   // Form weighted density matrix
-  P.zeros();
+  arma::mat Pp(arma::zeros<arma::mat>(stack[0].P.n_rows,stack[0].P.n_cols));
   for(size_t i=0;i<stack.size();i++)
-    P+=sol(i)*stack[i].P;
+    Pp+=sol(i)*stack[i].P;
+  P=unpack(Pp);
 }
 
 void uDIIS::solve_P(arma::mat & Pa, arma::mat & Pb) {
@@ -441,12 +775,14 @@ void uDIIS::solve_P(arma::mat & Pa, arma::mat & Pb) {
   }
 
   // Form weighted density matrix
-  Pa.zeros();
-  Pb.zeros();
+  arma::mat Pap(arma::zeros<arma::mat>(stack[0].Pa.n_rows,stack[0].Pa.n_cols));
+  arma::mat Pbp(arma::zeros<arma::mat>(stack[0].Pb.n_rows,stack[0].Pb.n_cols));
   for(size_t i=0;i<stack.size();i++) {
-    Pa+=sol(i)*stack[i].Pa;
-    Pb+=sol(i)*stack[i].Pb;
+    Pap+=sol(i)*stack[i].Pa;
+    Pbp+=sol(i)*stack[i].Pb;
   }
+  Pa=unpack(Pap);
+  Pb=unpack(Pbp);
 }
 
 static void find_minE(const std::vector< std::pair<double,double> > & steps, double & Emin, size_t & imin) {
@@ -489,7 +825,7 @@ static arma::mat compute_jac(const arma::vec & x) {
   return jac;
 }
 
-arma::vec DIIS::get_w_adiis() const {
+arma::vec DIIS::get_w_adiis() {
   // Number of parameters
   size_t N=PiF.n_elem;
 
@@ -497,11 +833,25 @@ arma::vec DIIS::get_w_adiis() const {
     // Trivial case.
     arma::vec ret(1);
     ret.ones();
+    adiis_w=ret;
     return ret;
   }
 
-  // Starting point: equal weights on all matrices
-  arma::vec x=arma::ones<arma::vec>(N)/N;
+  // Starting point: the previous weights, with half of the weight on
+  // the newest matrix. The coefficients are the squares of x, so none
+  // of them may vanish.
+  arma::vec c0;
+  if(adiis_w.n_elem==N) {
+    c0=adiis_w;
+  } else if(adiis_w.n_elem+1==N) {
+    c0.zeros(N);
+    c0.subvec(0,N-2)=0.5*adiis_w;
+    c0(N-1)=0.5;
+  } else
+    c0=arma::ones<arma::vec>(N)/N;
+  c0=arma::clamp(c0,1e-4,1.0);
+  c0/=arma::sum(c0);
+  arma::vec x=arma::sqrt(c0);
 
   // BFGS accelerator
   LBFGS bfgs;
@@ -613,7 +963,8 @@ arma::vec DIIS::get_w_adiis() const {
   }
 
   // Calculate weights
-  return compute_c(x);
+  adiis_w=compute_c(x);
+  return adiis_w;
 }
 
 double DIIS::get_E_adiis(const arma::vec & x) const {
@@ -19,8 +19,11 @@
 #define ERKALE_DIIS
 
 #include <armadillo>
+#include <string>
 #include <vector>
 
+class Checkpoint;
+
 /// Spin-polarized entry
 typedef struct {
   /// Alpha density matrix
@@ -34,7 +37,7 @@ typedef struct {
   /// Energy
   double E;
 
-  /// DIIS error matrix
+  /// DIIS error matrix, upper triangle of the antisymmetric matrix
   arma::vec err;
 } diis_pol_entry_t;
 
@@ -47,7 +50,7 @@ typedef struct {
   /// Energy
   double E;
 
-  /// DIIS error matrix
+  /// DIIS error matrix, upper triangle of the antisymmetric matrix
   arma::vec err;
 } diis_unpol_entry_t;
 
@@ -101,7 +104,12 @@ bool operator<(const diis_unpol_entry_t & lhs, const diis_unpol_entry_t & rhs);
 
 class DIIS {
  protected:
-  /// Overlap matrix
+  /**
+   * Overlap matrix. The matrices passed to DIIS may also be
+   * block-diagonal with all blocks having this overlap. In that case
+   * only the diagonal blocks are stored, side by side, and the errors
+   * and trace products are computed block by block.
+   */
   arma::mat S;
   /// Half-inverse overlap matrix
   arma::mat Sinvh;
@@ -124,11 +132,27 @@ class DIIS {
   size_t imax;
   /// Get energies
   virtual arma::vec get_energies() const=0;
-  /// Get errors
-  virtual arma::mat get_diis_error() const=0;
   /// Reduce size of stack by one
   virtual void erase_last()=0;
 
+  /// Error of the latest entry
+  double last_error;
+  /// Inner products of the error vectors, updated one row at a time
+  arma::mat B;
+  /// Trace products tr(P_i F_j), summed over spin; updated one row and column at a time
+  arma::mat PF;
+  /// Drop the oldest entry from B and PF
+  void erase_tables();
+  /// Form PiF and PiFj from the trace products
+  void PiF_update();
+
+  /// ADIIS weights of the previous solution, used as the starting point
+  arma::vec adiis_w;
+  /// Stop using ADIIS for good once DIIS has taken over?
+  bool adiis_stop;
+  /// Has DIIS taken over?
+  bool diis_only;
+
   // Helpers for speeding up ADIIS evaluation
   /// < P_i - P_n | F(D_n) >   or   < Pa_i - Pa_n | Fa(P_n) > + < Pb_i - Pb_n | Fb(P_n) >
   arma::vec PiF;
@@ -139,14 +163,44 @@ class DIIS {
   arma::vec get_w();
   /// Compute DIIS weights
   arma::vec get_w_diis() const;
-  /// Compute DIIS weights, worker routine
-  arma::vec get_w_diis_wrk(const arma::mat & err) const;
-  /// Compute ADIIS weights
-  arma::vec get_w_adiis() const;
+  /// Compute DIIS weights from the error inner product matrix, worker routine
+  arma::vec get_w_diis_wrk(const arma::mat & Berr) const;
+  /// Compute ADIIS weights, starting from the previous solution
+  arma::vec get_w_adiis();
 
   /// Solve coefficients
   arma::vec get_c_adiis(bool verbose=false) const;
 
+  /// Are the matrices given in the orthonormal basis, so that S = 1?
+  bool orthonormal;
+  /// Orthonormal-basis error vector of FPS - SPF, computed block by block
+  arma::vec error_vector(const arma::mat & F, const arma::mat & P) const;
+
+  /**
+   * Basis functions in each symmetry block. When these are set, the
+   * matrices are assumed to be block diagonal in the symmetries, and
+   * only their diagonal blocks are stored, packed one after the
+   * other into a single column.
+   */
+  std::vector<arma::uvec> sym_idx;
+  /// Orthogonalizing block of each symmetry
+  std::vector<arma::mat> sym_X;
+  /// Offsets of the packed symmetry blocks
+  std::vector<size_t> sym_off;
+  /// Column-major offsets in the full matrix of the packed elements
+  arma::uvec sym_gather;
+  /// Pack the diagonal symmetry blocks of a matrix
+  arma::mat pack(const arma::mat & M) const;
+  /// Unpack the symmetry blocks into a full matrix
+  arma::mat unpack(const arma::mat & M) const;
+  /// tr(A B) of stored matrices
+  double trace(const arma::mat & A, const arma::mat & B) const;
+
+  /// Save the state shared by the spin-restricted and unrestricted variants
+  void write_state(Checkpoint & chkpt, const std::string & grp) const;
+  /// Load the state shared by the spin-restricted and unrestricted variants
+  void read_state(Checkpoint & chkpt, const std::string & grp, size_t nstack);
+
  public:
   /// Constructor
   DIIS(const arma::mat & S, const arma::mat & Sinvh, bool usediis, double diiseps, double diisthr, bool useadiis, bool verbose, size_t imax);
@@ -155,6 +209,22 @@ class DIIS {
 
   /// Clear Fock matrices and errors
   virtual void clear()=0;
+  /// Stop using ADIIS once the error has fallen below diisthr, even if it rises again
+  void set_adiis_stop(bool stop);
+  /**
+   * Only store the diagonal blocks of the matrices in the given
+   * symmetries, e.g. the m values of a diatomic calculation. This
+   * must be called before any matrices have been added.
+   */
+  void set_symmetry_blocks(const std::vector<arma::uvec> & idx);
+  /**
+   * The Fock and density matrices are given in the orthonormal basis,
+   * so the error is FP - PF and no transformations are done. The
+   * overlap and orthogonalizing matrices passed to the constructor
+   * are then unit matrices. This must be called before any matrices
+   * have been added.
+   */
+  void set_orthonormal(bool orth);
 
   /// Compute energy with contraction coefficients \f$ c_i = x_i^2 / \left[ \sum_j x_j^2 \right] \f$
   double get_E_adiis(const arma::vec & x) const;
@@ -169,12 +239,8 @@ class rDIIS: protected DIIS {
 
   /// Get energies
   arma::vec get_energies() const;
-  /// Get errors
-  arma::mat get_diis_error() const;
   /// Reduce size of stack by one
   void erase_last();
-  /// ADIIS update
-  void PiF_update();
 
  public:
   /// Constructor
@@ -184,15 +250,27 @@ class rDIIS: protected DIIS {
 
   /// Add matrices to stack
   void update(const arma::mat & F, const arma::mat & P, double E, double & error);
+  /// Add block-diagonal matrices to stack, given as cubes of the diagonal blocks
+  void update(const arma::cube & F, const arma::cube & P, double E, double & error);
 
   /// Compute new Fock matrix
   void solve_F(arma::mat & F);
+  /// Compute new block-diagonal Fock matrix
+  void solve_F(arma::cube & F);
 
   /// Compute new density matrix
   void solve_P(arma::mat & P);
 
   /// Clear Fock matrices and errors
   void clear();
+
+  /// Save the history in the group grp of the checkpoint
+  void save(Checkpoint & chkpt, const std::string & grp) const;
+  /// Load the history from the group grp of the checkpoint
+  void load(Checkpoint & chkpt, const std::string & grp);
+
+  using DIIS::set_adiis_stop;
+  using DIIS::set_symmetry_blocks;
 };
 
 /// Spin-unrestricted DIIS
@@ -202,12 +280,8 @@ class uDIIS: protected DIIS {
 
   /// Get energies
   arma::vec get_energies() const;
-  /// Get errors
-  arma::mat get_diis_error() const;
   /// Reduce size of stack by one
   void erase_last();
-  /// ADIIS update
-  void PiF_update();
 
   /// Combine alpha and beta errors?
   bool combine;
@@ -220,15 +294,27 @@ class uDIIS: protected DIIS {
 
   /// Add matrices to stack
   void update(const arma::mat & Fa, const arma::mat & Fb, const arma::mat & Pa, const arma::mat & Pb, double E, double & error);
+  /// Add block-diagonal matrices to stack, given as cubes of the diagonal blocks
+  void update(const arma::cube & Fa, const arma::cube & Fb, const arma::cube & Pa, const arma::cube & Pb, double E, double & error);
 
   /// Compute new Fock matrix
   void solve_F(arma::mat & Fa, arma::mat & Fb);
+  /// Compute new block-diagonal Fock matrices
+  void solve_F(arma::cube & Fa, arma::cube & Fb);
 
   /// Compute new density matrix
   void solve_P(arma::mat & Pa, arma::mat & Pb);
 
   /// Clear Fock matrices and errors
   void clear();
+
+  /// Save the history in the group grp of the checkpoint
+  void save(Checkpoint & chkpt, const std::string & grp) const;
+  /// Load the history from the group grp of the checkpoint
+  void load(Checkpoint & chkpt, const std::string & grp);
+
+  using DIIS::set_adiis_stop;
+  using DIIS::set_symmetry_blocks;
 };
 
 #endif
@@ -16,19 +16,14 @@
 #include <cstdio>
 #include <cmath>
 #include "gaunt.h"
+#include "lobatto.h"
+#include "spherical_harmonics.h"
 
 extern "C" {
   // 3j symbols
 #include <gsl/gsl_sf_coupling.h>
 }
 
-/// Index of (l,m) in tables: l^2 + l + m
-#define genind(l,m) ( ((size_t) (l))*(size_t (l)) + (size_t) (l) + (size_t) (m))
-/// Index of (l,m) in m limited table
-#define LMind(L,M) ( ((size_t) (L))*(size_t (2*Mmax+1)) + (size_t) (Mmax) + (size_t) (M))
-#define lmind(L,M) ( ((size_t) (L))*(size_t (2*mmax+1)) + (size_t) (mmax) + (size_t) (M))
-#define lpmpind(L,M) ( ((size_t) (L))*(size_t (2*mpmax+1)) + (size_t) (mpmax) + (size_t) (M))
-
 namespace helfem {
   namespace gaunt {
 
@@ -67,88 +62,72 @@ namespace helfem {
       return const0*cpl0+const2*cpl2;
     }
 
-    Gaunt::Gaunt() {
+    Gaunt::Gaunt() : Lmax(-1), lmax(-1), lpmax(-1), Mmax(-1), mmax(-1), mpmax(-1) {
     }
 
-    Gaunt::Gaunt(int Lmax, int lmax, int lpmax) {
-      // Allocate storage
-      mlimit=false;
-      table=arma::cube(genind(Lmax,Lmax)+1,genind(lmax,lmax)+1,genind(lpmax,lpmax)+1);
-
-      // Compute coefficients
-#ifdef _OPENMP
-#pragma omp parallel for collapse(3)
-#endif
-      for(int L=0;L<=Lmax;L++)
-	  for(int l=0;l<=lmax;l++)
-            for(int lp=0;lp<=lpmax;lp++)
-              for(int M=-L;M<=L;M++)
-                for(int m=-l;m<=l;m++)
-                  for(int mp=-lp;mp<=lp;mp++)
-                    table(genind(L,M),genind(l,m),genind(lp,mp))=gaunt_coefficient(L,M,l,m,lp,mp);
+    Gaunt::Gaunt(int Lmax_, int lmax_, int lpmax_) : Lmax(Lmax_), lmax(lmax_), lpmax(lpmax_), Mmax(Lmax_), mmax(lmax_), mpmax(lpmax_) {
+      compute();
     }
 
-    Gaunt::Gaunt(int Lmax, int Mmax_, int lmax, int mmax_, int lpmax, int mpmax_) : Mmax(Mmax_), mmax(mmax_), mpmax(mpmax_) {
-      // Allocate storage
-      mlimit=true;
-      table=arma::cube(LMind(Lmax,Mmax)+1,lmind(lmax,mmax)+1,lpmpind(lpmax,mpmax)+1);
-
-      // Compute coefficients
-#ifdef _OPENMP
-#pragma omp parallel for collapse(3)
-#endif
-      for(int L=0;L<=Lmax;L++)
-	  for(int l=0;l<=lmax;l++)
-            for(int lp=0;lp<=lpmax;lp++)
-              for(int M=-Mmax;M<=Mmax;M++)
-                for(int m=-mmax;m<=mmax;m++)
-                  for(int mp=-mpmax;mp<=mpmax;mp++)
-                    table(LMind(L,M),lmind(l,m),lpmpind(lp,mp))=gaunt_coefficient(L,M,l,m,lp,mp);
+    Gaunt::Gaunt(int Lmax_, int Mmax_, int lmax_, int mmax_, int lpmax_, int mpmax_) : Lmax(Lmax_), lmax(lmax_), lpmax(lpmax_), Mmax(Mmax_), mmax(mmax_), mpmax(mpmax_) {
+      compute();
     }
 
     Gaunt::~Gaunt() {
     }
 
-    double Gaunt::coeff(int L, int M, int l, int m, int lp, int mp) const {
-      if(std::abs(M)>L) return 0.0;
-      if(std::abs(m)>l) return 0.0;
-      if(std::abs(mp)>lp) return 0.0;
-
-      size_t irow, icol, islice;
-      if(mlimit) {
-        irow=LMind(L,M);
-        icol=lmind(l,m);
-        islice=lpmpind(lp,mp);
-      } else {
-        irow=genind(L,M);
-        icol=genind(l,m);
-        islice=genind(lp,mp);
-      }
-
-#ifndef ARMA_NO_DEBUG
-      if(irow>table.n_rows) {
-        std::ostringstream oss;
-        oss << "Row index overflow for coeff(" << L << "," << M << "," << l << "," << m << "," << lp << "," << mp << ")!\n";
-        oss << "Wanted element at (" << irow << "," << icol << "," << islice << ") but table is " << table.n_rows << " x " << table.n_cols << " x " << table.n_slices << "\n";
-        throw std::logic_error(oss.str());
-      }
-
-      if(icol>table.n_cols) {
-        std::ostringstream oss;
-        oss << "Column index overflow for coeff(" << L << "," << M << "," << l << "," << m << "," << lp << "," << mp << ")!\n";
-        oss << "Wanted element at (" << irow << "," << icol << "," << islice << ") but table is " << table.n_rows << " x " << table.n_cols << " x " << table.n_slices << "\n";
-        throw std::logic_error(oss.str());
-      }
+    void Gaunt::compute() {
+      // Lay out the allowed (L, l, l') blocks
+      offset.assign(triplet(Lmax,lmax,lpmax)+1,0);
+      std::vector<size_t> blocks;
+      size_t ntot=0;
+      for(int L=0;L<=Lmax;L++)
+        for(int l=0;l<=lmax;l++)
+          for(int lp=std::abs(L-l);lp<=std::min(L+l,lpmax);lp+=2) {
+            size_t idx(triplet(L,l,lp));
+            offset[idx]=ntot;
+            blocks.push_back(idx);
+            ntot+=(2*std::min(l,mmax)+1)*(2*std::min(lp,mpmax)+1);
+          }
+      table.zeros(ntot);
+
+      /*
+        At phi=0 the spherical harmonics are real, and the phi
+        integral just enforces M = m + m'. The remaining integrand is
+        a polynomial of degree L+l+l' in cos th, which an n point
+        Gauss-Lobatto rule integrates exactly for 2n-3 >= L+l+l'.
+      */
+      const LobattoRule & rule(lobatto_rule((Lmax+lmax+lpmax)/2+2));
+      int ltot(std::max(Lmax,std::max(lmax,lpmax)));
+      arma::mat ylm(arma::real(spherical_harmonics_all(ltot,rule.x,arma::zeros<arma::vec>(rule.x.n_elem))));
+      // Fold in the weights for the coupled function
+      arma::mat wylm(ylm*arma::diagmat(2.0*M_PI*rule.w));
 
-      if(islice>table.n_slices) {
-        std::ostringstream oss;
-        oss << "Slice index overflow for coeff(" << L << "," << M << "," << l << "," << m << "," << lp << "," << mp << ")!\n";
-        oss << "Wanted element at (" << irow << "," << icol << "," << islice << ") but table is " << table.n_rows << " x " << table.n_cols << " x " << table.n_slices << "\n";
-        throw std::logic_error(oss.str());
-      }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
 #endif
+      for(size_t ib=0;ib<blocks.size();ib++) {
+        size_t idx(blocks[ib]);
+        int lp=idx%(lpmax+1);
+        int l=(idx/(lpmax+1))%(lmax+1);
+        int L=idx/((lpmax+1)*(lmax+1));
+
+        int mb(std::min(l,mmax));
+        int mpb(std::min(lp,mpmax));
+        size_t ioff(offset[idx]);
+        for(int m=-mb;m<=mb;m++)
+          for(int mp=-mpb;mp<=mpb;mp++) {
+            int M(m+mp);
+            if(std::abs(M)>L)
+              continue;
+            arma::rowvec cpl(wylm.row(spherical_harmonics_index(L,M)) % ylm.row(spherical_harmonics_index(l,m)));
+            table(ioff+(m+mb)*(2*mpb+1)+mp+mpb)=arma::dot(cpl,ylm.row(spherical_harmonics_index(lp,mp)));
+          }
+      }
+    }
 
-      return table(irow,icol,islice);
+    size_t Gaunt::size() const {
+      return table.n_elem;
     }
 
     double Gaunt::cosine_coupling(int lj, int mj, int li, int mi) const {
@@ -17,6 +17,9 @@
 #define GAUNT
 
 #include <armadillo>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
 
 namespace helfem {
   namespace gaunt {
@@ -29,15 +32,31 @@ namespace helfem {
     /// Get "modified" Gaunt coefficient (interim coupling through cos^2)
     double modified_gaunt_coefficient(int L, int M, int l, int m, int lp, int mp);
 
-    /// Table of Gaunt coefficients
+    /**
+     * Table of Gaunt coefficients. Only the couplings allowed by the
+     * selection rules are stored: each (L, l, l') triplet satisfying
+     * the triangle and parity rules holds a block over (m, m'), since
+     * M = m + m' is fixed. The coefficients are obtained by exact
+     * Gauss-Lobatto quadrature over recurrence-generated spherical
+     * harmonics.
+     */
     class Gaunt {
       /// Table of coefficients
-      arma::cube table;
-      /// Limited m set
-      bool mlimit;
+      arma::vec table;
+      /// Offset of the (L, l, l') blocks in the table
+      std::vector<size_t> offset;
+      /// Maximum l values
+      int Lmax, lmax, lpmax;
       /// Maximum m values
       int Mmax, mmax, mpmax;
 
+      /// Index of (L, l, l') block
+      size_t triplet(int L, int l, int lp) const {
+        return (((size_t) L)*(lmax+1) + l)*(lpmax+1) + lp;
+      }
+      /// Compute the table
+      void compute();
+
     public:
       /// Dummy constructor
       Gaunt();
@@ -48,6 +67,9 @@ namespace helfem {
       /// Destructor
       ~Gaunt();
 
+      /// Number of stored coefficients
+      size_t size() const;
+
       /// Get Gaunt coefficient
       double coeff(int L, int M, int l, int m, int lp, int mp) const;
       /// Get "modified" Gaunt coefficient (interim coupling through cos^2)
@@ -69,6 +91,26 @@ namespace helfem {
       /// Get cosine^2 sine^2 type coupling
       double cosine2_sine2_coupling(int lj, int mj, int li, int mi) const;
     };
+
+    inline double Gaunt::coeff(int L, int M, int l, int m, int lp, int mp) const {
+      // Selection rules
+      if(M != m+mp || std::abs(M)>L || std::abs(m)>l || std::abs(mp)>lp || L<std::abs(l-lp) || L>l+lp || (L+l+lp)%2)
+        return 0.0;
+
+#ifndef ARMA_NO_DEBUG
+      if(L>Lmax || l>lmax || lp>lpmax || std::abs(M)>Mmax || std::abs(m)>mmax || std::abs(mp)>mpmax) {
+        std::ostringstream oss;
+        oss << "Index overflow for coeff(" << L << "," << M << "," << l << "," << m << "," << lp << "," << mp << ")!\n";
+        oss << "Table has Lmax=" << Lmax << ", Mmax=" << Mmax << ", lmax=" << lmax << ", mmax=" << mmax << ", lpmax=" << lpmax << ", mpmax=" << mpmax << "\n";
+        throw std::logic_error(oss.str());
+      }
+#endif
+
+      // m ranges in the block
+      int mb(std::min(l,mmax));
+      int mpb(std::min(lp,mpmax));
+      return table[offset[triplet(L,l,lp)] + (size_t) ((m+mb)*(2*mpb+1) + mp+mpb)];
+    }
   }
 }
 
@@ -1653,5 +1653,19 @@ int main(void) {
   val=helfem::gaunt::modified_gaunt_coefficient(10,0,4,0,4,0);
   ref=5.8774027291321862e-02;
   if(std::abs(val-ref)>=DBL_EPSILON*(1.0+std::abs(ref))) printf("mod_coeff(10,0,4,0,4,0) value %e reference %e error %e\n",val,ref,val-ref);
+  // Compare the table against the direct evaluation
+  {
+    const int lmax=6;
+    helfem::gaunt::Gaunt table(2*lmax,lmax,lmax);
+    double maxerr=0.0;
+    for(int L=0;L<=2*lmax;L++)
+      for(int M=-L;M<=L;M++)
+        for(int l=0;l<=lmax;l++)
+          for(int m=-l;m<=l;m++)
+            for(int lp=0;lp<=lmax;lp++)
+              for(int mp=-lp;mp<=lp;mp++)
+                maxerr=std::max(maxerr,std::abs(table.coeff(L,M,l,m,lp,mp)-helfem::gaunt::gaunt_coefficient(L,M,l,m,lp,mp)));
+    if(maxerr>=1e-13) printf("Gaunt table maximum error %e\n",maxerr);
+  }
 return 0;
 }
@@ -0,0 +1,210 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "cmdline.h"
+#include "timer.h"
+#include "gaunt.h"
+#include "PolynomialBasis.h"
+#include "FiniteElementBasis.h"
+#include "RadialBasis.h"
+#include "chebyshev.h"
+#include "lobatto.h"
+#include <helfem.h>
+#include <functional>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace helfem;
+
+/// Result of a single benchmark
+typedef struct {
+  /// Kernel name
+  std::string kernel;
+  /// Parameters of the run
+  std::string params;
+  /// Number of repetitions
+  size_t nrep;
+  /// Time per call in seconds
+  double tcall;
+  /// Work units per call
+  double work;
+  /// Unit of work
+  std::string unit;
+} bench_t;
+
+/// Collected results
+static std::vector<bench_t> results;
+/// Minimum time spent on each benchmark
+static double mintime;
+
+/// Run the kernel repeatedly until at least mintime has elapsed
+static void run_bench(const std::string & kernel, const std::string & params, double work, const std::string & unit, const std::function<void()> & f) {
+  // Warm-up call, which also fills any caches
+  f();
+
+  bench_t b;
+  b.kernel=kernel;
+  b.params=params;
+  b.work=work;
+  b.unit=unit;
+  b.nrep=0;
+
+  Timer t;
+  size_t nbatch=1;
+  while(true) {
+    for(size_t i=0;i<nbatch;i++)
+      f();
+    b.nrep+=nbatch;
+    if(t.get()>=mintime)
+      break;
+    nbatch*=2;
+  }
+  b.tcall=t.get()/b.nrep;
+  results.push_back(b);
+
+  printf("%-24s %-28s %10zu %12.3e %12.3e %s/s\n",kernel.c_str(),params.c_str(),b.nrep,b.tcall,b.work/b.tcall,unit.c_str());
+  fflush(stdout);
+}
+
+/// Write out results as CSV, or as JSON if the file name ends in .json
+static void write_results(const std::string & fname) {
+  bool json(fname.size()>=5 && fname.compare(fname.size()-5,5,".json")==0);
+  FILE *out=fopen(fname.c_str(),"w");
+  if(!out)
+    throw std::runtime_error("Error opening benchmark output " + fname + "\n");
+
+  int nthreads=1;
+#ifdef _OPENMP
+  nthreads=omp_get_max_threads();
+#endif
+
+  if(json) {
+    fprintf(out,"{\n  \"version\": \"%s\",\n  \"compiler\": \"%s\",\n  \"threads\": %i,\n  \"results\": [\n",helfem::version().c_str(),__VERSION__,nthreads);
+    for(size_t i=0;i<results.size();i++)
+      fprintf(out,"    {\"kernel\": \"%s\", \"params\": \"%s\", \"nrep\": %zu, \"time\": %.9e, \"work\": %.9e, \"unit\": \"%s\", \"throughput\": %.9e}%s\n",results[i].kernel.c_str(),results[i].params.c_str(),results[i].nrep,results[i].tcall,results[i].work,results[i].unit.c_str(),results[i].work/results[i].tcall,(i+1<results.size()) ? "," : "");
+    fprintf(out,"  ]\n}\n");
+  } else {
+    fprintf(out,"# version %s, compiler %s, %i threads\n",helfem::version().c_str(),__VERSION__,nthreads);
+    fprintf(out,"kernel,params,nrep,time,work,unit,throughput\n");
+    for(size_t i=0;i<results.size();i++)
+      fprintf(out,"%s,\"%s\",%zu,%.9e,%.9e,%s,%.9e\n",results[i].kernel.c_str(),results[i].params.c_str(),results[i].nrep,results[i].tcall,results[i].work,results[i].unit.c_str(),results[i].work/results[i].tcall);
+  }
+  fclose(out);
+}
+
+/// Form the parameter string
+static std::string param_string(const char * fmt, int a, int b, int c=-1) {
+  char str[128];
+  snprintf(str,sizeof(str),fmt,a,b,c);
+  return std::string(str);
+}
+
+int main(int argc, char **argv) {
+  cmdline::parser parser;
+  parser.add<int>("primbas", 0, "highest primitive basis to benchmark (3-11)", false, 5);
+  parser.add<int>("maxnodes", 0, "maximum number of nodes per element", false, 15);
+  parser.add<int>("nnodes", 0, "number of nodes in radial integral benchmarks", false, 15);
+  parser.add<int>("nelem", 0, "number of elements in radial integral benchmarks", false, 10);
+  parser.add<int>("nquad", 0, "number of quadrature points", false, 0);
+  parser.add<int>("Lmax", 0, "maximum L for two-electron integrals", false, 4);
+  parser.add<int>("lmax", 0, "maximum l for Gaunt table", false, 10);
+  parser.add<double>("lambda", 0, "range separation parameter", false, 0.4);
+  parser.add<double>("mintime", 0, "minimum time spent on each benchmark in seconds", false, 0.2);
+  parser.add<std::string>("output", 0, "output file, JSON if name ends in .json, CSV otherwise", false, "helfem_bench.csv");
+  parser.parse_check(argc, argv);
+
+  int maxprim(parser.get<int>("primbas"));
+  int maxnodes(parser.get<int>("maxnodes"));
+  int nnodes(parser.get<int>("nnodes"));
+  int nelem(parser.get<int>("nelem"));
+  int nquad(parser.get<int>("nquad"));
+  int Lmax(parser.get<int>("Lmax"));
+  int lmax(parser.get<int>("lmax"));
+  double lambda(parser.get<double>("lambda"));
+  mintime=parser.get<double>("mintime");
+  std::string output(parser.get<std::string>("output"));
+
+  printf("%-24s %-28s %10s %12s %12s %s\n","kernel","parameters","nrep","t/call","throughput","unit");
+
+  // Lobatto rules
+  for(int n=2;n<=maxnodes;n++) {
+    arma::vec x, w;
+    run_bench("lobatto_compute", param_string("n=%i",n,0), 1.0, "rules", [n, &x, &w]() { ::lobatto_compute(n,x,w); });
+  }
+
+  // Polynomial basis evaluation on a Chebyshev grid
+  for(int primbas=3;primbas<=maxprim;primbas++)
+    for(int n=2;n<=maxnodes;n++) {
+      std::shared_ptr<const polynomial_basis::PolynomialBasis> poly;
+      try {
+        poly=std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(primbas,n));
+      } catch(std::exception &) {
+        continue;
+      }
+      int nq(nquad>0 ? nquad : 5*n);
+      arma::vec xq, wq;
+      chebyshev::chebyshev(nq,xq,wq);
+      for(int der=0;der<=2;der++) {
+        arma::mat dnf;
+        run_bench("eval_dnf", param_string("primbas=%i n=%i der=%i",primbas,n,der), xq.n_elem*poly->get_nbf(), "values", [&poly, &xq, &dnf, der]() { dnf=poly->eval_dnf(xq,der,1.0); });
+      }
+    }
+
+  // Radial integrals
+  std::shared_ptr<const polynomial_basis::PolynomialBasis> poly(polynomial_basis::get_basis(4,nnodes));
+  int nq(nquad>0 ? nquad : 5*nnodes);
+  arma::vec bval(arma::linspace<arma::vec>(0.0,40.0,nelem+1));
+  polynomial_basis::FiniteElementBasis fem(poly, bval, true, false, true, false);
+
+  {
+    arma::vec xq, wq;
+    chebyshev::chebyshev(nq,xq,wq);
+    std::function<double(double)> pot=[](double r) { return 1.0/(1.0+r); };
+    arma::mat S, V, T;
+    run_bench("matrix_element", param_string("overlap nel=%i n=%i",nelem,nnodes), fem.get_nbf(), "functions", [&]() { S=fem.matrix_element(0,0,xq,wq,nullptr); });
+    run_bench("matrix_element", param_string("potential nel=%i n=%i",nelem,nnodes), fem.get_nbf(), "functions", [&]() { V=fem.matrix_element(0,0,xq,wq,pot); });
+    run_bench("matrix_element", param_string("kinetic nel=%i n=%i",nelem,nnodes), fem.get_nbf(), "functions", [&]() { T=fem.matrix_element(1,1,xq,wq,nullptr); });
+  }
+
+  atomic::basis::RadialBasis radial(fem, nq, poly->get_nprim()-1);
+  for(int L=0;L<=Lmax;L++) {
+    arma::mat tei;
+    double nprim(radial.Nprim(0));
+    run_bench("twoe_integral", param_string("L=%i nel=%i n=%i",L,nelem,nnodes), radial.Nel()*std::pow(nprim,4), "integrals", [&]() {
+        for(size_t iel=0;iel<radial.Nel();iel++)
+          tei=radial.twoe_integral(L,iel);
+      });
+  }
+  for(int L=0;L<=Lmax;L++) {
+    arma::mat tei;
+    double nprim(radial.Nprim(0));
+    run_bench("erfc_integral", param_string("L=%i nel=%i n=%i",L,nelem,nnodes), radial.Nel()*radial.Nel()*std::pow(nprim,4), "integrals", [&]() {
+        for(size_t iel=0;iel<radial.Nel();iel++)
+          for(size_t jel=0;jel<radial.Nel();jel++)
+            tei=radial.erfc_integral(L,lambda,iel,jel);
+      });
+  }
+
+  // Gaunt table
+  for(int l=2;l<=lmax;l+=2) {
+    run_bench("gaunt_table", param_string("Lmax=%i lmax=%i",2*l,l), 1.0, "tables", [l]() { gaunt::Gaunt gaunt(2*l,l,l); });
+  }
+
+  write_results(output);
+  printf("\nResults written to %s\n",output.c_str());
+
+  return 0;
+}
@@ -88,4 +88,18 @@ void LBFGS::clear() {
   gk.clear();
 }
 
+PreconditionedLBFGS::PreconditionedLBFGS(size_t nmax_) : LBFGS(nmax_) {
+}
+
+PreconditionedLBFGS::~PreconditionedLBFGS() {
+}
 
+void PreconditionedLBFGS::set_diagonal(const arma::vec & h0_) {
+  h0=h0_;
+}
+
+arma::vec PreconditionedLBFGS::apply_diagonal_hessian(const arma::vec & q) const {
+  if(h0.n_elem != q.n_elem)
+    return LBFGS::apply_diagonal_hessian(q);
+  return q/h0;
+}
@@ -48,4 +48,23 @@ class LBFGS {
   void clear();
 };
 
+/// L-BFGS with a fixed diagonal preconditioner as the initial Hessian
+class PreconditionedLBFGS : public LBFGS {
+ protected:
+  /// Diagonal Hessian
+  arma::vec h0;
+
+  /// Apply diagonal Hessian: r = q / h0
+  arma::vec apply_diagonal_hessian(const arma::vec & q) const override;
+
+ public:
+  /// Constructor
+  PreconditionedLBFGS(size_t nmax=10);
+  /// Destructor
+  ~PreconditionedLBFGS();
+
+  /// Set the diagonal Hessian
+  void set_diagonal(const arma::vec & h0);
+};
+
 #endif
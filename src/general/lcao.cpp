@@ -30,30 +30,48 @@ namespace helfem {
       return gsl_sf_fact(n);
     }
 
+    /// Normalization constants of radial GTOs
+    static arma::vec GTO_norm(int l, const arma::vec & alpha) {
+      return std::pow(2,l+2) * arma::pow(alpha,(2*l+3)/4.0) / ( std::pow(2.0*M_PI,0.25) * sqrt(double_factorial(2*l+1)));
+    }
+
+    /// Normalization constants of radial STOs
+    static arma::vec STO_norm(int l, const arma::vec & zeta) {
+      return arma::pow(2*zeta,l+1.5)/sqrt(factorial(2*l+2));
+    }
+
     /// Evaluate radial GTO
     double radial_GTO(double r, int l, double alpha) {
       return std::pow(2,l+2) * std::pow(alpha,(2*l+3)/4.0) * std::pow(r,l) * exp(-alpha*r*r) / ( std::pow(2.0*M_PI,0.25) * sqrt(double_factorial(2*l+1)));
     }
 
     arma::mat radial_GTO(const arma::vec & r, int l, const arma::vec & alpha) {
-      arma::mat gto(r.n_elem, alpha.n_elem);
-      for(size_t j=0;j<alpha.n_elem;j++)
-        for(size_t i=0;i<r.n_elem;i++)
-          gto(i,j)=radial_GTO(r(i),l,alpha(j));
+      // The powers of r and the normalization are shared by all the
+      // exponents and all the points, respectively
+      arma::mat gto(arma::exp(-arma::square(r)*arma::trans(alpha)));
+      gto.each_col()%=arma::pow(r,l);
+      gto.each_row()%=arma::trans(GTO_norm(l,alpha));
       return gto;
     }
 
+    arma::vec radial_GTO(double r, int l, const arma::vec & alpha) {
+      return (std::pow(r,l)*GTO_norm(l,alpha))%arma::exp(-(r*r)*alpha);
+    }
+
     /// Evaluate radial STO
     double radial_STO(double r, int l, double zeta) {
       return std::pow(2*zeta,l+1.5)/sqrt(factorial(2*l+2)) * std::pow(r,l) * exp(-zeta*r);
     }
 
-    arma::mat radial_STO(const arma::vec & r, int l, const arma::vec & alpha) {
-      arma::mat gto(r.n_elem, alpha.n_elem);
-      for(size_t j=0;j<alpha.n_elem;j++)
-        for(size_t i=0;i<r.n_elem;i++)
-          gto(i,j)=radial_STO(r(i),l,alpha(j));
-      return gto;
+    arma::mat radial_STO(const arma::vec & r, int l, const arma::vec & zeta) {
+      arma::mat sto(arma::exp(-r*arma::trans(zeta)));
+      sto.each_col()%=arma::pow(r,l);
+      sto.each_row()%=arma::trans(STO_norm(l,zeta));
+      return sto;
+    }
+
+    arma::vec radial_STO(double r, int l, const arma::vec & zeta) {
+      return (std::pow(r,l)*STO_norm(l,zeta))%arma::exp(-r*zeta);
     }
   }
 }
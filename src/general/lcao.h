@@ -22,12 +22,16 @@ namespace helfem {
   namespace lcao {
     /// Evaluate radial GTO
     double radial_GTO(double r, int l, double alpha);
-    /// Evaluate radial GTO
+    /// Evaluate radial GTOs of all the exponents at all the points: Npoints x Nexp
     arma::mat radial_GTO(const arma::vec & r, int l, const arma::vec & alpha);
+    /// Evaluate radial GTOs of all the exponents at a point
+    arma::vec radial_GTO(double r, int l, const arma::vec & alpha);
     /// Evaluate radial STO
     double radial_STO(double r, int l, double zeta);
-    /// Evaluate radial STO
+    /// Evaluate radial STOs of all the exponents at all the points: Npoints x Nexp
     arma::mat radial_STO(const arma::vec & r, int l, const arma::vec & zeta);
+    /// Evaluate radial STOs of all the exponents at a point
+    arma::vec radial_STO(double r, int l, const arma::vec & zeta);
   }
 }
 
@@ -0,0 +1,162 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "legendre.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace helfem {
+  namespace legendre {
+    /// Check the arguments
+    static void check_args(int lmax, int mmax, double x) {
+      if(lmax<0 || mmax<0) {
+        std::ostringstream oss;
+        oss << "Invalid Legendre function order lmax = " << lmax << ", mmax = " << mmax << "!\n";
+        throw std::logic_error(oss.str());
+      }
+      if(!(x>1.0)) {
+        std::ostringstream oss;
+        oss << "Legendre functions are only implemented for x > 1, got x = " << x << "!\n";
+        throw std::logic_error(oss.str());
+      }
+    }
+
+    /**
+     * Ratio Q_N^m / Q_{N-1}^m from the continued fraction
+     *
+     * h_N = (N+m) / ( (2N+1) x - (N-m+1) h_{N+1} )
+     *
+     * evaluated with the modified Lentz algorithm.
+     */
+    static double Q_ratio(int N, int m, double x) {
+      const double tiny=1e-300;
+      // Convergence slows down as x -> 1
+      const size_t maxit=100000000;
+
+      double f=tiny, C=tiny, D=0.0;
+      for(size_t k=1;k<=maxit;k++) {
+        double a, b((2.0*(N+k)-1.0)*x);
+        if(k==1)
+          a=N+m;
+        else
+          a=-((double) (N-m+(int) k-1))*((double) (N+m+(int) k-1));
+
+        D=b+a*D;
+        if(D==0.0)
+          D=tiny;
+        C=b+a/C;
+        if(C==0.0)
+          C=tiny;
+        D=1.0/D;
+        double delta(C*D);
+        f*=delta;
+        if(std::abs(delta-1.0)<DBL_EPSILON)
+          return f;
+      }
+
+      std::ostringstream oss;
+      oss << "Continued fraction for Q_" << N << "^" << m << "(" << x << ") did not converge!\n";
+      throw std::runtime_error(oss.str());
+    }
+
+    void Plm(int lmax, int mmax, double x, double *P) {
+      check_args(lmax,mmax,x);
+      const size_t ldp(lmax+1);
+      std::fill(P,P+ldp*(mmax+1),0.0);
+
+      // sqrt(x^2-1) without cancellation
+      const double s(std::sqrt((x-1.0)*(x+1.0)));
+      // P_m^m = (2m-1)!! (x^2-1)^{m/2}
+      double pmm=1.0;
+      for(int m=0;m<=std::min(lmax,mmax);m++) {
+        if(m>0)
+          pmm*=(2*m-1)*s;
+        double *p(P+m*ldp);
+        p[m]=pmm;
+        if(m<lmax)
+          p[m+1]=x*(2*m+1)*pmm;
+        // (l-m+1) P_{l+1}^m = (2l+1) x P_l^m - (l+m) P_{l-1}^m
+        for(int l=m+1;l<lmax;l++)
+          p[l+1]=((2*l+1)*x*p[l]-(l+m)*p[l-1])/(l-m+1);
+      }
+    }
+
+    void Qlm(int lmax, int mmax, double x, double *Q) {
+      check_args(lmax,mmax,x);
+      const size_t ldq(lmax+1);
+
+      // ln((x+1)/(x-1)) without cancellation
+      const double lnr(std::log1p(2.0/(x-1.0)));
+      std::vector<double> h(lmax+2);
+      for(int m=0;m<=mmax;m++) {
+        double *q(Q+m*ldq);
+        // Q_0^m = (-1)^m (m-1)! sinh(m ln((x+1)/(x-1))/2) for m>0
+        if(m==0)
+          q[0]=0.5*lnr;
+        else
+          q[0]=((m%2) ? -1.0 : 1.0)*std::tgamma(m)*std::sinh(0.5*m*lnr);
+        if(lmax==0)
+          continue;
+
+        // Ratios h_l = Q_l^m / Q_{l-1}^m by backward recurrence
+        h[lmax+1]=Q_ratio(lmax+1,m,x);
+        for(int l=lmax;l>=1;l--)
+          h[l]=(l+m)/((2*l+1)*x-(l-m+1)*h[l+1]);
+        for(int l=1;l<=lmax;l++)
+          q[l]=h[l]*q[l-1];
+      }
+    }
+
+    void Plm(int lmax, int mmax, const double *x, size_t n, double *P) {
+      const size_t nlm((lmax+1)*(mmax+1));
+      for(size_t i=0;i<n;i++)
+        Plm(lmax,mmax,x[i],P+i*nlm);
+    }
+
+    void Qlm(int lmax, int mmax, const double *x, size_t n, double *Q) {
+      const size_t nlm((lmax+1)*(mmax+1));
+      for(size_t i=0;i<n;i++)
+        Qlm(lmax,mmax,x[i],Q+i*nlm);
+    }
+
+    arma::mat Plm(int lmax, int mmax, double x) {
+      arma::mat P(lmax+1,mmax+1);
+      Plm(lmax,mmax,x,P.memptr());
+      return P;
+    }
+
+    arma::mat Qlm(int lmax, int mmax, double x) {
+      arma::mat Q(lmax+1,mmax+1);
+      Qlm(lmax,mmax,x,Q.memptr());
+      return Q;
+    }
+
+    arma::cube Plm(int lmax, int mmax, const arma::vec & x) {
+      arma::cube P(lmax+1,mmax+1,x.n_elem);
+      Plm(lmax,mmax,x.memptr(),x.n_elem,P.memptr());
+      return P;
+    }
+
+    arma::cube Qlm(int lmax, int mmax, const arma::vec & x) {
+      arma::cube Q(lmax+1,mmax+1,x.n_elem);
+      Qlm(lmax,mmax,x.memptr(),x.n_elem,Q.memptr());
+      return Q;
+    }
+  }
+}
@@ -0,0 +1,63 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef LEGENDRE_FUNCTIONS_H
+#define LEGENDRE_FUNCTIONS_H
+
+#include <armadillo>
+
+namespace helfem {
+  namespace legendre {
+    /**
+     * Associated Legendre functions of the first and second kind for
+     * arguments x > 1,
+     *
+     * \f$ P_l^m(x) = (x^2-1)^{m/2} \frac {d^m} {dx^m} P_l(x) \f$ and
+     * \f$ Q_l^m(x) = (x^2-1)^{m/2} \frac {d^m} {dx^m} Q_l(x) \f$,
+     *
+     * i.e. without the Condon-Shortley phase, as in the Fortran
+     * library. P is obtained by upward recurrence in l. Q is obtained
+     * from the ratios Q_l^m / Q_{l-1}^m, which are computed by
+     * backward recurrence from a continued fraction, and the closed
+     * form of Q_0^m.
+     *
+     * The routines keep no state, so they may be called from parallel
+     * regions. The values are stored in column-major (lmax+1) x
+     * (mmax+1) order; the batch versions store the values of point i
+     * at offset i*(lmax+1)*(mmax+1). Values that overflow are
+     * returned as such.
+     */
+
+    /// Compute P_l^m(x) for l <= lmax, m <= mmax
+    void Plm(int lmax, int mmax, double x, double *P);
+    /// Compute Q_l^m(x) for l <= lmax, m <= mmax
+    void Qlm(int lmax, int mmax, double x, double *Q);
+    /// Compute P_l^m for n points at once
+    void Plm(int lmax, int mmax, const double *x, size_t n, double *P);
+    /// Compute Q_l^m for n points at once
+    void Qlm(int lmax, int mmax, const double *x, size_t n, double *Q);
+
+    /// P_l^m(x) as a (lmax+1) x (mmax+1) matrix
+    arma::mat Plm(int lmax, int mmax, double x);
+    /// Q_l^m(x) as a (lmax+1) x (mmax+1) matrix
+    arma::mat Qlm(int lmax, int mmax, double x);
+    /// P_l^m on a set of points, one slice per point
+    arma::cube Plm(int lmax, int mmax, const arma::vec & x);
+    /// Q_l^m on a set of points, one slice per point
+    arma::cube Qlm(int lmax, int mmax, const arma::vec & x);
+  }
+}
+
+#endif
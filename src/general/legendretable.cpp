@@ -15,120 +15,182 @@
  */
 #include "legendretable.h"
 #include <algorithm>
-#include "../legendre/Legendre_Wrapper.h"
+#include <sstream>
+#include "legendre.h"
 
 namespace helfem {
   namespace legendretable {
-    bool operator<(const legendre_table_t & lh, const legendre_table_t & rh) {
-      return lh.xi < rh.xi;
-    }
-
     LegendreTable::LegendreTable() {
       Lpad=-1;
       Lmax=-1;
       Mmax=-1;
     }
 
-    LegendreTable::LegendreTable(int Lpad_, int Lmax_, int Mmax_) : Lpad(Lpad_), Lmax(Lmax_), Mmax(Mmax_) {
-    }
+    /// Set up the element offsets and collect the arguments
+    static arma::vec collect_points(const std::vector<arma::vec> & xi, arma::uvec & offset, arma::uvec & npoints) {
+      offset.zeros(xi.size());
+      npoints.zeros(xi.size());
+      size_t ntot=0;
+      for(size_t iel=0;iel<xi.size();iel++) {
+        offset(iel)=ntot;
+        npoints(iel)=xi[iel].n_elem;
+        ntot+=xi[iel].n_elem;
+      }
 
-    LegendreTable::~LegendreTable() {
+      arma::vec x(ntot);
+      for(size_t iel=0;iel<xi.size();iel++)
+        if(xi[iel].n_elem)
+          x.subvec(offset(iel),offset(iel)+npoints(iel)-1)=xi[iel];
+      return x;
     }
 
-    size_t LegendreTable::get_index(double xi, bool check) const {
-      legendre_table_t p;
-      p.xi=xi;
-
-      std::vector<legendre_table_t>::const_iterator low(std::lower_bound(stor.begin(),stor.end(),p));
-      if(check && low == stor.end()) {
-        std::ostringstream oss;
-        oss << "Could not find xi=" << xi << " on the list!\n";
-        throw std::logic_error(oss.str());
+    LegendreTable::LegendreTable(int Lpad_, int Lmax_, int Mmax_, const std::vector<arma::vec> & xi_) : Lpad(Lpad_), Lmax(Lmax_), Mmax(Mmax_) {
+      xi=collect_points(xi_,offset,npoints);
+
+      // Allocate memory
+      size_t nlm((Lmax+1)*(Mmax+1));
+      Plm.zeros(xi.n_elem*nlm);
+      Qlm.zeros(xi.n_elem*nlm);
+      if(!xi.n_elem)
+        return;
+
+      // Sort the arguments and find the distinct values
+      arma::uvec order(arma::sort_index(xi));
+      std::vector<size_t> first;
+      first.push_back(0);
+      for(size_t i=1;i<order.n_elem;i++)
+        if(xi(order(i)) != xi(order(i-1)))
+          first.push_back(i);
+      first.push_back(order.n_elem);
+
+      // Evaluate each distinct value once, and copy it to the duplicates
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,16)
+#endif
+      for(size_t iu=0;iu<first.size()-1;iu++) {
+        size_t i0(order(first[iu])*nlm);
+        evaluate(xi(order(first[iu])),Plm.memptr()+i0,Qlm.memptr()+i0);
+        for(size_t i=first[iu]+1;i<first[iu+1];i++) {
+          size_t idx(order(i)*nlm);
+          std::copy(Plm.memptr()+i0,Plm.memptr()+i0+nlm,Plm.memptr()+idx);
+          std::copy(Qlm.memptr()+i0,Qlm.memptr()+i0+nlm,Qlm.memptr()+idx);
+        }
       }
+    }
 
-      // Index is
-      size_t idx(low-stor.begin());
-      if(check && (stor[idx].xi != xi)) {
+    LegendreTable::LegendreTable(int Lpad_, int Lmax_, int Mmax_, const std::vector<arma::vec> & xi_, const arma::vec & Plm_, const arma::vec & Qlm_) : Plm(Plm_), Qlm(Qlm_), Lpad(Lpad_), Lmax(Lmax_), Mmax(Mmax_) {
+      xi=collect_points(xi_,offset,npoints);
+      size_t nlm((Lmax+1)*(Mmax+1));
+      if(Plm.n_elem != xi.n_elem*nlm || Qlm.n_elem != xi.n_elem*nlm) {
         std::ostringstream oss;
-        oss << "Map error: tried to get xi = " << xi << " but got xi = " << stor[idx].xi << "!\n";
+        oss << "Legendre table of " << Plm.n_elem << " and " << Qlm.n_elem << " values does not match " << xi.n_elem << " points with " << nlm << " functions!\n";
         throw std::logic_error(oss.str());
       }
+    }
 
-      return idx;
+    LegendreTable::~LegendreTable() {
     }
 
-    void LegendreTable::compute(double xi) {
-#ifdef _OPENMP
-#pragma omp critical
-#endif
-      {
-        legendre_table_t entry;
-
-        // Allocate memory
-        entry.xi=xi;
-        entry.Plm.zeros(Lpad+1,Lpad+1);
-        entry.Qlm.zeros(Lpad+1,Lpad+1);
-
-        // Compute
-        if(xi!=1.0) {
-          ::calc_Plm_arr(entry.Plm.memptr(),Lpad,Lpad,xi);
-          ::calc_Qlm_arr(entry.Qlm.memptr(),Lpad,Lpad,xi);
+    void LegendreTable::evaluate(double x, double *plm, double *qlm) const {
+      // The continued fraction for Q is converged on its own, so the
+      // values are computed directly up to Lmax, Mmax; the C++ routines
+      // keep no state and can be called from several threads at once
+      arma::mat P(Lmax+1,Mmax+1,arma::fill::zeros);
+      arma::mat Q(Lmax+1,Mmax+1,arma::fill::zeros);
+      if(x!=1.0) {
+        legendre::Plm(Lmax,Mmax,x,P.memptr());
+        legendre::Qlm(Lmax,Mmax,x,Q.memptr());
+      }
+
+      // Get rid of any non-normal entries
+      for(int L=0;L<=Lmax;L++)
+        for(int M=0;M<=Mmax;M++) {
+          plm[L*(Mmax+1)+M] = std::isnormal(P(L,M)) ? P(L,M) : 0.0;
+          qlm[L*(Mmax+1)+M] = std::isnormal(Q(L,M)) ? Q(L,M) : 0.0;
         }
+    }
 
-        // Store only 0 to lmax
-        entry.Plm=entry.Plm.submat(0,0,Lmax,Mmax);
-        entry.Qlm=entry.Qlm.submat(0,0,Lmax,Mmax);
-
-        // Get rid of any non-normal entries
-        for(int L=0;L<=Lmax;L++)
-          for(int M=0;M<=Mmax;M++) {
-            if(!std::isnormal(entry.Plm(L,M)))
-              entry.Plm(L,M)=0.0;
-            if(!std::isnormal(entry.Qlm(L,M)))
-              entry.Qlm(L,M)=0.0;
-          }
-
-        if(!stor.size())
-          stor.push_back(entry);
-        else
-          // Insert at lower bound
-          stor.insert(stor.begin()+get_index(xi,false),entry);
-      }
+    int LegendreTable::get_Lpad() const {
+      return Lpad;
+    }
+
+    int LegendreTable::get_Lmax() const {
+      return Lmax;
+    }
+
+    int LegendreTable::get_Mmax() const {
+      return Mmax;
+    }
+
+    std::vector<arma::vec> LegendreTable::get_xi() const {
+      std::vector<arma::vec> x(offset.n_elem);
+      for(size_t iel=0;iel<offset.n_elem;iel++)
+        x[iel] = npoints(iel) ? arma::vec(xi.subvec(offset(iel),offset(iel)+npoints(iel)-1)) : arma::vec();
+      return x;
+    }
+
+    const arma::vec & LegendreTable::get_Plm() const {
+      return Plm;
+    }
+
+    const arma::vec & LegendreTable::get_Qlm() const {
+      return Qlm;
+    }
+
+    size_t LegendreTable::get_Nel() const {
+      return offset.n_elem;
     }
 
-    double LegendreTable::get_Plm(int l, int m, double xi) const {
+    size_t LegendreTable::get_Npoints(size_t iel) const {
+      return npoints(iel);
+    }
+
+    size_t LegendreTable::get_index(size_t iel, size_t ip) const {
 #ifndef ARMA_NO_DEBUG
-      if(get_index(xi)>stor.size()) {
+      if(iel>=offset.n_elem) {
         std::ostringstream oss;
-        oss << "Error in get_Plm(" << l << "," << m << "," << xi << "): index " << get_index(xi) << " greater than array size " << stor.size() << "!\n";
+        oss << "Element " << iel << " not in table of " << offset.n_elem << " elements!\n";
         throw std::logic_error(oss.str());
       }
-#endif
-      return stor[get_index(xi)].Plm(l,m);
-    }
-
-    double LegendreTable::get_Qlm(int l, int m, double xi) const {
-#ifndef ARMA_NO_DEBUG
-      if(get_index(xi)>stor.size()) {
+      if(ip>=npoints(iel)) {
         std::ostringstream oss;
-        oss << "Error in get_Qlm(" << l << "," << m << "," << xi << "): index " << get_index(xi) << " greater than array size " << stor.size() << "!\n";
+        oss << "Point " << ip << " not in table of " << npoints(iel) << " points in element " << iel << "!\n";
         throw std::logic_error(oss.str());
       }
 #endif
-      return stor[get_index(xi)].Qlm(l,m);
+      return (offset(iel)+ip)*(Lmax+1)*(Mmax+1);
     }
 
-    arma::vec LegendreTable::get_Plm(int l, int m, const arma::vec & xi) const {
-      arma::vec plm(xi.n_elem);
-      for(size_t i=0;i<xi.n_elem;i++)
-        plm(i)=get_Plm(l,m,xi(i));
+    double LegendreTable::get_Plm(int l, int m, size_t iel, size_t ip) const {
+      return Plm(get_index(iel,ip)+l*(Mmax+1)+m);
+    }
+
+    double LegendreTable::get_Qlm(int l, int m, size_t iel, size_t ip) const {
+      return Qlm(get_index(iel,ip)+l*(Mmax+1)+m);
+    }
+
+    arma::vec LegendreTable::get_Plm(int l, int m, size_t iel, size_t ip0, size_t np) const {
+      // Values of a single (l,m) are strided by the number of functions
+      size_t nlm((Lmax+1)*(Mmax+1));
+#ifndef ARMA_NO_DEBUG
+      if(np) get_index(iel,ip0+np-1);
+#endif
+      const double *p(Plm.memptr()+get_index(iel,ip0)+l*(Mmax+1)+m);
+      arma::vec plm(np);
+      for(size_t i=0;i<np;i++)
+        plm(i)=p[i*nlm];
       return plm;
     }
 
-    arma::vec LegendreTable::get_Qlm(int l, int m, const arma::vec & xi) const {
-      arma::vec qlm(xi.n_elem);
-      for(size_t i=0;i<xi.n_elem;i++)
-        qlm(i)=get_Qlm(l,m,xi(i));
+    arma::vec LegendreTable::get_Qlm(int l, int m, size_t iel, size_t ip0, size_t np) const {
+      size_t nlm((Lmax+1)*(Mmax+1));
+#ifndef ARMA_NO_DEBUG
+      if(np) get_index(iel,ip0+np-1);
+#endif
+      const double *q(Qlm.memptr()+get_index(iel,ip0)+l*(Mmax+1)+m);
+      arma::vec qlm(np);
+      for(size_t i=0;i<np;i++)
+        qlm(i)=q[i*nlm];
       return qlm;
     }
   }
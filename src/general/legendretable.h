@@ -21,50 +21,78 @@
 
 namespace helfem {
   namespace legendretable {
-    typedef struct {
-      /// Value of argument
-      double xi;
+    /**
+     * Table of associated Legendre function values P_L^M(xi) and
+     * Q_L^M(xi), addressed by element and point index. The values are
+     * stored contiguously in [element][point][L][M] order, so that no
+     * searching is necessary when the integrals are evaluated.
+     */
+    class LegendreTable {
+    private:
       /// Plm values
-      arma::mat Plm;
+      arma::vec Plm;
       /// Qlm values
-      arma::mat Qlm;
-    } legendre_table_t;
+      arma::vec Qlm;
+      /// Arguments of the functions
+      arma::vec xi;
+      /// Offset of the first point of each element
+      arma::uvec offset;
+      /// Number of points in each element
+      arma::uvec npoints;
 
-    bool operator<(const legendre_table_t & lh, const legendre_table_t & rh);
-
-    class LegendreTable {
-    private:
-      /// Storage array
-      std::vector<legendre_table_t> stor;
-      /// Maximum L value used in the actual computation
+      /// Padded maximum L value of the Fortran library; only identifies stored tables
       int Lpad;
       /// Maximum L value
       int Lmax;
       /// Maximum M value
       int Mmax;
 
-      /// Find index in array
-      size_t get_index(double xi, bool check=true) const;
+      /// Index of first value of (element, point)
+      size_t get_index(size_t iel, size_t ip) const;
+      /// Evaluate the functions at a single point
+      void evaluate(double x, double *plm, double *qlm) const;
 
     public:
       /// Dummy constructor
       LegendreTable();
-      /// Constructor
-      LegendreTable(int Lpad, int Lmax, int Mmax);
+      /**
+       * Constructor, computing the values at the points xi[iel]. The
+       * arguments are sorted and deduplicated, so that each distinct
+       * value is only evaluated once.
+       */
+      LegendreTable(int Lpad, int Lmax, int Mmax, const std::vector<arma::vec> & xi);
+      /// Constructor from precomputed values, e.g. read from a checkpoint
+      LegendreTable(int Lpad, int Lmax, int Mmax, const std::vector<arma::vec> & xi, const arma::vec & Plm, const arma::vec & Qlm);
       /// Destructor
       ~LegendreTable();
-      /// Add value to table
-      void compute(double xi);
 
-      /// Get value from table
-      double get_Plm(int l, int m, double xi) const;
-      /// Get value from table
-      double get_Qlm(int l, int m, double xi) const;
+      /// Maximum L value used in the actual computation
+      int get_Lpad() const;
+      /// Maximum L value
+      int get_Lmax() const;
+      /// Maximum M value
+      int get_Mmax() const;
+      /// Arguments of the functions in each element
+      std::vector<arma::vec> get_xi() const;
+      /// Raw Plm storage
+      const arma::vec & get_Plm() const;
+      /// Raw Qlm storage
+      const arma::vec & get_Qlm() const;
+
+      /// Number of elements
+      size_t get_Nel() const;
+      /// Number of points in element
+      size_t get_Npoints(size_t iel) const;
 
       /// Get value from table
-      arma::vec get_Plm(int l, int m, const arma::vec & xi) const;
+      double get_Plm(int l, int m, size_t iel, size_t ip) const;
       /// Get value from table
-      arma::vec get_Qlm(int l, int m, const arma::vec & xi) const;
+      double get_Qlm(int l, int m, size_t iel, size_t ip) const;
+
+      /// Get values at points ip0, ..., ip0+np-1 of element
+      arma::vec get_Plm(int l, int m, size_t iel, size_t ip0, size_t np) const;
+      /// Get values at points ip0, ..., ip0+np-1 of element
+      arma::vec get_Qlm(int l, int m, size_t iel, size_t ip0, size_t np) const;
     };
   }
 }
@@ -0,0 +1,134 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "memory_plan.h"
+#include "scf_helpers.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+namespace helfem {
+  namespace scf {
+    MemoryPlan::MemoryPlan(size_t budget_) : budget(budget_) {
+    }
+
+    MemoryPlan::~MemoryPlan() {
+    }
+
+    void MemoryPlan::set(const std::string & name, size_t size) {
+      for(size_t i=0;i<names.size();i++)
+        if(names[i]==name) {
+          sizes[i]=size;
+          return;
+        }
+      names.push_back(name);
+      sizes.push_back(size);
+    }
+
+    void MemoryPlan::remove(const std::string & name) {
+      for(size_t i=0;i<names.size();i++)
+        if(names[i]==name) {
+          names.erase(names.begin()+i);
+          sizes.erase(sizes.begin()+i);
+          return;
+        }
+    }
+
+    size_t MemoryPlan::get_budget() const {
+      return budget;
+    }
+
+    size_t MemoryPlan::total() const {
+      size_t tot=0;
+      for(size_t i=0;i<sizes.size();i++)
+        tot+=sizes[i];
+      return tot;
+    }
+
+    size_t MemoryPlan::available() const {
+      if(!budget)
+        return SIZE_MAX;
+      size_t tot(total());
+      return (tot<budget) ? budget-tot : 0;
+    }
+
+    bool MemoryPlan::fits() const {
+      return !budget || total()<=budget;
+    }
+
+    std::string MemoryPlan::report() const {
+      std::ostringstream oss;
+      char line[256];
+      for(size_t i=0;i<names.size();i++) {
+        snprintf(line,sizeof(line),"  %-40s %s\n",names[i].c_str(),memory_size(sizes[i]).c_str());
+        oss << line;
+      }
+      snprintf(line,sizeof(line),"  %-40s %s\n","total",memory_size(total()).c_str());
+      oss << line;
+      if(budget) {
+        snprintf(line,sizeof(line),"  %-40s %s\n","budget",memory_size(budget).c_str());
+        oss << line;
+      }
+      return oss.str();
+    }
+
+    void MemoryPlan::print() const {
+      printf("\nPlanned memory use\n%s\n",report().c_str());
+      fflush(stdout);
+    }
+
+    void MemoryPlan::check() const {
+      if(!fits())
+        throw std::runtime_error("The calculation does not fit in the memory budget even with the most economical storage modes.\nPlanned memory use\n" + report());
+    }
+
+    size_t parse_memory(const std::string & input) {
+      if(!input.size())
+        return 0;
+
+      char *end;
+      double val(strtod(input.c_str(),&end));
+      if(end==input.c_str() || val<0.0)
+        throw std::logic_error("Invalid memory size \"" + input + "\"\n");
+
+      double unit;
+      switch(*end) {
+      case('k'):
+      case('K'):
+        unit=1024.0;
+        break;
+      case('\0'):
+      case('m'):
+      case('M'):
+        unit=1024.0*1024.0;
+        break;
+      case('g'):
+      case('G'):
+        unit=1024.0*1024.0*1024.0;
+        break;
+      case('t'):
+      case('T'):
+        unit=1024.0*1024.0*1024.0*1024.0;
+        break;
+      default:
+        throw std::logic_error("Invalid memory size \"" + input + "\"\n");
+      }
+
+      return (size_t) (val*unit);
+    }
+  }
+}
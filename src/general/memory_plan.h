@@ -0,0 +1,72 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef MEMORY_PLAN_H
+#define MEMORY_PLAN_H
+
+#include <string>
+#include <vector>
+
+namespace helfem {
+  namespace scf {
+    /**
+     * Plan of the large allocations of a calculation. The expected
+     * sizes of the integrals, grid caches and SCF matrices are
+     * collected before anything is computed, so that the storage
+     * modes can be chosen to fit the memory budget and calculations
+     * that would not fit are stopped before the integrals are formed.
+     */
+    class MemoryPlan {
+      /// Memory budget in bytes, 0 for unlimited
+      size_t budget;
+      /// Names of the allocations
+      std::vector<std::string> names;
+      /// Sizes of the allocations
+      std::vector<size_t> sizes;
+
+    public:
+      /// Constructor
+      MemoryPlan(size_t budget);
+      /// Destructor
+      ~MemoryPlan();
+
+      /// Set the size of an allocation, adding it if it does not exist yet
+      void set(const std::string & name, size_t size);
+      /// Remove an allocation
+      void remove(const std::string & name);
+
+      /// Budget
+      size_t get_budget() const;
+      /// Total planned memory
+      size_t total() const;
+      /// Memory left over in the budget
+      size_t available() const;
+      /// Does the plan fit in the budget?
+      bool fits() const;
+
+      /// Tabulate the plan
+      std::string report() const;
+      /// Print the plan
+      void print() const;
+      /// Throw an exception with the report if the plan does not fit
+      void check() const;
+    };
+
+    /// Parse a memory size such as 500M or 4G (binary units); plain numbers are in MiB
+    size_t parse_memory(const std::string & input);
+  }
+}
+
+#endif
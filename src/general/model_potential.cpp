@@ -1,7 +1,10 @@
 #include "model_potential.h"
 #include "sap.h"
 #include "gsz.h"
+#include <algorithm>
 #include <cfloat>
+#include <sstream>
+#include <stdexcept>
 
 namespace helfem {
   namespace modelpotential {
@@ -39,6 +42,10 @@ namespace helfem {
       return -GSZ::Z_thomasfermi(r,Z)/r;
     }
 
+    arma::vec TFAtom::V(const arma::vec & r) const {
+      return -GSZ::Z_thomasfermi(r,Z)/r;
+    }
+
     GSZAtom::GSZAtom(int Z_) : Z(Z_) {
       GSZ::GSZ_parameters(Z,dz,Hz);
     }
@@ -53,6 +60,10 @@ namespace helfem {
       return -GSZ::Z_GSZ(r,Z,dz,Hz)/r;
     }
 
+    arma::vec GSZAtom::V(const arma::vec & r) const {
+      return -GSZ::Z_GSZ(r,Z,dz,Hz)/r;
+    }
+
     SAPAtom::SAPAtom(int Z_) : Z(Z_) {
     }
 
@@ -62,5 +73,113 @@ namespace helfem {
     double SAPAtom::V(double r) const {
       return -::sap_effective_charge(Z,r)/r;
     }
+
+    arma::vec SAPAtom::V(const arma::vec & r) const {
+      return -::sap_effective_charge(Z,r)/r;
+    }
+
+    TabulatedRadialPotential::TabulatedRadialPotential(const arma::vec & r, const arma::vec & V) {
+      initialize(r,V);
+    }
+
+    TabulatedRadialPotential::TabulatedRadialPotential(const std::string & fname) {
+      arma::mat tab;
+      if(!tab.load(fname,arma::raw_ascii) || tab.n_cols<2) {
+        std::ostringstream oss;
+        oss << "Could not read a tabulated potential from \"" << fname << "\"!\n";
+        throw std::runtime_error(oss.str());
+      }
+      initialize(tab.col(0),tab.col(1));
+    }
+
+    TabulatedRadialPotential::~TabulatedRadialPotential() {
+    }
+
+    /// Is the grid equidistant?
+    static bool is_uniform(const arma::vec & x) {
+      arma::vec d(arma::diff(x));
+      double h(arma::mean(d));
+      return arma::max(arma::abs(d-h)) <= 1e-10*h;
+    }
+
+    void TabulatedRadialPotential::initialize(const arma::vec & r, const arma::vec & V) {
+      if(r.n_elem != V.n_elem)
+        throw std::logic_error("Tabulated radii and potential differ in length!\n");
+      if(r.n_elem<2)
+        throw std::logic_error("Tabulated potential needs at least two points!\n");
+      if(r(0)<0.0 || arma::any(arma::diff(r)<=0.0))
+        throw std::logic_error("Tabulated radii must be non-negative and increasing!\n");
+
+      if(is_uniform(r)) {
+        grid=UNIFORM_GRID;
+        x=r;
+      } else if(r(0)>0.0 && is_uniform(arma::log(r))) {
+        grid=LOG_GRID;
+        x=arma::log(r);
+      } else {
+        grid=GENERAL_GRID;
+        x=r;
+      }
+      dx=(x(x.n_elem-1)-x(0))/(x.n_elem-1);
+      y=V;
+      rmin=r(0);
+      rmax=r(r.n_elem-1);
+
+      // Natural spline by the tridiagonal recurrence
+      const size_t n(x.n_elem);
+      y2.zeros(n);
+      arma::vec u(n,arma::fill::zeros);
+      for(size_t i=1;i+1<n;i++) {
+        double sig((x(i)-x(i-1))/(x(i+1)-x(i-1)));
+        double p(sig*y2(i-1)+2.0);
+        y2(i)=(sig-1.0)/p;
+        u(i)=(y(i+1)-y(i))/(x(i+1)-x(i)) - (y(i)-y(i-1))/(x(i)-x(i-1));
+        u(i)=(6.0*u(i)/(x(i+1)-x(i-1))-sig*u(i-1))/p;
+      }
+      y2(n-1)=0.0;
+      for(size_t i=n-1;i-- > 0;)
+        y2(i)=y2(i)*y2(i+1)+u(i);
+    }
+
+    size_t TabulatedRadialPotential::interval(double xv) const {
+      const size_t nint(x.n_elem-1);
+      if(grid==GENERAL_GRID) {
+        size_t k(std::upper_bound(x.begin(), x.end(), xv)-x.begin());
+        return std::min(nint-1, k>0 ? k-1 : 0);
+      }
+      double k(std::floor((xv-x(0))/dx));
+      if(k<0.0)
+        return 0;
+      return std::min(nint-1, (size_t) k);
+    }
+
+    double TabulatedRadialPotential::V(double r) const {
+      if(r<=rmin)
+        return y(0);
+      if(r>=rmax)
+        return y(y.n_elem-1)*rmax/r;
+
+      double xv(grid==LOG_GRID ? std::log(r) : r);
+      size_t k(interval(xv));
+      double h(x(k+1)-x(k));
+      double a((x(k+1)-xv)/h);
+      double b(1.0-a);
+      return a*y(k)+b*y(k+1)+((a*a*a-a)*y2(k)+(b*b*b-b)*y2(k+1))*h*h/6.0;
+    }
+
+    arma::vec TabulatedRadialPotential::V(const arma::vec & r) const {
+      arma::vec pot(r.n_elem);
+      for(size_t i=0;i<r.n_elem;i++)
+        pot(i)=V(r(i));
+      return pot;
+    }
+
+    std::vector<double> TabulatedRadialPotential::breakpoints() const {
+      std::vector<double> br;
+      if(rmin>0.0)
+        br.push_back(rmin);
+      br.push_back(rmax);
+      return br;
+    }
   }
 }
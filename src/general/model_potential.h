@@ -37,6 +37,8 @@ namespace helfem {
       ~TFAtom();
       /// Potential
       double V(double r) const override;
+      /// Potential at a batch of points
+      arma::vec V(const arma::vec & r) const override;
     };
 
     /// Green-Sellin-Zachor atom
@@ -54,6 +56,8 @@ namespace helfem {
       ~GSZAtom();
       /// Potential
       double V(double r) const override;
+      /// Potential at a batch of points
+      arma::vec V(const arma::vec & r) const override;
     };
 
     /// Superposition of atomic potentials
@@ -67,6 +71,55 @@ namespace helfem {
       ~SAPAtom();
       /// Potential
       double V(double r) const override;
+      /// Potential at a batch of points
+      arma::vec V(const arma::vec & r) const override;
+    };
+
+    /**
+     * Potential tabulated on a radial grid, interpolated with a natural
+     * cubic spline. Uniform grids, and logarithmic grids on which the
+     * spline is in ln r, are detected so that the interval is found in
+     * O(1); other grids are bisected. Below the first point the
+     * potential is held constant, and beyond the last point it
+     * continues as V(rmax) rmax / r.
+     */
+    class TabulatedRadialPotential : public ModelPotential {
+      /// Type of grid
+      typedef enum {
+            UNIFORM_GRID,
+            LOG_GRID,
+            GENERAL_GRID
+      } grid_t;
+      /// Grid type
+      grid_t grid;
+      /// Spline abscissae: r, or ln r on a logarithmic grid
+      arma::vec x;
+      /// Tabulated values
+      arma::vec y;
+      /// Second derivatives of the spline
+      arma::vec y2;
+      /// Spacing of uniform and logarithmic grids
+      double dx;
+      /// Extent of the table
+      double rmin, rmax;
+
+      /// Set up the spline
+      void initialize(const arma::vec & r, const arma::vec & V);
+      /// Interval of the table that contains the abscissa
+      size_t interval(double xv) const;
+    public:
+      /// Constructor
+      TabulatedRadialPotential(const arma::vec & r, const arma::vec & V);
+      /// Constructor, reads r and V(r) from the first two columns of a text file
+      TabulatedRadialPotential(const std::string & fname);
+      /// Destructor
+      ~TabulatedRadialPotential();
+      /// Potential
+      double V(double r) const override;
+      /// Potential at a batch of points
+      arma::vec V(const arma::vec & r) const override;
+      /// The second derivative jumps at the ends of the table
+      std::vector<double> breakpoints() const override;
     };
   }
 }
@@ -0,0 +1,192 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include "profiler.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace helfem {
+  namespace profiler {
+    /// Statistics of a region
+    typedef struct {
+      /// Number of times entered
+      size_t calls;
+      /// Total wall time
+      double total;
+      /// Total at the last iteration printout
+      double last;
+      /// Number of threads that have entered the region
+      int nthreads;
+      /// Counters
+      std::map<std::string, double> counters;
+    } region_stats_t;
+
+    /// Is profiling on?
+    static bool active=false;
+    /// Report file
+    static std::string report;
+    /// Statistics, by path
+    static std::map<std::string, region_stats_t> stats;
+    /// Paths of the open regions on this thread
+    static thread_local std::vector<std::string> open_regions;
+
+    /// Write the report at exit
+    static void write_at_exit() {
+      if(report.size())
+        write_report(report);
+    }
+
+    void enable(const std::string & fname) {
+      if(!active)
+        std::atexit(write_at_exit);
+      active=true;
+      report=fname;
+    }
+
+    bool enabled() {
+      return active;
+    }
+
+    /// Current thread
+    static int thread_index() {
+#ifdef _OPENMP
+      return omp_get_thread_num();
+#else
+      return 0;
+#endif
+    }
+
+    Region::Region(const char * name) : active(profiler::active) {
+      if(!active)
+        return;
+      std::string path(open_regions.size() ? open_regions.back()+"/"+name : std::string(name));
+      open_regions.push_back(path);
+      timer.set();
+    }
+
+    Region::~Region() {
+      stop();
+    }
+
+    void Region::stop() {
+      if(!active)
+        return;
+      active=false;
+
+      double t(timer.get());
+      std::string path(open_regions.back());
+      open_regions.pop_back();
+      int ithr(thread_index());
+
+#ifdef _OPENMP
+#pragma omp critical(profiler_stats)
+#endif
+      {
+        auto it(stats.find(path));
+        if(it == stats.end()) {
+          region_stats_t s;
+          s.calls=0;
+          s.total=0.0;
+          s.last=0.0;
+          s.nthreads=0;
+          it=stats.insert(std::make_pair(path,s)).first;
+        }
+        it->second.calls++;
+        it->second.total+=t;
+        if(ithr+1 > it->second.nthreads)
+          it->second.nthreads=ithr+1;
+      }
+    }
+
+    void count(const char * name, double value) {
+      if(!active || !open_regions.size())
+        return;
+#ifdef _OPENMP
+#pragma omp critical(profiler_stats)
+#endif
+      {
+        auto it(stats.find(open_regions.back()));
+        if(it == stats.end()) {
+          region_stats_t s;
+          s.calls=0;
+          s.total=0.0;
+          s.last=0.0;
+          s.nthreads=0;
+          it=stats.insert(std::make_pair(open_regions.back(),s)).first;
+        }
+        it->second.counters[name]+=value;
+      }
+    }
+
+    void print_iteration(int iter) {
+      if(!active)
+        return;
+#ifdef _OPENMP
+#pragma omp critical(profiler_stats)
+#endif
+      {
+        printf("Timing breakdown of iteration %i\n",iter);
+        for(auto it=stats.begin();it!=stats.end();++it) {
+          double dt(it->second.total-it->second.last);
+          if(dt>0.0)
+            printf("  %-40s %.6f\n",it->first.c_str(),dt);
+          it->second.last=it->second.total;
+        }
+        fflush(stdout);
+      }
+    }
+
+    void write_report(const std::string & fname) {
+      bool json(fname.size()>=5 && fname.compare(fname.size()-5,5,".json")==0);
+      FILE *out=fopen(fname.c_str(),"w");
+      if(!out) {
+        fprintf(stderr,"Error opening profile report %s\n",fname.c_str());
+        return;
+      }
+
+#ifdef _OPENMP
+#pragma omp critical(profiler_stats)
+#endif
+      {
+        if(json) {
+          fprintf(out,"{\n  \"regions\": [\n");
+          for(auto it=stats.begin();it!=stats.end();++it) {
+            fprintf(out,"    {\"path\": \"%s\", \"calls\": %zu, \"time\": %.9e, \"threads\": %i, \"counters\": {",it->first.c_str(),it->second.calls,it->second.total,it->second.nthreads);
+            for(auto ic=it->second.counters.begin();ic!=it->second.counters.end();++ic)
+              fprintf(out,"%s\"%s\": %.9e",(ic==it->second.counters.begin()) ? "" : ", ",ic->first.c_str(),ic->second);
+            fprintf(out,"}}%s\n",(std::next(it)==stats.end()) ? "" : ",");
+          }
+          fprintf(out,"  ]\n}\n");
+        } else {
+          fprintf(out,"path,calls,time,threads,counters\n");
+          for(auto it=stats.begin();it!=stats.end();++it) {
+            fprintf(out,"%s,%zu,%.9e,%i,",it->first.c_str(),it->second.calls,it->second.total,it->second.nthreads);
+            for(auto ic=it->second.counters.begin();ic!=it->second.counters.end();++ic)
+              fprintf(out,"%s%s=%.9e",(ic==it->second.counters.begin()) ? "" : ";",ic->first.c_str(),ic->second);
+            fprintf(out,"\n");
+          }
+        }
+      }
+      fclose(out);
+    }
+  }
+}
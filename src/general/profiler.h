@@ -0,0 +1,66 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "timer.h"
+#include <string>
+
+namespace helfem {
+  /**
+   * Hierarchical profiler. Regions are opened by creating a Region
+   * object and closed when it goes out of scope or is stopped, and
+   * are nested by the order in which they are opened on each
+   * thread; the time spent in a region is collected under its path,
+   * e.g. "scf/J". When profiling is disabled, opening a region only
+   * tests a flag.
+   */
+  namespace profiler {
+    /// Turn on profiling; the report is written to fname (JSON if the name ends in .json, CSV otherwise) at exit
+    void enable(const std::string & fname);
+    /// Is profiling enabled?
+    bool enabled();
+
+    /// Timed region
+    class Region {
+      /// Is the region running?
+      bool active;
+      /// Timer
+      Timer timer;
+
+      Region(const Region &) = delete;
+      Region & operator=(const Region &) = delete;
+    public:
+      /// Open region
+      Region(const char * name);
+      /// Close region if still running
+      ~Region();
+      /// Close region before the end of the scope
+      void stop();
+    };
+
+    /// Add to a named counter in the current region
+    void count(const char * name, double value=1.0);
+
+    /// Print the time spent in each region since the last call, e.g. once per SCF iteration
+    void print_iteration(int iter);
+    /// Write the totals to file
+    void write_report(const std::string & fname);
+  }
+}
+
+#endif
@@ -28,6 +28,10 @@
 */
 
 #ifndef SAP_POTENTIAL
+#define SAP_POTENTIAL
+
+#include <armadillo>
+
 /*
   Routines for the implementation of the superposition of atomic
   potentials guess for electronic structure calculations, see
@@ -52,4 +56,6 @@
   DOI: 10.1002/qua.25945
 */
 double sap_effective_charge(int Z, double r);
+/// Effective charge at a batch of radii
+arma::vec sap_effective_charge(int Z, const arma::vec & r);
 #endif
@@ -0,0 +1,272 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "cmdline.h"
+#include "timer.h"
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+/// A benchmark job
+typedef struct {
+  /// Name of the job
+  std::string name;
+  /// Program to run
+  std::string program;
+  /// Command line arguments
+  std::vector<std::string> args;
+} job_t;
+
+/// Timing of a single profiled phase
+typedef struct {
+  /// Region path
+  std::string path;
+  /// Number of calls
+  size_t calls;
+  /// Total time
+  double time;
+} phase_t;
+
+/// Result of a job
+typedef struct {
+  /// The job
+  job_t job;
+  /// Exit status
+  int status;
+  /// Wall time
+  double wall;
+  /// Peak resident set size in MiB
+  double maxrss;
+  /// Number of SCF iterations
+  size_t iterations;
+  /// Profiled phases
+  std::vector<phase_t> phases;
+} result_t;
+
+/// Split a line into whitespace separated words
+static std::vector<std::string> split(const std::string & line) {
+  std::istringstream iss(line);
+  std::vector<std::string> words;
+  std::string w;
+  while(iss >> w)
+    words.push_back(w);
+  return words;
+}
+
+/// The reference jobs
+static std::vector<job_t> reference_jobs() {
+  const char * list[] = {
+    "ne_hf_confined atomic --Z=Ne --lmax=0 --mmax=0 --nelem=10 --Rmax=10 --method=HF --iconf=1 --conf_N=2 --conf_R=4",
+    "kr_pbe0 atomic --Z=Kr --lmax=0 --mmax=0 --nelem=10 --method=hyb_gga_xc_pbeh",
+    "ne_wb97x atomic --Z=Ne --lmax=0 --mmax=0 --nelem=10 --method=hyb_gga_xc_wb97x",
+    "n2_lmax10 diatomic --Z1=N --Z2=N --Rbond=2.0743 --lmax=10 --mmax=4 --nelem=5 --method=HF",
+    "kr_sap_search gensap --Z=Kr --nelem=10 --method=lda_x,lda_c_pw"
+  };
+  std::vector<job_t> jobs;
+  for(size_t i=0;i<sizeof(list)/sizeof(list[0]);i++) {
+    std::vector<std::string> w(split(list[i]));
+    job_t job;
+    job.name=w[0];
+    job.program=w[1];
+    job.args.assign(w.begin()+2,w.end());
+    jobs.push_back(job);
+  }
+  return jobs;
+}
+
+/// Read jobs from file, one per line as "name program arguments"
+static std::vector<job_t> read_jobs(const std::string & fname) {
+  std::ifstream in(fname);
+  if(!in.good())
+    throw std::runtime_error("Error opening job file " + fname + "\n");
+
+  std::vector<job_t> jobs;
+  std::string line;
+  while(std::getline(in,line)) {
+    std::vector<std::string> w(split(line));
+    if(!w.size() || w[0][0]=='#')
+      continue;
+    if(w.size()<2)
+      throw std::runtime_error("Invalid job line \"" + line + "\"\n");
+    job_t job;
+    job.name=w[0];
+    job.program=w[1];
+    job.args.assign(w.begin()+2,w.end());
+    jobs.push_back(job);
+  }
+  return jobs;
+}
+
+/// Read the profile report written by the job
+static void read_profile(const std::string & fname, result_t & res) {
+  res.iterations=0;
+  std::ifstream in(fname);
+  std::string line;
+  // Skip header
+  if(!std::getline(in,line))
+    return;
+  while(std::getline(in,line)) {
+    std::istringstream iss(line);
+    std::string path, calls, time;
+    if(!std::getline(iss,path,',') || !std::getline(iss,calls,',') || !std::getline(iss,time,','))
+      continue;
+    phase_t ph;
+    ph.path=path;
+    ph.calls=std::stoul(calls);
+    ph.time=std::stod(time);
+    res.phases.push_back(ph);
+    if(path=="scf")
+      res.iterations=ph.calls;
+  }
+}
+
+/// Run a job, with output redirected into name.log
+static result_t run_job(const job_t & job, const std::string & bindir) {
+  result_t res;
+  res.job=job;
+  res.iterations=0;
+
+  std::string prog(bindir.size() ? bindir + "/" + job.program : job.program);
+  std::string profile(job.name + ".prof.csv");
+  std::string log(job.name + ".log");
+
+  std::vector<std::string> args(job.args);
+  args.push_back("--profile=" + profile);
+
+  std::vector<char *> argv;
+  argv.push_back(const_cast<char *>(prog.c_str()));
+  for(size_t i=0;i<args.size();i++)
+    argv.push_back(const_cast<char *>(args[i].c_str()));
+  argv.push_back(NULL);
+
+  printf("Running %-16s %s",job.name.c_str(),prog.c_str());
+  for(size_t i=0;i<args.size();i++)
+    printf(" %s",args[i].c_str());
+  printf("\n");
+  fflush(stdout);
+
+  Timer t;
+  pid_t pid=fork();
+  if(pid<0)
+    throw std::runtime_error("fork failed\n");
+  if(pid==0) {
+    int fd=open(log.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if(fd>=0) {
+      dup2(fd,STDOUT_FILENO);
+      dup2(fd,STDERR_FILENO);
+      close(fd);
+    }
+    execvp(argv[0],argv.data());
+    _exit(127);
+  }
+
+  int status;
+  struct rusage ru;
+  if(wait4(pid,&status,0,&ru)<0)
+    throw std::runtime_error("wait4 failed\n");
+  res.wall=t.get();
+  res.status=WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  // ru_maxrss is in KiB on Linux
+  res.maxrss=ru.ru_maxrss/1024.0;
+  read_profile(profile,res);
+
+  printf("  status %i, wall time %.3f s, peak RSS %.1f MiB, %zu SCF iterations\n",res.status,res.wall,res.maxrss,res.iterations);
+  fflush(stdout);
+
+  return res;
+}
+
+/// Write out results as CSV, or as JSON if the file name ends in .json
+static void write_results(const std::string & fname, const std::vector<result_t> & results) {
+  bool json(fname.size()>=5 && fname.compare(fname.size()-5,5,".json")==0);
+  FILE *out=fopen(fname.c_str(),"w");
+  if(!out)
+    throw std::runtime_error("Error opening results file " + fname + "\n");
+
+  if(json) {
+    fprintf(out,"{\n  \"jobs\": [\n");
+    for(size_t i=0;i<results.size();i++) {
+      const result_t & r(results[i]);
+      fprintf(out,"    {\"name\": \"%s\", \"program\": \"%s\", \"status\": %i, \"wall\": %.6e, \"maxrss_mib\": %.3f, \"iterations\": %zu, \"phases\": {",r.job.name.c_str(),r.job.program.c_str(),r.status,r.wall,r.maxrss,r.iterations);
+      for(size_t j=0;j<r.phases.size();j++)
+        fprintf(out,"%s\"%s\": {\"calls\": %zu, \"time\": %.6e}",j ? ", " : "",r.phases[j].path.c_str(),r.phases[j].calls,r.phases[j].time);
+      fprintf(out,"}}%s\n",(i+1<results.size()) ? "," : "");
+    }
+    fprintf(out,"  ]\n}\n");
+  } else {
+    fprintf(out,"job,program,status,wall,maxrss_mib,iterations,phase,calls,time\n");
+    for(size_t i=0;i<results.size();i++) {
+      const result_t & r(results[i]);
+      fprintf(out,"%s,%s,%i,%.6e,%.3f,%zu,total,1,%.6e\n",r.job.name.c_str(),r.job.program.c_str(),r.status,r.wall,r.maxrss,r.iterations,r.wall);
+      for(size_t j=0;j<r.phases.size();j++)
+        fprintf(out,"%s,%s,%i,%.6e,%.3f,%zu,%s,%zu,%.6e\n",r.job.name.c_str(),r.job.program.c_str(),r.status,r.wall,r.maxrss,r.iterations,r.phases[j].path.c_str(),r.phases[j].calls,r.phases[j].time);
+    }
+  }
+  fclose(out);
+}
+
+int main(int argc, char **argv) {
+  cmdline::parser parser;
+  parser.add<std::string>("bindir", 0, "directory of the HelFEM executables, default is that of this program", false, "");
+  parser.add<std::string>("jobs", 0, "file with jobs to run, one \"name program arguments\" per line, default is the reference set", false, "");
+  parser.add<std::string>("only", 0, "comma separated list of jobs to run", false, "");
+  parser.add<std::string>("output", 0, "results file, JSON if name ends in .json, CSV otherwise", false, "scf_bench.csv");
+  parser.add<bool>("list", 0, "list the jobs and exit", false, false);
+  parser.parse_check(argc, argv);
+
+  std::string bindir(parser.get<std::string>("bindir"));
+  if(!bindir.size()) {
+    std::string self(argv[0]);
+    size_t pos(self.find_last_of('/'));
+    if(pos!=std::string::npos)
+      bindir=self.substr(0,pos);
+  }
+  std::string jobfile(parser.get<std::string>("jobs"));
+  std::vector<job_t> jobs(jobfile.size() ? read_jobs(jobfile) : reference_jobs());
+
+  std::string only(parser.get<std::string>("only"));
+  if(only.size()) {
+    std::string list(","+only+",");
+    std::vector<job_t> sel;
+    for(size_t i=0;i<jobs.size();i++)
+      if(list.find(","+jobs[i].name+",")!=std::string::npos)
+        sel.push_back(jobs[i]);
+    jobs=sel;
+  }
+
+  if(parser.get<bool>("list")) {
+    for(size_t i=0;i<jobs.size();i++) {
+      printf("%-16s %s",jobs[i].name.c_str(),jobs[i].program.c_str());
+      for(size_t j=0;j<jobs[i].args.size();j++)
+        printf(" %s",jobs[i].args[j].c_str());
+      printf("\n");
+    }
+    return 0;
+  }
+
+  std::vector<result_t> results;
+  for(size_t i=0;i<jobs.size();i++)
+    results.push_back(run_job(jobs[i],bindir));
+
+  std::string output(parser.get<std::string>("output"));
+  write_results(output,results);
+  printf("\nResults written to %s\n",output.c_str());
+
+  return 0;
+}
@@ -14,8 +14,12 @@
  * of the License, or (at your option) any later version.
  */
 #include "scf_helpers.h"
+#include "constants.h"
 #include "timer.h"
+#include "threading.h"
+#include <algorithm>
 #include <cfloat>
+#include <cstdint>
 
 namespace helfem {
   namespace scf {
@@ -28,6 +32,22 @@ namespace helfem {
         return arma::zeros<arma::mat>(C.n_rows,C.n_rows);
     }
 
+    arma::mat form_density(const arma::mat & C, const arma::vec & occ) {
+      if(C.n_cols<occ.n_elem)
+        throw std::logic_error("Not enough orbitals!\n");
+      else if(occ.n_elem>0)
+        return C.cols(0,occ.n_elem-1)*arma::diagmat(occ)*arma::trans(C.cols(0,occ.n_elem-1));
+      else
+        return arma::zeros<arma::mat>(C.n_rows,C.n_rows);
+    }
+
+    arma::mat fock_from_orbitals(const arma::mat & S, const arma::mat & C, const arma::vec & E) {
+      if(C.n_cols != E.n_elem)
+        throw std::logic_error("Orbitals and orbital energies don't match!\n");
+      arma::mat SC(S*C);
+      return SC*arma::diagmat(E)*arma::trans(SC);
+    }
+
     void enforce_occupations(arma::mat & C, arma::vec & E, const arma::mat & S, const arma::ivec & nocc, const std::vector<arma::uvec> & m_idx) {
       if(nocc.n_elem != m_idx.size())
         throw std::logic_error("nocc vector and symmetry indices don't match!\n");
@@ -128,9 +148,9 @@ namespace helfem {
       E=E(newidx);
     }
 
-    void eig_gsym(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh) {
-      // Form matrix in orthonormal basis
-      arma::mat Forth(Sinvh.t()*F*Sinvh);
+    void eig_orth(arma::vec & E, arma::mat & C, const arma::mat & Forth, const arma::mat & Sinvh) {
+      // The full problem is solved with all threads
+      threading::ParallelBLAS blas;
 
       if(!arma::eig_sym(E,C,Forth))
         throw std::logic_error("Eigendecomposition failed!\n");
@@ -139,11 +159,19 @@ namespace helfem {
       C=Sinvh*C;
     }
 
-    void eig_gsym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, bool verbose) {
-      E.zeros(F.n_rows);
-      C.zeros(F.n_rows,F.n_rows);
+    void eig_gsym(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh) {
+      // The full problem is solved with all threads
+      threading::ParallelBLAS blas;
 
-      size_t iidx=0;
+      // Form matrix in orthonormal basis
+      eig_orth(E,C,arma::mat(Sinvh.t()*F*Sinvh),Sinvh);
+    }
+
+    SymmetryOrthogonalizer::SymmetryOrthogonalizer() : Nbf(0) {
+    }
+
+    SymmetryOrthogonalizer::SymmetryOrthogonalizer(const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx) : Nbf(Sinvh.n_rows) {
+      size_t ncols=0;
       // Loop over symmetries
       for(size_t isym=0;isym<m_idx.size();isym++) {
         // Find basis vectors that belong to this symmetry
@@ -155,29 +183,55 @@ namespace helfem {
 
         // Column indices of Sinvh that have non-zero elements
         arma::uvec Sind(arma::find(Snrm));
+        if(!Sind.n_elem)
+          continue;
 
-        // Solve subproblem
-        arma::vec Esub;
-        arma::mat Csub;
-        eig_gsym(Esub,Csub,F,Sinvh.cols(Sind));
+        idx.push_back(m_idx[isym]);
+        X.push_back(Scmp.cols(Sind));
+        ncols+=Sind.n_elem;
+      }
+      // Every vector must be found in exactly one symmetry, in which
+      // case the vectors vanish outside their own block
+      if(ncols!=Nbf) {
+        std::ostringstream oss;
+        oss << "Symmetry mismatch: expected " << Nbf << " vectors but got " << ncols << "!\n";
+        throw std::logic_error(oss.str());
+      }
+    }
 
-        // Store solutions
-        E.subvec(iidx,iidx+Esub.n_elem-1)=Esub;
-        C.cols(iidx,iidx+Esub.n_elem-1)=Csub;
+    void SymmetryOrthogonalizer::eig(arma::vec & E, arma::mat & C, const arma::mat & F) const {
+      if(F.n_rows != Nbf || F.n_cols != Nbf)
+        throw std::logic_error("Fock matrix does not match the orthogonalizer!\n");
+
+      // Offsets of the blocks
+      std::vector<size_t> ioff(X.size()+1,0);
+      for(size_t isym=0;isym<X.size();isym++)
+        ioff[isym+1]=ioff[isym]+X[isym].n_cols;
 
-#if 0
-        printf("Symmetry %i\n",isym);
-        Esub.t().print();
+      E.zeros(Nbf);
+      C.zeros(Nbf,Nbf);
+      int nfail=0;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:nfail)
 #endif
+      for(size_t isym=0;isym<X.size();isym++) {
+        // Form matrix in orthonormal basis
+        arma::mat Forth(X[isym].t()*F(idx[isym],idx[isym])*X[isym]);
 
-        // Increment offset
-        iidx+=Esub.n_elem;
-      }
-      if(iidx!=F.n_rows) {
-        std::ostringstream oss;
-        oss << "Symmetry mismatch: expected " << F.n_rows << " vectors but got " << iidx << "!\n";
-        throw std::logic_error(oss.str());
+        arma::vec Esub;
+        arma::mat Csub;
+        if(!arma::eig_sym(Esub,Csub,Forth)) {
+          nfail++;
+          continue;
+        }
+
+        // Store solutions
+        arma::uvec cidx(arma::linspace<arma::uvec>(ioff[isym],ioff[isym+1]-1,Esub.n_elem));
+        E(cidx)=Esub;
+        C(idx[isym],cidx)=X[isym]*Csub;
       }
+      if(nfail)
+        throw std::logic_error("Eigendecomposition failed!\n");
 
       // Sort energies
       arma::uvec Eord=arma::sort_index(E,"ascend");
@@ -185,9 +239,15 @@ namespace helfem {
       C=C.cols(Eord);
     }
 
+    void eig_gsym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, bool verbose) {
+      SymmetryOrthogonalizer(Sinvh,m_idx).eig(E,C,F);
+    }
+
     void eig_sym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const std::vector<arma::uvec> & m_idx) {
       E.zeros(F.n_rows);
       C.zeros(F.n_rows,F.n_rows);
+      // The blocks are solved one after the other with all threads
+      threading::ParallelBLAS blas;
 
       size_t iidx=0;
       // Loop over symmetries
@@ -283,6 +343,70 @@ namespace helfem {
       return Fout;
     }
 
+    FockSymmetrizer::FockSymmetrizer() : Nbf(0) {
+    }
+
+    FockSymmetrizer::FockSymmetrizer(size_t Nbf_, const std::vector<arma::uvec> & m_idx, const std::vector< std::vector<arma::uvec> > & sym_idx) : Nbf(Nbf_) {
+      if(m_idx.size()) {
+        block.assign(Nbf,-1);
+        for(size_t isym=0;isym<m_idx.size();isym++)
+          for(size_t i=0;i<m_idx[isym].n_elem;i++) {
+            arma::uword ibf(m_idx[isym](i));
+            if(ibf>=Nbf)
+              throw std::logic_error("Symmetry block index out of bounds!\n");
+            if(block[ibf]!=-1)
+              throw std::logic_error("Symmetry blocks overlap!\n");
+            block[ibf]=isym;
+          }
+      }
+
+      for(size_t isym=0;isym<sym_idx.size();isym++) {
+        if(!sym_idx[isym].size())
+          continue;
+        const size_t n(sym_idx[isym][0].n_elem);
+        avg_start.push_back(avg_off.size());
+        avg_ncopy.push_back(sym_idx[isym].size());
+        avg_nel.push_back(n*n);
+        for(size_t ic=0;ic<sym_idx[isym].size();ic++) {
+          const arma::uvec & idx(sym_idx[isym][ic]);
+          if(idx.n_elem!=n)
+            throw std::logic_error("Averaged symmetry copies differ in size!\n");
+          for(size_t j=0;j<n;j++)
+            for(size_t i=0;i<n;i++)
+              avg_off.push_back(idx(i)+idx(j)*Nbf);
+        }
+      }
+    }
+
+    void FockSymmetrizer::apply(arma::mat & F) const {
+      if(F.n_rows!=Nbf || F.n_cols!=Nbf)
+        throw std::logic_error("Matrix does not match the symmetrizer!\n");
+      double *f(F.memptr());
+
+      for(size_t ig=0;ig<avg_start.size();ig++) {
+        const arma::uword *off(avg_off.data()+avg_start[ig]);
+        const size_t nc(avg_ncopy[ig]), nel(avg_nel[ig]);
+        for(size_t k=0;k<nel;k++) {
+          double avg=0.0;
+          for(size_t ic=0;ic<nc;ic++)
+            avg+=f[off[ic*nel+k]];
+          avg/=nc;
+          for(size_t ic=0;ic<nc;ic++)
+            f[off[ic*nel+k]]=avg;
+        }
+      }
+
+      if(block.size()) {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for(size_t j=0;j<Nbf;j++)
+          for(size_t i=0;i<Nbf;i++)
+            if(block[i]<0 || block[i]!=block[j])
+              f[i+j*Nbf]=0.0;
+      }
+    }
+
     void sort_eig(arma::vec & Eorb, arma::mat & Cocc, arma::mat & Cvirt, const arma::mat & Fao, size_t Nact, int maxit, double convthr) {
       // Initialize vector
       arma::mat C(Cocc.n_rows,Cocc.n_cols+Cvirt.n_cols);
@@ -419,6 +543,256 @@ namespace helfem {
         Cvirt.clear();
     }
 
+    /// Orthonormalize the columns of W against V and each other in the S metric; SV=S*V. Returns the number of columns kept.
+    static size_t davidson_orthonormalize(arma::mat & W, arma::mat & SW, const arma::mat & V, const arma::mat & SV, const arma::mat & S) {
+      const double eps=1e-8;
+
+      std::vector<arma::uword> keep;
+      SW.zeros(W.n_rows,W.n_cols);
+      for(size_t j=0;j<W.n_cols;j++) {
+        arma::vec w(W.col(j));
+        // Two passes of classical Gram-Schmidt
+        for(int ipass=0;ipass<2;ipass++) {
+          if(V.n_cols)
+            w-=V*(SV.t()*w);
+          for(size_t k=0;k<keep.size();k++)
+            w-=W.col(keep[k])*arma::dot(SW.col(keep[k]),w);
+        }
+        arma::vec Sw(S*w);
+        double nrm(arma::dot(w,Sw));
+        if(nrm<eps*eps)
+          continue;
+        nrm=sqrt(nrm);
+        W.col(j)=w/nrm;
+        SW.col(j)=Sw/nrm;
+        keep.push_back(j);
+      }
+
+      arma::uvec kidx(arma::conv_to<arma::uvec>::from(keep));
+      W=W.cols(kidx);
+      SW=SW.cols(kidx);
+      return keep.size();
+    }
+
+    bool eig_davidson(arma::vec & Eout, arma::mat & Cout, const arma::mat & F, const arma::mat & S, size_t neig, int maxit, double convthr, bool verbose) {
+      if(neig>F.n_rows)
+        throw std::logic_error("Asking for more eigenvalues than there are basis functions!\n");
+      if(Cout.n_rows != F.n_rows || Cout.n_cols < neig)
+        return false;
+
+      // Maximal size of the subspace
+      const size_t maxsub(std::min<size_t>(F.n_rows,std::max<size_t>(4*neig,neig+20)));
+      // Preconditioner
+      const arma::vec Fdiag(arma::diagvec(F));
+      const arma::vec Sdiag(arma::diagvec(S));
+
+      // Initial subspace
+      arma::mat V(Cout.cols(0,neig-1)), SV;
+      davidson_orthonormalize(V,SV,arma::mat(),arma::mat(),S);
+      if(V.n_cols<neig)
+        return false;
+      arma::mat FV(F*V);
+
+      for(int it=0;it<maxit;it++) {
+        // Rayleigh-Ritz
+        arma::mat Fsub(V.t()*FV);
+        Fsub=0.5*(Fsub+Fsub.t());
+        arma::vec theta;
+        arma::mat Y;
+        if(!arma::eig_sym(theta,Y,Fsub))
+          throw std::logic_error("Eigendecomposition failed!\n");
+        Y=Y.cols(0,neig-1);
+        theta=theta.subvec(0,neig-1);
+
+        // Residuals
+        arma::mat SX(SV*Y);
+        arma::mat R(FV*Y-SX*arma::diagmat(theta));
+        arma::vec Rnrm(neig);
+        for(size_t i=0;i<neig;i++)
+          Rnrm(i)=arma::norm(R.col(i),2);
+        if(verbose)
+          printf("Davidson iteration %i subspace %i max residual %e\n",it,(int) V.n_cols,arma::max(Rnrm));
+
+        if(arma::max(Rnrm)<convthr) {
+          Eout=theta;
+          Cout=V*Y;
+          return true;
+        }
+
+        // Preconditioned corrections for the unconverged roots
+        arma::uvec unconv(arma::find(Rnrm>=convthr));
+        arma::mat W(F.n_rows,unconv.n_elem);
+        for(size_t i=0;i<unconv.n_elem;i++) {
+          arma::vec d(Fdiag-theta(unconv(i))*Sdiag);
+          for(size_t j=0;j<d.n_elem;j++)
+            if(std::abs(d(j))<1e-4)
+              d(j)=(d(j)<0.0) ? -1e-4 : 1e-4;
+          W.col(i)=-R.col(unconv(i))/d;
+        }
+
+        // Restart from the Ritz vectors if the subspace gets too big
+        if(V.n_cols+W.n_cols>maxsub) {
+          V=V*Y;
+          FV=FV*Y;
+          SV=SX;
+        }
+
+        arma::mat SW;
+        if(!davidson_orthonormalize(W,SW,V,SV,S))
+          // Stagnated
+          return false;
+        V=arma::join_rows(V,W);
+        SV=arma::join_rows(SV,SW);
+        FV=arma::join_rows(FV,F*W);
+      }
+
+      return false;
+    }
+
+    arma::uvec orbital_symmetries(const arma::mat & C, const std::vector<arma::uvec> & m_idx) {
+      arma::uvec osym(C.n_cols,arma::fill::zeros);
+      if(m_idx.size()<2)
+        return osym;
+
+      arma::mat w(m_idx.size(),C.n_cols);
+      for(size_t isym=0;isym<m_idx.size();isym++)
+        w.row(isym)=arma::sum(arma::square(C.rows(m_idx[isym])),0);
+      for(size_t io=0;io<C.n_cols;io++)
+        osym(io)=w.col(io).index_max();
+      return osym;
+    }
+
+    arma::mat rotation_mask(const arma::uvec & osym, size_t nocc) {
+      size_t nvirt(osym.n_elem-nocc);
+      arma::mat mask(nvirt,nocc);
+      for(size_t i=0;i<nocc;i++)
+        for(size_t a=0;a<nvirt;a++)
+          mask(a,i)=(osym(nocc+a)==osym(i)) ? 1.0 : 0.0;
+      return mask;
+    }
+
+    arma::mat rotate_orbitals(const arma::mat & C, const arma::mat & kappa) {
+      size_t nocc(kappa.n_cols);
+      size_t nvirt(kappa.n_rows);
+      if(C.n_cols != nocc+nvirt)
+        throw std::logic_error("Rotation does not match number of orbitals!\n");
+      if(!nocc || !nvirt)
+        return C;
+
+      /*
+        With the thin SVD kappa = U s V^T the exponential of
+        K = [0 -kappa^T; kappa 0] is available in closed form,
+          occ  <- occ V cos(s) V^T + virt U sin(s) V^T
+          virt <- virt - occ V sin(s) U^T + virt U (cos(s)-1) U^T
+        which stays exactly orthogonal and costs O(N nocc^2).
+      */
+      arma::mat U, V;
+      arma::vec sv;
+      if(!arma::svd_econ(U,sv,V,kappa))
+        throw std::logic_error("SVD of orbital rotation failed!\n");
+
+      arma::mat Cocc(C.cols(0,nocc-1));
+      arma::mat Cvirt(C.cols(nocc,C.n_cols-1));
+      arma::mat CoV(Cocc*V);
+      arma::mat CvU(Cvirt*U);
+
+      arma::mat Cnew(C.n_rows,C.n_cols);
+      Cnew.cols(0,nocc-1)=(CoV*arma::diagmat(arma::cos(sv)) + CvU*arma::diagmat(arma::sin(sv)))*V.t();
+      Cnew.cols(nocc,C.n_cols-1)=Cvirt + (CvU*arma::diagmat(arma::cos(sv)-1.0) - CoV*arma::diagmat(arma::sin(sv)))*U.t();
+      return Cnew;
+    }
+
+    std::vector<arma::mat> cpscf(const std::vector<arma::mat> & C, const std::vector<arma::vec> & E, const std::vector<size_t> & nocc, const arma::mat & V, const response_fock_t & G, double convthr, int maxit) {
+      size_t ns(C.size());
+      if(E.size() != ns || nocc.size() != ns)
+        throw std::logic_error("Inconsistent number of spin channels in response calculation!\n");
+
+      // Occupied and virtual orbitals, and offsets of the rotations
+      std::vector<arma::mat> Co(ns), Cv(ns);
+      std::vector<size_t> off(ns+1,0);
+      for(size_t is=0;is<ns;is++) {
+        if(E[is].n_elem != C[is].n_cols)
+          throw std::logic_error("Response calculation requires all orbitals!\n");
+        size_t nv(C[is].n_cols-nocc[is]);
+        if(nocc[is] && nv) {
+          Co[is]=C[is].cols(0,nocc[is]-1);
+          Cv[is]=C[is].cols(nocc[is],C[is].n_cols-1);
+        }
+        off[is+1]=off[is]+nocc[is]*nv;
+      }
+
+      // Right-hand side and orbital energy differences
+      arma::vec rhs(off[ns]), diag(off[ns]);
+      for(size_t is=0;is<ns;is++) {
+        if(off[is+1]==off[is])
+          continue;
+        rhs.subvec(off[is],off[is+1]-1)=-arma::vectorise(Cv[is].t()*V*Co[is]);
+        arma::mat de(Cv[is].n_cols,Co[is].n_cols);
+        for(size_t i=0;i<de.n_cols;i++)
+          for(size_t a=0;a<de.n_rows;a++)
+            de(a,i)=std::max(E[is](nocc[is]+a)-E[is](i),1e-3);
+        diag.subvec(off[is],off[is+1]-1)=arma::vectorise(de);
+      }
+
+      // First-order density matrices of the rotations
+      auto density=[&](const arma::vec & u) {
+        std::vector<arma::mat> P1(ns);
+        for(size_t is=0;is<ns;is++) {
+          P1[is].zeros(C[is].n_rows,C[is].n_rows);
+          if(off[is+1]==off[is])
+            continue;
+          arma::mat X(Cv[is]*arma::reshape(u.subvec(off[is],off[is+1]-1),Cv[is].n_cols,Co[is].n_cols)*Co[is].t());
+          P1[is]=X+X.t();
+        }
+        return P1;
+      };
+      // Electronic Hessian times rotation vector
+      auto hessian=[&](const arma::vec & u) {
+        std::vector<arma::mat> G1(G(density(u)));
+        arma::vec r(diag%u);
+        for(size_t is=0;is<ns;is++) {
+          if(off[is+1]==off[is])
+            continue;
+          r.subvec(off[is],off[is+1]-1)+=arma::vectorise(Cv[is].t()*G1[is]*Co[is]);
+        }
+        return r;
+      };
+
+      if(!off[ns])
+        return density(rhs);
+
+      // Preconditioned conjugate gradients, starting from the uncoupled solution
+      arma::vec x(rhs/diag);
+      arma::vec r(rhs-hessian(x));
+      arma::vec z(r/diag);
+      arma::vec p(z);
+      double rz(arma::dot(r,z));
+      bool convd=false;
+      for(int it=1;it<=maxit;it++) {
+        arma::vec Ap(hessian(p));
+        double alpha(rz/arma::dot(p,Ap));
+        x+=alpha*p;
+        r-=alpha*Ap;
+
+        double rnorm(arma::norm(r,2));
+        printf("CPSCF iteration %i: residual norm %e\n",it,rnorm);
+        fflush(stdout);
+        if(rnorm<convthr) {
+          convd=true;
+          break;
+        }
+
+        z=r/diag;
+        double rznew(arma::dot(r,z));
+        p=z+(rznew/rz)*p;
+        rz=rznew;
+      }
+      if(!convd)
+        printf("Warning - CPSCF equations did not converge in %i iterations\n",maxit);
+
+      return density(x);
+    }
+
     arma::mat perturbation_matrix(size_t N, double ampl) {
       arma::mat R(N,N);
       // Uniform distribution
@@ -603,6 +977,22 @@ namespace helfem {
     }
 
     arma::vec parse_xc_params(const std::string & input) {
+      return parse_list(input);
+    }
+
+    std::string hash_string(const std::string & str) {
+      // 64-bit FNV-1a; the value does not depend on the platform or the run
+      uint64_t h=UINT64_C(14695981039346656037);
+      for(size_t i=0;i<str.size();i++) {
+        h^=(unsigned char) str[i];
+        h*=UINT64_C(1099511628211);
+      }
+      char buf[17];
+      snprintf(buf,sizeof(buf),"%016llx",(unsigned long long) h);
+      return std::string(buf);
+    }
+
+    arma::vec parse_list(const std::string & input) {
       arma::vec r;
       if(input.size()) {
         // Is this a file name?
@@ -615,12 +1005,215 @@ namespace helfem {
           // Load the file
           r.load(input,arma::raw_ascii);
         } else {
-          // Assume string input
-          r = arma::vec(input);
+          // Assume string input; allow commas as separators
+          std::string str(input);
+          std::replace(str.begin(), str.end(), ',', ' ');
+          r = arma::vec(str);
         }
       }
 
       return r;
     }
+
+    arma::vec field_derivatives(const arma::vec & F, const arma::vec & E, int order) {
+      if(F.n_elem != E.n_elem)
+        throw std::logic_error("Field and energy vectors are of different length!\n");
+      if(F.n_elem < 2)
+        throw std::logic_error("Need at least two field strengths for the fit!\n");
+      order=std::min(order,(int) F.n_elem-1);
+
+      // Taylor series E(F) = sum_k E^(k) F^k / k!
+      arma::mat A(F.n_elem,order+1);
+      for(size_t i=0;i<F.n_elem;i++) {
+        double term=1.0;
+        for(int k=0;k<=order;k++) {
+          A(i,k)=term;
+          term*=F(i)/(k+1);
+        }
+      }
+      return arma::solve(A,E);
+    }
+
+    OmegaTuning::OmegaTuning() : tune(false), maxit(0), thr(0.0), results(0,5) {
+    }
+
+    OmegaTuning::OmegaTuning(const arma::vec & scan_, bool tune_, int maxit_, double thr_) : scan(scan_), tune(tune_), maxit(maxit_), thr(thr_), results(0,5) {
+      if(arma::any(scan<=0.0))
+        throw std::logic_error("The range-separation parameter must be positive!\n");
+    }
+
+    bool OmegaTuning::active() const {
+      return scan.n_elem>0 || tune;
+    }
+
+    arma::uword OmegaTuning::best() const {
+      return arma::index_min(arma::abs(results.col(4)));
+    }
+
+    bool OmegaTuning::next(double & omega) const {
+      if(results.n_rows<scan.n_elem) {
+        omega=scan(results.n_rows);
+        return true;
+      }
+      if(!tune || !results.n_rows || converged() || (int) (results.n_rows-scan.n_elem)>=maxit)
+        return false;
+
+      const arma::vec w(results.col(0)), J(results.col(4));
+      const arma::uword ib(best());
+      if(results.n_rows==1) {
+        // No slope yet
+        omega=1.25*w(ib);
+        return true;
+      }
+
+      // Closest points on either side of the root
+      arma::uvec neg(arma::find(J<0.0)), pos(arma::find(J>0.0));
+      arma::uword i1, i2;
+      if(neg.n_elem && pos.n_elem) {
+        i1=neg(arma::index_min(arma::abs(J(neg))));
+        i2=pos(arma::index_min(J(pos)));
+      } else {
+        // Secant through the two best points
+        arma::uvec idx(arma::sort_index(arma::abs(J)));
+        i1=idx(0);
+        i2=idx(1);
+      }
+      if(J(i1)==J(i2))
+        throw std::runtime_error("Tuning condition does not depend on omega!\n");
+      omega=w(i1)-J(i1)*(w(i2)-w(i1))/(J(i2)-J(i1));
+
+      // Limit the step outside a bracket to a factor of two
+      if(!(neg.n_elem && pos.n_elem))
+        omega=std::min(std::max(omega,0.5*w(ib)),2.0*w(ib));
+      return true;
+    }
+
+    void OmegaTuning::add(double omega, double Eneutral, double Eion, double ehomo) {
+      arma::rowvec row={omega, Eneutral, Eion, ehomo, ehomo+Eion-Eneutral};
+      results.insert_rows(results.n_rows,row);
+      printf("omega = % .8f: IP = % .10f, -eps_HOMO = % .10f, J = % .6e\n",omega,Eion-Eneutral,-ehomo,row(4));
+      fflush(stdout);
+    }
+
+    bool OmegaTuning::converged() const {
+      return results.n_rows>0 && std::abs(results(best(),4))<thr;
+    }
+
+    double OmegaTuning::optimum() const {
+      if(!results.n_rows)
+        throw std::logic_error("No points in the omega scan!\n");
+      return results(best(),0);
+    }
+
+    arma::mat OmegaTuning::table() const {
+      return results;
+    }
+
+    void OmegaTuning::print() const {
+      printf("\nRange-separation parameter scan\n");
+      printf("%12s %20s %20s %14s %14s %14s\n","omega","E(N)","E(N-1)","IP (eV)","-eps_HOMO (eV)","J (eV)");
+      for(size_t i=0;i<results.n_rows;i++)
+        printf("%12.8f % 20.10f % 20.10f % 14.6f % 14.6f % 14.6e\n",results(i,0),results(i,1),results(i,2),(results(i,2)-results(i,1))*HARTREEINEV,-results(i,3)*HARTREEINEV,results(i,4)*HARTREEINEV);
+      if(tune) {
+        if(converged())
+          printf("Tuned omega = %.8f\n",optimum());
+        else
+          printf("Tuning did not converge, best omega = %.8f\n",optimum());
+      }
+      printf("\n");
+    }
+
+    FermiSmearing::FermiSmearing() : T(0.0), anneal(0.0), Tmin(0.0), integer(true) {
+    }
+
+    FermiSmearing::FermiSmearing(double T_, double anneal_, double Tmin_, bool integer_) : T(T_), anneal(anneal_), Tmin(Tmin_), integer(integer_) {
+      if(T<0.0 || Tmin<0.0)
+        throw std::logic_error("Smearing temperatures must be non-negative!\n");
+      if(anneal<=0.0 || anneal>1.0)
+        throw std::logic_error("Smearing annealing factor must be in (0,1]!\n");
+      if(T>0.0 && Tmin==0.0)
+        throw std::logic_error("The final smearing temperature must be positive!\n");
+      if(T>0.0 && T<=Tmin && integer)
+        // Nothing to anneal
+        T=0.0;
+    }
+
+    bool FermiSmearing::active() const {
+      return T>0.0;
+    }
+
+    bool FermiSmearing::annealed() const {
+      return T<=Tmin;
+    }
+
+    double FermiSmearing::temperature() const {
+      return T;
+    }
+
+    /// Fermi function without overflow
+    static double fermi_function(double x) {
+      if(x>0.0) {
+        double e(std::exp(-x));
+        return e/(1.0+e);
+      }
+      return 1.0/(1.0+std::exp(x));
+    }
+
+    arma::vec FermiSmearing::occupations(const arma::vec & E, size_t nel) const {
+      if(nel==0)
+        return arma::vec();
+      if(nel>E.n_elem)
+        throw std::logic_error("Not enough orbitals for the smeared occupations!\n");
+      if(nel==E.n_elem)
+        return arma::ones<arma::vec>(nel);
+
+      // Bisection for the chemical potential
+      double mulo(arma::min(E)-50.0*T), muhi(arma::max(E)+50.0*T);
+      arma::vec f(E.n_elem);
+      for(int it=0;it<200;it++) {
+        double mu(0.5*(mulo+muhi));
+        for(size_t i=0;i<E.n_elem;i++)
+          f(i)=fermi_function((E(i)-mu)/T);
+        double N(arma::sum(f));
+        if(std::abs(N-nel)<1e-13*nel)
+          break;
+        if(N>nel)
+          muhi=mu;
+        else
+          mulo=mu;
+      }
+      // Renormalize the remaining error away
+      f*=nel/arma::sum(f);
+
+      // Drop the negligible tail
+      size_t nocc(f.n_elem);
+      while(nocc>nel && f(nocc-1)<DBL_EPSILON)
+        nocc--;
+      return f.subvec(0,nocc-1);
+    }
+
+    double FermiSmearing::entropy_energy(const arma::vec & occ) const {
+      double S=0.0;
+      for(size_t i=0;i<occ.n_elem;i++) {
+        double f(occ(i));
+        if(f>0.0 && f<1.0)
+          S-=f*std::log(f)+(1.0-f)*std::log(1.0-f);
+      }
+      return -T*S;
+    }
+
+    bool FermiSmearing::anneal_step() {
+      if(!active() || annealed())
+        return false;
+      T*=anneal;
+      if(T<=Tmin) {
+        T=Tmin;
+        if(integer) {
+          T=0.0;
+          return true;
+        }
+      }
+      return false;
+    }
   }
 }
@@ -16,12 +16,17 @@
 #ifndef SCF_HELPERS_H
 #define SCF_HELPERS_H
 #include <armadillo>
+#include <functional>
 #include <helfem.h>
 
 namespace helfem {
   namespace scf {
     /// Form density matrix
     arma::mat form_density(const arma::mat & C, size_t nocc);
+    /// Form density matrix with fractional occupations of the first occ.n_elem orbitals
+    arma::mat form_density(const arma::mat & C, const arma::vec & occ);
+    /// Fock matrix that has the given orbitals and orbital energies, S C diag(E) C^T S
+    arma::mat fock_from_orbitals(const arma::mat & S, const arma::mat & C, const arma::vec & E);
     /// Enforce occupation of wanted symmetries
     void enforce_occupations(arma::mat & C, arma::vec & E, const arma::mat & S, const arma::ivec & nocc, const std::vector<arma::uvec> & m_idx);
 
@@ -29,11 +34,64 @@ namespace helfem {
     arma::mat enforce_fock_symmetry(const arma::mat & Fin, const std::vector<arma::uvec> & m_idx);
     /// Average out the Fock matrix
     arma::mat fock_symmetry_average(const arma::mat & Fin, const std::vector< std::vector<arma::uvec> > & sym_idx);
+    /**
+     * Precompiled Fock matrix symmetrization. The averaging groups are
+     * flattened once into column-major element offsets and the
+     * symmetry blocking into a block label per basis function, so that
+     * apply() runs in place without forming any submatrices; it is
+     * equivalent to fock_symmetry_average followed by
+     * enforce_fock_symmetry.
+     */
+    class FockSymmetrizer {
+      /// Number of basis functions
+      size_t Nbf;
+      /// Symmetry block of each function, -1 if in none; empty if symmetry is not enforced
+      std::vector<int> block;
+      /// Element offsets of the averaged copies, copy ic of group ig starts at avg_start[ig]+ic*avg_nel[ig]
+      std::vector<arma::uword> avg_off;
+      /// Start of each averaging group
+      std::vector<size_t> avg_start;
+      /// Number of copies in each averaging group
+      std::vector<size_t> avg_ncopy;
+      /// Number of elements in a copy
+      std::vector<size_t> avg_nel;
+    public:
+      /// Dummy constructor
+      FockSymmetrizer();
+      /// Constructor; either list may be empty
+      FockSymmetrizer(size_t Nbf, const std::vector<arma::uvec> & m_idx, const std::vector< std::vector<arma::uvec> > & sym_idx);
+      /// Average and block the matrix in place
+      void apply(arma::mat & F) const;
+    };
 
+    /// Solve eigenvalue problem of a matrix given in the orthonormal basis, returning the vectors in the original basis
+    void eig_orth(arma::vec & E, arma::mat & C, const arma::mat & Forth, const arma::mat & Sinvh);
     /// Solve generalized eigenvalue problem
     void eig_gsym(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh);
     /// Solve generalized eigenvalue problem in subspaces
     void eig_gsym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx, bool verbose=true);
+    /**
+     * Symmetry blocked orthogonalizer. The columns of Sinvh that belong
+     * to each symmetry are found once, and only the rows within the
+     * symmetry are kept, so that each diagonalization only needs the
+     * diagonal blocks of the Fock matrix.
+     */
+    class SymmetryOrthogonalizer {
+      /// Number of basis functions
+      size_t Nbf;
+      /// Basis functions in each symmetry
+      std::vector<arma::uvec> idx;
+      /// Orthogonalizing block of each symmetry
+      std::vector<arma::mat> X;
+    public:
+      /// Dummy constructor
+      SymmetryOrthogonalizer();
+      /// Constructor
+      SymmetryOrthogonalizer(const arma::mat & Sinvh, const std::vector<arma::uvec> & m_idx);
+      /// Solve the generalized eigenvalue problem, the blocks are done in parallel
+      void eig(arma::vec & E, arma::mat & C, const arma::mat & F) const;
+    };
+
     /// Solve eigenvalue problem in subspaces
     void eig_sym_sub(arma::vec & E, arma::mat & C, const arma::mat & F, const std::vector<arma::uvec> & m_idx);
 
@@ -47,6 +105,33 @@ namespace helfem {
     /// Iterative eigenvalue solver
     void eig_iter(arma::vec & E, arma::mat & Cocc, arma::mat & Cvirt, const arma::mat & F, const arma::mat & Sinvh, size_t nocc, size_t neig, size_t nsub, int maxit, double convthr);
 
+    /**
+     * Block Davidson solver for the lowest neig solutions of F C = S C E,
+     * warm started from the columns of C. The correction vectors use the
+     * diagonal of F - E S as preconditioner. Returns false if the solver
+     * did not converge in maxit iterations, in which case E and C are
+     * left unchanged.
+     */
+    bool eig_davidson(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & S, size_t neig, int maxit, double convthr, bool verbose=false);
+
+    /// Symmetry block of each orbital: the block of basis functions that carries most of its weight
+    arma::uvec orbital_symmetries(const arma::mat & C, const std::vector<arma::uvec> & m_idx);
+    /// Mask of the allowed virtual-occupied rotations: only orbitals of the same symmetry are mixed
+    arma::mat rotation_mask(const arma::uvec & osym, size_t nocc);
+    /// Rotate the orbitals by exp(K), where K is antisymmetric with the virtual-occupied block kappa
+    arma::mat rotate_orbitals(const arma::mat & C, const arma::mat & kappa);
+
+    /// Response Fock matrices of first-order density matrices: a single alpha matrix for closed-shell responses, alpha and beta otherwise
+    typedef std::function<std::vector<arma::mat>(const std::vector<arma::mat> & P1)> response_fock_t;
+    /**
+     * Solve the static coupled-perturbed SCF equations for the
+     * perturbation V by preconditioned conjugate gradients, given the
+     * canonical orbitals of each spin; a single spin means a
+     * closed-shell response. Each iteration costs one response Fock
+     * build. Returns the first-order density matrices of each spin.
+     */
+    std::vector<arma::mat> cpscf(const std::vector<arma::mat> & C, const std::vector<arma::vec> & E, const std::vector<size_t> & nocc, const arma::mat & V, const response_fock_t & G, double convthr, int maxit);
+
     /// Random perturbation
     arma::mat perturbation_matrix(size_t N, double ampl);
 
@@ -67,6 +152,91 @@ namespace helfem {
 
     /// Parse xc parameters
     arma::vec parse_xc_params(const std::string & input);
+    /// Parse a list of values given in a file or as a space or comma separated string
+    arma::vec parse_list(const std::string & input);
+    /// Stable 64-bit hash of a string in hexadecimal, e.g. for fingerprinting basis sets
+    std::string hash_string(const std::string & str);
+    /// Fit the derivatives of the energy wrt the field at zero field up to the given order, returning E, dE/dF, d^2E/dF^2, ...
+    arma::vec field_derivatives(const arma::vec & F, const arma::vec & E, int order=4);
+
+    /**
+     * Scan and optimal tuning of the range-separation parameter. At
+     * each omega the tuning condition J = eps_HOMO(N) + E(N-1) - E(N)
+     * is evaluated; once the scan is done, the root of J is searched
+     * with the secant method, switching to regula falsi when the root
+     * has been bracketed.
+     */
+    class OmegaTuning {
+      /// Values of omega evaluated first
+      arma::vec scan;
+      /// Search for the root after the scan?
+      bool tune;
+      /// Maximum number of tuning steps
+      int maxit;
+      /// Convergence threshold for |J|
+      double thr;
+      /// omega, E(N), E(N-1), eps_HOMO and J of the points done so far
+      arma::mat results;
+      /// Index of the point with the smallest |J|
+      arma::uword best() const;
+    public:
+      /// Dummy constructor: no scan nor tuning
+      OmegaTuning();
+      /// Constructor
+      OmegaTuning(const arma::vec & scan, bool tune, int maxit, double thr);
+
+      /// Is a scan or tuning requested?
+      bool active() const;
+      /// Get the next omega to evaluate; returns false when done
+      bool next(double & omega) const;
+      /// Add the results for omega
+      void add(double omega, double Eneutral, double Eion, double ehomo);
+      /// Has the tuning condition been satisfied?
+      bool converged() const;
+      /// The omega with the smallest |J|
+      double optimum() const;
+      /// Get the results: omega, E(N), E(N-1), eps_HOMO, J
+      arma::mat table() const;
+      /// Print out the results
+      void print() const;
+    };
+
+    /**
+     * Fermi smearing of the orbital occupations with an annealed
+     * temperature. Each spin channel is occupied separately as
+     * f_i = 1/(1+exp((E_i-mu)/T)), with the chemical potential found by
+     * bisection. The temperature is lowered by a constant factor every
+     * iteration down to the final temperature, where the occupations
+     * are optionally switched to integer ones.
+     */
+    class FermiSmearing {
+      /// Current temperature
+      double T;
+      /// Annealing factor
+      double anneal;
+      /// Final temperature
+      double Tmin;
+      /// Switch to integer occupations at the final temperature?
+      bool integer;
+    public:
+      /// Dummy constructor: no smearing
+      FermiSmearing();
+      /// Constructor
+      FermiSmearing(double T, double anneal, double Tmin, bool integer);
+
+      /// Are the occupations smeared?
+      bool active() const;
+      /// Has the final temperature been reached?
+      bool annealed() const;
+      /// Current temperature
+      double temperature() const;
+      /// Occupations for nel electrons in the orbitals with energies E; the unoccupied tail is dropped
+      arma::vec occupations(const arma::vec & E, size_t nel) const;
+      /// The -TS contribution of the occupations to the free energy
+      double entropy_energy(const arma::vec & occ) const;
+      /// Lower the temperature; returns true when the occupations become integer
+      bool anneal_step();
+    };
   }
 }
 
@@ -0,0 +1,125 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include "scratchfile.h"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace helfem {
+  ScratchFile::ScratchFile(const std::string & fname_, size_t nrec) : fname(fname_), fsize(0), offset(nrec,0), dims(nrec) {
+    fd=open(fname.c_str(),O_RDWR|O_CREAT|O_TRUNC,0600);
+    if(fd<0) {
+      std::ostringstream oss;
+      oss << "Error opening scratch file " << fname << ": " << strerror(errno) << "\n";
+      throw std::runtime_error(oss.str());
+    }
+  }
+
+  ScratchFile::~ScratchFile() {
+    close(fd);
+    unlink(fname.c_str());
+  }
+
+  size_t ScratchFile::get_Nrec() const {
+    return offset.size();
+  }
+
+  size_t ScratchFile::get_size() const {
+    return fsize;
+  }
+
+  void ScratchFile::write(size_t irec, const std::vector<arma::mat> & rec) {
+    if(irec>=offset.size())
+      throw std::logic_error("Record index out of bounds!\n");
+
+    size_t len=0;
+    for(size_t i=0;i<rec.size();i++)
+      len+=rec[i].n_elem*sizeof(double);
+
+    // Reserve space at the end of the file
+    size_t pos;
+#ifdef _OPENMP
+#pragma omp critical(scratchfile_alloc)
+#endif
+    {
+      pos=fsize;
+      fsize+=len;
+      offset[irec]=pos;
+      dims[irec].resize(rec.size());
+      for(size_t i=0;i<rec.size();i++)
+        dims[irec][i]=std::make_pair(rec[i].n_rows,rec[i].n_cols);
+    }
+
+    for(size_t i=0;i<rec.size();i++) {
+      const char * buf=(const char *) rec[i].memptr();
+      size_t n=rec[i].n_elem*sizeof(double);
+      while(n) {
+        ssize_t nw=pwrite(fd,buf,n,pos);
+        if(nw<0) {
+          std::ostringstream oss;
+          oss << "Error writing to scratch file " << fname << ": " << strerror(errno) << "\n";
+          throw std::runtime_error(oss.str());
+        }
+        buf+=nw;
+        n-=nw;
+        pos+=nw;
+      }
+    }
+  }
+
+  std::vector<arma::mat> ScratchFile::read(size_t irec) const {
+    if(irec>=offset.size())
+      throw std::logic_error("Record index out of bounds!\n");
+
+    std::vector<arma::mat> rec(dims[irec].size());
+    size_t pos=offset[irec];
+    for(size_t i=0;i<rec.size();i++) {
+      rec[i].set_size(dims[irec][i].first,dims[irec][i].second);
+      char * buf=(char *) rec[i].memptr();
+      size_t n=rec[i].n_elem*sizeof(double);
+      while(n) {
+        ssize_t nr=pread(fd,buf,n,pos);
+        if(nr<=0) {
+          std::ostringstream oss;
+          oss << "Error reading from scratch file " << fname << ": " << (nr<0 ? strerror(errno) : "unexpected end of file") << "\n";
+          throw std::runtime_error(oss.str());
+        }
+        buf+=nr;
+        n-=nr;
+        pos+=nr;
+      }
+    }
+    return rec;
+  }
+
+  void ScratchFile::prefetch(size_t irec) const {
+    if(irec>=offset.size())
+      return;
+    size_t len=0;
+    for(size_t i=0;i<dims[irec].size();i++)
+      len+=dims[irec][i].first*dims[irec][i].second*sizeof(double);
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(fd,offset[irec],len,POSIX_FADV_WILLNEED);
+#endif
+  }
+}
@@ -0,0 +1,66 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#ifndef SCRATCHFILE_H
+#define SCRATCHFILE_H
+
+#include <armadillo>
+#include <string>
+#include <vector>
+
+namespace helfem {
+  /**
+   * Scratch file holding records of matrices. Each record is a list
+   * of matrices that is written once, in any order and from several
+   * threads at once, and can then be read back any number of
+   * times. The file is removed when the object is destroyed.
+   */
+  class ScratchFile {
+    /// File descriptor
+    int fd;
+    /// Name of file
+    std::string fname;
+    /// Current size of the file
+    size_t fsize;
+    /// Byte offsets of the records
+    std::vector<size_t> offset;
+    /// Dimensions of the matrices in the records
+    std::vector< std::vector< std::pair<arma::uword, arma::uword> > > dims;
+
+    ScratchFile(const ScratchFile &) = delete;
+    ScratchFile & operator=(const ScratchFile &) = delete;
+
+  public:
+    /// Create scratch file for nrec records
+    ScratchFile(const std::string & fname, size_t nrec);
+    /// Destructor closes and removes the file
+    ~ScratchFile();
+
+    /// Number of records
+    size_t get_Nrec() const;
+    /// Size of the file in bytes
+    size_t get_size() const;
+
+    /// Write record
+    void write(size_t irec, const std::vector<arma::mat> & rec);
+    /// Read record
+    std::vector<arma::mat> read(size_t irec) const;
+    /// Tell the operating system the record will be needed soon
+    void prefetch(size_t irec) const;
+  };
+}
+
+#endif
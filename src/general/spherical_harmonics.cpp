@@ -17,6 +17,8 @@
 #include "spherical_harmonics.h"
 #include <cmath>
 #include <cfloat>
+#include <algorithm>
+#include <stdexcept>
 extern "C" {
 // Legendre polynomials
 #include <gsl/gsl_sf_legendre.h>
@@ -39,3 +41,49 @@ std::complex<double> spherical_harmonics(int l, int m, double cth, double phi) {
 
   return ylm;
 }
+
+arma::cx_vec spherical_harmonics_all(int lmax, double cth, double phi) {
+  arma::cx_vec ylm((lmax+1)*(lmax+1));
+  if(lmax<0)
+    return ylm;
+
+  const double sth(std::sqrt(std::max(0.0,1.0-cth*cth)));
+
+  // Normalized associated Legendre functions with the Condon-Shortley
+  // phase by the standard stable recurrences in l at fixed m
+  arma::vec plm(lmax+1);
+  double pmm(std::sqrt(1.0/(4.0*M_PI)));
+  for(int m=0;m<=lmax;m++) {
+    if(m>0)
+      pmm*=-std::sqrt((2.0*m+1.0)/(2.0*m))*sth;
+    plm(m)=pmm;
+    if(m<lmax)
+      plm(m+1)=cth*std::sqrt(2.0*m+3.0)*pmm;
+    for(int l=m+2;l<=lmax;l++) {
+      double a(std::sqrt((4.0*l*l-1.0)/(1.0*(l*l-m*m))));
+      double aprev(std::sqrt((4.0*(l-1)*(l-1)-1.0)/(1.0*((l-1)*(l-1)-m*m))));
+      plm(l)=a*(cth*plm(l-1)-plm(l-2)/aprev);
+    }
+
+    // Plug in the phase factor; {Y_l}^{-m} = (-1)^m \overline{ {Y_l}^{m} }
+    const std::complex<double> eimphi(std::polar(1.0,m*phi));
+    const double sgn((m%2) ? -1.0 : 1.0);
+    for(int l=m;l<=lmax;l++) {
+      std::complex<double> y(plm(l)*eimphi);
+      ylm(spherical_harmonics_index(l,m))=y;
+      if(m>0)
+        ylm(spherical_harmonics_index(l,-m))=sgn*std::conj(y);
+    }
+  }
+
+  return ylm;
+}
+
+arma::cx_mat spherical_harmonics_all(int lmax, const arma::vec & cth, const arma::vec & phi) {
+  if(cth.n_elem != phi.n_elem)
+    throw std::logic_error("cth and phi arrays are not of the same size!\n");
+  arma::cx_mat ylm((lmax+1)*(lmax+1),cth.n_elem);
+  for(size_t i=0;i<cth.n_elem;i++)
+    ylm.col(i)=spherical_harmonics_all(lmax,cth(i),phi(i));
+  return ylm;
+}
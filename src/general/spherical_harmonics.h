@@ -17,9 +17,20 @@
 #ifndef ERKALE_SPHHARM
 #define ERKALE_SPHHARM
 
+#include <armadillo>
 #include <complex>
 
 /// Calculate value of \f$ Y_{l}^{m} (\cos \theta, \phi) = (-1)^m \sqrt{ \frac {2l +1} {4 \pi} \frac {(l-m)!} {(l+m)!} } P_l^m (\cos \theta) e^{i m \phi} \f$
 std::complex<double> spherical_harmonics(int l, int m, double cth, double phi);
 
+/// Index of \f$ Y_{l}^{m} \f$ in the tables below
+inline size_t spherical_harmonics_index(int l, int m) {
+  return l*(l+1)+m;
+}
+
+/// All \f$ Y_{l}^{m} \f$ with l <= lmax at a point from a single recurrence sweep
+arma::cx_vec spherical_harmonics_all(int lmax, double cth, double phi);
+/// All \f$ Y_{l}^{m} \f$ with l <= lmax on a set of points: (lmax+1)^2 x Npoints
+arma::cx_mat spherical_harmonics_all(int lmax, const arma::vec & cth, const arma::vec & phi);
+
 #endif
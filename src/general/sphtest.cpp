@@ -37,6 +37,10 @@ int main(void) {
         throw std::logic_error("Count wrong!\n");
     }
 
+    // The batch evaluation should agree with the point by point one
+    const arma::cx_mat & table(helfem::angular::spherical_harmonics_table(lang,lang,lsph,true));
+    printf("Difference of batch evaluation with lang=%i is %e\n",lang,arma::abs(table-sph).max());
+
     // Calculate quadrature
     arma::mat ovl(arma::abs(sph*arma::diagmat(w)*arma::trans(sph)));
     //ovl.print("Overlap");
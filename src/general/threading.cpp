@@ -0,0 +1,223 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "threading.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// BLAS libraries that allow the number of threads to be set at
+// runtime; the symbols are only resolved if the library provides them
+extern "C" {
+  void openblas_set_num_threads(int) __attribute__((weak));
+  int openblas_get_num_threads(void) __attribute__((weak));
+  void MKL_Set_Num_Threads(int) __attribute__((weak));
+  int MKL_Get_Max_Threads(void) __attribute__((weak));
+  void bli_thread_set_num_threads(long) __attribute__((weak));
+  long bli_thread_get_num_threads(void) __attribute__((weak));
+}
+
+namespace helfem {
+  namespace threading {
+    /// Is BLAS controlled by the policy?
+    static bool control_blas=false;
+    /// Number of threads
+    static int nthreads_max=1;
+
+    void configure(const std::string & policy_in, int nthreads) {
+      std::string policy(policy_in);
+      if(!policy.size()) {
+        const char * env=getenv("HELFEM_THREADING");
+        policy=env ? std::string(env) : std::string("auto");
+      }
+      if(nthreads<=0) {
+        const char * env=getenv("HELFEM_NUM_THREADS");
+        if(env)
+          nthreads=atoi(env);
+      }
+
+#ifdef _OPENMP
+      if(nthreads>0)
+        omp_set_num_threads(nthreads);
+      nthreads_max=omp_get_max_threads();
+#else
+      nthreads_max=1;
+#endif
+
+      if(policy=="auto") {
+        control_blas=true;
+#ifdef _OPENMP
+        // An OpenMP threaded BLAS called from a parallel region then
+        // also stays on the calling thread
+        omp_set_max_active_levels(1);
+#endif
+        set_blas_threads(1);
+      } else if(policy=="blas") {
+        control_blas=false;
+      } else
+        throw std::logic_error("Unknown threading policy " + policy + "\n");
+    }
+
+    void print() {
+      int nblas(get_blas_threads());
+      printf("Running with %i threads, BLAS threading %s",nthreads_max,control_blas ? "controlled by HelFEM" : "left to the library");
+      if(nblas)
+        printf(", %i BLAS threads",nblas);
+      printf("\n");
+    }
+
+    /// Pairwise sum of x[first,last)
+    static double pairwise_sum(const std::vector<double> & x, size_t first, size_t last) {
+      // Short runs are summed directly
+      if(last-first<=8) {
+        double s=0.0;
+        for(size_t i=first;i<last;i++)
+          s+=x[i];
+        return s;
+      }
+      size_t mid(first+(last-first)/2);
+      return pairwise_sum(x,first,mid)+pairwise_sum(x,mid,last);
+    }
+
+    double pairwise_sum(const std::vector<double> & x) {
+      return pairwise_sum(x,0,x.size());
+    }
+
+    int max_threads() {
+      return nthreads_max;
+    }
+
+    /// Divide the threads between the tasks in proportion to the weights
+    static std::vector<int> split_threads(int nth, const std::vector<double> & weights) {
+      double wtot(0.0);
+      for(double w: weights)
+        wtot+=w;
+
+      std::vector<int> nt(weights.size());
+      int ntot=0;
+      for(size_t i=0;i<weights.size();i++) {
+        nt[i]=std::max(1, (int) std::lround(nth*weights[i]/wtot));
+        ntot+=nt[i];
+      }
+      // Fix up the rounding: take from the best served and give to
+      // the worst served task
+      while(ntot>nth) {
+        size_t imax=0;
+        for(size_t i=1;i<nt.size();i++)
+          if(nt[i]>1 && (nt[imax]==1 || nt[i]/weights[i] > nt[imax]/weights[imax]))
+            imax=i;
+        nt[imax]--;
+        ntot--;
+      }
+      while(ntot<nth) {
+        size_t imin=0;
+        for(size_t i=1;i<nt.size();i++)
+          if(weights[i]/nt[i] > weights[imin]/nt[imin])
+            imin=i;
+        nt[imin]++;
+        ntot++;
+      }
+      return nt;
+    }
+
+    void run_concurrently(const std::vector< std::function<void()> > & tasks, const std::vector<double> & weights) {
+      if(weights.size() != tasks.size())
+        throw std::logic_error("Need a weight for every concurrent task!\n");
+
+      bool concurrent(tasks.size()>1);
+      for(double w: weights)
+        if(!(w>0.0))
+          concurrent=false;
+#ifdef _OPENMP
+      const int nth(omp_get_max_threads());
+      if(nth < (int) tasks.size() || omp_in_parallel())
+        concurrent=false;
+#else
+      concurrent=false;
+#endif
+      if(!concurrent) {
+        for(size_t i=0;i<tasks.size();i++)
+          tasks[i]();
+        return;
+      }
+
+#ifdef _OPENMP
+      std::vector<int> nt(split_threads(nth, weights));
+      // The builds' own parallel regions are nested one level deeper
+      const int levels(omp_get_max_active_levels());
+      omp_set_max_active_levels(levels+1);
+
+      // Exceptions may not leave the parallel region
+      std::vector<std::exception_ptr> err(tasks.size());
+#pragma omp parallel for schedule(static,1) num_threads(tasks.size())
+      for(size_t i=0;i<tasks.size();i++) {
+        omp_set_num_threads(nt[i]);
+        try {
+          tasks[i]();
+        } catch(...) {
+          err[i]=std::current_exception();
+        }
+      }
+      omp_set_max_active_levels(levels);
+
+      for(size_t i=0;i<err.size();i++)
+        if(err[i])
+          std::rethrow_exception(err[i]);
+#endif
+    }
+
+    void set_blas_threads(int n) {
+      if(openblas_set_num_threads)
+        openblas_set_num_threads(n);
+      if(MKL_Set_Num_Threads)
+        MKL_Set_Num_Threads(n);
+      if(bli_thread_set_num_threads)
+        bli_thread_set_num_threads(n);
+    }
+
+    int get_blas_threads() {
+      if(openblas_get_num_threads)
+        return openblas_get_num_threads();
+      if(MKL_Get_Max_Threads)
+        return MKL_Get_Max_Threads();
+      if(bli_thread_get_num_threads)
+        return (int) bli_thread_get_num_threads();
+      return 0;
+    }
+
+    ParallelBLAS::ParallelBLAS() : changed(false) {
+      if(!control_blas || nthreads_max==1)
+        return;
+#ifdef _OPENMP
+      // Nothing to do within a parallel region
+      if(omp_in_parallel())
+        return;
+#endif
+      set_blas_threads(nthreads_max);
+      changed=true;
+    }
+
+    ParallelBLAS::~ParallelBLAS() {
+      if(changed)
+        set_blas_threads(1);
+    }
+  }
+}
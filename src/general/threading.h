@@ -0,0 +1,81 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef THREADING_H
+#define THREADING_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace helfem {
+  namespace threading {
+    /**
+     * Runtime threading policy. The OpenMP loops of the Fock builds
+     * call BLAS from within the parallel regions, where a threaded
+     * BLAS oversubscribes the cores. With the default "auto" policy
+     * BLAS is therefore run on a single thread, and only the large
+     * serial linear algebra, such as the full diagonalizations, is
+     * given all the threads with a ParallelBLAS guard. The "blas"
+     * policy leaves the threading of the BLAS library untouched.
+     *
+     * The policy and the number of threads are taken from the
+     * command line, or from the HELFEM_THREADING and
+     * HELFEM_NUM_THREADS environment variables.
+     */
+    void configure(const std::string & policy, int nthreads);
+    /// Print out the thread setup
+    void print();
+
+    /// Number of threads available to the program
+    int max_threads();
+
+    /**
+     * Sum in a fixed pairwise order. Reductions over per-element
+     * partial sums with this give results that do not depend on the
+     * number of threads or the scheduling, unlike OpenMP reductions.
+     */
+    double pairwise_sum(const std::vector<double> & x);
+
+    /**
+     * Run independent tasks, such as the Coulomb, exchange and
+     * exchange-correlation builds, at the same time. Every task gets a
+     * nested parallel region of its own, with the threads divided in
+     * proportion to the weights, e.g. the timings of the previous
+     * iteration, and at least one thread per task. If all the weights
+     * are zero, or there are fewer threads than tasks, the tasks are
+     * run one after the other.
+     */
+    void run_concurrently(const std::vector< std::function<void()> > & tasks, const std::vector<double> & weights);
+
+    /// Set the number of BLAS threads, if the library allows it
+    void set_blas_threads(int n);
+    /// Get the number of BLAS threads, 0 if unknown
+    int get_blas_threads();
+
+    /// Guard that runs BLAS on all threads within its scope
+    class ParallelBLAS {
+      /// Was the number of threads changed?
+      bool changed;
+    public:
+      /// Constructor
+      ParallelBLAS();
+      /// Destructor, restores single threaded BLAS
+      ~ParallelBLAS();
+    };
+  }
+}
+
+#endif
@@ -17,121 +17,154 @@
 #include "PolynomialBasis.h"
 #include "FiniteElementBasis.h"
 #include "chebyshev.h"
+#include "banded.h"
+#include "../general/cmdline.h"
+#include "../general/scf_helpers.h"
+#include "../general/timer.h"
 
 using namespace helfem;
 
-arma::mat overlap(const helfem::polynomial_basis::FiniteElementBasis & fem, const arma::vec & x, const arma::vec & wx) {
-  return fem.matrix_element(false, false, x, wx, nullptr);
-}
-
-double square_potential(double r) {
-  return r*r;
-}
-
-arma::mat potential(const helfem::polynomial_basis::FiniteElementBasis & fem, const arma::vec & x, const arma::vec & wx) {
-  return fem.matrix_element(false, false, x, wx, square_potential);
-}
+/*
+ * One-dimensional harmonic oscillator H = -1/2 d^2/dx^2 + x^2/2 on
+ * [-xmax, xmax], whose exact eigenvalues are i+1/2. The driver sweeps
+ * over the primitive basis, the number of nodes and the number of
+ * elements, and reports the error in the lowest eigenvalues against
+ * the time spent in the assembly and in the solution.
+ */
 
-arma::mat kinetic(const helfem::polynomial_basis::FiniteElementBasis & fem, const arma::vec & x, const arma::vec & wx) {
-  return fem.matrix_element(true, true, x, wx, nullptr);
+static double harmonic_potential(double x) {
+  return 0.5*x*x;
 }
 
-int main(int argc, char **argv) {
-  if(argc!=6) {
-    printf("Usage: %s xmax Nel Nnode primbas Nquad\n",argv[0]);
-    return 1;
-  }
-
-  // Maximum R
-  double xmax=atof(argv[1]);
-  // Number of elements
-  int Nelem=atoi(argv[2]);
-
-  // Number of nodes
-  int Nnodes=atoi(argv[3]);
-  // Derivative order
-  int primbas=atoi(argv[4]);
-  // Order of quadrature rule
-  int Nquad=atoi(argv[5]);
-
-  printf("Running calculation with xmax=%e and %i elements.\n",xmax,Nelem);
-  printf("Using %i point quadrature rule.\n",Nquad);
+/// Result of one basis
+typedef struct {
+  int primbas, nnodes, nelem, nquad;
+  size_t nbf, kd;
+  double tasm, tsolve, error;
+  bool banded;
+} result_t;
+
+/// Solve the oscillator in one basis
+static result_t run(int primbas, int Nnodes, int Nelem, int Nquad, double xmax, size_t neig, bool banded, bool verbose) {
+  result_t res;
+  res.primbas=primbas;
+  res.nnodes=Nnodes;
+  res.nelem=Nelem;
 
   // Get polynomial basis
   auto poly(std::shared_ptr<const helfem::polynomial_basis::PolynomialBasis>(helfem::polynomial_basis::get_basis(primbas, Nnodes)));
+  if(Nquad==0)
+    // Set default value
+    Nquad=5*poly->get_nbf();
+  res.nquad=Nquad;
 
-  // Radial grid
+  Timer tasm;
   arma::vec r(arma::linspace<arma::vec>(-xmax,xmax,Nelem+1));
-
-  // Finite element basis
-  bool zero_func_left=true;
-  bool zero_deriv_left=true;
-  bool zero_func_right=true;
-  bool zero_deriv_right=true;
-  helfem::polynomial_basis::FiniteElementBasis fem(poly, r, zero_func_left, zero_deriv_left, zero_func_right, zero_deriv_right);
-
-  // Quadrature rule
+  helfem::polynomial_basis::FiniteElementBasis fem(poly, r, true, true, true, true);
   arma::vec xq, wq;
   chebyshev::chebyshev(Nquad,xq,wq);
 
-  // Evaluate polynomials at quadrature points
-  arma::mat bf(poly->eval_dnf(xq, 0, 1.0));
-  arma::mat dbf(poly->eval_dnf(xq, 1, 1.0));
-
-  xq.save("x.dat",arma::raw_ascii);
-  bf.save("bf.dat",arma::raw_ascii);
-  dbf.save("dbf.dat",arma::raw_ascii);
-
+  // The matrices are assembled element by element in band storage
   size_t Nbf(fem.get_nbf());
-  printf("Basis set contains %i functions\n",(int) Nbf);
-
-  // Form overlap matrix
-  arma::mat S(overlap(fem, xq, wq));
-  // Form potential matrix
-  arma::mat V(potential(fem, xq, wq));
-  // Form kinetic energy matrix
-  arma::mat T(kinetic(fem, xq, wq));
-
-  // Form Hamiltonian
-  arma::mat H(T+V);
-
-  //S.print("Overlap");
-  //T.print("Kinetic");
-  //V.print("Potential");
-  //H.print("Hamiltonian");
-
-  // Form orthonormal basis
-  arma::vec Sval;
-  arma::mat Svec;
-  arma::eig_sym(Sval,Svec,S);
-
-  //Sval.print("S eigenvalues");
-  printf("Smallest value of overlap matrix is % e, condition number is %e\n",Sval(0),Sval(Sval.n_elem-1)/Sval(0));
-  printf("Smallest and largest bf norms are %e and %e\n",arma::min(arma::abs(arma::diagvec(S))),arma::max(arma::abs(arma::diagvec(S))));
-
-  // Form half-inverse
-  arma::mat Sinvh(Svec * arma::diagmat(arma::pow(Sval, -0.5)) * arma::trans(Svec));
-
-  // Form orthonormal Hamiltonian
-  arma::mat Horth(arma::trans(Sinvh)*H*Sinvh);
+  size_t kd=0;
+  for(size_t iel=0;iel<fem.get_nelem();iel++) {
+    size_t ifirst, ilast;
+    fem.get_idx(iel,ifirst,ilast);
+    kd=std::max(kd,ilast-ifirst);
+  }
+  utils::SymBandMatrix S(Nbf,kd), H(Nbf,kd);
+  for(size_t iel=0;iel<fem.get_nelem();iel++) {
+    size_t ifirst, ilast;
+    fem.get_idx(iel,ifirst,ilast);
+    S.add_block(ifirst,fem.matrix_element(iel, false, false, xq, wq, nullptr));
+    H.add_block(ifirst,0.5*fem.matrix_element(iel, true, true, xq, wq, nullptr)+fem.matrix_element(iel, false, false, xq, wq, harmonic_potential));
+  }
+  res.tasm=tasm.get();
+  res.nbf=Nbf;
+  res.kd=kd;
 
-  // Diagonalize Hamiltonian
+  Timer tsolve;
   arma::vec E;
   arma::mat C;
-  arma::eig_sym(E,C,Horth);
-
-  // Go back to non-orthonormal basis
-  C=Sinvh*C;
+  res.banded=banded && utils::eig_gsym_banded(E,C,H,S);
+  if(!res.banded) {
+    // Dense solution in the orthonormal basis
+    arma::mat Sd(S.dense());
+    arma::vec Sval;
+    arma::mat Svec;
+    arma::eig_sym(Sval,Svec,Sd);
+    arma::mat Sinvh(Svec * arma::diagmat(arma::pow(Sval, -0.5)) * arma::trans(Svec));
+    arma::eig_sym(E,C,arma::trans(Sinvh)*H.dense()*Sinvh);
+    C=Sinvh*C;
+  }
+  res.tsolve=tsolve.get();
+
+  neig=std::min<size_t>(neig,E.n_elem);
+  arma::vec Eexact(arma::regspace<arma::vec>(0,neig-1)+0.5);
+  res.error=arma::max(arma::abs(E.subvec(0,neig-1)-Eexact));
+
+  if(verbose) {
+    printf("Eigenvalues\n");
+    for(size_t i=0;i<neig;i++)
+      printf("%i % 14.10f % e\n",(int) i,E(i),E(i)-Eexact(i));
+    // Test orthonormality
+    arma::mat Smo(C.cols(0,neig-1).t()*(S*arma::mat(C.cols(0,neig-1))));
+    Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
+    printf("Orbital orthonormality devation is %e\n",arma::norm(Smo,"fro"));
+  }
 
-  printf("Eigenvalues\n");
-  size_t neig=std::min(E.n_elem,(arma::uword) 8);
-  for(size_t i=0;i<neig;i++)
-    printf("%i % 10.6f % 10.6f\n",(int) i, E(i),E(i)-(2*i+1));
+  return res;
+}
 
-  // Test orthonormality
-  arma::mat Smo(C.t()*S*C);
-  Smo-=arma::eye<arma::mat>(Smo.n_rows,Smo.n_cols);
-  printf("Orbital orthonormality devation is %e\n",arma::norm(Smo,"fro"));
+int main(int argc, char **argv) {
+  cmdline::parser parser;
+  parser.add<double>("xmax", 0, "extent of the box", false, 10.0);
+  parser.add<std::string>("primbas", 0, "comma separated list of primitive bases to sweep", false, "4");
+  parser.add<std::string>("nnodes", 0, "comma separated list of numbers of nodes to sweep", false, "15");
+  parser.add<std::string>("nelem", 0, "comma separated list of numbers of elements to sweep", false, "5,10,20,40");
+  parser.add<int>("nquad", 0, "number of quadrature points, 0 for 5 per primitive function", false, 0);
+  parser.add<int>("neig", 0, "number of eigenvalues in the error", false, 8);
+  parser.add<bool>("banded", 0, "solve the banded eigenproblem instead of the dense one", false, true);
+  parser.add<bool>("verbose", 0, "print the eigenvalues of every basis", false, false);
+  parser.add<std::string>("output", 0, "file for the results table", false, "harmonic.dat");
+  parser.parse_check(argc, argv);
+
+  double xmax(parser.get<double>("xmax"));
+  arma::vec primbas(scf::parse_list(parser.get<std::string>("primbas")));
+  arma::vec nnodes(scf::parse_list(parser.get<std::string>("nnodes")));
+  arma::vec nelem(scf::parse_list(parser.get<std::string>("nelem")));
+  int Nquad(parser.get<int>("nquad"));
+  size_t neig(parser.get<int>("neig"));
+  bool banded(parser.get<bool>("banded"));
+  bool verbose(parser.get<bool>("verbose"));
+  std::string output(parser.get<std::string>("output"));
+
+  printf("Harmonic oscillator on [% .3f, % .3f], error in the %i lowest eigenvalues\n",-xmax,xmax,(int) neig);
+  printf("%7s %6s %5s %5s %6s %3s %12s %12s %12s %s\n","primbas","nnodes","nelem","nquad","Nbf","kd","t(asm)","t(solve)","max error","solver");
+
+  std::vector<result_t> results;
+  for(size_t ip=0;ip<primbas.n_elem;ip++)
+    for(size_t in=0;in<nnodes.n_elem;in++)
+      for(size_t ie=0;ie<nelem.n_elem;ie++) {
+        result_t res(run((int) primbas(ip), (int) nnodes(in), (int) nelem(ie), Nquad, xmax, neig, banded, verbose));
+        printf("%7i %6i %5i %5i %6i %3i %12.3e %12.3e %12.3e %s\n",res.primbas,res.nnodes,res.nelem,res.nquad,(int) res.nbf,(int) res.kd,res.tasm,res.tsolve,res.error,res.banded ? "banded" : "dense");
+        fflush(stdout);
+        results.push_back(res);
+      }
+
+  // primbas nnodes nelem nquad Nbf t(asm) t(solve) error
+  arma::mat table(results.size(),8);
+  for(size_t i=0;i<results.size();i++) {
+    table(i,0)=results[i].primbas;
+    table(i,1)=results[i].nnodes;
+    table(i,2)=results[i].nelem;
+    table(i,3)=results[i].nquad;
+    table(i,4)=results[i].nbf;
+    table(i,5)=results[i].tasm;
+    table(i,6)=results[i].tsolve;
+    table(i,7)=results[i].error;
+  }
+  table.save(output,arma::raw_ascii);
 
   return 0;
 }
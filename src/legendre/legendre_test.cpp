@@ -1,4 +1,5 @@
 #include "Legendre_Wrapper.h"
+#include "../general/legendre.h"
 #include "../general/spherical_harmonics.h"
 #include <armadillo>
 
@@ -35,9 +36,53 @@ double factorial_ratio(int pmax, int pmin) {
   return r;
 }
 
+/// Maximum relative difference of the C++ and Fortran values for l >= m
+double compare(const arma::mat & A, const arma::mat & B) {
+  double d=0.0;
+  for(size_t m=0;m<A.n_cols;m++)
+    for(size_t l=m;l<A.n_rows;l++)
+      if(std::isnormal(A(l,m)) && std::isnormal(B(l,m)))
+        d=std::max(d,std::abs(A(l,m)-B(l,m))/std::abs(B(l,m)));
+  return d;
+}
+
+/// Check the C++ implementation against the Fortran library
+bool check_backend(int lmax) {
+  // The Fortran library is evaluated with padding for accuracy
+  int lpad=20;
+  double thr=1e-8;
+  arma::vec x={1.01, 1.1, 1.7, 2.5, 5.0, 50.0};
+
+  // The C++ routines are reentrant, so the points are evaluated in parallel
+  arma::cube P(helfem::legendre::Plm(lmax,lmax,x));
+  arma::cube Q(lmax+1,lmax+1,x.n_elem);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for(size_t i=0;i<x.n_elem;i++)
+    Q.slice(i)=helfem::legendre::Qlm(lmax,lmax,x(i));
+
+  bool ok=true;
+  for(size_t i=0;i<x.n_elem;i++) {
+    arma::mat Pf(get_Plm(lmax+lpad,lmax+lpad,x(i)).submat(0,0,lmax,lmax));
+    arma::mat Qf(get_Qlm(lmax+lpad,lmax+lpad,x(i)).submat(0,0,lmax,lmax));
+    double dP(compare(P.slice(i),Pf));
+    double dQ(compare(Q.slice(i),Qf));
+    printf("x = % e: max relative difference in Plm % e, Qlm % e\n",x(i),dP,dQ);
+    if(dP>thr || dQ>thr)
+      ok=false;
+  }
+  return ok;
+}
+
 int main(void) {
   int Lmax=50;
 
+  if(!check_backend(Lmax)) {
+    printf("C++ and Fortran Legendre functions differ!\n");
+    return 1;
+  }
+
   double thr=1e-10;
   double eps;
 
@@ -0,0 +1,280 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "api.h"
+#include "../general/dftfuncs.h"
+#include <iomanip>
+#include <sstream>
+
+namespace helfem {
+  namespace sadatom {
+    namespace api {
+
+      /// Guess occupations by filling the shells in the Madelung order
+      static arma::ivec guess_occs(int numel, int lmax) {
+        const int shell_order[]={0, 0, 1, 0, 1, 0, 2, 1, 0, 2, 1, 0, 3, 2, 1, 0, 3, 2, 1};
+
+        arma::ivec occs(lmax+1);
+        occs.zeros();
+        for(size_t i=0;i<sizeof(shell_order)/sizeof(shell_order[0]) && numel>0;i++) {
+          int l = shell_order[i];
+          if(l > lmax) {
+            std::ostringstream oss;
+            oss << "Insufficient lmax = " << lmax << "\n";
+            throw std::logic_error(oss.str());
+          }
+          int nocc = std::min(numel, 2*(2*l+1));
+          occs(l) += nocc;
+          numel -= nocc;
+        }
+
+        return occs;
+      }
+
+      /// Key of the occupations
+      static std::string occ_key(const arma::ivec & occs) {
+        std::ostringstream oss;
+        for(size_t i=0;i<occs.n_elem;i++)
+          oss << " " << occs(i);
+        return oss.str();
+      }
+
+      Session::Session() {
+      }
+
+      Session::~Session() {
+      }
+
+      solver::SCFSolver & Session::get_solver(const settings_t & s, std::string & key) {
+        if(s.Z<1)
+          throw std::logic_error("Invalid nuclear charge.\n");
+
+        std::shared_ptr<const polynomial_basis::PolynomialBasis> poly(polynomial_basis::get_basis(s.primbas,s.nnodes));
+        int Nquad(s.nquad);
+        if(Nquad==0)
+          Nquad=5*poly->get_nbf();
+        else if(Nquad<2*poly->get_nbf())
+          throw std::logic_error("Insufficient radial quadrature.\n");
+        int taylor_order(s.taylor_order==-1 ? poly->get_nprim()-1 : s.taylor_order);
+
+        double Rmax(s.Rmax);
+        if(s.iconf==3) {
+          if(s.conf_R<=0.0)
+            throw std::logic_error("Hard wall confinement requires a positive conf_R!\n");
+          Rmax=s.conf_R;
+        }
+        arma::vec bval(s.bval.n_elem ? s.bval : atomic::basis::form_grid((modelpotential::nuclear_model_t) s.finitenuc, s.Rrms, s.nelem, Rmax, s.igrid, s.zexp, 0, s.igrid, s.zexp, s.Z, 0, 0, 0.0));
+
+        // The basis and the integrals
+        std::ostringstream basisdesc;
+        basisdesc << "Z=" << s.Z << " finitenuc=" << s.finitenuc << " Rrms=" << std::setprecision(17) << s.Rrms << " lmax=" << s.lmax << " primbas=" << s.primbas << " nnodes=" << s.nnodes << " nquad=" << Nquad << " zeroder=" << s.zeroder << " taylor_order=" << taylor_order << " bval=";
+        for(size_t i=0;i<bval.n_elem;i++)
+          basisdesc << " " << bval(i);
+        auto ist(states.find(basisdesc.str()));
+        if(ist==states.end())
+          ist=states.insert(std::make_pair(basisdesc.str(),std::make_shared<const solver::SolverState>(s.Z, s.finitenuc, s.Rrms, s.lmax, poly, s.zeroder, Nquad, bval, taylor_order))).first;
+
+        // The solver. The confinement radius only enters the core
+        // Hamiltonian, so solvers are shared between radii
+        std::ostringstream setdesc;
+        setdesc << basisdesc.str() << " method=" << s.method << " iconf=" << s.iconf << " conf_N=" << s.conf_N << " maxit=" << s.maxit << " shift=" << s.shift << " convthr=" << s.convthr << " dftthr=" << s.dftthr << " diiseps=" << s.diiseps << " diisthr=" << s.diisthr << " diisorder=" << s.diisorder;
+        key=setdesc.str();
+        auto isol(solvers.find(key));
+        if(isol==solvers.end()) {
+          int x_func, c_func;
+          ::parse_xc_func(x_func, c_func, s.method);
+          if(!is_supported(x_func))
+            throw std::logic_error("The specified exchange functional is not currently supported in HelFEM.\n");
+          if(!is_supported(c_func))
+            throw std::logic_error("The specified correlation functional is not currently supported in HelFEM.\n");
+          isol=solvers.insert(std::make_pair(key,std::make_shared<solver::SCFSolver>(ist->second, x_func, c_func, s.maxit, s.shift, s.convthr, s.dftthr, s.diiseps, s.diisthr, s.diisorder, s.iconf, s.conf_N, s.conf_R))).first;
+        }
+        isol->second->set_verbose(s.verbose);
+        if(isol->second->get_confinement()!=s.conf_R)
+          isol->second->set_confinement(s.conf_R);
+
+        return *(isol->second);
+      }
+
+      /// Collect the results of a restricted configuration
+      static result_t restricted_result(const solver::rconf_t & conf) {
+        result_t res;
+        res.Etot=conf.Econf;
+        res.Ekin=conf.Ekin;
+        res.Epot=conf.Epot;
+        res.Ecoul=conf.Ecoul;
+        res.Econfinement=conf.Econfinement;
+        res.Exc=conf.Exc;
+        res.converged=conf.converged;
+        res.iterations=conf.iterations;
+        res.occs=conf.orbs.Occs();
+        res.Ea=conf.orbs.Energies();
+        res.Ca=conf.orbs.Coeffs();
+        res.Pa=conf.Pl;
+        return res;
+      }
+
+      /// Collect the results of an unrestricted configuration
+      static result_t unrestricted_result(const solver::uconf_t & conf) {
+        result_t res;
+        res.Etot=conf.Econf;
+        res.Ekin=conf.Ekin;
+        res.Epot=conf.Epot;
+        res.Ecoul=conf.Ecoul;
+        res.Econfinement=conf.Econfinement;
+        res.Exc=conf.Exc;
+        res.converged=conf.converged;
+        res.iterations=conf.iterations;
+        res.occs=conf.orbsa.Occs();
+        res.occsb=conf.orbsb.Occs();
+        res.Ea=conf.orbsa.Energies();
+        res.Eb=conf.orbsb.Energies();
+        res.Ca=conf.orbsa.Coeffs();
+        res.Cb=conf.orbsb.Coeffs();
+        res.Pa=conf.Pal;
+        res.Pb=conf.Pbl;
+        return res;
+      }
+
+      /// Project orbitals onto the basis of another solver
+      static arma::cube project_orbitals(const solver::SCFSolver & newsolver, const solver::SCFSolver & oldsolver, const arma::cube & Cold) {
+        const arma::mat & S(newsolver.State()->S);
+        arma::mat S12(newsolver.Basis().overlap(oldsolver.Basis()));
+        arma::cube C(S12.n_rows,Cold.n_cols,Cold.n_slices);
+        for(size_t l=0;l<Cold.n_slices;l++) {
+          // C1 = S11^-1 S12 C2
+          arma::mat Cp(arma::solve(S,S12*Cold.slice(l)));
+          // Symmetric orthonormalization
+          arma::vec oval;
+          arma::mat ovec;
+          arma::eig_sym(oval,ovec,Cp.t()*S*Cp);
+          C.slice(l)=Cp*ovec*arma::diagmat(arma::pow(oval,-0.5))*ovec.t();
+        }
+        return C;
+      }
+
+      result_t Session::solve(const settings_t & s, const solver::SCFSolver * oldsolver, const result_t * guess) {
+        std::string key;
+        solver::SCFSolver & solver(get_solver(s, key));
+        arma::sword numel=s.Z-s.Q;
+        result_t res;
+
+        if(s.occsb.n_elem) {
+          // Unrestricted calculation with fixed occupations
+          if(s.occs.n_elem != (arma::uword) s.lmax+1 || s.occsb.n_elem != (arma::uword) s.lmax+1)
+            throw std::logic_error("Occupations must be given for each l channel.\n");
+          solver::uconf_t conf;
+          conf.orbsa=solver::OrbitalChannel(false);
+          conf.orbsb=solver::OrbitalChannel(false);
+          solver.Initialize(conf.orbsa,s.iguess);
+          solver.Initialize(conf.orbsb,s.iguess);
+          if(guess) {
+            conf.orbsa.SetOrbitals(project_orbitals(solver,*oldsolver,guess->Ca),guess->Ea);
+            conf.orbsb.SetOrbitals(project_orbitals(solver,*oldsolver,guess->Cb),guess->Eb);
+          }
+          conf.orbsa.SetOccs(s.occs);
+          conf.orbsb.SetOccs(s.occsb);
+
+          std::string ckey(key + " u" + occ_key(s.occs) + " |" + occ_key(s.occsb));
+          auto seed(usolved.find(ckey));
+          conf.Econf=solver.Solve(conf, (seed==usolved.end()) ? NULL : &(seed->second));
+          usolved[ckey]=conf;
+          res=unrestricted_result(conf);
+          res.bval=solver.Basis().get_bval();
+          res.errors=solver.Basis().element_errors(conf.Pal+conf.Pbl);
+          return res;
+        }
+
+        solver::rconf_t conf;
+        conf.orbs=solver::OrbitalChannel(true);
+        solver.Initialize(conf.orbs,s.iguess);
+        if(guess)
+          conf.orbs.SetOrbitals(project_orbitals(solver,*oldsolver,guess->Ca),guess->Ea);
+        if(s.occs.n_elem) {
+          if(s.occs.n_elem != (arma::uword) s.lmax+1)
+            throw std::logic_error("Occupations must be given for each l channel.\n");
+          conf.orbs.SetOccs(s.occs);
+        } else {
+          conf.orbs.SetOccs(guess_occs(numel,s.lmax));
+        }
+
+        // Solve, and update the Aufbau occupations until they no longer change
+        const int max_aufbau=10;
+        for(int iauf=0;iauf<max_aufbau;iauf++) {
+          std::string ckey(key + " r" + occ_key(conf.orbs.Occs()));
+          auto seed(rsolved.find(ckey));
+          conf.Econf=solver.Solve(conf, (seed==rsolved.end()) ? NULL : &(seed->second));
+          rsolved[ckey]=conf;
+          if(s.occs.n_elem)
+            break;
+
+          arma::ivec oldoccs(conf.orbs.Occs());
+          conf.orbs.AufbauOccupations(numel);
+          if(arma::all(conf.orbs.Occs()==oldoccs))
+            break;
+        }
+
+        res=restricted_result(conf);
+        res.bval=solver.Basis().get_bval();
+        res.errors=solver.Basis().element_errors(conf.Pl);
+        return res;
+      }
+
+      result_t Session::run_scf(const settings_t & s) {
+        result_t res(solve(s,NULL,NULL));
+        if(s.refine_thr<=0.0)
+          return res;
+
+        settings_t cur(s);
+        for(int iref=0;;iref++) {
+          double maxerr(arma::max(res.errors));
+          if(s.verbose)
+            printf("Refinement round %i: %i elements, E = %.12f, largest error estimate %e\n",iref,(int) res.errors.n_elem,res.Etot,maxerr);
+          if(maxerr<s.refine_thr)
+            break;
+          if(iref==s.refine_maxit) {
+            printf("Warning: element error estimates still above %e after %i refinement rounds\n",s.refine_thr,iref);
+            break;
+          }
+
+          // Solve in the refined grid, starting from the current orbitals
+          std::string key;
+          const solver::SCFSolver & oldsolver(get_solver(cur,key));
+          cur.bval=atomic::basis::refine_grid(res.bval,res.errors,s.refine_frac);
+          result_t prev(res);
+          res=solve(cur,&oldsolver,&prev);
+        }
+
+        return res;
+      }
+
+      void Session::clear() {
+        rsolved.clear();
+        usolved.clear();
+        solvers.clear();
+        states.clear();
+      }
+
+      size_t Session::num_bases() const {
+        return states.size();
+      }
+
+      result_t run_scf(const settings_t & settings) {
+        Session session;
+        return session.run_scf(settings);
+      }
+    }
+  }
+}
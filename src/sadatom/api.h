@@ -0,0 +1,182 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#ifndef SAD_API_H
+#define SAD_API_H
+
+#include "solver.h"
+#include <map>
+#include <memory>
+#include <string>
+
+namespace helfem {
+  namespace sadatom {
+    namespace api {
+      /// Settings of an atomic calculation; the defaults are those of gensap
+      typedef struct settings_t {
+        /// Nuclear charge
+        int Z=0;
+        /// Charge of the system
+        int Q=0;
+        /// Method
+        std::string method="lda_x";
+        /// Occupations per l channel, alpha occupations if occsb is given; empty for the Aufbau ground state
+        arma::ivec occs;
+        /// Beta occupations for an unrestricted calculation
+        arma::ivec occsb;
+
+        /// Maximum angular momentum
+        int lmax=3;
+        /// Primitive radial basis
+        int primbas=4;
+        /// Number of nodes per element
+        int nnodes=15;
+        /// Number of quadrature points, 0 for default
+        int nquad=0;
+        /// Number of elements
+        int nelem=10;
+        /// Type of grid
+        int igrid=4;
+        /// Grid parameter
+        double zexp=2.0;
+        /// Practical infinity
+        double Rmax=40.0;
+        /// Finite nuclear model
+        int finitenuc=0;
+        /// Nuclear rms radius
+        double Rrms=0.0;
+        /// Zero derivative at Rmax?
+        bool zeroder=false;
+        /// Order of Taylor expansion near the nucleus, -1 for default
+        int taylor_order=-1;
+        /// Element boundaries, overriding nelem, igrid and zexp if given
+        arma::vec bval;
+
+        /// Target for the largest element error estimate, 0 to switch off adaptive refinement
+        double refine_thr=0.0;
+        /// Fraction of the squared error estimate carried by the elements split each round
+        double refine_frac=0.5;
+        /// Maximum number of refinement rounds
+        int refine_maxit=10;
+
+        /// Maximum number of iterations
+        int maxit=200;
+        /// Level shift for initial iterations
+        double shift=1.0;
+        /// Convergence threshold
+        double convthr=1e-7;
+        /// Density threshold for DFT
+        double dftthr=1e-12;
+        /// When to start mixing in DIIS
+        double diiseps=1e-2;
+        /// When to switch over fully to DIIS
+        double diisthr=1e-3;
+        /// Length of DIIS history
+        int diisorder=10;
+        /// Guess
+        int iguess=2;
+
+        /// Confinement potential
+        int iconf=0;
+        /// Exponent in polynomial confinement potential
+        int conf_N=0;
+        /// Confinement radius
+        double conf_R=0.0;
+
+        /// Print out SCF iterations?
+        bool verbose=false;
+      } settings_t;
+
+      /// Results of an atomic calculation
+      typedef struct {
+        /// Total energy
+        double Etot;
+        /// Kinetic energy
+        double Ekin;
+        /// Nuclear attraction energy
+        double Epot;
+        /// Coulomb energy
+        double Ecoul;
+        /// Confinement energy
+        double Econfinement;
+        /// Exchange-correlation energy
+        double Exc;
+        /// Converged?
+        bool converged;
+        /// Number of SCF iterations
+        int iterations;
+        /// Final occupations per l channel (alpha and beta in the unrestricted case)
+        arma::ivec occs, occsb;
+        /// Orbital energies, Nrad x (lmax+1)
+        arma::mat Ea, Eb;
+        /// Orbital coefficients, Nrad x Nrad x (lmax+1)
+        arma::cube Ca, Cb;
+        /// Density matrices per l channel
+        arma::cube Pa, Pb;
+        /// Element boundaries of the basis
+        arma::vec bval;
+        /// Error estimates of the elements
+        arma::vec errors;
+      } result_t;
+
+      /**
+       * Session for running many atomic calculations without process
+       * startup or file I/O. The basis sets and integrals, and the
+       * solvers with their DFT grids, are kept in memory between the
+       * calls, and converged configurations are used as starting
+       * points for later calculations with the same occupations, such
+       * as the same atom at another confinement radius.
+       */
+      class Session {
+        /// Basis sets and integrals, keyed by basis description
+        std::map<std::string, std::shared_ptr<const solver::SolverState>> states;
+        /// Solvers, keyed by basis and calculation settings
+        std::map<std::string, std::shared_ptr<solver::SCFSolver>> solvers;
+        /// Converged restricted configurations
+        std::map<std::string, solver::rconf_t> rsolved;
+        /// Converged unrestricted configurations
+        std::map<std::string, solver::uconf_t> usolved;
+
+        /// Get the solver for the settings
+        solver::SCFSolver & get_solver(const settings_t & settings, std::string & key);
+        /// Run a calculation in a fixed basis, optionally starting from the orbitals of a calculation in another basis
+        result_t solve(const settings_t & settings, const solver::SCFSolver * oldsolver, const result_t * guess);
+
+      public:
+        /// Constructor
+        Session();
+        /// Destructor
+        ~Session();
+
+        /**
+         * Run a calculation. With refine_thr set, the calculation is
+         * repeated with the elements with the largest error estimates
+         * split in two, starting from the orbitals of the previous
+         * basis, until all estimates are below refine_thr.
+         */
+        result_t run_scf(const settings_t & settings);
+        /// Free all stored bases, solvers and configurations
+        void clear();
+        /// Number of stored basis sets
+        size_t num_bases() const;
+      };
+
+      /// Run a single calculation
+      result_t run_scf(const settings_t & settings);
+    }
+  }
+}
+
+#endif
@@ -23,6 +23,9 @@
 #include "../general/dftfuncs.h"
 #include <cassert>
 #include <cfloat>
+#include <map>
+#include <memory>
+#include <mutex>
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -34,6 +37,47 @@
 namespace helfem {
   namespace sadatom {
     namespace basis {
+      /// Computes the m-averaged exchange couplings (L, lin, lout)
+      static arma::cube compute_exchange_couplings(int lmax) {
+        gaunt::Gaunt gaunt(lmax,2*lmax,lmax);
+        arma::cube cpl_table;
+        cpl_table.zeros(2*lmax+1,lmax+1,lmax+1);
+        for(int lout=0;lout<=lmax;lout++)
+          for(int lin=0;lin<=lmax;lin++) {
+            // Possible couplings (lin,lout) => L
+            int Lmin=std::abs(lin-lout);
+            int Lmax=lin+lout;
+            // Sum over m values: output indices
+            for(int mout=-lout;mout<=lout;mout++) {
+              // and input indices
+              for(int min=-lin;min<=lin;min++) {
+                // LH m value
+                int M(mout-min);
+                for(int L=Lmin;L<=Lmax;L++) {
+                  // Calculate total coupling coefficient
+                  double cpl(gaunt.coeff(lout,mout,L,M,lin,min));
+                  cpl_table(L,lin,lout)+=cpl*cpl;
+                }
+              }
+            }
+            // Averaging wrt output
+            for(int L=Lmin;L<=Lmax;L++)
+              cpl_table(L,lin,lout) /= 2*lout+1;
+          }
+        return cpl_table;
+      }
+
+      /// Exchange couplings are tabulated once per lmax and shared by all bases
+      static const arma::cube & exchange_couplings(int lmax) {
+        static std::mutex lock;
+        static std::map<int, std::unique_ptr<arma::cube>> cache;
+        std::lock_guard<std::mutex> guard(lock);
+        std::unique_ptr<arma::cube> & cpl(cache[lmax]);
+        if(!cpl)
+          cpl.reset(new arma::cube(compute_exchange_couplings(lmax)));
+        return *cpl;
+      }
+
       TwoDBasis::TwoDBasis() {
       }
 
@@ -50,6 +94,25 @@ namespace helfem {
         radial=atomic::basis::RadialBasis(fem, n_quad, taylor_order);
         // Angular basis
         lval=arma::linspace<arma::ivec>(0,lmax,lmax+1);
+
+        // The angular couplings in the exchange matrix only depend
+        // on the angular basis, so they are shared between bases
+        exch_cpl=exchange_couplings(lmax);
+        // and are listed by the (lout, L) pairs for the contraction
+        exch_terms.clear();
+        for(int lout=0;lout<=lmax;lout++)
+          for(int L=0;L<=2*lmax;L++) {
+            exchange_term_t term;
+            term.lout=lout;
+            term.L=L;
+            for(int lin=0;lin<=lmax;lin++)
+              if(exch_cpl(L,lin,lout)!=0.0) {
+                term.lin.push_back(lin);
+                term.cpl.push_back(exch_cpl(L,lin,lout));
+              }
+            if(term.lin.size())
+              exch_terms.push_back(term);
+          }
       }
 
       TwoDBasis::~TwoDBasis() {
@@ -90,6 +153,71 @@ namespace helfem {
         return radial_integral(0);
       }
 
+      arma::mat TwoDBasis::overlap(const TwoDBasis & rh) const {
+        return radial.overlap(rh.radial);
+      }
+
+      arma::vec TwoDBasis::get_bval() const {
+        return radial.get_bval();
+      }
+
+      arma::vec TwoDBasis::element_errors(const arma::cube & Pl) const {
+        /*
+          The exact orbitals u(r) = r R(r) have continuous derivatives,
+          while the finite element ones only are continuous. The jumps
+          [u'] = r [R'] at the element boundaries give the estimate
+          eta(iel)^2 = h(iel) ([u']_left^2 + [u']_right^2) / 2
+          summed over the occupied orbitals, i.e. weighted by the
+          density matrix of each l channel.
+        */
+        size_t Nel(radial.Nel());
+        arma::vec bval(radial.get_bval());
+        arma::vec jump2(Nel+1,arma::fill::zeros);
+        arma::vec xleft(1), xright(1);
+        xleft(0)=-1.0;
+        xright(0)=1.0;
+        for(size_t ib=1;ib<Nel;ib++) {
+          size_t lfirst, llast, rfirst, rlast;
+          radial.get_idx(ib-1,lfirst,llast);
+          radial.get_idx(ib,rfirst,rlast);
+          // Derivatives from the left and right hand elements
+          arma::rowvec dleft(radial.get_df(xright,ib-1));
+          arma::rowvec dright(radial.get_df(xleft,ib));
+
+          arma::vec j(Nbf(),arma::fill::zeros);
+          j.subvec(lfirst,llast)+=dleft.t();
+          j.subvec(rfirst,rlast)-=dright.t();
+          j*=bval(ib);
+          for(size_t l=0;l<Pl.n_slices;l++)
+            jump2(ib)+=arma::as_scalar(j.t()*Pl.slice(l)*j);
+        }
+
+        arma::vec err(Nel);
+        for(size_t iel=0;iel<Nel;iel++)
+          err(iel)=std::sqrt(std::max(0.0,0.5*(bval(iel+1)-bval(iel))*(jump2(iel)+jump2(iel+1))));
+        return err;
+      }
+
+      size_t TwoDBasis::bandwidth() const {
+        size_t kd=0;
+        for(size_t iel=0;iel<radial.Nel();iel++) {
+          size_t ifirst, ilast;
+          radial.get_idx(iel,ifirst,ilast);
+          kd=std::max(kd,ilast-ifirst);
+        }
+        return kd;
+      }
+
+      helfem::utils::SymBandMatrix TwoDBasis::overlap_banded() const {
+        helfem::utils::SymBandMatrix Sband(radial.Nbf(),bandwidth());
+        for(size_t iel=0;iel<radial.Nel();iel++) {
+          size_t ifirst, ilast;
+          radial.get_idx(iel,ifirst,ilast);
+          Sband.add_block(ifirst,radial.radial_integral(0,iel));
+        }
+        return Sband;
+      }
+
       arma::mat TwoDBasis::kinetic() const {
         // Build radial kinetic energy matrix
         size_t Nrad(radial.Nbf());
@@ -150,7 +278,8 @@ namespace helfem {
           size_t Nrad(radial.Nbf());
           arma::mat Vrad(Nrad,Nrad);
           Vrad.zeros();
-	  if(!N)
+	  // Hard wall is handled by the basis set itself
+	  if(!N || iconf==3)
 	    return Vrad;
 
 	  if (iconf==1) {
@@ -179,6 +308,46 @@ namespace helfem {
 	  else throw std::logic_error("Case not implemented!\n");
       }
 
+      arma::mat TwoDBasis::confinement_derivative(int N, double r_0, int iconf) const {
+          size_t Nrad(radial.Nbf());
+          arma::mat Vrad(Nrad,Nrad);
+          Vrad.zeros();
+	  if(!N && iconf!=3)
+	    return Vrad;
+
+	  if (iconf==3) {
+	    // Hard wall at the end of the basis
+	    size_t ifirst, ilast;
+	    radial.get_idx(radial.Nel()-1,ifirst,ilast);
+	    Vrad.submat(ifirst,ifirst,ilast,ilast)+=radial.hard_wall_derivative();
+	    return Vrad;
+
+	  } else if (iconf==1) {
+	    // Loop over elements
+	    for(size_t iel=0;iel<radial.Nel();iel++) {
+	      // Where are we in the matrix?
+	      size_t ifirst, ilast;
+	      radial.get_idx(iel,ifirst,ilast);
+	      Vrad.submat(ifirst,ifirst,ilast,ilast)+=radial.radial_integral(N,iel);
+	    }
+	    // d/dr_0 r_0^-N = -N r_0^(-N-1)
+	    if(N<0)
+	      return Vrad * N * std::pow(r_0, -N-1);
+	    return -Vrad * N * std::pow(r_0, -N-1);
+
+	  } else if (iconf==2) {
+	    // Loop over elements
+	    for(size_t iel=0;iel<radial.Nel();iel++) {
+	      // Where are we in the matrix?
+	      size_t ifirst, ilast;
+	      radial.get_idx(iel,ifirst,ilast);
+	      Vrad.submat(ifirst,ifirst,ilast,ilast)+=radial.exponential_confinement_derivative(iel, N, r_0);
+	    }
+	    return Vrad;
+	  }
+	  else throw std::logic_error("Case not implemented!\n");
+      }
+
       arma::mat TwoDBasis::model_potential(const modelpotential::ModelPotential * pot) const {
         size_t Nrad(radial.Nbf());
         arma::mat Vrad(Nrad,Nrad);
@@ -198,7 +367,13 @@ namespace helfem {
         size_t N_L(2*arma::max(lval)+1);
         size_t Nel(radial.Nel());
 
-        // Compute disjoint integrals
+        // Compute disjoint integrals; the radial moments are formed in parallel
+        std::vector<int> Rexps;
+        for(size_t L=0;L<N_L;L++) {
+          Rexps.push_back(L);
+          Rexps.push_back(-((int) L)-1);
+        }
+        radial.precompute_radial_moments(Rexps);
         disjoint_L.resize(Nel*N_L);
         disjoint_m1L.resize(Nel*N_L);
         for(size_t L=0;L<N_L;L++)
@@ -210,7 +385,7 @@ namespace helfem {
         // Form two-electron integrals
         prim_tei.resize(Nel*Nel*N_L);
 #ifdef _OPENMP
-#pragma omp parallel for collapse(2)
+#pragma omp parallel for collapse(2) schedule(dynamic)
 #endif
         for(size_t L=0;L<N_L;L++) {
           for(size_t iel=0;iel<Nel;iel++) {
@@ -243,11 +418,15 @@ namespace helfem {
         // Compute disjoint integrals
         disjoint_iL.resize(Nel*N_L);
         disjoint_kL.resize(Nel*N_L);
-        for(size_t L=0;L<N_L;L++)
-          for(size_t iel=0;iel<Nel;iel++) {
-            disjoint_iL[L*Nel+iel]=radial.bessel_il_integral(L,lambda,iel);
-            disjoint_kL[L*Nel+iel]=radial.bessel_kl_integral(L,lambda,iel);
+        for(size_t iel=0;iel<Nel;iel++) {
+          // All L values from a single evaluation of the Bessel functions
+          std::vector<arma::mat> il, kl;
+          radial.bessel_integrals(N_L-1,lambda,iel,il,kl);
+          for(size_t L=0;L<N_L;L++) {
+            disjoint_iL[L*Nel+iel]=il[L];
+            disjoint_kL[L*Nel+iel]=kl[L];
           }
+        }
 
         /*
           The exchange matrix is given by
@@ -321,6 +500,8 @@ namespace helfem {
         for(int L=0;L<1;L++) {
           const double Lfac=4.0*M_PI/(2*L+1);
 
+          // Traces of the density with the disjoint integrals
+          arma::vec jsmall(Nel), jbig(Nel);
           for(size_t jel=0;jel<Nel;jel++) {
             size_t jfirst, jlast;
             radial.get_idx(jel,jfirst,jlast);
@@ -329,26 +510,8 @@ namespace helfem {
             arma::mat Psub(P.submat(jfirst,jfirst,jlast,jlast));
 
             // Contract integrals
-            double jsmall = Lfac*arma::trace(disjoint_L[L*Nel+jel]*Psub);
-            double jbig = Lfac*arma::trace(disjoint_m1L[L*Nel+jel]*Psub);
-
-            // Increment J: jel>iel
-            for(size_t iel=0;iel<jel;iel++) {
-              size_t ifirst, ilast;
-              radial.get_idx(iel,ifirst,ilast);
-
-              const arma::mat & iint=disjoint_L[L*Nel+iel];
-              J.submat(ifirst,ifirst,ilast,ilast)+=jbig*iint;
-            }
-
-            // Increment J: jel<iel
-            for(size_t iel=jel+1;iel<Nel;iel++) {
-              size_t ifirst, ilast;
-              radial.get_idx(iel,ifirst,ilast);
-
-              const arma::mat & iint=disjoint_m1L[L*Nel+iel];
-              J.submat(ifirst,ifirst,ilast,ilast)+=jsmall*iint;
-            }
+            jsmall(jel) = Lfac*arma::trace(disjoint_L[L*Nel+jel]*Psub);
+            jbig(jel) = Lfac*arma::trace(disjoint_m1L[L*Nel+jel]*Psub);
 
             // In-element contribution
             {
@@ -367,6 +530,22 @@ namespace helfem {
               J.submat(ifirst,ifirst,ilast,ilast)+=Jsub;
             }
           }
+
+          // Element iel gets jbig from all jel>iel and jsmall from all
+          // jel<iel: suffix and prefix sums
+          arma::vec bigsum(Nel), smallsum(Nel);
+          bigsum(Nel-1)=0.0;
+          for(size_t iel=Nel-1;iel>0;iel--)
+            bigsum(iel-1)=bigsum(iel)+jbig(iel);
+          smallsum(0)=0.0;
+          for(size_t iel=1;iel<Nel;iel++)
+            smallsum(iel)=smallsum(iel-1)+jsmall(iel-1);
+
+          for(size_t iel=0;iel<Nel;iel++) {
+            size_t ifirst, ilast;
+            radial.get_idx(iel,ifirst,ilast);
+            J.submat(ifirst,ifirst,ilast,ilast)+=bigsum(iel)*disjoint_L[L*Nel+iel]+smallsum(iel)*disjoint_m1L[L*Nel+iel];
+          }
         }
 
         return J;
@@ -376,177 +555,26 @@ namespace helfem {
         if(!prim_ktei.size())
           throw std::logic_error("Primitive teis have not been computed!\n");
 
-        // Gaunt coefficient table
-        int gmax(arma::max(lval));
-        gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
-
-        if(P.n_slices != (arma::uword) gmax+1)
-          throw std::logic_error("Density matrix am does not match basis set!\n");
-
-        // Number of radial elements
-        size_t Nel(radial.Nel());
-        // Number of radial basis functions
-        size_t Nrad(radial.Nbf());
-        if(P.n_rows != Nrad || P.n_cols != Nrad)
-          throw std::logic_error("Density matrix does not match basis set!\n");
-
-        // Full exchange matrix
-        arma::cube K(Nrad,Nrad,gmax+1);
-        K.zeros();
-
-        // Helper memory
-#ifdef _OPENMP
-        const int nth(omp_get_max_threads());
-#else
-        const int nth(1);
-#endif
-        std::vector<arma::vec> mem_Ksub(nth);
-        std::vector<arma::vec> mem_Psub(nth);
-        std::vector<arma::vec> mem_T(nth);
-
-#ifdef _OPENMP
-#pragma omp parallel
-#endif
-        {
-#ifdef _OPENMP
-          const int ith(omp_get_thread_num());
-#else
-          const int ith(0);
-#endif
-          // These are only small submatrices!
-          mem_Psub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-          mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-          mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-
-          // Increment
-#ifdef _OPENMP
-#pragma omp for
-#endif
-          // Loop over angular momentum of output
-          for(int lout=0;lout<=gmax;lout++) {
-            // Initialize memory
-            arma::cube Prad;
-            Prad.zeros(Nrad,Nrad,2*gmax+1);
-            // Do we have a coupling
-            std::vector<bool> coupling(2*gmax+1,false);
-
-            // Do angular sums: loop over input angular momentum
-            for(int lin=0;lin<=gmax;lin++) {
-              // Skip if nothing to do
-              if(arma::norm(P.slice(lin),2)==0.0)
-                continue;
-
-              // Possible couplings (lin,lout) => L
-              int Lmin=std::abs(lin-lout);
-              int Lmax=lin+lout;
-
-              arma::vec totcoup;
-              totcoup.zeros(Lmax+1);
-              // Sum over m values: output indices
-              for(int mout=-lout;mout<=lout;mout++) {
-                // and input indices
-                for(int min=-lin;min<=lin;min++) {
-                  // LH m value
-                  int M(mout-min);
-                  for(int L=Lmin;L<=Lmax;L++) {
-                    // Calculate total coupling coefficient
-                    double cpl(gaunt.coeff(lout,mout,L,M,lin,min)*gaunt.coeff(lout,mout,L,M,lin,min));
-                    totcoup(L)+=cpl;
-                  }
-                }
-              }
-              // Averaging wrt output
-              totcoup /= 2*lout+1;
-
-              // Increment radial density matrix
-              for(int L=Lmin;L<=Lmax;L++) {
-                // Check if coupling exists
-                if(totcoup(L)==0.0)
-                  continue;
-
-                // Form density matrix
-                double Lfac=4.0*M_PI/(2*L+1);
-                Prad.slice(L)+=(Lfac*totcoup(L))*P.slice(lin);
-                coupling[L]=true;
-              }
-            }
-
-            for(size_t L=0;L<coupling.size();L++) {
-              if(!coupling[L])
-                continue;
-
-              // Radial matrix
-              arma::mat P_L(Prad.slice(L));
-
-              // Loop over elements: output
-              for(size_t iel=0;iel<Nel;iel++) {
-                size_t ifirst, ilast;
-                radial.get_idx(iel,ifirst,ilast);
-
-                // Input
-                for(size_t jel=0;jel<Nel;jel++) {
-                  size_t jfirst, jlast;
-                  radial.get_idx(jel,jfirst,jlast);
-
-                  // Number of functions in the two elements
-                  size_t Ni(ilast-ifirst+1);
-                  size_t Nj(jlast-jfirst+1);
-
-                  if(iel == jel) {
-                    /*
-                      The exchange matrix is given by
-                      K(jk) = (ij|kl) P(il)
-                      i.e. the complex conjugation hits i and l as
-                      in the density matrix.
-
-                      To get this in the proper order, we permute the integrals
-                      K(jk) = (jk;il) P(il)
-                    */
-
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni*Nj,1,false,true);
-                    Ksub=prim_ktei[Nel*Nel*L + iel*Nel + jel]*arma::vectorise(P_L.submat(ifirst,jfirst,ilast,jlast));
-                    Ksub.reshape(Ni,Nj);
-
-                    // Increment global exchange matrix
-                    K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=Ksub;
-
-                  } else {
-                    // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
-                    const arma::mat & iint=(iel>jel) ? disjoint_m1L[L*Nel+iel] : disjoint_L[L*Nel+iel];
-                    const arma::mat & jint=(iel>jel) ? disjoint_L[L*Nel+jel] : disjoint_m1L[L*Nel+jel];
-
-                    // Get density submatrix (Niel x Njel)
-                    arma::mat Psub(mem_Psub[ith].memptr(),Ni,Nj,false,true);
-                    Psub=P_L.submat(ifirst,jfirst,ilast,jlast);
-
-                    // Calculate helper
-                    arma::mat T(mem_T[ith].memptr(),Ni,Nj,false,true);
-                    // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
-                    T=Psub*arma::trans(jint);
-                    // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
-                    Ksub=iint*T;
-
-                    // Increment global exchange matrix
-                    K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=Ksub;
-                  }
-                }
-              }
-            }
-          }
-        }
-
-        return K;
+        arma::vec Lfac(2*arma::max(lval)+1);
+        for(size_t L=0;L<Lfac.n_elem;L++)
+          Lfac(L)=4.0*M_PI/(2*L+1);
+        return exchange_contraction(P, prim_ktei, disjoint_L, disjoint_m1L, true, Lfac);
       }
 
       arma::cube TwoDBasis::rs_exchange(const arma::cube & P) const {
         if(!rs_ktei.size())
           throw std::logic_error("Primitive teis have not been computed!\n");
 
-        // Gaunt coefficient table
+        arma::vec Lfac(2*arma::max(lval)+1);
+        for(size_t L=0;L<Lfac.n_elem;L++)
+          Lfac(L) = yukawa ? 4.0*M_PI*lambda :  4.0*M_PI*lambda/(2*L+1);
+        // The complementary error function integrals are not factorized
+        return exchange_contraction(P, rs_ktei, disjoint_iL, disjoint_kL, yukawa, Lfac);
+      }
+
+      arma::cube TwoDBasis::exchange_contraction(const arma::cube & P, const std::vector<arma::mat> & ktei, const std::vector<arma::mat> & small, const std::vector<arma::mat> & big, bool disjoint, const arma::vec & Lfac) const {
+        // Maximal angular momentum
         int gmax(arma::max(lval));
-        gaunt::Gaunt gaunt(gmax,2*gmax,gmax);
 
         if(P.n_slices != (arma::uword) gmax+1)
           throw std::logic_error("Density matrix am does not match basis set!\n");
@@ -558,109 +586,82 @@ namespace helfem {
         if(P.n_rows != Nrad || P.n_cols != Nrad)
           throw std::logic_error("Density matrix does not match basis set!\n");
 
+        // Input angular momenta with a density
+        std::vector<bool> occupied(gmax+1);
+        for(int lin=0;lin<=gmax;lin++)
+          occupied[lin]=arma::any(arma::vectorise(P.slice(lin)));
+
+        // Coupling terms that are in use
+        std::vector<size_t> active;
+        for(size_t it=0;it<exch_terms.size();it++) {
+          const exchange_term_t & term(exch_terms[it]);
+          for(size_t k=0;k<term.lin.size();k++)
+            if(occupied[term.lin[k]]) {
+              active.push_back(it);
+              break;
+            }
+        }
+
+        // Radial density matrix of each term as a contiguous slab
+        arma::cube Prad(Nrad,Nrad,active.size(),arma::fill::zeros);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for(size_t ia=0;ia<active.size();ia++) {
+          const exchange_term_t & term(exch_terms[active[ia]]);
+          for(size_t k=0;k<term.lin.size();k++)
+            if(occupied[term.lin[k]])
+              Prad.slice(ia)+=(Lfac(term.L)*term.cpl[k])*P.slice(term.lin[k]);
+        }
+
+        // Terms of each output angular momentum
+        std::vector< std::vector<size_t> > lterms(gmax+1);
+        for(size_t ia=0;ia<active.size();ia++)
+          lterms[exch_terms[active[ia]].lout].push_back(ia);
+
         // Full exchange matrix
         arma::cube K(Nrad,Nrad,gmax+1);
         K.zeros();
 
-        // Helper memory
-#ifdef _OPENMP
-        const int nth(omp_get_max_threads());
-#else
-        const int nth(1);
-#endif
-        std::vector<arma::vec> mem_Ksub(nth);
-        std::vector<arma::vec> mem_Psub(nth);
-        std::vector<arma::vec> mem_T(nth);
+        // The tasks are the rows of the (lout, iel) blocks. Adjacent
+        // elements share a basis function, so the even and the odd
+        // elements are done in separate passes.
+        for(size_t parity=0;parity<2;parity++) {
+          std::vector< std::pair<int, size_t> > tasks;
+          for(int lout=0;lout<=gmax;lout++)
+            if(lterms[lout].size())
+              for(size_t iel=parity;iel<Nel;iel+=2)
+                tasks.push_back(std::make_pair(lout,iel));
 
 #ifdef _OPENMP
 #pragma omp parallel
 #endif
-        {
-#ifdef _OPENMP
-          const int ith(omp_get_thread_num());
-#else
-          const int ith(0);
-#endif
-          // These are only small submatrices!
-          mem_Psub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-          mem_Ksub[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
-          mem_T[ith].zeros(radial.max_Nprim()*radial.max_Nprim());
+          {
+            // These are only small submatrices!
+            const size_t Nmax(radial.max_Nprim());
+            arma::vec mem_Psub(Nmax*Nmax), mem_Ksub(Nmax*Nmax), mem_T(Nmax*Nmax);
 
-          // Increment
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
-          // Loop over angular momentum of output
-          for(int lout=0;lout<=gmax;lout++) {
-            // Initialize memory
-            arma::cube Prad;
-            Prad.zeros(Nrad,Nrad,2*gmax+1);
-            // Do we have a coupling
-            std::vector<bool> coupling(2*gmax+1,false);
-
-            // Do angular sums: loop over input angular momentum
-            for(int lin=0;lin<=gmax;lin++) {
-              // Skip if nothing to do
-              if(arma::norm(P.slice(lin),2)==0.0)
-                continue;
-
-              // Possible couplings (lin,lout) => L
-              int Lmin=std::abs(lin-lout);
-              int Lmax=lin+lout;
-
-              arma::vec totcoup;
-              totcoup.zeros(Lmax+1);
-              // Sum over m values: output indices
-              for(int mout=-lout;mout<=lout;mout++) {
-                // and input indices
-                for(int min=-lin;min<=lin;min++) {
-                  // LH m value
-                  int M(mout-min);
-                  for(int L=Lmin;L<=Lmax;L++) {
-                    // Calculate total coupling coefficient
-                    double cpl(gaunt.coeff(lout,mout,L,M,lin,min)*gaunt.coeff(lout,mout,L,M,lin,min));
-                    totcoup(L)+=cpl;
-                  }
-                }
-              }
-              // Averaging wrt output
-              totcoup /= 2*lout+1;
-
-              // Increment radial density matrix
-              for(int L=Lmin;L<=Lmax;L++) {
-                // Check if coupling exists
-                if(totcoup(L)==0.0)
-                  continue;
-
-                // Form density matrix
-                double Lfac = yukawa ? 4.0*M_PI*lambda :  4.0*M_PI*lambda/(2*L+1);
-                Prad.slice(L)+=(Lfac*totcoup(L))*P.slice(lin);
-                coupling[L]=true;
-              }
-            }
-
-            for(size_t L=0;L<coupling.size();L++) {
-              if(!coupling[L])
-                continue;
-
-              // Radial matrix
-              arma::mat P_L(Prad.slice(L));
+            for(size_t itask=0;itask<tasks.size();itask++) {
+              const int lout(tasks[itask].first);
+              const size_t iel(tasks[itask].second);
+              size_t ifirst, ilast;
+              radial.get_idx(iel,ifirst,ilast);
+              size_t Ni(ilast-ifirst+1);
 
-              // Loop over elements: output
-              for(size_t iel=0;iel<Nel;iel++) {
-                size_t ifirst, ilast;
-                radial.get_idx(iel,ifirst,ilast);
+              for(size_t ia: lterms[lout]) {
+                const size_t L(exch_terms[active[ia]].L);
+                const arma::mat & P_L(Prad.slice(ia));
 
                 // Input
                 for(size_t jel=0;jel<Nel;jel++) {
                   size_t jfirst, jlast;
                   radial.get_idx(jel,jfirst,jlast);
-
-                  // Number of functions in the two elements
-                  size_t Ni(ilast-ifirst+1);
                   size_t Nj(jlast-jfirst+1);
 
-                  if(!yukawa || iel == jel) {
+                  if(!disjoint || iel == jel) {
                     /*
                       The exchange matrix is given by
                       K(jk) = (ij|kl) P(il)
@@ -672,28 +673,28 @@ namespace helfem {
                     */
 
                     // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni*Nj,1,false,true);
-                    Ksub=rs_ktei[Nel*Nel*L + iel*Nel + jel]*arma::vectorise(P_L.submat(ifirst,jfirst,ilast,jlast));
+                    arma::mat Ksub(mem_Ksub.memptr(),Ni*Nj,1,false,true);
+                    Ksub=ktei[Nel*Nel*L + iel*Nel + jel]*arma::vectorise(P_L.submat(ifirst,jfirst,ilast,jlast));
                     Ksub.reshape(Ni,Nj);
 
                     // Increment global exchange matrix
                     K.slice(lout).submat(ifirst,jfirst,ilast,jlast)-=Ksub;
 
                   } else {
-                    // Disjoint integrals. When r(iel)>r(jel), iel gets -1-L, jel gets L.
-                    const arma::mat & iint=(iel>jel) ? disjoint_kL[L*Nel+iel] : disjoint_iL[L*Nel+iel];
-                    const arma::mat & jint=(iel>jel) ? disjoint_iL[L*Nel+jel] : disjoint_kL[L*Nel+jel];
+                    // Disjoint integrals. When r(iel)>r(jel), iel gets the big and jel the small radius part.
+                    const arma::mat & iint=(iel>jel) ? big[L*Nel+iel] : small[L*Nel+iel];
+                    const arma::mat & jint=(iel>jel) ? small[L*Nel+jel] : big[L*Nel+jel];
 
                     // Get density submatrix (Niel x Njel)
-                    arma::mat Psub(mem_Psub[ith].memptr(),Ni,Nj,false,true);
+                    arma::mat Psub(mem_Psub.memptr(),Ni,Nj,false,true);
                     Psub=P_L.submat(ifirst,jfirst,ilast,jlast);
 
                     // Calculate helper
-                    arma::mat T(mem_T[ith].memptr(),Ni,Nj,false,true);
+                    arma::mat T(mem_T.memptr(),Ni,Nj,false,true);
                     // (Niel x Njel) = (Niel x Njel) x (Njel x Njel)
                     T=Psub*arma::trans(jint);
                     // Exchange submatrix
-                    arma::mat Ksub(mem_Ksub[ith].memptr(),Ni,Nj,false,true);
+                    arma::mat Ksub(mem_Ksub.memptr(),Ni,Nj,false,true);
                     Ksub=iint*T;
 
                     // Increment global exchange matrix
@@ -746,6 +747,10 @@ namespace helfem {
         return radial.eval_orbs(C,r);
       }
 
+      arma::mat TwoDBasis::eval_orbs(const arma::mat & C, const arma::vec & r) const {
+        return radial.eval_orbs(C,r);
+      }
+
       size_t TwoDBasis::get_rad_Nel() const {
         return radial.Nel();
       }
@@ -791,63 +796,80 @@ namespace helfem {
       }
 
       arma::vec TwoDBasis::coulomb_screening(const arma::mat & Prad) const {
-        std::vector<arma::vec> r(radial.Nel());
-        std::vector<arma::vec> V(radial.Nel());
+        return coulomb_screening(std::vector<arma::mat>(1,Prad)).col(0);
+      }
+
+      arma::vec TwoDBasis::coulomb_screening(const arma::mat & Prad, const arma::mat & Pold, const arma::vec & Vold) const {
+        // The screening is linear in the density, so only the change
+        // needs to be processed; elements where the density has not
+        // changed drop out of the in-element potential
+        return Vold + coulomb_screening(Prad-Pold);
+      }
+
+      arma::mat TwoDBasis::coulomb_screening(const std::vector<arma::mat> & Prad) const {
+        const size_t Nel(radial.Nel());
+        const size_t Ndens(Prad.size());
+        std::vector<arma::vec> r(Nel);
+        std::vector<arma::mat> V(Nel);
 
         // Calculate potential due to charge outside the element
-        arma::vec zero(radial.Nel());
-        arma::vec minusone(radial.Nel());
-        for(size_t iel=0;iel<radial.Nel();iel++) {
+        arma::mat zero(Nel,Ndens);
+        arma::mat minusone(Nel,Ndens);
+        // Densities in the elements, one column per density
+        std::vector<arma::mat> Pv(Nel);
+        for(size_t iel=0;iel<Nel;iel++) {
           // Radial functions in element
           size_t ifirst, ilast;
           radial.get_idx(iel,ifirst,ilast);
-          // Density matrix
-          arma::mat Psub(Prad.submat(ifirst,ifirst,ilast,ilast));
+          // Density matrices
+          size_t nsub(ilast-ifirst+1);
+          Pv[iel].zeros(nsub*nsub,Ndens);
+          for(size_t id=0;id<Ndens;id++)
+            Pv[iel].col(id)=arma::vectorise(Prad[id].submat(ifirst,ifirst,ilast,ilast));
+          // tr(P M) = vec(M^T)^T vec(P)
           arma::mat zm(radial.radial_integral(0,iel));
           arma::mat mo(radial.radial_integral(-1,iel));
-          zero(iel)=arma::trace(Psub*zm);
-          minusone(iel)=arma::trace(Psub*mo);
+          zero.row(iel)=arma::vectorise(arma::trans(zm)).t()*Pv[iel];
+          minusone.row(iel)=arma::vectorise(arma::trans(mo)).t()*Pv[iel];
         }
         // Sum zero potentials together
-        for(size_t iel=1;iel<radial.Nel();iel++)
-          zero(iel)+=zero(iel-1);
+        for(size_t iel=1;iel<Nel;iel++)
+          zero.row(iel)+=zero.row(iel-1);
         // Sum minus one potentials together
-        for(size_t iel=radial.Nel()-2;iel<radial.Nel();iel--)
-          minusone(iel)+=minusone(iel+1);
+        for(size_t iel=Nel-2;iel<Nel;iel--)
+          minusone.row(iel)+=minusone.row(iel+1);
 
         // Form potential
-        for(size_t iel=0;iel<radial.Nel();iel++) {
+        for(size_t iel=0;iel<Nel;iel++) {
           // Initialize potential
           r[iel]=radial.get_r(iel);
-          V[iel].zeros(r[iel].n_elem);
-
-          // Get the density in the element
-          size_t ifirst, ilast;
-          radial.get_idx(iel,ifirst,ilast);
-          arma::vec Pv(arma::vectorise(Prad.submat(ifirst,ifirst,ilast,ilast)));
-
-          // Calculate the in-element potential
-          arma::mat pot(radial.spherical_potential(iel));
-          V[iel] += pot*Pv;
+          V[iel].zeros(r[iel].n_elem,Ndens);
+
+          // Calculate the in-element potential for the densities that
+          // do not vanish in the element
+          arma::uvec nonzero(arma::find(arma::any(Pv[iel]!=0.0,0)));
+          if(nonzero.n_elem) {
+            arma::mat pot(radial.spherical_potential(iel));
+            V[iel].cols(nonzero) += pot*Pv[iel].cols(nonzero);
+          }
 
           // Add in the contributions from the other elements
           if(iel>0)
-            for(size_t ip=0;ip<r[iel].n_elem;ip++)
-              V[iel](ip) += zero(iel-1)/r[iel](ip);
-          if(iel != radial.Nel()-1)
-            V[iel] += minusone(iel+1)*arma::ones<arma::vec>(V[iel].n_elem);
+            for(size_t id=0;id<Ndens;id++)
+              V[iel].col(id) += zero(iel-1,id)/r[iel];
+          if(iel != Nel-1)
+            V[iel].each_row() += minusone.row(iel+1);
 
           // Multiply by r to convert this into an effective charge
-          for(size_t ip=0;ip<r[iel].n_elem;ip++)
-            V[iel](ip)*=r[iel](ip);
+          V[iel].each_col() %= r[iel];
         }
 
         // Assemble all of this into an array
         size_t Npts=r[0].n_elem;
-        arma::vec Veff(radial.Nel()*Npts+1);
+        arma::mat Veff(Nel*Npts+1,Ndens);
         Veff.zeros();
-        for(size_t iel=0;iel<radial.Nel();iel++) {
-          Veff.subvec(1+iel*Npts,(iel+1)*Npts)=V[iel];
+        for(size_t iel=0;iel<Nel;iel++) {
+          Veff.rows(1+iel*Npts,(iel+1)*Npts)=V[iel];
         }
 
         return Veff;
@@ -905,7 +927,7 @@ namespace helfem {
         arma::mat Psub(Prad.submat(ifirst,ifirst,ilast,ilast));
         arma::mat bf(radial.get_bf(x, iel));
 
-        arma::vec density = arma::diagvec(bf*Psub*bf.t());
+        arma::vec density = arma::sum((bf*Psub) % bf, 1);
         if(rsqweight)
           density %= arma::square(radial.get_r(x, iel));
         return density;
@@ -915,6 +937,13 @@ namespace helfem {
         return electron_density(radial.get_xq(), iel, Prad, rsqweight);
       }
 
+      arma::vec TwoDBasis::electron_density_at(const arma::vec & r, const arma::mat & Prad, bool rsqweight) const {
+        arma::vec density(radial.eval_density(Prad, r));
+        if(rsqweight)
+          density %= arma::square(r);
+        return density;
+      }
+
       arma::vec TwoDBasis::electron_density(const arma::mat & Prad) const {
         std::vector<arma::vec> d(radial.Nel());
         for(size_t iel=0;iel<radial.Nel();iel++) {
@@ -978,8 +1007,10 @@ namespace helfem {
           while(arma::norm(a-b,"inf")>=eps) {
             arma::vec c = b - (b-a)/golden_ratio;
             arma::vec d = a + (b-a)/golden_ratio;
-            double density_c = arma::as_scalar(electron_density(c, iel, Prad, rsqweight));
-            double density_d = arma::as_scalar(electron_density(d, iel, Prad, rsqweight));
+            // Both points in a single evaluation
+            arma::vec density_cd = electron_density(arma::join_cols(c,d), iel, Prad, rsqweight);
+            double density_c = density_cd(0);
+            double density_d = density_cd(1);
             if(density_c > density_d) {
               b = d;
             } else {
@@ -1181,27 +1212,17 @@ namespace helfem {
         return rmat;
       }
 
-      arma::vec TwoDBasis::xc_screening(const arma::mat & Prad, int x_func, int c_func) const {
-        arma::mat v(xc_screening(Prad/2,Prad/2,x_func,c_func));
-        return 0.5*(v.col(0)+v.col(1));
-      }
-
-      arma::mat TwoDBasis::xc_screening(const arma::mat & Parad, const arma::mat & Pbrad, int x_func, int c_func) const {
-        const double angfac=4.0*M_PI;
-        // Get the electron density
-        arma::vec rhoa(electron_density(Parad)/angfac);
-        arma::vec rhob(electron_density(Pbrad)/angfac);
-        // and the density gradient
-        arma::vec grada(electron_density_gradient(Parad)/angfac);
-        arma::vec gradb(electron_density_gradient(Pbrad)/angfac);
-        // and the density Laplacian
-        arma::vec lapla(electron_density_laplacian(Parad)/angfac);
-        arma::vec laplb(electron_density_laplacian(Pbrad)/angfac);
-        // Radial coordinates
-        arma::vec r(radii());
+      /**
+       * Evaluate the exchange-correlation screening at a list of
+       * points. The points need not form a single radial grid: the
+       * grids of several densities can be concatenated to evaluate all
+       * of them with a single call per functional. Points at the
+       * nucleus (r=0) get no GGA correction.
+       */
+      static arma::mat xc_screening_points(const arma::vec & r, const arma::vec & rhoa, const arma::vec & rhob, const arma::vec & grada, const arma::vec & gradb, const arma::vec & lapla, const arma::vec & laplb, int x_func, int c_func) {
         size_t Npoints(r.n_elem);
 
-        // and pack it for libxc
+        // Pack the density for libxc
         arma::mat rho_libxc(Npoints,2);
         rho_libxc.col(0)=rhoa;
         rho_libxc.col(1)=rhob;
@@ -1292,6 +1313,7 @@ namespace helfem {
           } else {
             xc_lda_vxc(&func, rhoa.n_elem, rho_libxc.memptr(), vxc_wrk.memptr());
           }
+          xc_func_end(&func);
 
           vxc+=vxc_wrk;
         }
@@ -1302,7 +1324,8 @@ namespace helfem {
           corr.zeros();
 
           // Loop over points: skip nucleus since there's no laplacian there for now
-          for(size_t ip=1;ip<Npoints;ip++) {
+          for(size_t ip=0;ip<Npoints;ip++) {
+            if(r(ip)==0.0) continue;
             // First term: g(t) ( d^2 E / d n(t) d sigma(ss') ) g(s')
 
             // (a, aa) + (b, aa)
@@ -1316,7 +1339,8 @@ namespace helfem {
             corr(1,ip) += (grada(ip)*v2rhosigma(1,ip) + gradb(ip)*v2rhosigma(4,ip))*grada(ip);
           }
 
-          for(size_t ip=1;ip<Npoints;ip++) {
+          for(size_t ip=0;ip<Npoints;ip++) {
+            if(r(ip)==0.0) continue;
             // Second term: (l(t)g(t') + g(t)l(t')) (d^2 E / d sigma(tt') d sigma(ss')) g(s'). Contract t and t' first, put in factor two later
             double d2Edsaa = lapla(ip)*grada(ip)*v2sigma2(0,ip) + (lapla(ip)*gradb(ip) + grada(ip)*laplb(ip))*v2sigma2(1,ip) + laplb(ip)*gradb(ip)*v2sigma2(2,ip);
             double d2Edsab = lapla(ip)*grada(ip)*v2sigma2(1,ip) + (lapla(ip)*gradb(ip) + grada(ip)*laplb(ip))*v2sigma2(3,ip) + laplb(ip)*gradb(ip)*v2sigma2(4,ip);
@@ -1326,13 +1350,15 @@ namespace helfem {
             corr(1,ip) += 4.0*d2Edsbb*gradb(ip) + 2.0*d2Edsab*grada(ip);
           }
 
-          for(size_t ip=1;ip<Npoints;ip++) {
+          for(size_t ip=0;ip<Npoints;ip++) {
+            if(r(ip)==0.0) continue;
             // Third term: dE/dsigma(ss') l(s')
             corr(0,ip) += 2.0*vsigma(0,ip)*lapla(ip) + vsigma(1,ip)*laplb(ip);
             corr(1,ip) += vsigma(1,ip)*lapla(ip) + 2.0*vsigma(2,ip)*laplb(ip);
           }
 
-          for(size_t ip=1;ip<Npoints;ip++) {
+          for(size_t ip=0;ip<Npoints;ip++) {
+            if(r(ip)==0.0) continue;
             // Second term in the divergence: div A = dA/dr + 2 r A
             corr(0,ip) += 2.0/r(ip)*(2.0*vsigma(0,ip)*grada(ip) + vsigma(1,ip)*gradb(ip));
             corr(1,ip) += 2.0/r(ip)*(vsigma(1,ip)*grada(ip) + 2.0*vsigma(2,ip)*gradb(ip));
@@ -1350,6 +1376,64 @@ namespace helfem {
 
         return vxc;
       }
+
+      arma::vec TwoDBasis::xc_screening(const arma::mat & Prad, int x_func, int c_func) const {
+        arma::mat v(xc_screening(Prad/2,Prad/2,x_func,c_func));
+        return 0.5*(v.col(0)+v.col(1));
+      }
+
+      arma::mat TwoDBasis::xc_screening(const arma::mat & Parad, const arma::mat & Pbrad, int x_func, int c_func) const {
+        return xc_screening(std::vector<arma::mat>(1,Parad),std::vector<arma::mat>(1,Pbrad),x_func,c_func)[0];
+      }
+
+      arma::mat TwoDBasis::xc_screening(const std::vector<arma::mat> & Prad, int x_func, int c_func) const {
+        std::vector<arma::mat> Phalf(Prad.size());
+        for(size_t id=0;id<Prad.size();id++)
+          Phalf[id]=Prad[id]/2;
+        std::vector<arma::mat> v(xc_screening(Phalf,Phalf,x_func,c_func));
+
+        arma::mat vxc(radii().n_elem,Prad.size());
+        for(size_t id=0;id<Prad.size();id++)
+          vxc.col(id)=0.5*(v[id].col(0)+v[id].col(1));
+        return vxc;
+      }
+
+      std::vector<arma::mat> TwoDBasis::xc_screening(const std::vector<arma::mat> & Parad, const std::vector<arma::mat> & Pbrad, int x_func, int c_func) const {
+        if(Parad.size() != Pbrad.size())
+          throw std::logic_error("Number of alpha and beta densities does not match!\n");
+        const double angfac=4.0*M_PI;
+        const size_t Ndens(Parad.size());
+
+        // Radial coordinates
+        arma::vec rad(radii());
+        const size_t Npts(rad.n_elem);
+
+        // Stack the grids of all the densities
+        arma::vec r(Ndens*Npts);
+        arma::vec rhoa(Ndens*Npts), rhob(Ndens*Npts);
+        arma::vec grada(Ndens*Npts), gradb(Ndens*Npts);
+        arma::vec lapla(Ndens*Npts), laplb(Ndens*Npts);
+        for(size_t id=0;id<Ndens;id++) {
+          size_t i0(id*Npts), i1((id+1)*Npts-1);
+          r.subvec(i0,i1)=rad;
+          // Get the electron density
+          rhoa.subvec(i0,i1)=electron_density(Parad[id])/angfac;
+          rhob.subvec(i0,i1)=electron_density(Pbrad[id])/angfac;
+          // and the density gradient
+          grada.subvec(i0,i1)=electron_density_gradient(Parad[id])/angfac;
+          gradb.subvec(i0,i1)=electron_density_gradient(Pbrad[id])/angfac;
+          // and the density Laplacian
+          lapla.subvec(i0,i1)=electron_density_laplacian(Parad[id])/angfac;
+          laplb.subvec(i0,i1)=electron_density_laplacian(Pbrad[id])/angfac;
+        }
+
+        arma::mat vxc(xc_screening_points(r,rhoa,rhob,grada,gradb,lapla,laplb,x_func,c_func));
+
+        std::vector<arma::mat> ret(Ndens);
+        for(size_t id=0;id<Ndens;id++)
+          ret[id]=vxc.rows(id*Npts,(id+1)*Npts-1);
+        return ret;
+      }
     }
   }
 }
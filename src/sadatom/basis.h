@@ -18,6 +18,7 @@
 
 #include <armadillo>
 #include "../atomic/basis.h"
+#include "banded.h"
 
 namespace helfem {
   namespace sadatom {
@@ -51,6 +52,24 @@ namespace helfem {
         std::vector<arma::mat> prim_ktei;
         /// Primitive two-electron exchange integrals, range separation
         std::vector<arma::mat> rs_ktei;
+        /// m-averaged exchange couplings (L, lin, lout)
+        arma::cube exch_cpl;
+        /// Nonzero exchange couplings of an (lout, L) pair: input l values and coefficients
+        typedef struct {
+          int lout;
+          int L;
+          std::vector<int> lin;
+          std::vector<double> cpl;
+        } exchange_term_t;
+        /// Exchange couplings listed by the (lout, L) pairs
+        std::vector<exchange_term_t> exch_terms;
+        /**
+         * Exchange contraction shared by the full and range-separated
+         * kernels. With disjoint, the integrals between different
+         * elements factorize into the small and big radius parts;
+         * otherwise all element pairs are in ktei.
+         */
+        arma::cube exchange_contraction(const arma::cube & P, const std::vector<arma::mat> & ktei, const std::vector<arma::mat> & small, const std::vector<arma::mat> & big, bool disjoint, const arma::vec & Lfac) const;
 
       public:
         TwoDBasis();
@@ -77,6 +96,17 @@ namespace helfem {
         arma::mat radial_integral(int n) const;
         /// Form overlap matrix
         arma::mat overlap() const;
+        /// Form overlap matrix with another basis
+        arma::mat overlap(const TwoDBasis & rh) const;
+        /// Get the element boundaries
+        arma::vec get_bval() const;
+        /// Estimate the discretization error in each element from the
+        /// jumps in the derivative of r R(r) at the element boundaries
+        arma::vec element_errors(const arma::cube & Pl) const;
+        /// Number of superdiagonals in the radial matrices
+        size_t bandwidth() const;
+        /// Form overlap matrix in band storage
+        helfem::utils::SymBandMatrix overlap_banded() const;
         /// Form basic part kinetic energy matrix
         arma::mat kinetic() const;
         /// Form l part of kinetic energy matrix
@@ -85,6 +115,8 @@ namespace helfem {
         arma::mat nuclear() const;
 	/// Form confinement potential matrix
 	arma::mat confinement(int N, double r_0, int iconf) const;
+	/// Form derivative of confinement potential matrix wrt the confinement radius
+	arma::mat confinement_derivative(int N, double r_0, int iconf) const;
         /// Form model potential matrix
 	arma::mat model_potential(const modelpotential::ModelPotential * model) const;
         /// Form Coulomb matrix
@@ -105,6 +137,8 @@ namespace helfem {
 
         /// Evaluate orbitals
         arma::vec eval_orbs(const arma::mat & C, double r) const;
+        /// Evaluate orbitals at a set of radii: Npoints x Norbs
+        arma::mat eval_orbs(const arma::mat & C, const arma::vec & r) const;
 
         /// Get number of radial elements
         size_t get_rad_Nel() const;
@@ -129,6 +163,10 @@ namespace helfem {
         arma::vec quadrature_weights() const;
         /// Compute the Coulomb screening of the nucleus
         arma::vec coulomb_screening(const arma::mat & Prad) const;
+        /// Update the Coulomb screening Vold of the density Pold to the density Prad
+        arma::vec coulomb_screening(const arma::mat & Prad, const arma::mat & Pold, const arma::vec & Vold) const;
+        /// Compute the Coulomb screening for several densities at once, one column per density
+        arma::mat coulomb_screening(const std::vector<arma::mat> & Prad) const;
 
         /// Get the radial matrices
         std::vector< std::pair<int, arma::mat> > Rmatrices() const;
@@ -142,6 +180,8 @@ namespace helfem {
         arma::vec electron_density(const arma::vec & x, size_t iel, const arma::mat & Prad, bool rsqweight = false) const;
         /// Compute the electron density in given element at default quadrature points
         arma::vec electron_density(size_t iel, const arma::mat & Prad, bool rsqweight = false) const;
+        /// Compute the electron density at a set of radii in any elements
+        arma::vec electron_density_at(const arma::vec & r, const arma::mat & Prad, bool rsqweight = false) const;
         /// Compute the electron density in given element at default quadrature points
         double electron_density_maximum(const arma::mat & Prad, double eps=1e-10) const;
         /// Compute the van der Waals radius, see doi:10.1002/chem.201602949
@@ -160,6 +200,10 @@ namespace helfem {
         arma::vec xc_screening(const arma::mat & Prad, int x_func, int c_func) const;
         /// Compute the exchange-correlation screening
         arma::mat xc_screening(const arma::mat & Parad, const arma::mat & Pbrad, int x_func, int c_func) const;
+        /// Compute the exchange-correlation screening for several densities at once, one column per density
+        arma::mat xc_screening(const std::vector<arma::mat> & Prad, int x_func, int c_func) const;
+        /// Compute the exchange-correlation screening for several spin densities at once
+        std::vector<arma::mat> xc_screening(const std::vector<arma::mat> & Parad, const std::vector<arma::mat> & Pbrad, int x_func, int c_func) const;
       };
     }
   }
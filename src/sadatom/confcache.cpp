@@ -0,0 +1,214 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#include "confcache.h"
+#include "../general/checkpoint.h"
+#include <sstream>
+
+namespace helfem {
+  namespace sadatom {
+    namespace solver {
+
+      /// Form key from occupation vector
+      static void occupation_key(std::ostringstream & oss, const arma::ivec & occs) {
+        for(size_t i=0;i<occs.n_elem;i++)
+          oss << " " << occs(i);
+      }
+
+      /// Store orbital channel in checkpoint
+      static void write_channel(Checkpoint & chkpt, const std::string & grp, const OrbitalChannel & orbs) {
+        chkpt.create_group(grp);
+        arma::cube C(orbs.Coeffs());
+        std::vector<arma::mat> Cl(C.n_slices);
+        for(size_t l=0;l<C.n_slices;l++)
+          Cl[l]=C.slice(l);
+        chkpt.write(grp+"/C",Cl);
+        chkpt.write(grp+"/E",orbs.Energies());
+        chkpt.write(grp+"/occs",arma::imat(orbs.Occs()));
+        chkpt.write(grp+"/restricted",orbs.Restricted());
+      }
+
+      /// Read orbital channel from checkpoint
+      static OrbitalChannel read_channel(Checkpoint & chkpt, const std::string & grp) {
+        bool restr;
+        chkpt.read(grp+"/restricted",restr);
+        OrbitalChannel orbs(restr);
+
+        std::vector<arma::mat> Cl;
+        chkpt.read(grp+"/C",Cl);
+        arma::mat E;
+        chkpt.read(grp+"/E",E);
+        arma::imat occs;
+        chkpt.read(grp+"/occs",occs);
+
+        arma::cube C;
+        if(Cl.size()) {
+          C.zeros(Cl[0].n_rows,Cl[0].n_cols,Cl.size());
+          for(size_t l=0;l<Cl.size();l++)
+            C.slice(l)=Cl[l];
+        }
+        orbs.SetLmax(((int) Cl.size())-1);
+        orbs.SetOrbitals(C,E);
+        orbs.SetOccs(arma::vectorise(occs));
+
+        return orbs;
+      }
+
+      /// Store the energy components
+      template<typename T> static void write_energies(Checkpoint & chkpt, const std::string & grp, const T & conf) {
+        chkpt.write(grp+"/Econf",conf.Econf);
+        chkpt.write(grp+"/Ekin",conf.Ekin);
+        chkpt.write(grp+"/Epot",conf.Epot);
+        chkpt.write(grp+"/Ecoul",conf.Ecoul);
+        chkpt.write(grp+"/Econfinement",conf.Econfinement);
+        chkpt.write(grp+"/Exc",conf.Exc);
+        chkpt.write(grp+"/converged",conf.converged);
+      }
+
+      /// Read the energy components
+      template<typename T> static void read_energies(Checkpoint & chkpt, const std::string & grp, T & conf) {
+        chkpt.read(grp+"/Econf",conf.Econf);
+        chkpt.read(grp+"/Ekin",conf.Ekin);
+        chkpt.read(grp+"/Epot",conf.Epot);
+        chkpt.read(grp+"/Ecoul",conf.Ecoul);
+        chkpt.read(grp+"/Econfinement",conf.Econfinement);
+        chkpt.read(grp+"/Exc",conf.Exc);
+        chkpt.read(grp+"/converged",conf.converged);
+      }
+
+      ConfigurationCache::ConfigurationCache(const std::string & basis_, const std::string & settings_) : basis(basis_), settings(settings_) {
+      }
+
+      ConfigurationCache::~ConfigurationCache() {
+      }
+
+      std::string ConfigurationCache::key(const rconf_t & conf) {
+        std::ostringstream oss;
+        oss << "r";
+        occupation_key(oss, conf.orbs.Occs());
+        return oss.str();
+      }
+
+      std::string ConfigurationCache::key(const uconf_t & conf) {
+        std::ostringstream oss;
+        oss << "u";
+        occupation_key(oss, conf.orbsa.Occs());
+        oss << " |";
+        occupation_key(oss, conf.orbsb.Occs());
+        return oss.str();
+      }
+
+      const rconf_t * ConfigurationCache::find(const rconf_t & conf) const {
+        auto it(rsolved.find(key(conf)));
+        return (it == rsolved.end()) ? NULL : &(it->second);
+      }
+
+      const uconf_t * ConfigurationCache::find(const uconf_t & conf) const {
+        auto it(usolved.find(key(conf)));
+        return (it == usolved.end()) ? NULL : &(it->second);
+      }
+
+      const rconf_t * ConfigurationCache::guess(const rconf_t & conf) const {
+        auto it(rguess.find(key(conf)));
+        return (it == rguess.end()) ? NULL : &(it->second);
+      }
+
+      const uconf_t * ConfigurationCache::guess(const uconf_t & conf) const {
+        auto it(uguess.find(key(conf)));
+        return (it == uguess.end()) ? NULL : &(it->second);
+      }
+
+      void ConfigurationCache::insert(const rconf_t & conf) {
+        rsolved[key(conf)]=conf;
+      }
+
+      void ConfigurationCache::insert(const uconf_t & conf) {
+        usolved[key(conf)]=conf;
+      }
+
+      size_t ConfigurationCache::load(const std::string & fname) {
+        if(!file_exists(fname))
+          return 0;
+
+        Checkpoint chkpt(fname,false);
+        std::string oldbasis, oldsettings;
+        chkpt.read("basis",oldbasis);
+        chkpt.read("settings",oldsettings);
+        // Orbitals in another basis are of no use
+        if(oldbasis != basis)
+          return 0;
+        // Results are only valid for the same calculation
+        bool same(oldsettings == settings);
+
+        int nr, nu;
+        chkpt.read("nrestricted",nr);
+        chkpt.read("nunrestricted",nu);
+        for(int i=0;i<nr;i++) {
+          std::string grp("r"+std::to_string(i));
+          rconf_t conf;
+          conf.orbs=read_channel(chkpt,grp+"/orbs");
+          read_energies(chkpt,grp,conf);
+          conf.orbs.UpdateDensity(conf.Pl);
+          if(same)
+            rsolved[key(conf)]=conf;
+          else
+            rguess[key(conf)]=conf;
+        }
+        for(int i=0;i<nu;i++) {
+          std::string grp("u"+std::to_string(i));
+          uconf_t conf;
+          conf.orbsa=read_channel(chkpt,grp+"/orbsa");
+          conf.orbsb=read_channel(chkpt,grp+"/orbsb");
+          read_energies(chkpt,grp,conf);
+          conf.orbsa.UpdateDensity(conf.Pal);
+          conf.orbsb.UpdateDensity(conf.Pbl);
+          if(same)
+            usolved[key(conf)]=conf;
+          else
+            uguess[key(conf)]=conf;
+        }
+
+        return nr+nu;
+      }
+
+      void ConfigurationCache::save(const std::string & fname) const {
+        Checkpoint chkpt(fname,true);
+        chkpt.open();
+        chkpt.write("basis",basis);
+        chkpt.write("settings",settings);
+        chkpt.write("nrestricted",(int) rsolved.size());
+        chkpt.write("nunrestricted",(int) usolved.size());
+
+        int i=0;
+        for(auto it=rsolved.begin();it!=rsolved.end();++it) {
+          std::string grp("r"+std::to_string(i++));
+          chkpt.create_group(grp);
+          write_channel(chkpt,grp+"/orbs",it->second.orbs);
+          write_energies(chkpt,grp,it->second);
+        }
+        i=0;
+        for(auto it=usolved.begin();it!=usolved.end();++it) {
+          std::string grp("u"+std::to_string(i++));
+          chkpt.create_group(grp);
+          write_channel(chkpt,grp+"/orbsa",it->second.orbsa);
+          write_channel(chkpt,grp+"/orbsb",it->second.orbsb);
+          write_energies(chkpt,grp,it->second);
+        }
+        chkpt.close();
+      }
+    }
+  }
+}
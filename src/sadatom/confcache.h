@@ -0,0 +1,86 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+
+#ifndef SAD_CONFCACHE_H
+#define SAD_CONFCACHE_H
+
+#include "solver.h"
+#include <string>
+#include <unordered_map>
+
+namespace helfem {
+  namespace sadatom {
+    namespace solver {
+
+      /**
+       * Cache of solved configurations, keyed by the orbital
+       * occupations. The cache can be stored on disk together with
+       * strings describing the basis set and the rest of the
+       * calculation settings. Configurations loaded from a calculation
+       * with the same settings are reused as such, while those from a
+       * calculation in the same basis but with other settings (e.g. a
+       * different functional or confinement) only serve as starting
+       * guesses.
+       */
+      class ConfigurationCache {
+        /// Basis set of the calculation
+        std::string basis;
+        /// Other settings of the calculation
+        std::string settings;
+        /// Solved restricted configurations
+        std::unordered_map<std::string, rconf_t> rsolved;
+        /// Solved unrestricted configurations
+        std::unordered_map<std::string, uconf_t> usolved;
+        /// Restricted starting guesses
+        std::unordered_map<std::string, rconf_t> rguess;
+        /// Unrestricted starting guesses
+        std::unordered_map<std::string, uconf_t> uguess;
+
+      public:
+        /// Constructor
+        ConfigurationCache(const std::string & basis, const std::string & settings);
+        /// Destructor
+        ~ConfigurationCache();
+
+        /// Key of a restricted configuration
+        static std::string key(const rconf_t & conf);
+        /// Key of an unrestricted configuration
+        static std::string key(const uconf_t & conf);
+
+        /// Find a solved configuration with matching occupations
+        const rconf_t * find(const rconf_t & conf) const;
+        /// Find a solved configuration with matching occupations
+        const uconf_t * find(const uconf_t & conf) const;
+        /// Find a starting guess with matching occupations
+        const rconf_t * guess(const rconf_t & conf) const;
+        /// Find a starting guess with matching occupations
+        const uconf_t * guess(const uconf_t & conf) const;
+
+        /// Add a solved configuration
+        void insert(const rconf_t & conf);
+        /// Add a solved configuration
+        void insert(const uconf_t & conf);
+
+        /// Load configurations from disk, returns the number of entries read
+        size_t load(const std::string & fname);
+        /// Save the solved configurations to disk
+        void save(const std::string & fname) const;
+      };
+    }
+  }
+}
+
+#endif
@@ -17,11 +17,14 @@
 #include <cfloat>
 #include <cmath>
 #include <cstdio>
+#include <memory>
 // LibXC
 #include <xc.h>
 
 #include "dftgrid.h"
 #include "../general/dftfuncs.h"
+#include "../general/timer.h"
+#include "../general/blockfile.h"
 
 // OpenMP parallellization for XC calculations
 #ifdef _OPENMP
@@ -304,11 +307,19 @@ namespace helfem {
       }
 
       void DFTGridWorker::compute_xc(int func_id, const arma::vec & p, double thr, bool pot) {
+        XCFunctional func(func_id,polarized,p,thr);
+        compute_xc(func,pot);
+      }
+
+      void DFTGridWorker::compute_xc(const XCFunctional & xcfunc, bool pot) {
         // Compute exchange-correlation functional
+        if(xcfunc.is_polarized() != polarized)
+          throw std::logic_error("Functional was initialized for the wrong spin polarization!\n");
 
         // Which functional is in question?
         bool gga, mgga_t, mgga_l;
-        is_gga_mgga(func_id,gga,mgga_t,mgga_l);
+        xcfunc.get_family(gga,mgga_t,mgga_l);
+        const bool has_energy(xcfunc.has_exc());
 
         // Update controlling flags for eval_Fxc (exchange and correlation
         // parts might be of different type)
@@ -326,7 +337,7 @@ namespace helfem {
         arma::mat vlapl_wrk;
         arma::mat vtau_wrk;
 
-        if(has_exc(func_id))
+        if(has_energy)
           exc_wrk.zeros(exc.n_elem);
         if(pot) {
           vxc_wrk.zeros(vxc.n_rows,vxc.n_cols);
@@ -338,54 +349,31 @@ namespace helfem {
             vlapl_wrk.zeros(vlapl.n_rows,vlapl.n_cols);
         }
 
-        // Spin variable for libxc
-        int nspin;
-        if(!polarized)
-          nspin=XC_UNPOLARIZED;
-        else
-          nspin=XC_POLARIZED;
-
-        // Initialize libxc worker
-        xc_func_type func;
-        if(xc_func_init(&func, func_id, nspin) != 0) {
-          std::ostringstream oss;
-          oss << "Functional "<<func_id<<" not found!";
-          throw std::runtime_error(oss.str());
-        }
-        // Set density threshold
-        xc_func_set_dens_threshold(&func, thr);
-
-        // Set parameters
-        if(p.n_elem) {
-          // Check sanity
-          if(p.n_elem != (arma::uword) xc_func_info_get_n_ext_params(func.info))
-            throw std::logic_error("Incompatible number of parameters!\n");
-          arma::vec phlp(p);
-          xc_func_set_ext_params(&func, phlp.memptr());
-        }
+        // The functional has been initialized once for the whole SCF
+        xc_func_type *func(xcfunc.get());
 
         // Evaluate functionals.
-        if(has_exc(func_id)) {
+        if(has_energy) {
           if(pot) {
             if(mgga_t || mgga_l) {// meta-GGA
               double * laplp = mgga_l ? lapl.memptr() : NULL;
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_exc_vxc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_exc_vxc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_exc_vxc(&func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
+              xc_lda_exc_vxc(func, N, rho.memptr(), exc_wrk.memptr(), vxc_wrk.memptr());
           } else {
             if(mgga_t || mgga_l) { // meta-GGA
               double * laplp = mgga_l ? lapl.memptr() : NULL;
               double * taup = mgga_t ? tau.memptr() : NULL;
-              xc_mgga_exc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
+              xc_mgga_exc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, exc_wrk.memptr());
             } else if(gga) // GGA
-              xc_gga_exc(&func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
+              xc_gga_exc(func, N, rho.memptr(), sigma.memptr(), exc_wrk.memptr());
             else // LDA
-              xc_lda_exc(&func, N, rho.memptr(), exc_wrk.memptr());
+              xc_lda_exc(func, N, rho.memptr(), exc_wrk.memptr());
           }
 
         } else {
@@ -395,17 +383,17 @@ namespace helfem {
               double * taup = mgga_t ? tau.memptr() : NULL;
               double * vlaplp = mgga_l ? vlapl_wrk.memptr() : NULL;
               double * vtaup = mgga_t ? vtau_wrk.memptr() : NULL;
-              xc_mgga_vxc(&func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
+              xc_mgga_vxc(func, N, rho.memptr(), sigma.memptr(), laplp, taup, vxc_wrk.memptr(), vsigma_wrk.memptr(), vlaplp, vtaup);
             } else if(gga) // GGA
-              xc_gga_vxc(&func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
+              xc_gga_vxc(func, N, rho.memptr(), sigma.memptr(), vxc_wrk.memptr(), vsigma_wrk.memptr());
             else // LDA
-              xc_lda_vxc(&func, N, rho.memptr(), vxc_wrk.memptr());
+              xc_lda_vxc(func, N, rho.memptr(), vxc_wrk.memptr());
           }
         }
 
         // Check for NaNs
         for(size_t i=0; i<N; i++) {
-          double e = has_exc(func_id) ? exc_wrk[i] : 0.0;
+          double e = has_energy ? exc_wrk[i] : 0.0;
           double rhoa=0.0, rhob=0.0, sigmaaa=0.0, sigmaab=0.0, sigmabb=0.0, lapla=0.0, laplb=0.0, taua=0.0, taub=0.0;
           double vrhoa=0.0, vrhob=0.0, vsigmaaa=0.0, vsigmaab=0.0, vsigmabb=0.0, vlapla=0.0, vlaplb=0.0, vtaua=0.0, vtaub=0.0;
           if(polarized) {
@@ -461,7 +449,7 @@ namespace helfem {
           }
 
           if(std::isnan(e) || std::isnan(vrhoa) || std::isnan(vrhob) || std::isnan(vsigmaaa) || std::isnan(vsigmaab) || std::isnan(vsigmabb) || std::isnan(vlapla) || std::isnan(vlaplb) || std::isnan(vtaua) || std::isnan(vtaub)) {
-            printf("NaN encountered for functional id = %i with input\n", func_id);
+            printf("NaN encountered for functional id = %i with input\n", xcfunc.get_id());
 
             printf("input: %e %e %e % e %e %e %e % e % e\n",rhoa,rhob,sigmaaa,sigmaab,sigmabb,lapla,laplb,taua,taub);
             printf("output: % e % e % e % e % e % e % e % e % e % e\n",e,vrhoa,vrhob,vsigmaaa,vsigmaab,vsigmabb,vlapla,vlaplb,vtaua,vtaub);
@@ -469,7 +457,7 @@ namespace helfem {
         }
 
         // Sum to total arrays containing both exchange and correlation
-        if(has_exc(func_id))
+        if(has_energy)
           exc+=exc_wrk;
         if(pot) {
           if(mgga_l)
@@ -480,9 +468,6 @@ namespace helfem {
             vsigma+=vsigma_wrk;
           vxc+=vxc_wrk;
         }
-
-        // Free functional
-        xc_func_end(&func);
       }
 
       void DFTGridWorker::get_pot(arma::mat & pot) const {
@@ -862,16 +847,117 @@ namespace helfem {
         }
       }
 
-      DFTGrid::DFTGrid() {
+      void DFTGridWorker::save_bf(bf_cache_t & c) const {
+        c.grad=do_grad;
+        c.lapl=do_lapl;
+        c.bf_ind=bf_ind;
+        c.r=r;
+        c.wrad=wrad;
+        c.wtot=wtot;
+        c.bf=bf;
+        if(do_grad)
+          c.bf_rho=bf_rho;
+        if(do_lapl)
+          c.bf_rho2=bf_rho2;
+      }
+
+      void DFTGridWorker::load_bf(const bf_cache_t & c) {
+        bf_ind=c.bf_ind;
+        r=c.r;
+        wrad=c.wrad;
+        wtot=c.wtot;
+        bf=c.bf;
+        if(do_grad)
+          bf_rho=c.bf_rho;
+        if(do_lapl)
+          bf_rho2=c.bf_rho2;
+      }
+
+      /// Memory used by a cache entry
+      static size_t cache_memory(const bf_cache_t & c) {
+        size_t n=(c.r.n_elem+c.wrad.n_elem+c.wtot.n_elem+c.bf.n_elem+c.bf_rho.n_elem+c.bf_rho2.n_elem)*sizeof(double);
+        n+=c.bf_ind.n_elem*sizeof(arma::uword);
+        return n;
       }
 
-      DFTGrid::DFTGrid(const helfem::sadatom::basis::TwoDBasis * basp_) : basp(basp_) {
+      DFTGrid::DFTGrid() : cache_budget(0), cache_used(0), thread_timing(false) {
+      }
+
+      DFTGrid::DFTGrid(const helfem::sadatom::basis::TwoDBasis * basp_) : basp(basp_), cache_budget(0), cache_used(0), thread_timing(false) {
       }
 
       DFTGrid::~DFTGrid() {
       }
 
+      void DFTGrid::set_basis(const helfem::sadatom::basis::TwoDBasis * basp_) {
+        basp=basp_;
+      }
+
+            void DFTGrid::set_thread_timing(bool timing) {
+        thread_timing=timing;
+      }
+
+      void DFTGrid::set_bf_cache(size_t budget) {
+        cache_budget=budget;
+        cache_used=0;
+        cache.clear();
+        if(cache_budget)
+          cache.resize(basp->get_rad_Nel());
+      }
+
+      void DFTGrid::compute_bf(DFTGridWorker & grid, size_t iel) {
+        bool grad, tau, lapl;
+        grid.get_grad_tau_lapl(grad,tau,lapl);
+
+        // Use the cached values if they have everything that is needed
+        if(iel<cache.size()) {
+          const bf_cache_t & c(cache[iel]);
+          if(c.bf.n_elem && (c.grad || !grad) && (c.lapl || !lapl)) {
+            grid.load_bf(c);
+            return;
+          }
+        }
+
+        grid.compute_bf(iel);
+        if(iel<cache.size()) {
+          // Store the values if they fit in the budget; otherwise they
+          // are recomputed on every call
+          bf_cache_t c;
+          grid.save_bf(c);
+          size_t mem(cache_memory(c));
+          size_t oldmem(cache_memory(cache[iel]));
+          bool store;
+#ifdef _OPENMP
+#pragma omp critical(sadatom_bf_cache)
+#endif
+          {
+            store=(cache_used-oldmem+mem <= cache_budget);
+            if(store)
+              cache_used+=mem-oldmem;
+          }
+          if(store)
+            cache[iel]=c;
+        }
+      }
+
+      void DFTGrid::get_functionals(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, bool polarized, double thr, std::shared_ptr<const XCFunctional> & xf, std::shared_ptr<const XCFunctional> & cf) {
+        // Configurations may be solved concurrently on the same grid
+#ifdef _OPENMP
+#pragma omp critical(sadatom_xc_functional)
+#endif
+        {
+          XCFunctional::update(xfunc,x_func,polarized,x_pars,thr);
+          XCFunctional::update(cfunc,c_func,polarized,c_pars,thr);
+          xf=xfunc;
+          cf=cfunc;
+        }
+      }
+
       void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & P, arma::cube & H, double & Exc, double & Nel, double thr) {
+        // The functionals are only initialized when the settings change
+        std::shared_ptr<const XCFunctional> xf, cf;
+        get_functionals(x_func,x_pars,c_func,c_pars,false,thr,xf,cf);
+
         H.zeros(P.n_rows,P.n_rows,P.n_slices);
 
         double exc=0.0;
@@ -879,6 +965,15 @@ namespace helfem {
         double tau=0.0;
         double lapl=0.0;
 
+        // Busy time of each thread
+        std::vector<double> tthr;
+        if(thread_timing) {
+#ifdef _OPENMP
+          tthr.assign(omp_get_max_threads(),0.0);
+#else
+          tthr.assign(1,0.0);
+#endif
+        }
 #ifdef _OPENMP
 #pragma omp parallel reduction(+:exc,nel,tau,lapl)
 #endif
@@ -886,45 +981,45 @@ namespace helfem {
           DFTGridWorker grid(basp);
           grid.check_grad_tau_lapl(x_func,c_func);
 
+          double tbusy=0.0;
+
+          // Even and odd elements are done separately, since they share
+          // basis functions on the boundaries. The cost per element is
+          // uneven, so the elements are handed out dynamically.
+          for(size_t ipar=0;ipar<2;ipar++) {
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
-          for(size_t iel=0;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
-            grid.update_density(P);
-            nel+=grid.compute_Nel();
-            tau+=grid.compute_tau();
-            lapl+=grid.compute_lapl();
-
-            grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func,x_pars,thr);
-            if(c_func>0)
-              grid.compute_xc(c_func,c_pars,thr);
-
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(H);
+            for(size_t iel=ipar;iel<basp->get_rad_Nel();iel+=2) {
+              Timer tel;
+              compute_bf(grid,iel);
+              grid.update_density(P);
+              nel+=grid.compute_Nel();
+              tau+=grid.compute_tau();
+              lapl+=grid.compute_lapl();
+
+              grid.init_xc();
+              if(xf)
+                grid.compute_xc(*xf);
+              if(cf)
+                grid.compute_xc(*cf);
+
+              exc+=grid.eval_Exc();
+              grid.eval_Fxc(H);
+              tbusy+=tel.get();
+            }
           }
+
+          if(thread_timing) {
 #ifdef _OPENMP
-#pragma omp for
+            tthr[omp_get_thread_num()]=tbusy;
+#else
+            tthr[0]=tbusy;
 #endif
-          for(size_t iel=1;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
-            grid.update_density(P);
-            nel+=grid.compute_Nel();
-            tau+=grid.compute_tau();
-            lapl+=grid.compute_lapl();
-
-            grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func,x_pars,thr);
-            if(c_func>0)
-              grid.compute_xc(c_func,c_pars,thr);
-
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(H);
           }
         }
+        if(thread_timing)
+          print_thread_load(tthr);
 
         // Save outputs
         Exc=exc;
@@ -939,11 +1034,24 @@ namespace helfem {
       }
 
       void DFTGrid::eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & Pa, const arma::cube & Pb, arma::cube & Ha, arma::cube & Hb, double & Exc, double & Nel, bool beta, double thr) {
+        // The functionals are only initialized when the settings change
+        std::shared_ptr<const XCFunctional> xf, cf;
+        get_functionals(x_func,x_pars,c_func,c_pars,true,thr,xf,cf);
+
         Ha.zeros(Pa.n_rows,Pa.n_rows,Pa.n_slices);
         Hb.zeros(Pb.n_rows,Pb.n_rows,Pb.n_slices);
 
         double exc=0.0;
         double nel=0.0;
+        // Busy time of each thread
+        std::vector<double> tthr;
+        if(thread_timing) {
+#ifdef _OPENMP
+          tthr.assign(omp_get_max_threads(),0.0);
+#else
+          tthr.assign(1,0.0);
+#endif
+        }
 #ifdef _OPENMP
 #pragma omp parallel reduction(+:exc,nel)
 #endif
@@ -951,41 +1059,43 @@ namespace helfem {
           DFTGridWorker grid(basp);
           grid.check_grad_tau_lapl(x_func,c_func);
 
+          double tbusy=0.0;
+
+          // Even and odd elements are done separately, since they share
+          // basis functions on the boundaries. The cost per element is
+          // uneven, so the elements are handed out dynamically.
+          for(size_t ipar=0;ipar<2;ipar++) {
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
-          for(size_t iel=0;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
-            grid.update_density(Pa,Pb);
-            nel+=grid.compute_Nel();
-
-            grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func,x_pars,thr);
-            if(c_func>0)
-              grid.compute_xc(c_func,c_pars,thr);
-
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(Ha,Hb,beta);
+            for(size_t iel=ipar;iel<basp->get_rad_Nel();iel+=2) {
+              Timer tel;
+              compute_bf(grid,iel);
+              grid.update_density(Pa,Pb);
+              nel+=grid.compute_Nel();
+
+              grid.init_xc();
+              if(xf)
+                grid.compute_xc(*xf);
+              if(cf)
+                grid.compute_xc(*cf);
+
+              exc+=grid.eval_Exc();
+              grid.eval_Fxc(Ha,Hb,beta);
+              tbusy+=tel.get();
+            }
           }
+
+          if(thread_timing) {
 #ifdef _OPENMP
-#pragma omp for
+            tthr[omp_get_thread_num()]=tbusy;
+#else
+            tthr[0]=tbusy;
 #endif
-          for(size_t iel=1;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
-            grid.update_density(Pa,Pb);
-            nel+=grid.compute_Nel();
-
-            grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func,x_pars,thr);
-            if(c_func>0)
-              grid.compute_xc(c_func,c_pars,thr);
-
-            exc+=grid.eval_Exc();
-            grid.eval_Fxc(Ha,Hb,beta);
           }
         }
+        if(thread_timing)
+          print_thread_load(tthr);
 
         // Save outputs
         Exc=exc;
@@ -1004,17 +1114,17 @@ namespace helfem {
           grid.set_grad_tau_lapl(false,false,false);
 
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
           for(size_t iel=0;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
+            compute_bf(grid,iel);
             grid.eval_overlap(S);
           }
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
           for(size_t iel=1;iel<basp->get_rad_Nel();iel+=2) {
-            grid.compute_bf(iel);
+            compute_bf(grid,iel);
             grid.eval_overlap(S);
           }
         }
@@ -1022,12 +1132,22 @@ namespace helfem {
         return S;
       }
 
-      void DFTGrid::eval_pot(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & P, arma::mat & pot, double thr) {
+      void DFTGrid::eval_pot(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & P, arma::mat & pot, double thr, const std::string & fname) {
+        // The functionals are only initialized when the settings change
+        std::shared_ptr<const XCFunctional> xf, cf;
+        get_functionals(x_func,x_pars,c_func,c_pars,false,thr,xf,cf);
+
         // Compute number of quadrature points
         size_t Nquad=basp->get_r(0).n_elem;
         size_t Nelem=basp->get_rad_Nel();
         // exc vxca vxcb vsigmaaa vsigmaab vsigmabb vlapla vlaplb vtaua vtaub
-        pot.zeros(11, Nquad*Nelem);
+        // Stream the blocks to disk as they are computed?
+        std::shared_ptr<BlockFile> out;
+        if(fname.size()) {
+          out=std::make_shared<BlockFile>(fname, Nquad*Nelem, 11);
+          pot.reset();
+        } else
+          pot.zeros(11, Nquad*Nelem);
 
 #ifdef _OPENMP
 #pragma omp parallel
@@ -1037,34 +1157,48 @@ namespace helfem {
           grid.check_grad_tau_lapl(x_func,c_func);
 
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
           for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-            grid.compute_bf(iel);
+            compute_bf(grid,iel);
             grid.update_density(P);
 
             grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func,x_pars,thr);
-            if(c_func>0)
-              grid.compute_xc(c_func,c_pars,thr);
+            if(xf)
+              grid.compute_xc(*xf);
+            if(cf)
+              grid.compute_xc(*cf);
 
             // Store the potential
             arma::mat subpot;
             grid.get_pot(subpot);
-            pot.cols(iel*Nquad, (iel+1)*Nquad-1)=subpot;
+            if(out)
+              out->write_rows(iel*Nquad, subpot);
+            else
+              pot.cols(iel*Nquad, (iel+1)*Nquad-1)=subpot;
           }
         }
         // Swap rows and columns
-        pot = pot.t();
+        if(!out)
+          pot = pot.t();
       }
 
-      void DFTGrid::eval_pot(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars,  const arma::cube & Pa, const arma::cube & Pb, arma::mat & pot, double thr) {
+      void DFTGrid::eval_pot(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars,  const arma::cube & Pa, const arma::cube & Pb, arma::mat & pot, double thr, const std::string & fname) {
+        // The functionals are only initialized when the settings change
+        std::shared_ptr<const XCFunctional> xf, cf;
+        get_functionals(x_func,x_pars,c_func,c_pars,true,thr,xf,cf);
+
         // Compute number of quadrature points
         size_t Nquad=basp->get_r(0).n_elem;
         size_t Nelem=basp->get_rad_Nel();
         // exc vxca vxcb vsigmaaa vsigmaab vsigmabb vlapla vlaplb vtaua vtaub
-        pot.zeros(11, Nquad*Nelem);
+        // Stream the blocks to disk as they are computed?
+        std::shared_ptr<BlockFile> out;
+        if(fname.size()) {
+          out=std::make_shared<BlockFile>(fname, Nquad*Nelem, 11);
+          pot.reset();
+        } else
+          pot.zeros(11, Nquad*Nelem);
 
 #ifdef _OPENMP
 #pragma omp parallel
@@ -1074,34 +1208,48 @@ namespace helfem {
           grid.check_grad_tau_lapl(x_func,c_func);
 
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
           for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-            grid.compute_bf(iel);
+            compute_bf(grid,iel);
             grid.update_density(Pa,Pb);
 
             grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func,x_pars,thr);
-            if(c_func>0)
-              grid.compute_xc(c_func,c_pars,thr);
+            if(xf)
+              grid.compute_xc(*xf);
+            if(cf)
+              grid.compute_xc(*cf);
 
             // Store the potential
             arma::mat subpot;
             grid.get_pot(subpot);
-            pot.cols(iel*Nquad, (iel+1)*Nquad-1)=subpot;
+            if(out)
+              out->write_rows(iel*Nquad, subpot);
+            else
+              pot.cols(iel*Nquad, (iel+1)*Nquad-1)=subpot;
           }
         }
         // Swap rows and columns
-        pot = pot.t();
+        if(!out)
+          pot = pot.t();
       }
 
-      void DFTGrid::eval_ing(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & P, arma::mat & ing, double thr) {
+      void DFTGrid::eval_ing(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & P, arma::mat & ing, double thr, const std::string & fname) {
+        // The functionals are only initialized when the settings change
+        std::shared_ptr<const XCFunctional> xf, cf;
+        get_functionals(x_func,x_pars,c_func,c_pars,false,thr,xf,cf);
+
         // Compute number of quadrature points
         size_t Nquad=basp->get_r(0).n_elem;
         size_t Nelem=basp->get_rad_Nel();
         // rhoa rhob sigmaaa sigmaab sigmabb lapla laplb taua taub
-        ing.zeros(10, Nquad*Nelem);
+        // Stream the blocks to disk as they are computed?
+        std::shared_ptr<BlockFile> out;
+        if(fname.size()) {
+          out=std::make_shared<BlockFile>(fname, Nquad*Nelem, 10);
+          ing.reset();
+        } else
+          ing.zeros(10, Nquad*Nelem);
 
 #ifdef _OPENMP
 #pragma omp parallel
@@ -1111,35 +1259,49 @@ namespace helfem {
           grid.check_grad_tau_lapl(x_func,c_func);
 
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
           for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-            grid.compute_bf(iel);
+            compute_bf(grid,iel);
             grid.update_density(P);
 
             // We need to evaluate the xc functional to initialize the variables
             grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func,x_pars,thr);
-            if(c_func>0)
-              grid.compute_xc(c_func,c_pars,thr);
+            if(xf)
+              grid.compute_xc(*xf);
+            if(cf)
+              grid.compute_xc(*cf);
 
             // Store
             arma::mat subing;
             grid.get_ingredients(subing);
-            ing.cols(iel*Nquad, (iel+1)*Nquad-1)=subing;
+            if(out)
+              out->write_rows(iel*Nquad, subing);
+            else
+              ing.cols(iel*Nquad, (iel+1)*Nquad-1)=subing;
           }
         }
         // Swap rows and columns
-        ing = ing.t();
+        if(!out)
+          ing = ing.t();
       }
 
-      void DFTGrid::eval_ing(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars,  const arma::cube & Pa, const arma::cube & Pb, arma::mat & ing, double thr) {
+      void DFTGrid::eval_ing(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars,  const arma::cube & Pa, const arma::cube & Pb, arma::mat & ing, double thr, const std::string & fname) {
+        // The functionals are only initialized when the settings change
+        std::shared_ptr<const XCFunctional> xf, cf;
+        get_functionals(x_func,x_pars,c_func,c_pars,true,thr,xf,cf);
+
         // Compute number of quadrature points
         size_t Nquad=basp->get_r(0).n_elem;
         size_t Nelem=basp->get_rad_Nel();
         // rhoa rhob sigmaaa sigmaab sigmabb lapla laplb taua taub
-        ing.zeros(10, Nquad*Nelem);
+        // Stream the blocks to disk as they are computed?
+        std::shared_ptr<BlockFile> out;
+        if(fname.size()) {
+          out=std::make_shared<BlockFile>(fname, Nquad*Nelem, 10);
+          ing.reset();
+        } else
+          ing.zeros(10, Nquad*Nelem);
 
 #ifdef _OPENMP
 #pragma omp parallel
@@ -1149,27 +1311,31 @@ namespace helfem {
           grid.check_grad_tau_lapl(x_func,c_func);
 
 #ifdef _OPENMP
-#pragma omp for
+#pragma omp for schedule(dynamic)
 #endif
           for(size_t iel=0;iel<basp->get_rad_Nel();iel++) {
-            grid.compute_bf(iel);
+            compute_bf(grid,iel);
             grid.update_density(Pa,Pb);
 
             // We need to evaluate the xc functional to initialize the variables
             grid.init_xc();
-            if(x_func>0)
-              grid.compute_xc(x_func,x_pars,thr);
-            if(c_func>0)
-              grid.compute_xc(c_func,c_pars,thr);
+            if(xf)
+              grid.compute_xc(*xf);
+            if(cf)
+              grid.compute_xc(*cf);
 
             // Store
             arma::mat subing;
             grid.get_ingredients(subing);
-            ing.cols(iel*Nquad, (iel+1)*Nquad-1)=subing;
+            if(out)
+              out->write_rows(iel*Nquad, subing);
+            else
+              ing.cols(iel*Nquad, (iel+1)*Nquad-1)=subing;
           }
         }
         // Swap rows and columns
-        ing = ing.t();
+        if(!out)
+          ing = ing.t();
       }
     }
   }
@@ -18,11 +18,26 @@
 #define SADATOM_DFTGRID_H
 
 #include "basis.h"
+#include "../general/dftfuncs.h"
 
 namespace helfem {
   namespace sadatom {
     namespace dftgrid {
 
+      /// Basis function values in an element, cached between Fock builds
+      typedef struct {
+        /// Are the gradients included?
+        bool grad;
+        /// Are the laplacians included?
+        bool lapl;
+        /// List of basis functions in element
+        arma::uvec bf_ind;
+        /// Radii, radial and total quadrature weights
+        arma::rowvec r, wrad, wtot;
+        /// Function values, gradients and laplacians
+        arma::mat bf, bf_rho, bf_rho2;
+      } bf_cache_t;
+
       /// Worker class
       class DFTGridWorker {
       protected:
@@ -115,6 +130,10 @@ namespace helfem {
 
         /// Compute basis functions on grid points
         void compute_bf(size_t iel);
+        /// Store basis functions in cache entry
+        void save_bf(bf_cache_t & c) const;
+        /// Load basis functions from cache entry
+        void load_bf(const bf_cache_t & c);
         /// Free memory
         void free();
 
@@ -135,6 +154,8 @@ namespace helfem {
         /// Compute XC functional from density and add to total XC
         /// array. thr is density threshold. Pot toggles evaluation of potential
         void compute_xc(int func_id, const arma::vec & params, double thr, bool pot=true);
+        /// Same, with an already initialized functional
+        void compute_xc(const XCFunctional & func, bool pot=true);
         /// Evaluate exchange/correlation energy
         double eval_Exc() const;
         /// Zero out energy
@@ -160,6 +181,21 @@ namespace helfem {
         /// Pointer to basis set
         const helfem::sadatom::basis::TwoDBasis * basp;
 
+        /// Memory budget of the basis function cache in bytes
+        size_t cache_budget;
+        /// Memory used by the basis function cache
+        size_t cache_used;
+        /// Cached basis functions in each element
+        std::vector<bf_cache_t> cache;
+        /// Compute basis functions in element, or get them from the cache
+        void compute_bf(DFTGridWorker & grid, size_t iel);
+        /// Print per-thread busy times of the XC quadrature?
+        bool thread_timing;
+        /// Exchange and correlation functionals, kept between calls
+        std::shared_ptr<const XCFunctional> xfunc, cfunc;
+        /// Get the functionals, initializing them if the settings have changed
+        void get_functionals(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, bool polarized, double thr, std::shared_ptr<const XCFunctional> & xf, std::shared_ptr<const XCFunctional> & cf);
+
       public:
         /// Dummy constructor
         DFTGrid();
@@ -168,20 +204,29 @@ namespace helfem {
         /// Destructor
         ~DFTGrid();
 
+        /// Switch to another basis set with the same radial functions, keeping the cache
+        void set_basis(const helfem::sadatom::basis::TwoDBasis * basp);
+        /// Cache basis function values between calls, up to the given memory in bytes; 0 disables the cache
+        void set_bf_cache(size_t budget);
+        /// Toggle printout of per-thread busy times in the XC quadrature
+        void set_thread_timing(bool timing);
+
         /// Compute Fock matrix, exchange-correlation energy and integrated electron density, restricted case
         void eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & P, arma::cube & H, double & Exc, double & Nel, double thr);
         /// Compute Fock matrix, exchange-correlation energy and integrated electron density, unrestricted case
         void eval_Fxc(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & Pa, const arma::cube & Pb, arma::cube & Ha, arma::cube & Hb, double & Exc, double & Nel, bool beta, double thr);
 
-        /// Evaluate the potential
-        void eval_pot(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & P, arma::mat & pot, double thr);
+        /// Evaluate the potential. If a file name is given, the
+        /// values are streamed into a BlockFile instead of pot
+        void eval_pot(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & P, arma::mat & pot, double thr, const std::string & fname="");
         /// Compute the potential
-        void eval_pot(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & Pa, const arma::cube & Pb, arma::mat & pot, double thr);
+        void eval_pot(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & Pa, const arma::cube & Pb, arma::mat & pot, double thr, const std::string & fname="");
 
-        /// Evaluate the ingredients
-        void eval_ing(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & P, arma::mat & ing, double thr);
+        /// Evaluate the ingredients. If a file name is given, the
+        /// values are streamed into a BlockFile instead of ing
+        void eval_ing(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & P, arma::mat & ing, double thr, const std::string & fname="");
         /// Compute the ingredients
-        void eval_ing(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & Pa, const arma::cube & Pb, arma::mat & ing, double thr);
+        void eval_ing(int x_func, const arma::vec & x_pars, int c_func, const arma::vec & c_pars, const arma::cube & Pa, const arma::cube & Pb, arma::mat & ing, double thr, const std::string & fname="");
 
         /// Evaluate overlap
         arma::mat eval_overlap();
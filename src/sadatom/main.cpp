@@ -13,16 +13,26 @@
  * as published by the Free Software Foundation; either version 2
  * of the License, or (at your option) any later version.
  */
+#include "../general/checkpoint.h"
 #include "../general/cmdline.h"
 #include "../general/constants.h"
 #include "../general/dftfuncs.h"
 #include "../general/elements.h"
 #include "../general/scf_helpers.h"
+#include "../general/sap_table.h"
+#include "../general/profiler.h"
+#include "../general/threading.h"
 #include "utils.h"
 #include "dftgrid.h"
 #include "solver.h"
 #include "configurations.h"
+#include "confcache.h"
 #include <cfloat>
+#include <iomanip>
+#include <unordered_set>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 arma::ivec initial_occs(int Z, int lmax) {
   // Guess occupations
@@ -94,55 +104,240 @@ arma::irowvec translate_occs(const arma::irowvec & occin) {
   return occs;
 }
 
-int main(int argc, char **argv) {
-  cmdline::parser parser;
+/// Checks whether the configuration has been visited in the current search
+template<typename T> bool visited(const T & conf, const std::unordered_set<std::string> & keys) {
+  return keys.count(sadatom::solver::ConfigurationCache::key(conf))>0;
+}
 
-  // full option name, no short option, description, argument required
-  parser.add<std::string>("Z", 0, "nuclear charge", true);
-  parser.add<double>("Rmax", 0, "practical infinity in au", false, 40.0);
-  parser.add<int>("grid", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
-  parser.add<int>("grid0", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
-  parser.add<double>("zexp", 0, "parameter in radial grid", false, 2.0);
-  parser.add<double>("zexp0", 0, "parameter in radial grid", false, 2.0);
-  parser.add<int>("nelem", 0, "number of elements", true);
-  parser.add<int>("nelem0", 0, "number of elements", false, 0);
-  parser.add<int>("finitenuc", 0, "finite nuclear model", false, 0);
-  parser.add<double>("Rrms", 0, "nuclear rms radius", false, 0.0);
-  parser.add<int>("Q", 0, "charge of system", false, 0);
-  parser.add<int>("lmax", 0, "maximum angular momentum to include", false, 3);
-  parser.add<int>("nnodes", 0, "number of nodes per element", false, 15);
-  parser.add<int>("nquad", 0, "number of quadrature points", false, 0);
-  parser.add<int>("maxit", 0, "maximum number of iterations", false, 200);
-  parser.add<double>("shift", 0, "level shift for initial SCF iterations", false, 1.0);
-  parser.add<double>("convthr", 0, "convergence threshold", false, 1e-7);
-  parser.add<std::string>("method", 0, "method to use", false, "lda_x");
-  parser.add<std::string>("pot", 0, "method to use to compute potential", false, "none");
-  parser.add<std::string>("occs", 0, "occupations to use", false, "auto");
-  parser.add<double>("dftthr", 0, "density threshold for dft", false, 1e-12);
-  parser.add<int>("iguess", 0, "guess: 0 for core, 1 for GSZ, 2 for SAP, 3 for TF", false, 2);
-  parser.add<int>("restricted", 0, "spin-restricted orbitals", false, -1);
-  parser.add<int>("primbas", 0, "primitive radial basis", false, 4);
-  parser.add<double>("diiseps", 0, "when to start mixing in diis", false, 1e-2);
-  parser.add<double>("diisthr", 0, "when to switch over fully to diis", false, 1e-3);
-  parser.add<int>("diisorder", 0, "length of diis history", false, 10);
-  parser.add<int>("taylor_order", 0, "order of Taylor expansion near the nucleus", false, -1);
-  parser.add<bool>("saveorb", 0, "save radial orbitals to disk?", false, false);
-  parser.add<bool>("savepot", 0, "save xc potential to disk?", false, false);
-  parser.add<bool>("saveing", 0, "save xc ingredients to disk?", false, false);
-  parser.add<bool>("zeroder", 0, "zero derivative at Rmax?", false, false);
-  parser.add<std::string>("x_pars", 0, "file for parameters for exchange functional", false, "");
-  parser.add<std::string>("c_pars", 0, "file for parameters for correlation functional", false, "");
-  parser.add<double>("vdwthr", 0, "Density threshold for van der Waals radius", false, 0.0015);
-  parser.add<bool>("completeness", 0, "Compute completeness and importance profiles?", false, false);
-  parser.add<int>("iconf", 0, "Confinement potential: 1 for polynomial, 2 for exponential", false, 0);
-  parser.add<int>("conf_N", 0, "Exponent in polynomial confinement potential", false, 0);
-  parser.add<double>("conf_R", 0, "Confinement radius", false, 0.0);
-  parser.parse_check(argc, argv);
-/*
-  if(!parser.parse(argc, argv))
-    throw std::logic_error("Error parsing arguments!\n");
-*/
+/// Adds a solved configuration to the current search and to the cache
+template<typename T> void add_configuration(const T & conf, std::vector<T> & list, std::unordered_set<std::string> & keys, sadatom::solver::ConfigurationCache & cache) {
+  list.push_back(conf);
+  keys.insert(sadatom::solver::ConfigurationCache::key(conf));
+  cache.insert(conf);
+}
 
+/// Starting point for the configuration: a stored guess with the same occupations if there is one, otherwise the seed
+template<typename T> const T * starting_point(const T & conf, const T * seed, const sadatom::solver::ConfigurationCache & cache) {
+  const T * guess(cache.guess(conf));
+  return guess ? guess : seed;
+}
+
+/// Solves the configuration unless it is already in the cache
+template<typename T> void solve_configuration(sadatom::solver::SCFSolver & solver, T & conf, const T * seed, const sadatom::solver::ConfigurationCache & cache) {
+  const T * cached(cache.find(conf));
+  if(cached) {
+    conf=*cached;
+    return;
+  }
+  conf.Econf=solver.Solve(conf, starting_point(conf, seed, cache));
+}
+
+/// Solves a batch of configurations starting from the seed, running
+/// ntasks of them concurrently. The solver's integrals are only read,
+/// and the DFT basis function cache has been filled by the preceding
+/// calculations.
+template<typename T> void solve_configurations(sadatom::solver::SCFSolver & solver, std::vector<T> & confs, const T & seed, const sadatom::solver::ConfigurationCache & cache, int ntasks) {
+#ifdef _OPENMP
+  if(ntasks>1 && confs.size()>1) {
+    // Split the threads between the tasks
+    int ntask=std::min(ntasks, (int) confs.size());
+    int nthreads=std::max(1, omp_get_max_threads()/ntask);
+    int oldlevels=omp_get_max_active_levels();
+    omp_set_max_active_levels(2);
+#pragma omp parallel for num_threads(ntask) schedule(dynamic,1)
+    for(size_t i=0;i<confs.size();i++) {
+      omp_set_num_threads(nthreads);
+      confs[i].Econf=solver.Solve(confs[i], starting_point(confs[i], &seed, cache));
+    }
+    omp_set_max_active_levels(oldlevels);
+    return;
+  }
+#else
+  (void) ntasks;
+#endif
+  for(size_t i=0;i<confs.size();i++)
+    confs[i].Econf=solver.Solve(confs[i], starting_point(confs[i], &seed, cache));
+}
+
+/// Handles a candidate in the exhaustive search. Cached configurations
+/// are added to the search directly, while unknown ones are queued in
+/// the batch. Returns true if the candidate had not been visited yet.
+template<typename T> bool queue_configuration(const T & conf, std::vector<T> & list, std::unordered_set<std::string> & keys, std::vector<T> & batch, sadatom::solver::ConfigurationCache & cache) {
+  if(visited(conf, keys))
+    return false;
+  const T * cached(cache.find(conf));
+  if(cached) {
+    add_configuration(*cached, list, keys, cache);
+    return true;
+  }
+  if(std::find(batch.begin(), batch.end(), conf) != batch.end())
+    return false;
+  batch.push_back(conf);
+  return true;
+}
+
+/// Energy of the highest occupied shell and its channel, from Janak's theorem
+double homo_energy(const sadatom::solver::OrbitalChannel & orbs, int lmax, int & lhomo) {
+  arma::ivec occs(orbs.Occs());
+  double ehomo=-DBL_MAX;
+  lhomo=-1;
+  for(int l=0;l<=lmax;l++) {
+    if(occs(l)<=0)
+      continue;
+    arma::vec dN(lmax+1,arma::fill::zeros);
+    dN(l)=-1.0;
+    double e(-orbs.OccupationDerivative(dN));
+    if(e>ehomo) {
+      ehomo=e;
+      lhomo=l;
+    }
+  }
+  if(lhomo<0)
+    throw std::logic_error("No occupied orbitals!\n");
+  return ehomo;
+}
+
+/// Parses a list of nuclear charges such as 1-10,18,Kr-Xe
+std::vector<int> parse_charges(const std::string & str) {
+  std::vector<int> Zlist;
+  std::istringstream iss(str);
+  std::string entry;
+  while(std::getline(iss, entry, ',')) {
+    size_t dash(entry.find('-'));
+    if(dash==std::string::npos) {
+      Zlist.push_back(get_Z(entry));
+      continue;
+    }
+    int Zmin(get_Z(entry.substr(0,dash)));
+    int Zmax(get_Z(entry.substr(dash+1)));
+    if(Zmin<1 || Zmax<Zmin) {
+      std::ostringstream oss;
+      oss << "Invalid range of nuclear charges \"" << entry << "\".\n";
+      throw std::logic_error(oss.str());
+    }
+    for(int Z=Zmin;Z<=Zmax;Z++)
+      Zlist.push_back(Z);
+  }
+  if(!Zlist.size())
+    throw std::logic_error("No nuclear charges given!\n");
+  return Zlist;
+}
+
+/// Interpolates the effective charge from a potential table onto the radial grid of the SAP table
+arma::vec sap_row(const arma::mat & pot, int Z) {
+  // Quadrature points and effective charges; the charge is Z at the nucleus
+  arma::vec r(pot.n_rows+1), Zeff(pot.n_rows+1);
+  r(0)=0.0;
+  Zeff(0)=Z;
+  r.subvec(1,pot.n_rows)=pot.col(0);
+  Zeff.subvec(1,pot.n_rows)=pot.col(8);
+
+  arma::vec rtab(SAP_NRAD);
+  for(size_t i=0;i<SAP_NRAD;i++)
+    rtab(i)=std::min(sap_Zeff[0][i], r(r.n_elem-1));
+  arma::vec row;
+  arma::interp1(r, Zeff, rtab, row, "linear");
+  return row;
+}
+
+/// Writes the effective charges in the format of general/sap_table.cpp;
+/// elements not in the batch are copied from the current table
+/// Quadrature points in [rmin, rmax] for the orbital export, subsampled to npts points
+arma::uvec export_points(const arma::vec & r, double rmin, double rmax, int npts) {
+  arma::uvec idx(arma::find(r>=rmin));
+  if(rmax>0.0)
+    idx=idx(arma::find(r(idx)<=rmax));
+  if(!idx.n_elem)
+    throw std::logic_error("No radial points in the requested export range!\n");
+  if(npts>0 && (size_t) npts<idx.n_elem) {
+    // The quadrature points follow the element grid, which is
+    // already dense where the orbitals vary quickly
+    arma::uvec sub(arma::conv_to<arma::uvec>::from(arma::round(arma::linspace<arma::vec>(0,idx.n_elem-1,npts))));
+    idx=idx(arma::unique(sub));
+  }
+  return idx;
+}
+
+/// Open the HDF5 orbital export and write out the metadata
+void export_header(Checkpoint & chkpt, const sadatom::solver::SCFSolver & solver, int Z, const std::string & method, int x_func, int c_func, const arma::uvec & ridx) {
+  chkpt.open();
+  chkpt.write("Z",Z);
+  chkpt.write("method",method);
+  chkpt.write("x_func",x_func);
+  chkpt.write("c_func",c_func);
+  arma::vec r(solver.Basis().radii());
+  arma::vec wt(solver.Basis().quadrature_weights());
+  chkpt.write("r",arma::mat(r(ridx)));
+  chkpt.write("wr",arma::mat(wt(ridx)));
+}
+
+void write_sap_table(const std::string & fname, const std::vector<int> & Zlist, const std::vector<arma::vec> & zeff) {
+  std::vector<const double *> rows(SAP_NELEM);
+  for(size_t Z=0;Z<SAP_NELEM;Z++)
+    rows[Z]=sap_Zeff[Z];
+  for(size_t i=0;i<Zlist.size();i++)
+    if(Zlist[i]>0 && Zlist[i]<SAP_NELEM && zeff[i].n_elem==SAP_NRAD)
+      rows[Zlist[i]]=zeff[i].memptr();
+
+  FILE *out=fopen(fname.c_str(),"w");
+  if(!out) {
+    std::ostringstream oss;
+    oss << "Error opening " << fname << " for writing.\n";
+    throw std::runtime_error(oss.str());
+  }
+  static const char header[]=
+  "/*\n"
+  "  Copyright (c) 2019, Susi Lehtola\n"
+  "  All rights reserved.\n"
+  "\n"
+  "  Redistribution and use in source and binary forms, with or without\n"
+  "  modification, are permitted provided that the following conditions are met:\n"
+  "  * Redistributions of source code must retain the above copyright\n"
+  "  notice, this list of conditions and the following disclaimer.\n"
+  "  * Redistributions in binary form must reproduce the above copyright\n"
+  "  notice, this list of conditions and the following disclaimer in the\n"
+  "  documentation and/or other materials provided with the distribution.\n"
+  "  * Neither the name of the <organization> nor the\n"
+  "  names of its contributors may be used to endorse or promote products\n"
+  "  derived from this software without specific prior written permission.\n"
+  "\n"
+  "  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS\n"
+  "  \"AS IS\" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT\n"
+  "  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS\n"
+  "  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE\n"
+  "  COPYRIGHT HOLDER BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,\n"
+  "  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT\n"
+  "  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF\n"
+  "  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND\n"
+  "  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,\n"
+  "  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT\n"
+  "  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF\n"
+  "  SUCH DAMAGE.\n"
+  "*/\n"
+  "\n"
+  "/* Tabulated SAP effective charges, generated data. The first row\n"
+  "   holds the radial grid and row Z the charge of element Z. */\n"
+  "#include \"sap_table.h\"\n"
+  "\n"
+  "const double sap_Zeff[SAP_NELEM][SAP_NRAD] = {\n";
+  fputs(header,out);
+  for(size_t Z=0;Z<SAP_NELEM;Z++) {
+    fprintf(out,"  {\n");
+    for(size_t i=0;i<SAP_NRAD;i++) {
+      if(i%5==0)
+        fprintf(out,"    ");
+      fprintf(out,"%.14e",rows[Z][i]);
+      if(i+1<SAP_NRAD)
+        fprintf(out,(i%5==4) ? ",\n" : ", ");
+    }
+    fprintf(out,(Z+1<SAP_NELEM) ? "},\n" : "}};\n");
+  }
+  fclose(out);
+}
+
+/// Runs the calculation for nuclear charge Z. If zeff is given, the
+/// effective charge is also returned on the radial grid of the SAP table
+int run_atom(const cmdline::parser & parser, int Z, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, arma::vec * zeff) {
   // Get parameters
   double Rmax(parser.get<double>("Rmax"));
   int igrid(parser.get<int>("grid"));
@@ -166,16 +361,21 @@ int main(int argc, char **argv) {
   // Order of quadrature rule
   int Nquad(parser.get<int>("nquad"));
   double dftthr(parser.get<double>("dftthr"));
+  double dft_cache(parser.get<double>("dft_cache"));
+  bool dft_timing(parser.get<bool>("dft_timing"));
+  int conf_tasks(parser.get<int>("conf_tasks"));
+  std::string conf_cache(parser.get<std::string>("conf_cache"));
 
   int finitenuc(parser.get<int>("finitenuc"));
   double Rrms(parser.get<double>("Rrms"));
 
   // Nuclear charge
   int Q(parser.get<int>("Q"));
-  int Z(get_Z(parser.get<std::string>("Z")));
   double diiseps=parser.get<double>("diiseps");
   double diisthr=parser.get<double>("diisthr");
   int diisorder=parser.get<int>("diisorder");
+  bool adiis_stop=parser.get<bool>("adiis_stop");
+  bool carry_diis=parser.get<bool>("carry_diis");
   int iguess(parser.get<int>("iguess"));
 
   double vdw_thr=parser.get<double>("vdwthr");
@@ -184,13 +384,23 @@ int main(int argc, char **argv) {
   std::string potmethod(parser.get<std::string>("pot"));
   std::string occstr(parser.get<std::string>("occs"));
   bool saveorb(parser.get<bool>("saveorb"));
+  bool saveorb_h5(parser.get<bool>("saveorb_h5"));
+  double orb_rmin(parser.get<double>("orb_rmin"));
+  double orb_rmax(parser.get<double>("orb_rmax"));
+  int orb_npts(parser.get<int>("orb_npts"));
   bool savepot(parser.get<bool>("savepot"));
   bool saveing(parser.get<bool>("saveing"));
+  bool savebin(parser.get<bool>("savebin"));
   bool zeroder(parser.get<bool>("zeroder"));
   bool completeness(parser.get<bool>("completeness"));
+  bool completeness_ascii(parser.get<bool>("completeness_ascii"));
+  std::string frac_dN(parser.get<std::string>("frac_dN"));
+  std::string frac_output(parser.get<std::string>("frac_output"));
+  double frac_step(parser.get<double>("frac_step"));
 
   std::string xparf(parser.get<std::string>("x_pars"));
   std::string cparf(parser.get<std::string>("c_pars"));
+  scf::OmegaTuning omega_tuning(scf::parse_list(parser.get<std::string>("omega_scan")),parser.get<bool>("omega_tune"),parser.get<int>("omega_maxit"),parser.get<double>("omega_thr"));
 
   std::vector<std::string> rcalc(2);
   rcalc[0]="unrestricted";
@@ -198,9 +408,6 @@ int main(int argc, char **argv) {
 
   printf("Running %s %s calculation with Rmax=%e and %i elements.\n",rcalc[restr==1].c_str(),method.c_str(),Rmax,Nelem);
 
-  // Get primitive basis
-  auto poly(std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(primbas,Nnodes)));
-
   if(Nquad==0)
     // Set default value
     Nquad=5*poly->get_nbf();
@@ -247,16 +454,66 @@ int main(int argc, char **argv) {
       throw std::logic_error("Optimized effective potential is not implemented in the spherically symmetric program.\n");
   }
 
-  // Radial basis
-  arma::vec bval=atomic::basis::form_grid((modelpotential::nuclear_model_t) finitenuc, Rrms, Nelem, Rmax, igrid, zexp, Nelem0, igrid0, zexp0, Z, 0, 0, 0.0);
-
   // Confinement parameters
   int iconf(parser.get<int>("iconf"));
   double conf_R(parser.get<double>("conf_R"));
   int conf_N(parser.get<int>("conf_N"));
+  if(omega_tuning.active()) {
+    if(!is_range_separated(x_func))
+      throw std::logic_error("Tuning the range-separation parameter requires a range-separated functional!\n");
+    if(restr!=1)
+      throw std::logic_error("Range-separation tuning is only implemented for restricted calculations!\n");
+    if(numel<2)
+      throw std::logic_error("Range-separation tuning requires at least two electrons!\n");
+  }
+
+  // Confinement radius scan
+  arma::vec conf_R_list(scf::parse_list(parser.get<std::string>("conf_R_list")));
+  if(conf_R_list.n_elem>1 && omega_tuning.active())
+    throw std::logic_error("Range-separation tuning can't be combined with a confinement radius scan!\n");
+  if(conf_R_list.n_elem) {
+    if(!conf_N)
+      throw std::logic_error("Confinement radius scan requires a confinement potential!\n");
+    if(iconf==3)
+      throw std::logic_error("Confinement radius scan is not possible with a hard wall, since the basis depends on the radius!\n");
+    conf_R=conf_R_list(0);
+  }
+
+  // Radial basis
+  int Nelem_conf(parser.get<int>("nelem_conf"));
+  double conf_thr(parser.get<double>("conf_thr"));
+  // Hard wall confinement: the basis is truncated at the wall
+  bool confined(conf_N || iconf==3);
+  if(iconf==3) {
+    if(conf_R<=0.0)
+      throw std::logic_error("Hard wall confinement requires a positive conf_R!\n");
+    if(zeroder)
+      throw std::logic_error("Hard wall confinement requires the functions to vanish at the wall; don't use zeroder!\n");
+    if(Nelem_conf)
+      throw std::logic_error("nelem_conf is not used with hard wall confinement!\n");
+    Rmax=conf_R;
+    printf("Hard wall confinement: basis truncated at Rmax=%e\n",Rmax);
+  }
+  arma::vec bval;
+  if(Nelem_conf) {
+    if(finitenuc)
+      throw std::logic_error("Confinement grid is only supported for a point nucleus!\n");
+    bval=atomic::basis::confinement_grid(Nelem, Rmax, igrid, zexp, Nelem_conf, iconf, conf_N, conf_R, conf_thr);
+    bval.print("Grid");
+  } else {
+    bval=atomic::basis::form_grid((modelpotential::nuclear_model_t) finitenuc, Rrms, Nelem, Rmax, igrid, zexp, Nelem0, igrid0, zexp0, Z, 0, 0, 0.0);
+  }
 
   // Initialize solver
   sadatom::solver::SCFSolver solver(Z, finitenuc, Rrms, lmax, poly, zeroder, Nquad, bval, taylor_order, x_func, c_func, maxit, shift, convthr, dftthr, diiseps, diisthr, diisorder, iconf, conf_N, conf_R);
+  if(dft_cache>0.0)
+    solver.set_dft_cache((size_t) (dft_cache*1024.0*1024.0));
+  if(dft_timing)
+    solver.set_dft_timing(true);
+  if(adiis_stop)
+    solver.set_adiis_stop(true);
+  if(carry_diis)
+    solver.set_carry_diis(true);
 
   // Set parameters if necessary
   arma::vec xpars, cpars;
@@ -270,6 +527,20 @@ int main(int argc, char **argv) {
   }
   solver.set_params(xpars,cpars);
 
+  // Cache of solved configurations. Results can be reused from runs
+  // with the same settings, and orbitals from runs in the same basis
+  std::ostringstream basisdesc, setdesc;
+  basisdesc << "Z=" << Z << " finitenuc=" << finitenuc << " Rrms=" << std::setprecision(17) << Rrms << " lmax=" << lmax << " primbas=" << primbas << " nnodes=" << Nnodes << " nquad=" << Nquad << " zeroder=" << zeroder << " taylor_order=" << taylor_order << " bval=";
+  for(size_t i=0;i<bval.n_elem;i++)
+    basisdesc << " " << bval(i);
+  setdesc << "Q=" << Q << " method=" << method << " x_pars=" << xparf << " c_pars=" << cparf << " iconf=" << iconf << " conf_N=" << conf_N << " conf_R=" << std::setprecision(17) << conf_R << " convthr=" << convthr << " dftthr=" << dftthr;
+  sadatom::solver::ConfigurationCache cache(basisdesc.str(), setdesc.str());
+  if(conf_cache.size()) {
+    size_t nread(cache.load(conf_cache));
+    if(nread)
+      printf("Read %i configurations from %s\n",(int) nread,conf_cache.c_str());
+  }
+
   // Final configuration (restricted case)
   helfem::sadatom::solver::rconf_t rconf;
   // Final configuration (unrestricted case)
@@ -282,7 +553,9 @@ int main(int argc, char **argv) {
     solver.Initialize(initial.orbs,iguess);
     initial.orbs.SetOccs(initial_occs(numel,lmax));
     if(initial.orbs.Nel()) {
-      initial.Econf=solver.Solve(initial);
+      // This is always solved, since it also fills the DFT basis function cache
+      initial.Econf=solver.Solve(initial, starting_point(initial, (const sadatom::solver::rconf_t *) NULL, cache));
+      cache.insert(initial);
     } else {
       initial.Econf=0.0;
     }
@@ -290,16 +563,17 @@ int main(int argc, char **argv) {
     if(restr==1) {
       // List of configurations
       std::vector<sadatom::solver::rconf_t> rlist;
+      std::unordered_set<std::string> rkeys;
 
       // Restricted calculation
       sadatom::solver::rconf_t conf(initial);
-      conf.Econf=solver.Solve(conf);
+      solve_configuration(solver, conf, &initial, cache);
       if(Q!=0) {
         // Initial occupations are wrong for the state
         conf.orbs.AufbauOccupations(numel);
-        conf.Econf=solver.Solve(conf);
+        solve_configuration(solver, conf, (const sadatom::solver::rconf_t *) NULL, cache);
       }
-      rlist.push_back(conf);
+      add_configuration(conf, rlist, rkeys, cache);
 
       // Brute force search for the lowest state
       while(true) {
@@ -309,9 +583,11 @@ int main(int argc, char **argv) {
         // Do we have an Aufbau ground state?
         conf.orbs=rlist[0].orbs;
         conf.orbs.AufbauOccupations(numel);
-        while(std::find(rlist.begin(), rlist.end(), conf) == rlist.end()) {
-          conf.Econf=solver.Solve(conf);
-          rlist.push_back(conf);
+        sadatom::solver::rconf_t parent(rlist[0]);
+        while(!visited(conf, rkeys)) {
+          solve_configuration(solver, conf, &parent, cache);
+          add_configuration(conf, rlist, rkeys, cache);
+          parent=conf;
           conf.orbs.AufbauOccupations(numel);
         }
         printf("Aufbau search finished\n");
@@ -323,14 +599,16 @@ int main(int argc, char **argv) {
         std::vector<sadatom::solver::OrbitalChannel> newconfs(rlist[0].orbs.MoveElectrons());
 
         bool newconf=false;
+        std::vector<sadatom::solver::rconf_t> batch;
         for(size_t i=0;i<newconfs.size();i++) {
           conf.orbs=newconfs[i];
-          if(std::find(rlist.begin(), rlist.end(), conf) == rlist.end()) {
+          if(queue_configuration(conf, rlist, rkeys, batch, cache))
             newconf=true;
-            conf.Econf=solver.Solve(conf);
-            rlist.push_back(conf);
-          }
         }
+        sadatom::solver::rconf_t seed(rlist[0]);
+        solve_configurations(solver, batch, seed, cache, conf_tasks);
+        for(size_t i=0;i<batch.size();i++)
+          add_configuration(batch[i], rlist, rkeys, cache);
         printf("Exhaustive search finished\n");
         if(!newconf) {
           break;
@@ -357,6 +635,7 @@ int main(int argc, char **argv) {
     } else if(restr==-1) {
       // List of configurations
       std::vector<sadatom::solver::uconf_t> ulist;
+      std::unordered_set<std::string> ukeys;
 
       // Initial configuration
       arma::ivec inocc(initial_occs(numel,lmax));
@@ -370,16 +649,16 @@ int main(int argc, char **argv) {
       conf.orbsb.SetRestricted(false);
       conf.orbsa.SetOccs(inocca);
       conf.orbsb.SetOccs(inoccb);
-      solver.Solve(conf);
+      solve_configuration(solver, conf, (const sadatom::solver::uconf_t *) NULL, cache);
       if(Q!=0) {
         // Initial occupations are wrong for the state
         sadatom::solver::OrbitalChannel helper;
         helper=restrict_configuration(conf);
         helper.AufbauOccupations(numel);
         unrestrict_occupations(helper,conf);
-        conf.Econf=solver.Solve(conf);
+        solve_configuration(solver, conf, (const sadatom::solver::uconf_t *) NULL, cache);
       }
-      ulist.push_back(conf);
+      add_configuration(conf, ulist, ukeys, cache);
 
       // Brute force search for the lowest state
       while(true) {
@@ -393,9 +672,11 @@ int main(int argc, char **argv) {
         unrestrict_occupations(helper,conf);
 
         // Do we have an Aufbau ground state? Test
-        while(std::find(ulist.begin(), ulist.end(), conf) == ulist.end()) {
-          conf.Econf=solver.Solve(conf);
-          ulist.push_back(conf);
+        while(!visited(conf, ukeys)) {
+          // Start from the current lowest configuration
+          sadatom::solver::uconf_t parent(ulist[0]);
+          solve_configuration(solver, conf, &parent, cache);
+          add_configuration(conf, ulist, ukeys, cache);
 
           // Update
           helper=restrict_configuration(ulist[0]);
@@ -412,14 +693,16 @@ int main(int argc, char **argv) {
         std::vector<sadatom::solver::OrbitalChannel> newconfs(helper.MoveElectrons());
 
         bool newconf=false;
+        std::vector<sadatom::solver::uconf_t> batch;
         for(size_t i=0;i<newconfs.size();i++) {
           unrestrict_occupations(newconfs[i],conf);
-          if(std::find(ulist.begin(), ulist.end(), conf) == ulist.end()) {
+          if(queue_configuration(conf, ulist, ukeys, batch, cache))
             newconf=true;
-            conf.Econf=solver.Solve(conf);
-            ulist.push_back(conf);
-          }
         }
+        sadatom::solver::uconf_t seed(ulist[0]);
+        solve_configurations(solver, batch, seed, cache, conf_tasks);
+        for(size_t i=0;i<batch.size();i++)
+          add_configuration(batch[i], ulist, ukeys, cache);
         printf("Exhaustive search finished\n");
         if(!newconf) {
           break;
@@ -468,10 +751,11 @@ int main(int argc, char **argv) {
         printf("\n ************ M = %i ************\n",(int) (numela-numelb+1));
 
         std::vector<sadatom::solver::uconf_t> ulist;
+        std::unordered_set<std::string> ukeys;
         conf.orbsa.AufbauOccupations(numela);
         conf.orbsb.AufbauOccupations(numelb);
-        conf.Econf=solver.Solve(conf);
-        ulist.push_back(conf);
+        solve_configuration(solver, conf, (const sadatom::solver::uconf_t *) NULL, cache);
+        add_configuration(conf, ulist, ukeys, cache);
 
         // Brute force search for the lowest state
         while(true) {
@@ -482,9 +766,11 @@ int main(int argc, char **argv) {
           conf.orbsb=ulist[0].orbsb;
           conf.orbsa.AufbauOccupations(numela);
           conf.orbsb.AufbauOccupations(numelb);
-          while(std::find(ulist.begin(), ulist.end(), conf) == ulist.end()) {
-            conf.Econf=solver.Solve(conf);
-            ulist.push_back(conf);
+          sadatom::solver::uconf_t parent(ulist[0]);
+          while(!visited(conf, ukeys)) {
+            solve_configuration(solver, conf, &parent, cache);
+            add_configuration(conf, ulist, ukeys, cache);
+            parent=conf;
             // Did we find the Aufbau ground state?
             conf.orbsa.AufbauOccupations(numela);
             conf.orbsb.AufbauOccupations(numelb);
@@ -496,17 +782,19 @@ int main(int argc, char **argv) {
           std::vector<sadatom::solver::OrbitalChannel> newconfb(ulist[0].orbsb.MoveElectrons());
 
           bool newconf=false;
+          std::vector<sadatom::solver::uconf_t> batch;
           for(size_t i=0;i<newconfa.size();i++) {
             for(size_t j=0;j<newconfb.size();j++) {
               conf.orbsa=newconfa[i];
               conf.orbsb=newconfb[j];
-              if(std::find(ulist.begin(), ulist.end(), conf) == ulist.end()) {
+              if(queue_configuration(conf, ulist, ukeys, batch, cache))
                 newconf=true;
-                conf.Econf=solver.Solve(conf);
-                ulist.push_back(conf);
-              }
             }
           }
+          sadatom::solver::uconf_t seed(ulist[0]);
+          solve_configurations(solver, batch, seed, cache, conf_tasks);
+          for(size_t i=0;i<batch.size();i++)
+            add_configuration(batch[i], ulist, ukeys, cache);
           printf("Exhaustive search finished\n");
           if(!newconf) {
             break;
@@ -546,6 +834,9 @@ int main(int argc, char **argv) {
       uconf=totlist[0];
     }
 
+    if(conf_cache.size())
+      cache.save(conf_cache);
+
   } else {
     arma::irowvec occs;
 
@@ -607,6 +898,72 @@ int main(int argc, char **argv) {
     }
   }
 
+  // Scan over the rest of the confinement radii, keeping the configuration
+  // fixed and starting each calculation from the previous orbitals
+  if(conf_R_list.n_elem>1) {
+    arma::mat scan(conf_R_list.n_elem,4);
+    for(size_t iR=0;iR<conf_R_list.n_elem;iR++) {
+      if(iR>0) {
+        printf("\nConfinement radius % .6f\n",conf_R_list(iR));
+        solver.set_confinement(conf_R_list(iR));
+        if(restr==1)
+          rconf.Econf=solver.Solve(rconf);
+        else
+          uconf.Econf=solver.Solve(uconf);
+      }
+      scan(iR,0)=conf_R_list(iR);
+      scan(iR,1)=(restr==1) ? rconf.Econf : uconf.Econf;
+      scan(iR,2)=(restr==1) ? rconf.Econfinement : uconf.Econfinement;
+      scan(iR,3)=(restr==1) ? solver.confinement_derivative(rconf) : solver.confinement_derivative(uconf);
+    }
+
+    printf("\nConfinement radius scan for %s\n",element_symbols[Z].c_str());
+    printf("%12s %20s %20s %20s\n","conf_R","Etot","Econf","dE/dconf_R");
+    for(size_t iR=0;iR<scan.n_rows;iR++)
+      printf("%12.6f % 20.10f % 20.10f % 20.10e\n",scan(iR,0),scan(iR,1),scan(iR,2),scan(iR,3));
+
+    std::ostringstream oss;
+    oss << "confscan_" << element_symbols[Z] << ".dat";
+    scan.save(oss.str(),arma::raw_ascii);
+  }
+
+  // Scan or tuning of the range-separation parameter with the
+  // configuration fixed. The ion is formed by removing an electron from
+  // the highest occupied shell. Only the range-separated integrals are
+  // recomputed, and both states start from their previous orbitals.
+  if(omega_tuning.active()) {
+    int lhomo;
+    homo_energy(rconf.orbs,lmax,lhomo);
+    sadatom::solver::rconf_t ion(rconf);
+    arma::ivec ionoccs(rconf.orbs.Occs());
+    ionoccs(lhomo)--;
+    ion.orbs.SetOccs(ionoccs);
+    printf("\nIonized configuration is %s\n",ion.orbs.Characterize().c_str());
+
+    double omega, o_a, o_b;
+    range_separation(x_func, omega, o_a, o_b);
+    omega_tuning.next(omega);
+    sadatom::solver::rconf_t neutral(rconf);
+    while(true) {
+      printf("\nRange-separation parameter omega = % .8f\n",omega);
+      solver.set_omega(omega);
+      neutral.Econf=solver.Solve(neutral);
+      ion.Econf=solver.Solve(ion);
+      omega_tuning.add(omega, neutral.Econf, ion.Econf, homo_energy(neutral.orbs,lmax,lhomo));
+      if(omega_tuning.optimum()==omega)
+        rconf=neutral;
+      if(!omega_tuning.next(omega))
+        break;
+    }
+    omega_tuning.print();
+    // The analysis is done at the best omega
+    solver.set_omega(omega_tuning.optimum());
+
+    std::ostringstream oss;
+    oss << "omegascan_" << element_symbols[Z] << ".dat";
+    omega_tuning.table().save(oss.str(),arma::raw_ascii);
+  }
+
   if(restr==1) {
     // Print the minimal energy configuration
     printf("\nOccupations for wanted configuration\n");
@@ -629,36 +986,75 @@ int main(int argc, char **argv) {
     printf("Ecoul = % 18.9f\n",rconf.Ecoul);
     printf("Eenuc = % 18.9f\n",rconf.Epot);
     printf("Econf = % 18.9f\n",rconf.Econfinement);
+    if(confined) {
+      double dEdR(solver.confinement_derivative(rconf));
+      printf("\nEnergy derivative wrt confinement radius % .10e\n",dEdR);
+      printf("Pressure -dE/dV at confinement radius % .10e\n",-dEdR/(4.0*M_PI*std::pow(solver.get_confinement(),2)));
+    }
     printf("Exc   = % 18.9f\n",rconf.Exc);
     rconf.orbs.Print(solver.Basis());
     (HARTREEINEV*rconf.orbs.GetGap()).t().print("HOMO-LUMO gap (eV)");
 
     if(completeness) {
-      solver.gto_completeness_profile();
-      printf("Evaluated GTO completeness profile\n");
-      solver.sto_completeness_profile();
-      printf("Evaluated STO completeness profile\n");
-      solver.gto_importance_profile(rconf);
-      printf("Evaluated GTO importance profile\n");
-      solver.sto_importance_profile(rconf);
-      printf("Evaluated STO importance profile\n");
+      if(completeness_ascii) {
+        solver.gto_completeness_profile();
+        printf("Evaluated GTO completeness profile\n");
+        solver.sto_completeness_profile();
+        printf("Evaluated STO completeness profile\n");
+        solver.gto_importance_profile(rconf);
+        printf("Evaluated GTO importance profile\n");
+        solver.sto_importance_profile(rconf);
+        printf("Evaluated STO importance profile\n");
+      } else {
+        std::ostringstream oss;
+        oss << element_symbols[Z] << "_profiles.chk";
+        solver.ao_profiles(rconf, oss.str());
+        printf("Evaluated GTO and STO completeness and importance profiles into %s\n",oss.str().c_str());
+      }
+    }
+
+    if(frac_dN.size()) {
+      // Occupation change per l channel, padded with zeros
+      arma::vec dNin(frac_dN);
+      if(dNin.n_elem > (arma::uword) (lmax+1))
+        throw std::logic_error("Too many channels in occupation change!\n");
+      arma::vec dN(lmax+1,arma::fill::zeros);
+      if(dNin.n_elem)
+        dN.subvec(0,dNin.n_elem-1)=dNin;
+
+      std::ostringstream oss;
+      oss << element_symbols[Z] << "_" << frac_output;
+      sadatom::solver::rconf_t fconf(rconf);
+      solver.OccupationContinuation(fconf, dN, oss.str(), frac_step);
+      printf("Occupation continuation written to %s\n",oss.str().c_str());
     }
 
     // Evaluate xc ingredients
     if(saveing) {
-      arma::mat ing(solver.XCIngredients(rconf));
-      ing.save("xcing.dat",arma::raw_ascii);
+      if(savebin)
+        solver.XCIngredients(rconf,"xcing.bin");
+      else {
+        arma::mat ing(solver.XCIngredients(rconf));
+        ing.save("xcing.dat",arma::raw_ascii);
+      }
     }
     // Evaluate the XC potential
     if(savepot) {
-      arma::mat pot(solver.XCPotential(rconf));
-      pot.save("xcpot.dat",arma::raw_ascii);
+      if(savebin)
+        solver.XCPotential(rconf,"xcpot.bin");
+      else {
+        arma::mat pot(solver.XCPotential(rconf));
+        pot.save("xcpot.dat",arma::raw_ascii);
+      }
     }
 
     // Get the effective potential
+    arma::mat pot;
     if(xp_func > 0 || cp_func > 0) {
       solver.set_func(xp_func, cp_func);
-      arma::mat pot(solver.RestrictedPotential(rconf));
+      pot=solver.RestrictedPotential(rconf);
+      if(zeff)
+        *zeff=sap_row(pot, Z);
 
       std::ostringstream oss;
       oss << "result_" << element_symbols[Z] << ".dat";
@@ -667,7 +1063,16 @@ int main(int argc, char **argv) {
 
     // Save the orbitals
     if(saveorb) {
-      rconf.orbs.Save(solver.Basis(), element_symbols[Z]);
+      if(saveorb_h5) {
+        arma::uvec ridx(export_points(solver.Basis().radii(), orb_rmin, orb_rmax, orb_npts));
+        Checkpoint chkpt(element_symbols[Z] + "_orbs.hdf5", true);
+        export_header(chkpt, solver, Z, method, x_func, c_func, ridx);
+        rconf.orbs.Save(solver.Basis(), chkpt, "orbs", ridx);
+        if(pot.n_elem)
+          chkpt.write("potential",arma::mat(pot.rows(ridx)));
+        chkpt.close();
+      } else
+        rconf.orbs.Save(solver.Basis(), element_symbols[Z]);
     }
 
     // Evaluate HF energy
@@ -695,6 +1100,11 @@ int main(int argc, char **argv) {
     printf("Ecoul = % 18.9f\n",uconf.Ecoul);
     printf("Eenuc = % 18.9f\n",uconf.Epot);
     printf("Econf = % 18.9f\n",uconf.Econfinement);
+    if(confined) {
+      double dEdR(solver.confinement_derivative(uconf));
+      printf("\nEnergy derivative wrt confinement radius % .10e\n",dEdR);
+      printf("Pressure -dE/dV at confinement radius % .10e\n",-dEdR/(4.0*M_PI*std::pow(solver.get_confinement(),2)));
+    }
     printf("Exc   = % 18.9f\n",uconf.Exc);
     printf("Alpha orbitals\n");
     uconf.orbsa.Print(solver.Basis());
@@ -705,23 +1115,34 @@ int main(int argc, char **argv) {
 
     // Evaluate xc ingredients
     if(saveing) {
-      arma::mat ing(solver.XCIngredients(uconf));
-      ing.save("xcing.dat",arma::raw_ascii);
+      if(savebin)
+        solver.XCIngredients(uconf,"xcing.bin");
+      else {
+        arma::mat ing(solver.XCIngredients(uconf));
+        ing.save("xcing.dat",arma::raw_ascii);
+      }
     }
     // Evaluate the XC potential
     if(savepot) {
-      arma::mat pot(solver.XCPotential(uconf));
-      pot.save("xcpot.dat",arma::raw_ascii);
+      if(savebin)
+        solver.XCPotential(uconf,"xcpot.bin");
+      else {
+        arma::mat pot(solver.XCPotential(uconf));
+        pot.save("xcpot.dat",arma::raw_ascii);
+      }
     }
 
     // Get the potential
+    arma::mat potU, potM, potW, potS, pots;
     if(xp_func > 0 || cp_func > 0) {
       solver.set_func(xp_func, cp_func);
-      arma::mat potU(solver.UnrestrictedPotential(uconf));
-      arma::mat potM(solver.AveragePotential(uconf));
-      arma::mat potW(solver.WeightedPotential(uconf));
-      arma::mat potS(solver.HighSpinPotential(uconf));
-      arma::mat pots(solver.LowSpinPotential(uconf));
+      potU=solver.UnrestrictedPotential(uconf);
+      potM=solver.AveragePotential(uconf);
+      if(zeff)
+        *zeff=sap_row(potM, Z);
+      potW=solver.WeightedPotential(uconf);
+      potS=solver.HighSpinPotential(uconf);
+      pots=solver.LowSpinPotential(uconf);
 
       std::ostringstream oss;
 
@@ -748,8 +1169,24 @@ int main(int argc, char **argv) {
 
     // Save the orbitals
     if(saveorb) {
-      uconf.orbsa.Save(solver.Basis(), element_symbols[Z] + "_alpha");
-      uconf.orbsb.Save(solver.Basis(), element_symbols[Z] + "_beta");
+      if(saveorb_h5) {
+        arma::uvec ridx(export_points(solver.Basis().radii(), orb_rmin, orb_rmax, orb_npts));
+        Checkpoint chkpt(element_symbols[Z] + "_orbs.hdf5", true);
+        export_header(chkpt, solver, Z, method, x_func, c_func, ridx);
+        uconf.orbsa.Save(solver.Basis(), chkpt, "alpha", ridx);
+        uconf.orbsb.Save(solver.Basis(), chkpt, "beta", ridx);
+        if(potU.n_elem) {
+          chkpt.write("potentialU",arma::mat(potU.rows(ridx)));
+          chkpt.write("potentialM",arma::mat(potM.rows(ridx)));
+          chkpt.write("potentialW",arma::mat(potW.rows(ridx)));
+          chkpt.write("potentialS",arma::mat(potS.rows(ridx)));
+          chkpt.write("potentials",arma::mat(pots.rows(ridx)));
+        }
+        chkpt.close();
+      } else {
+        uconf.orbsa.Save(solver.Basis(), element_symbols[Z] + "_alpha");
+        uconf.orbsb.Save(solver.Basis(), element_symbols[Z] + "_beta");
+      }
     }
 
     // Evaluate HF energy
@@ -761,3 +1198,128 @@ int main(int argc, char **argv) {
 
   return 0;
 }
+
+int main(int argc, char **argv) {
+  cmdline::parser parser;
+
+  // full option name, no short option, description, argument required
+  parser.add<std::string>("Z", 0, "nuclear charge, or a list of charges such as 1-118 to run in one batch", true);
+  parser.add<std::string>("sap_table", 0, "in batch mode, write the effective charges into this file in the format of general/sap_table.cpp", false, "");
+  parser.add<int>("batch_tasks", 0, "number of nuclear charges to run concurrently in batch mode", false, 1);
+  parser.add<double>("Rmax", 0, "practical infinity in au", false, 40.0);
+  parser.add<int>("grid", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
+  parser.add<int>("grid0", 0, "type of grid: 1 for linear, 2 for quadratic, 3 for polynomial, 4 for exponential", false, 4);
+  parser.add<double>("zexp", 0, "parameter in radial grid", false, 2.0);
+  parser.add<double>("zexp0", 0, "parameter in radial grid", false, 2.0);
+  parser.add<int>("nelem", 0, "number of elements", true);
+  parser.add<int>("nelem0", 0, "number of elements", false, 0);
+  parser.add<int>("finitenuc", 0, "finite nuclear model", false, 0);
+  parser.add<double>("Rrms", 0, "nuclear rms radius", false, 0.0);
+  parser.add<int>("Q", 0, "charge of system", false, 0);
+  parser.add<int>("lmax", 0, "maximum angular momentum to include", false, 3);
+  parser.add<int>("nnodes", 0, "number of nodes per element", false, 15);
+  parser.add<int>("nquad", 0, "number of quadrature points", false, 0);
+  parser.add<int>("maxit", 0, "maximum number of iterations", false, 200);
+  parser.add<double>("shift", 0, "level shift for initial SCF iterations", false, 1.0);
+  parser.add<double>("convthr", 0, "convergence threshold", false, 1e-7);
+  parser.add<std::string>("method", 0, "method to use", false, "lda_x");
+  parser.add<std::string>("pot", 0, "method to use to compute potential", false, "none");
+  parser.add<std::string>("occs", 0, "occupations to use", false, "auto");
+  parser.add<double>("dftthr", 0, "density threshold for dft", false, 1e-12);
+  parser.add<double>("dft_cache", 0, "memory in MiB for caching basis functions on the DFT grid, 0 to recompute them on every build", false, 0.0);
+  parser.add<bool>("dft_timing", 0, "print per-thread busy times of the XC quadrature", false, false);
+  parser.add<int>("conf_tasks", 0, "number of configurations to solve concurrently in the exhaustive search", false, 1);
+  parser.add<std::string>("conf_cache", 0, "file for storing solved configurations between runs", false, "");
+  parser.add<int>("iguess", 0, "guess: 0 for core, 1 for GSZ, 2 for SAP, 3 for TF", false, 2);
+  parser.add<int>("restricted", 0, "spin-restricted orbitals", false, -1);
+  parser.add<int>("primbas", 0, "primitive radial basis", false, 4);
+  parser.add<double>("diiseps", 0, "when to start mixing in diis", false, 1e-2);
+  parser.add<double>("diisthr", 0, "when to switch over fully to diis", false, 1e-3);
+  parser.add<int>("diisorder", 0, "length of diis history", false, 10);
+  parser.add<bool>("adiis_stop", 0, "stop using ADIIS for good once the DIIS error falls below diisthr", false, false);
+  parser.add<bool>("carry_diis", 0, "carry the DIIS history over from the parent configuration in the search", false, false);
+  parser.add<int>("taylor_order", 0, "order of Taylor expansion near the nucleus", false, -1);
+  parser.add<bool>("saveorb", 0, "save radial orbitals to disk?", false, false);
+  parser.add<bool>("saveorb_h5", 0, "save radial orbitals and potentials into a single HDF5 file with metadata instead of text files?", false, false);
+  parser.add<double>("orb_rmin", 0, "smallest radius in the HDF5 orbital export", false, 0.0);
+  parser.add<double>("orb_rmax", 0, "largest radius in the HDF5 orbital export, 0 for all", false, 0.0);
+  parser.add<int>("orb_npts", 0, "number of radial points in the HDF5 orbital export, 0 for all quadrature points in the range", false, 0);
+  parser.add<bool>("savepot", 0, "save xc potential to disk?", false, false);
+  parser.add<bool>("saveing", 0, "save xc ingredients to disk?", false, false);
+  parser.add<bool>("savebin", 0, "save xc potential and ingredients as memory mappable binary files (xcpot.bin and xcing.bin)?", false, false);
+  parser.add<bool>("zeroder", 0, "zero derivative at Rmax?", false, false);
+  parser.add<std::string>("x_pars", 0, "file for parameters for exchange functional", false, "");
+  parser.add<std::string>("c_pars", 0, "file for parameters for correlation functional", false, "");
+  parser.add<double>("vdwthr", 0, "Density threshold for van der Waals radius", false, 0.0015);
+  parser.add<bool>("completeness", 0, "Compute completeness and importance profiles?", false, false);
+  parser.add<bool>("completeness_ascii", 0, "Save the profiles in separate text files instead of a single checkpoint?", false, false);
+  parser.add<std::string>("frac_dN", 0, "Continue the occupations of the final configuration by this change per l channel, e.g. \"0 -1\"", false, "");
+  parser.add<std::string>("frac_output", 0, "File for the occupation continuation, prefixed by the element symbol", false, "continuation.dat");
+  parser.add<double>("frac_step", 0, "Initial step of the occupation continuation", false, 0.05);
+  parser.add<std::string>("omega_scan", 0, "List of range-separation parameters at which to evaluate the ionization potential tuning condition", false, "");
+  parser.add<bool>("omega_tune", 0, "Tune the range-separation parameter so that -eps_HOMO equals the ionization potential", false, false);
+  parser.add<int>("omega_maxit", 0, "Maximum number of range-separation tuning steps", false, 10);
+  parser.add<double>("omega_thr", 0, "Convergence threshold for the range-separation tuning condition", false, 1e-5);
+  parser.add<int>("iconf", 0, "Confinement potential: 1 for polynomial, 2 for exponential, 3 for hard wall", false, 0);
+  parser.add<int>("conf_N", 0, "Exponent in polynomial confinement potential", false, 0);
+  parser.add<double>("conf_R", 0, "Confinement radius", false, 0.0);
+  parser.add<std::string>("conf_R_list", 0, "List of confinement radii to scan", false, "");
+  parser.add<int>("nelem_conf", 0, "Number of elements in the confinement wall region, 0 for normal grid", false, 0);
+  parser.add<double>("conf_thr", 0, "Density threshold for truncating the grid in the confinement wall", false, 1e-12);
+  parser.add<std::string>("profile", 0, "Write timing profile to file (.json or .csv)", false, "");
+  parser.add<int>("threads", 0, "Number of threads, 0 for the OpenMP default", false, 0);
+  parser.add<std::string>("threading", 0, "Threading policy: auto runs BLAS serially within the parallel loops, blas leaves it to the library", false, "");
+  parser.parse_check(argc, argv);
+
+  std::string profile(parser.get<std::string>("profile"));
+  if(profile.size())
+    profiler::enable(profile);
+  threading::configure(parser.get<std::string>("threading"),parser.get<int>("threads"));
+  threading::print();
+/*
+  if(!parser.parse(argc, argv))
+    throw std::logic_error("Error parsing arguments!\n");
+*/
+
+  // The primitive basis does not depend on the nuclear charge
+  int primbas(parser.get<int>("primbas"));
+  int Nnodes(parser.get<int>("nnodes"));
+  auto poly(std::shared_ptr<const polynomial_basis::PolynomialBasis>(polynomial_basis::get_basis(primbas,Nnodes)));
+
+  std::vector<int> Zlist(parse_charges(parser.get<std::string>("Z")));
+  std::string sap_table(parser.get<std::string>("sap_table"));
+  if(Zlist.size()==1 && !sap_table.size())
+    return run_atom(parser, Zlist[0], poly, NULL);
+
+  // Batch mode
+  if(sap_table.size() && helfem::utils::stricmp(parser.get<std::string>("pot"),"none")==0)
+    throw std::logic_error("Generating the SAP table requires a potential method!\n");
+  int batch_tasks(parser.get<int>("batch_tasks"));
+
+  std::vector<arma::vec> zeff(Zlist.size());
+#ifdef _OPENMP
+  int ntask=std::max(1, std::min(batch_tasks, (int) Zlist.size()));
+  int nthreads=std::max(1, omp_get_max_threads()/ntask);
+  int oldlevels=omp_get_max_active_levels();
+  omp_set_max_active_levels(2);
+#pragma omp parallel for num_threads(ntask) schedule(dynamic,1)
+#else
+  (void) batch_tasks;
+#endif
+  for(size_t i=0;i<Zlist.size();i++) {
+#ifdef _OPENMP
+    omp_set_num_threads(nthreads);
+#endif
+    run_atom(parser, Zlist[i], poly, sap_table.size() ? &zeff[i] : NULL);
+  }
+#ifdef _OPENMP
+  omp_set_max_active_levels(oldlevels);
+#endif
+
+  if(sap_table.size()) {
+    write_sap_table(sap_table, Zlist, zeff);
+    printf("Wrote effective charges to %s\n",sap_table.c_str());
+  }
+
+  return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ *                This source code is part of
+ *
+ *                          HelFEM
+ *                             -
+ * Finite element methods for electronic structure calculations on small systems
+ *
+ * Written by Susi Lehtola, 2018-
+ * Copyright (c) 2018- Susi Lehtola
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ */
+#include "api.h"
+#include "../general/cmdline.h"
+#include "../general/elements.h"
+#include "../general/timer.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#include <sstream>
+
+using namespace helfem;
+
+/// Parse a list of integers separated by commas
+static arma::ivec parse_ivec(const std::string & str) {
+  std::vector<arma::sword> v;
+  std::stringstream ss(str);
+  std::string item;
+  while(std::getline(ss,item,','))
+    v.push_back(std::stol(item));
+  return arma::conv_to<arma::ivec>::from(v);
+}
+
+/// Parse a job given as space separated key=value pairs
+static sadatom::api::settings_t parse_job(const std::string & line) {
+  sadatom::api::settings_t s;
+  std::istringstream iss(line);
+  std::string word;
+  while(iss >> word) {
+    size_t eq(word.find('='));
+    if(eq==std::string::npos)
+      throw std::logic_error("Expected key=value, got \"" + word + "\"\n");
+    std::string key(word.substr(0,eq));
+    std::string val(word.substr(eq+1));
+
+    if(key=="Z")
+      s.Z=get_Z(val);
+    else if(key=="Q")
+      s.Q=std::stoi(val);
+    else if(key=="method")
+      s.method=val;
+    else if(key=="occs")
+      s.occs=parse_ivec(val);
+    else if(key=="occsb")
+      s.occsb=parse_ivec(val);
+    else if(key=="lmax")
+      s.lmax=std::stoi(val);
+    else if(key=="primbas")
+      s.primbas=std::stoi(val);
+    else if(key=="nnodes")
+      s.nnodes=std::stoi(val);
+    else if(key=="nquad")
+      s.nquad=std::stoi(val);
+    else if(key=="nelem")
+      s.nelem=std::stoi(val);
+    else if(key=="grid")
+      s.igrid=std::stoi(val);
+    else if(key=="zexp")
+      s.zexp=std::stod(val);
+    else if(key=="Rmax")
+      s.Rmax=std::stod(val);
+    else if(key=="finitenuc")
+      s.finitenuc=std::stoi(val);
+    else if(key=="Rrms")
+      s.Rrms=std::stod(val);
+    else if(key=="zeroder")
+      s.zeroder=std::stoi(val);
+    else if(key=="taylor_order")
+      s.taylor_order=std::stoi(val);
+    else if(key=="maxit")
+      s.maxit=std::stoi(val);
+    else if(key=="shift")
+      s.shift=std::stod(val);
+    else if(key=="convthr")
+      s.convthr=std::stod(val);
+    else if(key=="dftthr")
+      s.dftthr=std::stod(val);
+    else if(key=="diiseps")
+      s.diiseps=std::stod(val);
+    else if(key=="diisthr")
+      s.diisthr=std::stod(val);
+    else if(key=="diisorder")
+      s.diisorder=std::stoi(val);
+    else if(key=="iguess")
+      s.iguess=std::stoi(val);
+    else if(key=="iconf")
+      s.iconf=std::stoi(val);
+    else if(key=="conf_N")
+      s.conf_N=std::stoi(val);
+    else if(key=="conf_R")
+      s.conf_R=std::stod(val);
+    else if(key=="refine_thr")
+      s.refine_thr=std::stod(val);
+    else if(key=="refine_frac")
+      s.refine_frac=std::stod(val);
+    else if(key=="refine_maxit")
+      s.refine_maxit=std::stoi(val);
+    else if(key=="verbose")
+      s.verbose=std::stoi(val);
+    else
+      throw std::logic_error("Unknown key \"" + key + "\"\n");
+  }
+  return s;
+}
+
+/// Format occupations as a comma separated list
+static std::string format_occs(const arma::ivec & occs) {
+  std::ostringstream oss;
+  for(size_t i=0;i<occs.n_elem;i++)
+    oss << (i ? "," : "") << occs(i);
+  return oss.str();
+}
+
+/// Serve a stream of jobs, one per line; returns false if the server should shut down
+static bool serve(sadatom::api::Session & session, FILE *in, FILE *out, size_t & njobs) {
+  char *buf=NULL;
+  size_t len=0;
+  bool keep_running=true;
+  while(getline(&buf,&len,in)>0) {
+    std::string line(buf);
+    while(line.size() && (line.back()=='\n' || line.back()=='\r'))
+      line.pop_back();
+    if(!line.size() || line[0]=='#')
+      continue;
+    if(line=="quit")
+      break;
+    if(line=="shutdown") {
+      keep_running=false;
+      break;
+    }
+    if(line=="clear") {
+      session.clear();
+      fprintf(out,"ok\n");
+      fflush(out);
+      continue;
+    }
+
+    try {
+      sadatom::api::settings_t s(parse_job(line));
+      Timer t;
+      sadatom::api::result_t res(session.run_scf(s));
+      fprintf(out,"result %zu Etot=%.12e Ekin=%.12e Epot=%.12e Ecoul=%.12e Econf=%.12e Exc=%.12e converged=%i iterations=%i occs=%s",njobs,res.Etot,res.Ekin,res.Epot,res.Ecoul,res.Econfinement,res.Exc,(int) res.converged,res.iterations,format_occs(res.occs).c_str());
+      if(res.occsb.n_elem)
+        fprintf(out," occsb=%s",format_occs(res.occsb).c_str());
+      if(s.refine_thr>0.0)
+        fprintf(out," nelem=%i maxerr=%.3e",(int) res.errors.n_elem,arma::max(res.errors));
+      fprintf(out," time=%.6f\n",t.get());
+    } catch(std::exception & e) {
+      std::string msg(e.what());
+      while(msg.size() && msg.back()=='\n')
+        msg.pop_back();
+      fprintf(out,"error %zu %s\n",njobs,msg.c_str());
+    }
+    fflush(out);
+    njobs++;
+  }
+  free(buf);
+  return keep_running;
+}
+
+int main(int argc, char **argv) {
+  cmdline::parser parser;
+  parser.add<std::string>("socket", 0, "serve jobs on this Unix domain socket instead of standard input", false, "");
+  parser.parse_check(argc, argv);
+  std::string sockname(parser.get<std::string>("socket"));
+
+  // The solvers print to standard output, so it is moved over to
+  // standard error and the results are written to the original one
+  int resfd(dup(STDOUT_FILENO));
+  dup2(STDERR_FILENO,STDOUT_FILENO);
+
+  sadatom::api::Session session;
+  size_t njobs=0;
+
+  if(!sockname.size()) {
+    FILE *out(fdopen(resfd,"w"));
+    serve(session,stdin,out,njobs);
+    fclose(out);
+    return 0;
+  }
+
+  int sock(socket(AF_UNIX,SOCK_STREAM,0));
+  if(sock<0)
+    throw std::runtime_error("Error creating socket\n");
+  struct sockaddr_un addr;
+  memset(&addr,0,sizeof(addr));
+  addr.sun_family=AF_UNIX;
+  if(sockname.size()>=sizeof(addr.sun_path))
+    throw std::logic_error("Socket name is too long\n");
+  strncpy(addr.sun_path,sockname.c_str(),sizeof(addr.sun_path)-1);
+  unlink(sockname.c_str());
+  if(bind(sock,(struct sockaddr *) &addr,sizeof(addr))<0 || listen(sock,8)<0)
+    throw std::runtime_error("Error binding socket " + sockname + "\n");
+  fprintf(stderr,"Serving jobs on %s\n",sockname.c_str());
+
+  // The connections are served one at a time, sharing the session
+  bool keep_running=true;
+  while(keep_running) {
+    int conn(accept(sock,NULL,NULL));
+    if(conn<0)
+      continue;
+    FILE *in(fdopen(conn,"r"));
+    FILE *out(fdopen(dup(conn),"w"));
+    keep_running=serve(session,in,out,njobs);
+    fclose(in);
+    fclose(out);
+  }
+  close(sock);
+  unlink(sockname.c_str());
+  close(resfd);
+
+  return 0;
+}
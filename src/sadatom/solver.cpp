@@ -21,6 +21,8 @@
 #include "../general/diis.h"
 #include "../general/lcao.h"
 #include "../general/elements.h"
+#include "../general/checkpoint.h"
+#include "../general/profiler.h"
 
 // Shell types
 static const char shtype[]="spdfgh";
@@ -73,6 +75,15 @@ namespace helfem {
         return C;
       }
 
+      arma::mat OrbitalChannel::Energies() const {
+        return E;
+      }
+
+      void OrbitalChannel::SetOrbitals(const arma::cube & C_, const arma::mat & E_) {
+        C=C_;
+        E=E_;
+      }
+
       void OrbitalChannel::SetLmax(int lmax_) {
         lmax=lmax_;
       }
@@ -87,6 +98,60 @@ namespace helfem {
 
       void OrbitalChannel::SetOccs(const arma::ivec & occs_) {
         occs=occs_;
+        if(focc.n_elem != occs.n_elem)
+          focc.clear();
+      }
+
+      arma::vec OrbitalChannel::FractionalOccs() const {
+        return focc.n_elem ? focc : arma::zeros<arma::vec>(occs.n_elem);
+      }
+
+      void OrbitalChannel::SetFractionalOccs(const arma::vec & focc_) {
+        if(focc_.n_elem && focc_.n_elem != occs.n_elem)
+          throw std::logic_error("Fractional occupation vector is of wrong length!\n");
+        focc=focc_;
+      }
+
+      arma::vec OrbitalChannel::TotalOccs() const {
+        return arma::conv_to<arma::vec>::from(occs)+FractionalOccs();
+      }
+
+      arma::vec OrbitalChannel::ShellOccupations(int l) const {
+        arma::vec nocc(C.n_cols,arma::fill::zeros);
+        // Number of electrons to put in
+        double numl = occs(l) + (focc.n_elem ? focc(l) : 0.0);
+        for(size_t io=0;io<C.n_cols;io++) {
+          if(numl <= 1e-12)
+            break;
+          nocc(io) = std::min((double) ShellCapacity(l), numl);
+          numl -= nocc(io);
+        }
+        return nocc;
+      }
+
+      double OrbitalChannel::OccupationDerivative(const arma::vec & dN) const {
+        double dEdt=0.0;
+        for(int l=0;l<=lmax;l++) {
+          if(dN(l)==0.0)
+            continue;
+          // Electrons in the channel
+          double numl = occs(l) + (focc.n_elem ? focc(l) : 0.0);
+          double nsh = numl/ShellCapacity(l);
+          // The frontier shell is the partially filled one; for filled
+          // shells it is the next empty shell when adding, and the
+          // highest filled one when removing electrons
+          arma::sword io = std::floor(nsh);
+          if(std::abs(nsh-std::round(nsh)) < 1e-10) {
+            io = std::round(nsh);
+            if(dN(l)<0.0)
+              io--;
+          }
+          if(io<0 || io>=(arma::sword) E.n_rows)
+            throw std::logic_error("Frontier orbital out of range!\n");
+          // Janak's theorem: dE/dn = orbital energy
+          dEdt += dN(l)*E(io,l);
+        }
+        return dEdt;
       }
 
       std::vector<shell_occupation_t> OrbitalChannel::GetOccupied() const {
@@ -185,28 +250,30 @@ namespace helfem {
         }
       }
 
-      void OrbitalChannel::Save(const basis::TwoDBasis & basis, const std::string & symbol) const {
+      arma::mat OrbitalChannel::OccupiedOrbitals(const basis::TwoDBasis & basis, arma::ivec & lval, arma::ivec & occnum, arma::vec & Eorb) const {
         std::vector<shell_occupation_t> occlist(GetOccupied());
 
-        // Collect the occupied orbitals
+        // Collect the occupied orbitals in order of l
         std::vector< std::vector<int> > iocc(lmax+1);
-        std::vector< std::vector<int> > occnum(lmax+1);
-        std::vector< std::vector<int> > lval(lmax+1);
-        std::vector< std::vector<double> > Eorb(lmax+1);
-        size_t norb=0;
+        std::vector<int> ll, nocc;
+        std::vector<double> El;
         for(int l=0;l<=lmax;l++) {
           for(size_t io=0;io<occlist.size();io++) {
             if(occlist[io].l != l)
               continue;
             iocc[l].push_back(occlist[io].n-l-1);
-            occnum[l].push_back(occlist[io].nocc);
-            Eorb[l].push_back(occlist[io].E);
+            ll.push_back(l);
+            nocc.push_back(occlist[io].nocc);
+            El.push_back(occlist[io].E);
           }
-          norb+=iocc[l].size();
         }
+        lval=arma::conv_to<arma::ivec>::from(ll);
+        occnum=arma::conv_to<arma::ivec>::from(nocc);
+        Eorb=arma::conv_to<arma::vec>::from(El);
 
         // Evaluate the orbitals
-        std::vector<arma::mat> orbval(lmax+1);
+        arma::mat orbval(basis.radii().n_elem,ll.size());
+        size_t ioff=0;
         for(int l=0;l<=lmax;l++) {
           arma::uvec oidx(arma::conv_to<arma::uvec>::from(iocc[l]));
           if(!oidx.n_elem)
@@ -214,18 +281,27 @@ namespace helfem {
 
           // Orbital vector
           arma::mat Cl(C.slice(l).cols(oidx));
-          orbval[l]=basis.orbitals(Cl);
-
-          // Fix the phases
-          for(size_t io=0;io<orbval[l].n_cols;io++) {
-            arma::vec odens(arma::square(orbval[l].col(io)));
-            arma::uword idx;
-            odens.max(idx);
-            if(orbval[l](idx,io)<0.0)
-              orbval[l].col(io)*=-1;
-          }
+          orbval.cols(ioff,ioff+oidx.n_elem-1)=basis.orbitals(Cl);
+          ioff+=oidx.n_elem;
+        }
+
+        // Fix the phases
+        for(size_t io=0;io<orbval.n_cols;io++) {
+          arma::vec odens(arma::square(orbval.col(io)));
+          arma::uword idx;
+          odens.max(idx);
+          if(orbval(idx,io)<0.0)
+            orbval.col(io)*=-1;
         }
 
+        return orbval;
+      }
+
+      void OrbitalChannel::Save(const basis::TwoDBasis & basis, const std::string & symbol) const {
+        arma::ivec lval, occnum;
+        arma::vec Eorb;
+        arma::mat orbval(OccupiedOrbitals(basis, lval, occnum, Eorb));
+
         // Save the results
         arma::vec r(basis.radii());
 
@@ -234,38 +310,42 @@ namespace helfem {
         FILE *out = fopen(oss.str().c_str(),"w");
 
         // Header: number of radial points and orbitals
-        fprintf(out,"%i %i\n",(int) orbval[0].n_rows,(int) norb);
+        fprintf(out,"%i %i\n",(int) orbval.n_rows,(int) orbval.n_cols);
 
         // Orbital angular momenta
-        for(int l=0;l<=lmax;l++) {
-          for(size_t io=0;io<Eorb[l].size();io++)
-            fprintf(out," %i",l);
-        }
+        for(size_t io=0;io<lval.n_elem;io++)
+          fprintf(out," %i",(int) lval(io));
         fprintf(out,"\n");
         // Orbital occupations
-        for(int l=0;l<=lmax;l++) {
-          for(size_t io=0;io<occnum[l].size();io++)
-            fprintf(out," %i",occnum[l][io]);
-        }
+        for(size_t io=0;io<occnum.n_elem;io++)
+          fprintf(out," %i",(int) occnum(io));
         fprintf(out,"\n");
         // Orbital energies
-        for(int l=0;l<=lmax;l++) {
-          for(size_t io=0;io<Eorb[l].size();io++)
-            fprintf(out," %e",Eorb[l][io]);
-        }
+        for(size_t io=0;io<Eorb.n_elem;io++)
+          fprintf(out," %e",Eorb(io));
         fprintf(out,"\n");
         // Orbital values
-        for(size_t ir=0;ir<orbval[0].n_rows;ir++) {
+        for(size_t ir=0;ir<orbval.n_rows;ir++) {
           fprintf(out,"%e",r(ir));
-          for(int l=0;l<=lmax;l++)
-            for(size_t ic=0;ic<orbval[l].n_cols;ic++) {
-              fprintf(out," % e",orbval[l](ir,ic));
-            }
+          for(size_t ic=0;ic<orbval.n_cols;ic++)
+            fprintf(out," % e",orbval(ir,ic));
           fprintf(out,"\n");
         }
         fclose(out);
       }
 
+      void OrbitalChannel::Save(const basis::TwoDBasis & basis, Checkpoint & chkpt, const std::string & grp, const arma::uvec & ridx) const {
+        arma::ivec lval, occnum;
+        arma::vec Eorb;
+        arma::mat orbval(OccupiedOrbitals(basis, lval, occnum, Eorb));
+
+        chkpt.create_group(grp);
+        chkpt.write(grp+"/l",arma::imat(lval));
+        chkpt.write(grp+"/occs",arma::imat(occnum));
+        chkpt.write(grp+"/E",arma::mat(Eorb));
+        chkpt.write(grp+"/orbitals",arma::mat(orbval.rows(ridx)));
+      }
+
       bool OrbitalChannel::operator==(const OrbitalChannel & rh) const {
         if(occs.n_elem != rh.occs.n_elem)
           return false;
@@ -278,30 +358,41 @@ namespace helfem {
 
       size_t OrbitalChannel::CountOccupied(int l) const {
         // Count occupied shells
-        arma::sword numl = occs(l);
-        size_t nsh;
-        for(nsh=0;nsh<C.n_cols;nsh++) {
-          arma::sword nocc = std::min(ShellCapacity(l), numl);
-          numl -= nocc;
-          if(nocc==0)
-            break;
+        arma::vec nocc(ShellOccupations(l));
+        return arma::uvec(arma::find(nocc>0.0)).n_elem;
+      }
+
+      /// Solve the orbitals of an angular channel. Fock matrices without
+      /// nonlocal parts have the band structure of the overlap, and are
+      /// solved in band storage.
+      static void eig_channel(arma::vec & E, arma::mat & C, const arma::mat & F, const arma::mat & Sinvh, const helfem::utils::SymBandMatrix * Sband) {
+        if(Sband && Sband->size()==F.n_rows && Sinvh.n_cols==F.n_rows && helfem::utils::is_banded(F,Sband->bandwidth())) {
+          if(helfem::utils::eig_gsym_banded(E,C,helfem::utils::SymBandMatrix(F,Sband->bandwidth()),*Sband))
+            return;
         }
-        return nsh;
+        helfem::scf::eig_gsym(E,C,F,Sinvh);
       }
 
-      void OrbitalChannel::UpdateOrbitals(const arma::cube & F, const arma::mat & Sinvh) {
+      void OrbitalChannel::UpdateOrbitals(const arma::cube & F, const arma::mat & Sinvh, const helfem::utils::SymBandMatrix * Sband) {
         E.resize(F.n_rows,lmax+1);
         C.resize(F.n_rows,F.n_rows,lmax+1);
+        // The angular channels are independent eigenproblems
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
         for(int l=0;l<=lmax;l++) {
           arma::vec El;
-          helfem::scf::eig_gsym(El,C.slice(l),F.slice(l),Sinvh);
+          eig_channel(El,C.slice(l),F.slice(l),Sinvh,Sband);
           E.col(l)=El;
         }
       }
 
-      void OrbitalChannel::UpdateOrbitalsDamped(const arma::cube & F, const arma::mat & Sinvh, const arma::mat & S, double dampov) {
+      void OrbitalChannel::UpdateOrbitalsDamped(const arma::cube & F, const arma::mat & Sinvh, const arma::mat & S, double dampov, const helfem::utils::SymBandMatrix * Sband) {
         E.resize(F.n_rows,lmax+1);
         C.resize(F.n_rows,F.n_rows,lmax+1);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
         for(int l=0;l<=lmax;l++) {
           // Fock matrix
           arma::mat Fl(F.slice(l));
@@ -322,14 +413,17 @@ namespace helfem {
           }
 
           arma::vec El;
-          helfem::scf::eig_gsym(El,C.slice(l),Fl,Sinvh);
+          eig_channel(El,C.slice(l),Fl,Sinvh,Sband);
           E.col(l)=El;
         }
       }
 
-      void OrbitalChannel::UpdateOrbitalsShifted(const arma::cube & F, const arma::mat & Sinvh, const arma::mat & S, double shift) {
+      void OrbitalChannel::UpdateOrbitalsShifted(const arma::cube & F, const arma::mat & Sinvh, const arma::mat & S, double shift, const helfem::utils::SymBandMatrix * Sband) {
         E.resize(F.n_rows,lmax+1);
         C.resize(F.n_rows,F.n_rows,lmax+1);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
         for(int l=0;l<=lmax;l++) {
           // Fock matrix
           arma::mat Fl(F.slice(l));
@@ -344,11 +438,11 @@ namespace helfem {
             arma::mat shmat(shift*S*Cv*Cv.t()*S);
             // Update orbitals
             arma::vec El;
-            helfem::scf::eig_gsym(El,C.slice(l),Fl+shmat,Sinvh);
+            eig_channel(El,C.slice(l),Fl+shmat,Sinvh,Sband);
             E.col(l)=El;
           } else {
             arma::vec El;
-            helfem::scf::eig_gsym(El,C.slice(l),Fl,Sinvh);
+            eig_channel(El,C.slice(l),Fl,Sinvh,Sband);
             E.col(l)=El;
           }
 
@@ -365,14 +459,12 @@ namespace helfem {
       void OrbitalChannel::UpdateDensity(arma::cube & Pl) const {
         Pl.zeros(C.n_rows,C.n_rows,lmax+1);
         for(int l=0;l<=lmax;l++) {
-          // Number of electrons to put in
-          arma::sword numl = occs(l);
+          // Electrons in the shells
+          arma::vec nocc(ShellOccupations(l));
           for(size_t io=0;io<C.n_cols;io++) {
-            arma::sword nocc = std::min(ShellCapacity(l), numl);
-            numl -= nocc;
-            Pl.slice(l) += nocc * C.slice(l).col(io) * C.slice(l).col(io).t();
-            if(nocc == 0)
+            if(nocc(io) == 0.0)
               break;
+            Pl.slice(l) += nocc(io) * C.slice(l).col(io) * C.slice(l).col(io).t();
           }
         }
       }
@@ -488,18 +580,16 @@ namespace helfem {
         arma::cube P;
         P.zeros(Nrad,Nrad,lmax+1);
         for(int l=0;l<=lmax;l++) {
-          // Number of electrons to put in
-          arma::sword numl = occs(l);
+          // Electrons in the shells
+          arma::vec nocc(ShellOccupations(l));
           // Fill shells
           for(size_t io=0;io<C.n_cols;io++) {
-            arma::sword nocc = std::min(ShellCapacity(l), numl);
-            if(nocc == 0)
+            if(nocc(io) == 0.0)
               break;
 
             // Fractional occupation is
-            double fracocc = nocc*1.0/ShellCapacity(l);
+            double fracocc = nocc(io)/ShellCapacity(l);
             P.slice(l) += fracocc * C.slice(l).col(io) * C.slice(l).col(io).t();
-            numl -= nocc;
           }
         }
 
@@ -599,14 +689,7 @@ namespace helfem {
         return lh.Econf < rh.Econf;
       }
 
-      SCFSolver::SCFSolver(int Z, int finitenuc, double Rrms, int lmax_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order, int x_func_, int c_func_, int maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_) : lmax(lmax_), maxit(maxit_), shift(shift_), convthr(convthr_), dftthr(dftthr_), diiseps(diiseps_), diisthr(diisthr_), diisorder(diisorder_), iconf(0), conf_N(0), conf_R(0.0) {}
-
-      SCFSolver::SCFSolver(int Z, int finitenuc, double Rrms, int lmax_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order, int x_func_, int c_func_, int maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_, int iconf_, int conf_N_, double conf_R_) : lmax(lmax_), maxit(maxit_), shift(shift_), convthr(convthr_), dftthr(dftthr_), diiseps(diiseps_), diisthr(diisthr_), diisorder(diisorder_), iconf(iconf_), conf_N(conf_N_), conf_R(conf_R_) {
-
-        // Construct the angular basis
-        arma::ivec lval, mval;
-        atomic::basis::angular_basis(lmax,lmax,lval,mval);
-
+      SolverState::SolverState(int Z, int finitenuc, double Rrms, int lmax_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order) : lmax(lmax_), yukawa(false), omega(0.0) {
         basis=sadatom::basis::TwoDBasis(Z, (modelpotential::nuclear_model_t) (finitenuc), Rrms, poly, zeroder, Nquad, bval, taylor_order, lmax);
         printf("Basis set has %i radial functions\n",(int) basis.Nbf());
         printf("%ith order Taylor series used to evaluate basis functions for r <= %e, error %e\n",taylor_order, basis.get_small_r_taylor_cutoff(), basis.get_taylor_diff());
@@ -615,22 +698,48 @@ namespace helfem {
         S=basis.overlap();
         // Get half-inverse
         Sinvh=basis.Sinvh();
+        // Overlap in band storage for solving local Fock matrices
+        Sband=basis.overlap_banded();
         // Form kinetic energy matrix
         T=basis.kinetic();
         // Form kinetic energy matrix
         Tl=basis.kinetic_l();
         // Form nuclear attraction energy matrix
         Vnuc=basis.nuclear();
+
+        // Compute two-electron integrals
+        basis.compute_tei();
+      }
+
+      SolverState::SolverState(const SolverState & base, bool yukawa_, double omega_) : SolverState(base) {
+        yukawa=yukawa_;
+        omega=omega_;
+        if(yukawa)
+          basis.compute_yukawa(omega);
+        else
+          basis.compute_erfc(omega);
+      }
+
+      SolverState::~SolverState() {
+      }
+
+      SCFSolver::SCFSolver(int Z, int finitenuc, double Rrms, int lmax_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order, int x_func_, int c_func_, int maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_) : SCFSolver(Z, finitenuc, Rrms, lmax_, poly, zeroder, Nquad, bval, taylor_order, x_func_, c_func_, maxit_, shift_, convthr_, dftthr_, diiseps_, diisthr_, diisorder_, 0, 0, 0.0) {
+      }
+
+      SCFSolver::SCFSolver(int Z, int finitenuc, double Rrms, int lmax_, const std::shared_ptr<const polynomial_basis::PolynomialBasis> & poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order, int x_func_, int c_func_, int maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_, int iconf_, int conf_N_, double conf_R_) : SCFSolver(std::make_shared<const SolverState>(Z, finitenuc, Rrms, lmax_, poly, zeroder, Nquad, bval, taylor_order), x_func_, c_func_, maxit_, shift_, convthr_, dftthr_, diiseps_, diisthr_, diisorder_, iconf_, conf_N_, conf_R_) {
+      }
+
+      SCFSolver::SCFSolver(const std::shared_ptr<const SolverState> & state_, int x_func_, int c_func_, int maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_, int iconf_, int conf_N_, double conf_R_) : state(state_), maxit(maxit_), shift(shift_), convthr(convthr_), dftthr(dftthr_), diiseps(diiseps_), diisthr(diisthr_), diisorder(diisorder_), adiis_stop(false), carry_diis(false), iconf(iconf_), conf_N(conf_N_), conf_R(conf_R_) {
+        lmax=state->lmax;
+
 	// Form confinement potential energy matrix
-	Vconf=basis.confinement(conf_N, conf_R, iconf);
+	Vconf=state->basis.confinement(conf_N, conf_R, iconf);
         // Form core Hamiltonian
-        H0=T+Vnuc+Vconf;
+        H0=state->T+state->Vnuc+Vconf;
 
         // Form DFT grid
-        grid=helfem::sadatom::dftgrid::DFTGrid(&basis);
+        grid=helfem::sadatom::dftgrid::DFTGrid(&state->basis);
 
-        // Compute two-electron integrals
-        basis.compute_tei();
         // Range separation?
         set_func(x_func_, c_func_);
 
@@ -663,10 +772,14 @@ namespace helfem {
         else
           printf("\nA pure exchange functional used, no exact exchange.\n");
 
-        if(yukawa)
-          basis.compute_yukawa(omega);
-        else if(erfc)
-          basis.compute_erfc(omega);
+        // The shared state is not modified; if it lacks the wanted
+        // range-separated integrals, this solver switches to a copy
+        // that has them. The cached basis functions on the grid stay
+        // valid, since the copy has the same radial basis.
+        if((yukawa || erfc) && (state->omega != omega || state->yukawa != yukawa)) {
+          state=std::make_shared<const SolverState>(*state, yukawa, omega);
+          grid.set_basis(&state->basis);
+        }
       }
 
       void SCFSolver::set_params(const arma::vec & px, const arma::vec & pc) {
@@ -674,10 +787,51 @@ namespace helfem {
         c_pars = pc;
       }
 
+      void SCFSolver::set_omega(double omega) {
+        bool erfc, yukawa;
+        is_range_separated(x_func, erfc, yukawa);
+        if(!(erfc || yukawa))
+          throw std::logic_error("The exchange functional is not range separated!\n");
+        x_pars=set_range_separation(x_func, x_pars, omega);
+
+        // The other integrals and the grid cache are kept, as in set_func
+        if(state->omega != omega || state->yukawa != yukawa) {
+          state=std::make_shared<const SolverState>(*state, yukawa, omega);
+          grid.set_basis(&state->basis);
+        }
+      }
+
       void SCFSolver::set_verbose(bool verbose_) {
         verbose = verbose_;
       }
 
+      void SCFSolver::set_dft_cache(size_t budget) {
+        grid.set_bf_cache(budget);
+      }
+
+      void SCFSolver::set_dft_timing(bool timing) {
+        grid.set_thread_timing(timing);
+      }
+
+      void SCFSolver::set_adiis_stop(bool stop) {
+        adiis_stop=stop;
+      }
+
+      void SCFSolver::set_carry_diis(bool carry) {
+        carry_diis=carry;
+      }
+
+      void SCFSolver::set_confinement(double conf_R_) {
+        conf_R=conf_R_;
+        // Basis, grid and two-electron integrals don't depend on the radius
+        Vconf=state->basis.confinement(conf_N, conf_R, iconf);
+        H0=state->T+state->Vnuc+Vconf;
+      }
+
+      double SCFSolver::get_confinement() const {
+        return conf_R;
+      }
+
       arma::mat SCFSolver::TotalDensity(const arma::cube & Pl) const {
         arma::mat P(Pl.slice(0));
         for(size_t l=1;l<Pl.n_slices;l++)
@@ -691,33 +845,33 @@ namespace helfem {
         switch(iguess) {
         case(0):
           // Core guess
-          orbs.UpdateOrbitals(ReplicateCube(H0)+KineticCube(),Sinvh);
+          orbs.UpdateOrbitals(ReplicateCube(H0)+KineticCube(),state->Sinvh,&state->Sband);
           break;
         case(1):
           {
             // GSZ guess
-            auto model = new modelpotential::GSZAtom(basis.charge());
-            arma::mat Vsap(basis.model_potential(model));
+            auto model = new modelpotential::GSZAtom(state->basis.charge());
+            arma::mat Vsap(state->basis.model_potential(model));
             delete model;
-            orbs.UpdateOrbitals(ReplicateCube(T+Vsap)+KineticCube(),Sinvh);
+            orbs.UpdateOrbitals(ReplicateCube(state->T+Vsap)+KineticCube(),state->Sinvh,&state->Sband);
           }
           break;
         case(2):
           // SAP guess
           {
-            auto model = new modelpotential::SAPAtom(basis.charge());
-            arma::mat Vsap(basis.model_potential(model));
+            auto model = new modelpotential::SAPAtom(state->basis.charge());
+            arma::mat Vsap(state->basis.model_potential(model));
             delete model;
-            orbs.UpdateOrbitals(ReplicateCube(T+Vsap)+KineticCube(),Sinvh);
+            orbs.UpdateOrbitals(ReplicateCube(state->T+Vsap)+KineticCube(),state->Sinvh,&state->Sband);
           }
           break;
         case(3):
           // TF guess
           {
-            auto model = new modelpotential::TFAtom(basis.charge());
-            arma::mat Vsap(basis.model_potential(model));
+            auto model = new modelpotential::TFAtom(state->basis.charge());
+            arma::mat Vsap(state->basis.model_potential(model));
             delete model;
-            orbs.UpdateOrbitals(ReplicateCube(T+Vsap)+KineticCube(),Sinvh);
+            orbs.UpdateOrbitals(ReplicateCube(state->T+Vsap)+KineticCube(),state->Sinvh,&state->Sband);
           }
           break;
 
@@ -739,7 +893,7 @@ namespace helfem {
         conf.orbs.UpdateDensity(conf.Pl);
         arma::mat P(TotalDensity(conf.Pl));
         if(verbose) {
-          printf("Tr P = %f\n",arma::trace(P*S));
+          printf("Tr P = %f\n",arma::trace(P*state->S));
           fflush(stdout);
         }
 
@@ -749,10 +903,10 @@ namespace helfem {
         arma::cube kc(KineticCube());
 
         // Compute energy
-        conf.Ekin=arma::trace(P*T);
+        conf.Ekin=arma::trace(P*state->T);
         for(arma::sword l=0;l<=lmax;l++)
           conf.Ekin+=arma::trace(conf.Pl.slice(l)*kc.slice(l));
-        conf.Epot=arma::trace(P*Vnuc);
+        conf.Epot=arma::trace(P*state->Vnuc);
         if(verbose) {
           printf("Kinetic energy %.10e\n",conf.Ekin);
           printf("Nuclear attraction energy %.10e\n",conf.Epot);
@@ -760,7 +914,7 @@ namespace helfem {
         }
 
         // Form Coulomb matrix
-        arma::mat J(basis.coulomb(P/angfac));
+        arma::mat J(state->basis.coulomb(P/angfac));
         conf.Ecoul=0.5*arma::trace(P*J);
         if(verbose) {
           printf("Coulomb energy %.10e\n",conf.Ecoul);
@@ -785,7 +939,7 @@ namespace helfem {
           XC/=angfac;
           if(verbose) {
             printf("DFT energy %.10e\n",conf.Exc);
-            printf("Error in integrated number of electrons % e\n",nelnum-conf.orbs.Nel());
+            printf("Error in integrated number of electrons % e\n",nelnum-arma::sum(conf.orbs.TotalOccs()));
             fflush(stdout);
           }
         }
@@ -798,9 +952,9 @@ namespace helfem {
         if(kfrac!=0.0 || kshort!=0.0) {
           K.zeros(P.n_rows,P.n_rows,lmax+1);
           if(kfrac!=0.0)
-            K+=kfrac*basis.exchange(conf.orbs.AngularDensity());
+            K+=kfrac*state->basis.exchange(conf.orbs.AngularDensity());
           if(kshort!=0.0)
-            K+=kshort*basis.rs_exchange(conf.orbs.AngularDensity());
+            K+=kshort*state->basis.rs_exchange(conf.orbs.AngularDensity());
 
           double Exx=0.0;
           for(int l=0;l<=lmax;l++)
@@ -842,13 +996,13 @@ namespace helfem {
         arma::cube kc(KineticCube());
 
         // Compute energy
-        conf.Ekin=arma::trace(P*T);
+        conf.Ekin=arma::trace(P*state->T);
         for(arma::sword l=0;l<=lmax;l++)
           conf.Ekin+=arma::trace(Pl.slice(l)*kc.slice(l));
-        conf.Epot=arma::trace(P*Vnuc);
+        conf.Epot=arma::trace(P*state->Vnuc);
 
         // Form Coulomb matrix
-        arma::mat J(basis.coulomb(P/angfac));
+        arma::mat J(state->basis.coulomb(P/angfac));
         conf.Ecoul=0.5*arma::trace(P*J);
         if(verbose) {
           printf("Coulomb energy %.10e\n",conf.Ecoul);
@@ -872,7 +1026,7 @@ namespace helfem {
         XCb/=angfac;
         if(verbose) {
           printf("DFT energy %.10e\n",conf.Exc);
-          printf("Error in integrated number of electrons % e\n",nelnum-conf.orbsa.Nel()-conf.orbsb.Nel());
+          printf("Error in integrated number of electrons % e\n",nelnum-arma::sum(conf.orbsa.TotalOccs())-arma::sum(conf.orbsb.TotalOccs()));
           fflush(stdout);
         }
 
@@ -885,12 +1039,12 @@ namespace helfem {
           Ka.zeros(P.n_rows,P.n_rows,lmax+1);
           Kb.zeros(P.n_rows,P.n_rows,lmax+1);
           if(kfrac!=0.0) {
-            Ka+=kfrac*basis.exchange(conf.orbsa.AngularDensity());
-            Kb+=kfrac*basis.exchange(conf.orbsb.AngularDensity());
+            Ka+=kfrac*state->basis.exchange(conf.orbsa.AngularDensity());
+            Kb+=kfrac*state->basis.exchange(conf.orbsb.AngularDensity());
           }
           if(kshort!=0.0) {
-            Ka+=kshort*basis.rs_exchange(conf.orbsa.AngularDensity());
-            Kb+=kshort*basis.rs_exchange(conf.orbsb.AngularDensity());
+            Ka+=kshort*state->basis.rs_exchange(conf.orbsa.AngularDensity());
+            Kb+=kshort*state->basis.rs_exchange(conf.orbsb.AngularDensity());
           }
 
           double Exx=0.0;
@@ -921,67 +1075,107 @@ namespace helfem {
         return conf.Econf;
       }
 
+      /// Evaluator for radial GTOs
+      static std::function<arma::mat(int l, const arma::vec &r)> gto_evaluator(const arma::vec & expn) {
+        return [expn](int l, const arma::vec & r) {
+          return lcao::radial_GTO(r,l,expn);
+        };
+      }
+
+      /// Evaluator for radial STOs
+      static std::function<arma::mat(int l, const arma::vec &r)> sto_evaluator(const arma::vec & expn) {
+        return [expn](int l, const arma::vec & r) {
+          return lcao::radial_STO(r,l,expn);
+        };
+      }
+
       void SCFSolver::gto_importance_profile(const rconf_t & conf, double minexp, double maxexp, size_t nexp) const {
         arma::vec expn(arma::exp10(arma::linspace<arma::vec>(log10(minexp),log10(maxexp),nexp)));
-        std::function<arma::mat(int l, const arma::vec &r)> eval_gto = [expn](int l, const arma::vec & r) {
-          arma::mat value(r.n_elem, expn.n_elem, arma::fill::zeros);
-          for(size_t ix=0;ix<expn.n_elem;ix++)
-            for(size_t ir=0;ir<r.n_elem;ir++)
-              value(ir,ix) = lcao::radial_GTO(r(ir),l,expn(ix));
-          return value;
-        };
-        arma::mat I = ao_importance_profile(conf, expn, eval_gto);
+        arma::mat I = ao_importance_profile(conf, expn, ao_projections(expn, gto_evaluator(expn)));
         std::ostringstream oss;
-        oss << element_symbols[basis.charge()] << "_gto_importance.dat";
+        oss << element_symbols[state->basis.charge()] << "_gto_importance.dat";
         I.save(oss.str(),arma::raw_ascii);
       }
 
       void SCFSolver::sto_importance_profile(const rconf_t & conf, double minexp, double maxexp, size_t nexp) const {
         arma::vec expn(arma::exp10(arma::linspace<arma::vec>(log10(minexp),log10(maxexp),nexp)));
-        std::function<arma::mat(int l, const arma::vec &r)> eval_sto = [expn](int l, const arma::vec & r) {
-          arma::mat value(r.n_elem, expn.n_elem, arma::fill::zeros);
-          for(size_t ix=0;ix<expn.n_elem;ix++)
-            for(size_t ir=0;ir<r.n_elem;ir++)
-              value(ir,ix) = lcao::radial_STO(r(ir),l,expn(ix));
-          return value;
-        };
-        arma::mat I = ao_importance_profile(conf, expn, eval_sto);
+        arma::mat I = ao_importance_profile(conf, expn, ao_projections(expn, sto_evaluator(expn)));
         std::ostringstream oss;
-        oss << element_symbols[basis.charge()] << "_sto_importance.dat";
+        oss << element_symbols[state->basis.charge()] << "_sto_importance.dat";
         I.save(oss.str(),arma::raw_ascii);
       }
 
       void SCFSolver::gto_completeness_profile(double minexp, double maxexp, size_t nexp) const {
         arma::vec expn(arma::exp10(arma::linspace<arma::vec>(log10(minexp),log10(maxexp),nexp)));
-        std::function<arma::mat(int l, const arma::vec &r)> eval_gto = [expn](int l, const arma::vec & r) {
-          arma::mat value(r.n_elem, expn.n_elem, arma::fill::zeros);
-          for(size_t ix=0;ix<expn.n_elem;ix++)
-            for(size_t ir=0;ir<r.n_elem;ir++)
-              value(ir,ix) = lcao::radial_GTO(r(ir),l,expn(ix));
-          return value;
-        };
-        arma::mat I = ao_completeness_profile(expn, eval_gto);
+        arma::mat I = ao_completeness_profile(expn, ao_projections(expn, gto_evaluator(expn)));
         std::ostringstream oss;
-        oss << element_symbols[basis.charge()] << "_gto_completeness.dat";
+        oss << element_symbols[state->basis.charge()] << "_gto_completeness.dat";
         I.save(oss.str(),arma::raw_ascii);
       }
 
       void SCFSolver::sto_completeness_profile(double minexp, double maxexp, size_t nexp) const {
         arma::vec expn(arma::exp10(arma::linspace<arma::vec>(log10(minexp),log10(maxexp),nexp)));
-        std::function<arma::mat(int l, const arma::vec &r)> eval_sto = [expn](int l, const arma::vec & r) {
-          arma::mat value(r.n_elem, expn.n_elem, arma::fill::zeros);
-          for(size_t ix=0;ix<expn.n_elem;ix++)
-            for(size_t ir=0;ir<r.n_elem;ir++)
-              value(ir,ix) = lcao::radial_STO(r(ir),l,expn(ix));
-          return value;
-        };
-        arma::mat I = ao_completeness_profile(expn, eval_sto);
+        arma::mat I = ao_completeness_profile(expn, ao_projections(expn, sto_evaluator(expn)));
         std::ostringstream oss;
-        oss << element_symbols[basis.charge()] << "_sto_completeness.dat";
+        oss << element_symbols[state->basis.charge()] << "_sto_completeness.dat";
         I.save(oss.str(),arma::raw_ascii);
       }
 
-      arma::mat SCFSolver::ao_importance_profile(const rconf_t & conf, const arma::vec & expn, const std::function<arma::mat(int l, const arma::vec &r)> & eval_ao) const {
+      void SCFSolver::ao_profiles(const rconf_t & conf, const std::string & fname, double minexp, double maxexp, size_t nexp) const {
+        arma::vec expn(arma::exp10(arma::linspace<arma::vec>(log10(minexp),log10(maxexp),nexp)));
+
+        Checkpoint chkpt(fname,true);
+        chkpt.open();
+        chkpt.write("Z",state->basis.charge());
+        chkpt.write("exponents",arma::mat(expn));
+
+        // The projections on the basis are shared by both profiles
+        std::vector<arma::mat> proj(ao_projections(expn, gto_evaluator(expn)));
+        chkpt.write("gto_completeness",ao_completeness_profile(expn, proj));
+        chkpt.write("gto_importance",ao_importance_profile(conf, expn, proj));
+
+        proj = ao_projections(expn, sto_evaluator(expn));
+        chkpt.write("sto_completeness",ao_completeness_profile(expn, proj));
+        chkpt.write("sto_importance",ao_importance_profile(conf, expn, proj));
+        chkpt.close();
+      }
+
+      std::vector<arma::mat> SCFSolver::ao_projections(const arma::vec & expn, const std::function<arma::mat(int l, const arma::vec &r)> & eval_ao) const {
+        std::vector<arma::mat> proj(lmax+1);
+        for(int l=0;l<=lmax;l++)
+          proj[l].zeros(state->basis.Nbf(), expn.n_elem);
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+        {
+          // Thread-local projections
+          std::vector<arma::mat> wrk(proj);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic,1)
+#endif
+          for(size_t iel=0; iel < state->basis.get_rad_Nel(); iel++) {
+            // Get the values of the radii
+            arma::vec r(state->basis.get_r(iel));
+            arma::vec wr(state->basis.get_wrad(iel));
+            // The basis functions are evaluated only once for all l
+            arma::mat bf(state->basis.eval_bf(iel));
+            bf.each_col() %= wr%r%r;
+            arma::uvec bf_list(state->basis.bf_list(iel));
+            for(int l=0; l<=lmax; l++)
+              wrk[l].rows(bf_list) += bf.t()*eval_ao(l, r);
+          }
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+          for(int l=0; l<=lmax; l++)
+            proj[l] += wrk[l];
+        }
+
+        return proj;
+      }
+
+      arma::mat SCFSolver::ao_importance_profile(const rconf_t & conf, const arma::vec & expn, const std::vector<arma::mat> & proj) const {
         // Pick the orbital occupations
         arma::ivec occs = conf.orbs.Occs();
         // Pick the orbital coefficients
@@ -996,29 +1190,13 @@ namespace helfem {
         I.col(0) = expn;
 
         for(int l=0; l<=lmax;l++) {
-          // Evaluator
-
           // Determine number of occupied orbitals
           int nocc = std::ceil(occs(l) / (2.0*(2.0*l+1.0)));
           // The occupied orbitals are
           arma::mat Cocc = C.slice(l).cols(0,nocc-1);
 
-          // Compute the projection of the AOs on the occupied orbitals
-          arma::mat ao_projection(nocc, expn.n_elem, arma::fill::zeros);
-          for(size_t iel=0; iel < basis.get_rad_Nel(); iel++) {
-            // Get the values of the radii
-            arma::vec r(basis.get_r(iel));
-            arma::vec wr(basis.get_wrad(iel));
-            // Evaluate AOs
-            arma::mat gto(eval_ao(l, r));
-            // Evaluate the basis functions
-            arma::mat bf(basis.eval_bf(iel));
-            arma::uvec bf_list(basis.bf_list(iel));
-            // Orbitals are then
-            arma::mat orbs = bf*Cocc.rows(bf_list);
-            // Projection of AO onto orbitals is
-            ao_projection += orbs.t()*arma::diagmat(wr%r%r)*gto;
-          }
+          // Projection of the AOs on the occupied orbitals
+          arma::mat ao_projection(Cocc.t()*proj[l]);
 
           // Compute the importance profile
           for(size_t ix=0;ix<expn.n_elem;ix++) {
@@ -1029,30 +1207,14 @@ namespace helfem {
         return I;
       }
 
-      arma::mat SCFSolver::ao_completeness_profile(const arma::vec & expn, const std::function<arma::mat(int l, const arma::vec &r)> & eval_ao) const {
+      arma::mat SCFSolver::ao_completeness_profile(const arma::vec & expn, const std::vector<arma::mat> & proj) const {
         // Returned profile
         arma::mat Y(expn.n_elem, lmax+2, arma::fill::zeros);
         Y.col(0) = expn;
 
         for(int l=0; l<=lmax;l++) {
-          // Compute the projection of the AOs on the element basis
-          arma::mat ao_projection(expn.n_elem, basis.Nbf(), arma::fill::zeros);
-          for(size_t iel=0; iel < basis.get_rad_Nel(); iel++) {
-            // Get the values of the radii
-            arma::vec r(basis.get_r(iel));
-            arma::vec wr(basis.get_wrad(iel));
-            // Evaluate AOs
-            arma::mat ao(eval_ao(l, r));
-            // Evaluate the basis functions
-            arma::mat bf(basis.eval_bf(iel));
-            arma::uvec bf_list(basis.bf_list(iel));
-            // Projection of AOs onto orbitals is
-            ao_projection.cols(bf_list) += ao.t()*arma::diagmat(wr%r%r)*bf;
-          }
-          // Convert into the orthonormal basis
-          ao_projection = ao_projection * Sinvh;
-          // and take the transpose for easier manipulation
-          ao_projection = ao_projection.t();
+          // Projection of the AOs in the orthonormal basis
+          arma::mat ao_projection(state->Sinvh.t()*proj[l]);
 
           // Compute the completeness profile
           for(size_t ix=0;ix<expn.n_elem;ix++) {
@@ -1083,10 +1245,10 @@ namespace helfem {
 
       arma::cube SCFSolver::KineticCube() const {
         // Kinetic energy l factors
-        arma::cube Tc(T.n_rows,T.n_cols,lmax+1);
+        arma::cube Tc(state->T.n_rows,state->T.n_cols,lmax+1);
         Tc.zeros();
         for(arma::sword l=0;l<=lmax;l++)
-          Tc.slice(l)=l*(l+1)*Tl;
+          Tc.slice(l)=l*(l+1)*state->Tl;
         return Tc;
       }
 
@@ -1108,7 +1270,15 @@ namespace helfem {
         return M;
       }
 
-      double SCFSolver::Solve(rconf_t & conf) {
+      double SCFSolver::Solve(rconf_t & conf, const rconf_t * seed) {
+        if(seed) {
+          // Start from the converged orbitals of the seed, keeping the occupations
+          arma::ivec occs(conf.orbs.Occs());
+          arma::vec focc(conf.orbs.FractionalOccs());
+          conf.orbs=seed->orbs;
+          conf.orbs.SetOccs(occs);
+          conf.orbs.SetFractionalOccs(focc);
+        }
         if(!conf.orbs.OrbitalsInitialized())
           throw std::logic_error("Orbitals not initialized!\n");
         if(!conf.orbs.Restricted())
@@ -1123,7 +1293,12 @@ namespace helfem {
 
         // DIIS object. ADIIS doesn't work for (significant) fractional occupation
         bool usediis=true, useadiis=true;
-        ::rDIIS diis(SuperMat(S),SuperMat(Sinvh),usediis,diiseps,diisthr,useadiis,verbose,diisorder);
+        // The Fock and density matrices are block diagonal in l, so DIIS
+        // works on the per-l blocks directly
+        ::rDIIS diis(state->S,state->Sinvh,usediis,diiseps,diisthr,useadiis,verbose,diisorder);
+        if(carry_diis && seed && seed->diis)
+          diis=*(seed->diis);
+        diis.set_adiis_stop(adiis_stop);
         double diiserr;
 
         double E=0.0, Eold;
@@ -1133,10 +1308,13 @@ namespace helfem {
           if(verbose) {
             printf("\n**** Iteration %i ****\n\n",(int) iscf);
           }
+          profiler::Region rscf("scf");
 
           // Form Fock matrix
           Eold=E;
+          profiler::Region rfock("fock");
           E=FockBuild(conf);
+          rfock.stop();
 
           double dE=E-Eold;
           if(verbose) {
@@ -1146,13 +1324,9 @@ namespace helfem {
             fflush(stdout);
           }
 
-          // Since Fock operator depends on the l channel, we need to create
-          // a supermatrix for DIIS.
-          arma::mat Fsuper(SuperCube(conf.Fl));
-          // Need density for DIIS as well
-          arma::mat Psuper(SuperCube(conf.Pl));
           // Update DIIS
-          diis.update(Fsuper,Psuper,E,diiserr);
+          profiler::Region rdiis("DIIS");
+          diis.update(conf.Fl,conf.Pl,E,diiserr);
           if(verbose) {
             printf("DIIS error is %e\n",diiserr);
             fflush(stdout);
@@ -1161,24 +1335,29 @@ namespace helfem {
           conf.converged=(diiserr<convthr) && (std::abs(dE)<convthr);
 
           // Solve DIIS to get Fock update
-          diis.solve_F(Fsuper);
-          conf.Fl=MiniMat(Fsuper);
+          diis.solve_F(conf.Fl);
+          rdiis.stop();
 
           // Update orbitals and density
+          profiler::Region rdiag("diag");
           if(diiserr > diisthr) {
             // Since ADIIS is unreliable, we also use a level shift.
-            conf.orbs.UpdateOrbitalsShifted(conf.Fl,Sinvh,S,shift);
+            conf.orbs.UpdateOrbitalsShifted(conf.Fl,state->Sinvh,state->S,shift,&state->Sband);
           } else {
-            conf.orbs.UpdateOrbitals(conf.Fl,Sinvh);
+            conf.orbs.UpdateOrbitals(conf.Fl,state->Sinvh,&state->Sband);
           }
+          rdiag.stop();
 
           if(conf.converged)
             break;
         }
+        conf.iterations=std::min(iscf,(arma::sword) maxit);
         if(iscf > maxit) {
           printf("*** Not converged; DIIS error %e ***\n",diiserr);
           fflush(stdout);
         }
+        // Keep the history for configurations seeded from this one
+        conf.diis = carry_diis ? std::make_shared<::rDIIS>(diis) : std::shared_ptr<::rDIIS>();
 
         if(verbose) {
           printf("%-21s energy: % .16f\n","Kinetic",conf.Ekin);
@@ -1191,21 +1370,38 @@ namespace helfem {
           printf("\n");
 
           // Electron density at nucleus
-          printf("Electron density at nucleus % .10e\n",basis.nuclear_density(TotalDensity(conf.Pl)));
+          printf("Electron density at nucleus % .10e\n",state->basis.nuclear_density(TotalDensity(conf.Pl)));
         } else {
-          printf("Evaluated energy % .16f for configuration ",conf.Econf);
+          // Keep the line intact when configurations are solved concurrently
+#ifdef _OPENMP
+#pragma omp critical(sadatom_solve_print)
+#endif
+          {
+            printf("Evaluated energy % .16f for configuration ",conf.Econf);
 
-          arma::ivec occs(conf.orbs.Occs());
-          for(size_t i=0;i<occs.size();i++)
-            printf(" %i",(int) occs(i));
-          printf("\n");
-          fflush(stdout);
+            arma::ivec occs(conf.orbs.Occs());
+            for(size_t i=0;i<occs.size();i++)
+              printf(" %i",(int) occs(i));
+            printf("\n");
+            fflush(stdout);
+          }
         }
 
         return E;
       }
 
-      double SCFSolver::Solve(uconf_t & conf) {
+      double SCFSolver::Solve(uconf_t & conf, const uconf_t * seed) {
+        if(seed) {
+          // Start from the converged orbitals of the seed, keeping the occupations
+          arma::ivec occa(conf.orbsa.Occs()), occb(conf.orbsb.Occs());
+          arma::vec focca(conf.orbsa.FractionalOccs()), foccb(conf.orbsb.FractionalOccs());
+          conf.orbsa=seed->orbsa;
+          conf.orbsb=seed->orbsb;
+          conf.orbsa.SetOccs(occa);
+          conf.orbsb.SetOccs(occb);
+          conf.orbsa.SetFractionalOccs(focca);
+          conf.orbsb.SetFractionalOccs(foccb);
+        }
         if(!conf.orbsa.OrbitalsInitialized())
           throw std::logic_error("Orbitals not initialized!\n");
         if(!conf.orbsb.OrbitalsInitialized())
@@ -1230,7 +1426,10 @@ namespace helfem {
 
         // DIIS object. ADIIS doesn't work for (significant) fractional occupation
         bool combine=false, usediis=true, useadiis=true;
-        uDIIS diis(SuperMat(S),SuperMat(Sinvh),combine, usediis,diiseps,diisthr,useadiis,verbose,diisorder);
+        uDIIS diis(state->S,state->Sinvh,combine, usediis,diiseps,diisthr,useadiis,verbose,diisorder);
+        if(carry_diis && seed && seed->diis)
+          diis=*(seed->diis);
+        diis.set_adiis_stop(adiis_stop);
         double diiserr;
 
         arma::sword iscf;
@@ -1238,9 +1437,12 @@ namespace helfem {
           if(verbose) {
             printf("\n**** Iteration %i ****\n\n",(int) iscf);
           }
+          profiler::Region rscf("scf");
 
           Eold=E;
+          profiler::Region rfock("fock");
           E=FockBuild(conf);
+          rfock.stop();
           double dE=E-Eold;
 
           if(verbose) {
@@ -1250,13 +1452,9 @@ namespace helfem {
             fflush(stdout);
           }
 
-          // Since Fock operator depends on the l channel, we need to create
-          // a supermatrix for DIIS.
-          arma::mat Fasuper(SuperCube(conf.Fal)), Fbsuper(SuperCube(conf.Fbl));
-          arma::mat Pasuper(SuperCube(conf.Pal));
-          arma::mat Pbsuper(SuperCube(conf.Pbl));
-          // Update DIIS
-          diis.update(Fasuper,Fbsuper,Pasuper,Pbsuper,E,diiserr);
+          // Update DIIS with the per-l blocks
+          profiler::Region rdiis("DIIS");
+          diis.update(conf.Fal,conf.Fbl,conf.Pal,conf.Pbl,E,diiserr);
           if(verbose) {
             printf("DIIS error is %e\n",diiserr);
             fflush(stdout);
@@ -1266,26 +1464,30 @@ namespace helfem {
           conf.converged=(diiserr<convthr) && (std::abs(dE)<convthr);
 
           // Solve DIIS to get Fock update
-          diis.solve_F(Fasuper,Fbsuper);
-          conf.Fal=MiniMat(Fasuper);
-          conf.Fbl=MiniMat(Fbsuper);
+          diis.solve_F(conf.Fal,conf.Fbl);
+          rdiis.stop();
 
           // Update orbitals and density
+          profiler::Region rdiag("diag");
           if(diiserr > diisthr) {
             // Since ADIIS is unreliable, we also use a level shift
-            conf.orbsa.UpdateOrbitalsShifted(conf.Fal,Sinvh,S,shift);
-            conf.orbsb.UpdateOrbitalsShifted(conf.Fbl,Sinvh,S,shift);
+            conf.orbsa.UpdateOrbitalsShifted(conf.Fal,state->Sinvh,state->S,shift,&state->Sband);
+            conf.orbsb.UpdateOrbitalsShifted(conf.Fbl,state->Sinvh,state->S,shift,&state->Sband);
           } else {
-            conf.orbsa.UpdateOrbitals(conf.Fal,Sinvh);
-            conf.orbsb.UpdateOrbitals(conf.Fbl,Sinvh);
+            conf.orbsa.UpdateOrbitals(conf.Fal,state->Sinvh,&state->Sband);
+            conf.orbsb.UpdateOrbitals(conf.Fbl,state->Sinvh,&state->Sband);
           }
+          rdiag.stop();
           if(conf.converged)
             break;
         }
+        conf.iterations=std::min(iscf,(arma::sword) maxit);
         if(iscf > maxit) {
           printf("*** Not converged; DIIS error %e ***\n",diiserr);
           fflush(stdout);
         }
+        // Keep the history for configurations seeded from this one
+        conf.diis = carry_diis ? std::make_shared<::uDIIS>(diis) : std::shared_ptr<::uDIIS>();
 
         if(verbose) {
           printf("%-21s energy: % .16f\n","Kinetic",conf.Ekin);
@@ -1298,38 +1500,104 @@ namespace helfem {
           printf("\n");
 
           // Electron density at nucleus
-          printf("Electron density at nucleus % .10e % .10e\n",basis.nuclear_density(TotalDensity(conf.Pal)),basis.nuclear_density(TotalDensity(conf.Pbl)));
+          printf("Electron density at nucleus % .10e % .10e\n",state->basis.nuclear_density(TotalDensity(conf.Pal)),state->basis.nuclear_density(TotalDensity(conf.Pbl)));
         } else {
-          printf("Evaluated energy % .16f for configuration ",E);
-
-          arma::ivec occa(conf.orbsa.Occs());
-          for(size_t i=0;i<occa.size();i++)
-            printf(" %i",(int) occa(i));
-          arma::ivec occb(conf.orbsb.Occs());
-          for(size_t i=0;i<occb.size();i++)
-            printf(" %i",(int) occb(i));
-          printf("\n");
-          fflush(stdout);
+#ifdef _OPENMP
+#pragma omp critical(sadatom_solve_print)
+#endif
+          {
+            printf("Evaluated energy % .16f for configuration ",E);
+
+            arma::ivec occa(conf.orbsa.Occs());
+            for(size_t i=0;i<occa.size();i++)
+              printf(" %i",(int) occa(i));
+            arma::ivec occb(conf.orbsb.Occs());
+            for(size_t i=0;i<occb.size();i++)
+              printf(" %i",(int) occb(i));
+            printf("\n");
+            fflush(stdout);
+          }
         }
 
         return E;
       }
 
+      void SCFSolver::OccupationContinuation(rconf_t & conf, const arma::vec & dN, const std::string & fname, double dt, double dtmin, double dtmax, int fastit, int slowit) {
+        if(dN.n_elem != (arma::uword) (lmax+1))
+          throw std::logic_error("Occupation change vector is of wrong length!\n");
+        if(dt<dtmin)
+          throw std::logic_error("Initial step is smaller than the minimal step!\n");
+
+        FILE *out = fopen(fname.c_str(),"w");
+        if(!out)
+          throw std::runtime_error("Error opening " + fname + " for writing!\n");
+        fprintf(out,"# %-6s","t");
+        for(int l=0;l<=lmax;l++)
+          fprintf(out," %8s%-2i","n_l=",l);
+        fprintf(out," %24s %24s %24s %6s\n","E","dE/dt (Janak)","dE/dt (finite diff)","niter");
+
+        std::function<void(double t, const rconf_t & c, double dEfd)> write_step = [&](double t, const rconf_t & c, double dEfd) {
+          fprintf(out,"%8.6f",t);
+          arma::vec n(c.orbs.TotalOccs());
+          for(size_t l=0;l<n.n_elem;l++)
+            fprintf(out," %10.6f",n(l));
+          fprintf(out," % 24.16e % 24.16e % 24.16e %6i\n",c.Econf,c.orbs.OccupationDerivative(dN),dEfd,(int) c.iterations);
+          fflush(out);
+        };
+
+        // Starting point
+        rconf_t last(conf);
+        double t=0.0;
+        last.orbs.SetFractionalOccs(arma::vec());
+        Solve(last);
+        write_step(t,last,0.0);
+
+        while(t<1.0) {
+          double tnew=std::min(1.0,t+dt);
+          rconf_t trial(last);
+          trial.orbs.SetFractionalOccs(tnew*dN);
+          Solve(trial,&last);
+
+          if(!trial.converged) {
+            // Retry with a shorter step
+            dt*=0.5;
+            if(dt<dtmin) {
+              fclose(out);
+              throw std::runtime_error("Occupation continuation failed to converge!\n");
+            }
+            continue;
+          }
+          write_step(tnew,trial,(trial.Econf-last.Econf)/(tnew-t));
+
+          // Adapt step length to the SCF effort
+          if(trial.iterations<=fastit)
+            dt=std::min(dtmax,1.5*dt);
+          else if(trial.iterations>=slowit)
+            dt=std::max(dtmin,0.5*dt);
+
+          last=trial;
+          t=tnew;
+        }
+        fclose(out);
+
+        conf=last;
+      }
+
       arma::mat SCFSolver::RestrictedPotential(rconf_t & conf) {
         if(!conf.orbs.OrbitalsInitialized())
           throw std::logic_error("No orbitals!\n");
 
         arma::mat P=TotalDensity(conf.Pl);
 
-        arma::vec r(basis.radii());
-        arma::vec wt(basis.quadrature_weights());
-        arma::vec vcoul(basis.coulomb_screening(P));
-        arma::vec vxc(basis.xc_screening(P,x_func,c_func));
+        arma::vec r(state->basis.radii());
+        arma::vec wt(state->basis.quadrature_weights());
+        arma::vec vcoul(state->basis.coulomb_screening(P));
+        arma::vec vxc(state->basis.xc_screening(P,x_func,c_func));
         arma::vec Zeff(vcoul+vxc);
-        arma::vec rho(basis.electron_density(P));
-        arma::vec grho(basis.electron_density_gradient(P));
-        arma::vec lrho(basis.electron_density_laplacian(P));
-        arma::vec tau(basis.kinetic_energy_density(conf.Pl));
+        arma::vec rho(state->basis.electron_density(P));
+        arma::vec grho(state->basis.electron_density_gradient(P));
+        arma::vec lrho(state->basis.electron_density_laplacian(P));
+        arma::vec tau(state->basis.kinetic_energy_density(conf.Pl));
 
         arma::mat result(Zeff.n_rows,9);
         result.col(0)=r;
@@ -1340,7 +1608,7 @@ namespace helfem {
         result.col(5)=vcoul;
         result.col(6)=vxc;
         result.col(7)=wt;
-        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*basis.charge()-Zeff;
+        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*state->basis.charge()-Zeff;
 
         printf("Electron density by quadrature: %.10e\n",arma::sum(wt%rho%r%r));
         printf("Quadrature of tabulated Coulomb potential yields Coulomb energy %.10e\n",arma::sum(0.5*r%rho%wt%vcoul));
@@ -1361,17 +1629,17 @@ namespace helfem {
         // Total density
         arma::cube Pl(conf.Pal+conf.Pbl);
 
-        arma::vec r(basis.radii());
-        arma::vec wt(basis.quadrature_weights());
-        arma::vec vcoul(basis.coulomb_screening(P));
-        arma::mat vxcm(basis.xc_screening(Pa,Pb,x_func,c_func));
+        arma::vec r(state->basis.radii());
+        arma::vec wt(state->basis.quadrature_weights());
+        arma::vec vcoul(state->basis.coulomb_screening(P));
+        arma::mat vxcm(state->basis.xc_screening(Pa,Pb,x_func,c_func));
         // Averaged potential
         arma::vec vxc=arma::mean(vxcm,1);
         arma::vec Zeff(vcoul+vxc);
-        arma::vec rho(basis.electron_density(P));
-        arma::vec grho(basis.electron_density_gradient(P));
-        arma::vec lrho(basis.electron_density_laplacian(P));
-        arma::vec tau(basis.kinetic_energy_density(Pl));
+        arma::vec rho(state->basis.electron_density(P));
+        arma::vec grho(state->basis.electron_density_gradient(P));
+        arma::vec lrho(state->basis.electron_density_laplacian(P));
+        arma::vec tau(state->basis.kinetic_energy_density(Pl));
 
         arma::mat result(r.n_elem,9);
         result.col(0)=r;
@@ -1382,7 +1650,7 @@ namespace helfem {
         result.col(5)=vcoul;
         result.col(6)=vxc;
         result.col(7)=wt;
-        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*basis.charge()-Zeff;
+        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*state->basis.charge()-Zeff;
 
         printf("Electron density by quadrature: %.10e\n",arma::sum(wt%rho%r%r));
         printf("Quadrature of tabulated Coulomb potential yields Coulomb energy %.10e\n",arma::sum(0.5*r%rho%wt%vcoul));
@@ -1400,16 +1668,16 @@ namespace helfem {
         arma::mat Pb=TotalDensity(conf.Pbl);
         arma::mat P(Pa+Pb);
 
-        arma::vec wt(basis.quadrature_weights());
-        arma::vec vcoul(basis.coulomb_screening(P));
-        arma::vec vxc(basis.xc_screening(P,x_func,c_func));
+        arma::vec wt(state->basis.quadrature_weights());
+        arma::vec vcoul(state->basis.coulomb_screening(P));
+        arma::vec vxc(state->basis.xc_screening(P,x_func,c_func));
         arma::vec Zeff(vcoul+vxc);
 
-        arma::vec r(basis.radii());
-        arma::vec rho(basis.electron_density(P));
-        arma::vec grho(basis.electron_density_gradient(P));
-        arma::vec lrho(basis.electron_density_laplacian(P));
-        arma::vec tau(basis.kinetic_energy_density(conf.Pal+conf.Pbl));
+        arma::vec r(state->basis.radii());
+        arma::vec rho(state->basis.electron_density(P));
+        arma::vec grho(state->basis.electron_density_gradient(P));
+        arma::vec lrho(state->basis.electron_density_laplacian(P));
+        arma::vec tau(state->basis.kinetic_energy_density(conf.Pal+conf.Pbl));
 
         arma::mat result(Zeff.n_rows,9);
         result.col(0)=r;
@@ -1420,7 +1688,7 @@ namespace helfem {
         result.col(5)=vcoul;
         result.col(6)=vxc;
         result.col(7)=wt;
-        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*basis.charge()-Zeff;
+        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*state->basis.charge()-Zeff;
 
         return result;
       }
@@ -1435,18 +1703,18 @@ namespace helfem {
         arma::mat Pb=TotalDensity(conf.Pbl);
         arma::mat P(Pa+Pb);
 
-        arma::vec r(basis.radii());
-        arma::vec wt(basis.quadrature_weights());
-        arma::vec vcoul(basis.coulomb_screening(P));
-        arma::mat vxcm(basis.xc_screening(Pa,Pb,x_func,c_func));
-        arma::vec rhoa(basis.electron_density(Pa));
-        arma::vec grhoa(basis.electron_density_gradient(Pa));
-        arma::vec lrhoa(basis.electron_density_laplacian(Pa));
-        arma::vec rhob(basis.electron_density(Pb));
-        arma::vec grhob(basis.electron_density_gradient(Pb));
-        arma::vec lrhob(basis.electron_density_laplacian(Pb));
-        arma::vec taua(basis.kinetic_energy_density(conf.Pal));
-        arma::vec taub(basis.kinetic_energy_density(conf.Pbl));
+        arma::vec r(state->basis.radii());
+        arma::vec wt(state->basis.quadrature_weights());
+        arma::vec vcoul(state->basis.coulomb_screening(P));
+        arma::mat vxcm(state->basis.xc_screening(Pa,Pb,x_func,c_func));
+        arma::vec rhoa(state->basis.electron_density(Pa));
+        arma::vec grhoa(state->basis.electron_density_gradient(Pa));
+        arma::vec lrhoa(state->basis.electron_density_laplacian(Pa));
+        arma::vec rhob(state->basis.electron_density(Pb));
+        arma::vec grhob(state->basis.electron_density_gradient(Pb));
+        arma::vec lrhob(state->basis.electron_density_laplacian(Pb));
+        arma::vec taua(state->basis.kinetic_energy_density(conf.Pal));
+        arma::vec taub(state->basis.kinetic_energy_density(conf.Pbl));
 
         // Averaged potential
         arma::vec vxc((vxcm.col(0)%rhoa + vxcm.col(1)%rhob)/(rhoa+rhob));
@@ -1464,7 +1732,7 @@ namespace helfem {
         result.col(5)=vcoul;
         result.col(6)=vxc;
         result.col(7)=wt;
-        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*basis.charge()-Zeff;
+        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*state->basis.charge()-Zeff;
 
         return result;
       }
@@ -1480,18 +1748,18 @@ namespace helfem {
         arma::mat Pcoul(Pa+Pb);
         arma::mat Pxc(2*Pa);
 
-        arma::vec r(basis.radii());
-        arma::vec wt(basis.quadrature_weights());
-        arma::vec vcoul(basis.coulomb_screening(Pcoul));
-        arma::mat vxc(basis.xc_screening(Pxc,x_func,c_func));
-        arma::vec rhoa(basis.electron_density(Pa));
-        arma::vec grhoa(basis.electron_density_gradient(Pa));
-        arma::vec lrhoa(basis.electron_density_laplacian(Pa));
-        arma::vec rhob(basis.electron_density(Pb));
-        arma::vec grhob(basis.electron_density_gradient(Pb));
-        arma::vec lrhob(basis.electron_density_laplacian(Pb));
-        arma::vec taua(basis.kinetic_energy_density(conf.Pal));
-        arma::vec taub(basis.kinetic_energy_density(conf.Pbl));
+        arma::vec r(state->basis.radii());
+        arma::vec wt(state->basis.quadrature_weights());
+        arma::vec vcoul(state->basis.coulomb_screening(Pcoul));
+        arma::mat vxc(state->basis.xc_screening(Pxc,x_func,c_func));
+        arma::vec rhoa(state->basis.electron_density(Pa));
+        arma::vec grhoa(state->basis.electron_density_gradient(Pa));
+        arma::vec lrhoa(state->basis.electron_density_laplacian(Pa));
+        arma::vec rhob(state->basis.electron_density(Pb));
+        arma::vec grhob(state->basis.electron_density_gradient(Pb));
+        arma::vec lrhob(state->basis.electron_density_laplacian(Pb));
+        arma::vec taua(state->basis.kinetic_energy_density(conf.Pal));
+        arma::vec taub(state->basis.kinetic_energy_density(conf.Pbl));
         arma::vec Zeff(vcoul+vxc);
 
         arma::mat result(Zeff.n_rows,9);
@@ -1503,7 +1771,7 @@ namespace helfem {
         result.col(5)=vcoul;
         result.col(6)=vxc;
         result.col(7)=wt;
-        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*basis.charge()-Zeff;
+        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*state->basis.charge()-Zeff;
 
         return result;
       }
@@ -1519,18 +1787,18 @@ namespace helfem {
         arma::mat Pcoul(Pa+Pb);
         arma::mat Pxc(2*Pb);
 
-        arma::vec r(basis.radii());
-        arma::vec wt(basis.quadrature_weights());
-        arma::vec vcoul(basis.coulomb_screening(Pcoul));
-        arma::mat vxc(basis.xc_screening(Pxc,x_func,c_func));
-        arma::vec rhoa(basis.electron_density(Pa));
-        arma::vec grhoa(basis.electron_density_gradient(Pa));
-        arma::vec lrhoa(basis.electron_density_laplacian(Pa));
-        arma::vec rhob(basis.electron_density(Pb));
-        arma::vec grhob(basis.electron_density_gradient(Pb));
-        arma::vec lrhob(basis.electron_density_laplacian(Pb));
-        arma::vec taua(basis.kinetic_energy_density(conf.Pal));
-        arma::vec taub(basis.kinetic_energy_density(conf.Pbl));
+        arma::vec r(state->basis.radii());
+        arma::vec wt(state->basis.quadrature_weights());
+        arma::vec vcoul(state->basis.coulomb_screening(Pcoul));
+        arma::mat vxc(state->basis.xc_screening(Pxc,x_func,c_func));
+        arma::vec rhoa(state->basis.electron_density(Pa));
+        arma::vec grhoa(state->basis.electron_density_gradient(Pa));
+        arma::vec lrhoa(state->basis.electron_density_laplacian(Pa));
+        arma::vec rhob(state->basis.electron_density(Pb));
+        arma::vec grhob(state->basis.electron_density_gradient(Pb));
+        arma::vec lrhob(state->basis.electron_density_laplacian(Pb));
+        arma::vec taua(state->basis.kinetic_energy_density(conf.Pal));
+        arma::vec taub(state->basis.kinetic_energy_density(conf.Pbl));
         arma::vec Zeff(vcoul+vxc);
 
         arma::mat result(Zeff.n_rows,9);
@@ -1542,65 +1810,78 @@ namespace helfem {
         result.col(5)=vcoul;
         result.col(6)=vxc;
         result.col(7)=wt;
-        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*basis.charge()-Zeff;
+        result.col(8)=arma::ones<arma::vec>(Zeff.n_elem)*state->basis.charge()-Zeff;
 
         return result;
       }
 
-      arma::mat SCFSolver::XCPotential(rconf_t & conf) {
+      arma::mat SCFSolver::XCPotential(rconf_t & conf, const std::string & fname) {
         arma::mat pot;
         double angfac(4.0*M_PI);
-        grid.eval_pot(x_func, x_pars, c_func, c_pars, conf.Pl/angfac, pot, dftthr);
+        grid.eval_pot(x_func, x_pars, c_func, c_pars, conf.Pl/angfac, pot, dftthr, fname);
         return pot;
       }
 
-      arma::mat SCFSolver::XCPotential(uconf_t & conf) {
+      arma::mat SCFSolver::XCPotential(uconf_t & conf, const std::string & fname) {
         arma::mat pot;
         double angfac(4.0*M_PI);
-        grid.eval_pot(x_func, x_pars, c_func, c_pars, conf.Pal/angfac, conf.Pbl/angfac, pot, dftthr);
+        grid.eval_pot(x_func, x_pars, c_func, c_pars, conf.Pal/angfac, conf.Pbl/angfac, pot, dftthr, fname);
         return pot;
       }
 
-      arma::mat SCFSolver::XCIngredients(rconf_t & conf) {
+      arma::mat SCFSolver::XCIngredients(rconf_t & conf, const std::string & fname) {
         arma::mat ing;
         double angfac(4.0*M_PI);
-        grid.eval_ing(x_func, x_pars, c_func, c_pars, conf.Pl/angfac, ing, dftthr);
+        grid.eval_ing(x_func, x_pars, c_func, c_pars, conf.Pl/angfac, ing, dftthr, fname);
         return ing;
       }
 
-      arma::mat SCFSolver::XCIngredients(uconf_t & conf) {
+      arma::mat SCFSolver::XCIngredients(uconf_t & conf, const std::string & fname) {
         arma::mat ing;
         double angfac(4.0*M_PI);
-        grid.eval_ing(x_func, x_pars, c_func, c_pars, conf.Pal/angfac, conf.Pbl/angfac, ing, dftthr);
+        grid.eval_ing(x_func, x_pars, c_func, c_pars, conf.Pal/angfac, conf.Pbl/angfac, ing, dftthr, fname);
         return ing;
       }
 
       const sadatom::basis::TwoDBasis & solver::SCFSolver::Basis() const {
-        return basis;
+        return state->basis;
+      }
+
+      std::shared_ptr<const solver::SolverState> solver::SCFSolver::State() const {
+        return state;
       }
 
       double SCFSolver::nuclear_density(const rconf_t & conf) const {
-        return basis.nuclear_density(TotalDensity(conf.Pl));
+        return state->basis.nuclear_density(TotalDensity(conf.Pl));
       }
 
       double SCFSolver::nuclear_density(const uconf_t & conf) const {
-        return basis.nuclear_density(TotalDensity(conf.Pal+conf.Pbl));
+        return state->basis.nuclear_density(TotalDensity(conf.Pal+conf.Pbl));
       }
 
       double SCFSolver::nuclear_density_gradient(const rconf_t & conf) const {
-        return basis.nuclear_density_gradient(TotalDensity(conf.Pl));
+        return state->basis.nuclear_density_gradient(TotalDensity(conf.Pl));
       }
 
       double SCFSolver::nuclear_density_gradient(const uconf_t & conf) const {
-        return basis.nuclear_density_gradient(TotalDensity(conf.Pal+conf.Pbl));
+        return state->basis.nuclear_density_gradient(TotalDensity(conf.Pal+conf.Pbl));
+      }
+
+      double SCFSolver::confinement_derivative(const rconf_t & conf) const {
+        // Hellmann-Feynman: only the confinement potential depends on the radius
+        return arma::trace(TotalDensity(conf.Pl)*state->basis.confinement_derivative(conf_N, conf_R, iconf));
+      }
+
+      double SCFSolver::confinement_derivative(const uconf_t & conf) const {
+        return arma::trace(TotalDensity(conf.Pal+conf.Pbl)*state->basis.confinement_derivative(conf_N, conf_R, iconf));
       }
 
       double SCFSolver::vdw_radius(const rconf_t & conf, double thr) const {
-        return basis.vdw_radius(TotalDensity(conf.Pl), thr);
+        return state->basis.vdw_radius(TotalDensity(conf.Pl), thr);
       }
 
       double SCFSolver::vdw_radius(const uconf_t & conf, double thr) const {
-        return basis.vdw_radius(TotalDensity(conf.Pal+conf.Pbl), thr);
+        return state->basis.vdw_radius(TotalDensity(conf.Pal+conf.Pbl), thr);
       }
     }
   }
@@ -21,6 +21,10 @@
 #include "dftgrid.h"
 #include "../atomic/basis.h"
 #include "../atomic/dftgrid.h"
+#include "../general/diis.h"
+#include <memory>
+
+class Checkpoint;
 
 namespace helfem {
   namespace sadatom {
@@ -45,6 +49,8 @@ namespace helfem {
         arma::mat E;
         /// Orbital occupations per l channel
         arma::ivec occs;
+        /// Fractional change of the occupations per l channel (empty for none)
+        arma::vec focc;
         /// Restricted occupations?
         bool restr;
         /// Maximum angular channel
@@ -54,8 +60,12 @@ namespace helfem {
         arma::sword ShellCapacity(arma::sword l) const;
         /// Count number of occupied orbitals
         size_t CountOccupied(int l) const;
+        /// Get the number of electrons in the radial shells of channel l
+        arma::vec ShellOccupations(int l) const;
         /// Get occupied orbitals
         std::vector<shell_occupation_t> GetOccupied() const;
+        /// Occupied orbitals on the radial grid in order of l, with phases fixed to positive maxima
+        arma::mat OccupiedOrbitals(const basis::TwoDBasis & basis, arma::ivec & lval, arma::ivec & occnum, arma::vec & Eorb) const;
 
       public:
         /// Dummy constructor
@@ -80,6 +90,10 @@ namespace helfem {
         void SetLmax(int lmax);
         /// Get coefficients
         arma::cube Coeffs() const;
+        /// Get orbital energies
+        arma::mat Energies() const;
+        /// Set orbital coefficients and energies
+        void SetOrbitals(const arma::cube & C_, const arma::mat & E_);
 
         /// Counts the number of electrons
         arma::sword Nel() const;
@@ -87,6 +101,14 @@ namespace helfem {
         arma::ivec Occs() const;
         /// Sets the occupations
         void SetOccs(const arma::ivec & occs_);
+        /// Gives the fractional change of the occupations per l channel
+        arma::vec FractionalOccs() const;
+        /// Sets the fractional change of the occupations
+        void SetFractionalOccs(const arma::vec & focc_);
+        /// Gives the total (integer plus fractional) occupations per l channel
+        arma::vec TotalOccs() const;
+        /// Janak estimate of the energy derivative when the occupations change along dN
+        double OccupationDerivative(const arma::vec & dN) const;
 
         /// Get HOMO-LUMO gaps
         arma::vec GetGap() const;
@@ -97,16 +119,18 @@ namespace helfem {
         void Print(const basis::TwoDBasis & basp) const;
         /// Save radial part to disk
         void Save(const basis::TwoDBasis & basis, const std::string & symbol) const;
+        /// Save radial part at the radial points ridx into group grp of a checkpoint
+        void Save(const basis::TwoDBasis & basis, Checkpoint & chkpt, const std::string & grp, const arma::uvec & ridx) const;
 
         /// Checks if the occupations are the same
         bool operator==(const OrbitalChannel & rh) const;
 
         /// Updates the orbitals by diagonalization
-        void UpdateOrbitals(const arma::cube & Fl, const arma::mat & Sinvh);
+        void UpdateOrbitals(const arma::cube & Fl, const arma::mat & Sinvh, const helfem::utils::SymBandMatrix * Sband=NULL);
         /// Updates the orbitals by a damped diagonalization (ov and vo blocks scaled)
-        void UpdateOrbitalsDamped(const arma::cube & Fl, const arma::mat & Sinvh, const arma::mat & S, double dampov);
+        void UpdateOrbitalsDamped(const arma::cube & Fl, const arma::mat & Sinvh, const arma::mat & S, double dampov, const helfem::utils::SymBandMatrix * Sband=NULL);
         /// Updates the orbitals by diagonalization with a level shift
-        void UpdateOrbitalsShifted(const arma::cube & Fl, const arma::mat & Sinvh, const arma::mat & S, double shift);
+        void UpdateOrbitalsShifted(const arma::cube & Fl, const arma::mat & Sinvh, const arma::mat & S, double shift, const helfem::utils::SymBandMatrix * Sband=NULL);
         /// Computes a new density matrix
         void UpdateDensity(arma::cube & Pl) const;
         /// Computes a full atomic density matrix
@@ -142,6 +166,10 @@ namespace helfem {
         double Exc;
         /// Converged?
         bool converged;
+        /// Number of SCF iterations taken
+        arma::sword iterations;
+        /// DIIS history at the end of the solution, kept if DIIS is carried over
+        std::shared_ptr<::rDIIS> diis;
       } rconf_t;
       /// Checks if orbital occupations match
       bool operator==(const rconf_t & lh, const rconf_t & rh);
@@ -169,20 +197,62 @@ namespace helfem {
         double Exc;
         /// Converged?
         bool converged;
+        /// Number of SCF iterations taken
+        arma::sword iterations;
+        /// DIIS history at the end of the solution, kept if DIIS is carried over
+        std::shared_ptr<::uDIIS> diis;
       } uconf_t;
       /// Checks if orbital occupations match
       bool operator==(const uconf_t & lh, const uconf_t & rh);
       /// Orders configurations in energy
       bool operator<(const uconf_t & lh, const uconf_t & rh);
 
+      /**
+       * Basis set, one-electron matrices and two-electron integrals of
+       * a solver. These do not depend on the method, so the state is
+       * built once and shared read-only between solvers, e.g. ones
+       * running different functionals for the same atom.
+       */
+      class SolverState {
+      public:
+        /// Constructor: forms the basis set and all the integrals
+        SolverState(int Z, int finitenuc, double Rrms, int lmax, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order);
+        /// Copy of another state with range-separated exchange integrals
+        SolverState(const SolverState & base, bool yukawa, double omega);
+        /// Destructor
+        ~SolverState();
+
+        /// Maximum l value
+        int lmax;
+        /// Basis set
+        basis::TwoDBasis basis;
+        /// Overlap matrix
+        arma::mat S;
+        /// Half-inverse overlap
+        arma::mat Sinvh;
+        /// Overlap matrix in band storage
+        helfem::utils::SymBandMatrix Sband;
+        /// Kinetic energy, l-independent part
+        arma::mat T;
+        /// Kinetic energy, l-dependent part
+        arma::mat Tl;
+        /// Nuclear attraction
+        arma::mat Vnuc;
+
+        /// Kernel of the range-separated integrals
+        bool yukawa;
+        /// Range-separation parameter, zero if no range-separated integrals are available
+        double omega;
+      };
+
       /// SCF Solver
       class SCFSolver {
       protected:
         /// Maximum l value
         int lmax;
 
-        /// Basis set to use
-        basis::TwoDBasis basis;
+        /// Basis set and integrals, possibly shared with other solvers
+        std::shared_ptr<const SolverState> state;
         /// Integration grid
         dftgrid::DFTGrid grid;
 
@@ -195,17 +265,6 @@ namespace helfem {
         /// Correlation functional parameters
         arma::vec c_pars;
 
-        /// Overlap matrix
-        arma::mat S;
-        /// Half-inverse overlap
-        arma::mat Sinvh;
-
-        /// Kinetic energy, l-independent part
-        arma::mat T;
-        /// Kinetic energy, l-dependent part
-        arma::mat Tl;
-        /// Nuclear attraction
-        arma::mat Vnuc;
 	/// Confinement potential
 	arma::mat Vconf;
         /// Core Hamiltonian
@@ -226,6 +285,10 @@ namespace helfem {
         double diisthr;
         /// Number of matrices to keep in memory
         int diisorder;
+        /// Stop using ADIIS once DIIS has taken over?
+        bool adiis_stop;
+        /// Carry the DIIS history over from the seed configuration?
+        bool carry_diis;
 
         /// Verbose operation?
         bool verbose;
@@ -246,16 +309,20 @@ namespace helfem {
         /// Replicate matrix into a cube
         arma::cube ReplicateCube(const arma::mat & M) const;
 
-        /// Compute completeness profile
-        arma::mat ao_completeness_profile(const arma::vec & expn, const std::function<arma::mat(int l, const arma::vec &r)> & eval_ao) const;
-        /// Compute importance profile
-        arma::mat ao_importance_profile(const rconf_t & conf, const arma::vec & expn, const std::function<arma::mat(int l, const arma::vec &r)> & eval_ao) const;
+        /// Compute the projections of the AOs on the basis functions for every l
+        std::vector<arma::mat> ao_projections(const arma::vec & expn, const std::function<arma::mat(int l, const arma::vec &r)> & eval_ao) const;
+        /// Compute completeness profile from the AO projections
+        arma::mat ao_completeness_profile(const arma::vec & expn, const std::vector<arma::mat> & proj) const;
+        /// Compute importance profile from the AO projections
+        arma::mat ao_importance_profile(const rconf_t & conf, const arma::vec & expn, const std::vector<arma::mat> & proj) const;
       public:
         /// Constructor
         SCFSolver(int Z, int finitenuc, double Rrms, int lmax, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order, int x_func_, int c_func_, int maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_);
 	
 	SCFSolver(int Z, int finitenuc, double Rrms, int lmax, const std::shared_ptr<const polynomial_basis::PolynomialBasis> &poly, bool zeroder, int Nquad, const arma::vec & bval, int taylor_order, int x_func_, int c_func_, int
 		  maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_, int iconf_, int conf_N_, double conf_R_);
+        /// Constructor using an existing, possibly shared, state
+        SCFSolver(const std::shared_ptr<const SolverState> & state, int x_func_, int c_func_, int maxit_, double shift_, double convthr_, double dftthr_, double diiseps_, double diisthr_, int diisorder_, int iconf_, int conf_N_, double conf_R_);
         /// Destructor
         ~SCFSolver();
 
@@ -263,8 +330,22 @@ namespace helfem {
         void set_func(int x_func_, int c_func_);
         /// Set parameters
         void set_params(const arma::vec & px, const arma::vec & pc);
+        /// Change the range-separation parameter; only the range-separated integrals are recomputed
+        void set_omega(double omega);
         /// Set verbosity
         void set_verbose(bool verbose);
+        /// Cache basis functions on the DFT grid, up to the given memory in bytes
+        void set_dft_cache(size_t budget);
+        /// Print per-thread busy times of the XC quadrature
+        void set_dft_timing(bool timing);
+        /// Stop using ADIIS for good once DIIS has taken over
+        void set_adiis_stop(bool stop);
+        /// Start warm-started solutions from the DIIS history of the seed configuration
+        void set_carry_diis(bool carry);
+        /// Change the confinement radius; only the confinement potential and core Hamiltonian are rebuilt
+        void set_confinement(double conf_R_);
+        /// Get the confinement radius
+        double get_confinement() const;
 
         /// Build total density
         arma::mat TotalDensity(const arma::cube & Pl) const;
@@ -276,10 +357,21 @@ namespace helfem {
         /// Build the Fock operator, return the energy
         double FockBuild(uconf_t & conf);
 
-        /// Solve the SCF problem, return the energy
-        double Solve(rconf_t & conf);
-        /// Solve the SCF problem, return the energy
-        double Solve(uconf_t & conf);
+        /// Solve the SCF problem, return the energy. If a seed is given,
+        /// its converged orbitals are used as the starting guess
+        double Solve(rconf_t & conf, const rconf_t * seed=NULL);
+        /// Solve the SCF problem, return the energy. If a seed is given,
+        /// its converged orbitals are used as the starting guess
+        double Solve(uconf_t & conf, const uconf_t * seed=NULL);
+        /**
+         * Continue the occupations of conf along conf.occs + t dN for t
+         * from 0 to 1. Every step starts from the previous solution, and
+         * the step length is lengthened for steps that converge in at
+         * most fastit iterations and shortened for those that take at
+         * least slowit. The energies and their derivatives with respect
+         * to t are written to fname. On return, conf holds the end point.
+         */
+        void OccupationContinuation(rconf_t & conf, const arma::vec & dN, const std::string & fname, double dt=0.05, double dtmin=1e-3, double dtmax=0.25, int fastit=10, int slowit=25);
 
         /// Compute the spin-restricted effective potential
         arma::mat RestrictedPotential(rconf_t & conf);
@@ -295,16 +387,18 @@ namespace helfem {
         arma::mat LowSpinPotential(uconf_t & conf);
 
         /// Save the density functional potential
-        arma::mat XCPotential(rconf_t & conf);
+        arma::mat XCPotential(rconf_t & conf, const std::string & fname="");
         /// Save the density functional potential
-        arma::mat XCPotential(uconf_t & conf);
+        arma::mat XCPotential(uconf_t & conf, const std::string & fname="");
         /// Save the density functional ingredient
-        arma::mat XCIngredients(rconf_t & conf);
+        arma::mat XCIngredients(rconf_t & conf, const std::string & fname="");
         /// Save the density functional ingredients
-        arma::mat XCIngredients(uconf_t & conf);
+        arma::mat XCIngredients(uconf_t & conf, const std::string & fname="");
 
         /// Get the basis
         const basis::TwoDBasis & Basis() const;
+        /// Get the basis set and integrals, for sharing with other solvers
+        std::shared_ptr<const SolverState> State() const;
         /// Compute the nuclear density
         double nuclear_density(const rconf_t & conf) const;
         /// Compute the nuclear density
@@ -313,6 +407,10 @@ namespace helfem {
         double nuclear_density_gradient(const rconf_t & conf) const;
         /// Compute the nuclear density gradient
         double nuclear_density_gradient(const uconf_t & conf) const;
+        /// Compute the derivative of the energy wrt the confinement radius
+        double confinement_derivative(const rconf_t & conf) const;
+        /// Compute the derivative of the energy wrt the confinement radius
+        double confinement_derivative(const uconf_t & conf) const;
         /// Compute the van der Waals radius
         double vdw_radius(const rconf_t & conf, double thr) const;
         /// Compute the nuclear density gradient
@@ -326,6 +424,8 @@ namespace helfem {
         void gto_importance_profile(const rconf_t & conf, double minexp=1e-5, double maxexp=1e10, size_t nexp=501) const;
         /// Compute the STO importance profile
         void sto_importance_profile(const rconf_t & conf, double minexp=1e-5, double maxexp=1e10, size_t nexp=501) const;
+        /// Compute all the GTO and STO profiles and store them in a single checkpoint file
+        void ao_profiles(const rconf_t & conf, const std::string & fname, double minexp=1e-5, double maxexp=1e10, size_t nexp=501) const;
       };
     }
   }